@@ -0,0 +1,153 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "DiskCacheBenchmark.hpp"
+#include <sirikata/core/options/Options.hpp>
+#include <sirikata/core/util/Timer.hpp>
+#include <sirikata/core/util/Paths.hpp>
+#include <sirikata/core/util/AtomicTypes.hpp>
+#include <sirikata/core/transfer/LRUPolicy.hpp>
+#include <boost/filesystem.hpp>
+
+namespace Sirikata {
+
+using namespace Transfer;
+
+namespace {
+
+const char* StoreDir = "DiskCacheBenchmark";
+
+// Generates asset data when it isn't in the cache, as the network would
+class GeneratingCacheLayer : public CacheLayer {
+public:
+    GeneratingCacheLayer(uint32 asset_size)
+     : CacheLayer(NULL),
+       mAssetSize(asset_size),
+       mRequests(0)
+    {}
+
+    virtual void getData(const Fingerprint &fileId, const Range &requestedRange,
+        const TransferCallback&callback) {
+        mRequests++;
+        MutableDenseDataPtr data(new DenseData(Range(0, mAssetSize, LENGTH, true)));
+        memset(data->writableData(), fileId.rawData()[0], mAssetSize);
+        populateParentCaches(fileId, data);
+        SparseData sparse;
+        sparse.addValidData(data);
+        callback(&sparse);
+    }
+
+    uint32 requests() const { return mRequests.read(); }
+
+private:
+    uint32 mAssetSize;
+    AtomicValue<uint32> mRequests;
+};
+
+} // namespace
+
+DiskCacheBenchmark::DiskCacheBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false),
+          mLoaded(0)
+{
+    OptionValue* assets;
+    OptionValue* assetSize;
+    OptionValue* threads;
+    Sirikata::InitializeClassOptions ico("DiskCacheBenchmark",this,
+        assets=new OptionValue("assets","10000",Sirikata::OptionValueType<uint32>(),"number of assets to store and load"),
+        assetSize=new OptionValue("asset-size","16384",Sirikata::OptionValueType<uint32>(),"size of each asset in bytes"),
+        threads=new OptionValue("threads","4",Sirikata::OptionValueType<uint32>(),"number of disk cache I/O threads"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("DiskCacheBenchmark",this);
+    optionsSet->parse(param);
+
+    mNumAssets = std::max((uint32)1, assets->as<uint32>());
+    mAssetSize = std::max((uint32)1, assetSize->as<uint32>());
+    mNumThreads = std::max((uint32)1, threads->as<uint32>());
+}
+
+String DiskCacheBenchmark::name() {
+    return "disk-cache";
+}
+
+void DiskCacheBenchmark::loaded(const SparseData* data) {
+    boost::unique_lock<boost::mutex> lck(mMutex);
+    if (data == NULL)
+        SILOG(benchmark,error,"Failed to load asset");
+    mLoaded++;
+    mLoadedCV.notify_one();
+}
+
+uint32 DiskCacheBenchmark::loadAll(CacheLayer* layer, const String& pass) {
+    GeneratingCacheLayer* source = static_cast<GeneratingCacheLayer*>(layer->getNext());
+    uint32 source_requests = source->requests();
+    {
+        boost::unique_lock<boost::mutex> lck(mMutex);
+        mLoaded = 0;
+    }
+
+    Time start = Timer::now();
+    uint32 requested = 0;
+    for(; requested < mAssets.size() && !mForceStop; requested++)
+        layer->getData(mAssets[requested], Range(true), std::tr1::bind(&DiskCacheBenchmark::loaded, this, std::tr1::placeholders::_1));
+    {
+        boost::unique_lock<boost::mutex> lck(mMutex);
+        while(mLoaded < requested)
+            mLoadedCV.wait(lck);
+    }
+    Duration dur = Timer::now() - start;
+
+    uint32 hits = requested - (source->requests() - source_requests);
+    SILOG(benchmark,info,
+          pass << ": " << requested << " assets, " << hits << " from disk, " << dur << ": "
+          << float(requested)/dur.toSeconds() << " assets/s, "
+          << (float(requested)*mAssetSize/(1024*1024))/dur.toSeconds() << " MB/s");
+    return hits;
+}
+
+void DiskCacheBenchmark::start() {
+    mForceStop = false;
+
+    String dir = Path::Get(Path::DIR_TEMP, StoreDir);
+    boost::filesystem::remove_all(dir);
+
+    mAssets.resize(mNumAssets);
+    for(uint32 i = 0; i < mNumAssets; i++)
+        mAssets[i] = Fingerprint::computeDigest((const void*)&i, sizeof(i));
+
+    // Leave plenty of room so nothing gets evicted
+    cache_usize_type cache_size = (cache_usize_type)mNumAssets * mAssetSize * 2;
+    GeneratingCacheLayer source(mAssetSize);
+
+    {
+        LRUPolicy policy(cache_size, 1.f);
+        DiskCacheLayer layer(&policy, dir, &source, mNumThreads);
+        loadAll(&layer, "Fill");
+        // Destroying the layer waits for the writes to finish
+    }
+    if (mForceStop) return;
+
+    LRUPolicy policy(cache_size, 1.f);
+    Time open_start = Timer::now();
+    DiskCacheLayer layer(&policy, dir, &source, mNumThreads);
+    SILOG(benchmark,info,"Opened store with " << mNumAssets << " assets in " << (Timer::now() - open_start));
+
+    uint32 cold_hits = loadAll(&layer, "Cold");
+    if (mForceStop) return;
+    uint32 warm_hits = loadAll(&layer, "Warm");
+    if (mForceStop) return;
+
+    if (cold_hits != mNumAssets || warm_hits != mNumAssets)
+        SILOG(benchmark,error,"Not all assets were loaded from disk: " << cold_hits << " cold, " << warm_hits << " warm");
+
+    notifyFinished();
+}
+
+void DiskCacheBenchmark::stop() {
+    mForceStop = true;
+}
+
+} // namespace Sirikata
@@ -0,0 +1,55 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_DISK_CACHE_BENCHMARK_HPP_
+#define _SIRIKATA_DISK_CACHE_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+#include <sirikata/core/transfer/DiskCacheLayer.hpp>
+
+namespace Sirikata {
+
+/** Measures loading assets from the DiskCacheLayer. The cache is filled with
+ *  a set of assets, then a new layer is opened over the same store and every
+ *  asset is loaded (cold: the layer has just been opened and nothing has been
+ *  mapped yet) and loaded again (warm). Reports the time to open the store
+ *  and assets per second for each pass.
+ */
+class DiskCacheBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& param) {
+        return new DiskCacheBenchmark(finished_cb, param);
+    }
+
+    DiskCacheBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    // Loads all the assets through layer, returning how many were found
+    // without going to the source.
+    uint32 loadAll(Transfer::CacheLayer* layer, const String& pass);
+    void loaded(const Transfer::SparseData* data);
+
+    bool mForceStop;
+
+    uint32 mNumAssets;
+    uint32 mAssetSize;
+    uint32 mNumThreads;
+
+    std::vector<Transfer::Fingerprint> mAssets;
+
+    boost::mutex mMutex;
+    boost::condition_variable mLoadedCV;
+    uint32 mLoaded;
+}; // class DiskCacheBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_DISK_CACHE_BENCHMARK_HPP_
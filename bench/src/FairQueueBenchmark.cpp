@@ -0,0 +1,108 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "FairQueueBenchmark.hpp"
+#include <sirikata/core/queue/FairQueue.hpp>
+#include <sirikata/core/queue/DRRFairQueue.hpp>
+#include <sirikata/core/util/Random.hpp>
+#include <boost/lexical_cast.hpp>
+
+#define DEFAULT_NUM_POPS 2000000
+#define MAX_KEYS 1000
+
+namespace Sirikata {
+
+namespace {
+struct BenchMessage {
+    BenchMessage(uint32 sz)
+     : mSize(sz)
+    {}
+
+    uint32 size() const {
+        return mSize;
+    }
+
+    uint32 mSize;
+};
+typedef Queue<BenchMessage*> BenchMessageQueue;
+}
+
+FairQueueBenchmark::FairQueueBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mNumPops(DEFAULT_NUM_POPS),
+          mForceStop(false)
+{
+    if (!param.empty()) {
+        try {
+            mNumPops = boost::lexical_cast<uint32>(param);
+        } catch(boost::bad_lexical_cast&) {
+            SILOG(benchmark,error,"Invalid message count '" << param << "', using " << mNumPops);
+        }
+    }
+}
+
+String FairQueueBenchmark::name() {
+    return "fair-queue";
+}
+
+template<typename FairQueueType>
+void FairQueueBenchmark::run(const String& queue_name, uint32 nkeys) {
+    if (mForceStop) return;
+
+    // Same weights and sizes for both implementations
+    srand(nkeys);
+
+    FairQueueType queue;
+    std::vector<BenchMessage*> messages;
+    for(uint32 key = 0; key < nkeys; key++) {
+        queue.addQueue(new BenchMessageQueue(1 << 20), key, randFloat(0.5f, 4.f));
+        // Two messages per queue, each reinserted as soon as it's popped, so
+        // every queue stays backlogged
+        uint32 msg_size = randInt<uint32>(64, 1024);
+        for(uint32 i = 0; i < 2; i++) {
+            messages.push_back(new BenchMessage(msg_size));
+            queue.push(key, messages.back());
+        }
+    }
+
+    uint64 bytes = 0;
+    Time start_time = Timer::now();
+    for(uint32 i = 0; i < mNumPops; i++) {
+        uint32 key;
+        BenchMessage* msg = queue.pop(&key);
+        bytes += msg->size();
+        queue.push(key, msg);
+    }
+    Time end_time = Timer::now();
+    Duration dur = end_time - start_time;
+
+    SILOG(benchmark,info,
+          queue_name << ", " << nkeys << " keys: "
+          << mNumPops << " messages, " << bytes << " bytes, " << dur << ": "
+          << (dur.toMicroseconds()*1000/float(mNumPops)) << "ns/message, "
+          << float(mNumPops)/dur.toSeconds() << " messages/s");
+
+    for(uint32 i = 0; i < messages.size(); i++)
+        delete messages[i];
+}
+
+void FairQueueBenchmark::start() {
+    mForceStop = false;
+
+    for(uint32 nkeys = 10; nkeys <= MAX_KEYS && !mForceStop; nkeys *= 10) {
+        run< FairQueue<BenchMessage, uint32, BenchMessageQueue> >("FairQueue", nkeys);
+        run< DRRFairQueue<BenchMessage, uint32, BenchMessageQueue> >("DRRFairQueue", nkeys);
+    }
+
+    if (mForceStop)
+        return;
+
+    notifyFinished();
+}
+
+void FairQueueBenchmark::stop() {
+    mForceStop = true;
+}
+
+} // namespace Sirikata
@@ -0,0 +1,42 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_FAIR_QUEUE_BENCHMARK_HPP_
+#define _SIRIKATA_FAIR_QUEUE_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+
+namespace Sirikata {
+
+/** Compares the cost of selecting messages with FairQueue (weighted fair
+ *  queuing) and DRRFairQueue (deficit round robin) for 10 to 1000 input
+ *  queues with random weights and message sizes, keeping every queue
+ *  backlogged. The parameter is the number of messages to pop for each run.
+ */
+class FairQueueBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& _param) {
+        return new FairQueueBenchmark(finished_cb, _param);
+    }
+
+    FairQueueBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    template<typename FairQueueType>
+    void run(const String& queue_name, uint32 nkeys);
+
+    uint32 mNumPops;
+    bool mForceStop;
+}; // class FairQueueBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_FAIR_QUEUE_BENCHMARK_HPP_
@@ -0,0 +1,230 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "InterServerBenchmark.hpp"
+#include "../../libspace/src/TCPSpaceNetwork.hpp"
+#include <sirikata/space/SpaceContext.hpp>
+#include <sirikata/space/ServerMessage.hpp>
+#include <sirikata/core/network/IOService.hpp>
+#include <sirikata/core/network/IOStrand.hpp>
+#include <sirikata/core/network/IOStrandImpl.hpp>
+#include <sirikata/core/network/Address4.hpp>
+#include <sirikata/core/network/ServerIDMap.hpp>
+#include <sirikata/core/options/Options.hpp>
+#include <sirikata/core/util/PluginManager.hpp>
+#include <sirikata/core/util/Timer.hpp>
+
+namespace Sirikata {
+
+namespace {
+
+const ServerID ReceiverID = 1;
+// Sending server for each phase
+const ServerID SenderIDs[] = { 2, 3 };
+
+// Only the receiver listens, so it's the only server with an address
+class LoopbackServerIDMap : public ServerIDMap {
+  public:
+    LoopbackServerIDMap(Context* ctx, const String& port)
+     : ServerIDMap(ctx),
+       mAddress(Network::Address("127.0.0.1", port))
+    {}
+
+    virtual void lookupInternal(const ServerID& sid, Address4LookupCallback cb) {
+        mContext->ioService->post(std::tr1::bind(cb, sid, (sid == ReceiverID ? mAddress : Address4::Null)), "LoopbackServerIDMap::lookupInternal");
+    }
+    virtual void lookupExternal(const ServerID& sid, Address4LookupCallback cb) {
+        mContext->ioService->post(std::tr1::bind(cb, sid, Address4::Null), "LoopbackServerIDMap::lookupExternal");
+    }
+    virtual void lookupRandomExternal(Address4LookupCallback cb) {
+        mContext->ioService->post(std::tr1::bind(cb, NullServerID, Address4::Null), "LoopbackServerIDMap::lookupRandomExternal");
+    }
+
+  private:
+    Address4 mAddress;
+};
+
+} // namespace
+
+InterServerBenchmark::InterServerBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false),
+          mIOService(NULL),
+          mIOStrand(NULL),
+          mServerIDMap(NULL),
+          mReceiverContext(NULL),
+          mReceiverNetwork(NULL),
+          mPhase(Unbatched),
+          mPhaseStarted(false),
+          mSent(0),
+          mReceived(0)
+{
+    for(uint32 i = 0; i < NumPhases; i++) {
+        mSenderContexts[i] = NULL;
+        mSenderNetworks[i] = NULL;
+        mSendStreams[i] = NULL;
+        mMessages[i] = NULL;
+    }
+
+    OptionValue* messages;
+    OptionValue* messageSize;
+    OptionValue* batchBytes;
+    OptionValue* port;
+    OptionValue* streamOptions;
+    OptionValue* whichPlugin;
+    Sirikata::InitializeClassOptions ico("InterServerBenchmark",this,
+        messages=new OptionValue("messages","200000",Sirikata::OptionValueType<uint32>(),"number of messages to send in each phase"),
+        messageSize=new OptionValue("message-size","200",Sirikata::OptionValueType<uint32>(),"size of each message's payload in bytes"),
+        batchBytes=new OptionValue("batch-bytes","16384",Sirikata::OptionValueType<uint32>(),"maximum size of a batched write, as in spacestreambatchsize"),
+        port=new OptionValue("port","4092",Sirikata::OptionValueType<String>(),"port to listen on"),
+        streamOptions=new OptionValue("stream-options","--send-buffer-size=32768 --parallel-sockets=1 --no-delay=true",Sirikata::OptionValueType<String>(),"options passed to the stream plugin, as in spacestreamoptions"),
+        whichPlugin=new OptionValue("stream-plugin","tcpsst",Sirikata::OptionValueType<String>(),"which plugin to load for streams, as in spacestreamlib"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("InterServerBenchmark",this);
+    optionsSet->parse(param);
+
+    mNumMessages = std::max((uint32)1, messages->as<uint32>());
+    mMessageSize = std::max((uint32)1, messageSize->as<uint32>());
+    mBatchBytes = batchBytes->as<uint32>();
+    mPort = port->as<String>();
+    mStreamOptions = streamOptions->as<String>();
+    mStreamPlugin = whichPlugin->as<String>();
+}
+
+InterServerBenchmark::~InterServerBenchmark() {
+    delete mReceiverNetwork;
+    delete mReceiverContext;
+    for(uint32 i = 0; i < NumPhases; i++) {
+        delete mMessages[i];
+        delete mSenderNetworks[i];
+        delete mSenderContexts[i];
+    }
+    delete mServerIDMap;
+    delete mIOStrand;
+    delete mIOService;
+}
+
+String InterServerBenchmark::name() {
+    return "inter-server";
+}
+
+void InterServerBenchmark::networkReadyToSend(const ServerID& from) {
+    // Only the senders' streams to the receiver carry any data
+    if (from != ReceiverID) return;
+    sendMessages();
+}
+
+void InterServerBenchmark::networkReceivedConnection(SpaceNetwork::ReceiveStream* strm) {
+}
+
+void InterServerBenchmark::networkReceivedData(SpaceNetwork::ReceiveStream* strm) {
+    if (mForceStop) return;
+
+    // We're only notified when the stream goes from empty to non-empty, so
+    // it has to be drained completely
+    Network::Chunk* chunk = NULL;
+    while( (chunk = strm->pop()) != NULL ) {
+        delete chunk;
+        mReceived++;
+    }
+
+    if (mReceived == mNumMessages)
+        finishPhase();
+}
+
+void InterServerBenchmark::startPhase(Phase phase) {
+    mPhase = phase;
+    mPhaseStarted = false;
+    mSent = 0;
+    mReceived = 0;
+    // Connecting notifies us when the stream is ready, which starts sending
+    SpaceNetwork::SendStream* strm = mSenderNetworks[mPhase]->connect(mIOStrand, ReceiverID);
+    mSendStreams[mPhase] = strm;
+    sendMessages();
+}
+
+void InterServerBenchmark::sendMessages() {
+    if (mForceStop) return;
+
+    SpaceNetwork::SendStream* strm = mSendStreams[mPhase];
+    // Notifications can arrive while connect() is still setting up the stream
+    if (strm == NULL) return;
+
+    while(mSent < mNumMessages) {
+        if (strm->send(mMessages[mPhase]) == 0)
+            return;
+        if (!mPhaseStarted) {
+            mPhaseStart = Timer::now();
+            mPhaseStarted = true;
+        }
+        mSent++;
+    }
+    strm->flush();
+}
+
+void InterServerBenchmark::finishPhase() {
+    Duration dur = Timer::now() - mPhaseStart;
+
+    SILOG(benchmark,info,
+        (mPhase == Unbatched ? "Unbatched" : "Batched") << ": "
+        << mNumMessages << " messages of " << mMessages[mPhase]->serializedSize() << " bytes in "
+        << dur << ": "
+        << float(mNumMessages)/dur.toSeconds() << " messages/s, "
+        << float(mNumMessages)*mMessages[mPhase]->serializedSize()/dur.toSeconds()/(1024*1024) << " MB/s");
+
+    if (mPhase == Unbatched)
+        startPhase(Batched);
+    else
+        stop();
+}
+
+void InterServerBenchmark::start() {
+    static PluginManager pluginManager;
+    pluginManager.load(mStreamPlugin);
+    mForceStop = false;
+
+    mIOService = new Network::IOService("InterServerBenchmark");
+    mIOStrand = mIOService->createStrand("InterServerBenchmark Main");
+
+    mReceiverContext = new SpaceContext("InterServerBenchmark Receiver", ReceiverID, NULL, NULL, mIOService, mIOStrand, Timer::now(), NULL);
+    mServerIDMap = new LoopbackServerIDMap(mReceiverContext, mPort);
+
+    mReceiverNetwork = new TCPSpaceNetwork(mReceiverContext, mStreamPlugin, mStreamOptions, mBatchBytes);
+    mReceiverNetwork->setServerIDMap(mServerIDMap);
+    mReceiverNetwork->setSendListener(this);
+    mReceiverNetwork->listen(ReceiverID, this);
+
+    String payload(mMessageSize, 'a');
+    for(uint32 i = 0; i < NumPhases; i++) {
+        mSenderContexts[i] = new SpaceContext("InterServerBenchmark Sender", SenderIDs[i], NULL, NULL, mIOService, mIOStrand, Timer::now(), NULL);
+        mSenderNetworks[i] = new TCPSpaceNetwork(mSenderContexts[i], mStreamPlugin, mStreamOptions, (i == Unbatched ? 0 : mBatchBytes));
+        mSenderNetworks[i]->setServerIDMap(mServerIDMap);
+        mSenderNetworks[i]->setSendListener(this);
+        // Senders have no address so they won't actually listen, but the
+        // receive side of their connections still reports to us
+        mSenderNetworks[i]->listen(SenderIDs[i], this);
+        mMessages[i] = new Message(SenderIDs[i], SERVER_PORT_OBJECT_MESSAGE_ROUTING, ReceiverID, SERVER_PORT_OBJECT_MESSAGE_ROUTING, payload);
+    }
+
+    // Give the receiver a chance to start listening before connecting
+    mIOStrand->post(
+        std::tr1::bind(&InterServerBenchmark::startPhase, this, Unbatched),
+        "InterServerBenchmark::startPhase"
+    );
+
+    mIOService->run();
+}
+
+void InterServerBenchmark::stop() {
+    if (mForceStop) return;
+    mForceStop = true;
+
+    if (mIOService)
+        mIOService->stop();
+
+    notifyFinished();
+}
+
+} // namespace Sirikata
@@ -0,0 +1,86 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_INTER_SERVER_BENCHMARK_HPP_
+#define _SIRIKATA_INTER_SERVER_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+#include <sirikata/space/SpaceNetwork.hpp>
+
+namespace Sirikata {
+
+class SpaceContext;
+class ServerIDMap;
+class Message;
+
+/** Measures the throughput of TCPSpaceNetwork, the network connecting space
+ *  servers. A receiving network listens on loopback and a fixed number of
+ *  server messages are pushed to it through a send stream, first from a
+ *  network with batching disabled and then from one batching up to
+ *  batch-bytes per write, the same way spacestreambatchsize configures it.
+ */
+class InterServerBenchmark : public Benchmark, public SpaceNetwork::SendListener, public SpaceNetwork::ReceiveListener {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& param) {
+        return new InterServerBenchmark(finished_cb, param);
+    }
+
+    InterServerBenchmark(const FinishedCallback& finished_cb, const String& param);
+    ~InterServerBenchmark();
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    enum Phase {
+        Unbatched,
+        Batched,
+        NumPhases
+    };
+
+    // SpaceNetwork::SendListener Interface
+    virtual void networkReadyToSend(const ServerID& from);
+    // SpaceNetwork::ReceiveListener Interface
+    virtual void networkReceivedConnection(SpaceNetwork::ReceiveStream* strm);
+    virtual void networkReceivedData(SpaceNetwork::ReceiveStream* strm);
+
+    void sendMessages();
+    void startPhase(Phase phase);
+    void finishPhase();
+
+    bool mForceStop;
+
+    uint32 mNumMessages;
+    uint32 mMessageSize;
+    uint32 mBatchBytes;
+    String mStreamOptions;
+    String mStreamPlugin;
+    String mPort;
+
+    Network::IOService* mIOService;
+    Network::IOStrand* mIOStrand;
+    ServerIDMap* mServerIDMap;
+    // The receiving server and one sending server per phase, since the batch
+    // size is fixed when the network is created
+    SpaceContext* mReceiverContext;
+    SpaceNetwork* mReceiverNetwork;
+    SpaceContext* mSenderContexts[NumPhases];
+    SpaceNetwork* mSenderNetworks[NumPhases];
+    SpaceNetwork::SendStream* mSendStreams[NumPhases];
+    Message* mMessages[NumPhases];
+
+    Phase mPhase;
+    bool mPhaseStarted;
+    Time mPhaseStart;
+    uint32 mSent;
+    uint32 mReceived;
+}; // class InterServerBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_INTER_SERVER_BENCHMARK_HPP_
@@ -0,0 +1,234 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "LocEncodingBenchmark.hpp"
+#include <sirikata/core/options/Options.hpp>
+#include <sirikata/core/util/Random.hpp>
+#include <sirikata/core/util/Timer.hpp>
+#include <sirikata/core/util/CompactLocEncoding.hpp>
+#include <sirikata/core/network/Message.hpp>
+#include <boost/lexical_cast.hpp>
+#include <fstream>
+
+#include "Protocol_Loc.pbj.hpp"
+
+namespace Sirikata {
+
+LocEncodingBenchmark::LocEncodingBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false)
+{
+    OptionValue* trace;
+    OptionValue* objects;
+    OptionValue* updates;
+    OptionValue* maxPerResult;
+    OptionValue* precision;
+    Sirikata::InitializeClassOptions ico("LocEncodingBenchmark",this,
+        trace=new OptionValue("trace","",Sirikata::OptionValueType<String>(),"motion trace to encode. If empty, a trace is generated"),
+        objects=new OptionValue("objects","1000",Sirikata::OptionValueType<uint32>(),"number of objects in a generated trace"),
+        updates=new OptionValue("updates","100000",Sirikata::OptionValueType<uint32>(),"number of updates in a generated trace"),
+        maxPerResult=new OptionValue("max-per-result","5",Sirikata::OptionValueType<uint32>(),"maximum number of updates per message, as in loc.max-per-result"),
+        precision=new OptionValue("precision","0.001",Sirikata::OptionValueType<float32>(),"precision of positions and velocities in compact updates"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("LocEncodingBenchmark",this);
+    optionsSet->parse(param);
+
+    mTraceFile = trace->as<String>();
+    mNumObjects = std::max((uint32)1, objects->as<uint32>());
+    mNumUpdates = std::max((uint32)1, updates->as<uint32>());
+    mMaxPerResult = std::max((uint32)1, maxPerResult->as<uint32>());
+    mPrecision = precision->as<float32>();
+}
+
+String LocEncodingBenchmark::name() {
+    return "loc-encoding";
+}
+
+void LocEncodingBenchmark::addObject(uint32 idx) {
+    if (idx < mObjects.size()) return;
+    uint32 first = mObjects.size();
+    mObjects.resize(idx+1);
+    for(uint32 i = first; i <= idx; i++) {
+        TraceObject& obj = mObjects[i];
+        obj.id = UUID::random();
+        obj.bounds = AggregateBoundingInfo(Vector3f::zero(), 0.f, randFloat(0.5f, 2.f));
+        obj.mesh = "meerkat:///sirikata/models/avatar" + boost::lexical_cast<String>(i % 10) + ".dae/optimized/0/avatar.dae";
+        obj.physics = "{\"treatment\":\"dynamic\",\"bounds\":\"sphere\",\"mass\":1}";
+    }
+}
+
+bool LocEncodingBenchmark::loadTrace() {
+    std::ifstream fp(mTraceFile.c_str());
+    if (!fp) return false;
+
+    int64 t_us;
+    uint32 idx;
+    float32 px, py, pz, vx, vy, vz, qx, qy, qz, qw;
+    while(fp >> t_us >> idx >> px >> py >> pz >> vx >> vy >> vz >> qx >> qy >> qz >> qw) {
+        addObject(idx);
+        Time t = Time::null() + Duration::microseconds(t_us);
+        TraceUpdate up;
+        up.object = idx;
+        up.location = TimedMotionVector3f(t, MotionVector3f(Vector3f(px, py, pz), Vector3f(vx, vy, vz)));
+        up.orientation = TimedMotionQuaternion(t, MotionQuaternion(Quaternion(qx, qy, qz, qw, Quaternion::XYZW()), Quaternion::identity()));
+        mTrace.push_back(up);
+    }
+    return !mTrace.empty();
+}
+
+void LocEncodingBenchmark::generateTrace() {
+    srand(mNumObjects);
+    addObject(mNumObjects-1);
+
+    // Avatars wandering around a shared area, each changing direction now and
+    // then, which is when updates get generated.
+    std::vector<TraceUpdate> current(mNumObjects);
+    Time t = Time::null() + Duration::seconds(1000.f);
+    for(uint32 i = 0; i < mNumObjects; i++) {
+        current[i].object = i;
+        current[i].location = TimedMotionVector3f(t, MotionVector3f(Vector3f(randFloat(-200.f, 200.f), randFloat(-200.f, 200.f), 0.f), Vector3f::zero()));
+        current[i].orientation = TimedMotionQuaternion(t, MotionQuaternion(Quaternion::identity(), Quaternion::identity()));
+    }
+
+    for(uint32 u = 0; u < mNumUpdates; u++) {
+        t += Duration::microseconds((int64)randInt<int32>(0, 2000));
+        TraceUpdate& up = current[randInt<uint32>(0, mNumObjects-1)];
+        float32 heading = randFloat(0.f, 6.2831853f);
+        float32 speed = (randInt<int32>(0, 3) == 0) ? 0.f : randFloat(1.f, 5.f);
+        up.location = TimedMotionVector3f(t, MotionVector3f(up.location.extrapolate(t).position(), Vector3f(cos(heading), sin(heading), 0.f) * speed));
+        up.orientation = TimedMotionQuaternion(t, MotionQuaternion(Quaternion(Vector3f(0.f, 0.f, 1.f), heading), Quaternion::identity()));
+        mTrace.push_back(up);
+    }
+}
+
+uint64 LocEncodingBenchmark::encodePBJ() {
+    // Mirrors AlwaysLocationUpdatePolicy, which includes every field in every
+    // update.
+    uint64 bytes = 0;
+    uint64 seqno = 0;
+    uint32 idx = 0;
+    while(idx < mTrace.size() && !mForceStop) {
+        Sirikata::Protocol::Loc::BulkLocationUpdate bulk_update;
+        for(uint32 count = 0; count < mMaxPerResult && idx < mTrace.size(); count++, idx++) {
+            const TraceUpdate& tu = mTrace[idx];
+            const TraceObject& obj = mObjects[tu.object];
+
+            Sirikata::Protocol::Loc::ILocationUpdate update = bulk_update.add_update();
+            update.set_object(obj.id);
+            update.set_seqno(seqno++);
+
+            Sirikata::Protocol::ITimedMotionVector location = update.mutable_location();
+            location.set_t(tu.location.updateTime());
+            location.set_position(tu.location.position());
+            location.set_velocity(tu.location.velocity());
+
+            Sirikata::Protocol::ITimedMotionQuaternion orientation = update.mutable_orientation();
+            orientation.set_t(tu.orientation.updateTime());
+            orientation.set_position(tu.orientation.position());
+            orientation.set_velocity(tu.orientation.velocity());
+
+            Sirikata::Protocol::IAggregateBoundingInfo msg_bounds = update.mutable_aggregate_bounds();
+            msg_bounds.set_center_offset(obj.bounds.centerOffset);
+            msg_bounds.set_center_bounds_radius(obj.bounds.centerBoundsRadius);
+            msg_bounds.set_max_object_size(obj.bounds.maxObjectRadius);
+
+            update.set_mesh(obj.mesh);
+            update.set_physics(obj.physics);
+        }
+        bytes += serializePBJMessage(bulk_update).size();
+    }
+    return bytes;
+}
+
+uint64 LocEncodingBenchmark::encodeCompact(uint32* decoded) {
+    CompactLocEncoder encoder(mPrecision);
+    CompactLocDecoder decoder;
+    std::vector<bool> sent(mObjects.size(), false);
+    std::vector<CompactLocRecord> records;
+
+    uint64 bytes = 0;
+    uint64 seqno = 0;
+    uint32 idx = 0;
+    *decoded = 0;
+    while(idx < mTrace.size() && !mForceStop) {
+        for(uint32 count = 0; count < mMaxPerResult && idx < mTrace.size(); count++, idx++) {
+            const TraceUpdate& tu = mTrace[idx];
+            const TraceObject& obj = mObjects[tu.object];
+
+            CompactLocRecord rec;
+            rec.object = obj.id;
+            rec.seqno = seqno++;
+            rec.fields = CompactLocRecord::LocationField | CompactLocRecord::OrientationField;
+            rec.location = tu.location;
+            rec.orientation = tu.orientation;
+            // The first update, when the subscription is added, is complete,
+            // the rest only contain the motion that changed
+            if (!sent[tu.object]) {
+                rec.fields |= CompactLocRecord::BoundsField | CompactLocRecord::MeshField | CompactLocRecord::PhysicsField;
+                rec.bounds = obj.bounds;
+                rec.mesh = obj.mesh;
+                rec.physics = obj.physics;
+                sent[tu.object] = true;
+            }
+            encoder.add(rec);
+        }
+
+        String msg;
+        uint32 msg_id = encoder.finish(&msg);
+        bytes += msg.size();
+        // Assume messages are delivered before the next one is generated
+        encoder.delivered(msg_id);
+
+        records.clear();
+        decoder.decode(msg.data(), msg.size(), &records);
+        *decoded += records.size();
+    }
+    return bytes;
+}
+
+void LocEncodingBenchmark::report(const String& method, uint64 bytes, const Duration& dur) {
+    SILOG(benchmark,info,
+          method << ": " << mTrace.size() << " updates, " << bytes << " bytes, "
+          << (bytes/float(mTrace.size())) << " bytes/update, " << dur);
+}
+
+void LocEncodingBenchmark::start() {
+    mForceStop = false;
+
+    if (!mTraceFile.empty()) {
+        if (!loadTrace()) {
+            SILOG(benchmark,error,"Couldn't load motion trace from " << mTraceFile);
+            notifyFinished();
+            return;
+        }
+    }
+    else {
+        generateTrace();
+    }
+
+    Time pbj_start = Timer::now();
+    uint64 pbj_bytes = encodePBJ();
+    report("PBJ", pbj_bytes, Timer::now() - pbj_start);
+
+    uint32 decoded = 0;
+    Time compact_start = Timer::now();
+    uint64 compact_bytes = encodeCompact(&decoded);
+    report("Compact", compact_bytes, Timer::now() - compact_start);
+
+    if (mForceStop)
+        return;
+
+    if (decoded != mTrace.size())
+        SILOG(benchmark,error,"Only decoded " << decoded << " of " << mTrace.size() << " compact updates");
+    SILOG(benchmark,info,"Compact updates are " << (compact_bytes/float(pbj_bytes)) << " of the size of PBJ updates");
+
+    notifyFinished();
+}
+
+void LocEncodingBenchmark::stop() {
+    mForceStop = true;
+}
+
+} // namespace Sirikata
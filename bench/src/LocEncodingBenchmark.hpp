@@ -0,0 +1,76 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_LOC_ENCODING_BENCHMARK_HPP_
+#define _SIRIKATA_LOC_ENCODING_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+#include <sirikata/core/util/UUID.hpp>
+#include <sirikata/core/util/MotionVector.hpp>
+#include <sirikata/core/util/MotionQuaternion.hpp>
+#include <sirikata/core/util/AggregateBoundingInfo.hpp>
+
+namespace Sirikata {
+
+/** Compares the size of location updates sent to a single subscriber encoded
+ *  as Protocol::Loc::BulkLocationUpdates, which always contain every field,
+ *  against CompactLocEncoder, which only includes changed fields and quantizes
+ *  them. Updates come from a motion trace, either loaded from a file or
+ *  generated, and the benchmark reports bytes per update for each encoding.
+ *
+ *  Trace files have one update per line:
+ *    time_us object_index px py pz vx vy vz qx qy qz qw
+ */
+class LocEncodingBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& param) {
+        return new LocEncodingBenchmark(finished_cb, param);
+    }
+
+    LocEncodingBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    struct TraceObject {
+        UUID id;
+        AggregateBoundingInfo bounds;
+        String mesh;
+        String physics;
+    };
+    struct TraceUpdate {
+        uint32 object;
+        TimedMotionVector3f location;
+        TimedMotionQuaternion orientation;
+    };
+
+    bool loadTrace();
+    void generateTrace();
+    void addObject(uint32 idx);
+
+    uint64 encodePBJ();
+    // Also decodes the results to make sure no updates were lost
+    uint64 encodeCompact(uint32* decoded);
+    void report(const String& method, uint64 bytes, const Duration& dur);
+
+    bool mForceStop;
+
+    String mTraceFile;
+    uint32 mNumObjects;
+    uint32 mNumUpdates;
+    uint32 mMaxPerResult;
+    float32 mPrecision;
+
+    std::vector<TraceObject> mObjects;
+    std::vector<TraceUpdate> mTrace;
+}; // class LocEncodingBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_LOC_ENCODING_BENCHMARK_HPP_
@@ -0,0 +1,221 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "LocSubscriberIndexBenchmark.hpp"
+#include <sirikata/core/options/Options.hpp>
+#include <sirikata/core/util/Random.hpp>
+#include <sirikata/core/util/Timer.hpp>
+#include <sirikata/core/util/MotionVector.hpp>
+
+#include "../../libspace/plugins/standard/DirtyUpdateList.hpp"
+
+namespace Sirikata {
+
+namespace {
+
+struct FanoutUpdate {
+    uint8 fields;
+    TimedMotionVector3f location;
+};
+
+typedef std::set<uint32> FanoutIndexSet;
+
+// The layout AlwaysLocationUpdatePolicy originally used
+struct OrderedIndex {
+    struct Subscriber {
+        std::map<UUID, FanoutIndexSet> objectIndexes;
+        std::map<UUID, FanoutUpdate> outstandingUpdates;
+    };
+    typedef std::tr1::shared_ptr<Subscriber> SubscriberPtr;
+    std::map<UUID, SubscriberPtr> subscriptions;
+    std::map<UUID, std::set<UUID>*> objectSubscribers;
+
+    ~OrderedIndex() {
+        for(std::map<UUID, std::set<UUID>*>::iterator it = objectSubscribers.begin(); it != objectSubscribers.end(); it++)
+            delete it->second;
+    }
+
+    void subscribe(const UUID& sub, const UUID& obj) {
+        SubscriberPtr& info = subscriptions[sub];
+        if (!info) info = SubscriberPtr(new Subscriber());
+        info->objectIndexes[obj] = FanoutIndexSet();
+        std::set<UUID>*& subs = objectSubscribers[obj];
+        if (subs == NULL) subs = new std::set<UUID>();
+        subs->insert(sub);
+    }
+
+    void updated(const UUID& obj, const TimedMotionVector3f& loc) {
+        std::map<UUID, std::set<UUID>*>::iterator obj_it = objectSubscribers.find(obj);
+        if (obj_it == objectSubscribers.end()) return;
+        for(std::set<UUID>::iterator sub_it = obj_it->second->begin(); sub_it != obj_it->second->end(); sub_it++) {
+            if (subscriptions.find(*sub_it) == subscriptions.end()) continue;
+            SubscriberPtr info = subscriptions[*sub_it];
+            if (info->objectIndexes.find(obj) == info->objectIndexes.end()) continue;
+            if (info->outstandingUpdates.find(obj) == info->outstandingUpdates.end())
+                info->outstandingUpdates[obj] = FanoutUpdate();
+            FanoutUpdate& up = info->outstandingUpdates[obj];
+            up.location = loc;
+            up.fields |= 0x02;
+        }
+    }
+
+    uint64 service() {
+        uint64 count = 0;
+        for(std::map<UUID, SubscriberPtr>::iterator it = subscriptions.begin(); it != subscriptions.end(); it++) {
+            count += it->second->outstandingUpdates.size();
+            it->second->outstandingUpdates.clear();
+        }
+        return count;
+    }
+};
+
+// The layout AlwaysLocationUpdatePolicy uses now
+struct HashedIndex {
+    struct Subscriber {
+        std::tr1::unordered_map<UUID, FanoutIndexSet, UUID::Hasher> objectIndexes;
+        DirtyUpdateList<FanoutUpdate> dirtyUpdates;
+    };
+    typedef std::tr1::shared_ptr<Subscriber> SubscriberPtr;
+    typedef std::tr1::unordered_map<UUID, SubscriberPtr, UUID::Hasher> SubscriberMap;
+    SubscriberMap subscriptions;
+    typedef std::tr1::unordered_map<UUID, std::vector<UUID>, UUID::Hasher> ObjectSubscribersMap;
+    ObjectSubscribersMap objectSubscribers;
+
+    void subscribe(const UUID& sub, const UUID& obj) {
+        SubscriberPtr& info = subscriptions[sub];
+        if (!info) info = SubscriberPtr(new Subscriber());
+        info->objectIndexes[obj] = FanoutIndexSet();
+        std::vector<UUID>& subs = objectSubscribers[obj];
+        if (std::find(subs.begin(), subs.end(), sub) == subs.end())
+            subs.push_back(sub);
+    }
+
+    void updated(const UUID& obj, const TimedMotionVector3f& loc) {
+        ObjectSubscribersMap::iterator obj_it = objectSubscribers.find(obj);
+        if (obj_it == objectSubscribers.end()) return;
+        const std::vector<UUID>& subs = obj_it->second;
+        for(uint32 i = 0; i < subs.size(); i++) {
+            SubscriberMap::iterator sub_it = subscriptions.find(subs[i]);
+            if (sub_it == subscriptions.end()) continue;
+            Subscriber* info = sub_it->second.get();
+            if (info->objectIndexes.find(obj) == info->objectIndexes.end()) continue;
+            FanoutUpdate* up = info->dirtyUpdates.find(obj);
+            if (up == NULL)
+                up = &(info->dirtyUpdates.add(obj, FanoutUpdate()));
+            up->location = loc;
+            up->fields |= 0x02;
+        }
+    }
+
+    uint64 service() {
+        uint64 count = 0;
+        for(SubscriberMap::iterator it = subscriptions.begin(); it != subscriptions.end(); it++) {
+            count += it->second->dirtyUpdates.size();
+            it->second->dirtyUpdates.eraseFront(it->second->dirtyUpdates.size());
+        }
+        return count;
+    }
+};
+
+} // namespace
+
+LocSubscriberIndexBenchmark::LocSubscriberIndexBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false)
+{
+    OptionValue* subscribers;
+    OptionValue* objects;
+    OptionValue* perSubscriber;
+    OptionValue* updates;
+    OptionValue* serviceInterval;
+    Sirikata::InitializeClassOptions ico("LocSubscriberIndexBenchmark",this,
+        subscribers=new OptionValue("subscribers","1000",Sirikata::OptionValueType<uint32>(),"number of subscribers"),
+        objects=new OptionValue("objects","10000",Sirikata::OptionValueType<uint32>(),"number of objects subscribers can subscribe to"),
+        perSubscriber=new OptionValue("subscriptions","50",Sirikata::OptionValueType<uint32>(),"number of objects each subscriber is subscribed to"),
+        updates=new OptionValue("updates","1000000",Sirikata::OptionValueType<uint32>(),"number of object location changes"),
+        serviceInterval=new OptionValue("service-interval","1000",Sirikata::OptionValueType<uint32>(),"number of changes between clearing out pending updates, as if they were sent"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("LocSubscriberIndexBenchmark",this);
+    optionsSet->parse(param);
+
+    mNumSubscribers = std::max((uint32)1, subscribers->as<uint32>());
+    mNumObjects = std::max((uint32)1, objects->as<uint32>());
+    mSubscriptionsPerSubscriber = std::min(mNumObjects, perSubscriber->as<uint32>());
+    mNumUpdates = updates->as<uint32>();
+    mServiceInterval = std::max((uint32)1, serviceInterval->as<uint32>());
+}
+
+String LocSubscriberIndexBenchmark::name() {
+    return "loc-fanout";
+}
+
+template<typename IndexType>
+uint64 LocSubscriberIndexBenchmark::run(const String& method) {
+    IndexType index;
+    for(uint32 i = 0; i < mSubscriptions.size(); i++)
+        index.subscribe(mSubscribers[mSubscriptions[i].first], mObjects[mSubscriptions[i].second]);
+
+    Time t = Time::null() + Duration::seconds(100.f);
+    TimedMotionVector3f loc(t, MotionVector3f(Vector3f(1.f, 2.f, 3.f), Vector3f(0.f, 1.f, 0.f)));
+
+    uint64 pending = 0;
+    Time start = Timer::now();
+    for(uint32 u = 0; u < mUpdates.size() && !mForceStop; u++) {
+        index.updated(mObjects[mUpdates[u]], loc);
+        if ((u+1) % mServiceInterval == 0)
+            pending += index.service();
+    }
+    pending += index.service();
+    Duration dur = Timer::now() - start;
+
+    SILOG(benchmark,info,
+          method << ": " << mUpdates.size() << " changes, " << pending << " pending updates, " << dur << ": "
+          << (dur.toMicroseconds()*1000/float(mUpdates.size())) << "ns/change, "
+          << float(mUpdates.size())/dur.toSeconds() << " changes/s");
+    return pending;
+}
+
+void LocSubscriberIndexBenchmark::start() {
+    mForceStop = false;
+
+    srand(mNumObjects);
+    mSubscribers.resize(mNumSubscribers);
+    for(uint32 i = 0; i < mNumSubscribers; i++)
+        mSubscribers[i] = UUID::random();
+    mObjects.resize(mNumObjects);
+    for(uint32 i = 0; i < mNumObjects; i++)
+        mObjects[i] = UUID::random();
+
+    // Subscribers are interested in nearby objects, so some objects are much
+    // more popular than others.
+    for(uint32 s = 0; s < mNumSubscribers; s++) {
+        uint32 center = randInt<uint32>(0, mNumObjects-1);
+        for(uint32 i = 0; i < mSubscriptionsPerSubscriber; i++)
+            mSubscriptions.push_back(std::make_pair(s, (center + i) % mNumObjects));
+    }
+    mUpdates.resize(mNumUpdates);
+    for(uint32 u = 0; u < mNumUpdates; u++)
+        mUpdates[u] = randInt<uint32>(0, mNumObjects-1);
+
+    SILOG(benchmark,info,
+          mNumSubscribers << " subscribers, " << mNumObjects << " objects, "
+          << mSubscriptions.size() << " subscriptions");
+
+    uint64 ordered_pending = run<OrderedIndex>("Ordered maps");
+    if (mForceStop) return;
+    uint64 hashed_pending = run<HashedIndex>("Hashed");
+    if (mForceStop) return;
+
+    if (ordered_pending != hashed_pending)
+        SILOG(benchmark,error,"Layouts generated different numbers of updates: " << ordered_pending << " vs. " << hashed_pending);
+
+    notifyFinished();
+}
+
+void LocSubscriberIndexBenchmark::stop() {
+    mForceStop = true;
+}
+
+} // namespace Sirikata
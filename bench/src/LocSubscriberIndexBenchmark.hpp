@@ -0,0 +1,60 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_LOC_SUBSCRIBER_INDEX_BENCHMARK_HPP_
+#define _SIRIKATA_LOC_SUBSCRIBER_INDEX_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+#include <sirikata/core/util/UUID.hpp>
+
+namespace Sirikata {
+
+/** Measures the fan-out of location changes to subscribers, as done by
+ *  AlwaysLocationUpdatePolicy's propertyUpdated: looking up an object's
+ *  subscribers and, for each of them, checking the subscription and recording
+ *  a pending update. The original layout, built from ordered maps and sets, is
+ *  compared against the hash tables, subscriber lists and DirtyUpdateList the
+ *  policy now uses. Pending updates are periodically cleared out, as happens
+ *  when they're sent. Reports updates per second for each layout.
+ */
+class LocSubscriberIndexBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& param) {
+        return new LocSubscriberIndexBenchmark(finished_cb, param);
+    }
+
+    LocSubscriberIndexBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    // Runs the changes against one layout, returning the number of updates
+    // that would have been sent.
+    template<typename IndexType>
+    uint64 run(const String& method);
+
+    bool mForceStop;
+
+    uint32 mNumSubscribers;
+    uint32 mNumObjects;
+    uint32 mSubscriptionsPerSubscriber;
+    uint32 mNumUpdates;
+    uint32 mServiceInterval;
+
+    std::vector<UUID> mSubscribers;
+    std::vector<UUID> mObjects;
+    // Pairs of (subscriber, object) indices
+    std::vector< std::pair<uint32, uint32> > mSubscriptions;
+    // Indices of objects to update
+    std::vector<uint32> mUpdates;
+}; // class LocSubscriberIndexBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_LOC_SUBSCRIBER_INDEX_BENCHMARK_HPP_
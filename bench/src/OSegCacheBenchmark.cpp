@@ -0,0 +1,201 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "OSegCacheBenchmark.hpp"
+#include <sirikata/core/network/IOService.hpp>
+#include <sirikata/core/network/IOStrand.hpp>
+#include <sirikata/core/options/Options.hpp>
+#include <sirikata/core/util/Thread.hpp>
+#include <sirikata/core/util/Random.hpp>
+#include <sirikata/space/SpaceContext.hpp>
+#include <sirikata/space/CoordinateSegmentation.hpp>
+
+#include "../../libspace/src/caches/CacheLRUOriginal.hpp"
+#include "../../libspace/src/caches/CommunicationCache.hpp"
+#include "../../libspace/src/caches/ShardedClockCache.hpp"
+
+namespace Sirikata {
+
+namespace {
+// CommunicationCache scores entries by the distance to the server they're on,
+// so give it a single server covering a fixed region.
+class BenchmarkCoordinateSegmentation : public CoordinateSegmentation {
+public:
+    BenchmarkCoordinateSegmentation(SpaceContext* ctx)
+     : CoordinateSegmentation(ctx),
+       mRegion(Vector3f(-1000.f, -1000.f, -1000.f), Vector3f(1000.f, 1000.f, 1000.f))
+    {}
+
+    virtual ServerID lookup(const Vector3f& pos) { return 1; }
+    virtual BoundingBoxList serverRegion(const ServerID& server) {
+        BoundingBoxList result;
+        result.push_back(mRegion);
+        return result;
+    }
+    virtual BoundingBox3f region() { return mRegion; }
+    virtual uint32 numServers() { return 1; }
+    virtual std::vector<ServerID> lookupBoundingBox(const BoundingBox3f& bbox) {
+        return std::vector<ServerID>(1, 1);
+    }
+    virtual void receiveMessage(Message* msg) {}
+    virtual void service() {}
+
+private:
+    BoundingBox3f mRegion;
+};
+}
+
+OSegCacheBenchmark::OSegCacheBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false),
+          mIOService(NULL),
+          mIOStrand(NULL),
+          mContext(NULL),
+          mCSeg(NULL)
+{
+    OptionValue* objects;
+    OptionValue* lookups;
+    OptionValue* cacheSize;
+    OptionValue* threads;
+    OptionValue* zipf;
+    Sirikata::InitializeClassOptions ico("OSegCacheBenchmark",this,
+        objects=new OptionValue("objects","100000",Sirikata::OptionValueType<uint32>(),"number of distinct objects looked up"),
+        lookups=new OptionValue("lookups","1000000",Sirikata::OptionValueType<uint32>(),"number of lookups in the trace"),
+        cacheSize=new OptionValue("cache-size","10000",Sirikata::OptionValueType<uint32>(),"maximum number of cache entries, as in oseg-cache-size"),
+        threads=new OptionValue("threads","4",Sirikata::OptionValueType<uint32>(),"number of threads to split the trace between for the concurrent runs"),
+        zipf=new OptionValue("zipf","1.0",Sirikata::OptionValueType<double>(),"exponent of the Zipf distribution of object popularity"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("OSegCacheBenchmark",this);
+    optionsSet->parse(param);
+
+    mNumObjects = std::max((uint32)1, objects->as<uint32>());
+    mNumLookups = std::max((uint32)1, lookups->as<uint32>());
+    mCacheSize = std::max((uint32)1, cacheSize->as<uint32>());
+    mNumThreads = std::max((uint32)1, threads->as<uint32>());
+    mZipfExponent = zipf->as<double>();
+}
+
+OSegCacheBenchmark::~OSegCacheBenchmark() {
+    delete mCSeg;
+    delete mContext;
+    delete mIOStrand;
+    delete mIOService;
+}
+
+String OSegCacheBenchmark::name() {
+    return "oseg-cache";
+}
+
+void OSegCacheBenchmark::generateTrace() {
+    srand(mNumObjects);
+
+    mObjects.resize(mNumObjects);
+    for(uint32 i = 0; i < mNumObjects; i++)
+        mObjects[i] = UUID::random();
+
+    // Sample ranks by inverting the Zipf CDF
+    std::vector<double> cdf(mNumObjects);
+    double total = 0;
+    for(uint32 i = 0; i < mNumObjects; i++) {
+        total += 1.0 / pow((double)(i+1), mZipfExponent);
+        cdf[i] = total;
+    }
+
+    mTrace.resize(mNumLookups);
+    for(uint32 i = 0; i < mNumLookups; i++) {
+        double r = randFloat() * total;
+        uint32 rank = (uint32)(std::lower_bound(cdf.begin(), cdf.end(), r) - cdf.begin());
+        mTrace[i] = std::min(rank, mNumObjects-1);
+    }
+}
+
+void OSegCacheBenchmark::lookups(OSegCache* cache, const std::vector<UUID>* objects, const std::vector<uint32>* trace, uint32 offset, uint32 count, uint32* hits) {
+    uint32 nhits = 0;
+    for(uint32 i = offset; i < offset + count; i++) {
+        const UUID& obj = (*objects)[(*trace)[i]];
+        if (cache->get(obj).notNull())
+            nhits++;
+        else
+            cache->insert(obj, OSegEntry(1, 1.f));
+    }
+    *hits = nhits;
+}
+
+void OSegCacheBenchmark::run(const String& cache_name, OSegCache* cache, uint32 nthreads) {
+    if (mForceStop) return;
+
+    std::vector<uint32> hits(nthreads, 0);
+    uint32 per_thread = mNumLookups / nthreads;
+
+    Time start_time = Timer::now();
+    std::vector<Thread*> threads;
+    for(uint32 i = 0; i < nthreads; i++) {
+        threads.push_back(new Thread("OSegCacheBenchmark",
+                std::tr1::bind(&OSegCacheBenchmark::lookups, cache, &mObjects, &mTrace, i * per_thread, per_thread, &hits[i])));
+    }
+    for(uint32 i = 0; i < threads.size(); i++) {
+        threads[i]->join();
+        delete threads[i];
+    }
+    Duration dur = Timer::now() - start_time;
+
+    uint32 total = per_thread * nthreads;
+    uint32 total_hits = 0;
+    for(uint32 i = 0; i < nthreads; i++)
+        total_hits += hits[i];
+
+    SILOG(benchmark,info,
+          cache_name << ", " << nthreads << " threads: "
+          << total << " lookups, " << dur << ": "
+          << (dur.toMicroseconds()*1000/float(total)) << "ns/lookup, "
+          << float(total)/dur.toSeconds() << " lookups/s, hit rate "
+          << float(total_hits)/total);
+}
+
+void OSegCacheBenchmark::start() {
+    mForceStop = false;
+
+    mIOService = new Network::IOService("OSegCacheBenchmark");
+    mIOStrand = mIOService->createStrand("OSegCacheBenchmark Main");
+    mContext = new SpaceContext("OSegCacheBenchmark", 1, NULL, NULL, mIOService, mIOStrand, Timer::now(), NULL);
+    mCSeg = new BenchmarkCoordinateSegmentation(mContext);
+
+    generateTrace();
+
+    // Entries never expire during the run, only capacity limits the hit rate
+    Duration lifetime = Duration::seconds(3600.f);
+    uint32 thread_counts[2] = { 1, mNumThreads };
+    for(uint32 t = 0; t < 2 && !mForceStop; t++) {
+        if (t > 0 && thread_counts[t] == 1) break;
+        uint32 nthreads = thread_counts[t];
+
+        OSegCache* cache = new CacheLRUOriginal(mContext, mCacheSize, 25, lifetime);
+        run("CacheLRUOriginal", cache, nthreads);
+        delete cache;
+
+        // Complete_Cache asserts on duplicate inserts, which concurrent
+        // lookups missing on the same object produce
+        if (nthreads == 1) {
+            cache = new CommunicationCache(mContext, 1.0, mCSeg, mCacheSize);
+            run("CommunicationCache", cache, nthreads);
+            delete cache;
+        }
+
+        cache = new ShardedClockCache(mContext, mCacheSize, 16, lifetime);
+        run("ShardedClockCache", cache, nthreads);
+        delete cache;
+    }
+
+    if (mForceStop)
+        return;
+
+    notifyFinished();
+}
+
+void OSegCacheBenchmark::stop() {
+    mForceStop = true;
+}
+
+} // namespace Sirikata
@@ -0,0 +1,65 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_OSEG_CACHE_BENCHMARK_HPP_
+#define _SIRIKATA_OSEG_CACHE_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+#include <sirikata/core/util/UUID.hpp>
+
+namespace Sirikata {
+
+class SpaceContext;
+class CoordinateSegmentation;
+class OSegCache;
+
+/** Compares the OSeg cache implementations -- CacheLRUOriginal,
+ *  CommunicationCache and ShardedClockCache -- on a synthetic lookup trace
+ *  where object popularity follows a Zipf distribution. Each lookup which
+ *  misses inserts the object, like the OSeg does when a lookup completes.
+ *  Each cache is run with 1 and then with the given number of threads, except
+ *  CommunicationCache which can't handle concurrent inserts of one object.
+ */
+class OSegCacheBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& param) {
+        return new OSegCacheBenchmark(finished_cb, param);
+    }
+
+    OSegCacheBenchmark(const FinishedCallback& finished_cb, const String& param);
+    ~OSegCacheBenchmark();
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    void generateTrace();
+    void run(const String& cache_name, OSegCache* cache, uint32 nthreads);
+    static void lookups(OSegCache* cache, const std::vector<UUID>* objects, const std::vector<uint32>* trace, uint32 offset, uint32 count, uint32* hits);
+
+    bool mForceStop;
+
+    uint32 mNumObjects;
+    uint32 mNumLookups;
+    uint32 mCacheSize;
+    uint32 mNumThreads;
+    double mZipfExponent;
+
+    std::vector<UUID> mObjects;
+    // Indices into mObjects
+    std::vector<uint32> mTrace;
+
+    Network::IOService* mIOService;
+    Network::IOStrand* mIOStrand;
+    SpaceContext* mContext;
+    CoordinateSegmentation* mCSeg;
+}; // class OSegCacheBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_OSEG_CACHE_BENCHMARK_HPP_
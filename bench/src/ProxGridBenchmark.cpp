@@ -0,0 +1,373 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "ProxGridBenchmark.hpp"
+#include <sirikata/core/options/Options.hpp>
+#include <sirikata/core/util/Random.hpp>
+#include <sirikata/core/util/Timer.hpp>
+#include <sirikata/pintoloc/ProxSimulationTraits.hpp>
+#include <prox/base/LocationServiceCache.hpp>
+
+namespace Sirikata {
+
+namespace {
+
+typedef Prox::QueryHandler<ObjectProxSimulationTraits> ProxQueryHandler;
+typedef Prox::Query<ObjectProxSimulationTraits> ProxQuery;
+typedef Prox::QueryEvent<ObjectProxSimulationTraits> ProxQueryEvent;
+typedef std::deque<ProxQueryEvent> ProxQueryEventList;
+
+// Minimal location cache, holding just what query handlers need. Objects are
+// only added and moved.
+class BenchmarkLocationServiceCache : public Prox::LocationServiceCache<ObjectProxSimulationTraits> {
+public:
+    typedef Prox::LocationUpdateListener<ObjectProxSimulationTraits> LocationUpdateListener;
+
+    void addObject(const ObjectReference& id, const TimedMotionVector3f& loc, float32 radius) {
+        ObjectData& data = mObjects[id];
+        data.location = loc;
+        data.radius = radius;
+        data.tracking = 0;
+        for(ListenerSet::iterator it = mListeners.begin(); it != mListeners.end(); it++)
+            (*it)->locationConnected(id, false, true, loc, BoundingSphere3f(Vector3f::zero(), radius), radius);
+    }
+
+    void updateLocation(const ObjectReference& id, const TimedMotionVector3f& loc) {
+        ObjectData& data = mObjects[id];
+        TimedMotionVector3f old_loc = data.location;
+        data.location = loc;
+        for(ListenerSet::iterator it = mListeners.begin(); it != mListeners.end(); it++)
+            (*it)->locationPositionUpdated(id, old_loc, loc);
+    }
+
+    virtual void addPlaceholderImposter(
+        const ObjectID& id,
+        const Vector3f& center_offset,
+        const float32 center_bounds_radius,
+        const float32 max_size,
+        const String& query_data,
+        const String& mesh
+    ) {
+        // Only needed for aggregates, which none of the benchmarked handlers
+        // generate.
+    }
+
+    virtual Iterator startTracking(const ObjectID& id) {
+        ObjectMap::iterator it = mObjects.find(id);
+        assert(it != mObjects.end());
+        it->second.tracking++;
+        // Elements don't move when the map is modified, iterators might
+        return Iterator( &(*it) );
+    }
+    virtual void stopTracking(const Iterator& id) {
+        extract(id).second.tracking--;
+    }
+    virtual bool startRefcountTracking(const ObjectID& id) {
+        mObjects[id].tracking++;
+        return true;
+    }
+    virtual void stopRefcountTracking(const ObjectID& id) {
+        mObjects[id].tracking--;
+    }
+
+    virtual TimedMotionVector3f location(const Iterator& id) {
+        return extract(id).second.location;
+    }
+    virtual Vector3f centerOffset(const Iterator& id) {
+        return Vector3f::zero();
+    }
+    virtual float32 centerBoundsRadius(const Iterator& id) {
+        return extract(id).second.radius;
+    }
+    virtual float32 maxSize(const Iterator& id) {
+        return extract(id).second.radius;
+    }
+    virtual bool isLocal(const Iterator& id) {
+        return true;
+    }
+    String mesh(const Iterator& id) {
+        return "";
+    }
+    String queryData(const Iterator& id) {
+        return "";
+    }
+
+    virtual const ObjectReference& iteratorID(const Iterator& id) {
+        return extract(id).first;
+    }
+
+    virtual void addUpdateListener(LocationUpdateListener* listener) {
+        mListeners.insert(listener);
+    }
+    virtual void removeUpdateListener(LocationUpdateListener* listener) {
+        mListeners.erase(listener);
+    }
+
+private:
+    struct ObjectData {
+        TimedMotionVector3f location;
+        float32 radius;
+        int32 tracking;
+    };
+    typedef std::tr1::unordered_map<ObjectReference, ObjectData, ObjectReference::Hasher> ObjectMap;
+    typedef std::tr1::unordered_set<LocationUpdateListener*> ListenerSet;
+
+    ObjectMap::value_type& extract(const Iterator& id) {
+        return *((ObjectMap::value_type*)id.data);
+    }
+
+    ObjectMap mObjects;
+    ListenerSet mListeners;
+};
+
+} // namespace
+
+ProxGridBenchmark::ProxGridBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false)
+{
+    OptionValue* objects;
+    OptionValue* queries;
+    OptionValue* ticks;
+    OptionValue* moving;
+    OptionValue* updates;
+    OptionValue* speed;
+    OptionValue* worldSize;
+    OptionValue* angle;
+    OptionValue* distance;
+    OptionValue* handlers;
+    OptionValue* handlerOptions;
+    OptionValue* verify;
+    Sirikata::InitializeClassOptions ico("ProxGridBenchmark",this,
+        objects=new OptionValue("objects","10000",Sirikata::OptionValueType<uint32>(),"number of objects in the scene"),
+        queries=new OptionValue("queries","100",Sirikata::OptionValueType<uint32>(),"number of queries, placed at random static positions"),
+        ticks=new OptionValue("ticks","100",Sirikata::OptionValueType<uint32>(),"number of ticks, 100ms apart, to run each handler for"),
+        moving=new OptionValue("moving","0.5",Sirikata::OptionValueType<float32>(),"fraction of objects which are moving"),
+        updates=new OptionValue("updates","0.1",Sirikata::OptionValueType<float32>(),"fraction of moving objects which change direction each tick"),
+        speed=new OptionValue("speed","10",Sirikata::OptionValueType<float32>(),"maximum speed of moving objects"),
+        worldSize=new OptionValue("world-size","1000",Sirikata::OptionValueType<float32>(),"objects and queries are placed in a cube with this half-width"),
+        angle=new OptionValue("angle","0.01",Sirikata::OptionValueType<float32>(),"minimum solid angle for queries"),
+        distance=new OptionValue("distance","0",Sirikata::OptionValueType<float32>(),"if non-zero, use distance queries with this radius instead of solid angle queries"),
+        handlers=new OptionValue("handlers","brute,rtree,grid",Sirikata::OptionValueType<String>(),"comma separated list of query handler types to compare"),
+        handlerOptions=new OptionValue("handler-options","",Sirikata::OptionValueType<String>(),"options passed to each query handler, e.g. --cell-size=50"),
+        verify=new OptionValue("verify","true",Sirikata::OptionValueType<bool>(),"check that every handler generates the same results as the first one"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("ProxGridBenchmark",this);
+    optionsSet->parse(param);
+
+    mNumObjects = std::max((uint32)1, objects->as<uint32>());
+    mNumQueries = std::max((uint32)1, queries->as<uint32>());
+    mTicks = std::max((uint32)1, ticks->as<uint32>());
+    mMovingFraction = moving->as<float32>();
+    mUpdateFraction = updates->as<float32>();
+    mSpeed = speed->as<float32>();
+    mWorldSize = worldSize->as<float32>();
+    mAngle = angle->as<float32>();
+    mDistance = distance->as<float32>();
+    mHandlerOptions = handlerOptions->as<String>();
+    mVerify = verify->as<bool>();
+
+    String handler_list = handlers->as<String>();
+    String::size_type pos = 0;
+    while(pos <= handler_list.size()) {
+        String::size_type next = handler_list.find(',', pos);
+        if (next == String::npos) next = handler_list.size();
+        if (next > pos)
+            mHandlers.push_back(handler_list.substr(pos, next - pos));
+        pos = next + 1;
+    }
+}
+
+String ProxGridBenchmark::name() {
+    return "prox-grid";
+}
+
+Vector3f ProxGridBenchmark::randomVelocity() {
+    return Vector3f(randFloat(-mSpeed, mSpeed), randFloat(-mSpeed, mSpeed), randFloat(-mSpeed, mSpeed) * 0.1f);
+}
+
+void ProxGridBenchmark::generateScene() {
+    srand(mNumObjects);
+    mStartTime = Time::null() + Duration::seconds(100.f);
+    mTickInterval = Duration::milliseconds((int64)100);
+
+    mScene.resize(mNumObjects);
+    for(uint32 i = 0; i < mNumObjects; i++) {
+        SceneObject& obj = mScene[i];
+        obj.id = ObjectReference(UUID::random());
+        obj.moving = (randFloat() < mMovingFraction);
+        Vector3f pos(randFloat(-mWorldSize, mWorldSize), randFloat(-mWorldSize, mWorldSize), randFloat(-mWorldSize, mWorldSize) * 0.1f);
+        Vector3f vel = obj.moving ? randomVelocity() : Vector3f::zero();
+        obj.location = TimedMotionVector3f(mStartTime, MotionVector3f(pos, vel));
+        obj.radius = randFloat(0.5f, 5.f);
+    }
+
+    mQueryPositions.resize(mNumQueries);
+    for(uint32 i = 0; i < mNumQueries; i++)
+        mQueryPositions[i] = Vector3f(randFloat(-mWorldSize, mWorldSize), randFloat(-mWorldSize, mWorldSize), randFloat(-mWorldSize, mWorldSize) * 0.1f);
+}
+
+void ProxGridBenchmark::run(const String& handler_type) {
+    if (!ObjectProxGeomQueryHandlerFactory.hasConstructor(handler_type, "maxsize")) {
+        SILOG(benchmark,error,"Unknown query handler type " << handler_type);
+        return;
+    }
+
+    BenchmarkLocationServiceCache* loc_cache = new BenchmarkLocationServiceCache();
+    ProxQueryHandler* handler = ObjectProxGeomQueryHandlerFactory.getConstructor(handler_type, "maxsize")(mHandlerOptions, false);
+    handler->initialize(loc_cache, loc_cache, false, false);
+
+    // Every handler sees the same sequence of updates
+    srand(mNumObjects + 1);
+    std::vector<TimedMotionVector3f> locations(mScene.size());
+    for(uint32 i = 0; i < mScene.size(); i++) {
+        locations[i] = mScene[i].location;
+        loc_cache->addObject(mScene[i].id, mScene[i].location, mScene[i].radius);
+    }
+
+    std::vector<ProxQuery*> queries(mQueryPositions.size());
+    for(uint32 i = 0; i < mQueryPositions.size(); i++) {
+        TimedMotionVector3f qloc(mStartTime, MotionVector3f(mQueryPositions[i], Vector3f::zero()));
+        BoundingSphere3f qregion(Vector3f::zero(), 0.f);
+        queries[i] = (mDistance > 0) ?
+            handler->registerQuery(qloc, qregion, 1.f, SolidAngle::Min, mDistance) :
+            handler->registerQuery(qloc, qregion, 1.f, SolidAngle(mAngle));
+    }
+
+    // Current results for each query, and a digest of them after each tick:
+    // the sum of the result IDs' hashes, which is independent of order
+    std::vector<ResultSet> results(queries.size());
+    std::vector<uint64> result_sums(queries.size(), 0);
+    std::vector<uint64> digests;
+    if (mVerify) digests.reserve((size_t)mTicks * queries.size());
+    ObjectReference::Hasher hasher;
+
+    uint64 num_updates = 0, additions = 0, removals = 0;
+    Duration update_dur = Duration::zero(), tick_dur = Duration::zero();
+    Time t = mStartTime;
+    ProxQueryEventList evts;
+    for(uint32 ti = 0; ti < mTicks && !mForceStop; ti++) {
+        t += mTickInterval;
+
+        Time update_start = Timer::now();
+        for(uint32 i = 0; i < mScene.size(); i++) {
+            if (!mScene[i].moving || randFloat() >= mUpdateFraction) continue;
+            locations[i] = TimedMotionVector3f(t, MotionVector3f(locations[i].position(t), randomVelocity()));
+            loc_cache->updateLocation(mScene[i].id, locations[i]);
+            num_updates++;
+        }
+        update_dur += Timer::now() - update_start;
+
+        Time tick_start = Timer::now();
+        handler->tick(t);
+        tick_dur += Timer::now() - tick_start;
+
+        for(uint32 i = 0; i < queries.size(); i++) {
+            queries[i]->popEvents(evts);
+            while(!evts.empty()) {
+                const ProxQueryEvent& evt = evts.front();
+                additions += evt.additions().size();
+                removals += evt.removals().size();
+                if (mVerify) {
+                    for(uint32 ai = 0; ai < evt.additions().size(); ai++) {
+                        results[i].insert(evt.additions()[ai].id());
+                        result_sums[i] += hasher(evt.additions()[ai].id());
+                    }
+                    for(uint32 ri = 0; ri < evt.removals().size(); ri++) {
+                        results[i].erase(evt.removals()[ri].id());
+                        result_sums[i] -= hasher(evt.removals()[ri].id());
+                    }
+                }
+                evts.pop_front();
+            }
+            if (mVerify)
+                digests.push_back(result_sums[i]);
+        }
+    }
+
+    SILOG(benchmark,info,
+          handler_type << ": " << num_updates << " updates in " << update_dur
+          << ", " << mTicks << " ticks in " << tick_dur << " ("
+          << (tick_dur.toMicroseconds()/(float)mTicks) << "us/tick), "
+          << additions << " additions, " << removals << " removals, "
+          << (additions - removals) << " final results");
+
+    if (mVerify && !mForceStop) {
+        if (mReferenceHandler.empty()) {
+            mReferenceHandler = handler_type;
+            mReferenceDigests.swap(digests);
+            mReferenceResults.swap(results);
+        }
+        else {
+            verifyResults(handler_type, digests, results);
+        }
+    }
+
+    // Deleting queries notifies the handler
+    for(uint32 i = 0; i < queries.size(); i++)
+        delete queries[i];
+    delete handler;
+    delete loc_cache;
+}
+
+void ProxGridBenchmark::verifyResults(const String& handler_type, const std::vector<uint64>& digests, const std::vector<ResultSet>& results) {
+    uint32 nqueries = (uint32)results.size();
+    uint32 first_bad_tick = mTicks;
+    for(uint32 i = 0; i < digests.size() && i < mReferenceDigests.size(); i++) {
+        if (digests[i] != mReferenceDigests[i]) {
+            first_bad_tick = i / nqueries;
+            break;
+        }
+    }
+
+    // Objects in one result set but not the other, after the last tick
+    uint32 bad_queries = 0;
+    uint64 missing = 0, extra = 0;
+    for(uint32 qi = 0; qi < nqueries; qi++) {
+        const ResultSet& ref = mReferenceResults[qi];
+        const ResultSet& res = results[qi];
+        uint64 query_missing = 0, query_extra = 0;
+        for(ResultSet::const_iterator it = ref.begin(); it != ref.end(); it++)
+            if (res.find(*it) == res.end()) query_missing++;
+        for(ResultSet::const_iterator it = res.begin(); it != res.end(); it++)
+            if (ref.find(*it) == ref.end()) query_extra++;
+        if (query_missing > 0 || query_extra > 0) bad_queries++;
+        missing += query_missing;
+        extra += query_extra;
+    }
+
+    if (first_bad_tick == mTicks && bad_queries == 0) {
+        SILOG(benchmark,info,handler_type << ": results match " << mReferenceHandler);
+        return;
+    }
+    SILOG(benchmark,error,
+          handler_type << ": results differ from " << mReferenceHandler
+          << " starting at tick " << first_bad_tick << ", final results for "
+          << bad_queries << " of " << nqueries << " queries differ, "
+          << missing << " missing, " << extra << " extra");
+}
+
+void ProxGridBenchmark::start() {
+    mForceStop = false;
+    mReferenceHandler = "";
+    mReferenceDigests.clear();
+    mReferenceResults.clear();
+
+    generateScene();
+
+    for(uint32 i = 0; i < mHandlers.size() && !mForceStop; i++)
+        run(mHandlers[i]);
+
+    if (mForceStop)
+        return;
+
+    notifyFinished();
+}
+
+void ProxGridBenchmark::stop() {
+    mForceStop = true;
+}
+
+} // namespace Sirikata
@@ -0,0 +1,82 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_PROX_GRID_BENCHMARK_HPP_
+#define _SIRIKATA_PROX_GRID_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+#include <sirikata/core/util/ObjectReference.hpp>
+#include <sirikata/core/util/MotionVector.hpp>
+
+namespace Sirikata {
+
+/** Compares query handlers on a scene where some fraction of the objects are
+ *  moving and regularly change direction, the workload GridQueryHandler is
+ *  meant for. Each handler type is run over the same scene and sequence of
+ *  updates, and the benchmark reports the time spent processing location
+ *  updates and ticking the handler, as well as the number of result changes
+ *  it generated. Unless disabled, every handler's results are checked
+ *  against those of the first handler (brute force by default) after each
+ *  tick, and mismatches are reported as errors.
+ */
+class ProxGridBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& param) {
+        return new ProxGridBenchmark(finished_cb, param);
+    }
+
+    ProxGridBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    struct SceneObject {
+        ObjectReference id;
+        TimedMotionVector3f location;
+        float32 radius;
+        bool moving;
+    };
+    typedef std::tr1::unordered_set<ObjectReference, ObjectReference::Hasher> ResultSet;
+
+    void generateScene();
+    Vector3f randomVelocity();
+    void run(const String& handler_type);
+    // Compares a handler's results against the reference handler's.
+    // digests holds a digest of each query's results after each tick.
+    void verifyResults(const String& handler_type, const std::vector<uint64>& digests, const std::vector<ResultSet>& results);
+
+    bool mForceStop;
+
+    uint32 mNumObjects;
+    uint32 mNumQueries;
+    uint32 mTicks;
+    float32 mMovingFraction;
+    float32 mUpdateFraction;
+    float32 mSpeed;
+    float32 mWorldSize;
+    float32 mAngle;
+    float32 mDistance;
+    std::vector<String> mHandlers;
+    String mHandlerOptions;
+    bool mVerify;
+
+    Time mStartTime;
+    Duration mTickInterval;
+    std::vector<SceneObject> mScene;
+    std::vector<Vector3f> mQueryPositions;
+
+    // Results from the first handler, which the rest are checked against
+    String mReferenceHandler;
+    std::vector<uint64> mReferenceDigests;
+    std::vector<ResultSet> mReferenceResults;
+}; // class ProxGridBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_PROX_GRID_BENCHMARK_HPP_
@@ -0,0 +1,183 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "ProxResultEncoderBenchmark.hpp"
+#include <sirikata/core/options/Options.hpp>
+#include <sirikata/core/util/Random.hpp>
+#include <sirikata/core/util/Timer.hpp>
+#include <sirikata/core/network/Message.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "../../libspace/src/ProxResultEncoder.hpp"
+
+namespace Sirikata {
+
+ProxResultEncoderBenchmark::ProxResultEncoderBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false),
+          mEncoder(NULL)
+{
+    OptionValue* objects;
+    OptionValue* queriers;
+    OptionValue* maxPerResult;
+    Sirikata::InitializeClassOptions ico("ProxResultEncoderBenchmark",this,
+        objects=new OptionValue("objects","10000",Sirikata::OptionValueType<uint32>(),"number of objects in the scene"),
+        queriers=new OptionValue("queriers","10",Sirikata::OptionValueType<uint32>(),"number of queriers which receive the entire scene"),
+        maxPerResult=new OptionValue("max-per-result","5",Sirikata::OptionValueType<uint32>(),"maximum number of events per result message, as in prox.max-per-result"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("ProxResultEncoderBenchmark",this);
+    optionsSet->parse(param);
+
+    mNumObjects = std::max((uint32)1, objects->as<uint32>());
+    mNumQueriers = std::max((uint32)1, queriers->as<uint32>());
+    mMaxPerResult = std::max((uint32)1, maxPerResult->as<uint32>());
+}
+
+ProxResultEncoderBenchmark::~ProxResultEncoderBenchmark() {
+    delete mEncoder;
+}
+
+String ProxResultEncoderBenchmark::name() {
+    return "prox-encoder";
+}
+
+void ProxResultEncoderBenchmark::generateScene() {
+    srand(mNumObjects);
+    mSimTime = Time::null() + Duration::seconds(100.f);
+
+    mScene.resize(mNumObjects);
+    for(uint32 i = 0; i < mNumObjects; i++) {
+        SceneObject& obj = mScene[i];
+        obj.id = UUID::random();
+        Vector3f pos(randFloat(-1000.f, 1000.f), randFloat(-1000.f, 1000.f), randFloat(-100.f, 100.f));
+        // Most objects are static
+        Vector3f vel = (i % 10 == 0) ? Vector3f(randFloat(-1.f, 1.f), randFloat(-1.f, 1.f), 0.f) : Vector3f::zero();
+        obj.location = TimedMotionVector3f(mSimTime, MotionVector3f(pos, vel));
+        obj.orientation = TimedMotionQuaternion(mSimTime, MotionQuaternion(Quaternion::identity(), Quaternion::identity()));
+        obj.bounds = AggregateBoundingInfo(Vector3f::zero(), 0.f, randFloat(0.5f, 10.f));
+        // Scenes are built from a limited set of models
+        obj.mesh = "meerkat:///sirikata/models/model" + boost::lexical_cast<String>(i % 100) + ".dae/optimized/0/model.dae";
+        if (i % 5 == 0)
+            obj.physics = "{\"treatment\":\"static\",\"bounds\":\"triangles\",\"mass\":0}";
+    }
+}
+
+uint64 ProxResultEncoderBenchmark::encodePBJ(uint64* seqno, std::vector<String>* results) {
+    // Mirrors the original LibproxProximity result generation, with each
+    // addition as its own event, as they are generated by libprox.
+    uint64 bytes = 0;
+    uint32 idx = 0;
+    while(idx < mScene.size()) {
+        Sirikata::Protocol::Prox::ProximityResults prox_results;
+        prox_results.set_t(mSimTime);
+
+        for(uint32 count = 0; count < mMaxPerResult && idx < mScene.size(); count++, idx++) {
+            const SceneObject& obj = mScene[idx];
+            Sirikata::Protocol::Prox::IProximityUpdate event_results = prox_results.add_update();
+            Sirikata::Protocol::Prox::IObjectAddition addition = event_results.add_addition();
+            ProxResultEncoder::fillAddition(
+                addition, obj.id, (*seqno)++, false,
+                obj.location, obj.orientation, obj.bounds, obj.mesh, obj.physics
+            );
+        }
+
+        String serialized = serializePBJMessage(prox_results);
+        bytes += serialized.size();
+        if (results != NULL) results->push_back(serialized);
+    }
+    return bytes;
+}
+
+uint64 ProxResultEncoderBenchmark::encodeFragments(uint64* seqno, std::vector<String>* results) {
+    uint64 bytes = 0;
+    uint32 idx = 0;
+    while(idx < mScene.size()) {
+        mEncoder->start(mSimTime);
+
+        for(uint32 count = 0; count < mMaxPerResult && idx < mScene.size(); count++, idx++) {
+            mEncoder->startUpdate();
+            mEncoder->addAddition(*mFragments[idx], (*seqno)++);
+            mEncoder->finishUpdate();
+        }
+
+        const String& serialized = mEncoder->finish();
+        bytes += serialized.size();
+        if (results != NULL) results->push_back(serialized);
+    }
+    return bytes;
+}
+
+void ProxResultEncoderBenchmark::report(const String& method, uint32 additions, uint64 bytes, const Duration& dur) {
+    SILOG(benchmark,info,
+          method << ": " << additions << " additions, " << bytes << " bytes, " << dur << ": "
+          << (dur.toMicroseconds()*1000/float(additions)) << "ns/addition, "
+          << float(additions)/dur.toSeconds() << " additions/s");
+}
+
+void ProxResultEncoderBenchmark::start() {
+    mForceStop = false;
+
+    generateScene();
+
+    mEncoder = new ProxResultEncoder();
+    if (!mEncoder->valid()) {
+        SILOG(benchmark,error,"Couldn't determine proximity result encoding, only PBJ encoding is available");
+        notifyFinished();
+        return;
+    }
+
+    // Fragments are generated once per object, when they're first sent or
+    // after they change, and reused for all queriers.
+    Time frag_start = Timer::now();
+    mFragments.resize(mScene.size());
+    for(uint32 i = 0; i < mScene.size(); i++) {
+        const SceneObject& obj = mScene[i];
+        mFragments[i] = ProxResultEncoder::encodeAdditionFragment(
+            obj.id, false, obj.location, obj.orientation, obj.bounds, obj.mesh, obj.physics
+        );
+    }
+    Duration frag_dur = Timer::now() - frag_start;
+    report("Fragment generation", mScene.size(), 0, frag_dur);
+
+    // Check both methods generate the same results
+    std::vector<String> pbj_results, frag_results;
+    uint64 pbj_seqno = 0, frag_seqno = 0;
+    encodePBJ(&pbj_seqno, &pbj_results);
+    encodeFragments(&frag_seqno, &frag_results);
+    if (pbj_results != frag_results) {
+        SILOG(benchmark,error,"Encoded results differ between PBJ and fragment encoding");
+        notifyFinished();
+        return;
+    }
+
+    uint32 total_additions = mScene.size() * mNumQueriers;
+
+    uint64 bytes = 0;
+    Time pbj_start = Timer::now();
+    for(uint32 q = 0; q < mNumQueriers && !mForceStop; q++) {
+        uint64 seqno = 0;
+        bytes += encodePBJ(&seqno, NULL);
+    }
+    report("PBJ", total_additions, bytes, Timer::now() - pbj_start);
+
+    bytes = 0;
+    Time frag_encode_start = Timer::now();
+    for(uint32 q = 0; q < mNumQueriers && !mForceStop; q++) {
+        uint64 seqno = 0;
+        bytes += encodeFragments(&seqno, NULL);
+    }
+    report("ProxResultEncoder", total_additions, bytes, Timer::now() - frag_encode_start);
+
+    if (mForceStop)
+        return;
+
+    notifyFinished();
+}
+
+void ProxResultEncoderBenchmark::stop() {
+    mForceStop = true;
+}
+
+} // namespace Sirikata
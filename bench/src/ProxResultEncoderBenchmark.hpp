@@ -0,0 +1,73 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_PROX_RESULT_ENCODER_BENCHMARK_HPP_
+#define _SIRIKATA_PROX_RESULT_ENCODER_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+#include <sirikata/core/util/UUID.hpp>
+#include <sirikata/core/util/MotionVector.hpp>
+#include <sirikata/core/util/MotionQuaternion.hpp>
+#include <sirikata/core/util/AggregateBoundingInfo.hpp>
+
+namespace Sirikata {
+
+class ProxResultEncoder;
+struct ObjectAdditionFragment;
+
+/** Compares encoding proximity results for objects by building PBJ messages
+ *  field by field against ProxResultEncoder, which appends per-object
+ *  pre-encoded additions into a reused buffer. A synthetic scene is sent to a
+ *  number of queriers as additions, as happens when they first connect, and
+ *  the benchmark reports additions encoded per second by each method. The two
+ *  methods are also checked to produce identical results.
+ */
+class ProxResultEncoderBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& param) {
+        return new ProxResultEncoderBenchmark(finished_cb, param);
+    }
+
+    ProxResultEncoderBenchmark(const FinishedCallback& finished_cb, const String& param);
+    ~ProxResultEncoderBenchmark();
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    struct SceneObject {
+        UUID id;
+        TimedMotionVector3f location;
+        TimedMotionQuaternion orientation;
+        AggregateBoundingInfo bounds;
+        String mesh;
+        String physics;
+    };
+
+    void generateScene();
+    // Encode all additions for one querier, returning the number of bytes
+    // generated. If results is non-NULL, the encoded messages are stored in it.
+    uint64 encodePBJ(uint64* seqno, std::vector<String>* results);
+    uint64 encodeFragments(uint64* seqno, std::vector<String>* results);
+    void report(const String& method, uint32 additions, uint64 bytes, const Duration& dur);
+
+    bool mForceStop;
+
+    uint32 mNumObjects;
+    uint32 mNumQueriers;
+    uint32 mMaxPerResult;
+
+    Time mSimTime;
+    std::vector<SceneObject> mScene;
+    std::vector< std::tr1::shared_ptr<const ObjectAdditionFragment> > mFragments;
+    ProxResultEncoder* mEncoder;
+}; // class ProxResultEncoderBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_PROX_RESULT_ENCODER_BENCHMARK_HPP_
@@ -0,0 +1,103 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "QueueBenchmark.hpp"
+#include <sirikata/core/queue/ThreadSafeQueue.hpp>
+#include <sirikata/core/queue/LockFreeQueue.hpp>
+#include <sirikata/core/queue/RingQueue.hpp>
+#include <sirikata/core/util/Thread.hpp>
+#include <boost/lexical_cast.hpp>
+
+#define DEFAULT_ELEMENTS_PER_PRODUCER 200000
+#define MAX_THREADS 16
+
+namespace Sirikata {
+
+QueueBenchmark::QueueBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mElementsPerProducer(DEFAULT_ELEMENTS_PER_PRODUCER),
+          mForceStop(false)
+{
+    if (!param.empty()) {
+        try {
+            mElementsPerProducer = boost::lexical_cast<uint32>(param);
+        } catch(boost::bad_lexical_cast&) {
+            SILOG(benchmark,error,"Invalid element count '" << param << "', using " << mElementsPerProducer);
+        }
+    }
+}
+
+String QueueBenchmark::name() {
+    return "queue";
+}
+
+template<typename QueueType>
+void QueueBenchmark::produce(QueueType* queue, uint32 count) {
+    for(uint32 i = 0; i < count; i++)
+        queue->push(i);
+}
+
+template<typename QueueType>
+void QueueBenchmark::consume(QueueType* queue, AtomicValue<uint32>* consumed, uint32 total) {
+    uint32 value = 0;
+    while(consumed->read() < total) {
+        if (queue->pop(value))
+            ++(*consumed);
+        else
+            Thread::yield();
+    }
+}
+
+// Runs nthreads producers and nthreads consumers against a single queue
+template<typename QueueType>
+void QueueBenchmark::run(const String& queue_name, uint32 nthreads) {
+    if (mForceStop) return;
+
+    QueueType queue;
+    uint32 total = nthreads * mElementsPerProducer;
+    AtomicValue<uint32> consumed(0);
+
+    Time start_time = Timer::now();
+    std::vector<Thread*> threads;
+    for(uint32 i = 0; i < nthreads; i++) {
+        threads.push_back(new Thread("QueueBenchmark Consumer", std::tr1::bind(&QueueBenchmark::consume<QueueType>, &queue, &consumed, total)));
+        threads.push_back(new Thread("QueueBenchmark Producer", std::tr1::bind(&QueueBenchmark::produce<QueueType>, &queue, mElementsPerProducer)));
+    }
+    for(uint32 i = 0; i < threads.size(); i++) {
+        threads[i]->join();
+        delete threads[i];
+    }
+    Time end_time = Timer::now();
+    Duration dur = end_time - start_time;
+
+    SILOG(benchmark,info,
+          queue_name << ", " << nthreads << "x" << nthreads << " threads: "
+          << total << " elements, " << dur << ": "
+          << (dur.toMicroseconds()*1000/float(total)) << "ns/element, "
+          << float(total)/dur.toSeconds() << " elements/s");
+}
+
+void QueueBenchmark::start() {
+    mForceStop = false;
+
+    for(uint32 nthreads = 1; nthreads <= MAX_THREADS && !mForceStop; nthreads *= 2) {
+        run< ThreadSafeQueue<uint32> >("ThreadSafeQueue", nthreads);
+        run< LockFreeQueue<uint32> >("LockFreeQueue", nthreads);
+        run< MPMCRingQueue<uint32> >("MPMCRingQueue", nthreads);
+        // Only valid with a single producer and consumer
+        if (nthreads == 1)
+            run< SPSCRingQueue<uint32> >("SPSCRingQueue", nthreads);
+    }
+
+    if (mForceStop)
+        return;
+
+    notifyFinished();
+}
+
+void QueueBenchmark::stop() {
+    mForceStop = true;
+}
+
+} // namespace Sirikata
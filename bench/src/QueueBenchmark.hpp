@@ -0,0 +1,47 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_QUEUE_BENCHMARK_HPP_
+#define _SIRIKATA_QUEUE_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+
+namespace Sirikata {
+
+/** Compares the throughput of the thread safe queue implementations --
+ *  ThreadSafeQueue, LockFreeQueue, MPMCRingQueue and SPSCRingQueue -- with
+ *  1 to 16 producer and consumer threads. The parameter is the number of
+ *  elements each producer pushes.
+ */
+class QueueBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& _param) {
+        return new QueueBenchmark(finished_cb, _param);
+    }
+
+    QueueBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    template<typename QueueType>
+    void run(const String& queue_name, uint32 nthreads);
+
+    template<typename QueueType>
+    static void produce(QueueType* queue, uint32 count);
+    template<typename QueueType>
+    static void consume(QueueType* queue, AtomicValue<uint32>* consumed, uint32 total);
+
+    uint32 mElementsPerProducer;
+    bool mForceStop;
+}; // class QueueBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_QUEUE_BENCHMARK_HPP_
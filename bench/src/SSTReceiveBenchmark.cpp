@@ -0,0 +1,422 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "SSTReceiveBenchmark.hpp"
+#include <sirikata/core/network/SSTImpl.hpp>
+#include <sirikata/core/network/IOService.hpp>
+#include <sirikata/core/network/IOStrand.hpp>
+#include <sirikata/core/network/IOWork.hpp>
+#include <sirikata/core/service/Context.hpp>
+#include <sirikata/core/trace/Trace.hpp>
+#include <sirikata/core/options/Options.hpp>
+
+namespace Sirikata {
+
+namespace SSTReceiveBench {
+
+// Endpoint identifier for the loopback datagram layer, just an integer.
+class ID {
+public:
+    ID()
+     : mID(0)
+    {}
+    explicit ID(uint32 id)
+     : mID(id)
+    {}
+
+    String toString() const { return boost::lexical_cast<String>(mID); }
+
+    bool operator<(const ID& rhs) const { return mID < rhs.mID; }
+    bool operator==(const ID& rhs) const { return mID == rhs.mID; }
+    bool operator!=(const ID& rhs) const { return mID != rhs.mID; }
+    class Hasher {
+    public:
+        size_t operator()(const ID& id) const {
+            return std::tr1::hash<uint32>()(id.mID);
+        }
+    };
+
+private:
+    uint32 mID;
+};
+
+// Delivers datagrams between endpoints in the same process. Delivery is
+// posted to the IOService rather than a strand so packets are handled by
+// whichever worker thread is available, like they would be for a real
+// network.
+class LoopbackService {
+public:
+    typedef std::tr1::function<void(const ID&, ObjectMessagePort, const ID&, ObjectMessagePort, void*, uint32)> DatagramCallback;
+
+    LoopbackService(Context* ctx)
+     : mContext(ctx),
+       mNextPort(1),
+       mPacketsDelivered(0)
+    {}
+
+    void listen(const ID& ep, ObjectMessagePort port, DatagramCallback cb) {
+        boost::mutex::scoped_lock lock(mMutex);
+        mHandlers[SST::EndPoint<ID>(ep, port)] = cb;
+    }
+
+    void unlisten(const ID& ep, ObjectMessagePort port) {
+        boost::mutex::scoped_lock lock(mMutex);
+        mHandlers.erase(SST::EndPoint<ID>(ep, port));
+    }
+
+    void send(const ID& src, ObjectMessagePort src_port, const ID& dst, ObjectMessagePort dst_port, void* payload, uint32 payload_size) {
+        mContext->ioService->post(
+            std::tr1::bind(&LoopbackService::deliver, this,
+                src, src_port, dst, dst_port,
+                String((char*)payload, payload_size)
+            )
+        );
+    }
+
+    ObjectMessagePort unused(const ID& ep) {
+        boost::mutex::scoped_lock lock(mMutex);
+        return mNextPort++;
+    }
+
+    uint64 packetsDelivered() const { return mPacketsDelivered.read(); }
+
+private:
+    void deliver(const ID& src, ObjectMessagePort src_port, const ID& dst, ObjectMessagePort dst_port, String payload) {
+        DatagramCallback cb;
+        {
+            boost::mutex::scoped_lock lock(mMutex);
+            HandlerMap::iterator it = mHandlers.find(SST::EndPoint<ID>(dst, dst_port));
+            if (it == mHandlers.end()) return;
+            cb = it->second;
+        }
+        ++mPacketsDelivered;
+        cb(src, src_port, dst, dst_port, (void*)payload.data(), payload.size());
+    }
+
+    Context* mContext;
+
+    boost::mutex mMutex;
+    typedef std::tr1::unordered_map<SST::EndPoint<ID>, DatagramCallback, SST::EndPoint<ID>::Hasher> HandlerMap;
+    HandlerMap mHandlers;
+    ObjectMessagePort mNextPort;
+
+    AtomicValue<uint64> mPacketsDelivered;
+};
+
+} // namespace SSTReceiveBench
+
+namespace SST {
+
+template <>
+class BaseDatagramLayer<SSTReceiveBench::ID>
+{
+  private:
+    typedef SSTReceiveBench::ID EndPointType;
+
+  public:
+    typedef std::tr1::shared_ptr<BaseDatagramLayer<EndPointType> > Ptr;
+    typedef Ptr BaseDatagramLayerPtr;
+
+    typedef std::tr1::function<void(void*, int)> DataCallback;
+
+    static BaseDatagramLayerPtr getDatagramLayer(ConnectionVariables<EndPointType>* sstConnVars,
+                                                 EndPointType endPoint)
+    {
+        return sstConnVars->getDatagramLayer(endPoint);
+    }
+
+    static BaseDatagramLayerPtr createDatagramLayer(
+        ConnectionVariables<EndPointType>* sstConnVars,
+        EndPointType endPoint,
+        const Context* ctx,
+        SSTReceiveBench::LoopbackService* loopback)
+    {
+        BaseDatagramLayerPtr datagramLayer = getDatagramLayer(sstConnVars, endPoint);
+        if (datagramLayer) return datagramLayer;
+
+        datagramLayer = BaseDatagramLayerPtr(
+            new BaseDatagramLayer(sstConnVars, ctx, loopback, endPoint)
+        );
+        sstConnVars->addDatagramLayer(endPoint, datagramLayer);
+
+        return datagramLayer;
+    }
+
+    static void stopListening(ConnectionVariables<EndPointType>* sstConnVars, EndPoint<EndPointType>& listeningEndPoint) {
+        EndPointType endPointID = listeningEndPoint.endPoint;
+
+        BaseDatagramLayerPtr bdl = sstConnVars->getDatagramLayer(endPointID);
+        if (!bdl) return;
+        sstConnVars->removeDatagramLayer(endPointID, true);
+        bdl->unlisten(listeningEndPoint);
+    }
+
+    void listenOn(EndPoint<EndPointType>& listeningEndPoint, DataCallback cb) {
+        mLoopback->listen(
+            listeningEndPoint.endPoint, listeningEndPoint.port,
+            std::tr1::bind(
+                &BaseDatagramLayer::receiveMessageToCallback, this,
+                std::tr1::placeholders::_1,
+                std::tr1::placeholders::_2,
+                std::tr1::placeholders::_3,
+                std::tr1::placeholders::_4,
+                std::tr1::placeholders::_5,
+                std::tr1::placeholders::_6,
+                cb
+            )
+        );
+    }
+
+    void listenOn(const EndPoint<EndPointType>& listeningEndPoint) {
+        mLoopback->listen(
+            listeningEndPoint.endPoint, listeningEndPoint.port,
+            std::tr1::bind(
+                &BaseDatagramLayer::receiveMessage, this,
+                std::tr1::placeholders::_1,
+                std::tr1::placeholders::_2,
+                std::tr1::placeholders::_3,
+                std::tr1::placeholders::_4,
+                std::tr1::placeholders::_5,
+                std::tr1::placeholders::_6
+            )
+        );
+    }
+
+    void unlisten(EndPoint<EndPointType>& ep) {
+        mLoopback->unlisten(ep.endPoint, ep.port);
+    }
+
+    void send(EndPoint<EndPointType>* src, EndPoint<EndPointType>* dest, const SegmentBufferPtr& packet) {
+        mLoopback->send(
+            src->endPoint, src->port,
+            dest->endPoint, dest->port,
+            packet->data(), packet->size()
+        );
+    }
+
+    const Context* context() {
+        return mContext;
+    }
+
+    uint32 getUnusedPort(const EndPointType& ep) {
+        return mLoopback->unused(ep);
+    }
+
+    void invalidate() {
+        mLoopback = NULL;
+        mSSTConnVars->removeDatagramLayer(mEndpoint, true);
+    }
+
+  private:
+    BaseDatagramLayer(ConnectionVariables<EndPointType>* sstConnVars, const Context* ctx, SSTReceiveBench::LoopbackService* loopback, const EndPointType& ep)
+        : mContext(ctx),
+          mLoopback(loopback),
+          mSSTConnVars(sstConnVars),
+          mEndpoint(ep)
+        {
+        }
+
+    void receiveMessage(const EndPointType& src, ObjectMessagePort src_port, const EndPointType& dst, ObjectMessagePort dst_port, void* payload, uint32 payload_size) {
+        Connection<EndPointType>::handleReceive(
+            mSSTConnVars,
+            EndPoint<EndPointType> (src, src_port),
+            EndPoint<EndPointType> (dst, dst_port),
+            payload, payload_size
+        );
+    }
+
+    void receiveMessageToCallback(const EndPointType& src, ObjectMessagePort src_port, const EndPointType& dst, ObjectMessagePort dst_port, void* payload, uint32 payload_size, DataCallback cb) {
+        cb(payload, payload_size);
+    }
+
+    const Context* mContext;
+    SSTReceiveBench::LoopbackService* mLoopback;
+
+    ConnectionVariables<EndPointType>* mSSTConnVars;
+    EndPointType mEndpoint;
+};
+
+} // namespace SST
+
+using std::tr1::placeholders::_1;
+using std::tr1::placeholders::_2;
+
+// Server endpoints are [1, N], clients are [N+1, 2N]
+#define SERVER_ID(i) SSTReceiveBench::ID(i+1)
+#define CLIENT_ID(i) SSTReceiveBench::ID(mNumConnections+i+1)
+#define LISTEN_PORT 1
+
+SSTReceiveBenchmark::SSTReceiveBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false),
+          mTrace(NULL),
+          mIOService(NULL),
+          mMainStrand(NULL),
+          mWork(NULL),
+          mContext(NULL),
+          mLoopback(NULL),
+          mConnectionManager(NULL)
+{
+    OptionValue* threads;
+    OptionValue* connections;
+    OptionValue* bytes;
+    Sirikata::InitializeClassOptions ico("SSTReceiveBenchmark",this,
+        threads=new OptionValue("threads","4",Sirikata::OptionValueType<uint32>(),"number of threads processing received packets"),
+        connections=new OptionValue("connections","16",Sirikata::OptionValueType<uint32>(),"number of SST connections sending data concurrently"),
+        bytes=new OptionValue("bytes","4000000",Sirikata::OptionValueType<uint32>(),"bytes transferred over each connection"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("SSTReceiveBenchmark",this);
+    optionsSet->parse(param);
+
+    mNumThreads = std::max((uint32)1, threads->as<uint32>());
+    mNumConnections = std::max((uint32)1, connections->as<uint32>());
+    mBytesPerConnection = bytes->as<uint32>();
+
+    mPayload.resize(mBytesPerConnection);
+    for(uint32 i = 0; i < mBytesPerConnection; i++)
+        mPayload[i] = ('a' + (i % 26));
+}
+
+String SSTReceiveBenchmark::name() {
+    return "sst-receive";
+}
+
+void SSTReceiveBenchmark::setup() {
+    mTrace = new Trace::Trace("sst-receive-benchmark.trace");
+    mIOService = new Network::IOService("SSTReceiveBenchmark");
+    mMainStrand = mIOService->createStrand("SSTReceiveBenchmark Main");
+    mWork = new Network::IOWork(*mIOService, "SSTReceiveBenchmark IOWork");
+    mContext = new Context("SSTReceiveBenchmark", mIOService, mMainStrand, mTrace, Timer::now());
+
+    mLoopback = new SSTReceiveBench::LoopbackService(mContext);
+    mConnectionManager = new SST::ConnectionManager<EndPointID>();
+
+    mContext->add(mContext);
+    mContext->add(mConnectionManager);
+
+    for(uint32 i = 0; i < mNumConnections; i++) {
+        mConnectionManager->createDatagramLayer(SERVER_ID(i), mContext, mLoopback);
+        mConnectionManager->createDatagramLayer(CLIENT_ID(i), mContext, mLoopback);
+    }
+
+    mContext->run(mNumThreads, Context::AllNew);
+}
+
+void SSTReceiveBenchmark::teardown() {
+    delete mWork;
+    mWork = NULL;
+
+    mContext->shutdown();
+    mTrace->prepareShutdown();
+
+    delete mContext;
+    mContext = NULL;
+
+    mTrace->shutdown();
+    delete mTrace;
+    mTrace = NULL;
+
+    delete mMainStrand;
+    mMainStrand = NULL;
+    delete mIOService;
+    mIOService = NULL;
+
+    // Must come after the IOService is destroyed since queued handlers can
+    // still refer to connections, see SSTTest.
+    delete mConnectionManager;
+    mConnectionManager = NULL;
+    delete mLoopback;
+    mLoopback = NULL;
+}
+
+void SSTReceiveBenchmark::onAccepted(int err, StreamPtr s) {
+    if (err != SST_IMPL_SUCCESS) return;
+
+    // Need this to last across many calls to read
+    uint32* read_so_far = new uint32(0);
+    s->registerReadCallback(
+        std::tr1::bind(&SSTReceiveBenchmark::onRead, this, _1, _2, read_so_far)
+    );
+}
+
+void SSTReceiveBenchmark::onRead(uint8* data, int size, uint32* read_so_far) {
+    *read_so_far += size;
+    if (*read_so_far == mBytesPerConnection) {
+        delete read_so_far;
+        mCompleted.push(true);
+    }
+}
+
+void SSTReceiveBenchmark::onConnected(int err, StreamPtr s) {
+    if (err != SST_IMPL_SUCCESS) {
+        SILOG(benchmark,error,"SST connection failed");
+        return;
+    }
+    writeData(s, 0);
+}
+
+void SSTReceiveBenchmark::writeData(StreamPtr s, uint32 from) {
+    if (mForceStop) return;
+
+    from += s->write((const uint8*)mPayload.data() + from, mPayload.size() - from);
+    if (from == mPayload.size()) return;
+
+    // Buffers are full, try again once some data has made it out
+    mContext->mainStrand->post(
+        Duration::milliseconds(1),
+        std::tr1::bind(&SSTReceiveBenchmark::writeData, this, s, from)
+    );
+}
+
+void SSTReceiveBenchmark::start() {
+    mForceStop = false;
+
+    setup();
+
+    for(uint32 i = 0; i < mNumConnections; i++) {
+        mConnectionManager->listen(
+            std::tr1::bind(&SSTReceiveBenchmark::onAccepted, this, _1, _2),
+            SST::EndPoint<EndPointID>(SERVER_ID(i), LISTEN_PORT)
+        );
+    }
+
+    Time start_time = Timer::now();
+    for(uint32 i = 0; i < mNumConnections; i++) {
+        mConnectionManager->connectStream(
+            SST::EndPoint<EndPointID>(CLIENT_ID(i), LISTEN_PORT),
+            SST::EndPoint<EndPointID>(SERVER_ID(i), LISTEN_PORT),
+            std::tr1::bind(&SSTReceiveBenchmark::onConnected, this, _1, _2)
+        );
+    }
+
+    uint32 completed = 0;
+    while(completed < mNumConnections && !mForceStop) {
+        bool done;
+        if (mCompleted.blockingPop(done, Duration::milliseconds(100)))
+            completed++;
+    }
+    Time end_time = Timer::now();
+    uint64 packets = mLoopback->packetsDelivered();
+
+    teardown();
+
+    if (mForceStop) return;
+
+    Duration dur = end_time - start_time;
+    uint64 total_bytes = (uint64)mNumConnections * mBytesPerConnection;
+    SILOG(benchmark,info,
+          mNumConnections << " connections, " << mNumThreads << " threads, "
+          << total_bytes << " bytes, " << dur << ": "
+          << float(total_bytes)/dur.toSeconds()/(1024*1024) << " MB/s, "
+          << float(packets)/dur.toSeconds() << " packets/s");
+
+    notifyFinished();
+}
+
+void SSTReceiveBenchmark::stop() {
+    mForceStop = true;
+}
+
+} // namespace Sirikata
@@ -0,0 +1,80 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_SST_RECEIVE_BENCHMARK_HPP_
+#define _SIRIKATA_SST_RECEIVE_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+#include <sirikata/core/queue/ThreadSafeQueue.hpp>
+
+namespace Sirikata {
+
+namespace Trace {
+class Trace;
+}
+namespace SSTReceiveBench {
+class ID;
+class LoopbackService;
+}
+namespace SST {
+template <typename EndPointType> class ConnectionManager;
+template <typename EndPointType> class Stream;
+}
+
+/** Measures SST receive throughput when packets are processed by multiple
+ *  threads. A number of connections are set up over an in-process loopback
+ *  datagram layer which delivers packets directly to the Context's
+ *  IOService, i.e. to any of its worker threads rather than a single strand,
+ *  and each connection transfers a fixed amount of data.
+ */
+class SSTReceiveBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& param) {
+        return new SSTReceiveBenchmark(finished_cb, param);
+    }
+
+    SSTReceiveBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    typedef SSTReceiveBench::ID EndPointID;
+    typedef SST::Stream<EndPointID> StreamType;
+    typedef std::tr1::shared_ptr<StreamType> StreamPtr;
+
+    void setup();
+    void teardown();
+
+    void onAccepted(int err, StreamPtr s);
+    void onConnected(int err, StreamPtr s);
+    void onRead(uint8* data, int size, uint32* read_so_far);
+    void writeData(StreamPtr s, uint32 from);
+
+    bool mForceStop;
+
+    uint32 mNumThreads;
+    uint32 mNumConnections;
+    uint32 mBytesPerConnection;
+    String mPayload;
+
+    Trace::Trace* mTrace;
+    Network::IOService* mIOService;
+    Network::IOStrand* mMainStrand;
+    Network::IOWork* mWork;
+    Context* mContext;
+    SSTReceiveBench::LoopbackService* mLoopback;
+    SST::ConnectionManager<EndPointID>* mConnectionManager;
+
+    // Signaled each time a connection finishes receiving all its data
+    ThreadSafeQueue<bool> mCompleted;
+}; // class SSTReceiveBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_SST_RECEIVE_BENCHMARK_HPP_
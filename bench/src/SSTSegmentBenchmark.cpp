@@ -0,0 +1,199 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "SSTSegmentBenchmark.hpp"
+#include <sirikata/core/network/SSTImpl.hpp>
+#include <boost/lexical_cast.hpp>
+#include <new>
+#include <cstdlib>
+
+#define ITERATIONS 200000
+#define DEFAULT_PAYLOAD_SIZE 1000
+
+// Count every heap allocation made by the process so we can report how many
+// each packet requires. This replaces operator new for the whole binary, so
+// this benchmark is built into its own executable, sst_segment_bench, rather
+// than into bench with the others.
+namespace {
+Sirikata::AtomicValue<Sirikata::uint64> sHeapAllocations(0);
+}
+
+void* operator new(std::size_t size) throw(std::bad_alloc) {
+    ++sHeapAllocations;
+    void* result = std::malloc(size == 0 ? 1 : size);
+    if (result == NULL) throw std::bad_alloc();
+    return result;
+}
+
+void* operator new[](std::size_t size) throw(std::bad_alloc) {
+    return operator new(size);
+}
+
+void operator delete(void* ptr) throw() {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) throw() {
+    std::free(ptr);
+}
+
+namespace Sirikata {
+
+using namespace Sirikata::SST;
+using namespace Sirikata::Protocol::SST;
+
+SSTSegmentBenchmark::SSTSegmentBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mPayloadSize(DEFAULT_PAYLOAD_SIZE),
+          mForceStop(false)
+{
+    if (!param.empty()) {
+        try {
+            mPayloadSize = boost::lexical_cast<uint32>(param);
+        } catch(boost::bad_lexical_cast&) {
+            SILOG(benchmark,error,"Invalid payload size '" << param << "', using " << mPayloadSize);
+        }
+    }
+    if (mPayloadSize > SegmentBuffer::CAPACITY - SegmentBuffer::HEADROOM)
+        mPayloadSize = SegmentBuffer::CAPACITY - SegmentBuffer::HEADROOM;
+}
+
+String SSTSegmentBenchmark::name() {
+    return "sst-segment";
+}
+
+namespace {
+
+void fillStreamHeader(SSTStreamHeader& sstMsg, uint64 offset) {
+    sstMsg.set_lsid( 1 );
+    sstMsg.set_type(SSTStreamHeader::DATA);
+    sstMsg.set_flags(0);
+    sstMsg.set_window( 15 );
+    sstMsg.set_src_port(10);
+    sstMsg.set_dest_port(11);
+    sstMsg.set_bsn(offset);
+}
+
+void fillChannelHeader(SSTChannelHeader& sstMsg, uint64 seqno) {
+    sstMsg.set_channel_id( 1 );
+    sstMsg.set_transmit_sequence_number(seqno);
+    sstMsg.set_ack_count(1);
+    sstMsg.set_ack_sequence_number(seqno);
+}
+
+} // namespace
+
+void SSTSegmentBenchmark::runCopying(uint32 iterations) {
+    uint8* payload = new uint8[mPayloadSize];
+    memset(payload, 0, mPayloadSize);
+
+    uint64 allocs_before = sHeapAllocations.read();
+    Time start_time = Timer::now();
+
+    uint64 total_bytes = 0;
+    for(uint32 ii = 0; ii < iterations && !mForceStop; ii++) {
+        // Stream layer: copy data into header, serialize to a string
+        SSTStreamHeader stream_msg;
+        fillStreamHeader(stream_msg, ii * (uint64)mPayloadSize);
+        stream_msg.set_payload(payload, mPayloadSize);
+        std::string stream_buffer = serializePBJMessage(stream_msg);
+
+        // Connection layer: copy into a segment
+        uint8* segment = new uint8[stream_buffer.size()];
+        memcpy(segment, stream_buffer.data(), stream_buffer.size());
+
+        // Channel layer: copy segment into header, serialize again
+        SSTChannelHeader channel_msg;
+        fillChannelHeader(channel_msg, ii);
+        channel_msg.set_payload(segment, stream_buffer.size());
+        std::string channel_buffer = serializePBJMessage(channel_msg);
+        total_bytes += channel_buffer.size();
+
+        delete[] segment;
+    }
+
+    Time end_time = Timer::now();
+    uint64 allocs = sHeapAllocations.read() - allocs_before;
+    delete[] payload;
+
+    if (mForceStop) return;
+
+    Duration dur = end_time - start_time;
+    SILOG(benchmark,info,
+          "Copying: " << iterations << " packets, " << dur << ": "
+          << (dur.toMicroseconds()*1000/float(iterations)) << "ns/packet, "
+          << float(total_bytes)/dur.toSeconds()/(1024*1024) << " MB/s, "
+          << float(allocs)/iterations << " allocations/packet");
+}
+
+void SSTSegmentBenchmark::runPooled(uint32 iterations) {
+    uint8* payload = new uint8[mPayloadSize];
+    memset(payload, 0, mPayloadSize);
+
+    // Warm up the pool and the payload field encodings so we only measure
+    // steady state behavior.
+    {
+        SSTStreamHeader stream_msg;
+        fillStreamHeader(stream_msg, 0);
+        SSTChannelHeader channel_msg;
+        fillChannelHeader(channel_msg, 0);
+        SegmentBufferPtr buffer(SegmentBuffer::allocate());
+        buffer->append(payload, mPayloadSize);
+        buffer = encodeHeaderWithPayload(stream_msg, buffer);
+        buffer = encodeHeaderWithPayload(channel_msg, buffer);
+    }
+
+    SegmentBuffer::Stats stats_before = SegmentBuffer::stats();
+    uint64 allocs_before = sHeapAllocations.read();
+    Time start_time = Timer::now();
+
+    uint64 total_bytes = 0;
+    for(uint32 ii = 0; ii < iterations && !mForceStop; ii++) {
+        SegmentBufferPtr buffer(SegmentBuffer::allocate());
+        buffer->append(payload, mPayloadSize);
+
+        SSTStreamHeader stream_msg;
+        fillStreamHeader(stream_msg, ii * (uint64)mPayloadSize);
+        buffer = encodeHeaderWithPayload(stream_msg, buffer);
+
+        SSTChannelHeader channel_msg;
+        fillChannelHeader(channel_msg, ii);
+        buffer = encodeHeaderWithPayload(channel_msg, buffer);
+        total_bytes += buffer->size();
+    }
+
+    Time end_time = Timer::now();
+    uint64 allocs = sHeapAllocations.read() - allocs_before;
+    SegmentBuffer::Stats stats_after = SegmentBuffer::stats();
+    delete[] payload;
+
+    if (mForceStop) return;
+
+    Duration dur = end_time - start_time;
+    SILOG(benchmark,info,
+          "Pooled: " << iterations << " packets, " << dur << ": "
+          << (dur.toMicroseconds()*1000/float(iterations)) << "ns/packet, "
+          << float(total_bytes)/dur.toSeconds()/(1024*1024) << " MB/s, "
+          << float(allocs)/iterations << " allocations/packet, "
+          << (stats_after.slabs - stats_before.slabs) << " new slabs");
+}
+
+void SSTSegmentBenchmark::start() {
+    mForceStop = false;
+
+    SILOG(benchmark,info, "Generating SST packets with " << mPayloadSize << " byte payloads");
+
+    runCopying(ITERATIONS);
+    if (mForceStop) return;
+    runPooled(ITERATIONS);
+    if (mForceStop) return;
+
+    notifyFinished();
+}
+
+void SSTSegmentBenchmark::stop() {
+    mForceStop = true;
+}
+
+} // namespace Sirikata
@@ -0,0 +1,42 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_SST_SEGMENT_BENCHMARK_HPP_
+#define _SIRIKATA_SST_SEGMENT_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+
+namespace Sirikata {
+
+/** Compares the cost of generating SST packets by copying each layer's
+ *  serialized data into the next layer's header (the old send path) against
+ *  serializing headers in place into pooled segment buffers. Reports
+ *  throughput and the number of heap allocations per packet for each.
+ */
+class SSTSegmentBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& _param) {
+        return new SSTSegmentBenchmark(finished_cb, _param);
+    }
+
+    SSTSegmentBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    void runCopying(uint32 iterations);
+    void runPooled(uint32 iterations);
+
+    uint32 mPayloadSize;
+    bool mForceStop;
+}; // class SSTSegmentBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_SST_SEGMENT_BENCHMARK_HPP_
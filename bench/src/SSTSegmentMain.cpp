@@ -0,0 +1,31 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "BenchmarkRunner.hpp"
+#include "SSTSegmentBenchmark.hpp"
+
+#include <sirikata/core/util/DynamicLibrary.hpp>
+#include <sirikata/core/options/CommonOptions.hpp>
+
+using namespace Sirikata;
+
+// The SST segment benchmark counts heap allocations by replacing the global
+// operator new, so it runs as its own binary instead of as part of bench,
+// where the replacement would affect every other benchmark.
+int main(int argc, char** argv) {
+    DynamicLibrary::Initialize();
+    // SST reads global options, e.g. window sizes, so make sure the defaults
+    // are available.
+    InitOptions();
+    FakeParseOptions();
+
+    BenchmarkFactory factory;
+    factory.registerConstructor("sst-segment", SSTSegmentBenchmark::create);
+
+    BenchmarkRunner runner(factory, Duration::seconds(30.f));
+    // The only argument is the payload size
+    runner.run("sst-segment", argc > 1 ? argv[1] : "");
+
+    return 0;
+}
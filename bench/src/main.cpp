@@ -37,8 +37,19 @@
 #include "TimerMonotonicityBenchmark.hpp"
 #include "TCPSSTBenchmark.hpp"
 #include "UUIDSpeedBenchmark.hpp"
+#include "SSTReceiveBenchmark.hpp"
+#include "QueueBenchmark.hpp"
+#include "FairQueueBenchmark.hpp"
+#include "InterServerBenchmark.hpp"
+#include "OSegCacheBenchmark.hpp"
+#include "ProxResultEncoderBenchmark.hpp"
+#include "ProxGridBenchmark.hpp"
+#include "LocEncodingBenchmark.hpp"
+#include "LocSubscriberIndexBenchmark.hpp"
+#include "DiskCacheBenchmark.hpp"
 
 #include <sirikata/core/util/DynamicLibrary.hpp>
+#include <sirikata/core/options/CommonOptions.hpp>
 
 using namespace Sirikata;
 
@@ -53,6 +64,10 @@ void runAll(BenchmarkRunner& runner, const BenchmarkList all_benchmarks) {
 
 int main(int argc, char** argv) {
     DynamicLibrary::Initialize();
+    // Some benchmarks exercise code which reads global options, e.g. SST
+    // window sizes, so make sure the defaults are available.
+    InitOptions();
+    FakeParseOptions();
 
     BenchmarkFactory factory;
     BenchmarkList all_benchmarks;
@@ -68,9 +83,20 @@ int main(int argc, char** argv) {
     ADD_BENCHMARK(timer-monotonicity, TimerMonotonicityBenchmark::create);
 
     ADD_BENCHMARK(ping, SSTBenchmark::create);
+    ADD_BENCHMARK(sst-receive, SSTReceiveBenchmark::create);
+    ADD_BENCHMARK(inter-server, InterServerBenchmark::create);
+    ADD_BENCHMARK(oseg-cache, OSegCacheBenchmark::create);
+    ADD_BENCHMARK(prox-encoder, ProxResultEncoderBenchmark::create);
+    ADD_BENCHMARK(prox-grid, ProxGridBenchmark::create);
+    ADD_BENCHMARK(loc-encoding, LocEncodingBenchmark::create);
+    ADD_BENCHMARK(loc-fanout, LocSubscriberIndexBenchmark::create);
+    ADD_BENCHMARK(disk-cache, DiskCacheBenchmark::create);
 
     ADD_BENCHMARK(uuid-create, UUIDSpeedBenchmark::create);
 
+    ADD_BENCHMARK(queue, QueueBenchmark::create);
+    ADD_BENCHMARK(fair-queue, FairQueueBenchmark::create);
+
     BenchmarkRunner runner(factory, Duration::seconds(30.f));
 
 
@@ -0,0 +1,189 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_CORE_NETWORK_MESSAGE_BATCH_HPP_
+#define _SIRIKATA_CORE_NETWORK_MESSAGE_BATCH_HPP_
+
+#include <sirikata/core/util/Platform.hpp>
+
+namespace Sirikata {
+namespace Network {
+
+/** Iterates over the messages contained in a buffer. A buffer is either a
+ *  single message, as sent by peers that don't batch, or a batch generated by
+ *  MessageBatchWriter:
+ *
+ *    [BATCH_MARKER] ([varint length] [message])*
+ *
+ *  The marker is a zero byte, which can never start a serialized protocol
+ *  buffer since field number 0 isn't allowed, so both formats can be
+ *  distinguished without any other framing.
+ */
+class MessageBatchReader {
+public:
+    enum {
+        BATCH_MARKER = 0x00
+    };
+
+    MessageBatchReader(const void* data, uint32 len)
+     : mPos((const uint8*)data),
+       mEnd((const uint8*)data + len),
+       mBatched(len > 0 && *(const uint8*)data == BATCH_MARKER)
+    {
+        if (mBatched)
+            mPos++;
+    }
+
+    /** Get the next message, returning false when there are none left or the
+     *  rest of the batch is malformed.
+     */
+    bool next(MemoryReference* msg) {
+        if (mPos >= mEnd) return false;
+
+        if (!mBatched) {
+            *msg = MemoryReference(mPos, mEnd - mPos);
+            mPos = mEnd;
+            return true;
+        }
+
+        uint32 len = 0;
+        for(uint32 shift = 0; ; shift += 7) {
+            if (mPos >= mEnd || shift > 28) {
+                mPos = mEnd;
+                return false;
+            }
+            uint8 b = *mPos++;
+            len |= (uint32)(b & 0x7F) << shift;
+            if ((b & 0x80) == 0) break;
+        }
+        if (len > (uint32)(mEnd - mPos)) {
+            mPos = mEnd;
+            return false;
+        }
+
+        *msg = MemoryReference(mPos, len);
+        mPos += len;
+        return true;
+    }
+
+    /** Get the number of bytes which haven't been consumed yet. */
+    uint32 remaining() const {
+        return mEnd - mPos;
+    }
+
+private:
+    const uint8* mPos;
+    const uint8* mEnd;
+    bool mBatched;
+};
+
+/** Builds a batch of messages in the format read by MessageBatchReader.
+ *  Messages can be serialized directly into the batch by reserving space with
+ *  append(len). The buffer is kept when the batch is cleared, so once it has
+ *  grown to the usual batch size building batches doesn't allocate.
+ */
+class MessageBatchWriter {
+public:
+    enum {
+        // Largest number of bytes framing adds to a single message
+        MAX_FRAMING_BYTES = 6
+    };
+
+    MessageBatchWriter()
+     : mCount(0),
+       mFirstOffset(0),
+       mLastFrameOffset(0)
+    {}
+
+    /** Get the number of messages in the batch. */
+    uint32 count() const {
+        return mCount;
+    }
+
+    bool empty() const {
+        return mCount == 0;
+    }
+
+    /** Get the size of the batch in bytes, including framing. */
+    size_t size() const {
+        return mData.size();
+    }
+
+    /** Add a message of len bytes to the batch.
+     *  \returns a pointer to len bytes of storage for the message, valid until
+     *  the batch is next modified
+     */
+    uint8* append(uint32 len) {
+        if (mCount == 0)
+            mData.push_back((uint8)MessageBatchReader::BATCH_MARKER);
+        mLastFrameOffset = mData.size();
+
+        uint32 framed_len = len;
+        do {
+            uint8 b = framed_len & 0x7F;
+            framed_len >>= 7;
+            if (framed_len > 0) b |= 0x80;
+            mData.push_back(b);
+        } while(framed_len > 0);
+
+        size_t offset = mData.size();
+        if (mCount == 0)
+            mFirstOffset = offset;
+        mData.resize(offset + len);
+        mCount++;
+        return &mData[0] + offset;
+    }
+
+    /** Add a copy of a message to the batch. */
+    void append(const void* data, uint32 len) {
+        uint8* dest = append(len);
+        if (len > 0)
+            memcpy(dest, data, len);
+    }
+
+    /** Remove the most recently appended message, e.g. because serializing it
+     *  into the space returned by append() failed.
+     */
+    void removeLast() {
+        if (mCount == 0) return;
+        mCount--;
+        mData.resize(mCount == 0 ? 0 : mLastFrameOffset);
+    }
+
+    /** Get the contents of the batch. A batch with a single message is
+     *  returned without any framing so the receiver sees a plain message.
+     */
+    MemoryReference data() const {
+        if (mCount == 0)
+            return MemoryReference::null();
+        if (mCount == 1)
+            return MemoryReference(&mData[0] + mFirstOffset, mData.size() - mFirstOffset);
+        return MemoryReference(&mData[0], mData.size());
+    }
+
+    /** Remove all messages, keeping the buffer for the next batch. */
+    void clear() {
+        mData.clear();
+        mCount = 0;
+    }
+
+    void swap(MessageBatchWriter& other) {
+        mData.swap(other.mData);
+        std::swap(mCount, other.mCount);
+        std::swap(mFirstOffset, other.mFirstOffset);
+        std::swap(mLastFrameOffset, other.mLastFrameOffset);
+    }
+
+private:
+    std::vector<uint8> mData;
+    uint32 mCount;
+    size_t mFirstOffset;
+    // Only valid for the last message, removeLast() can't be called twice
+    size_t mLastFrameOffset;
+};
+
+} // namespace Network
+} // namespace Sirikata
+
+#endif //_SIRIKATA_CORE_NETWORK_MESSAGE_BATCH_HPP_
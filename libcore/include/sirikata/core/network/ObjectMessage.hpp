@@ -49,6 +49,7 @@ typedef uint32 ObjectMessagePort;
 #define OBJECT_PORT_PROXIMITY     2
 #define OBJECT_PORT_LOCATION      3
 #define OBJECT_PORT_TIMESYNC      4
+#define OBJECT_PORT_LOCATION_COMPACT 5
 #define OBJECT_SPACE_PORT         253
 #define OBJECT_PORT_PING          254
 
@@ -0,0 +1,253 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_CORE_NETWORK_SST_DATAGRAM_BATCHER_HPP_
+#define _SIRIKATA_CORE_NETWORK_SST_DATAGRAM_BATCHER_HPP_
+
+#include <sirikata/core/network/SSTImpl.hpp>
+#include <sirikata/core/network/MessageBatch.hpp>
+#include <sirikata/core/network/IOStrand.hpp>
+#include <sirikata/core/service/Context.hpp>
+#include <sirikata/core/trace/TimeSeries.hpp>
+#include <sirikata/core/options/CommonOptions.hpp>
+
+namespace Sirikata {
+namespace SST {
+
+/** Iterates over the SST packets contained in a datagram. A datagram is
+ *  either a single packet, as sent by peers that don't batch, or a batch of
+ *  packets generated by DatagramBatcher, using the MessageBatchReader framing.
+ */
+typedef Network::MessageBatchReader DatagramBatchReader;
+
+/** Coalesces SST packets headed to the same remote endpoint into a single
+ *  datagram before handing them to the underlying datagram service. Packets
+ *  are held until either the batch size is reached for the endpoint or the
+ *  flush latency has passed since the first one was queued. A latency of zero
+ *  flushes once the current handler on the main strand finishes, which picks
+ *  up all the segments generated by a single pass over a connection's queue
+ *  without adding any delay.
+ *
+ *  Queued packets aren't copied: the batcher holds a reference to each
+ *  packet's SegmentBuffer until the batch is flushed. Batches containing only
+ *  one packet are sent straight from that buffer as a plain packet, so
+ *  batching costs nothing for sparse traffic. Only batches of several packets
+ *  are framed, which gathers them into a single datagram. A batch size of 1
+ *  disables batching entirely, and is the default since peers which predate
+ *  batching can't parse batched datagrams.
+ *
+ *  Use create() and hold onto the result with a shared_ptr; pending flushes
+ *  only hold weak references, so the batcher can be destroyed at any time.
+ */
+template <typename EndPointType>
+class DatagramBatcher {
+public:
+    typedef std::tr1::shared_ptr<DatagramBatcher> Ptr;
+    typedef std::tr1::weak_ptr<DatagramBatcher> WPtr;
+
+    typedef std::tr1::function<void(const EndPoint<EndPointType>&, const EndPoint<EndPointType>&, const MemoryReference&)> SendCallback;
+
+    enum {
+        // Maximum size of a batched datagram. Packets which would push a batch
+        // past this are sent in the next one.
+        MAX_BATCH_BYTES = 8192
+    };
+
+    /** Create a batcher using the sst.batch-size and sst.batch-flush-latency
+     *  options.
+     */
+    static Ptr create(const Context* ctx, const SendCallback& sender) {
+        return create(
+            ctx, sender,
+            GetOptionValue<uint32>(OPT_SST_BATCH_SIZE),
+            GetOptionValue<Duration>(OPT_SST_BATCH_FLUSH_LATENCY)
+        );
+    }
+
+    static Ptr create(const Context* ctx, const SendCallback& sender, uint32 max_packets, const Duration& flush_latency) {
+        Ptr result(new DatagramBatcher(ctx, sender, max_packets, flush_latency));
+        result->mWeakThis = result;
+        return result;
+    }
+
+    /** Queue a packet for dest. The packet's buffer is sent as is when the
+     *  batch is flushed, so it must not be modified until then. SST only
+     *  rewrites a buffer when retransmitting the segment it holds, which
+     *  happens long after the batch has been flushed.
+     */
+    void send(const EndPoint<EndPointType>& src, const EndPoint<EndPointType>& dest, const SegmentBufferPtr& packet) {
+        if (mMaxPackets <= 1) {
+            mSender(src, dest, MemoryReference(packet->data(), packet->size()));
+            return;
+        }
+
+        BatchList ready;
+        {
+            boost::mutex::scoped_lock lock(mMutex);
+
+            BatchKey key(src, dest);
+            typename BatchMap::iterator it = mPending.find(key);
+            if (it == mPending.end())
+                it = mPending.insert( typename BatchMap::value_type(key, Batch()) ).first;
+
+            uint32 framed_size = packet->size() + Network::MessageBatchWriter::MAX_FRAMING_BYTES;
+            if (!it->second.empty() && it->second.bytes + framed_size > MAX_BATCH_BYTES)
+                takeBatch(it, &ready);
+
+            Batch& batch = it->second;
+            batch.packets.push_back(packet);
+            batch.bytes += framed_size;
+
+            if (batch.packets.size() >= mMaxPackets)
+                takeBatch(it, &ready);
+            else
+                scheduleFlush();
+        }
+
+        sendBatches(ready);
+    }
+
+    /** Immediately send all pending batches. */
+    void flush() {
+        BatchList ready;
+        {
+            boost::mutex::scoped_lock lock(mMutex);
+            mFlushScheduled = false;
+            for(typename BatchMap::iterator it = mPending.begin(); it != mPending.end(); it++)
+                takeBatch(it, &ready);
+            mPending.clear();
+        }
+        sendBatches(ready);
+    }
+
+private:
+    DatagramBatcher(const Context* ctx, const SendCallback& sender, uint32 max_packets, const Duration& flush_latency)
+     : mContext(ctx),
+       mSender(sender),
+       mMaxPackets(max_packets),
+       mFlushLatency(flush_latency),
+       mFlushScheduled(false),
+       mTimeSeriesPacketsPerBatch(ctx->name + ".sst.packets_per_batch"),
+       mStatsPackets(0),
+       mStatsBatches(0),
+       mLastStatsReport(Timer::now())
+    {
+    }
+
+    typedef std::pair<EndPoint<EndPointType>, EndPoint<EndPointType> > BatchKey;
+    struct Batch {
+        Batch()
+         : bytes(1) // Batch marker
+        {}
+
+        bool empty() const { return packets.empty(); }
+        void swap(Batch& other) {
+            packets.swap(other.packets);
+            std::swap(bytes, other.bytes);
+        }
+
+        std::vector<SegmentBufferPtr> packets;
+        // Upper bound on the size of the framed batch
+        uint32 bytes;
+    };
+    typedef std::map<BatchKey, Batch> BatchMap;
+    typedef std::vector< std::pair<BatchKey, Batch> > BatchList;
+
+    // Must be called with mMutex held. Moves the batch out of the pending map
+    // so it can be sent after the lock is released -- the datagram service
+    // may deliver locally and synchronously, which can generate new packets.
+    void takeBatch(typename BatchMap::iterator it, BatchList* ready) {
+        if (it->second.empty()) return;
+        ready->push_back( std::make_pair(it->first, Batch()) );
+        ready->back().second.swap(it->second);
+    }
+
+    // Must be called with mMutex held
+    void scheduleFlush() {
+        if (mFlushScheduled) return;
+        mFlushScheduled = true;
+
+        if (mFlushLatency == Duration::zero())
+            mContext->mainStrand->post(
+                std::tr1::bind(&DatagramBatcher::handleFlush, mWeakThis),
+                "SST::DatagramBatcher::handleFlush"
+            );
+        else
+            mContext->mainStrand->post(
+                mFlushLatency,
+                std::tr1::bind(&DatagramBatcher::handleFlush, mWeakThis),
+                "SST::DatagramBatcher::handleFlush"
+            );
+    }
+
+    static void handleFlush(WPtr weak_batcher) {
+        Ptr batcher = weak_batcher.lock();
+        if (batcher) batcher->flush();
+    }
+
+    void sendBatches(BatchList& ready) {
+        if (ready.empty()) return;
+
+        Network::MessageBatchWriter writer;
+        for(typename BatchList::iterator it = ready.begin(); it != ready.end(); it++) {
+            std::vector<SegmentBufferPtr>& packets = it->second.packets;
+            if (packets.size() == 1) {
+                mSender(it->first.first, it->first.second, MemoryReference(packets[0]->data(), packets[0]->size()));
+                continue;
+            }
+
+            writer.clear();
+            for(uint32 i = 0; i < packets.size(); i++)
+                writer.append(packets[i]->data(), packets[i]->size());
+            mSender(it->first.first, it->first.second, writer.data());
+        }
+
+        reportStats(ready);
+    }
+
+    void reportStats(const BatchList& ready) {
+        uint32 packets = 0;
+        for(typename BatchList::const_iterator it = ready.begin(); it != ready.end(); it++)
+            packets += it->second.packets.size();
+
+        boost::mutex::scoped_lock lock(mStatsMutex);
+        mStatsPackets += packets;
+        mStatsBatches += ready.size();
+
+        // Reported at most once a second since this can be called for every
+        // datagram sent
+        Time now = Timer::now();
+        if (now - mLastStatsReport < Duration::seconds((int64)1)) return;
+        if (mContext->timeSeries != NULL)
+            mContext->timeSeries->report(
+                mTimeSeriesPacketsPerBatch,
+                (float64)mStatsPackets / mStatsBatches
+            );
+        mStatsPackets = 0;
+        mStatsBatches = 0;
+        mLastStatsReport = now;
+    }
+
+    const Context* mContext;
+    SendCallback mSender;
+    WPtr mWeakThis;
+
+    const uint32 mMaxPackets;
+    const Duration mFlushLatency;
+
+    boost::mutex mMutex;
+    BatchMap mPending;
+    bool mFlushScheduled;
+
+    boost::mutex mStatsMutex;
+    const String mTimeSeriesPacketsPerBatch;
+    uint64 mStatsPackets;
+    uint64 mStatsBatches;
+    Time mLastStatsReport;
+};
+
+} // namespace SST
+} // namespace Sirikata
+
+#endif //_SIRIKATA_CORE_NETWORK_SST_DATAGRAM_BATCHER_HPP_
@@ -43,6 +43,7 @@
 
 #include <sirikata/core/network/Message.hpp>
 #include <sirikata/core/network/ObjectMessage.hpp>
+#include <sirikata/core/network/SSTSegmentBuffer.hpp>
 #include "Protocol_SSTHeader.pbj.hpp"
 
 #include <boost/lexical_cast.hpp>
@@ -128,6 +129,10 @@ public:
     typedef std::tr1::function< void (int, void*) >  DatagramSendDoneCallback;
     typedef std::tr1::function<void (uint8*, int) >  ReadDatagramCallback;
     typedef std::tr1::function<void (uint8*, int) > ReadCallback;
+    // Scatter/gather version of ReadCallback. Data is delivered directly from
+    // the stream's circular receive buffer, so when it wraps around the end of
+    // the buffer it arrives in two pieces. The second piece is empty otherwise.
+    typedef std::tr1::function<void (const MemoryReference&, const MemoryReference&) > ReadVectorCallback;
 };
 
 typedef UUID USID;
@@ -194,7 +199,86 @@ public:
     typedef std::tr1::unordered_map<EndPoint<EndPointType>, StreamReturnCallbackFunction, typename EndPoint<EndPointType>::Hasher> StreamReturnCallbackMap;
     StreamReturnCallbackMap mStreamReturnCallbackMap;
 
-    typedef std::tr1::unordered_map<EndPoint<EndPointType>, std::tr1::shared_ptr<Connection<EndPointType> >, typename EndPoint<EndPointType>::Hasher >  ConnectionMap;
+    // Map from local endpoint to connection. Every received packet requires a
+    // lookup in this map, so rather than protecting it with
+    // sStaticMembersLock it is split into shards by endpoint, each with its
+    // own lock. The shard locks are only held while accessing the map itself,
+    // never while calling into a Connection, so they can be taken with or
+    // without sStaticMembersLock held.
+    class ConnectionMap {
+    public:
+        typedef std::tr1::shared_ptr<Connection<EndPointType> > ConnectionPtr;
+
+        // Returns NULL if there isn't a connection for the endpoint
+        ConnectionPtr find(const EndPoint<EndPointType>& ep) {
+            Shard& s = shard(ep);
+            boost::mutex::scoped_lock lock(s.lock.getMutex());
+            typename ShardMap::iterator it = s.connections.find(ep);
+            if (it == s.connections.end()) return ConnectionPtr();
+            return it->second;
+        }
+
+        // Add a connection, unless one already exists for the endpoint.
+        // Returns true if the connection was added.
+        bool insert(const EndPoint<EndPointType>& ep, const ConnectionPtr& conn) {
+            Shard& s = shard(ep);
+            boost::mutex::scoped_lock lock(s.lock.getMutex());
+            return s.connections.insert(typename ShardMap::value_type(ep, conn)).second;
+        }
+
+        // Remove the connection for the endpoint, returning it so the caller
+        // controls when it is released.
+        ConnectionPtr erase(const EndPoint<EndPointType>& ep) {
+            ConnectionPtr removed;
+            Shard& s = shard(ep);
+            boost::mutex::scoped_lock lock(s.lock.getMutex());
+            typename ShardMap::iterator it = s.connections.find(ep);
+            if (it != s.connections.end()) {
+                removed.swap(it->second);
+                s.connections.erase(it);
+            }
+            return removed;
+        }
+
+        // Remove an arbitrary connection, returning NULL if there are none left
+        ConnectionPtr pop() {
+            for(uint32 i = 0; i < NUM_SHARDS; i++) {
+                ConnectionPtr removed;
+                boost::mutex::scoped_lock lock(mShards[i].lock.getMutex());
+                if (mShards[i].connections.empty()) continue;
+                removed.swap(mShards[i].connections.begin()->second);
+                mShards[i].connections.erase(mShards[i].connections.begin());
+                return removed;
+            }
+            return ConnectionPtr();
+        }
+
+        // Get a snapshot of all the connections
+        void getAll(std::vector<ConnectionPtr>* conns) {
+            for(uint32 i = 0; i < NUM_SHARDS; i++) {
+                boost::mutex::scoped_lock lock(mShards[i].lock.getMutex());
+                for(typename ShardMap::iterator it = mShards[i].connections.begin(); it != mShards[i].connections.end(); it++)
+                    conns->push_back(it->second);
+            }
+        }
+
+    private:
+        enum {
+            NUM_SHARDS = 16
+        };
+
+        typedef std::tr1::unordered_map<EndPoint<EndPointType>, ConnectionPtr, typename EndPoint<EndPointType>::Hasher > ShardMap;
+        struct Shard {
+            Mutex lock;
+            ShardMap connections;
+        };
+
+        Shard& shard(const EndPoint<EndPointType>& ep) {
+            return mShards[ typename EndPoint<EndPointType>::Hasher()(ep) % NUM_SHARDS ];
+        }
+
+        Shard mShards[NUM_SHARDS];
+    };
     ConnectionMap sConnectionMap;
 
     typedef std::tr1::unordered_map<EndPoint<EndPointType>, ConnectionReturnCallbackFunction, typename EndPoint<EndPointType>::Hasher>  ConnectionReturnCallbackMap;
@@ -275,11 +359,12 @@ class SIRIKATA_EXPORT BaseDatagramLayer
     void listenOn(EndPoint<EndPointType>& listeningEndPoint) {
     }
 
-    /** Send the given data from the given source port (possibly not allocated
-     *  yet) to the given destination. This is the core function for outbound
-     *  communication.
+    /** Send the given packet from the given source port (possibly not
+     *  allocated yet) to the given destination. This is the core function for
+     *  outbound communication. Implementations may hold onto the packet's
+     *  buffer to send it later, e.g. to batch it with other packets.
      */
-    void send(EndPoint<EndPointType>* src, EndPoint<EndPointType>* dest, void* data, int len) {
+    void send(EndPoint<EndPointType>* src, EndPoint<EndPointType>* dest, const SegmentBufferPtr& packet) {
     }
 
     /** Stop listening on the given endpoint. You can fully deallocate the
@@ -299,11 +384,106 @@ class SIRIKATA_EXPORT BaseDatagramLayer
 #define SST_IMPL_SUCCESS 0
 #define SST_IMPL_FAILURE -1
 
+/** Field number of the payload in each SST header, as declared in
+ *  SSTHeader.pbj. The payload has to be the highest numbered field so it is
+ *  serialized after the rest of the header.
+ */
+template<typename HeaderType>
+struct PayloadFieldNumber;
+template<>
+struct PayloadFieldNumber<Sirikata::Protocol::SST::SSTChannelHeader> {
+    enum { value = 5 };
+};
+template<>
+struct PayloadFieldNumber<Sirikata::Protocol::SST::SSTStreamHeader> {
+    enum { value = 10 };
+};
+
+/** Get the serialized key for the payload field of a header: the varint
+ *  encoding of its field number and the length delimited wire type.
+ */
+template<typename HeaderType>
+String payloadFieldKey() {
+    String key;
+    for(uint32 tag = (PayloadFieldNumber<HeaderType>::value << 3) | 2; ; tag >>= 7) {
+        if (tag < 0x80) {
+            key.push_back((char)tag);
+            break;
+        }
+        key.push_back((char)((tag & 0x7F) | 0x80));
+    }
+    return key;
+}
+
+/** Serialize a header in front of the data already stored in buf, making the
+ *  data the header's payload. The header must not have its payload set. This
+ *  avoids copying the payload into the header and then serializing the
+ *  combined message into yet another buffer.
+ *
+ *  Returns the buffer holding the complete message. Normally this is buf
+ *  itself, but if the header can't be encoded in place the message is
+ *  serialized into a new buffer, leaving buf untouched. Returns NULL if
+ *  serialization failed.
+ */
+template<typename HeaderType>
+SegmentBufferPtr encodeHeaderWithPayload(HeaderType& msg, const SegmentBufferPtr& buf) {
+    static const String key = payloadFieldKey<HeaderType>();
+    uint32 payload_len = buf->size();
+
+    uint8 len_bytes[5];
+    uint32 len_size = 0;
+    for(uint32 remaining = payload_len; ; remaining >>= 7) {
+        len_bytes[len_size] = (uint8)(remaining & 0x7F);
+        if (remaining < 0x80) {
+            len_size++;
+            break;
+        }
+        len_bytes[len_size++] |= 0x80;
+    }
+
+    int header_size = msg.ByteSize();
+    uint32 prefix_size = header_size + key.size() + len_size;
+    if (prefix_size <= buf->headroom()) {
+        uint8* prefix = buf->prepend(prefix_size);
+        if (!msg.SerializeToArray(prefix, header_size)) {
+            buf->setStart(buf->start() + prefix_size);
+            return SegmentBufferPtr();
+        }
+        memcpy(prefix + header_size, key.data(), key.size());
+        memcpy(prefix + header_size + key.size(), len_bytes, len_size);
+        return buf;
+    }
+
+    // Fallback: the header doesn't fit in front of the payload, so go through
+    // the PBJ message, copying the payload into it.
+    msg.set_payload(buf->data(), payload_len);
+    String serialized;
+    if (!serializePBJMessage(&serialized, msg)) return SegmentBufferPtr();
+    SegmentBufferPtr result(SegmentBuffer::allocate());
+    if (serialized.size() > result->tailroom()) {
+        SST_LOG(error, "Serialized SST header doesn't fit in segment buffer");
+        return SegmentBufferPtr();
+    }
+    result->append(serialized.data(), serialized.size());
+    return result;
+}
+
+/** Serialize a header which doesn't carry any payload into buf. */
+template<typename HeaderType>
+bool serializeHeader(const HeaderType& msg, SegmentBuffer* buf) {
+    int header_size = msg.ByteSize();
+    if (header_size < 0 || (uint32)header_size > buf->tailroom()) return false;
+    return msg.SerializeToArray(buf->extend(header_size), header_size);
+}
+
 class ChannelSegment {
 public:
 
-  uint8* mBuffer;
-  uint16 mBufferLength;
+  // Holds the payload (the serialized stream header and data), and once the
+  // segment has been sent, the channel header in front of it.
+  SegmentBufferPtr mBuffer;
+  // Start of the payload within mBuffer, i.e. where the channel header ends.
+  uint16 mPayloadStart;
   uint64 mChannelSequenceNumber;
   uint64 mAckSequenceNumber;
 
@@ -311,17 +491,22 @@ public:
   Time mAckTime;
 
   ChannelSegment( const void* data, int len, uint64 channelSeqNum, uint64 ackSequenceNum) :
-                                               mBufferLength(len),
+                                              mBuffer(SegmentBuffer::allocate()),
 					      mChannelSequenceNumber(channelSeqNum),
 					      mAckSequenceNumber(ackSequenceNum),
 					      mTransmitTime(Time::null()), mAckTime(Time::null())
   {
-    mBuffer = new uint8[len];
-    memcpy( mBuffer, (const uint8*) data, len);
+    mBuffer->append(data, len);
+    mPayloadStart = mBuffer->start();
   }
 
-  ~ChannelSegment() {
-    delete [] mBuffer;
+  ChannelSegment( SegmentBufferPtr buffer, uint64 channelSeqNum, uint64 ackSequenceNum) :
+                                              mBuffer(buffer),
+                                              mPayloadStart(buffer->start()),
+					      mChannelSequenceNumber(channelSeqNum),
+					      mAckSequenceNumber(ackSequenceNum),
+					      mTransmitTime(Time::null()), mAckTime(Time::null())
+  {
   }
 
   void setAckTime(Time& ackTime) {
@@ -330,6 +515,137 @@ public:
 
 };
 
+/** OutstandingSegmentList tracks the segments which have been sent but not yet
+ *  acknowledged, indexed by channel sequence number. Segments are stored in a
+ *  ring buffer slot determined by their sequence number, so looking up and
+ *  removing acknowledged segments takes constant time regardless of the size
+ *  of the window.
+ *
+ *  Segments must be added in increasing sequence number order, which is the
+ *  order Connection assigns them in. Sequence numbers don't need to be
+ *  contiguous since some of them are used by packets that are never
+ *  retransmitted (e.g. acks).
+ */
+class OutstandingSegmentList {
+public:
+    typedef std::tr1::shared_ptr<ChannelSegment> SegmentPtr;
+
+    OutstandingSegmentList(uint32 initial_capacity = 64)
+     : mBegin(0),
+       mEnd(0),
+       mCount(0)
+    {
+        uint32 capacity = 1;
+        while(capacity < initial_capacity)
+            capacity <<= 1;
+        mSlots.resize(capacity);
+        mMask = capacity - 1;
+    }
+
+    bool empty() const { return mCount == 0; }
+    size_t size() const { return mCount; }
+
+    /** Sequence number of the oldest outstanding segment. Only valid if the
+     *  list isn't empty.
+     */
+    uint64 beginSequenceNumber() const { return mBegin; }
+    /** One past the sequence number of the newest outstanding segment. Only
+     *  valid if the list isn't empty.
+     */
+    uint64 endSequenceNumber() const { return mEnd; }
+
+    void push_back(const SegmentPtr& segment) {
+        uint64 seqno = segment->mChannelSequenceNumber;
+
+        if (mCount == 0) {
+            mBegin = seqno;
+            mEnd = seqno;
+        }
+        else if (seqno < mEnd) {
+            // Retransmission of a segment we're still tracking, just replace it
+            assert(seqno >= mBegin);
+            SegmentPtr& slot = mSlots[seqno & mMask];
+            if (!slot) mCount++;
+            slot = segment;
+            return;
+        }
+
+        if (seqno - mBegin >= mSlots.size())
+            grow(seqno - mBegin + 1);
+
+        mSlots[seqno & mMask] = segment;
+        mEnd = seqno + 1;
+        mCount++;
+    }
+
+    /** Remove the segment with the given sequence number, returning it or NULL
+     *  if it isn't outstanding.
+     */
+    SegmentPtr erase(uint64 seqno) {
+        if (mCount == 0 || seqno < mBegin || seqno >= mEnd)
+            return SegmentPtr();
+
+        SegmentPtr& slot = mSlots[seqno & mMask];
+        if (!slot || slot->mChannelSequenceNumber != seqno)
+            return SegmentPtr();
+
+        SegmentPtr segment;
+        segment.swap(slot);
+        mCount--;
+
+        if (mCount == 0) {
+            mBegin = mEnd;
+        }
+        else if (seqno == mBegin) {
+            // Skip ahead to the next segment that's still outstanding. Each
+            // slot is only passed over once, so this is amortized constant time.
+            while(!mSlots[mBegin & mMask])
+                mBegin++;
+        }
+
+        return segment;
+    }
+
+    void clear() {
+        for(uint64 seqno = mBegin; mCount > 0 && seqno < mEnd; seqno++) {
+            SegmentPtr& slot = mSlots[seqno & mMask];
+            if (slot) {
+                slot.reset();
+                mCount--;
+            }
+        }
+        assert(mCount == 0);
+        mBegin = mEnd;
+    }
+
+private:
+    // Resize so the ring can hold at least span consecutive sequence numbers
+    void grow(uint64 span) {
+        uint64 capacity = mSlots.size();
+        while(capacity < span)
+            capacity <<= 1;
+
+        std::vector<SegmentPtr> slots(capacity);
+        uint64 mask = capacity - 1;
+        for(uint64 seqno = mBegin; seqno < mEnd; seqno++) {
+            SegmentPtr& slot = mSlots[seqno & mMask];
+            if (slot)
+                slots[seqno & mask].swap(slot);
+        }
+        mSlots.swap(slots);
+        mMask = mask;
+    }
+
+    std::vector<SegmentPtr> mSlots;
+    uint64 mMask;
+    // Range of sequence numbers which may be outstanding. mBegin is always the
+    // oldest outstanding segment.
+    uint64 mBegin;
+    uint64 mEnd;
+    size_t mCount;
+}; // class OutstandingSegmentList
+
+
 #define SST_BASE_CWND 10
 #define SST_BASE_SSTHRESH 32768
 
@@ -353,7 +669,7 @@ private:
   friend class ConnectionManager<EndPointType>;
   friend class BaseDatagramLayer<EndPointType>;
 
-  typedef std::tr1::unordered_map<EndPoint<EndPointType>, std::tr1::shared_ptr<Connection>, typename EndPoint<EndPointType>::Hasher >  ConnectionMap;
+  typedef typename ConnectionVariables<EndPointType>::ConnectionMap ConnectionMap;
   typedef std::tr1::unordered_map<EndPoint<EndPointType>, ConnectionReturnCallbackFunction, typename EndPoint<EndPointType>::Hasher>  ConnectionReturnCallbackMap;
   typedef std::tr1::unordered_map<EndPoint<EndPointType>, StreamReturnCallbackFunction, typename EndPoint<EndPointType>::Hasher> StreamReturnCallbackMap;
 
@@ -383,7 +699,7 @@ private:
   uint32 mNumStreams;
 
   std::deque< std::tr1::shared_ptr<ChannelSegment> > mQueuedSegments;
-  std::deque< std::tr1::shared_ptr<ChannelSegment> > mOutstandingSegments;
+  OutstandingSegmentList mOutstandingSegments;
   boost::mutex mOutstandingSegmentsMutex;
 
   uint16 mCwnd;
@@ -392,6 +708,8 @@ private:
   bool mFirstRTO;
 
   boost::mutex mQueueMutex;
+  // Serializes handling of received packets, see handleReceive
+  boost::recursive_mutex mReceiveMutex;
 
   uint16 MAX_DATAGRAM_SIZE;
   uint16 MAX_PAYLOAD_SIZE;
@@ -533,9 +851,46 @@ private:
   void sendSSTChannelPacket(Sirikata::Protocol::SST::SSTChannelHeader& sstMsg) {
     if (mState == CONNECTION_DISCONNECTED) return;
 
-    std::string buffer = serializePBJMessage(sstMsg);
-    mDatagramLayer->send(&mLocalEndPoint, &mRemoteEndPoint, (void*) buffer.data(),
-				       buffer.size());
+    SegmentBufferPtr packet(SegmentBuffer::allocate());
+    if (!serializeHeader(sstMsg, packet.get())) return;
+    mDatagramLayer->send(&mLocalEndPoint, &mRemoteEndPoint, packet);
+  }
+
+  // Sends a queued segment, serializing the channel header directly in front
+  // of the payload already stored in the segment's buffer.
+  void sendSegment(ChannelSegment* segment) {
+    if (mState == CONNECTION_DISCONNECTED) return;
+
+    Sirikata::Protocol::SST::SSTChannelHeader sstMsg;
+    sstMsg.set_channel_id( mRemoteChannelID );
+    sstMsg.set_transmit_sequence_number(segment->mChannelSequenceNumber);
+    sstMsg.set_ack_count(1);
+    sstMsg.set_ack_sequence_number(segment->mAckSequenceNumber);
+
+    SegmentBufferPtr payload = segment->mBuffer;
+    uint32 header_size = segment->mPayloadStart - payload->start();
+    if (payload->shared()) {
+      // A previous transmission of this segment, e.g. a retransmitted
+      // connection request, may still be waiting in the datagram layer with
+      // its channel header in front of the payload. Leave that alone and
+      // build this transmission's header into a separate buffer.
+      payload = SegmentBuffer::allocate();
+      payload->append(segment->mBuffer->data() + header_size, segment->mBuffer->size() - header_size);
+    }
+    else {
+      // Nobody else is using the buffer, so any channel header left over from
+      // a previous transmission can just be dropped.
+      payload->setStart(segment->mPayloadStart);
+    }
+    sendChannelPacket(sstMsg, payload);
+  }
+
+  void sendChannelPacket(Sirikata::Protocol::SST::SSTChannelHeader& sstMsg, const SegmentBufferPtr& payload) {
+    if (mState == CONNECTION_DISCONNECTED) return;
+
+    SegmentBufferPtr packet = encodeHeaderWithPayload(sstMsg, payload);
+    if (!packet) return;
+    mDatagramLayer->send(&mLocalEndPoint, &mRemoteEndPoint, packet);
   }
 
   const Context* getContext() {
@@ -610,19 +965,11 @@ private:
       for (int i = 0; (!mQueuedSegments.empty()) && mOutstandingSegments.size() <= mCwnd; i++) {
 	  std::tr1::shared_ptr<ChannelSegment> segment = mQueuedSegments.front();
 
-	  Sirikata::Protocol::SST::SSTChannelHeader sstMsg;
-	  sstMsg.set_channel_id( mRemoteChannelID );
-	  sstMsg.set_transmit_sequence_number(segment->mChannelSequenceNumber);
-	  sstMsg.set_ack_count(1);
-	  sstMsg.set_ack_sequence_number(segment->mAckSequenceNumber);
-
-	  sstMsg.set_payload(segment->mBuffer, segment->mBufferLength);
-
           /*printf("%s sending packet from data sending loop to %s \n",
                    mLocalEndPoint.endPoint.toString().c_str()
                    , mRemoteEndPoint.endPoint.toString().c_str());*/
 
-	  sendSSTChannelPacket(sstMsg);
+	  sendSegment(segment.get());
 
 	  segment->mTransmitTime = curTime;
 	  mOutstandingSegments.push_back(segment);
@@ -807,7 +1154,7 @@ private:
     boost::mutex::scoped_lock lock(sstConnVars->sStaticMembersLock.getMutex());
 
     ConnectionMap& connectionMap = sstConnVars->sConnectionMap;
-    if (connectionMap.find(localEndPoint) != connectionMap.end()) {
+    if (connectionMap.find(localEndPoint)) {
       SST_LOG(warn, "sConnectionMap.find failed for " << localEndPoint.endPoint.toString() << "\n");
 
       return false;
@@ -821,18 +1168,20 @@ private:
     std::tr1::shared_ptr<Connection>  conn =  std::tr1::shared_ptr<Connection> (
                        new Connection(sstConnVars, localEndPoint, remoteEndPoint));
 
-    connectionMap[localEndPoint] = conn;
+    // Packets for the connection are handled as soon as it's in the map,
+    // without sStaticMembersLock, so it has to be fully set up first.
+    conn->setWeakThis(conn);
+    conn->setState(CONNECTION_PENDING_CONNECT);
+    conn->setLocalChannelID(availableChannel);
+
+    connectionMap.insert(localEndPoint, conn);
     sstConnVars->sConnectionReturnCallbackMap[localEndPoint] = cb;
 
     lock.unlock();
 
-    conn->setWeakThis(conn);
-    conn->setState(CONNECTION_PENDING_CONNECT);
-
     uint32 payload[1];
     payload[0] = htonl(availableChannel);
 
-    conn->setLocalChannelID(availableChannel);
     conn->sendDataWithAutoAck(payload, sizeof(payload), false);
 
     return true;
@@ -864,11 +1213,15 @@ private:
     return true;
   }
 
+  // mListeningStreamsCallbackMap is read while handling received packets, so
+  // it's protected by mReceiveMutex
   void listenStream(uint32 port, StreamReturnCallbackFunction scb) {
+    boost::recursive_mutex::scoped_lock lock(mReceiveMutex);
     mListeningStreamsCallbackMap[port] = scb;
   }
 
   void unlistenStream(uint32 port) {
+    boost::recursive_mutex::scoped_lock lock(mReceiveMutex);
     mListeningStreamsCallbackMap.erase(port);
   }
 
@@ -925,11 +1278,23 @@ private:
       return sendData(data, length, isAck, mLastReceivedSequenceNumber);
   }
 
+  uint64 sendDataWithAutoAck(const SegmentBufferPtr& payload, bool isAck) {
+      return sendData(payload, isAck, mLastReceivedSequenceNumber);
+  }
+
   // Explicit version, used when acking direct response to a packet
   uint64 sendData(const void* data, uint32 length, bool isAck, uint64 ack_seqno) {
+    SegmentBufferPtr payload(SegmentBuffer::allocate());
+    payload->append(data, length);
+    return sendData(payload, isAck, ack_seqno);
+  }
+
+  // Zero-copy version. The payload buffer is held until the segment is acked
+  // and the channel header is serialized directly in front of its contents.
+  uint64 sendData(const SegmentBufferPtr& payload, bool isAck, uint64 ack_seqno) {
     boost::mutex::scoped_lock lock(mQueueMutex);
 
-    assert(length <= MAX_PAYLOAD_SIZE);
+    assert(payload->size() <= MAX_PAYLOAD_SIZE);
 
     uint64 transmitSequenceNumber =  mTransmitSequenceNumber;
 
@@ -940,14 +1305,12 @@ private:
       sstMsg.set_ack_count(1);
       sstMsg.set_ack_sequence_number(ack_seqno);
 
-      sstMsg.set_payload(data, length);
-
-      sendSSTChannelPacket(sstMsg);
+      sendChannelPacket(sstMsg, payload);
     }
     else {
       if (mQueuedSegments.size() < MAX_QUEUED_SEGMENTS) {
         mQueuedSegments.push_back( std::tr1::shared_ptr<ChannelSegment>(
-                                   new ChannelSegment(data, length, mTransmitSequenceNumber, ack_seqno) ) );
+                                   new ChannelSegment(payload, mTransmitSequenceNumber, ack_seqno) ) );
         // Only service if we're going to be able to send
         // immediately. Otherwise, we must already have outstanding
         // packets waiting for a timeout, in which case this new
@@ -998,53 +1361,55 @@ private:
     return id;
   }
 
-  void markAcknowledgedPacket(uint64 receivedAckNum) {
+  // Handles acknowledgement of ackCount consecutive segments, ending with
+  // receivedAckNum.
+  void markAcknowledgedPacket(uint64 receivedAckNum, uint64 ackCount = 1) {
     boost::mutex::scoped_lock lock(mOutstandingSegmentsMutex);
 
-    for (std::deque< std::tr1::shared_ptr<ChannelSegment> >::iterator it = mOutstandingSegments.begin();
-         it != mOutstandingSegments.end(); it++)
-    {
-        std::tr1::shared_ptr<ChannelSegment> segment = *it;
+    if (mOutstandingSegments.empty()) return;
 
-        if (!segment) {
-          mOutstandingSegments.erase(it);
-          it = mOutstandingSegments.begin();
-          continue;
-        }
+    // Clip the acked range to the segments that could actually be outstanding
+    // so huge (or bogus) ranges don't cost anything extra.
+    uint64 range_end = std::min(receivedAckNum + 1, mOutstandingSegments.endSequenceNumber());
+    uint64 range_start = mOutstandingSegments.beginSequenceNumber();
+    if (ackCount <= receivedAckNum && receivedAckNum + 1 - ackCount > range_start)
+        range_start = receivedAckNum + 1 - ackCount;
 
-        if (segment->mChannelSequenceNumber == receivedAckNum) {
-          segment->mAckTime = Timer::now();
+    bool acked_any = false;
+    Time ackTime = Timer::now();
+    for(uint64 seqno = range_start; seqno < range_end; seqno++) {
+        std::tr1::shared_ptr<ChannelSegment> segment = mOutstandingSegments.erase(seqno);
+        if (!segment) continue;
 
-          if (mFirstRTO ) {
-	         mRTOMicroseconds = 10 * ((segment->mAckTime - segment->mTransmitTime).toMicroseconds()) ;
-	         mFirstRTO = false;
-          }
-          else {
-            mRTOMicroseconds = CC_ALPHA * mRTOMicroseconds +
-              (1.0-CC_ALPHA) * (segment->mAckTime - segment->mTransmitTime).toMicroseconds();
-          }
+        segment->mAckTime = ackTime;
 
-          mOutstandingSegments.erase(it);
+        if (mFirstRTO ) {
+            mRTOMicroseconds = 10 * ((segment->mAckTime - segment->mTransmitTime).toMicroseconds()) ;
+            mFirstRTO = false;
+        }
+        else {
+          mRTOMicroseconds = CC_ALPHA * mRTOMicroseconds +
+            (1.0-CC_ALPHA) * (segment->mAckTime - segment->mTransmitTime).toMicroseconds();
+        }
 
-          if (mCwnd <= mSSThresh) {
-              // Slow start exponential growth, bump for every acked packet
-              mCwnd += 1;
-          }
-          else {
-              // regular growth
-              if (rand() % mCwnd == 0)
-                  mCwnd += 1;
-          }
+        if (mCwnd <= mSSThresh) {
+            // Slow start exponential growth, bump for every acked packet
+            mCwnd += 1;
+        }
+        else {
+            // regular growth
+            if (rand() % mCwnd == 0)
+                mCwnd += 1;
+        }
 
-          // We freed up some space in the window. If we have
-          // something left to send, trigger servicing.
-          if (!mQueuedSegments.empty()) {
-              mInSendingMode = true;
-              scheduleConnectionService();
-          }
+        acked_any = true;
+    }
 
-          return;
-        }
+    // We freed up some space in the window. If we have
+    // something left to send, trigger servicing.
+    if (acked_any && !mQueuedSegments.empty()) {
+        mInSendingMode = true;
+        scheduleConnectionService();
     }
   }
 
@@ -1272,7 +1637,9 @@ private:
       uint64 ack_seqno = received_msg->transmit_sequence_number();
 
     uint64 receivedAckNum = received_msg->ack_sequence_number();
-    markAcknowledgedPacket(receivedAckNum);
+    // Older peers always ack exactly one packet, and may not fill in the count
+    uint64 receivedAckCount = (received_msg->has_ack_count() && received_msg->ack_count() > 0) ? received_msg->ack_count() : 1;
+    markAcknowledgedPacket(receivedAckNum, receivedAckCount);
 
     bool handled = false;
     if (mState == CONNECTION_PENDING_CONNECT) {
@@ -1302,20 +1669,24 @@ private:
 
       sendData(received_payload, 0, false, ack_seqno);
 
-      boost::mutex::scoped_lock lock(mSSTConnVars->sStaticMembersLock.getMutex());
-
-      ConnectionReturnCallbackMap& connectionReturnCallbackMap = mSSTConnVars->sConnectionReturnCallbackMap;
-      ConnectionMap& connectionMap = mSSTConnVars->sConnectionMap;
-
-      if (connectionReturnCallbackMap.find(mLocalEndPoint) != connectionReturnCallbackMap.end())
+      // The callback is invoked without sStaticMembersLock held since it
+      // needs to take the lock itself to find the stream's callback.
+      ConnectionReturnCallbackFunction cb = NULL;
+      std::tr1::shared_ptr<Connection> conn;
       {
-        if (connectionMap.find(mLocalEndPoint) != connectionMap.end()) {
-          std::tr1::shared_ptr<Connection> conn = connectionMap[mLocalEndPoint];
-
-          connectionReturnCallbackMap[mLocalEndPoint] (SST_IMPL_SUCCESS, conn);
+        boost::mutex::scoped_lock lock(mSSTConnVars->sStaticMembersLock.getMutex());
+
+        ConnectionReturnCallbackMap& connectionReturnCallbackMap = mSSTConnVars->sConnectionReturnCallbackMap;
+        typename ConnectionReturnCallbackMap::iterator cb_it = connectionReturnCallbackMap.find(mLocalEndPoint);
+        if (cb_it != connectionReturnCallbackMap.end()) {
+          conn = mSSTConnVars->sConnectionMap.find(mLocalEndPoint);
+          if (conn)
+            cb = cb_it->second;
+          connectionReturnCallbackMap.erase(cb_it);
         }
-        connectionReturnCallbackMap.erase(mLocalEndPoint);
       }
+      if (cb)
+        cb(SST_IMPL_SUCCESS, conn);
 
       handled = true;
     }
@@ -1364,6 +1735,9 @@ private:
   }
 
   void eraseDisconnectedStream(Stream<EndPointType>* s) {
+    // The substream maps are also modified while handling received packets
+    boost::recursive_mutex::scoped_lock lock(mReceiveMutex);
+
     mOutgoingSubstreamMap.erase(s->getLSID());
     mIncomingSubstreamMap.erase(s->getRemoteLSID());
 
@@ -1428,10 +1802,16 @@ private:
    }
 
    static void stopConnections(ConnectionVariables<EndPointType>* sstConnVars) {
-       // This just passes stop calls along to all the connections
-       boost::mutex::scoped_lock lock(sstConnVars->sStaticMembersLock.getMutex());
-       for(typename ConnectionMap::iterator it = sstConnVars->sConnectionMap.begin(); it != sstConnVars->sConnectionMap.end(); it++)
-           it->second->stop();
+       // This just passes stop calls along to all the connections. They're
+       // stopped without sStaticMembersLock held since Connection::stop needs
+       // mReceiveMutex, which is always acquired before sStaticMembersLock.
+       std::vector<ConnectionPtr> conns;
+       {
+           boost::mutex::scoped_lock lock(sstConnVars->sStaticMembersLock.getMutex());
+           sstConnVars->sConnectionMap.getAll(&conns);
+       }
+       for(typename std::vector<ConnectionPtr>::iterator it = conns.begin(); it != conns.end(); it++)
+           (*it)->stop();
    }
 
    static void closeConnections(ConnectionVariables<EndPointType>* sstConnVars) {
@@ -1452,12 +1832,9 @@ private:
            ConnectionPtr saved;
            {
                boost::mutex::scoped_lock lock(sstConnVars->sStaticMembersLock.getMutex());
-               if (sstConnVars->sConnectionMap.empty()) break;
-               ConnectionMap& connectionMap = sstConnVars->sConnectionMap;
-
-               saved = connectionMap.begin()->second;
-               connectionMap.erase(connectionMap.begin());
+               saved = sstConnVars->sConnectionMap.pop();
            }
+           if (!saved) break;
            // Calling close makes sure we kill the check alive timer,
            // which holds a shared_ptr.
            saved->close(false);
@@ -1474,24 +1851,28 @@ private:
 
      uint8 channelID = received_msg->channel_id();
 
-     boost::mutex::scoped_lock lock(sstConnVars->sStaticMembersLock.getMutex());
-
+     // Only the connection map's shard lock is needed to find the connection,
+     // so packets for different connections can be processed in parallel.
      ConnectionMap& connectionMap = sstConnVars->sConnectionMap;
-     if (connectionMap.find(localEndPoint) != connectionMap.end()) {
+     std::tr1::shared_ptr<Connection<EndPointType> > existing_conn = connectionMap.find(localEndPoint);
+     if (existing_conn) {
        if (channelID == 0) {
  	/*Someone's already connected at this port. Either don't reply or
  	  send back a request rejected message. */
 
         SST_LOG(info, "Someone's already connected at this port on object " << localEndPoint.endPoint.toString() << "\n");
+        delete received_msg;
  	return;
        }
-       std::tr1::shared_ptr<Connection<EndPointType> > conn = connectionMap[localEndPoint];
 
-       conn->receiveMessage(received_msg);
+       // Packets for the same connection are still handled one at a time.
+       boost::recursive_mutex::scoped_lock lock(existing_conn->mReceiveMutex);
+       existing_conn->receiveMessage(received_msg);
      }
      else if (channelID == 0) {
        /* it's a new channel request negotiation protocol
  	        packet ; allocate a new channel.*/
+       boost::mutex::scoped_lock lock(sstConnVars->sStaticMembersLock.getMutex());
 
        StreamReturnCallbackMap& listeningConnectionsCallbackMap = sstConnVars->sListeningConnectionsCallbackMap;
        if (listeningConnectionsCallbackMap.find(localEndPoint) != listeningConnectionsCallbackMap.end()) {
@@ -1514,14 +1895,16 @@ private:
 
          conn->listenStream(newLocalEndPoint.port, listeningConnectionsCallbackMap[localEndPoint]);
          conn->setWeakThis(conn);
-         connectionMap[newLocalEndPoint] = conn;
-
          conn->setLocalChannelID(availableChannel);
          if (received_msg->payload().size()>=sizeof(uint32)) {
              conn->setRemoteChannelID(ntohl(received_payload[0]));
          }
          conn->setState(CONNECTION_PENDING_RECEIVE_CONNECT);
 
+         // Only publish the connection once it's set up, since its packets
+         // are handled without sStaticMembersLock
+         connectionMap.insert(newLocalEndPoint, conn);
+
          conn->sendData(payload, sizeof(payload), false, received_msg->transmit_sequence_number());
        }
        else {
@@ -1610,18 +1993,23 @@ private:
             sstMsg.set_src_port(local_port);
             sstMsg.set_dest_port(remote_port);
 
-            sstMsg.set_payload( ((uint8*)data)+currOffset, buffLen);
-
-            std::string buffer = serializePBJMessage(sstMsg);
+            SegmentBufferPtr buffer(SegmentBuffer::allocate());
+            buffer->append( ((uint8*)data)+currOffset, buffLen);
+            buffer = encodeHeaderWithPayload(sstMsg, buffer);
+            if (!buffer) {
+                if (cb != NULL)
+                    cb(SST_IMPL_FAILURE, data);
+                return false;
+            }
 
             // If we're not within the payload size, we need to
             // increase our buffer space and try again
-            if (buffer.size() > MAX_PAYLOAD_SIZE) {
+            if (buffer->size() > MAX_PAYLOAD_SIZE) {
                 header_buffer += 10;
                 continue;
             }
 
-            sendDataWithAutoAck(  buffer.data(), buffer.size(), false );
+            sendDataWithAutoAck( buffer, false );
 
             currOffset += buffLen;
             // If we got to the send, we can break out of the loop
@@ -1678,6 +2066,9 @@ private:
    * start a clean, quick, but graceful stop.
    */
   void stop() {
+      // Received packets can add streams while we're iterating
+      boost::recursive_mutex::scoped_lock lock(mReceiveMutex);
+
       // Request that all streams stop. This may hit some streams twice since
       // they may be in both incoming and outgoing stream lists
       for(typename LSIDStreamMap::iterator it = mIncomingSubstreamMap.begin(); it != mIncomingSubstreamMap.end(); it++)
@@ -1955,6 +2346,7 @@ public:
     typedef CallbackTypes<EndPointType> CBTypes;
     typedef typename CBTypes::StreamReturnCallbackFunction StreamReturnCallbackFunction;
     typedef typename CBTypes::ReadCallback ReadCallback;
+    typedef typename CBTypes::ReadVectorCallback ReadVectorCallback;
 
     typedef std::tr1::unordered_map<EndPoint<EndPointType>, StreamReturnCallbackFunction, typename EndPoint<EndPointType>::Hasher> StreamReturnCallbackMap;
 
@@ -1993,17 +2385,25 @@ public:
           localEndPoint.port = bdl->getUnusedPort(localEndPoint.endPoint);
       }
 
-      StreamReturnCallbackMap& streamReturnCallbackMap = sstConnVars->mStreamReturnCallbackMap;
-      if (streamReturnCallbackMap.find(localEndPoint) != streamReturnCallbackMap.end()) {
-        return false;
-      }
+      {
+          boost::mutex::scoped_lock lock(sstConnVars->sStaticMembersLock.getMutex());
 
-      streamReturnCallbackMap[localEndPoint] = cb;
+          StreamReturnCallbackMap& streamReturnCallbackMap = sstConnVars->mStreamReturnCallbackMap;
+          if (streamReturnCallbackMap.find(localEndPoint) != streamReturnCallbackMap.end()) {
+              return false;
+          }
+
+          streamReturnCallbackMap[localEndPoint] = cb;
+      }
 
       bool result = Connection<EndPointType>::createConnection(sstConnVars,
                                                                localEndPoint,
                                                                remoteEndPoint,
                                                                connectionCreated, cb);
+      if (!result) {
+          boost::mutex::scoped_lock lock(sstConnVars->sStaticMembersLock.getMutex());
+          sstConnVars->mStreamReturnCallbackMap.erase(localEndPoint);
+      }
       return result;
   }
 
@@ -2157,6 +2557,30 @@ public:
   */
   virtual bool registerReadCallback( ReadCallback callback) {
     mReadCallback = callback;
+    mReadVectorCallback = 0;
+
+    boost::recursive_mutex::scoped_lock lock(mReceiveBufferMutex);
+    sendToApp(0);
+
+    return true;
+  }
+
+  /*
+    Register a callback which will be called when there are bytes to be
+    read from the stream, replacing any callback registered with
+    registerReadCallback. Unlike ReadCallback, data is never split into
+    multiple callbacks because it wrapped around the end of the receive buffer.
+
+    @param ReadVectorCallback a function of type
+           "void (const MemoryReference&, const MemoryReference&)" which will
+           be called when data is available. The data is the contents of the
+           first segment followed by the contents of the second, which is
+           empty unless the data wrapped around the end of the receive buffer.
+    @return true if the callback was successfully registered.
+  */
+  virtual bool registerReadVectorCallback( ReadVectorCallback callback) {
+    mReadVectorCallback = callback;
+    mReadCallback = 0;
 
     boost::recursive_mutex::scoped_lock lock(mReceiveBufferMutex);
     sendToApp(0);
@@ -2322,6 +2746,7 @@ private:
     mNumOutstandingBytes(0),
     mNextByteExpected(0),
     mLastContiguousByteReceived(-1),
+    mReceiveBufferStart(0),
     mLastSendTime(Time::null()),
     mLastReceiveTime(Time::null()),
     mStreamReturnCallback(cb),
@@ -2442,23 +2867,26 @@ private:
   }
 
   static void connectionCreated( int errCode, std::tr1::shared_ptr<Connection<EndPointType> > c) {
-    StreamReturnCallbackMap& streamReturnCallbackMap = c->mSSTConnVars->mStreamReturnCallbackMap;
-    assert(streamReturnCallbackMap.find(c->localEndPoint()) != streamReturnCallbackMap.end());
+    StreamReturnCallbackFunction cb;
+    {
+      boost::mutex::scoped_lock lock(c->mSSTConnVars->sStaticMembersLock.getMutex());
 
-    if (errCode != SST_IMPL_SUCCESS) {
+      StreamReturnCallbackMap& streamReturnCallbackMap = c->mSSTConnVars->mStreamReturnCallbackMap;
+      typename StreamReturnCallbackMap::iterator cb_it = streamReturnCallbackMap.find(c->localEndPoint());
+      assert(cb_it != streamReturnCallbackMap.end());
+      if (cb_it == streamReturnCallbackMap.end()) return;
 
-      StreamReturnCallbackFunction cb = streamReturnCallbackMap[c->localEndPoint()];
-      streamReturnCallbackMap.erase(c->localEndPoint());
+      cb = cb_it->second;
+      streamReturnCallbackMap.erase(cb_it);
+    }
 
+    if (errCode != SST_IMPL_SUCCESS) {
       cb(SST_IMPL_FAILURE, StreamPtr() );
-
       return;
     }
 
-    c->stream(streamReturnCallbackMap[c->localEndPoint()], NULL , 0,
+    c->stream(cb, NULL , 0,
 	      c->localEndPoint().port, c->remoteEndPoint().port);
-
-    streamReturnCallbackMap.erase(c->localEndPoint());
   }
 
   void serviceStreamNoReturn() {
@@ -2502,7 +2930,10 @@ private:
         std::tr1::shared_ptr<Connection<EndPointType> > conn = mConnection.lock();
         assert(conn);
 
-        mSSTConnVars->mStreamReturnCallbackMap.erase(conn->localEndPoint());
+        {
+          boost::mutex::scoped_lock lock(mSSTConnVars->sStaticMembersLock.getMutex());
+          mSSTConnVars->mStreamReturnCallbackMap.erase(conn->localEndPoint());
+        }
 
 	// If this is the root stream that failed to connect, close the
 	// connection associated with it as well.
@@ -2581,10 +3012,16 @@ private:
 	    break;
 	  }
 
-	  uint64 channelID = sendDataPacket(buffer->mBuffer,
-					    buffer->mBufferLength,
-					    buffer->mOffset
-					    );
+	  uint64 channelID;
+	  if (!sendDataPacket(buffer->mBuffer,
+			      buffer->mBufferLength,
+			      buffer->mOffset,
+			      &channelID))
+	  {
+	    // Leave the buffer queued, the retransmit timeout below will
+	    // try sending it again.
+	    break;
+	  }
           buffer->mTransmitTime = curTime;
           sentSomething = true;
 
@@ -2667,23 +3104,62 @@ private:
       // Make sure we bail if we can't perform the callback since
       // checking the ready range will clear that range from the
       // segment list.
-      if (mReadCallback == NULL) return;
+      if (mReadCallback == NULL && mReadVectorCallback == NULL) return;
 
       ReceivedSegmentList::SegmentRange nextReadyRange = mReceivedSegments.readyRange(mNextByteExpected, skipLength);
       int64 readyBufferSize = ReceivedSegmentList::Length(nextReadyRange);
       if (ReceivedSegmentList::Length(nextReadyRange) == 0) return;
 
 
+      // The ready data starts at mReceiveBufferStart and may wrap around the
+      // end of the buffer.
       uint8* recv_buf = receiveBuffer();
-      mReadCallback(recv_buf, readyBufferSize);
+      uint32 firstSize = std::min((int64)(MAX_RECEIVE_WINDOW - mReceiveBufferStart), readyBufferSize);
+      uint32 secondSize = readyBufferSize - firstSize;
+
+      if (mReadVectorCallback) {
+          mReadVectorCallback(
+              MemoryReference(recv_buf + mReceiveBufferStart, firstSize),
+              MemoryReference(recv_buf, secondSize)
+          );
+      }
+      else {
+          // Only deliver the data up to the end of the buffer and put the
+          // rest back in the segment list. The callback may unregister
+          // itself, in which case the rest has to wait for the next one.
+          if (secondSize > 0) {
+              mReceivedSegments.insert(ReceivedSegmentList::StartByte(nextReadyRange) + firstSize, secondSize);
+              readyBufferSize = firstSize;
+          }
+          mReadCallback(recv_buf + mReceiveBufferStart, firstSize);
+      }
 
       //now move the window forward...
       mLastContiguousByteReceived = mLastContiguousByteReceived + readyBufferSize;
       mNextByteExpected = mLastContiguousByteReceived + 1;
 
-      memmove(recv_buf, recv_buf + readyBufferSize, MAX_RECEIVE_WINDOW - readyBufferSize);
+      mReceiveBufferStart = (mReceiveBufferStart + readyBufferSize) % MAX_RECEIVE_WINDOW;
 
       mReceiveWindowSize += readyBufferSize;
+
+      // Deliver the data from the start of the buffer, if anyone is still
+      // listening
+      if (secondSize > 0 && readyBufferSize == firstSize)
+          sendToApp(0);
+  }
+
+  /* Copy received data into the circular receive buffer. offsetInBuffer is
+     relative to mNextByteExpected. */
+  void copyToReceiveBuffer(int64 offsetInBuffer, const void* data, uint32 len) {
+      assert(offsetInBuffer >= 0);
+      assert(offsetInBuffer + len <= MAX_RECEIVE_WINDOW);
+
+      uint8* recv_buf = receiveBuffer();
+      uint32 start = (mReceiveBufferStart + offsetInBuffer) % MAX_RECEIVE_WINDOW;
+      uint32 firstSize = std::min(MAX_RECEIVE_WINDOW - start, len);
+      memcpy(recv_buf + start, data, firstSize);
+      if (firstSize < len)
+          memcpy(recv_buf, ((const uint8*)data) + firstSize, len - firstSize);
   }
 
   // Handle reception of data packets (INIT, REPLY, DATA). Return value
@@ -2748,7 +3224,7 @@ private:
 
           assert(offsetInBuffer >= 0);
           assert(offsetInBuffer + len <= MAX_RECEIVE_WINDOW);
-	  memcpy(receiveBuffer()+offsetInBuffer, buffer, len);
+	  copyToReceiveBuffer(offsetInBuffer, buffer, len);
           assert((int64)offset >= mNextByteExpected);
           mReceivedSegments.insert(offset, len);
 
@@ -2777,7 +3253,7 @@ private:
 
           assert(offsetInBuffer >= 0);
           assert(offsetInBuffer + len <= MAX_RECEIVE_WINDOW);
-   	  memcpy(receiveBuffer()+offsetInBuffer, buffer, len);
+   	  copyToReceiveBuffer(offsetInBuffer, buffer, len);
           assert((int64)offset >= mNextByteExpected);
           mReceivedSegments.insert(offset, len);
 
@@ -2946,16 +3422,14 @@ private:
 
     sstMsg.set_bsn(0);
 
-    sstMsg.set_payload(data, len);
-
-    std::string buffer = serializePBJMessage(sstMsg);
-
+    SegmentBufferPtr buffer = encodePacket(sstMsg, data, len);
+    if (!buffer) return;
 
     std::tr1::shared_ptr<Connection<EndPointType> > conn = mConnection.lock();
 
     if (!conn) return;
 
-    conn->sendDataWithAutoAck( buffer.data(), buffer.size(), false );
+    conn->sendDataWithAutoAck( buffer, false );
 
     scheduleStreamService(Duration::microseconds(pow(2.0,mNumInitRetransmissions)*mStreamRTOMicroseconds));
   }
@@ -2968,16 +3442,19 @@ private:
     sstMsg.set_window( log((double)mReceiveWindowSize)/log(2.0)  );
     sstMsg.set_src_port(mLocalPort);
     sstMsg.set_dest_port(mRemotePort);
-    std::string buffer = serializePBJMessage(sstMsg);
+    SegmentBufferPtr buffer(SegmentBuffer::allocate());
+    if (!serializeHeader(sstMsg, buffer.get())) return;
 
     //printf("Sending Ack packet with window %d\n", (int)sstMsg.window());
 
     std::tr1::shared_ptr<Connection<EndPointType> > conn = mConnection.lock();
     assert(conn);
-    conn->sendData(buffer.data(), buffer.size(), true, ack_seqno);
+    conn->sendData(buffer, true, ack_seqno);
   }
 
-  uint64 sendDataPacket(const void* data, uint32 len, uint64 offset) {
+  // Returns false if the packet couldn't be encoded or the connection is
+  // gone, in which case nothing was sent and channelID isn't set.
+  bool sendDataPacket(const void* data, uint32 len, uint64 offset, uint64* channelID) {
     Sirikata::Protocol::SST::SSTStreamHeader sstMsg;
     sstMsg.set_lsid( mLSID );
     sstMsg.set_type(sstMsg.DATA);
@@ -2988,13 +3465,16 @@ private:
 
     sstMsg.set_bsn(offset);
 
-    sstMsg.set_payload(data, len);
-
-    std::string buffer = serializePBJMessage(sstMsg);
+    SegmentBufferPtr buffer = encodePacket(sstMsg, data, len);
+    if (!buffer) {
+      SST_LOG(error, "Couldn't encode SST data packet");
+      return false;
+    }
 
     std::tr1::shared_ptr<Connection<EndPointType> > conn = mConnection.lock();
-    assert(conn);
-    return conn->sendDataWithAutoAck(  buffer.data(), buffer.size(), false);
+    if (!conn) return false;
+    *channelID = conn->sendDataWithAutoAck( buffer, false);
+    return true;
   }
 
   // Reply packets should be in repsonse to other side initiating connection, so
@@ -3011,14 +3491,23 @@ private:
     sstMsg.set_rsid(remoteLSID);
     sstMsg.set_bsn(0);
 
-    sstMsg.set_payload(data, len);
-    std::string buffer = serializePBJMessage(sstMsg);
+    SegmentBufferPtr buffer = encodePacket(sstMsg, data, len);
+    if (!buffer) return;
 
     std::tr1::shared_ptr<Connection<EndPointType> > conn = mConnection.lock();
     assert(conn);
-    conn->sendData(  buffer.data(), buffer.size(), false, ack_seqno);
+    conn->sendData( buffer, false, ack_seqno);
   }
 
+  // Serializes the stream header followed by the data into a segment buffer,
+  // which is handed directly to the connection.
+  SegmentBufferPtr encodePacket(Sirikata::Protocol::SST::SSTStreamHeader& sstMsg, const void* data, uint32 len) {
+    SegmentBufferPtr buffer(SegmentBuffer::allocate());
+    buffer->append(data, len);
+    return encodeHeaderWithPayload(sstMsg, buffer);
+  }
+
+
   uint8 mState;
 
   uint32 mLocalPort;
@@ -3080,6 +3569,8 @@ private:
 
   int64 mNextByteExpected;
   int64 mLastContiguousByteReceived;
+  // mReceiveBuffer is circular. This is the index of mNextByteExpected in it.
+  uint32 mReceiveBufferStart;
   Time mLastSendTime;
   Time mLastReceiveTime;
 
@@ -3088,6 +3579,7 @@ private:
   boost::recursive_mutex mReceiveBufferMutex;
 
   ReadCallback mReadCallback;
+  ReadVectorCallback mReadVectorCallback;
   StreamReturnCallbackFunction mStreamReturnCallback;
 
   friend class Connection<EndPointType>;
@@ -0,0 +1,151 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_CORE_NETWORK_SST_SEGMENT_BUFFER_HPP_
+#define _SIRIKATA_CORE_NETWORK_SST_SEGMENT_BUFFER_HPP_
+
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/util/AtomicTypes.hpp>
+#include <boost/intrusive_ptr.hpp>
+
+namespace Sirikata {
+namespace SST {
+
+/** SegmentBuffer holds a single SST packet from the time it is generated until
+ *  it is acknowledged. Buffers are fixed size cells carved out of large slabs
+ *  and recycled through a shared free list, so generating a packet doesn't
+ *  require any heap allocations once the pool has warmed up.
+ *
+ *  Data is stored in the middle of the cell. Payloads are appended starting at
+ *  HEADROOM bytes into the cell and each protocol layer then prepends its
+ *  header in front of the data already in the buffer. This lets the stream and
+ *  channel headers be serialized in place instead of each layer copying the
+ *  data from the layer above into a new buffer.
+ *
+ *  Buffers are reference counted. Use SegmentBufferPtr to hold onto them; the
+ *  buffer is returned to the pool when the last reference is dropped.
+ */
+class SIRIKATA_EXPORT SegmentBuffer : Noncopyable {
+public:
+    enum {
+        // Total size of each cell. This needs to be large enough to hold the
+        // largest payload SST generates plus all the headers in front of it.
+        CAPACITY = 1536,
+        // Space reserved in front of the payload for headers. This covers
+        // both the stream and channel headers with a healthy margin.
+        HEADROOM = 128
+    };
+
+    /** Allocate a new, empty buffer from the pool. */
+    static SegmentBuffer* allocate();
+
+    /** Pointer to the first valid byte in the buffer. */
+    uint8* data() { return mData + mStart; }
+    const uint8* data() const { return mData + mStart; }
+    /** Number of valid bytes in the buffer. */
+    uint32 size() const { return mEnd - mStart; }
+
+    /** Offset of the first valid byte, used to roll back prepended headers. */
+    uint16 start() const { return mStart; }
+    void setStart(uint16 start) {
+        assert(start <= mEnd);
+        mStart = start;
+    }
+
+    /** Number of bytes which can still be appended. */
+    uint32 tailroom() const { return CAPACITY - mEnd; }
+    /** Number of bytes which can still be prepended. */
+    uint32 headroom() const { return mStart; }
+
+    /** Reserve len bytes at the end of the buffer and return a pointer to
+     *  them. The caller is responsible for filling them in.
+     */
+    uint8* extend(uint32 len) {
+        assert(len <= tailroom());
+        uint8* result = mData + mEnd;
+        mEnd += len;
+        return result;
+    }
+
+    /** Copy data to the end of the buffer. */
+    void append(const void* src, uint32 len) {
+        uint8* dest = extend(len);
+        if (len > 0)
+            memcpy(dest, src, len);
+    }
+
+    /** Reserve len bytes in front of the current data and return a pointer to
+     *  them. The caller is responsible for filling them in.
+     */
+    uint8* prepend(uint32 len) {
+        assert(len <= headroom());
+        mStart -= len;
+        return mData + mStart;
+    }
+
+    /** Whether anyone besides the caller holds a reference to the buffer. */
+    bool shared() const { return mRefCount.read() > 1; }
+
+    /** Discard all data, restoring the buffer to the state it was in when it
+     *  was allocated.
+     */
+    void clear() {
+        mStart = HEADROOM;
+        mEnd = HEADROOM;
+    }
+
+    /** Statistics about the pool, useful for verifying that steady state
+     *  operation isn't hitting the allocator.
+     */
+    struct Stats {
+        Stats()
+         : slabs(0), allocated(0), inUse(0)
+        {}
+
+        // Number of slabs requested from the system allocator
+        uint64 slabs;
+        // Total number of buffers handed out by allocate()
+        uint64 allocated;
+        // Number of buffers currently held by someone
+        uint64 inUse;
+    };
+    static Stats stats();
+
+private:
+    friend class SegmentBufferPool;
+    friend void intrusive_ptr_add_ref(SegmentBuffer* buf);
+    friend void intrusive_ptr_release(SegmentBuffer* buf);
+
+    SegmentBuffer()
+     : mNext(NULL),
+       mRefCount(0),
+       mStart(HEADROOM),
+       mEnd(HEADROOM)
+    {}
+
+    void release();
+
+    // Free list link, only valid while the buffer is in the pool
+    SegmentBuffer* mNext;
+    AtomicValue<uint32> mRefCount;
+    uint16 mStart;
+    uint16 mEnd;
+    uint8 mData[CAPACITY];
+};
+
+inline void intrusive_ptr_add_ref(SegmentBuffer* buf) {
+    ++(buf->mRefCount);
+}
+
+inline void intrusive_ptr_release(SegmentBuffer* buf) {
+    if (--(buf->mRefCount) == 0)
+        buf->release();
+}
+
+typedef boost::intrusive_ptr<SegmentBuffer> SegmentBufferPtr;
+
+} // namespace SST
+} // namespace Sirikata
+
+#endif //_SIRIKATA_CORE_NETWORK_SST_SEGMENT_BUFFER_HPP_
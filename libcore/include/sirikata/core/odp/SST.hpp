@@ -7,6 +7,7 @@
 
 #include <sirikata/core/odp/SSTDecls.hpp>
 #include <sirikata/core/network/SSTImpl.hpp>
+#include <sirikata/core/network/SSTDatagramBatcher.hpp>
 #include <sirikata/core/odp/Service.hpp>
 
 namespace Sirikata {
@@ -90,15 +91,8 @@ class SIRIKATA_EXPORT BaseDatagramLayer<SpaceObjectReference>
         mAllocatedPorts.erase(it);
     }
 
-    void send(EndPoint<EndPointType>* src, EndPoint<EndPointType>* dest, void* data, int len) {
-        boost::mutex::scoped_lock lock(mMutex);
-
-        ODP::Port* port = getOrAllocatePort(*src);
-
-        port->send(
-            ODP::Endpoint(dest->endPoint, dest->port),
-            MemoryReference(data, len)
-        );
+    void send(EndPoint<EndPointType>* src, EndPoint<EndPointType>* dest, const SegmentBufferPtr& packet) {
+        mBatcher->send(*src, *dest, packet);
     }
 
     const Context* context() {
@@ -121,6 +115,14 @@ class SIRIKATA_EXPORT BaseDatagramLayer<SpaceObjectReference>
           mSSTConnVars(sstConnVars),
           mEndpoint(ep)
         {
+            mBatcher = DatagramBatcher<EndPointType>::create(
+                ctx,
+                std::tr1::bind(&BaseDatagramLayer::sendDatagram, this,
+                    std::tr1::placeholders::_1,
+                    std::tr1::placeholders::_2,
+                    std::tr1::placeholders::_3
+                )
+            );
 
         }
 
@@ -145,17 +147,41 @@ class SIRIKATA_EXPORT BaseDatagramLayer<SpaceObjectReference>
         return result;
     }
 
-    void receiveMessage(const ODP::Endpoint &src, const ODP::Endpoint &dst, MemoryReference payload) {
-        Connection<EndPointType>::handleReceive(
-            mSSTConnVars,
-            EndPoint<EndPointType> (SpaceObjectReference(src.space(), src.object()), src.port()),
-            EndPoint<EndPointType> (SpaceObjectReference(dst.space(), dst.object()), dst.port()),
-            (void*) payload.data(), payload.size()
+    // Sends a single datagram, which may hold a batch of SST packets.
+    void sendDatagram(const EndPoint<EndPointType>& src, const EndPoint<EndPointType>& dest, const MemoryReference& data) {
+        boost::mutex::scoped_lock lock(mMutex);
+
+        // Batches can be flushed after we've been invalidated
+        if (mODP == NULL) return;
+
+        ODP::Port* port = getOrAllocatePort(src);
+
+        port->send(
+            ODP::Endpoint(dest.endPoint, dest.port),
+            data
         );
     }
 
+    void receiveMessage(const ODP::Endpoint &src, const ODP::Endpoint &dst, MemoryReference payload) {
+        EndPoint<EndPointType> src_ep(SpaceObjectReference(src.space(), src.object()), src.port());
+        EndPoint<EndPointType> dst_ep(SpaceObjectReference(dst.space(), dst.object()), dst.port());
+
+        // A single datagram may carry a batch of packets
+        DatagramBatchReader reader(payload.data(), payload.size());
+        MemoryReference packet(NULL, 0);
+        while(reader.next(&packet)) {
+            Connection<EndPointType>::handleReceive(
+                mSSTConnVars, src_ep, dst_ep,
+                (void*) packet.data(), packet.size()
+            );
+        }
+    }
+
     void receiveMessageToCallback(const ODP::Endpoint &src, const ODP::Endpoint &dst, MemoryReference payload, DataCallback cb) {
-        cb((void*) payload.data(), payload.size() );
+        DatagramBatchReader reader(payload.data(), payload.size());
+        MemoryReference packet(NULL, 0);
+        while(reader.next(&packet))
+            cb((void*) packet.data(), packet.size());
     }
 
 
@@ -168,6 +194,8 @@ class SIRIKATA_EXPORT BaseDatagramLayer<SpaceObjectReference>
 
     boost::mutex mMutex;
 
+    typename DatagramBatcher<EndPointType>::Ptr mBatcher;
+
     ConnectionVariables<EndPointType>* mSSTConnVars;
     EndPointType mEndpoint;
 };
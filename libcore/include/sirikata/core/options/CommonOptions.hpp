@@ -46,6 +46,8 @@
 #define OPT_PID_FILE                    "pid-file"
 
 #define OPT_SST_DEFAULT_WINDOW_SIZE  "sst.default-window-size"
+#define OPT_SST_BATCH_SIZE           "sst.batch-size"
+#define OPT_SST_BATCH_FLUSH_LATENCY  "sst.batch-flush-latency"
 
 #define STATS_TRACE_FILE     "stats.trace-filename"
 #define PROFILE                    "profile"
@@ -60,6 +62,9 @@
 #define OPT_CDN_UPLOAD_URI_PREFIX   "cdn.upload.prefix"
 #define OPT_CDN_UPLOAD_STATUS_URI_PREFIX   "cdn.upload.status.prefix"
 
+#define OPT_HTTP_PIPELINE_DEPTH     "http.pipeline-depth"
+#define OPT_HTTP_COALESCE_REQUESTS  "http.coalesce-requests"
+
 #define OPT_TRACE_TIMESERIES           "trace.timeseries"
 #define OPT_TRACE_TIMESERIES_OPTIONS   "trace.timeseries-options"
 
@@ -0,0 +1,54 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_CORE_QUEUE_ABSTRACT_FAIR_QUEUE_HPP_
+#define _SIRIKATA_CORE_QUEUE_ABSTRACT_FAIR_QUEUE_HPP_
+
+#include "AbstractQueue.hpp"
+
+namespace Sirikata {
+
+/** Interface for queues which fairly select between a set of input queues of
+ *  Messages, one per Key, each backed by a TQueue and assigned a weight.
+ *  Implemented by FairQueue (weighted fair queuing) and DRRFairQueue (deficit
+ *  round robin) so users can choose a scheduler at runtime.
+ */
+template <class Message, class Key, class TQueue>
+class AbstractFairQueue {
+public:
+    virtual ~AbstractFairQueue() {}
+
+    virtual void addQueue(TQueue* mq, Key key, float weight) = 0;
+    virtual bool removeQueue(Key key) = 0;
+    virtual bool hasQueue(Key key) const = 0;
+    virtual uint32 numQueues() const = 0;
+
+    virtual void setQueueWeight(Key key, float weight) = 0;
+    virtual float getQueueWeight(Key key) const = 0;
+    virtual float avg_weight() const = 0;
+
+    // Disabled queues keep their contents but are skipped when selecting the
+    // next message.
+    virtual void enableQueue(Key key) = 0;
+    virtual void disableQueue(Key key) = 0;
+
+    virtual QueueEnum::PushResult push(Key key, Message* msg) = 0;
+    // Notify the queue that the front of an input queue changed without going
+    // through push(), e.g. for input queues which are filled externally.
+    virtual void notifyPushFront(Key key) = 0;
+
+    // Returns the next message to deliver, or NULL if there is none
+    virtual Message* front(Key* keyAtFront) = 0;
+    // Removes and returns the next message to deliver, or NULL if there is none
+    virtual Message* pop(Key* keyAtFront = NULL) = 0;
+    virtual bool empty() const = 0;
+
+    // NOTE: maxSize(key) and size(key) are left to implementations since not
+    // all input queue types can report them and every virtual method is
+    // instantiated with the queue.
+};
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_CORE_QUEUE_ABSTRACT_FAIR_QUEUE_HPP_
@@ -0,0 +1,339 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_CORE_QUEUE_DRR_FAIR_QUEUE_HPP_
+#define _SIRIKATA_CORE_QUEUE_DRR_FAIR_QUEUE_HPP_
+
+#include "AbstractFairQueue.hpp"
+
+namespace Sirikata {
+
+/** Fair Queue with one input queue of Messages per Key, backed by a TQueue,
+ *  which selects between input queues using deficit round robin. This is a
+ *  drop in replacement for FairQueue: shares of bandwidth are proportional to
+ *  weights, but selecting the next message is O(1) instead of O(log n) in the
+ *  number of queues, at the cost of coarser interleaving between queues.
+ *
+ *  Queues with data are kept in a round robin list. Each time a queue gets a
+ *  turn its deficit is increased by a quantum proportional to its weight and
+ *  it may send messages until its deficit is exhausted. The quantum of the
+ *  lowest weight queue is the largest message seen so far, so each turn sends
+ *  at least one message.
+ */
+template <class Message, class Key, class TQueue>
+class DRRFairQueue : public AbstractFairQueue<Message, Key, TQueue> {
+private:
+    typedef TQueue MessageQueue;
+
+    struct QueueInfo;
+    typedef std::list<QueueInfo*> ActiveList;
+
+    struct QueueInfo {
+        QueueInfo(Key _key, TQueue* queue, float w)
+         : key(_key),
+           messageQueue(queue),
+           weight(w),
+           deficit(0),
+           enabled(true),
+           hasData(false),
+           turnStarted(false)
+        {}
+
+        ~QueueInfo() {
+            delete messageQueue;
+        }
+
+        Key key;
+        TQueue* messageQueue;
+        float weight;
+        int64 deficit; // Bytes this queue can send before its turn ends
+        bool enabled;
+        bool hasData; // In mActive if enabled, counted in mNumDisabledWithData otherwise
+        bool turnStarted; // Whether this turn's quantum has been added to deficit
+        typename ActiveList::iterator activeIt; // Only valid when in mActive
+    };
+
+    // Hashed so push and notifyPushFront, which happen for every message,
+    // don't add an O(log n) lookup back in
+    typedef std::tr1::unordered_map<Key, QueueInfo*> QueueInfoByKey;
+    typedef typename QueueInfoByKey::iterator ByKeyIterator;
+    typedef typename QueueInfoByKey::const_iterator ConstByKeyIterator;
+
+    // Multiset of positive weights so the minimum can be tracked cheaply as
+    // weights change
+    typedef std::multiset<float> WeightSet;
+
+public:
+    DRRFairQueue()
+     : mQueuesByKey(),
+       mActive(),
+       mNumDisabledWithData(0),
+       mWeights(),
+       mWeightSum(0.0),
+       mMaxMessageSize(1),
+       warn_count(0)
+    {
+    }
+
+    ~DRRFairQueue() {
+        while(!mQueuesByKey.empty())
+            removeQueue( mQueuesByKey.begin()->first );
+    }
+
+    virtual void addQueue(MessageQueue *mq, Key key, float weight) {
+        QueueInfo* queue_info = new QueueInfo(key, mq, weight);
+        mQueuesByKey[key] = queue_info;
+        addWeight(weight);
+        // The input queue may have been created with data in it
+        if (!mq->empty())
+            markHasData(queue_info);
+    }
+
+    virtual void setQueueWeight(Key key, float weight) {
+        ByKeyIterator it = mQueuesByKey.find(key);
+        if (it == mQueuesByKey.end()) return;
+        QueueInfo* qi = it->second;
+        removeWeight(qi->weight);
+        qi->weight = weight;
+        addWeight(weight);
+        // The new weight takes effect at the start of the queue's next turn
+    }
+
+    virtual float getQueueWeight(Key key) const {
+        ConstByKeyIterator it = mQueuesByKey.find(key);
+        if (it != mQueuesByKey.end())
+            return it->second->weight;
+        return 0.f;
+    }
+
+    virtual bool removeQueue(Key key) {
+        ByKeyIterator it = mQueuesByKey.find(key);
+        if (it == mQueuesByKey.end()) return false;
+
+        QueueInfo* qi = it->second;
+        clearHasData(qi);
+        removeWeight(qi->weight);
+
+        mQueuesByKey.erase(it);
+        delete qi;
+
+        return true;
+    }
+
+    // NOTE: Disabled queues keep their place in mQueuesByKey and their
+    // deficit, but are taken out of the round robin list so they cost nothing
+    // when selecting the next message.
+    virtual void enableQueue(Key key) {
+        ByKeyIterator it = mQueuesByKey.find(key);
+        if (it == mQueuesByKey.end()) return;
+        QueueInfo* qi = it->second;
+        if (qi->enabled) return;
+
+        qi->enabled = true;
+        if (qi->hasData) {
+            mNumDisabledWithData--;
+            qi->activeIt = mActive.insert(mActive.end(), qi);
+        }
+    }
+
+    virtual void disableQueue(Key key) {
+        ByKeyIterator it = mQueuesByKey.find(key);
+        assert(it != mQueuesByKey.end());
+        QueueInfo* qi = it->second;
+        if (!qi->enabled) return;
+
+        // Keep turnStarted so a queue which is disabled and quickly reenabled,
+        // e.g. because its network stream blocked, doesn't collect an extra
+        // quantum.
+        qi->enabled = false;
+        if (qi->hasData) {
+            mActive.erase(qi->activeIt);
+            mNumDisabledWithData++;
+        }
+    }
+
+    virtual bool hasQueue(Key key) const {
+        return ( mQueuesByKey.find(key) != mQueuesByKey.end() );
+    }
+
+    virtual uint32 numQueues() const {
+        return (uint32)mQueuesByKey.size();
+    }
+
+    virtual QueueEnum::PushResult push(Key key, Message *msg) {
+        ByKeyIterator qi_it = mQueuesByKey.find(key);
+        assert( qi_it != mQueuesByKey.end() );
+
+        QueueInfo* queue_info = qi_it->second;
+        QueueEnum::PushResult pushResult = queue_info->messageQueue->push(msg);
+        if (pushResult == QueueEnum::PushSucceeded)
+            markHasData(queue_info);
+
+        return pushResult;
+    }
+
+    // See FairQueue::notifyPushFront. Since the front message is only examined
+    // when the queue gets a turn, this just makes sure the queue gets one.
+    virtual void notifyPushFront(Key key) {
+        ByKeyIterator qi_it = mQueuesByKey.find(key);
+        assert( qi_it != mQueuesByKey.end() );
+
+        markHasData(qi_it->second);
+    }
+
+    // Returns the next message to deliver
+    // \returns the next message, or NULL if the queue is empty
+    virtual Message* front(Key* keyAtFront) {
+        QueueInfo* qi = NULL;
+        Message* result = nextMessage(&qi);
+        if (result != NULL && keyAtFront != NULL)
+            *keyAtFront = qi->key;
+        return result;
+    }
+
+    // Returns the next message to deliver
+    // \returns the next message, or NULL if the queue is empty
+    virtual Message* pop(Key* keyAtFront = NULL) {
+        QueueInfo* qi = NULL;
+        Message* result = nextMessage(&qi);
+        if (result == NULL)
+            return NULL;
+
+        if (keyAtFront != NULL)
+            *keyAtFront = qi->key;
+
+        qi->deficit -= result->size();
+        Message* popped_val = qi->messageQueue->pop();
+        assert(popped_val == result);
+
+        // Queues which run out of data lose the rest of their turn
+        if (qi->messageQueue->empty())
+            clearHasData(qi);
+
+        return result;
+    }
+
+    virtual bool empty() const {
+        // Like FairQueue, disabled queues holding data make us non-empty
+        return mActive.empty() && mNumDisabledWithData == 0;
+    }
+
+    // Returns the total amount of space that can be allocated for the destination
+    uint32 maxSize(Key key) const {
+        ConstByKeyIterator it = mQueuesByKey.find(key);
+        if (it == mQueuesByKey.end()) return 0;
+        return it->second->messageQueue->maxSize();
+    }
+
+    // Returns the total amount of space currently used for the destination
+    uint32 size(Key key) const {
+        ConstByKeyIterator it = mQueuesByKey.find(key);
+        if (it == mQueuesByKey.end()) return 0;
+        return it->second->messageQueue->size();
+    }
+
+    virtual float avg_weight() const {
+        if (mQueuesByKey.size() == 0) return 1.f;
+        return (float)(mWeightSum / mQueuesByKey.size());
+    }
+
+protected:
+    // Finds the queue whose turn it is and which has enough deficit to send its
+    // front message. Returns NULL if no enabled queue has data. Calling this
+    // repeatedly without popping returns the same message.
+    Message* nextMessage(QueueInfo** qi_out) {
+        while(!mActive.empty()) {
+            QueueInfo* qi = mActive.front();
+
+            // front() may be NULL even for non-empty queues, e.g. if the input
+            // queue is filtered. Like FairQueue, we drop it until the next
+            // push or notifyPushFront.
+            Message* msg = qi->messageQueue->empty() ? NULL : qi->messageQueue->front();
+            if (msg == NULL) {
+                clearHasData(qi);
+                continue;
+            }
+
+            uint32 msg_size = msg->size();
+            if (msg_size > mMaxMessageSize)
+                mMaxMessageSize = msg_size;
+
+            if (!qi->turnStarted) {
+                qi->deficit += quantum(qi);
+                qi->turnStarted = true;
+            }
+
+            if (qi->deficit >= (int64)msg_size) {
+                *qi_out = qi;
+                return msg;
+            }
+
+            // Out of deficit, move on to the next queue. Since the quantum is
+            // at least mMaxMessageSize, the next queue can always send.
+            qi->turnStarted = false;
+            mActive.splice(mActive.end(), mActive, qi->activeIt);
+        }
+        return NULL;
+    }
+
+    int64 quantum(const QueueInfo* qi) const {
+        float weight = qi->weight;
+        if (weight <= 0.f) {
+            if (!(warn_count++))
+                SILOG(fairqueue,warning,"Encountered 0 weight, using the minimum weight.");
+            return mMaxMessageSize;
+        }
+        float min_weight = mWeights.empty() ? weight : *mWeights.begin();
+        // Cap the ratio so a tiny minimum weight can't overflow the deficit.
+        double ratio = std::min((double)weight / min_weight, 1000000.0);
+        return (int64)(mMaxMessageSize * ratio);
+    }
+
+    void markHasData(QueueInfo* qi) {
+        if (qi->hasData) return;
+        qi->hasData = true;
+        if (qi->enabled)
+            qi->activeIt = mActive.insert(mActive.end(), qi);
+        else
+            mNumDisabledWithData++;
+    }
+
+    void clearHasData(QueueInfo* qi) {
+        if (!qi->hasData) return;
+        qi->hasData = false;
+        qi->deficit = 0;
+        qi->turnStarted = false;
+        if (qi->enabled)
+            mActive.erase(qi->activeIt);
+        else
+            mNumDisabledWithData--;
+    }
+
+    void addWeight(float weight) {
+        mWeightSum += weight;
+        if (weight > 0.f)
+            mWeights.insert(weight);
+    }
+
+    void removeWeight(float weight) {
+        mWeightSum -= weight;
+        if (weight > 0.f) {
+            typename WeightSet::iterator it = mWeights.find(weight);
+            if (it != mWeights.end())
+                mWeights.erase(it);
+        }
+    }
+
+    QueueInfoByKey mQueuesByKey;
+    ActiveList mActive; // Enabled queues with data, in round robin order
+    uint32 mNumDisabledWithData;
+    WeightSet mWeights;
+    double mWeightSum;
+    uint32 mMaxMessageSize;
+    mutable uint32 warn_count;
+}; // class DRRFairQueue
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_CORE_QUEUE_DRR_FAIR_QUEUE_HPP_
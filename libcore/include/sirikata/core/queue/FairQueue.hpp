@@ -34,6 +34,7 @@
 #define _FAIR_MESSAGE_QUEUE_HPP_
 
 #include "Queue.hpp"
+#include "AbstractFairQueue.hpp"
 #include <sirikata/core/util/Time.hpp>
 
 namespace Sirikata {
@@ -41,7 +42,7 @@ namespace Sirikata {
 /** Fair Queue with one input queue of Messages per Key, backed by a TQueue. Each
  *  input queue can be assigned a weight and selection happens according to FairQueuing.
  */
-template <class Message,class Key,class TQueue> class FairQueue {
+template <class Message,class Key,class TQueue> class FairQueue : public AbstractFairQueue<Message, Key, TQueue> {
 private:
     typedef TQueue MessageQueue;
 
@@ -113,14 +114,14 @@ public:
             removeQueue( mQueuesByKey.begin()->first );
     }
 
-    void addQueue(MessageQueue *mq, Key key, float weight) {
+    virtual void addQueue(MessageQueue *mq, Key key, float weight) {
         QueueInfo* queue_info = new QueueInfo(key, mq, weight);
         mQueuesByKey[key] = queue_info;
         computeNextFinishTime(queue_info);
         mFrontQueue = NULL; // Force recomputation of front
     }
 
-    void setQueueWeight(Key key, float weight) {
+    virtual void setQueueWeight(Key key, float weight) {
         ConstByKeyIterator it = mQueuesByKey.find(key);
         if (it != mQueuesByKey.end()) {
             QueueInfo* qi = it->second;
@@ -144,14 +145,14 @@ public:
         }
     }
 
-    float getQueueWeight(Key key) const {
+    virtual float getQueueWeight(Key key) const {
         ConstByKeyIterator it = mQueuesByKey.find(key);
         if (it != mQueuesByKey.end())
             return it->second->weight;
         return 0.f;
     }
 
-    bool removeQueue(Key key) {
+    virtual bool removeQueue(Key key) {
         // Find the queue
         ByKeyIterator it = mQueuesByKey.find(key);
         bool havequeue = (it != mQueuesByKey.end());
@@ -179,7 +180,7 @@ public:
     // operations, under certain conditions, need to reset the previously
     // computed front queue because they can affect this computation by adding
     // or removing options.
-    void enableQueue(Key key) {
+    virtual void enableQueue(Key key) {
         ByKeyIterator it = mQueuesByKey.find(key);
         if (it == mQueuesByKey.end())
             return;
@@ -196,7 +197,7 @@ public:
             mFrontQueue = NULL;
     }
 
-    void disableQueue(Key key) {
+    virtual void disableQueue(Key key) {
         ByKeyIterator it = mQueuesByKey.find(key);
         assert(it != mQueuesByKey.end());
         QueueInfo* qi = it->second;
@@ -208,15 +209,15 @@ public:
             mFrontQueue = NULL;
     }
 
-    bool hasQueue(Key key) const{
+    virtual bool hasQueue(Key key) const{
         return ( mQueuesByKey.find(key) != mQueuesByKey.end() );
     }
 
-    uint32 numQueues() const {
+    virtual uint32 numQueues() const {
         return (uint32)mQueuesByKey.size();
     }
 
-    QueueEnum::PushResult push(Key key, Message *msg) {
+    virtual QueueEnum::PushResult push(Key key, Message *msg) {
         ByKeyIterator qi_it = mQueuesByKey.find(key);
         assert( qi_it != mQueuesByKey.end() );
 
@@ -243,7 +244,7 @@ public:
     // to know when data becomes available when none was left in the network
     // buffer, but it is safe to call notifyPushFront on every data received
     // callback.
-    void notifyPushFront(Key key) {
+    virtual void notifyPushFront(Key key) {
         ByKeyIterator qi_it = mQueuesByKey.find(key);
         assert( qi_it != mQueuesByKey.end() );
 
@@ -258,7 +259,7 @@ public:
 
     // Returns the next message to deliver
     // \returns the next message, or NULL if the queue is empty
-    Message* front(Key* keyAtFront) {
+    virtual Message* front(Key* keyAtFront) {
         Message* result = NULL;
 
         if (mFrontQueue == NULL) {
@@ -282,7 +283,7 @@ public:
 
     // Returns the next message to deliver
     // \returns the next message, or NULL if the queue is empty
-    Message* pop(Key* keyAtFront = NULL) {
+    virtual Message* pop(Key* keyAtFront = NULL) {
         Message* result = NULL;
         Time vftime(Time::null());
 
@@ -323,7 +324,7 @@ public:
         return result;
     }
 
-    bool empty() const {
+    virtual bool empty() const {
         // Queues won't be in mQueuesByTime unless they have something in them
         // This allows us to efficiently answer false if we know we have pending
         // items
@@ -346,7 +347,7 @@ public:
     }
 
     // FIXME we really shouldn't have to expose this
-    float avg_weight() const {
+    virtual float avg_weight() const {
         if (mQueuesByKey.size() == 0) return 1.f;
         float w_sum = 0.f;
         for(ConstByKeyIterator it = mQueuesByKey.begin(); it != mQueuesByKey.end(); it++)
@@ -0,0 +1,369 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_CORE_QUEUE_RING_QUEUE_HPP_
+#define _SIRIKATA_CORE_QUEUE_RING_QUEUE_HPP_
+
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/util/AtomicTypes.hpp>
+#include <sirikata/core/util/Thread.hpp>
+#include <sirikata/core/util/Timer.hpp>
+
+namespace Sirikata {
+
+// Size used to keep data written by different threads on separate cache lines
+#define SIRIKATA_CACHE_LINE_SIZE 64
+
+namespace RingQueueNS {
+// Round up to the next power of two, with a minimum of 2
+inline uint32 ringCapacity(uint32 requested) {
+    uint32 cap = 2;
+    while(cap < requested) cap <<= 1;
+    return cap;
+}
+} // namespace RingQueueNS
+
+/** A bounded queue which can be used by any number of producers and consumers
+ *  at once without locking. Elements are stored in a ring of preallocated
+ *  cells, each tagged with a sequence number which tells producers when the
+ *  cell is free and consumers when it holds a value. Claiming a cell only
+ *  requires a single compare-and-swap on the shared position, so there are no
+ *  allocations and no ABA problems, unlike LockFreeQueue.
+ *
+ *  The interface matches ThreadSafeQueue, so this can be used as the
+ *  Superclass of a SizedThreadSafeQueue. Since the queue is bounded, push()
+ *  waits for space when the queue is full. Use tryPush() if you'd rather
+ *  handle that yourself. When used with SizedThreadSafeQueue, choose a
+ *  capacity larger than the resource monitor's limit so push() never has to
+ *  wait.
+ *
+ *  Popped values are swapped out of their cells rather than copied, so
+ *  values held by the queue (e.g. shared_ptrs) are released when they are
+ *  popped as long as the destination is empty.
+ */
+template <typename T>
+class MPMCRingQueue : Noncopyable {
+public:
+    enum {
+        DEFAULT_CAPACITY = 1024
+    };
+
+    explicit MPMCRingQueue(uint32 capacity = DEFAULT_CAPACITY)
+     : mBuffer(NULL),
+       mMask(RingQueueNS::ringCapacity(capacity) - 1),
+       mEnqueuePos(0),
+       mDequeuePos(0)
+    {
+        mBuffer = new Cell[mMask + 1];
+        for(uint32 i = 0; i <= mMask; i++)
+            mBuffer[i].sequence = i;
+    }
+
+    ~MPMCRingQueue() {
+        delete[] mBuffer;
+    }
+
+    uint32 capacity() const {
+        return mMask + 1;
+    }
+
+    /** Push a value onto the queue if there is room for it.
+     *  \param value the value to push
+     *  \returns true if the value was pushed, false if the queue was full
+     */
+    bool tryPush(const T& value) {
+        Cell* cell;
+        uint32 pos = mEnqueuePos;
+        while(true) {
+            cell = &mBuffer[pos & mMask];
+            uint32 seq = cell->sequence;
+            memory_barrier();
+            int32 diff = (int32)(seq - pos);
+            if (diff == 0) {
+                if (compare_and_swap(&mEnqueuePos, pos, pos + 1))
+                    break;
+                pos = mEnqueuePos;
+            }
+            else if (diff < 0) {
+                // The consumer hasn't freed this cell from the last lap
+                return false;
+            }
+            else {
+                pos = mEnqueuePos;
+            }
+        }
+
+        cell->value = value;
+        memory_barrier();
+        cell->sequence = pos + 1;
+        return true;
+    }
+
+    /** Push a value onto the queue, waiting for space if it is full.
+     *  \param value the value to push
+     */
+    void push(const T& value) {
+        while(!tryPush(value))
+            Thread::yield();
+    }
+
+    /** Pops the front element from the queue and places it in ret.
+     *  \param ret storage for the popped element
+     *  \returns true if an element was popped, false if the queue was empty
+     */
+    bool pop(T& ret) {
+        Cell* cell;
+        uint32 pos = mDequeuePos;
+        while(true) {
+            cell = &mBuffer[pos & mMask];
+            uint32 seq = cell->sequence;
+            memory_barrier();
+            int32 diff = (int32)(seq - (pos + 1));
+            if (diff == 0) {
+                if (compare_and_swap(&mDequeuePos, pos, pos + 1))
+                    break;
+                pos = mDequeuePos;
+            }
+            else if (diff < 0) {
+                // Nothing has been written to this cell yet
+                return false;
+            }
+            else {
+                pos = mDequeuePos;
+            }
+        }
+
+        using std::swap;
+        swap(ret, cell->value);
+        memory_barrier();
+        cell->sequence = pos + mMask + 1;
+        return true;
+    }
+
+    /** Pop an element from the queue, waiting until an element is available
+     *  if the queue is currently empty. This spins, yielding the processor
+     *  between attempts, so it is only appropriate when the queue is rarely
+     *  empty.
+     *  \param retval storage for the popped element
+     */
+    void blockingPop(T& retval) {
+        while(!pop(retval))
+            Thread::yield();
+    }
+
+    /** Pop an element from the queue, waiting up to timeout for an element to
+     *  become available.
+     *  \param retval storage for the popped element
+     *  \returns true if an element was popped
+     */
+    bool blockingPop(T& retval, const Duration& timeout) {
+        Time give_up = Timer::now() + timeout;
+        while(!pop(retval)) {
+            if (Timer::now() > give_up) return false;
+            Thread::yield();
+        }
+        return true;
+    }
+
+    /** Pops all elements currently in the queue into popResults. Any elements
+     *  currently in popResults will be discarded.
+     *  \param popResults a deque to place popped elements in
+     */
+    void popAll(std::deque<T>* popResults) {
+        popResults->resize(0);
+        T value;
+        while(pop(value)) {
+            popResults->push_back(value);
+            value = T();
+        }
+    }
+
+    /** Swap the contents of this queue with the one specified. Elements in
+     *  swapWith are pushed onto the queue after the current contents are
+     *  removed, so this is only atomic with respect to other swap() and
+     *  popAll() calls if there's a single consumer.
+     *  \param swapWith a deque to swap elements with
+     */
+    void swap(std::deque<T>& swapWith) {
+        std::deque<T> popped;
+        popAll(&popped);
+        for(typename std::deque<T>::iterator it = swapWith.begin(); it != swapWith.end(); it++)
+            push(*it);
+        swapWith.swap(popped);
+    }
+
+    /** Checks if the queue is probably empty. The result could change as soon
+     *  as this returns.
+     */
+    bool probablyEmpty() {
+        return (int32)(mEnqueuePos - mDequeuePos) <= 0;
+    }
+
+    /** Get the approximate number of elements in the queue, only useful for
+     *  monitoring.
+     */
+    int32 size() {
+        int32 result = (int32)(mEnqueuePos - mDequeuePos);
+        return result < 0 ? 0 : result;
+    }
+
+private:
+    struct Cell {
+        volatile uint32 sequence;
+        T value;
+    };
+
+    char mPad0[SIRIKATA_CACHE_LINE_SIZE];
+    Cell* mBuffer;
+    const uint32 mMask;
+    char mPad1[SIRIKATA_CACHE_LINE_SIZE - sizeof(Cell*) - sizeof(uint32)];
+    // Producers and consumers each hammer on their own position, so keep them
+    // on separate cache lines.
+    volatile uint32 mEnqueuePos;
+    char mPad2[SIRIKATA_CACHE_LINE_SIZE - sizeof(uint32)];
+    volatile uint32 mDequeuePos;
+    char mPad3[SIRIKATA_CACHE_LINE_SIZE - sizeof(uint32)];
+};
+
+/** A bounded queue for exactly one producer thread and one consumer thread.
+ *  With only one writer for each position no atomic read-modify-write
+ *  operations are needed, just barriers to order the value and position
+ *  updates. Each side also caches the other side's position so it only needs
+ *  to read the shared cache line when the queue looks full or empty.
+ *
+ *  The interface is the same as MPMCRingQueue. Using it with more than one
+ *  producer or consumer will corrupt the queue.
+ */
+template <typename T>
+class SPSCRingQueue : Noncopyable {
+public:
+    enum {
+        DEFAULT_CAPACITY = 1024
+    };
+
+    explicit SPSCRingQueue(uint32 capacity = DEFAULT_CAPACITY)
+     : mBuffer(NULL),
+       mMask(RingQueueNS::ringCapacity(capacity) - 1),
+       mTail(0),
+       mCachedHead(0),
+       mHead(0),
+       mCachedTail(0)
+    {
+        mBuffer = new T[mMask + 1];
+    }
+
+    ~SPSCRingQueue() {
+        delete[] mBuffer;
+    }
+
+    uint32 capacity() const {
+        return mMask + 1;
+    }
+
+    /** Push a value onto the queue if there is room for it. Only call from the
+     *  producer thread.
+     *  \returns true if the value was pushed, false if the queue was full
+     */
+    bool tryPush(const T& value) {
+        uint32 tail = mTail;
+        if (tail - mCachedHead > mMask) {
+            mCachedHead = mHead;
+            memory_barrier();
+            if (tail - mCachedHead > mMask)
+                return false;
+        }
+
+        mBuffer[tail & mMask] = value;
+        memory_barrier();
+        mTail = tail + 1;
+        return true;
+    }
+
+    /** Push a value onto the queue, waiting for space if it is full. */
+    void push(const T& value) {
+        while(!tryPush(value))
+            Thread::yield();
+    }
+
+    /** Pops the front element from the queue and places it in ret. Only call
+     *  from the consumer thread.
+     *  \returns true if an element was popped, false if the queue was empty
+     */
+    bool pop(T& ret) {
+        uint32 head = mHead;
+        if (head == mCachedTail) {
+            mCachedTail = mTail;
+            memory_barrier();
+            if (head == mCachedTail)
+                return false;
+        }
+
+        using std::swap;
+        swap(ret, mBuffer[head & mMask]);
+        memory_barrier();
+        mHead = head + 1;
+        return true;
+    }
+
+    void blockingPop(T& retval) {
+        while(!pop(retval))
+            Thread::yield();
+    }
+
+    bool blockingPop(T& retval, const Duration& timeout) {
+        Time give_up = Timer::now() + timeout;
+        while(!pop(retval)) {
+            if (Timer::now() > give_up) return false;
+            Thread::yield();
+        }
+        return true;
+    }
+
+    void popAll(std::deque<T>* popResults) {
+        popResults->resize(0);
+        T value;
+        while(pop(value)) {
+            popResults->push_back(value);
+            value = T();
+        }
+    }
+
+    /** Swap the contents of this queue with the one specified. Since this both
+     *  pushes and pops, it may only be used if the producer and consumer are
+     *  the same thread.
+     */
+    void swap(std::deque<T>& swapWith) {
+        std::deque<T> popped;
+        popAll(&popped);
+        for(typename std::deque<T>::iterator it = swapWith.begin(); it != swapWith.end(); it++)
+            push(*it);
+        swapWith.swap(popped);
+    }
+
+    bool probablyEmpty() {
+        return mHead == mTail;
+    }
+
+    int32 size() {
+        return (int32)(mTail - mHead);
+    }
+
+private:
+    char mPad0[SIRIKATA_CACHE_LINE_SIZE];
+    T* mBuffer;
+    const uint32 mMask;
+    char mPad1[SIRIKATA_CACHE_LINE_SIZE - sizeof(T*) - sizeof(uint32)];
+    // Written by the producer
+    volatile uint32 mTail;
+    uint32 mCachedHead;
+    char mPad2[SIRIKATA_CACHE_LINE_SIZE - 2*sizeof(uint32)];
+    // Written by the consumer
+    volatile uint32 mHead;
+    uint32 mCachedTail;
+    char mPad3[SIRIKATA_CACHE_LINE_SIZE - 2*sizeof(uint32)];
+};
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_CORE_QUEUE_RING_QUEUE_HPP_
@@ -30,10 +30,7 @@ public:
 
     //Puts a request into the pool
     virtual void addRequest(TransferRequestPtr req) {
-        if (!req) {
-            mDeltaQueue.push(req);
-            return;
-        }
+        if (!req) return;
 
         boost::unique_lock<boost::mutex> lock(mMutex);
 
@@ -102,6 +99,7 @@ public:
         setRequestPriority(it->second.aggregateRequest, mAggregationAlgorithm->aggregate(it->second.inputRequests));
 
         mDeltaQueue.push(it->second.aggregateRequest);
+        notifyRequestsAvailable();
     }
 
     //Updates priority of a request in the pool
@@ -123,6 +121,7 @@ public:
         // Update aggregate priority
         setRequestPriority(it->second.aggregateRequest, mAggregationAlgorithm->aggregate(it->second.inputRequests));
         mDeltaQueue.push(it->second.aggregateRequest);
+        notifyRequestsAvailable();
     }
 
     //Updates priority of a request in the pool
@@ -152,12 +151,14 @@ public:
         if (it->second.inputRequests.empty()) {
             setRequestDeletion(it->second.aggregateRequest);
             mDeltaQueue.push(it->second.aggregateRequest);
+            notifyRequestsAvailable();
             mRequestData.erase(it);
         }
         else {
             // Otherwise, update priority
             setRequestPriority(it->second.aggregateRequest, mAggregationAlgorithm->aggregate(it->second.inputRequests));
             mDeltaQueue.push(it->second.aggregateRequest);
+            notifyRequestsAvailable();
         }
 
     }
@@ -173,10 +174,10 @@ private:
         mAggregationAlgorithm = new MaxPriorityAggregation();
     }
 
-    //Returns an item from the pool. Blocks if pool is empty.
+    //Returns an item from the pool, or NULL if the pool is empty.
     inline std::tr1::shared_ptr<TransferRequest> getRequest() {
         std::tr1::shared_ptr<TransferRequest> retval;
-        mDeltaQueue.blockingPop(retval);
+        mDeltaQueue.pop(retval);
         return retval;
     }
 
@@ -0,0 +1,159 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_CORE_TRANSFER_BLOB_STORE_HPP_
+#define _SIRIKATA_CORE_TRANSFER_BLOB_STORE_HPP_
+
+#include <sirikata/core/transfer/Defs.hpp>
+#include <sirikata/core/transfer/TransferData.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace Sirikata {
+namespace Transfer {
+
+/** BlobStore is an on-disk store for cached file data, keyed by fingerprint.
+ *  All the data is kept in a single append-only data file which is memory
+ *  mapped, so reads return DenseData views of the mapping instead of copies.
+ *  A binary index file records where each piece of each file is stored and
+ *  is replayed when the store is opened.
+ *
+ *  Index records are buffered and written in batches, by sync() or once
+ *  enough are pending, so a burst of puts costs a single data sync. Data is
+ *  synced before the index records referring to it are written, and each
+ *  record is checksummed, so after a crash a torn record or one referring to
+ *  data past the end of the data file marks the end of the valid index, and
+ *  at worst the puts since the last batch are lost. Removals only append a
+ *  record, so space is reclaimed by compact(), which writes the live data to
+ *  a new generation of files and switches to it by renaming the new index
+ *  into place.
+ *
+ *  All methods are thread safe.
+ */
+class SIRIKATA_EXPORT BlobStore : Noncopyable {
+public:
+    /// Data for a file found when opening the store
+    struct Entry {
+        Fingerprint id;
+        // Parts of the file which are stored
+        RangeList ranges;
+        // Bytes used in the data file
+        cache_usize_type size;
+    };
+
+    enum {
+        // Don't bother compacting data files smaller than this
+        MinCompactBytes = 16*1024*1024,
+        // Write the index once this many records are waiting
+        MaxPendingRecords = 256
+    };
+
+    /** \param dir directory to keep the store in, created if necessary */
+    BlobStore(const String& dir);
+    ~BlobStore();
+
+    /** Open the store, creating it if it doesn't exist yet.
+     *  \param entries if non-NULL, filled in with the data in the store
+     *  \returns false if the store couldn't be opened
+     */
+    bool open(std::vector<Entry>* entries);
+
+    /** Append a piece of a file's data. Stored data it completely covers is
+     *  released. The data can be read back immediately, but only survives
+     *  reopening the store once its index record is written.
+     */
+    bool put(const Fingerprint& id, const DenseData& data);
+    /** Sync the data and write any pending index records, e.g. once a batch
+     *  of puts is done. Also done when the store is destroyed.
+     */
+    void sync();
+    /** Get the stored data overlapping range, adding it to out. When
+     *  possible, these are views of the data file.
+     *  \returns false if range isn't completely stored
+     */
+    bool get(const Fingerprint& id, const Range& range, SparseData* out);
+    /** Release all data for a file. */
+    void remove(const Fingerprint& id);
+
+    /** Rewrite the store with only live data. */
+    bool compact();
+    /** Compact if more than half of a large enough data file is garbage. */
+    bool maybeCompact();
+
+    /// Bytes of data which are still referenced
+    uint64 liveBytes();
+    /// Total size of the data file
+    uint64 totalBytes();
+    /// Incremented with each compaction
+    uint32 generation();
+
+private:
+    struct Chunk {
+        Chunk(const Range& r, uint64 off)
+         : range(r), offset(off)
+        {}
+
+        Range range;
+        uint64 offset;
+    };
+    typedef std::vector<Chunk> ChunkList;
+    typedef std::tr1::unordered_map<Fingerprint, ChunkList, Fingerprint::Hasher> ChunkMap;
+
+    // A put or remove made while a compaction was copying data
+    struct Change {
+        Change(const Fingerprint& i, const Chunk& c, bool rem)
+         : id(i), chunk(c), removed(rem)
+        {}
+
+        Fingerprint id;
+        Chunk chunk;
+        bool removed;
+    };
+
+    class Mapping;
+    typedef std::tr1::shared_ptr<Mapping> MappingPtr;
+
+    String dataPath(uint32 gen) const;
+    String indexPath(uint32 gen) const;
+
+    // These assume mMutex is held
+    bool openGeneration(uint32 gen);
+    void closeFiles();
+    void replayIndex();
+    bool appendRecord(uint8 type, const Fingerprint& id, const Chunk& chunk);
+    bool flushIndex();
+    void addChunk(const Fingerprint& id, const Chunk& chunk);
+    void removeChunks(const Fingerprint& id);
+    MappingPtr mappingCovering(uint64 end);
+    // Releases lck while copying the live data
+    bool compactLocked(boost::unique_lock<boost::mutex>& lck);
+
+    const String mDir;
+    boost::mutex mMutex;
+
+    bool mOpen;
+    uint32 mGeneration;
+    int mDataFD;
+    int mIndexFD;
+    uint64 mDataSize;
+    uint64 mIndexSize;
+    uint64 mLiveBytes;
+    // Encoded index records which haven't been written yet
+    std::vector<unsigned char> mPendingRecords;
+    // Whether everything appended to the data file has been synced
+    bool mDataSynced;
+
+    ChunkMap mChunks;
+    // Set while a compaction copies data without holding mMutex. Changes
+    // made in the meantime are recorded to be added to the new generation.
+    bool mCompacting;
+    std::vector<Change> mCompactChanges;
+    // Mapping of the data file, replaced when the file grows past it. Views
+    // hold on to the mapping they were created from.
+    MappingPtr mMapping;
+}; // class BlobStore
+
+} // namespace Transfer
+} // namespace Sirikata
+
+#endif //_SIRIKATA_CORE_TRANSFER_BLOB_STORE_HPP_
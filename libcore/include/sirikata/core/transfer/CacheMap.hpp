@@ -38,6 +38,7 @@
 #include "CacheLayer.hpp"
 #include <boost/thread.hpp>
 #include <boost/thread/shared_mutex.hpp>
+#include <algorithm>
 
 namespace Sirikata {
 namespace Transfer {
@@ -45,6 +46,11 @@ namespace Transfer {
 /**
  * Handles locking, and also stores a map that can be used
  * both by the CachePolicy, and by the CacheLayer.
+ *
+ * The map is split into shards by Fingerprint, each with its own lock, so
+ * readers only contend with a writer touching the same shard.  Writers are
+ * serialized by a separate lock since the CachePolicy's bookkeeping is shared
+ * by all shards; only CachePolicy::use() is called without it.
  */
 class CacheMap : Noncopyable {
 public:
@@ -58,8 +64,13 @@ private:
 	typedef std::pair<CacheData, std::pair<PolicyData, cache_usize_type> > MapEntry;
 	typedef std::map<Fingerprint, MapEntry> MapClass;
 
-	MapClass mMap;
-	boost::shared_mutex mMapLock;
+	struct Shard {
+		MapClass mMap;
+		boost::shared_mutex mLock;
+	};
+
+	std::vector<Shard*> mShards;
+	boost::mutex mWriteLock;
 
 	CacheLayer *mOwner;
 	CachePolicy *mPolicy;
@@ -68,22 +79,47 @@ private:
 		mOwner->destroyCacheEntry(id, data, size);
 	}
 
+	inline size_t shardIndex(const Fingerprint &id) const {
+		// Digests are uniformly distributed, so a couple of bytes are
+		// enough to pick a shard.
+		const Fingerprint::Digest &digest = id.rawData();
+		return (digest[Fingerprint::static_size-1] | (digest[Fingerprint::static_size-2] << 8)) % mShards.size();
+	}
+
+	/// Orders victims so that each shard is locked once per batch.
+	struct ShardOrder {
+		const CacheMap *mCachemap;
+		ShardOrder(const CacheMap *m) : mCachemap(m) {}
+		bool operator() (const Fingerprint &a, const Fingerprint &b) const {
+			return mCachemap->shardIndex(a) < mCachemap->shardIndex(b);
+		}
+	};
+
 public:
-	CacheMap(CacheLayer *owner, CachePolicy *policy) :
+	CacheMap(CacheLayer *owner, CachePolicy *policy, uint32 numShards = 16) :
 		mOwner(owner), mPolicy(policy) {
+		for (uint32 i = 0; i < std::max(numShards, (uint32)1); ++i) {
+			mShards.push_back(new Shard());
+		}
 	}
     void setOwner(CacheLayer *owner) {//if you can't afford to initialize in initializer list
         mOwner=owner;
     }
 
 	~CacheMap() {
-		write_iterator clearIterator(*this);
-		clearIterator.eraseAll();
+		{
+			write_iterator clearIterator(*this);
+			clearIterator.eraseAll();
+		}
+		for (size_t i = 0; i < mShards.size(); ++i) {
+			delete mShards[i];
+		}
 	}
 
 	/**
 	 * Allocates the requested number of bytes, and erases the
-	 * appropriate set of entries using CachePolicy::allocateSpace().
+	 * appropriate set of entries using CachePolicy::nextItems().
+	 * Victims are erased in batches, grouped by shard.
 	 *
 	 * @param required  The space required for the new entry.
          * @param writer    Write iterator used to process deletions.
@@ -95,10 +131,21 @@ public:
 		if (!cachable) {
 			return false;
 		}
-		Fingerprint toDelete;
-		while (mPolicy->nextItem(required, toDelete)) {
-			writer.find(toDelete);
-			writer.erase();
+		std::vector<Fingerprint> toDelete;
+		while (mPolicy->nextItems(required, toDelete)) {
+			std::sort(toDelete.begin(), toDelete.end(), ShardOrder(this));
+			size_t erased = 0;
+			for (std::vector<Fingerprint>::iterator iter = toDelete.begin(); iter != toDelete.end(); ++iter) {
+				if (writer.find(*iter)) {
+					writer.erase();
+					++erased;
+				}
+			}
+			toDelete.clear();
+			if (!erased) {
+				// The policy is out of sync with the map; don't spin.
+				break;
+			}
 		}
 		return true;
 	}
@@ -106,36 +153,56 @@ public:
 	/**
 	 * A read-only iterator.  Not const because the LRU use-count
 	 * is allowed to be updated, even though the CacheLayer cannot
-	 * be changed.  A read_iterator locks the map using a
-	 * boost::shared_lock.  This means that any number of read_iterator
-	 * objects are allowed access at the same time, except when
-	 * a write_iterator is in use.
+	 * be changed.  A read_iterator holds a boost::shared_lock on the
+	 * shard it currently points into.  This means that any number of
+	 * read_iterator objects are allowed access at the same time, except
+	 * to a shard a write_iterator is using.
 	 */
 	class read_iterator {
 		CacheMap *mCachemap;
 		boost::shared_lock<boost::shared_mutex> mLock;
 
+		size_t mShardIndex;
 		MapClass *mMap;
 		MapClass::iterator mIter;
 
+		void lockShard(size_t index) {
+			if (mMap && index == mShardIndex) {
+				return;
+			}
+			if (mLock.owns_lock()) {
+				mLock.unlock();
+			}
+			Shard *shard = mCachemap->mShards[index];
+			boost::shared_lock<boost::shared_mutex> lock(shard->mLock);
+			mLock.swap(lock);
+			mShardIndex = index;
+			mMap = &shard->mMap;
+		}
+
 	public:
-		/// Construct from a CacheMap (contains a scoped read lock)
+		/// Construct from a CacheMap (locks a shard on the first find)
 		read_iterator(CacheMap &m)
-			: mCachemap(&m), mLock(m.mMapLock),
-			mMap(&m.mMap), mIter(m.mMap.end()) {
+			: mCachemap(&m), mShardIndex(0), mMap(NULL) {
 		}
 
 		/// @returns   if this iterator can be dereferenced.
 		inline operator bool () const{
-			return (mIter != mMap->end());
+			return mMap && (mIter != mMap->end());
 		}
 
+		/// Moves through every shard in turn, locking each as it goes.
 		inline bool iterate () {
-			if (mIter == mMap->end()) {
+			if (!*this) {
+				lockShard(0);
 				mIter = mMap->begin();
 			} else {
 				++mIter;
 			}
+			while (mIter == mMap->end() && mShardIndex + 1 < mCachemap->mShards.size()) {
+				lockShard(mShardIndex + 1);
+				mIter = mMap->begin();
+			}
 			return (mIter != mMap->end());
 		}
 
@@ -144,6 +211,7 @@ public:
 		 * @returns   if the find was successful.
 		 */
 		inline bool find(const Fingerprint &id) {
+			lockShard(mCachemap->shardIndex(id));
 			mIter = mMap->find(id);
 			return (bool)*this;
 		}
@@ -177,28 +245,45 @@ public:
 	/**
 	 * A read-write iterator.  Also contains insert() and erase()
 	 * functions which also interact with the appropriate CachePolicy.
-	 * The write_iterator aassumes exclusive ownership of the map.
+	 * Only one write_iterator exists at a time, and it holds an
+	 * exclusive lock on the shard it currently points into.
 	 * Since creating two write_iterators at once causes deadlock,
 	 * make sure to call the alloc() function that takes a write_iterator
 	 * argument if you already own one.
 	 */
 	class write_iterator : Noncopyable {
 		CacheMap *mCachemap;
+		boost::unique_lock<boost::mutex> mWriteLock;
 		boost::unique_lock<boost::shared_mutex> mLock;
 
+		size_t mShardIndex;
 		MapClass *mMap;
 		MapClass::iterator mIter;
 
+		void lockShard(size_t index) {
+			if (mMap && index == mShardIndex) {
+				return;
+			}
+			if (mLock.owns_lock()) {
+				mLock.unlock();
+			}
+			Shard *shard = mCachemap->mShards[index];
+			boost::unique_lock<boost::shared_mutex> lock(shard->mLock);
+			mLock.swap(lock);
+			mShardIndex = index;
+			mMap = &shard->mMap;
+		}
+
 	public:
-		/// Construct from a CacheMap (contains a scoped write lock)
+		/// Construct from a CacheMap (contains a scoped writer lock)
 		write_iterator(CacheMap &m)
-			: mCachemap(&m), mLock(m.mMapLock),
-			mMap(&m.mMap), mIter(m.mMap.end()) {
+			: mCachemap(&m), mWriteLock(m.mWriteLock),
+			mShardIndex(0), mMap(NULL) {
 		}
 
 		/// @returns   if this iterator can be dereferenced.
 		inline operator bool () const{
-			return (mIter != mMap->end());
+			return mMap && (mIter != mMap->end());
 		}
 
 		/** Moves this iterator to id.
@@ -206,6 +291,7 @@ public:
 		 * @returns   if the find was successful.
 		 */
 		bool find(const Fingerprint &id) {
+			lockShard(mCachemap->shardIndex(id));
 			mIter = mMap->find(id);
 			return (bool)*this;
 		}
@@ -252,7 +338,7 @@ public:
 		 * Erases the current iterator.  Note that this iterator is
 		 * invalidated at the point you erase it.
 		 *
-s		 * Also, calls CachePolicy::destroy() and CacheInfo::destroy()
+		 * Also, calls CachePolicy::destroy() and CacheInfo::destroy()
 		 */
 		void erase() {
 			mCachemap->mPolicy->destroy(getId(), getPolicyInfo(), getSize());
@@ -265,12 +351,15 @@ s		 * Also, calls CachePolicy::destroy() and CacheInfo::destroy()
 		 * write_iterator contains no iterate() method because it is generally not safe.
 		 */
 		void eraseAll() {
-			for (mIter = mMap->begin(); mIter != mMap->end(); ++mIter) {
-				mCachemap->mPolicy->destroy(getId(), getPolicyInfo(), getSize());
-				mCachemap->destroyCacheLayerEntry(getId(), (**this), getSize());
+			for (size_t i = 0; i < mCachemap->mShards.size(); ++i) {
+				lockShard(i);
+				for (mIter = mMap->begin(); mIter != mMap->end(); ++mIter) {
+					mCachemap->mPolicy->destroy(getId(), getPolicyInfo(), getSize());
+					mCachemap->destroyCacheLayerEntry(getId(), (**this), getSize());
+				}
+				mMap->clear();
+				mIter = mMap->end();
 			}
-			mMap->clear();
-			mIter = mMap->end();
 		}
 
 		/**
@@ -286,6 +375,7 @@ s		 * Also, calls CachePolicy::destroy() and CacheInfo::destroy()
 		 * @returns       If this element was actually inserted.
 		 */
 		bool insert(const Fingerprint &id, cache_usize_type size) {
+			lockShard(mCachemap->shardIndex(id));
 			std::pair<MapClass::iterator, bool> ins=
 				mMap->insert(MapClass::value_type(id,
 						MapEntry(CacheData(), std::pair<PolicyData, cache_usize_type>(PolicyData(), size))));
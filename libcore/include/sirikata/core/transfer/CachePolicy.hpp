@@ -144,6 +144,25 @@ public:
 	}
 
 	virtual bool nextItem(cache_usize_type requiredSpace, Fingerprint &myprint) = 0;
+
+	/**
+	 *  Picks a batch of entries to free so that requiredSpace is available.
+	 *  All of them must be destroyed before this is called again.  Policies
+	 *  which can choose several victims in one pass should override this;
+	 *  by default it returns the single entry from nextItem().
+	 *
+	 *  @param requiredSpace  the amount of space the new entry needs
+	 *  @param victims        filled in with the entries to free
+	 *  @returns              whether any entries need to be freed
+	 */
+	virtual bool nextItems(cache_usize_type requiredSpace, std::vector<Fingerprint> &victims) {
+		Fingerprint victim;
+		if (!nextItem(requiredSpace, victim)) {
+			return false;
+		}
+		victims.push_back(victim);
+		return true;
+	}
 };
 
 
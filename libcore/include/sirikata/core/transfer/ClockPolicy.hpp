@@ -0,0 +1,149 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_CORE_TRANSFER_CLOCK_POLICY_HPP_
+#define _SIRIKATA_CORE_TRANSFER_CLOCK_POLICY_HPP_
+
+#include <sirikata/core/transfer/CachePolicy.hpp>
+#include <sirikata/core/util/AtomicTypes.hpp>
+
+namespace Sirikata {
+namespace Transfer {
+
+/** Approximate LRU policy using CLOCK (second chance). Entries sit in a ring
+ *  which a hand sweeps when space is needed, clearing reference bits and
+ *  evicting entries whose bit was already clear. use() only sets the
+ *  entry's reference bit, so it may be called concurrently by any number of
+ *  CacheMap readers. All other methods change the ring and must be
+ *  serialized, which CacheMap does by only calling them from a
+ *  write_iterator.
+ *
+ *  When eviction is needed, nextItems() picks enough victims to free an
+ *  extra batchPct of the total space, so a full cache doesn't have to evict
+ *  on every insertion.
+ */
+class ClockPolicy : public CachePolicy {
+    struct ClockData;
+    typedef std::list<ClockData*> ClockRing;
+
+    struct ClockData : public Data {
+        ClockData(const Fingerprint& id_, cache_usize_type size_)
+         : id(id_),
+           size(size_),
+           referenced(0),
+           evicting(false)
+        {}
+
+        Fingerprint id;
+        cache_usize_type size;
+        ClockRing::iterator iter;
+        AtomicValue<uint32> referenced;
+        bool evicting; // Already returned by nextItems()
+    };
+
+    ClockRing mRing;
+    ClockRing::iterator mHand;
+    float mBatchPct;
+
+    // Advances the hand to the next entry which should be evicted, giving
+    // referenced entries a second chance. Returns NULL if nothing could be
+    // found after two full sweeps.
+    ClockData* advance() {
+        size_t limit = 2 * mRing.size();
+        for(size_t steps = 0; steps < limit; steps++) {
+            if (mHand == mRing.end())
+                mHand = mRing.begin();
+            ClockData* data = *mHand;
+            ++mHand;
+            if (data->evicting)
+                continue;
+            if (data->referenced.read() != 0) {
+                data->referenced = 0;
+                continue;
+            }
+            return data;
+        }
+        return NULL;
+    }
+
+public:
+    ClockPolicy(cache_usize_type allocatedSpace, float maxSizePct=0.5, float batchPct=0.05)
+     : CachePolicy(allocatedSpace, maxSizePct),
+       mHand(mRing.end()),
+       mBatchPct(batchPct)
+    {}
+
+    virtual ~ClockPolicy() {
+        for(ClockRing::iterator it = mRing.begin(); it != mRing.end(); it++)
+            delete *it;
+    }
+
+    virtual void use(const Fingerprint &id, Data* data, cache_usize_type size) {
+        // Only write if needed so hot entries don't bounce between caches
+        ClockData* clockdata = static_cast<ClockData*>(data);
+        if (clockdata->referenced.read() == 0)
+            clockdata->referenced = 1;
+    }
+
+    virtual void useAndUpdate(const Fingerprint &id, Data* data, cache_usize_type oldsize, cache_usize_type newsize) {
+        ClockData* clockdata = static_cast<ClockData*>(data);
+        clockdata->referenced = 1;
+        clockdata->size = newsize;
+        CachePolicy::updateSpace(oldsize, newsize);
+    }
+
+    virtual void destroy(const Fingerprint &id, Data* data, cache_usize_type size) {
+        ClockData* clockdata = static_cast<ClockData*>(data);
+
+        CachePolicy::updateSpace(size, 0);
+
+        SILOG(clockpolicy,detailed,"Freeing " << id << " (" << size << " bytes); " << mFreeSpace << " free");
+        if (mHand == clockdata->iter)
+            ++mHand;
+        mRing.erase(clockdata->iter);
+        delete clockdata;
+    }
+
+    virtual Data* create(const Fingerprint &id, cache_usize_type size) {
+        CachePolicy::updateSpace(0, size);
+
+        // New entries go just behind the hand so they are the last to be
+        // considered on this sweep.
+        ClockData* clockdata = new ClockData(id, size);
+        clockdata->iter = mRing.insert(mHand, clockdata);
+        return clockdata;
+    }
+
+    virtual bool nextItem(cache_usize_type requiredSpace, Fingerprint &myprint) {
+        if (mFreeSpace >= (cache_ssize_type)requiredSpace || mRing.empty())
+            return false;
+        ClockData* victim = advance();
+        if (victim == NULL)
+            return false;
+        myprint = victim->id;
+        return true;
+    }
+
+    virtual bool nextItems(cache_usize_type requiredSpace, std::vector<Fingerprint> &victims) {
+        if (mFreeSpace >= (cache_ssize_type)requiredSpace || mRing.empty())
+            return false;
+
+        cache_ssize_type target = (cache_ssize_type)requiredSpace + (cache_ssize_type)(mTotalSize * mBatchPct);
+        cache_ssize_type freed = mFreeSpace;
+        while(freed < target) {
+            ClockData* victim = advance();
+            if (victim == NULL)
+                break;
+            victim->evicting = true;
+            victims.push_back(victim->id);
+            freed += victim->size;
+        }
+        return !victims.empty();
+    }
+}; // class ClockPolicy
+
+} // namespace Transfer
+} // namespace Sirikata
+
+#endif //_SIRIKATA_CORE_TRANSFER_CLOCK_POLICY_HPP_
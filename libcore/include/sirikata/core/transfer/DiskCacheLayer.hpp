@@ -34,22 +34,20 @@
 #ifndef SIRIKATA_DiskCacheLayer_HPP__
 #define SIRIKATA_DiskCacheLayer_HPP__
 
-#include <sys/stat.h>
-#include <sys/types.h>
-
 #include <sirikata/core/transfer/CacheLayer.hpp>
 #include <sirikata/core/transfer/CacheMap.hpp>
+#include <sirikata/core/transfer/BlobStore.hpp>
 #include <sirikata/core/queue/ThreadSafeQueue.hpp>
 #include <sirikata/core/util/Thread.hpp>
+#include <sirikata/core/util/AtomicTypes.hpp>
 
 namespace Sirikata {
 namespace Transfer {
 
-// should really be a config option.
-//#define NUM_WORKER_THREADS 10
-
-
-/// Disk Cache keeps track of what files are on disk, and manages a helper thread to retrieve it.
+/** Disk Cache keeps track of what files are on disk, and manages a pool of
+ *  helper threads to retrieve them. Data is kept in a BlobStore, so reads
+ *  return views of the memory mapped store rather than copies.
+ */
 class SIRIKATA_EXPORT DiskCacheLayer : public CacheLayer {
 public:
 	struct CacheData : public CacheEntry {
@@ -65,19 +63,23 @@ public:
 		}
 	};
 
+	enum {
+		DefaultWorkerThreads = 4
+	};
+
 private:
 
 	struct DiskRequest;
-	ThreadSafeQueue<std::tr1::shared_ptr<DiskRequest> > mRequestQueue; // must be initialized before the thread.
-	Thread *mWorkerThread;
+	ThreadSafeQueue<std::tr1::shared_ptr<DiskRequest> > mRequestQueue; // must be initialized before the threads.
+	std::vector<Thread*> mWorkerThreads;
 
 	CacheMap mFiles;
 
-
-	std::string mPrefix; // directory or prefix name with trailing slash.
+	std::string mPrefix; // directory holding the store.
+	BlobStore mStore;
 
 	struct DiskRequest {
-		enum Operation {OPREAD, OPWRITE, OPDELETE, OPEXIT} op;
+		enum Operation {OPREAD, OPWRITE, OPCOMPACT, OPEXIT} op;
 
 		DiskRequest(Operation op, const Fingerprint &id, const Range &myRange)
 			:op(op), fileId(id), toRead(myRange) {}
@@ -89,9 +91,9 @@ private:
 
 	};
 
-	boost::mutex destroyLock;
-	boost::condition_variable destroyCV;
 	bool mCleaningUp; // do not delete any files.
+	// Evictions since an OPCOMPACT was queued, so a burst only queues one.
+	AtomicValue<uint32> mCompactsPending;
 
 public:
 	void workerThread(); // defined in DiskCache.cpp
@@ -107,43 +109,6 @@ public:
 		mRequestQueue.push(req);
 	}
 
-	void serializeRanges(const RangeList &list, std::string &out) {
-		std::ostringstream outs;
-
-		for (RangeList::const_iterator liter = list.begin(); liter != list.end(); ++liter) {
-			cache_ssize_type len = (cache_ssize_type)((*liter).length());
-			if ((*liter).goesToEndOfFile()) {
-				len = -len;
-			}
-			outs << (*liter).startbyte() << " " << len << "; ";
-		}
-		out = outs.str();
-	}
-
-	void unserializeRanges(RangeList &rlist, std::istream &iranges) {
-		while (iranges.good()) {
-			Range::base_type start = 0;
-			cache_ssize_type length = 0;
-			bool toEndOfFile = false;
-			iranges >> start >> length;
-
-			if (length == 0) {
-				continue;
-			}
-			if (length < 0) {
-				length = -length;
-				toEndOfFile = true;
-			}
-
-			Range toAdd (start, length, LENGTH, toEndOfFile);
-
-			toAdd.addToList(toAdd, rlist);
-
-			char c;
-			iranges >> c;
-		}
-	}
-
 protected:
 	virtual void populateCache(const Fingerprint& fileId, const DenseDataPtr &data) {
 		std::tr1::shared_ptr<DiskRequest> req (
@@ -158,10 +123,15 @@ protected:
 	virtual void destroyCacheEntry(const Fingerprint &fileId, CacheEntry *cacheLayerData, cache_usize_type releaseSize) {
 		if (!mCleaningUp) {
 			// don't want to erase the disk cache when exiting the program.
-			std::string fileName = fileId.convertToHexString();
-			std::tr1::shared_ptr<DiskRequest> req
-                            (new DiskRequest(DiskRequest::OPDELETE, fileId, Range(true)));
-                        mRequestQueue.push(req);
+			// Removal only appends to the index, so do it immediately to
+			// keep it ordered with writes, but leave reclaiming the space
+			// to the workers.
+			mStore.remove(fileId);
+			if (++mCompactsPending == 1) {
+				std::tr1::shared_ptr<DiskRequest> req
+					(new DiskRequest(DiskRequest::OPCOMPACT, fileId, Range(true)));
+				mRequestQueue.push(req);
+			}
 		}
 		CacheData *toDelete = static_cast<CacheData*>(cacheLayerData);
 		delete toDelete;
@@ -169,17 +139,21 @@ protected:
 
 public:
 
-	DiskCacheLayer(CachePolicy *policy, const std::string &prefix, CacheLayer *tryNext);
+	DiskCacheLayer(CachePolicy *policy, const std::string &prefix, CacheLayer *tryNext, uint32 numThreads = DefaultWorkerThreads);
 
 	virtual ~DiskCacheLayer() {
-		std::tr1::shared_ptr<DiskRequest> req
-			(new DiskRequest(DiskRequest::OPEXIT, Fingerprint(), Range(true)));
-		boost::unique_lock<boost::mutex> sleep_cv(destroyLock);
-		mRequestQueue.push(req);
-		destroyCV.wait(sleep_cv); // we know the thread has terminated.
+		for (size_t i = 0; i < mWorkerThreads.size(); i++) {
+			std::tr1::shared_ptr<DiskRequest> req
+				(new DiskRequest(DiskRequest::OPEXIT, Fingerprint(), Range(true)));
+			mRequestQueue.push(req);
+		}
+		for (size_t i = 0; i < mWorkerThreads.size(); i++) {
+			mWorkerThreads[i]->join();
+			delete mWorkerThreads[i];
+		}
+		mWorkerThreads.clear();
 
 		mCleaningUp = true; // don't allow destroyCacheEntry to delete files.
-		delete mWorkerThread;
 	}
 
 	virtual void purgeFromCache(const Fingerprint &fileId) {
@@ -46,9 +46,8 @@
 #ifdef check
 #undef check
 #endif
-#include <boost/iostreams/filtering_streambuf.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
-#include <boost/iostreams/copy.hpp>
 #include <sirikata/core/network/IOServicePool.hpp>
 #include <sirikata/core/network/IOWork.hpp>
 #include <sirikata/core/network/Asio.hpp>
@@ -162,10 +161,11 @@ public:
         LAST_HEADER_CB mLastCallback;
         bool mHeaderComplete;
         bool mMessageComplete;
-        http_parser_settings mHttpSettings;
-        http_parser mHttpParser;
-        bool mGzip;
-        std::stringstream mCompressedStream;
+        // Whether the connection can be reused after this response
+        bool mKeepAlive;
+        // Set for gzip encoded responses, decompresses into mData as the body
+        // arrives
+        std::tr1::shared_ptr<boost::iostreams::filtering_ostream> mDecompressor;
         //
 
         Headers mHeaders;
@@ -180,7 +180,7 @@ public:
 
         HttpResponse()
             : mLastCallback(NONE), mHeaderComplete(false), mMessageComplete(false),
-              mGzip(false), mContentLength(0), mStatusCode(0),
+              mKeepAlive(false), mContentLength(0), mStatusCode(0),
               mBytesSent(0), mBytesReceived(0)
         {}
     public:
@@ -236,6 +236,10 @@ public:
      *  level version exposed publicly, taking a raw HTTP request, which you
      *  should ensure is properly formatted. Usually you should use the
      *  convenience wrappers that format the request for you.
+     *
+     *  GET and HEAD requests identical to one that is already in flight are
+     *  coalesced with it: only one request is made and every callback gets
+     *  the same HttpResponse, so callbacks shouldn't modify it.
      */
     void makeRequest(Sirikata::Network::Address addr, HTTP_METHOD method, std::string req, bool allow_redirects, HttpCallback cb);
 
@@ -343,7 +347,7 @@ private:
         const bool allow_redirects;
         HttpRequest(Sirikata::Network::Address _addr, std::string _req, HTTP_METHOD meth, bool _allow_redirects, HttpCallback _cb)
          : addr(_addr), req(_req), cb(_cb), method(meth), allow_redirects(_allow_redirects),
-           mNumTries(0), mLastCallback(NONE), mHeaderComplete(false) {}
+           mNumTries(0), mLastCallback(NONE), mHeaderComplete(false), mPipelinable(false) {}
 
         friend class HttpManager;
     protected:
@@ -355,10 +359,57 @@ private:
         LAST_HEADER_CB mLastCallback;
         bool mHeaderComplete;
         Headers mHeaders;
+        // Idempotent and doesn't ask the server to close the connection, so
+        // it can be sent before responses to earlier requests arrive
+        bool mPipelinable;
+    };
+    typedef std::tr1::shared_ptr<HttpRequest> HttpRequestPtr;
+
+    /*
+     * An open connection to an endpoint. Requests are written as soon as
+     * they're assigned to the connection, so several GET/HEAD requests can be
+     * outstanding at once, and their responses are parsed in order by a
+     * single parser as data arrives.
+     */
+    class HttpConnection {
+    public:
+        HttpConnection(const Sirikata::Network::Address& _addr, std::tr1::shared_ptr<TCPSocket> _socket)
+         : addr(_addr), socket(_socket), mNumWritten(0), mWriting(false), mReading(false),
+           mCanPipeline(false), mClosed(false), mBuffer(SOCKET_BUFFER_SIZE) {}
+
+        const Sirikata::Network::Address addr;
+        const std::tr1::shared_ptr<TCPSocket> socket;
+
+        friend class HttpManager;
+    protected:
+        // Lock this to access anything below or to start operations on
+        // the socket
+        boost::mutex mMutex;
+        // Requests whose responses haven't been received yet, in the order
+        // they were written
+        std::deque<HttpRequestPtr> mPending;
+        // Number of requests at the front of mPending that have been written
+        // or are being written
+        uint32 mNumWritten;
+        bool mWriting;
+        bool mReading;
+        // Set once the server has sent a persistent HTTP/1.1 response,
+        // after which we trust it to handle pipelined requests
+        bool mCanPipeline;
+        bool mClosed;
+        // Response for mPending.front(), being parsed
+        std::tr1::shared_ptr<HttpResponse> mResponse;
+        // Requests whose responses finished during the current read,
+        // dispatched once the lock is released
+        std::vector<std::pair<HttpRequestPtr, std::tr1::shared_ptr<HttpResponse> > > mFinished;
+        http_parser_settings mHttpSettings;
+        http_parser mHttpParser;
+        std::vector<unsigned char> mBuffer;
     };
+    typedef std::tr1::shared_ptr<HttpConnection> HttpConnectionPtr;
 
     //Holds a queue of requests to be made
-    typedef std::list<std::tr1::shared_ptr<HttpRequest> > RequestQueueType;
+    typedef std::list<HttpRequestPtr> RequestQueueType;
     RequestQueueType mRequestQueue;
     //Lock this to access mRequestQueue
     boost::mutex mRequestQueueLock;
@@ -377,12 +428,25 @@ private:
     //Lock this to access mNumTotalConnections or mNumConnsPerAddr
     boost::mutex mNumConnsLock;
 
-    //Holds connections that are open but not being used
-    typedef std::map<Sirikata::Network::Address,
-        std::queue<std::tr1::shared_ptr<TCPSocket> > > RecycleBinType;
-    RecycleBinType mRecycleBin;
-    //Lock this to access mRecycleBin
-    boost::mutex mRecycleBinLock;
+    //Holds connections that are open, whether or not they're being used
+    typedef std::vector<HttpConnectionPtr> ConnectionList;
+    typedef std::map<Sirikata::Network::Address, ConnectionList> ConnectionsType;
+    ConnectionsType mConnections;
+    //Lock this to access mConnections. If also locking a connection, lock
+    //this first
+    boost::mutex mConnectionsLock;
+
+    //Maximum number of requests outstanding on one connection. 1 disables
+    //pipelining
+    const uint32 mPipelineDepth;
+
+    //Callbacks for GET/HEAD requests in flight, indexed by address and
+    //raw request, so identical requests can share one response
+    const bool mCoalesceRequests;
+    typedef std::map<String, std::vector<HttpCallback> > InFlightType;
+    InFlightType mInFlight;
+    //Lock this to access mInFlight
+    boost::mutex mInFlightLock;
 
     IOServicePool* mServicePool;
     TCPResolver* mResolver;
@@ -391,18 +455,36 @@ private:
 
     void processQueue();
 
-    void add_req(std::tr1::shared_ptr<HttpRequest> req);
+    void add_req(HttpRequestPtr req);
     void decrement_connection(const Sirikata::Network::Address& addr);
-    void write_request(std::tr1::shared_ptr<TCPSocket> socket, std::tr1::shared_ptr<HttpRequest> req);
-
-    void handle_resolve(std::tr1::shared_ptr<HttpRequest> req, const boost::system::error_code& err,
+    void finish_coalesced(const String& key, std::tr1::shared_ptr<HttpResponse> response,
+            ERR_TYPE error, const boost::system::error_code& boost_error);
+
+    // These require the connection's lock
+    bool can_accept(HttpConnectionPtr conn, HttpRequestPtr req);
+    void write_requests(HttpConnectionPtr conn);
+    void read_response(HttpConnectionPtr conn);
+    static void start_response(HttpConnection* conn);
+    // Marks the connection closed and moves its requests to requeue, except
+    // for non-idempotent requests that were already written, which go to
+    // aborted. Returns false if it was already closed, otherwise
+    // close_connection must be called once the lock is released.
+    bool mark_closed(HttpConnectionPtr conn, std::deque<HttpRequestPtr>* requeue, std::deque<HttpRequestPtr>* aborted);
+
+    // Looks for an open connection to send req on. Requires mConnectionsLock
+    bool assign_request(HttpRequestPtr req);
+    // Retries the requests in requeue and fails those in aborted
+    void close_connection(HttpConnectionPtr conn, const std::deque<HttpRequestPtr>& requeue,
+        const std::deque<HttpRequestPtr>& aborted);
+    void finish_request(HttpRequestPtr req, std::tr1::shared_ptr<HttpResponse> respPtr);
+
+    void handle_resolve(HttpRequestPtr req, const boost::system::error_code& err,
             TCPResolver::iterator endpoint_iterator);
-    void handle_connect(std::tr1::shared_ptr<TCPSocket> socket, std::tr1::shared_ptr<HttpRequest> req,
+    void handle_connect(std::tr1::shared_ptr<TCPSocket> socket, HttpRequestPtr req,
             const boost::system::error_code& err, TCPResolver::iterator endpoint_iterator);
-    void handle_write_request(std::tr1::shared_ptr<TCPSocket> socket, std::tr1::shared_ptr<HttpRequest> req,
+    void handle_write_request(HttpConnectionPtr conn,
             const boost::system::error_code& err, std::tr1::shared_ptr<boost::asio::streambuf> request_stream);
-    void handle_read(std::tr1::shared_ptr<TCPSocket> socket, std::tr1::shared_ptr<HttpRequest> req,
-            std::tr1::shared_ptr<std::vector<unsigned char> > vecbuf, std::tr1::shared_ptr<HttpResponse> respPtr,
+    void handle_read(HttpConnectionPtr conn,
             const boost::system::error_code& err, std::size_t bytes_transferred);
 
     static int on_header_field(http_parser *_, const char *at, size_t len);
@@ -424,7 +506,8 @@ private:
       , F_SKIPBODY = 1 << 5
       };
 
-    static void print_flags(std::tr1::shared_ptr<HttpResponse> resp);
+    static bool should_keep_alive(http_parser* parser);
+    static void print_flags(http_parser* parser, std::tr1::shared_ptr<HttpResponse> resp);
 
 public:
 
@@ -35,11 +35,14 @@
 #define SIRIKATA_LRUPolicy_HPP__
 
 #include "CachePolicy.hpp"
+#include <boost/thread/mutex.hpp>
 
 namespace Sirikata {
 namespace Transfer {
 
 /// Simple LRU policy--does not do any ordering by size.
+/// use() may be called by concurrent CacheMap readers, so the list is locked;
+/// see ClockPolicy for a policy where readers don't contend.
 class LRUPolicy : public CachePolicy {
 
 	typedef Fingerprint LRUElement;
@@ -54,6 +57,7 @@ class LRUPolicy : public CachePolicy {
 	};
 
 	LRUList mLeastUsed;
+	boost::mutex mLock;
 	// std::list<Fingerprint>::const_iterator
 
 public:
@@ -64,6 +68,7 @@ public:
 	virtual void use(const Fingerprint &id, Data* data, cache_usize_type size) {
 		LRUData *lrudata = static_cast<LRUData*>(data);
 
+		boost::mutex::scoped_lock lck(mLock);
 		// "All iterators remain valid"
 		mLeastUsed.splice(mLeastUsed.end(), mLeastUsed, lrudata->mIter);
 	}
@@ -79,6 +84,7 @@ public:
 		CachePolicy::updateSpace(size, 0);
 
 		SILOG(lrupolicy,detailed,"Freeing " << id << " (" << size << " bytes); " << mFreeSpace << " free");
+		boost::mutex::scoped_lock lck(mLock);
 		mLeastUsed.erase(lrudata->mIter);
 		delete lrudata;
 	}
@@ -86,6 +92,7 @@ public:
 	virtual Data* create(const Fingerprint &id, cache_usize_type size) {
 		CachePolicy::updateSpace(0, size);
 
+		boost::mutex::scoped_lock lck(mLock);
 		mLeastUsed.push_back(id);
 		LRUList::iterator newIter = mLeastUsed.end();
 		--newIter; // I wish push_back returned an iterator
@@ -97,6 +104,7 @@ public:
 			cache_usize_type requiredSpace,
 			Fingerprint &myprint)
 	{
+		boost::mutex::scoped_lock lck(mLock);
 		if (mFreeSpace < (cache_ssize_type)requiredSpace && !mLeastUsed.empty()) {
 
 			myprint = mLeastUsed.front();
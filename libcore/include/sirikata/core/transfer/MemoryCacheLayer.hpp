@@ -119,6 +119,7 @@ public:
 				if (sparseData.contains(requestedRange)) {
 					haveData = true;
 					foundData = sparseData;
+					iter.use();
 				}
 			}
 		}
@@ -43,40 +43,64 @@ namespace Transfer {
 /// Represents a single block of data, and also knows the range of the file it came from.
 class DenseData : Noncopyable, public Range {
 	std::vector<unsigned char> mData;
+	// If non-NULL, the data is a read-only view of memory kept alive by
+	// mViewOwner, e.g. a memory mapped file, and mData is unused.
+	const unsigned char *mView;
+	std::tr1::shared_ptr<const void> mViewOwner;
+
+	// Copies a view into mData so it can be modified.
+	void unview() {
+		if (mView == NULL) return;
+		mData.assign(mView, mView + (size_t)length());
+		mView = NULL;
+		mViewOwner.reset();
+	}
 
     // All too easy to mix up string constructors (binarydata,length) with (string,startbyte)
-	DenseData(const char *str, size_t len) : Range(false) {}
-	DenseData(const unsigned char *str, size_t len) : Range(false) {}
+	DenseData(const char *str, size_t len) : Range(false), mView(NULL) {}
+	DenseData(const unsigned char *str, size_t len) : Range(false), mView(NULL) {}
 
 public:
 	DenseData(const Range &range)
-			:Range(range) {
+			:Range(range), mView(NULL) {
 		if (range.length()) {
 			mData.resize((std::vector<unsigned char>::size_type)range.length());
 		}
 	}
 
 	DenseData(const std::string &str, Range::base_type start=0, bool wholeFile=true)
-			:Range(start, str.length(), LENGTH, wholeFile) {
+			:Range(start, str.length(), LENGTH, wholeFile), mView(NULL) {
 		setLength(str.length(), wholeFile);
 		std::copy(str.begin(), str.end(), writableData());
 	}
 
 	DenseData(const Range& range, const char* str)
-        : Range(range), mData(str, str+range.length()) {
+        : Range(range), mData(str, str+range.length()), mView(NULL) {
 	    if(range.length() == 0)
 	        throw std::invalid_argument("Tried to create DenseData with length of 0");
 	}
 
 	DenseData(const Range& range, const std::vector<unsigned char>& data)
-        : Range(range), mData(data) {
+        : Range(range), mData(data), mView(NULL) {
 	    if(range.length() != data.size()) {
 	        throw std::invalid_argument("Tried to create DenseData with vector length not equal to Range");
 	    }
 	}
 
+	/** Wraps length() bytes of existing memory without copying them. owner
+	 * keeps the memory alive for as long as this DenseData exists. Views are
+	 * copied into a private buffer if they're modified.
+	 */
+	DenseData(const Range& range, const unsigned char* view, const std::tr1::shared_ptr<const void>& owner)
+        : Range(range), mView(view), mViewOwner(owner) {
+	    if(range.length() == 0)
+	        throw std::invalid_argument("Tried to create DenseData view with length of 0");
+	}
+
 	/// equals dataAt(startbyte()).
 	inline const unsigned char *data() const {
+	    if (mView != NULL)
+	        return mView;
 	    if(mData.size() == 0)
 	        throw std::length_error("Tried to get a const pointer to DenseData with 0 length");
 		return &(mData[0]);
@@ -92,6 +116,7 @@ public:
 
 	/// Returns a non-const data, starting at startbyte().
 	inline unsigned char *writableData() {
+	    unview();
 	    if(mData.size() == 0)
 	        throw std::length_error("Tried to get a writable pointer to DenseData with 0 length");
 		return &(mData[0]);
@@ -104,6 +129,8 @@ public:
 	inline const unsigned char *dataAt(base_type offset) const {
 		if (offset > endbyte() || offset < startbyte())
 		    return NULL;
+		if (mView != NULL)
+		    return mView + (size_t)(offset-startbyte());
 		return &(mData[(std::vector<unsigned char>::size_type)(offset-startbyte())]);
 	}
 
@@ -113,6 +140,7 @@ public:
 
 	/// Sets the length of the range, as well as allocates more space in the data vector.
 	inline void setLength(size_t len, bool is_npos) {
+		unview();
 		Range::setLength(len, is_npos);
 		mData.resize(len);
 	}
@@ -120,6 +148,7 @@ public:
 	//Appends len bytes from data to internal data vector and adds to length of range
 	inline void append(const char* data, size_t len, bool is_npos) {
 	    if(len <= 0) return;
+	    unview();
 	    size_t prev_end = length();
 	    Range::setLength(prev_end + len, is_npos);
 	    mData.resize(prev_end + len, 0);
@@ -140,6 +169,7 @@ public:
 	       return;
 	   }
 
+	   unview();
 	   Range::setLength(length() + (end-begin), is_npos);
 	   mData.insert(mData.end(), begin, end);
 	}
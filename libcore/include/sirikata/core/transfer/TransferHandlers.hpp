@@ -39,6 +39,7 @@
 #include <sirikata/core/transfer/DiskCacheLayer.hpp>
 #include <sirikata/core/transfer/MemoryCacheLayer.hpp>
 #include <sirikata/core/transfer/LRUPolicy.hpp>
+#include <sirikata/core/transfer/ClockPolicy.hpp>
 #include <sirikata/core/transfer/TransferRequest.hpp>
 
 namespace Sirikata {
@@ -73,6 +73,8 @@ class SIRIKATA_EXPORT TransferMediator
 		Priority mPriority;
             // Whether we've started processing this request.
             bool mExecuting;
+            // When the request was first added, for queue wait stats
+            Time mQueuedTime;
 	private:
 		//Maps each client's string ID to the original TransferRequest object
 		std::map<std::string, std::tr1::shared_ptr<TransferRequest> > mTransferReqs;
@@ -132,72 +134,110 @@ class SIRIKATA_EXPORT TransferMediator
 	typedef AggregateList::index<tagID>::type AggregateListByID;
 	typedef AggregateList::index<tagPriority>::type AggregateListByPriority;
 
-	/*
-	 * Used to process the queue of requests coming from a single client.
-	 * There is one PoolWorker for each client, and this makes it so that the client's
-	 * thread doesn't have to block when inserting a request. Instead, the PoolWorkers
-	 * block against each other when inserting the request into the aggregated list.
-	 */
-	class PoolWorker {
-	private:
-	    //The TransferPool associated with this worker
-		std::tr1::shared_ptr<TransferPool> mTransferPool;
-
-		//The worker's thread
-		Thread * mWorkerThread;
-
-		//Set to true when worker should shut down
-		bool mCleanup;
-
-		//Runs the worker thread
-	    void run();
-
-	public:
-		//Initialize with the associated TransferPool
-		PoolWorker(std::tr1::shared_ptr<TransferPool> transferPool);
+    enum {
+        // These match HttpManager's connection limits since starting more
+        // requests than it will service at once only hides the queuing from
+        // us.
+        MaxOutstanding = 40,
+        MaxOriginOutstanding = 8,
+        InitialOriginLimit = 4
+    };
 
-		//Returns the TransferPool this was initialized with
-		std::tr1::shared_ptr<TransferPool> getTransferPool() const;
-
-		//Returns the worker's thread
-		Thread * getThread() const;
-
-		//Signal to shut down
-		void cleanup();
-	};
-
-    friend class PoolWorker;
-    //Helper for compatibility with compilers where TransferPool declaring
-    //TransferMediator as a friend does not give PoolWorker access
-    static inline std::tr1::shared_ptr<TransferRequest> getRequest(std::tr1::shared_ptr<TransferPool> pool) {
-        return pool->getRequest();
-    }
+    /*
+     * Concurrency control for a single origin (see
+     * TransferRequest::getOrigin). The limit on outstanding requests adapts
+     * AIMD-style: it grows by about one request per round trip while requests
+     * complete quickly and is halved, at most once per round trip, when a
+     * request fails or its latency rises well above the best seen for the
+     * origin, which indicates we're just queuing requests up at the server.
+     */
+    struct OriginState {
+        OriginState();
+
+        // Current limit, fractional so it can grow gradually
+        float64 limit;
+        uint32 outstanding;
+        // Lowest latency seen, after discounting the time spent transferring
+        // data at the best observed rate. Drifts upwards slowly so it can
+        // follow changes in the network.
+        Duration baseLatency;
+        // Smoothed latency
+        Duration latency;
+        // Best observed per-request transfer rate, in bytes/second
+        float64 peakRate;
+        Time lastDecrease;
+        uint32 completed;
+        uint32 failed;
+    };
+    typedef std::tr1::unordered_map<String, OriginState> OriginMap;
+    // Protected by mAggMutex
+    OriginMap mOrigins;
+
+    // Per pool statistics, protected by mAggMutex
+    struct PoolStats {
+        PoolStats();
+
+        uint32 inFlight;
+        uint32 started;
+        uint32 completed;
+        Duration totalQueueWait;
+        uint64 bytes;
+        // Bytes since the last time rates were computed
+        uint64 periodBytes;
+        float64 bytesPerSecond;
+    };
+    typedef std::map<std::string, PoolStats> PoolStatsMap;
+    PoolStatsMap mPoolStats;
+
+    // Requests which have been executed but haven't finished, protected by
+    // mAggMutex
+    struct ExecutingRequest {
+        String origin;
+        Time startTime;
+        std::vector<std::string> clients;
+    };
+    typedef std::multimap<TransferRequest*, ExecutingRequest> ExecutingMap;
+    ExecutingMap mExecuting;
 
     Context* mContext;
 
-	//Maps a client ID string to the PoolWorker class
-	typedef std::map<std::string, std::tr1::shared_ptr<PoolWorker> > PoolType;
+	//Maps a client ID string to its pool
+	typedef std::map<std::string, TransferPoolPtr> PoolType;
 	//Stores the list of pools
 	PoolType mPools;
 	//lock this to access mPools
 	boost::shared_mutex mPoolMutex;
 
+	// Lock this to access mCleanup and mWakeRequested
+	boost::mutex mWakeMutex;
+	boost::condition_variable mWakeCV;
 	//Set to true to signal shutdown
 	bool mCleanup;
-	//Number of outstanding requests
+	// Set when there may be work for the dispatcher
+	bool mWakeRequested;
+	//Number of outstanding requests, protected by mAggMutex
 	uint32 mNumOutstanding;
 
-	//TransferMediator's worker thread
+	//TransferMediator's dispatcher thread
 	Thread* mThread;
 
     // Algorithm used to aggregate priorities of requests
     PriorityAggregationAlgorithm* mAggregationAlgorithm;
 
-    //Main thread that handles the input pools
+    //Dispatcher thread, which sleeps until there's work to do
     void mediatorThread();
+    //Wake the dispatcher thread
+    void wake();
+
+    //Pull new requests out of all the pools
+    void processPools();
+    //Merge a request from a pool into mAggregateList. Requires mAggMutex.
+    void addPoolRequest(TransferRequestPtr req);
 
     //Callback for when an executed request finishes
     void execute_finished(std::tr1::shared_ptr<TransferRequest> req, std::string id);
+    //Adjust an origin's limit for a finished request. Requires mAggMutex.
+    void updateOrigin(OriginState& origin, const ExecutingRequest& exec, TransferRequestPtr req, const Time& now);
 
     //Check our internal queue to see what request to process next
     void checkQueue();
@@ -205,7 +245,7 @@ class SIRIKATA_EXPORT TransferMediator
     void registerPool(TransferPoolPtr pool);
 
     //Update statistics from the TransferHandlers
-    void updateStats();
+    void updateStats(const Duration& elapsed);
 
     void commandListRequests(const Command::Command& cmd, Command::Commander* cmdr, Command::CommandID cmdid);
 public:
@@ -94,12 +94,28 @@ protected:
     // Friend in TransferMediator so it can construct, call getRequest
     friend class TransferMediator;
 
+    typedef std::tr1::function<void()> RequestsAvailableCallback;
+
     TransferPool(const std::string& clientID)
      : mClientID(clientID)
     {}
 
+    /// Returns the next request from the pool, or an empty pointer if there
+    /// are none. Never blocks.
     virtual TransferRequestPtr getRequest() = 0;
 
+    /// Set by the TransferMediator when the pool is registered so it can be
+    /// woken up instead of polling for new requests.
+    void setRequestsAvailableCallback(const RequestsAvailableCallback& cb) {
+        mRequestsAvailable = cb;
+    }
+    /// Implementations must call this after adding anything getRequest will
+    /// return.
+    void notifyRequestsAvailable() {
+        if (mRequestsAvailable)
+            mRequestsAvailable();
+    }
+
     // Utility methods because they require being friended by
     // TransferRequest but that doesn't extend to subclasses
     void setRequestClientID(TransferRequestPtr req) {
@@ -113,6 +129,7 @@ protected:
     }
 
     const std::string mClientID;
+    RequestsAvailableCallback mRequestsAvailable;
 };
 typedef std::tr1::shared_ptr<TransferPool> TransferPoolPtr;
 
@@ -125,21 +142,24 @@ public:
 
     //Puts a request into the pool
     virtual void addRequest(TransferRequestPtr req) {
-        if (req)
-            setRequestClientID(req);
+        if (!req) return;
+        setRequestClientID(req);
         mDeltaQueue.push(req);
+        notifyRequestsAvailable();
     }
 
     //Updates priority of a request in the pool
     virtual void updatePriority(TransferRequestPtr req, Priority p) {
         setRequestPriority(req, p);
         mDeltaQueue.push(req);
+        notifyRequestsAvailable();
     }
 
     //Updates priority of a request in the pool
     inline void deleteRequest(TransferRequestPtr req) {
         setRequestDeletion(req);
         mDeltaQueue.push(req);
+        notifyRequestsAvailable();
     }
 
 private:
@@ -153,10 +173,10 @@ private:
     {
     }
 
-    //Returns an item from the pool. Blocks if pool is empty.
+    //Returns an item from the pool, or NULL if the pool is empty.
     inline std::tr1::shared_ptr<TransferRequest> getRequest() {
         std::tr1::shared_ptr<TransferRequest> retval;
-        mDeltaQueue.blockingPop(retval);
+        mDeltaQueue.pop(retval);
         return retval;
     }
 };
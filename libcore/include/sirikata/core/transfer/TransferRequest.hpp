@@ -53,6 +53,16 @@ public:
 
     virtual void notifyCaller(TransferRequestPtr me, TransferRequestPtr from) = 0;
 
+    /// Identifies the server the request is serviced by, e.g. a scheme and
+    /// host, so the TransferMediator can limit concurrency per server.
+    virtual String getOrigin() const = 0;
+    /// Whether the request produced a result. Only valid after execute has
+    /// finished.
+    virtual bool succeeded() const = 0;
+    /// Bytes of data retrieved or sent by the request. Only valid after
+    /// execute has finished.
+    virtual uint64 bytesTransferred() const { return 0; }
+
 	virtual ~TransferRequest() {}
 
 	friend class TransferPool;
@@ -107,6 +117,11 @@ public:
 
     void execute(std::tr1::shared_ptr<TransferRequest> req, ExecuteFinished cb);
 
+    virtual String getOrigin() const;
+    virtual bool succeeded() const {
+        return (bool)mRemoteFileMetadata;
+    }
+
     inline void notifyCaller(TransferRequestPtr me, TransferRequestPtr from) {
         std::tr1::shared_ptr<MetadataRequest> meC =
             std::tr1::static_pointer_cast<MetadataRequest, TransferRequest>(me);
@@ -187,6 +202,14 @@ public:
     void notifyCaller(TransferRequestPtr me, TransferRequestPtr from);
     void notifyCaller(TransferRequestPtr me, TransferRequestPtr from, DenseDataPtr data);
 
+    virtual String getOrigin() const;
+    virtual bool succeeded() const {
+        return (bool)mDenseData;
+    }
+    virtual uint64 bytesTransferred() const {
+        return mDenseData ? mDenseData->length() : 0;
+    }
+
 protected:
     std::string mID;
     std::tr1::shared_ptr<Chunk> mChunk;
@@ -232,6 +255,14 @@ public:
     void notifyCaller(TransferRequestPtr me, TransferRequestPtr from);
     void notifyCaller(TransferRequestPtr me, TransferRequestPtr from, DenseDataPtr data);
 
+    virtual String getOrigin() const;
+    virtual bool succeeded() const {
+        return (bool)mDenseData;
+    }
+    virtual uint64 bytesTransferred() const {
+        return mDenseData ? mDenseData->length() : 0;
+    }
+
 protected:
     std::tr1::shared_ptr<RemoteFileMetadata> mMetadata;
     std::tr1::shared_ptr<Chunk> mChunk;
@@ -275,6 +306,9 @@ class SIRIKATA_EXPORT UploadRequest : public TransferRequest {
     virtual const std::string& getIdentifier() const;
     virtual void execute(TransferRequestPtr req, ExecuteFinished cb);
     virtual void notifyCaller(TransferRequestPtr me, TransferRequestPtr from);
+    virtual String getOrigin() const;
+    virtual bool succeeded() const;
+    virtual uint64 bytesTransferred() const;
 
     OAuthParamsPtr oauth() { return mOAuth; }
     const StringMap& files() { return mFiles; }
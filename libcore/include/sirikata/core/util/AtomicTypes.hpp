@@ -204,6 +204,37 @@ inline bool compare_and_swap(volatile Node*volatile *target, volatile Node *comp
 #endif
 }
 
+/** Atomically replace *target with exchange if it currently holds comperand.
+ *  Acts as a full memory barrier.
+ *  \returns true if the value was replaced
+ */
+inline bool compare_and_swap(volatile uint32* target, uint32 comperand, uint32 exchange) {
+#ifdef _WIN32
+        return InterlockedCompareExchange((volatile LONG*)target, (LONG)exchange, (LONG)comperand)==(LONG)comperand;
+#else
+#ifdef __APPLE__
+        return OSAtomicCompareAndSwap32Barrier((int32_t)comperand, (int32_t)exchange, (volatile int32_t*)target);
+#else
+        return __sync_bool_compare_and_swap (target, comperand, exchange);
+#endif
+#endif
+}
+
+/** Full memory barrier. Neither the compiler nor the processor will move loads
+ *  or stores across this call.
+ */
+inline void memory_barrier() {
+#ifdef _WIN32
+        MemoryBarrier();
+#else
+#ifdef __APPLE__
+        OSMemoryBarrier();
+#else
+        __sync_synchronize();
+#endif
+#endif
+}
+
 #ifdef _WIN32
 #pragma warning( pop )
 #endif
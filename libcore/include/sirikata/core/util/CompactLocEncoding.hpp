@@ -0,0 +1,180 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_CORE_UTIL_COMPACT_LOC_ENCODING_HPP_
+#define _SIRIKATA_CORE_UTIL_COMPACT_LOC_ENCODING_HPP_
+
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/util/MotionVector.hpp>
+#include <sirikata/core/util/MotionQuaternion.hpp>
+#include <sirikata/core/util/AggregateBoundingInfo.hpp>
+#include <sirikata/core/util/UUID.hpp>
+
+namespace Sirikata {
+
+/** The properties of one object carried in a compact location update. Like
+ *  Protocol::Loc::LocationUpdate, only some fields may be present, indicated by
+ *  the bits in fields.
+ */
+struct CompactLocRecord {
+    enum Field {
+        EpochField = 0x01,
+        LocationField = 0x02,
+        OrientationField = 0x04,
+        BoundsField = 0x08,
+        MeshField = 0x10,
+        PhysicsField = 0x20,
+        QueryDataField = 0x40,
+        IndexIDsField = 0x80
+    };
+
+    CompactLocRecord()
+     : seqno(0),
+       fields(0),
+       epoch(0)
+    {}
+
+    bool has(Field f) const { return (fields & f) != 0; }
+
+    UUID object;
+    uint64 seqno;
+    uint8 fields;
+
+    uint64 epoch;
+    TimedMotionVector3f location;
+    TimedMotionQuaternion orientation;
+    AggregateBoundingInfo bounds;
+    String mesh;
+    String physics;
+    String query_data;
+    std::vector<uint32> index_ids;
+};
+
+/** Encodes CompactLocRecords for a single subscriber into messages much
+ *  smaller than the equivalent Protocol::Loc::BulkLocationUpdate:
+ *
+ *  - Positions and velocities are quantized to a fixed precision and positions
+ *    are stored relative to an origin chosen per message, so objects near each
+ *    other need only a few bytes each.
+ *  - Orientations are stored with the smallest-three encoding in 6 bytes, and
+ *    an identity angular velocity takes no space.
+ *  - Times are stored as offsets from a time chosen per message.
+ *  - Strings (meshes, physics, query data) are sent in full once with an ID
+ *    and afterwards by ID only.
+ *
+ *  Updates can be reordered or lost on the way to the subscriber, so a string
+ *  is only referenced by ID once a message defining it has been reported as
+ *  delivered(). Until then it's resent in full whenever it's used.
+ *
+ *  Messages are built by calling add() for each record and then finish().
+ */
+class SIRIKATA_EXPORT CompactLocEncoder {
+public:
+    static const float32 DefaultPrecision;
+
+    enum {
+        // Version of the encoding, also used by subscribers to indicate which
+        // version they can decode
+        Version = 1,
+        // Maximum number of strings remembered per subscriber. Once full, new
+        // strings are always sent in full.
+        MaxStringIDs = 4096,
+        // Maximum number of messages waiting on delivered() or dropped()
+        MaxUndeliveredMessages = 256
+    };
+
+    /** \param precision maximum error, in meters or meters/second, in
+     *  positions and velocities
+     */
+    CompactLocEncoder(float32 precision = DefaultPrecision);
+
+    float32 precision() const { return mPrecision; }
+
+    /** Add a record to the current message. */
+    void add(const CompactLocRecord& rec);
+    /** Get the number of records in the current message. */
+    uint32 size() const { return mCount; }
+    bool empty() const { return mCount == 0; }
+
+    /** Encode the current message into out and start a new one.
+     *  \returns an ID for the message to report it as delivered() or
+     *  dropped() later
+     */
+    uint32 finish(String* out);
+    /** Discard the current message without encoding it. */
+    void clear();
+
+    /** Indicate the message with the given ID was received by the subscriber,
+     *  allowing strings it defined to be referenced by ID.
+     */
+    void delivered(uint32 msg_id);
+    /** Indicate the message with the given ID was lost. */
+    void dropped(uint32 msg_id);
+
+    /** Forget all strings known to have been received, e.g. when the
+     *  subscriber may have lost its state.
+     */
+    void reset();
+
+private:
+    struct StringInfo {
+        uint32 id;
+        bool delivered;
+        // The last message the string was sent in full in
+        uint32 definedIn;
+    };
+    typedef std::tr1::unordered_map<String, StringInfo> StringIDMap;
+
+    int64 quantize(float32 v) const;
+    void clearMessage();
+    void encodeString(const String& str);
+
+    float32 mPrecision;
+
+    // Records are encoded into mBody as they're added. The header, which
+    // includes the origin and base time taken from the first record, is
+    // only added in finish().
+    String mBody;
+    uint32 mCount;
+    bool mHaveOrigin;
+    int64 mOrigin[3];
+    int64 mBaseTime;
+    uint64 mLastSeqno;
+
+    StringIDMap mStringIDs;
+    // Elements of unordered_maps aren't moved, so we can index them by ID
+    std::vector<StringInfo*> mStringsByID;
+    uint32 mNextStringID;
+    // Strings defined in full in the message currently being encoded
+    std::vector<uint32> mDefinedStrings;
+    // IDs of strings defined by messages we haven't heard back about yet
+    typedef std::map<uint32, std::vector<uint32> > UndeliveredMessageMap;
+    UndeliveredMessageMap mUndelivered;
+    uint32 mNextMessageID;
+}; // class CompactLocEncoder
+
+/** Decodes messages generated by CompactLocEncoder. Each subscriber needs its
+ *  own decoder since it tracks the strings sent by the encoder.
+ */
+class SIRIKATA_EXPORT CompactLocDecoder {
+public:
+    CompactLocDecoder();
+
+    /** Decode a message, appending the records it contains to out.
+     *  \returns false if the message was malformed, in which case some records
+     *  may still have been added to out.
+     */
+    bool decode(const void* data, uint32 len, std::vector<CompactLocRecord>* out);
+
+private:
+    bool decodeString(const uint8*& pos, const uint8* end, String* out, bool* known);
+
+    // Indexed by string ID, with empty slots for IDs not received yet
+    std::vector<String> mStrings;
+    std::vector<bool> mHaveString;
+}; // class CompactLocDecoder
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_CORE_UTIL_COMPACT_LOC_ENCODING_HPP_
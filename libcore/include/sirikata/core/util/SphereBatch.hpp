@@ -0,0 +1,112 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_CORE_UTIL_SPHERE_BATCH_HPP_
+#define _SIRIKATA_CORE_UTIL_SPHERE_BATCH_HPP_
+
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/util/MotionVector.hpp>
+
+namespace Sirikata {
+
+/** A query evaluated against a SphereBatch. Objects satisfy it if they are
+ *  within a maximum distance of the query region and/or subtend at least a
+ *  minimum solid angle from it, the same constraints proximity queries use.
+ *  Distances are measured from the surface of the query region, or zero if
+ *  the object is inside it.
+ */
+class SIRIKATA_EXPORT SphereBatchQuery {
+public:
+    // Pass SphereBatchQuery::NoMaxDistance to disable the distance constraint
+    // and SolidAngle::Min to disable the solid angle constraint.
+    SphereBatchQuery(const Vector3f& center, float32 region_radius, float32 max_distance, const SolidAngle& min_angle);
+
+    static const float32 NoMaxDistance;
+
+    const Vector3f& center() const { return mCenter; }
+    float32 regionRadius() const { return mRegionRadius; }
+    float32 maxDistance() const { return mMaxDistance; }
+    const SolidAngle& minAngle() const { return mMinAngle; }
+
+    bool hasMaxDistance() const { return mMaxDistance != NoMaxDistance; }
+    bool hasMinAngle() const { return mMinAngle != SolidAngle::Min; }
+
+private:
+    friend class SphereBatch;
+
+    Vector3f mCenter;
+    float32 mRegionRadius;
+    float32 mMaxDistance;
+    SolidAngle mMinAngle;
+    // Precomputed from mMinAngle exactly as SolidAngle::lessThanEqualDistanceSqRadius
+    // computes it, so batch and per-object checks agree.
+    float32 mInvertSquaredFrac;
+}; // class SphereBatchQuery
+
+/** SphereBatch stores the motion and bounds of a set of objects as a
+ *  structure of arrays so queries can be checked against many objects at
+ *  once with SIMD instructions, instead of one object at a time through
+ *  LocationServiceCache accessors. Positions are extrapolated to the query
+ *  time as part of the check.
+ *
+ *  Update times are stored as offsets in seconds from the batch's epoch in
+ *  single precision, so the epoch should be kept near the times the batch is
+ *  queried at, using rebase() if necessary.
+ *
+ *  cull() uses SSE when it's available at compile time and falls back to
+ *  cullScalar() otherwise. Both perform exactly the same single precision
+ *  operations in the same order, so they always make the same decisions.
+ */
+class SIRIKATA_EXPORT SphereBatch {
+public:
+    SphereBatch(const Time& epoch = Time::null());
+
+    const Time& epoch() const { return mEpoch; }
+    // Moves the epoch, extrapolating all objects to the new epoch.
+    void rebase(const Time& epoch);
+
+    uint32 size() const { return (uint32)mPosX.size(); }
+    bool empty() const { return mPosX.empty(); }
+    void clear();
+    void reserve(uint32 n);
+
+    // Adds an object, returning its index. max_size is used for the solid
+    // angle constraint and radius for the distance constraint.
+    uint32 add(const TimedMotionVector3f& loc, float32 radius, float32 max_size);
+    void update(uint32 idx, const TimedMotionVector3f& loc, float32 radius, float32 max_size);
+    void updateLocation(uint32 idx, const TimedMotionVector3f& loc);
+    // Removes the object at idx by moving the last object into its place.
+    void remove(uint32 idx);
+
+    // Position of an object at time t, as computed by cull().
+    Vector3f position(uint32 idx, const Time& t) const;
+    float32 radius(uint32 idx) const { return mRadius[idx]; }
+    float32 maxSize(uint32 idx) const { return mMaxSize[idx]; }
+
+    /** Appends the indices of objects satisfying the query at time t to
+     *  results, in increasing order, and returns the number appended.
+     */
+    uint32 cull(const Time& t, const SphereBatchQuery& query, std::vector<uint32>* results) const;
+    uint32 cullScalar(const Time& t, const SphereBatchQuery& query, std::vector<uint32>* results) const;
+
+    // Whether cull() uses SIMD instructions in this build
+    static bool simd();
+
+private:
+    float32 timeOffset(const Time& t) const;
+    void set(uint32 idx, const TimedMotionVector3f& loc);
+    uint32 cullScalarRange(float32 qt, const SphereBatchQuery& query, uint32 start, uint32 end, std::vector<uint32>* results) const;
+
+    Time mEpoch;
+    std::vector<float32> mPosX, mPosY, mPosZ;
+    std::vector<float32> mVelX, mVelY, mVelZ;
+    // Offset from the epoch of the time of each object's position
+    std::vector<float32> mTime;
+    std::vector<float32> mRadius;
+    std::vector<float32> mMaxSize;
+}; // class SphereBatch
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_CORE_UTIL_SPHERE_BATCH_HPP_
@@ -0,0 +1,99 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <sirikata/core/network/SSTSegmentBuffer.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/once.hpp>
+
+namespace Sirikata {
+namespace SST {
+
+// Number of buffers carved out of each slab. With 1.5KB cells this allocates
+// ~400KB at a time.
+#define SEGMENT_BUFFERS_PER_SLAB 256
+
+class SegmentBufferPool {
+public:
+    SegmentBufferPool()
+     : mFreeList(NULL)
+    {}
+
+    SegmentBuffer* allocate() {
+        boost::lock_guard<boost::mutex> lck(mMutex);
+
+        if (mFreeList == NULL)
+            allocateSlab();
+
+        SegmentBuffer* buf = mFreeList;
+        mFreeList = buf->mNext;
+        buf->mNext = NULL;
+
+        mStats.allocated++;
+        mStats.inUse++;
+
+        return buf;
+    }
+
+    void release(SegmentBuffer* buf) {
+        buf->clear();
+
+        boost::lock_guard<boost::mutex> lck(mMutex);
+        buf->mNext = mFreeList;
+        mFreeList = buf;
+        mStats.inUse--;
+    }
+
+    SegmentBuffer::Stats stats() {
+        boost::lock_guard<boost::mutex> lck(mMutex);
+        return mStats;
+    }
+
+private:
+    // Must be called with mMutex held
+    void allocateSlab() {
+        SegmentBuffer* slab = new SegmentBuffer[SEGMENT_BUFFERS_PER_SLAB];
+        for(int i = SEGMENT_BUFFERS_PER_SLAB-1; i >= 0; i--) {
+            slab[i].mNext = mFreeList;
+            mFreeList = &(slab[i]);
+        }
+        mStats.slabs++;
+    }
+
+    boost::mutex mMutex;
+    SegmentBuffer* mFreeList;
+    SegmentBuffer::Stats mStats;
+};
+
+namespace {
+// The pool is intentionally never freed. Buffers may be held by connections
+// which are only cleaned up during static destruction, so tearing the pool
+// down could leave them pointing at freed memory.
+SegmentBufferPool* sSegmentBufferPool = NULL;
+boost::once_flag sSegmentBufferPoolInitialized = BOOST_ONCE_INIT;
+
+void initSegmentBufferPool() {
+    sSegmentBufferPool = new SegmentBufferPool();
+}
+
+SegmentBufferPool& pool() {
+    boost::call_once(sSegmentBufferPoolInitialized, initSegmentBufferPool);
+    return *sSegmentBufferPool;
+}
+}
+
+SegmentBuffer* SegmentBuffer::allocate() {
+    return pool().allocate();
+}
+
+void SegmentBuffer::release() {
+    pool().release(this);
+}
+
+SegmentBuffer::Stats SegmentBuffer::stats() {
+    return pool().stats();
+}
+
+} // namespace SST
+} // namespace Sirikata
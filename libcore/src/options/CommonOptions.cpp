@@ -74,6 +74,8 @@ void InitOptions() {
         .addOption(new OptionValue("ohstreamoptions","--send-buffer-size=16384 --parallel-sockets=1 --no-delay=false",Sirikata::OptionValueType<String>(),"TCPSST stream options such as how many bytes to collect for sending during an ongoing asynchronous send call."))
 
         .addOption(new OptionValue(OPT_SST_DEFAULT_WINDOW_SIZE,"10000",Sirikata::OptionValueType<uint32>(),"Default window (and buffer) size for SST streams."))
+        .addOption(new OptionValue(OPT_SST_BATCH_SIZE,"1",Sirikata::OptionValueType<uint32>(),"Maximum number of SST packets to the same endpoint coalesced into a single datagram. 1 disables batching. Batched datagrams can only be parsed by peers which support batching, so only enable this when all of them do."))
+        .addOption(new OptionValue(OPT_SST_BATCH_FLUSH_LATENCY,"0ms",Sirikata::OptionValueType<Duration>(),"Maximum time SST packets are held waiting for a batch to fill. 0 flushes as soon as the current work on the main strand is done."))
 
         .addOption(new OptionValue(OPT_REGION_WEIGHT, "sqr", Sirikata::OptionValueType<String>(), "Type of region weight calculator to use, which affects communication falloff."))
         .addOption(new OptionValue(OPT_REGION_WEIGHT_ARGS, "--flatness=8 --const-cutoff=64", Sirikata::OptionValueType<String>(), "Arguments to region weight calculator."))
@@ -114,6 +116,9 @@ void InitOptions() {
         .addOption(new OptionValue(OPT_CDN_UPLOAD_URI_PREFIX, "/api/upload", Sirikata::OptionValueType<String>(), "URI prefix for CDN HTTP uploads."))
         .addOption(new OptionValue(OPT_CDN_UPLOAD_STATUS_URI_PREFIX, "/upload/processing", Sirikata::OptionValueType<String>(), "URI prefix for CDN HTTP upload status checks."))
 
+        .addOption(new OptionValue(OPT_HTTP_PIPELINE_DEPTH, "1", Sirikata::OptionValueType<uint32>(), "Maximum number of GET/HEAD requests sent on an HTTP connection before their responses arrive. 1, the default, disables pipelining. Some servers and proxies mishandle pipelined requests, so only raise it for servers known to support them."))
+        .addOption(new OptionValue(OPT_HTTP_COALESCE_REQUESTS, "true", Sirikata::OptionValueType<bool>(), "Whether identical GET/HEAD requests already in flight share a single HTTP request."))
+
         .addOption(new OptionValue(OPT_TRACE_TIMESERIES, "null", Sirikata::OptionValueType<String>(), "Service to report TimeSeries data to."))
         .addOption(new OptionValue(OPT_TRACE_TIMESERIES_OPTIONS, "", Sirikata::OptionValueType<String>(), "Options for TimeSeries reporting service."))
 
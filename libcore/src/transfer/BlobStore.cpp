@@ -0,0 +1,744 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <sirikata/core/util/Standard.hh>
+#include <sirikata/core/transfer/BlobStore.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#if SIRIKATA_PLATFORM == SIRIKATA_PLATFORM_WINDOWS
+#include <io.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+namespace Sirikata {
+namespace Transfer {
+
+namespace {
+
+const char* FilePrefix = "blobs.";
+const char* DataSuffix = ".dat";
+const char* IndexSuffix = ".idx";
+const char* TempSuffix = ".tmp";
+
+// Both files start with a magic number and version
+const uint32 HeaderSize = 8;
+const char DataMagic[4] = { 'S', 'B', 'D', 'T' };
+const char IndexMagic[4] = { 'S', 'B', 'I', 'X' };
+const uint32 FormatVersion = 1;
+
+// Index records are fixed size:
+//  [0] type, [1] flags, [2-3] unused, [4-35] fingerprint, [36-43] start byte,
+//  [44-51] length, [52-59] offset in the data file, [60-63] checksum of the
+//  preceding bytes. All integers are little endian.
+const uint32 RecordSize = 64;
+const uint8 RecordAdd = 1;
+const uint8 RecordRemove = 2;
+const uint8 FlagToEndOfFile = 0x01;
+
+// Files left behind by the old one-file-per-asset disk cache: the hex
+// fingerprint, optionally followed by one of these suffixes
+const char* LegacySuffixes[] = { "", ".part", ".ranges", ".ranges.temp" };
+
+void writeLE(unsigned char* out, uint64 v, uint32 nbytes) {
+    for(uint32 i = 0; i < nbytes; i++)
+        out[i] = (unsigned char)(v >> (8*i));
+}
+
+uint64 readLE(const unsigned char* in, uint32 nbytes) {
+    uint64 v = 0;
+    for(uint32 i = 0; i < nbytes; i++)
+        v |= ((uint64)in[i]) << (8*i);
+    return v;
+}
+
+// FNV-1a
+uint32 checksum(const unsigned char* data, uint32 len) {
+    uint32 h = 2166136261u;
+    for(uint32 i = 0; i < len; i++) {
+        h ^= data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+void encodeRecord(unsigned char* rec, uint8 type, const Fingerprint& id, const Range& range, uint64 offset) {
+    memset(rec, 0, RecordSize);
+    rec[0] = type;
+    rec[1] = range.goesToEndOfFile() ? FlagToEndOfFile : 0;
+    memcpy(rec+4, id.rawData().data(), Fingerprint::static_size);
+    writeLE(rec+36, range.startbyte(), 8);
+    writeLE(rec+44, range.length(), 8);
+    writeLE(rec+52, offset, 8);
+    writeLE(rec+60, checksum(rec, 60), 4);
+}
+
+#if SIRIKATA_PLATFORM == SIRIKATA_PLATFORM_WINDOWS
+
+int openFile(const String& path) {
+    return _open(path.c_str(), _O_RDWR|_O_CREAT|_O_BINARY, _S_IREAD|_S_IWRITE);
+}
+void closeFile(int fd) {
+    _close(fd);
+}
+uint64 fileSize(int fd) {
+    struct _stat64 st;
+    if (_fstat64(fd, &st) != 0) return 0;
+    return (uint64)st.st_size;
+}
+bool writeAt(int fd, uint64 offset, const void* data, uint64 len) {
+    if (_lseeki64(fd, offset, SEEK_SET) != (int64)offset) return false;
+    const char* pos = (const char*)data;
+    while(len > 0) {
+        int written = _write(fd, pos, (unsigned int)std::min(len, (uint64)(1 << 30)));
+        if (written <= 0) return false;
+        pos += written;
+        len -= written;
+    }
+    return true;
+}
+bool readAt(int fd, uint64 offset, void* data, uint64 len) {
+    if (_lseeki64(fd, offset, SEEK_SET) != (int64)offset) return false;
+    char* pos = (char*)data;
+    while(len > 0) {
+        int nread = _read(fd, pos, (unsigned int)std::min(len, (uint64)(1 << 30)));
+        if (nread <= 0) return false;
+        pos += nread;
+        len -= nread;
+    }
+    return true;
+}
+bool truncateFile(int fd, uint64 size) {
+    return (_chsize_s(fd, size) == 0);
+}
+void syncFile(int fd) {
+    _commit(fd);
+}
+
+#else
+
+int openFile(const String& path) {
+    return ::open(path.c_str(), O_RDWR|O_CREAT|O_BINARY, 0666);
+}
+void closeFile(int fd) {
+    ::close(fd);
+}
+uint64 fileSize(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) return 0;
+    return (uint64)st.st_size;
+}
+bool writeAt(int fd, uint64 offset, const void* data, uint64 len) {
+    const char* pos = (const char*)data;
+    while(len > 0) {
+        ssize_t written = pwrite(fd, pos, (size_t)len, (off_t)offset);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        pos += written;
+        offset += written;
+        len -= written;
+    }
+    return true;
+}
+bool readAt(int fd, uint64 offset, void* data, uint64 len) {
+    char* pos = (char*)data;
+    while(len > 0) {
+        ssize_t nread = pread(fd, pos, (size_t)len, (off_t)offset);
+        if (nread < 0 && errno == EINTR) continue;
+        if (nread <= 0) return false;
+        pos += nread;
+        offset += nread;
+        len -= nread;
+    }
+    return true;
+}
+bool truncateFile(int fd, uint64 size) {
+    return (ftruncate(fd, (off_t)size) == 0);
+}
+void syncFile(int fd) {
+#if SIRIKATA_PLATFORM == SIRIKATA_PLATFORM_MAC
+    fsync(fd);
+#else
+    fdatasync(fd);
+#endif
+}
+
+#endif
+
+// Opens a file, writing the header if it's new. Returns -1 if the file can't
+// be opened or has an invalid header.
+int openWithHeader(const String& path, const char magic[4]) {
+    int fd = openFile(path);
+    if (fd < 0) return -1;
+
+    unsigned char header[HeaderSize];
+    if (fileSize(fd) < HeaderSize) {
+        memcpy(header, magic, 4);
+        writeLE(header+4, FormatVersion, 4);
+        if (!truncateFile(fd, 0) || !writeAt(fd, 0, header, HeaderSize)) {
+            closeFile(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    if (!readAt(fd, 0, header, HeaderSize) ||
+        memcmp(header, magic, 4) != 0 ||
+        readLE(header+4, 4) != FormatVersion)
+    {
+        closeFile(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Copy a piece of one data file to the end of another, adding the index
+// record for its new location
+bool copyData(int from_fd, int to_fd, const Fingerprint& id, const Range& range, uint64 offset,
+    uint64* to_size, std::vector<unsigned char>* buffer, std::vector<unsigned char>* index)
+{
+    uint64 len = range.length();
+    buffer->resize((size_t)len);
+    if (!readAt(from_fd, offset, &(*buffer)[0], len) ||
+        !writeAt(to_fd, *to_size, &(*buffer)[0], len))
+        return false;
+
+    unsigned char rec[RecordSize];
+    encodeRecord(rec, RecordAdd, id, range, *to_size);
+    index->insert(index->end(), rec, rec+RecordSize);
+    *to_size += len;
+    return true;
+}
+
+String leafName(const boost::filesystem::path& p) {
+    return p.filename()
+#if BOOST_FILESYSTEM_VERSION>=3
+        .string()
+#endif
+        ;
+}
+
+// Parse the generation out of a file name of the form blobs.<gen><suffix>
+bool parseGeneration(const String& name, const char* suffix, uint32* gen_out) {
+    String prefix(FilePrefix), suf(suffix);
+    if (name.size() <= prefix.size() + suf.size()) return false;
+    if (name.compare(0, prefix.size(), prefix) != 0) return false;
+    if (name.compare(name.size() - suf.size(), suf.size(), suf) != 0) return false;
+    String gen_str = name.substr(prefix.size(), name.size() - prefix.size() - suf.size());
+    try {
+        *gen_out = boost::lexical_cast<uint32>(gen_str);
+    } catch(boost::bad_lexical_cast&) {
+        return false;
+    }
+    return true;
+}
+
+bool isLegacyCacheFile(const String& name) {
+    for(uint32 i = 0; i < sizeof(LegacySuffixes)/sizeof(LegacySuffixes[0]); i++) {
+        String suf(LegacySuffixes[i]);
+        if (name.size() != Fingerprint::static_size*2 + suf.size()) continue;
+        if (name.compare(name.size() - suf.size(), suf.size(), suf) != 0) continue;
+        bool hex = true;
+        for(uint32 c = 0; hex && c < Fingerprint::static_size*2; c++)
+            hex = isxdigit((unsigned char)name[c]) != 0;
+        if (hex) return true;
+    }
+    return false;
+}
+
+} // namespace
+
+
+/** A read-only mapping of the start of the data file. */
+class BlobStore::Mapping : Noncopyable {
+public:
+    Mapping(int fd, uint64 size)
+     : mData(NULL),
+       mSize(0)
+    {
+#if SIRIKATA_PLATFORM != SIRIKATA_PLATFORM_WINDOWS
+        void* addr = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+            SILOG(transfer,error,"Failed to map blob store data: " << errno);
+            return;
+        }
+        mData = (const unsigned char*)addr;
+        mSize = size;
+#endif
+    }
+
+    ~Mapping() {
+#if SIRIKATA_PLATFORM != SIRIKATA_PLATFORM_WINDOWS
+        if (mData != NULL)
+            munmap((void*)mData, (size_t)mSize);
+#endif
+    }
+
+    const unsigned char* data() const { return mData; }
+    uint64 size() const { return mSize; }
+
+private:
+    const unsigned char* mData;
+    uint64 mSize;
+}; // class BlobStore::Mapping
+
+
+BlobStore::BlobStore(const String& dir)
+ : mDir(dir),
+   mOpen(false),
+   mGeneration(0),
+   mDataFD(-1),
+   mIndexFD(-1),
+   mDataSize(0),
+   mIndexSize(0),
+   mLiveBytes(0),
+   mDataSynced(true),
+   mCompacting(false)
+{
+}
+
+BlobStore::~BlobStore() {
+    boost::lock_guard<boost::mutex> lck(mMutex);
+    flushIndex();
+    closeFiles();
+}
+
+String BlobStore::dataPath(uint32 gen) const {
+    return (boost::filesystem::path(mDir) / (FilePrefix + boost::lexical_cast<String>(gen) + DataSuffix)).string();
+}
+
+String BlobStore::indexPath(uint32 gen) const {
+    return (boost::filesystem::path(mDir) / (FilePrefix + boost::lexical_cast<String>(gen) + IndexSuffix)).string();
+}
+
+bool BlobStore::open(std::vector<Entry>* entries) {
+    boost::lock_guard<boost::mutex> lck(mMutex);
+    flushIndex();
+    closeFiles();
+
+    // Find the newest complete generation. Its index is only renamed into
+    // place once its data is complete, so anything else is left over from an
+    // interrupted compaction or an old generation.
+    std::vector<String> all_files;
+    bool found = false;
+    uint32 gen = 0;
+    try {
+        boost::filesystem::create_directories(mDir);
+        for(boost::filesystem::directory_iterator it(mDir), end; it != end; it++) {
+            String name = leafName(it->path());
+            // The old disk cache format can't be converted since it didn't
+            // track which files were complete, so just reclaim the space
+            if (isLegacyCacheFile(name)) {
+                SILOG(transfer,detailed,"Removing old format disk cache file " << name);
+                boost::system::error_code ec;
+                boost::filesystem::remove(it->path(), ec);
+                continue;
+            }
+            if (name.compare(0, strlen(FilePrefix), FilePrefix) != 0) continue;
+            all_files.push_back(name);
+            uint32 file_gen;
+            if (parseGeneration(name, IndexSuffix, &file_gen) && (!found || file_gen > gen)) {
+                gen = file_gen;
+                found = true;
+            }
+        }
+    } catch(boost::filesystem::filesystem_error& e) {
+        SILOG(transfer,error,"Couldn't open blob store in " << mDir << ": " << e.what());
+        return false;
+    }
+
+    for(uint32 i = 0; i < all_files.size(); i++) {
+        uint32 file_gen;
+        if (found &&
+            ((parseGeneration(all_files[i], IndexSuffix, &file_gen) && file_gen == gen) ||
+             (parseGeneration(all_files[i], DataSuffix, &file_gen) && file_gen == gen)))
+            continue;
+        SILOG(transfer,detailed,"Removing stale blob store file " << all_files[i]);
+        boost::system::error_code ec;
+        boost::filesystem::remove(boost::filesystem::path(mDir) / all_files[i], ec);
+    }
+
+    if (!openGeneration(gen))
+        return false;
+
+    if (entries != NULL) {
+        entries->clear();
+        for(ChunkMap::iterator it = mChunks.begin(); it != mChunks.end(); it++) {
+            entries->push_back(Entry());
+            Entry& entry = entries->back();
+            entry.id = it->first;
+            entry.size = 0;
+            for(ChunkList::iterator chunk_it = it->second.begin(); chunk_it != it->second.end(); chunk_it++) {
+                chunk_it->range.addToList(chunk_it->range, entry.ranges);
+                entry.size += chunk_it->range.length();
+            }
+        }
+    }
+    return true;
+}
+
+bool BlobStore::openGeneration(uint32 gen) {
+    mGeneration = gen;
+    mDataFD = openWithHeader(dataPath(gen), DataMagic);
+    mIndexFD = openWithHeader(indexPath(gen), IndexMagic);
+    if (mDataFD < 0 || mIndexFD < 0) {
+        SILOG(transfer,error,"Couldn't open blob store files in " << mDir);
+        closeFiles();
+        return false;
+    }
+    mDataSize = fileSize(mDataFD);
+    mIndexSize = fileSize(mIndexFD);
+    replayIndex();
+    mOpen = true;
+    return true;
+}
+
+void BlobStore::closeFiles() {
+    if (mDataFD >= 0) closeFile(mDataFD);
+    if (mIndexFD >= 0) closeFile(mIndexFD);
+    mDataFD = -1;
+    mIndexFD = -1;
+    mDataSize = 0;
+    mIndexSize = 0;
+    mLiveBytes = 0;
+    mPendingRecords.clear();
+    mDataSynced = true;
+    mChunks.clear();
+    mMapping.reset();
+    mOpen = false;
+}
+
+void BlobStore::replayIndex() {
+    uint64 valid_end = HeaderSize;
+    if (mIndexSize > HeaderSize) {
+        std::vector<unsigned char> index((size_t)(mIndexSize - HeaderSize));
+        if (!readAt(mIndexFD, HeaderSize, &index[0], index.size()))
+            index.clear();
+
+        for(uint64 pos = 0; pos + RecordSize <= index.size(); pos += RecordSize) {
+            const unsigned char* rec = &index[(size_t)pos];
+            if (readLE(rec+60, 4) != checksum(rec, 60))
+                break;
+
+            Fingerprint id = Fingerprint::convertFromBinary(rec+4);
+            if (rec[0] == RecordAdd) {
+                uint64 start = readLE(rec+36, 8);
+                uint64 length = readLE(rec+44, 8);
+                uint64 offset = readLE(rec+52, 8);
+                // Data always precedes its record, so this is where we lost
+                // data in a crash
+                if (length == 0 || offset < HeaderSize || offset + length > mDataSize)
+                    break;
+                addChunk(id, Chunk(Range(start, length, LENGTH, (rec[1] & FlagToEndOfFile) != 0), offset));
+            }
+            else if (rec[0] == RecordRemove) {
+                removeChunks(id);
+            }
+            else {
+                break;
+            }
+            valid_end = HeaderSize + pos + RecordSize;
+        }
+    }
+
+    // Drop anything after the last valid record so new records follow it
+    if (valid_end != mIndexSize) {
+        SILOG(transfer,warn,"Discarding " << (mIndexSize - valid_end) << " bytes of invalid blob store index");
+        truncateFile(mIndexFD, valid_end);
+        mIndexSize = valid_end;
+    }
+}
+
+bool BlobStore::appendRecord(uint8 type, const Fingerprint& id, const Chunk& chunk) {
+    unsigned char rec[RecordSize];
+    encodeRecord(rec, type, id, chunk.range, chunk.offset);
+    mPendingRecords.insert(mPendingRecords.end(), rec, rec+RecordSize);
+
+    if (mPendingRecords.size() >= MaxPendingRecords * RecordSize)
+        return flushIndex();
+    return true;
+}
+
+bool BlobStore::flushIndex() {
+    if (mPendingRecords.empty()) return true;
+
+    // The data has to be on disk before the records referring to it, but a
+    // single sync covers all the data written since the last flush
+    if (!mDataSynced) {
+        syncFile(mDataFD);
+        mDataSynced = true;
+    }
+
+    bool success = writeAt(mIndexFD, mIndexSize, &mPendingRecords[0], mPendingRecords.size());
+    if (success) {
+        mIndexSize += mPendingRecords.size();
+    }
+    else {
+        // Make sure a partial record doesn't get followed by valid ones. The
+        // records are lost, which only costs refetching the data after a
+        // restart.
+        SILOG(transfer,error,"Failed to write blob store index records: " << errno);
+        truncateFile(mIndexFD, mIndexSize);
+    }
+    mPendingRecords.clear();
+    return success;
+}
+
+void BlobStore::addChunk(const Fingerprint& id, const Chunk& chunk) {
+    ChunkList& chunks = mChunks[id];
+    // Release anything the new data completely covers
+    for(uint32 i = 0; i < chunks.size(); ) {
+        if (chunks[i].range.isContainedBy(chunk.range)) {
+            mLiveBytes -= chunks[i].range.length();
+            chunks[i] = chunks.back();
+            chunks.pop_back();
+        }
+        else {
+            i++;
+        }
+    }
+    chunks.push_back(chunk);
+    mLiveBytes += chunk.range.length();
+}
+
+void BlobStore::removeChunks(const Fingerprint& id) {
+    ChunkMap::iterator it = mChunks.find(id);
+    if (it == mChunks.end()) return;
+    for(ChunkList::iterator chunk_it = it->second.begin(); chunk_it != it->second.end(); chunk_it++)
+        mLiveBytes -= chunk_it->range.length();
+    mChunks.erase(it);
+}
+
+bool BlobStore::put(const Fingerprint& id, const DenseData& data) {
+    if (data.length() == 0) return false;
+
+    boost::lock_guard<boost::mutex> lck(mMutex);
+    if (!mOpen) return false;
+
+    Chunk chunk(data, mDataSize);
+    if (!writeAt(mDataFD, chunk.offset, data.data(), data.length())) {
+        SILOG(transfer,error,"Failed to write " << data.length() << " bytes to blob store: " << errno);
+        truncateFile(mDataFD, mDataSize);
+        return false;
+    }
+    mDataSize += data.length();
+    mDataSynced = false;
+    addChunk(id, chunk);
+    if (mCompacting)
+        mCompactChanges.push_back(Change(id, chunk, false));
+    // Even if the index can't be written the data is still usable until
+    // the store is reopened
+    appendRecord(RecordAdd, id, chunk);
+    return true;
+}
+
+void BlobStore::sync() {
+    boost::lock_guard<boost::mutex> lck(mMutex);
+    if (!mOpen) return;
+    flushIndex();
+}
+
+BlobStore::MappingPtr BlobStore::mappingCovering(uint64 end) {
+    if (!mMapping || mMapping->size() < end) {
+        // Map everything written so far, so we only need to remap once the
+        // file grows again
+        MappingPtr mapping(new Mapping(mDataFD, mDataSize));
+        if (mapping->data() == NULL)
+            return MappingPtr();
+        mMapping = mapping;
+    }
+    return mMapping;
+}
+
+bool BlobStore::get(const Fingerprint& id, const Range& range, SparseData* out) {
+    std::vector<Chunk> found;
+    MappingPtr mapping;
+    {
+        boost::lock_guard<boost::mutex> lck(mMutex);
+        if (!mOpen) return false;
+
+        ChunkMap::iterator it = mChunks.find(id);
+        if (it == mChunks.end()) return false;
+
+        RangeList stored;
+        uint64 end = 0;
+        for(ChunkList::iterator chunk_it = it->second.begin(); chunk_it != it->second.end(); chunk_it++) {
+            const Range& r = chunk_it->range;
+            // Skip chunks that end before the range or start after it
+            if (r.startbyte() + r.length() <= range.startbyte()) continue;
+            if (!range.goesToEndOfFile() && r.startbyte() >= range.startbyte() + range.length()) continue;
+            found.push_back(*chunk_it);
+            r.addToList(r, stored);
+            end = std::max(end, chunk_it->offset + r.length());
+        }
+        if (found.empty() || !range.isContainedBy(stored))
+            return false;
+
+#if SIRIKATA_PLATFORM != SIRIKATA_PLATFORM_WINDOWS
+        mapping = mappingCovering(end);
+#endif
+        if (!mapping) {
+            // Without a mapping, fall back to copying the data
+            for(uint32 i = 0; i < found.size(); i++) {
+                MutableDenseDataPtr datum(new DenseData(found[i].range));
+                if (!readAt(mDataFD, found[i].offset, datum->writableData(), datum->length()))
+                    return false;
+                out->addValidData(datum);
+            }
+            return true;
+        }
+    }
+
+    // The mapping stays valid for as long as the views hold on to it, even
+    // if the store is compacted in the meantime.
+    for(uint32 i = 0; i < found.size(); i++) {
+        DenseDataPtr view(new DenseData(found[i].range, mapping->data() + found[i].offset, mapping));
+        out->addValidData(view);
+    }
+    return true;
+}
+
+void BlobStore::remove(const Fingerprint& id) {
+    boost::lock_guard<boost::mutex> lck(mMutex);
+    if (!mOpen) return;
+    if (mChunks.find(id) == mChunks.end()) return;
+
+    appendRecord(RecordRemove, id, Chunk(Range(true), 0));
+    removeChunks(id);
+    if (mCompacting)
+        mCompactChanges.push_back(Change(id, Chunk(Range(true), 0), true));
+}
+
+bool BlobStore::compact() {
+    boost::unique_lock<boost::mutex> lck(mMutex);
+    return compactLocked(lck);
+}
+
+bool BlobStore::maybeCompact() {
+    boost::unique_lock<boost::mutex> lck(mMutex);
+    if (!mOpen || mDataSize < MinCompactBytes) return false;
+    if (mDataSize - HeaderSize - mLiveBytes < mDataSize / 2) return false;
+    return compactLocked(lck);
+}
+
+bool BlobStore::compactLocked(boost::unique_lock<boost::mutex>& lck) {
+    if (!mOpen || mCompacting) return false;
+
+    uint32 old_gen = mGeneration;
+    uint32 new_gen = mGeneration + 1;
+    String new_data_path = dataPath(new_gen);
+    String new_index_path = indexPath(new_gen);
+    String temp_index_path = new_index_path + TempSuffix;
+
+    boost::system::error_code ec;
+    boost::filesystem::remove(new_data_path, ec);
+    boost::filesystem::remove(temp_index_path, ec);
+
+    int data_fd = openWithHeader(new_data_path, DataMagic);
+    int index_fd = openWithHeader(temp_index_path, IndexMagic);
+    bool success = (data_fd >= 0 && index_fd >= 0);
+
+    // Copy the live data without holding the lock, building the new index as
+    // we go. Data is only ever appended to the old data file, so the chunks
+    // in the snapshot stay put while we read them.
+    ChunkMap snapshot = mChunks;
+    int old_data_fd = mDataFD;
+    mCompacting = true;
+    lck.unlock();
+
+    uint64 data_size = HeaderSize;
+    std::vector<unsigned char> index;
+    std::vector<unsigned char> buffer;
+    for(ChunkMap::iterator it = snapshot.begin(); success && it != snapshot.end(); it++) {
+        for(ChunkList::iterator chunk_it = it->second.begin(); chunk_it != it->second.end(); chunk_it++) {
+            if (!copyData(old_data_fd, data_fd, it->first, chunk_it->range, chunk_it->offset, &data_size, &buffer, &index)) {
+                success = false;
+                break;
+            }
+        }
+    }
+
+    // Then add whatever changed in the meantime, in order, so replaying the
+    // new index ends up with the current contents
+    lck.lock();
+    mCompacting = false;
+    std::vector<Change> changes;
+    changes.swap(mCompactChanges);
+    if (!mOpen || mGeneration != old_gen)
+        success = false;
+    for(uint32 i = 0; success && i < changes.size(); i++) {
+        if (changes[i].removed) {
+            unsigned char rec[RecordSize];
+            encodeRecord(rec, RecordRemove, changes[i].id, changes[i].chunk.range, changes[i].chunk.offset);
+            index.insert(index.end(), rec, rec+RecordSize);
+        }
+        else if (!copyData(mDataFD, data_fd, changes[i].id, changes[i].chunk.range, changes[i].chunk.offset, &data_size, &buffer, &index)) {
+            success = false;
+        }
+    }
+
+    if (success && !index.empty())
+        success = writeAt(index_fd, HeaderSize, &index[0], index.size());
+
+    if (success) {
+        syncFile(data_fd);
+        syncFile(index_fd);
+    }
+    if (data_fd >= 0) closeFile(data_fd);
+    if (index_fd >= 0) closeFile(index_fd);
+
+    if (!success) {
+        SILOG(transfer,error,"Failed to compact blob store in " << mDir);
+        boost::filesystem::remove(new_data_path, ec);
+        boost::filesystem::remove(temp_index_path, ec);
+        return false;
+    }
+
+    // Renaming the index into place commits to the new generation
+    boost::filesystem::rename(temp_index_path, new_index_path, ec);
+    if (ec) {
+        SILOG(transfer,error,"Failed to commit compacted blob store: " << ec.message());
+        boost::filesystem::remove(new_data_path, ec);
+        boost::filesystem::remove(temp_index_path, ec);
+        return false;
+    }
+
+    uint64 old_size = mDataSize;
+    closeFiles();
+    boost::filesystem::remove(indexPath(old_gen), ec);
+    boost::filesystem::remove(dataPath(old_gen), ec);
+
+    if (!openGeneration(new_gen))
+        return false;
+    SILOG(transfer,detailed,"Compacted blob store from " << old_size << " to " << mDataSize << " bytes");
+    return true;
+}
+
+uint64 BlobStore::liveBytes() {
+    boost::lock_guard<boost::mutex> lck(mMutex);
+    return mLiveBytes;
+}
+
+uint64 BlobStore::totalBytes() {
+    boost::lock_guard<boost::mutex> lck(mMutex);
+    return mDataSize;
+}
+
+uint32 BlobStore::generation() {
+    boost::lock_guard<boost::mutex> lck(mMutex);
+    return mGeneration;
+}
+
+} // namespace Transfer
+} // namespace Sirikata
@@ -34,9 +34,11 @@
 #include <sirikata/core/transfer/HttpManager.hpp>
 #include <sirikata/core/transfer/URL.hpp>
 #include <sirikata/core/network/Address.hpp>
+#include <sirikata/core/options/CommonOptions.hpp>
 #include <liboauthcpp/liboauthcpp.h>
 
 #include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string/predicate.hpp>
 #include <sirikata/core/util/UUID.hpp>
 
 AUTO_SINGLETON_INSTANCE(Sirikata::Transfer::HttpManager);
@@ -44,6 +46,27 @@ AUTO_SINGLETON_INSTANCE(Sirikata::Transfer::HttpManager);
 namespace Sirikata {
 namespace Transfer {
 
+namespace {
+// Output end of the gzip decompression chain, appending to a response's data
+class DenseDataSink {
+public:
+    typedef char char_type;
+    typedef boost::iostreams::sink_tag category;
+
+    DenseDataSink(DenseData* data)
+     : mData(data)
+    {}
+
+    std::streamsize write(const char* s, std::streamsize n) {
+        mData->append(s, (size_t)n, true);
+        return n;
+    }
+
+private:
+    DenseData* mData;
+};
+} // namespace
+
 HttpManager& HttpManager::getSingleton() {
     return AutoSingleton<HttpManager>::getSingleton();
 }
@@ -52,7 +75,9 @@ void HttpManager::destroy() {
 }
 
 HttpManager::HttpManager()
-    : mNumTotalConnections(0) {
+    : mNumTotalConnections(0),
+      mPipelineDepth(std::max(GetOptionValue<uint32>(OPT_HTTP_PIPELINE_DEPTH), (uint32)1)),
+      mCoalesceRequests(GetOptionValue<bool>(OPT_HTTP_COALESCE_REQUESTS)) {
 
     EMPTY_PARSER_SETTINGS.on_message_begin = 0;
     EMPTY_PARSER_SETTINGS.on_header_field = 0;
@@ -90,7 +115,8 @@ HttpManager::~HttpManager() {
     //Clean up any data we still have to make sure anything
     //referencing the service pool is dead
     mRequestQueue.clear();
-    mRecycleBin.clear();
+    mConnections.clear();
+    mInFlight.clear();
 
     //Delete dummy worker and service pool
     mServicePool->stopWork();
@@ -116,7 +142,24 @@ String HttpManager::methodAsString(HTTP_METHOD m) {
 
 void HttpManager::makeRequest(Sirikata::Network::Address addr, HTTP_METHOD method, std::string req, bool allow_redirects, HttpCallback cb) {
 
-    std::tr1::shared_ptr<HttpRequest> r(new HttpRequest(addr, req, method, allow_redirects, cb));
+    HttpCallback request_cb = cb;
+    if (mCoalesceRequests && (method == GET || method == HEAD)) {
+        // Identical requests will get identical responses, so if one is
+        // already in flight just wait for its response
+        String key = addr.toString() + (allow_redirects ? " R " : " - ") + req;
+        boost::unique_lock<boost::mutex> lockInFlight(mInFlightLock);
+        InFlightType::iterator findInFlight = mInFlight.find(key);
+        if (findInFlight != mInFlight.end()) {
+            SILOG(transfer, detailed, "Coalescing request with identical in-flight request to " << addr.toString());
+            findInFlight->second.push_back(cb);
+            return;
+        }
+        mInFlight[key].push_back(cb);
+        request_cb = std::tr1::bind(&HttpManager::finish_coalesced, this, key,
+            std::tr1::placeholders::_1, std::tr1::placeholders::_2, std::tr1::placeholders::_3);
+    }
+
+    HttpRequestPtr r(new HttpRequest(addr, req, method, allow_redirects, request_cb));
 
     //Initialize http parser settings callbacks
     r->mHttpSettings = EMPTY_PARSER_SETTINGS;
@@ -138,16 +181,36 @@ void HttpManager::makeRequest(Sirikata::Network::Address addr, HTTP_METHOD metho
         SILOG(transfer, warning, "Parsing http request failed");
         boost::system::error_code ec;
         postCallback(
-            std::tr1::bind(cb, std::tr1::shared_ptr<HttpResponse>(), REQUEST_PARSING_FAILED, ec),
+            std::tr1::bind(request_cb, std::tr1::shared_ptr<HttpResponse>(), REQUEST_PARSING_FAILED, ec),
             "HttpManager::makeRequest callback"
         );
         return;
     }
 
+    Headers::const_iterator findConnection = r->mHeaders.find("Connection");
+    r->mPipelinable = (method == GET || method == HEAD) &&
+        (findConnection == r->mHeaders.end() || !boost::algorithm::iequals(findConnection->second, "close"));
+
     add_req(r);
     processQueue();
 }
 
+void HttpManager::finish_coalesced(const String& key, std::tr1::shared_ptr<HttpResponse> response,
+    ERR_TYPE error, const boost::system::error_code& boost_error)
+{
+    std::vector<HttpCallback> callbacks;
+    boost::unique_lock<boost::mutex> lockInFlight(mInFlightLock);
+    InFlightType::iterator findInFlight = mInFlight.find(key);
+    if (findInFlight != mInFlight.end()) {
+        callbacks.swap(findInFlight->second);
+        mInFlight.erase(findInFlight);
+    }
+    lockInFlight.unlock();
+
+    for(std::vector<HttpCallback>::iterator it = callbacks.begin(); it != callbacks.end(); it++)
+        (*it)(response, error, boost_error);
+}
+
 void HttpManager::makeRequest(
     Sirikata::Network::Address addr, HTTP_METHOD method, const String& path,
     HttpCallback cb,
@@ -310,38 +373,23 @@ void HttpManager::postMultipartForm(
 
 void HttpManager::processQueue() {
     SILOG(transfer, insane, "processQueue called, mNumTotalConnections = "
-            << mNumTotalConnections << " and recycle bin size = " << mRecycleBin.size()
+            << mNumTotalConnections << " and open connection hosts = " << mConnections.size()
             << " and size of hosts = " << mNumConnsPerAddr.size()
             << " and request queue size = " << mRequestQueue.size());
 
     boost::unique_lock<boost::mutex> lockQueue(mRequestQueueLock);
+    boost::unique_lock<boost::mutex> lockConnections(mConnectionsLock);
     boost::unique_lock<boost::mutex> lockNumConns(mNumConnsLock, boost::defer_lock);
 
     for (RequestQueueType::iterator req = mRequestQueue.begin(); req != mRequestQueue.end(); ) {
 
-        std::tr1::shared_ptr<TCPSocket> sock;
-
-        //First check the recycle bin to see if there's a connection already open we can use
-        boost::unique_lock<boost::mutex> lockRB(mRecycleBinLock); {
-            RecycleBinType::iterator findRec = mRecycleBin.find((*req)->addr);
-            if (findRec != mRecycleBin.end()) {
-                sock = findRec->second.front();
-                findRec->second.pop();
-                if (findRec->second.size() == 0) {
-                    mRecycleBin.erase(findRec);
-                }
-            }
-        }
-        lockRB.unlock();
-
-        if (sock) {
-            //SILOG(transfer, debug, "Reusing a connection for " << (*req)->addr.toString());
-            write_request(sock, *req);
+        //First check if there's a connection already open we can use
+        if (assign_request(*req)) {
             req = mRequestQueue.erase(req);
         } else {
 
             lockNumConns.lock(); {
-                //If nothing in the recycle bin, let's see if we can open a new connection
+                //If there's no open connection available, let's see if we can open a new connection
                 if (mNumTotalConnections < MAX_TOTAL_CONNECTIONS) {
                     NumConnsType::iterator findNumC = mNumConnsPerAddr.find((*req)->addr);
                     if (mNumTotalConnections < MAX_TOTAL_CONNECTIONS &&
@@ -362,20 +410,59 @@ void HttpManager::processQueue() {
 
                         req = mRequestQueue.erase(req);
                     } else {
-                        //No available recycled connections, can't open a new one, so do nothing
+                        //No available open connections, can't open a new one, so do nothing
                         req++;
                     }
                 } else {
-                    //No available recycled connections, can't open a new one, so do nothing
+                    //No available open connections, can't open a new one, so do nothing
                     req++;
                 }
             } lockNumConns.unlock();
         }
     }
 
+    lockConnections.unlock();
     lockQueue.unlock();
 }
 
+bool HttpManager::assign_request(HttpRequestPtr req) {
+    ConnectionsType::iterator findConns = mConnections.find(req->addr);
+    if (findConns == mConnections.end()) return false;
+
+    //Prefer an idle connection, otherwise the shortest pipeline
+    HttpConnectionPtr best;
+    size_t best_pending = 0;
+    for(ConnectionList::iterator it = findConns->second.begin(); it != findConns->second.end(); it++) {
+        boost::unique_lock<boost::mutex> lockConn((*it)->mMutex);
+        if (!can_accept(*it, req)) continue;
+        if (!best || (*it)->mPending.size() < best_pending) {
+            best = *it;
+            best_pending = best->mPending.size();
+            if (best_pending == 0) break;
+        }
+    }
+    if (!best) return false;
+
+    boost::unique_lock<boost::mutex> lockConn(best->mMutex);
+    //The connection may have finished or closed since we checked it
+    if (!can_accept(best, req)) return false;
+
+    //SILOG(transfer, debug, "Reusing a connection for " << req->addr.toString());
+    best->mPending.push_back(req);
+    write_requests(best);
+    return true;
+}
+
+bool HttpManager::can_accept(HttpConnectionPtr conn, HttpRequestPtr req) {
+    if (conn->mClosed) return false;
+    if (conn->mPending.empty()) return true;
+    //Everything after the first pending request was pipelined, so we only
+    //need to check the first to know they all were
+    return (req->mPipelinable && conn->mCanPipeline &&
+        conn->mPending.front()->mPipelinable &&
+        conn->mPending.size() < mPipelineDepth);
+}
+
 void HttpManager::decrement_connection(const Sirikata::Network::Address& addr) {
     //SILOG(transfer, debug, "Reducing number of connections by 1 for " << addr.toString());
     boost::unique_lock<boost::mutex> lockNumConns(mNumConnsLock); {
@@ -392,13 +479,13 @@ void HttpManager::decrement_connection(const Sirikata::Network::Address& addr) {
     lockNumConns.unlock();
 }
 
-void HttpManager::add_req(std::tr1::shared_ptr<HttpRequest> req) {
+void HttpManager::add_req(HttpRequestPtr req) {
     boost::unique_lock<boost::mutex> lockQueue(mRequestQueueLock);
     mRequestQueue.push_back(req);
     lockQueue.unlock();
 }
 
-void HttpManager::handle_resolve(std::tr1::shared_ptr<HttpRequest> req, const boost::system::error_code& err,
+void HttpManager::handle_resolve(HttpRequestPtr req, const boost::system::error_code& err,
         TCPResolver::iterator endpoint_iterator) {
     if (!err) {
         TCPEndPoint endpoint = *endpoint_iterator;
@@ -419,24 +506,123 @@ void HttpManager::handle_resolve(std::tr1::shared_ptr<HttpRequest> req, const bo
             add_req(req);
         }
 
-        add_req(req);
         processQueue();
     }
 }
 
-void HttpManager::write_request(std::tr1::shared_ptr<TCPSocket> socket, std::tr1::shared_ptr<HttpRequest> req) {
+void HttpManager::write_requests(HttpConnectionPtr conn) {
+    if (conn->mWriting || conn->mClosed || conn->mNumWritten == conn->mPending.size())
+        return;
+
+    //Send everything that's been assigned since the last write together
     std::tr1::shared_ptr<boost::asio::streambuf> request_ptr(new boost::asio::streambuf());
     std::ostream request_stream(request_ptr.get());
-    request_stream << req->req;
-    boost::asio::async_write(*socket, *request_ptr, boost::bind(
-            &HttpManager::handle_write_request, this, socket, req,
+    for(; conn->mNumWritten < conn->mPending.size(); conn->mNumWritten++)
+        request_stream << conn->mPending[conn->mNumWritten]->req;
+
+    conn->mWriting = true;
+    boost::asio::async_write(*(conn->socket), *request_ptr, boost::bind(
+            &HttpManager::handle_write_request, this, conn,
             boost::asio::placeholders::error, request_ptr));
 }
 
-void HttpManager::handle_connect(std::tr1::shared_ptr<TCPSocket> socket, std::tr1::shared_ptr<HttpRequest> req,
+void HttpManager::read_response(HttpConnectionPtr conn) {
+    if (conn->mReading || conn->mClosed || conn->mNumWritten == 0)
+        return;
+
+    if (!conn->mResponse)
+        start_response(conn.get());
+
+    conn->mReading = true;
+    conn->socket->async_read_some(boost::asio::buffer(conn->mBuffer), boost::bind(
+            &HttpManager::handle_read, this, conn,
+            boost::asio::placeholders::error,
+            boost::asio::placeholders::bytes_transferred));
+}
+
+void HttpManager::start_response(HttpConnection* conn) {
+    //Create a new response object for the oldest outstanding request
+    std::tr1::shared_ptr<HttpResponse> respPtr(new HttpResponse());
+    respPtr->mBytesSent = conn->mPending.front()->req.size();
+
+    //Initiate an empty DenseData
+    std::tr1::shared_ptr<DenseData> emptyData(new DenseData(Range(true)));
+    respPtr->mData = emptyData;
+
+    conn->mResponse = respPtr;
+}
+
+bool HttpManager::mark_closed(HttpConnectionPtr conn, std::deque<HttpRequestPtr>* requeue, std::deque<HttpRequestPtr>* aborted) {
+    if (conn->mClosed) return false;
+
+    conn->mClosed = true;
+    //Requests the server never saw can always be sent again. Ones we wrote may
+    //have been acted on already, so only idempotent ones can be retried
+    for(uint32 i = 0; i < conn->mPending.size(); i++) {
+        HttpRequestPtr req = conn->mPending[i];
+        if (i < conn->mNumWritten && req->method == POST)
+            aborted->push_back(req);
+        else
+            requeue->push_back(req);
+    }
+    conn->mPending.clear();
+    conn->mNumWritten = 0;
+    conn->mResponse.reset();
+    return true;
+}
+
+void HttpManager::close_connection(HttpConnectionPtr conn, const std::deque<HttpRequestPtr>& requeue,
+        const std::deque<HttpRequestPtr>& aborted) {
+    boost::unique_lock<boost::mutex> lockConnections(mConnectionsLock);
+    ConnectionsType::iterator findConns = mConnections.find(conn->addr);
+    if (findConns != mConnections.end()) {
+        ConnectionList::iterator findConn = std::find(findConns->second.begin(), findConns->second.end(), conn);
+        if (findConn != findConns->second.end())
+            findConns->second.erase(findConn);
+        if (findConns->second.empty())
+            mConnections.erase(findConns);
+    }
+    boost::unique_lock<boost::mutex> lockConn(conn->mMutex);
+    conn->socket->close();
+    lockConn.unlock();
+    lockConnections.unlock();
+
+    decrement_connection(conn->addr);
+    for(std::deque<HttpRequestPtr>::const_iterator it = aborted.begin(); it != aborted.end(); it++)
+        (*it)->cb(std::tr1::shared_ptr<HttpResponse>(), BOOST_ERROR, boost::asio::error::connection_aborted);
+    for(std::deque<HttpRequestPtr>::const_iterator it = requeue.begin(); it != requeue.end(); it++)
+        add_req(*it);
+    processQueue();
+}
+
+void HttpManager::handle_connect(std::tr1::shared_ptr<TCPSocket> socket, HttpRequestPtr req,
         const boost::system::error_code& err, TCPResolver::iterator endpoint_iterator) {
     if (!err) {
-        write_request(socket, req);
+        HttpConnectionPtr conn(new HttpConnection(req->addr, socket));
+
+        //Initialize http parser settings callbacks
+        conn->mHttpSettings = EMPTY_PARSER_SETTINGS;
+        conn->mHttpSettings.on_header_field = &HttpManager::on_header_field;
+        conn->mHttpSettings.on_header_value = &HttpManager::on_header_value;
+        conn->mHttpSettings.on_body = &HttpManager::on_body;
+        conn->mHttpSettings.on_headers_complete = &HttpManager::on_headers_complete;
+        conn->mHttpSettings.on_message_complete = &HttpManager::on_message_complete;
+
+        //Initialize the parser for parsing responses. The same parser handles
+        //every response on the connection
+        http_parser_init(&(conn->mHttpParser), HTTP_RESPONSE);
+
+        /*
+         * http-parser library uses this void * parameter to callbacks for user-defined data
+         * Store a pointer to the HttpConnection object so we can access it during static callbacks
+         */
+        conn->mHttpParser.data = static_cast<void *>(conn.get());
+
+        boost::unique_lock<boost::mutex> lockConnections(mConnectionsLock);
+        mConnections[req->addr].push_back(conn);
+        boost::unique_lock<boost::mutex> lockConn(conn->mMutex);
+        conn->mPending.push_back(req);
+        write_requests(conn);
     } else if (endpoint_iterator != TCPResolver::iterator()) {
         socket->close();
         TCPEndPoint endpoint = *endpoint_iterator;
@@ -460,173 +646,172 @@ void HttpManager::handle_connect(std::tr1::shared_ptr<TCPSocket> socket, std::tr
     }
 }
 
-void HttpManager::handle_write_request(std::tr1::shared_ptr<TCPSocket> socket, std::tr1::shared_ptr<HttpRequest> req,
+void HttpManager::handle_write_request(HttpConnectionPtr conn,
         const boost::system::error_code& err, std::tr1::shared_ptr<boost::asio::streambuf> request_stream) {
 
+    boost::unique_lock<boost::mutex> lockConn(conn->mMutex);
+    conn->mWriting = false;
+
     if (err) {
-        socket->close();
         SILOG(transfer, error, "Failed to write. Error = " << err.message());
-        decrement_connection(req->addr);
-        add_req(req);
-        processQueue();
+        std::deque<HttpRequestPtr> requeue, aborted;
+        if (mark_closed(conn, &requeue, &aborted)) {
+            lockConn.unlock();
+            close_connection(conn, requeue, aborted);
+        }
         return;
     }
 
-    //Create a new response object
-    std::tr1::shared_ptr<HttpResponse> respPtr(new HttpResponse());
-    respPtr->mBytesSent = req->req.size();
-
-    //Initiate an empty DenseData
-    std::tr1::shared_ptr<DenseData> emptyData(new DenseData(Range(true)));
-    respPtr->mData = emptyData;
-
-    //Initialize http parser settings callbacks
-    respPtr->mHttpSettings = EMPTY_PARSER_SETTINGS;
-    respPtr->mHttpSettings.on_header_field = &HttpManager::on_header_field;
-    respPtr->mHttpSettings.on_header_value = &HttpManager::on_header_value;
-    respPtr->mHttpSettings.on_body = &HttpManager::on_body;
-    respPtr->mHttpSettings.on_headers_complete = &HttpManager::on_headers_complete;
-    respPtr->mHttpSettings.on_message_complete = &HttpManager::on_message_complete;
-
-    //Initialize the parser for parsing a response
-    http_parser_init(&(respPtr->mHttpParser), HTTP_RESPONSE);
-
-    /*
-     * http-parser library uses this void * parameter to callbacks for user-defined data
-     * Store a pointer to the HttpResponse object so we can access it during static callbacks
-     */
-    respPtr->mHttpParser.data = static_cast<void *>(respPtr.get());
-
-    //Create a buffer for receiving from socket
-    std::tr1::shared_ptr<std::vector<unsigned char> > vecbuf(new std::vector<unsigned char>(SOCKET_BUFFER_SIZE));
-
-    //Read some data
-    socket->async_read_some(boost::asio::buffer(*vecbuf), boost::bind(
-            &HttpManager::handle_read, this, socket, req, vecbuf, respPtr,
-            boost::asio::placeholders::error,
-            boost::asio::placeholders::bytes_transferred));
+    //Send anything that was assigned while we were writing and make sure
+    //we're reading the responses
+    write_requests(conn);
+    read_response(conn);
 }
 
-void HttpManager::handle_read(std::tr1::shared_ptr<TCPSocket> socket, std::tr1::shared_ptr<HttpRequest> req,
-        std::tr1::shared_ptr<std::vector<unsigned char> > vecbuf, std::tr1::shared_ptr<HttpResponse> respPtr,
+void HttpManager::handle_read(HttpConnectionPtr conn,
         const boost::system::error_code& err, std::size_t bytes_transferred) {
 
     SILOG(transfer, insane, "handle_read triggered with bytes_transferred = " << bytes_transferred << " EOF? "
             << (err == boost::asio::error::eof ? "Y" : "N"));
 
+    boost::unique_lock<boost::mutex> lockConn(conn->mMutex);
+    conn->mReading = false;
+    if (conn->mClosed) return;
+
+    std::deque<HttpRequestPtr> requeue, aborted;
+
     if ((err || bytes_transferred == 0) && err != boost::asio::error::eof) {
-        SILOG(transfer, error, "Failed to write. Error = " << err.message());
-        socket->close();
-        decrement_connection(req->addr);
-        add_req(req);
-        processQueue();
+        SILOG(transfer, error, "Failed to read. Error = " << err.message());
+        if (mark_closed(conn, &requeue, &aborted)) {
+            lockConn.unlock();
+            close_connection(conn, requeue, aborted);
+        }
         return;
     }
 
-    respPtr->mBytesReceived += bytes_transferred;
+    if (conn->mResponse)
+        conn->mResponse->mBytesReceived += bytes_transferred;
 
-    //Parse the data we just got back from the socket
-    size_t nparsed = http_parser_execute(&(respPtr->mHttpParser), &(respPtr->mHttpSettings),
-            (const char *)(&((*vecbuf)[0])), bytes_transferred);
-
-    boost::system::error_code ec;
+    //Parse the data we just got back from the socket. This can finish any
+    //number of pipelined responses, which on_message_complete collects in
+    //mFinished
+    bool parse_failed = false;
+    size_t nparsed = http_parser_execute(&(conn->mHttpParser), &(conn->mHttpSettings),
+            (const char *)(&(conn->mBuffer[0])), bytes_transferred);
     if (nparsed != bytes_transferred) {
         SILOG(transfer, warning, "Failed to parse http response. nparsed=" << nparsed << " while bytes_transferred=" << bytes_transferred);
-        req->cb(std::tr1::shared_ptr<HttpResponse>(), RESPONSE_PARSING_FAILED, ec);
-        socket->close();
-        decrement_connection(req->addr);
-        processQueue();
-        return;
+        parse_failed = true;
     }
-
-    if (err == boost::asio::error::eof && bytes_transferred != 0) {
+    else if (err == boost::asio::error::eof && bytes_transferred != 0) {
         //Pass 0 as fourth parameter to parser to tell it that we got EOF
-        size_t nparsed = http_parser_execute(&(respPtr->mHttpParser), &(respPtr->mHttpSettings),
-                (const char *)(&((*vecbuf)[0])), 0);
+        size_t nparsed = http_parser_execute(&(conn->mHttpParser), &(conn->mHttpSettings),
+                (const char *)(&(conn->mBuffer[0])), 0);
         if (nparsed != 0) {
             SILOG(transfer, warning, "Failed to parse http response when giving EOF. nparsed=" << nparsed);
-            req->cb(std::tr1::shared_ptr<HttpResponse>(), RESPONSE_PARSING_FAILED, ec);
-            socket->close();
-            decrement_connection(req->addr);
-            processQueue();
-            return;
+            parse_failed = true;
         }
-
     }
 
-    if ((req->method == HEAD && respPtr->mHeaderComplete) ||
-        ((req->method == GET || req->method == POST) && respPtr->mMessageComplete)) {
-        //We're done
-
-        //If we didn't get any body data, erase the DenseData pointer
-        if (respPtr->mData->length() == 0) {
-            respPtr->mData.reset();
+    std::vector<std::pair<HttpRequestPtr, std::tr1::shared_ptr<HttpResponse> > > finished;
+    finished.swap(conn->mFinished);
+
+    //If this is Connection: Close or we reached EOF, then close connection,
+    //otherwise keep reading if there are still outstanding requests
+    bool close = parse_failed || err == boost::asio::error::eof;
+    for(uint32 i = 0; i < finished.size(); i++)
+        if (!finished[i].second->mKeepAlive) close = true;
+
+    HttpRequestPtr failed, broken;
+    bool closing = false;
+    if (close) {
+        //Any requests left after the responses we finished never got a
+        //complete response. The first written one may have been cut off, the
+        //rest weren't answered at all and are handled by mark_closed
+        HttpRequestPtr cutoff;
+        if (conn->mNumWritten > 0 && (parse_failed || err == boost::asio::error::eof))
+            cutoff = conn->mPending.front();
+        closing = mark_closed(conn, &requeue, &aborted);
+        if (cutoff) {
+            if (!requeue.empty() && requeue.front() == cutoff)
+                requeue.pop_front();
+            else
+                aborted.pop_front();
+            if (parse_failed)
+                failed = cutoff;
+            else
+                broken = cutoff;
         }
+    } else {
+        read_response(conn);
+    }
+    lockConn.unlock();
 
-        SILOG(transfer, detailed, "Finished http transfer with content length of " << respPtr->getContentLength());
-        Headers::const_iterator findLocation;
-        findLocation = respPtr->mHeaders.find("Location");
-        if (respPtr->getStatusCode() == 301 && findLocation != respPtr->mHeaders.end() && req->allow_redirects) {
-            SILOG(transfer, detailed, "Got a 301 redirect reply and location = " << findLocation->second);
-            std::ostringstream request_stream;
-            std::string request_method = methodAsString(req->method);
-            URL newURI(findLocation->second.c_str());
-            request_stream << request_method << " " << newURI.fullpath() << " HTTP/1.1\r\n";
-            Headers::const_iterator it;
-            for (it = req->mHeaders.begin(); it != req->mHeaders.end(); it++) {
-            	if (it->first == "Host") {
-            		request_stream << "Host: " << newURI.host() << "\r\n";
-            	} else {
-            		request_stream << it->first << ": " << it->second << "\r\n";
-            	}
-            }
-            request_stream << "\r\n";
-            Network::Address newaddr(newURI.host(), newURI.proto());
-            makeRequest(newaddr, req->method, request_stream.str(), req->allow_redirects, req->cb);
-        } else {
-            req->cb(respPtr, SUCCESS, ec);
-        }
+    for(uint32 i = 0; i < finished.size(); i++)
+        finish_request(finished[i].first, finished[i].second);
 
-        //If this is Connection: Close or we reached EOF, then close connection, otherwise recycle
-        if ((respPtr->mHttpParser.flags & F_CONNECTION_CLOSE) || err == boost::asio::error::eof) {
-            socket->close();
-            decrement_connection(req->addr);
-        } else {
-            boost::unique_lock<boost::mutex> lockRB(mRecycleBinLock);
-            mRecycleBin[req->addr].push(socket);
-            lockRB.unlock();
-        }
-        processQueue();
-
-    } else if(err == boost::asio::error::eof || bytes_transferred == 0) {
+    boost::system::error_code ec;
+    if (failed) {
+        failed->cb(std::tr1::shared_ptr<HttpResponse>(), RESPONSE_PARSING_FAILED, ec);
+    }
+    if (broken) {
         SILOG(transfer, warning, "EOF was true or bytes_transferred==0 and the parser wasn't finished, so connection is broken");
-        socket->close();
-        decrement_connection(req->addr);
-
-        req->mNumTries++;
-        if (req->mNumTries > 10) {
-            //This means this connection has gotten an error over 10 times. Let's stop trying
+        broken->mNumTries++;
+        if (broken->method == POST || broken->mNumTries > 10) {
+            //The server may have acted on a POST already, so it can't be
+            //retried. Otherwise this means this connection has gotten an
+            //error over 10 times. Let's stop trying
             //TODO: this should probably be configurable
-            req->cb(std::tr1::shared_ptr<HttpResponse>(), BOOST_ERROR, boost::asio::error::eof);
+            broken->cb(std::tr1::shared_ptr<HttpResponse>(), BOOST_ERROR, boost::asio::error::eof);
         } else {
-            add_req(req);
+            requeue.push_front(broken);
         }
+    }
 
+    if (closing)
+        close_connection(conn, requeue, aborted);
+    else
         processQueue();
-        return;
-    } else {
-        //Read some more data
-        socket->async_read_some(boost::asio::buffer(*vecbuf), boost::bind(
-                &HttpManager::handle_read, this, socket, req, vecbuf, respPtr,
-                boost::asio::placeholders::error,
-                boost::asio::placeholders::bytes_transferred));
+}
+
+void HttpManager::finish_request(HttpRequestPtr req, std::tr1::shared_ptr<HttpResponse> respPtr) {
+    //If we didn't get any body data, erase the DenseData pointer
+    if (respPtr->mData->length() == 0) {
+        respPtr->mData.reset();
     }
 
+    SILOG(transfer, detailed, "Finished http transfer with content length of " << respPtr->getContentLength());
+    Headers::const_iterator findLocation;
+    findLocation = respPtr->mHeaders.find("Location");
+    if (respPtr->getStatusCode() == 301 && findLocation != respPtr->mHeaders.end() && req->allow_redirects) {
+        SILOG(transfer, detailed, "Got a 301 redirect reply and location = " << findLocation->second);
+        std::ostringstream request_stream;
+        std::string request_method = methodAsString(req->method);
+        URL newURI(findLocation->second.c_str());
+        request_stream << request_method << " " << newURI.fullpath() << " HTTP/1.1\r\n";
+        Headers::const_iterator it;
+        for (it = req->mHeaders.begin(); it != req->mHeaders.end(); it++) {
+        	if (it->first == "Host") {
+        		request_stream << "Host: " << newURI.host() << "\r\n";
+        	} else {
+        		request_stream << it->first << ": " << it->second << "\r\n";
+        	}
+        }
+        request_stream << "\r\n";
+        Network::Address newaddr(newURI.host(), newURI.proto());
+        makeRequest(newaddr, req->method, request_stream.str(), req->allow_redirects, req->cb);
+    } else {
+        boost::system::error_code ec;
+        req->cb(respPtr, SUCCESS, ec);
+    }
 }
 
 int HttpManager::on_headers_complete(http_parser* _) {
     //SILOG(transfer, debug, "headers complete. content length = " << _->content_length);
-    HttpResponse* curResponse = static_cast<HttpResponse*>(_->data);
+    HttpConnection* conn = static_cast<HttpConnection*>(_->data);
+    HttpResponse* curResponse = conn->mResponse.get();
+    //Data after the responses to all our requests
+    if (!curResponse) return -1;
+
     curResponse->mContentLength = _->content_length;
     curResponse->mStatusCode = _->status_code;
 
@@ -635,18 +820,24 @@ int HttpManager::on_headers_complete(http_parser* _) {
         curResponse->mHeaders[curResponse->mTempHeaderField] = curResponse->mTempHeaderValue;
     }
 
-    //Check if Content-Encoding = gzip
+    //Check if Content-Encoding = gzip, and if so decompress as the body arrives
     Headers::const_iterator it = curResponse->mHeaders.find("Content-Encoding");
     if(it != curResponse->mHeaders.end() && it->second == "gzip") {
-        curResponse->mGzip = true;
+        curResponse->mDecompressor.reset(new boost::iostreams::filtering_ostream());
+        curResponse->mDecompressor->push(boost::iostreams::gzip_decompressor());
+        curResponse->mDecompressor->push(DenseDataSink(curResponse->mData.get()));
     }
 
     curResponse->mHeaderComplete = true;
-    return 0;
+
+    //Responses to HEAD requests never have a body, even if they have a
+    //Content-Length. Returning 1 tells the parser to skip it.
+    return (conn->mPending.front()->method == HEAD) ? 1 : 0;
 }
 
 int HttpManager::on_header_field(http_parser* _, const char* at, size_t len) {
-    HttpResponse* curResponse = static_cast<HttpResponse*>(_->data);
+    HttpResponse* curResponse = static_cast<HttpConnection*>(_->data)->mResponse.get();
+    if (!curResponse) return -1;
 
     //See http-parser documentation for why this is necessary
     switch (curResponse->mLastCallback) {
@@ -670,7 +861,8 @@ int HttpManager::on_header_field(http_parser* _, const char* at, size_t len) {
 
 int HttpManager::on_header_value(http_parser* _, const char* at, size_t len) {
     //SILOG(transfer, debug, "on_header_value called");
-    HttpResponse* curResponse = static_cast<HttpResponse*>(_->data);
+    HttpResponse* curResponse = static_cast<HttpConnection*>(_->data)->mResponse.get();
+    if (!curResponse) return -1;
 
     //See http-parser documentation for why this is necessary
     switch(curResponse->mLastCallback) {
@@ -754,11 +946,16 @@ int HttpManager::on_request_header_value(http_parser* _, const char* at, size_t
 
 int HttpManager::on_body(http_parser* _, const char* at, size_t len) {
     //SILOG(transfer, debug, "on_body called with length = " << len);
-    HttpResponse* curResponse = static_cast<HttpResponse*>(_->data);
-
-    if(curResponse->mGzip) {
-        //Gzip encoding, so pass this buffer through a decoder
-        curResponse->mCompressedStream.write(at, len);
+    HttpResponse* curResponse = static_cast<HttpConnection*>(_->data)->mResponse.get();
+    if (!curResponse) return -1;
+
+    if(curResponse->mDecompressor) {
+        //Gzip encoding, so pass this buffer through the decoder
+        curResponse->mDecompressor->write(at, len);
+        if (!*(curResponse->mDecompressor)) {
+            SILOG(transfer, warning, "Failed to decompress gzip encoded http response");
+            return -1;
+        }
     } else {
         //Raw encoding, so append the bytes in current body pointer directly to the DenseData pointer in our response
         curResponse->mData->append(at, len, true);
@@ -769,25 +966,53 @@ int HttpManager::on_body(http_parser* _, const char* at, size_t len) {
 
 int HttpManager::on_message_complete(http_parser* _) {
     //SILOG(transfer, debug, "message complete. content length = " << _->content_length);
-    HttpResponse* curResponse = static_cast<HttpResponse*>(_->data);
-
-    if(curResponse->mGzip) {
-        std::stringstream decompressed;
-        boost::iostreams::filtering_streambuf<boost::iostreams::input> out;
-        out.push(boost::iostreams::gzip_decompressor());
-        out.push(curResponse->mCompressedStream);
-        boost::iostreams::copy(out, decompressed);
-        curResponse->mCompressedStream.str("");
-        curResponse->mData->append(decompressed.str().c_str(), decompressed.str().length(), true);
-        curResponse->mContentLength = decompressed.str().length();
+    HttpConnection* conn = static_cast<HttpConnection*>(_->data);
+    HttpResponse* curResponse = conn->mResponse.get();
+    if (!curResponse) return -1;
+
+    if(curResponse->mDecompressor) {
+        //Flushes the remaining data through the decoder, which also checks
+        //the gzip trailer
+        try {
+            curResponse->mDecompressor->reset();
+        } catch(std::exception& e) {
+            SILOG(transfer, warning, "Failed to decompress gzip encoded http response: " << e.what());
+            return -1;
+        }
+        curResponse->mDecompressor.reset();
+        curResponse->mContentLength = curResponse->mData->length();
     }
 
     curResponse->mMessageComplete = true;
+    curResponse->mKeepAlive = should_keep_alive(_);
+    //Only pipeline requests to servers we know support persistent HTTP/1.1
+    //connections
+    if (curResponse->mKeepAlive && _->http_major == 1 && _->http_minor >= 1)
+        conn->mCanPipeline = true;
+
+    //Hand the response off and get ready for the next one, which may be in
+    //the same buffer
+    conn->mFinished.push_back(std::make_pair(conn->mPending.front(), conn->mResponse));
+    conn->mPending.pop_front();
+    conn->mNumWritten--;
+    conn->mResponse.reset();
+    if (!conn->mPending.empty())
+        start_response(conn);
+
     return 0;
 }
 
-void HttpManager::print_flags(std::tr1::shared_ptr<HttpResponse> resp) {
-    char flags = resp->mHttpParser.flags;
+bool HttpManager::should_keep_alive(http_parser* parser) {
+    if (parser->http_major > 0 && parser->http_minor > 0) {
+        //HTTP/1.1
+        return !(parser->flags & F_CONNECTION_CLOSE);
+    }
+    //HTTP/1.0 or earlier
+    return (parser->flags & F_CONNECTION_KEEP_ALIVE);
+}
+
+void HttpManager::print_flags(http_parser* parser, std::tr1::shared_ptr<HttpResponse> resp) {
+    char flags = parser->flags;
     SILOG(transfer, detailed, "Flags are: "
             << (flags & F_CHUNKED ? "F_CHUNKED " : "")
             << (flags & F_CONNECTION_KEEP_ALIVE ? "F_CONNECTION_KEEP_ALIVE " : "")
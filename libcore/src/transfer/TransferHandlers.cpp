@@ -17,7 +17,7 @@ const unsigned int SharedChunkCache::MEMORY_LRU_CACHE_SIZE = 1024 * 1024 * 50; /
 SharedChunkCache::SharedChunkCache() {
     //Use LRU for eviction
     mDiskCachePolicy = new LRUPolicy(DISK_LRU_CACHE_SIZE);
-    mMemoryCachePolicy = new LRUPolicy(MEMORY_LRU_CACHE_SIZE);
+    mMemoryCachePolicy = new ClockPolicy(MEMORY_LRU_CACHE_SIZE);
 
     //Make a disk cache as the bottom cache layer
     CacheLayer* diskCache = new DiskCacheLayer(mDiskCachePolicy, "HttpChunkHandlerCache", NULL);
@@ -36,10 +36,45 @@ void TransferMediator::destroy() {
 	DiskManager::destroy();
 }
 
+namespace {
+// How often stats are updated. The dispatcher otherwise only wakes up when
+// there's something to do.
+const Duration StatsInterval = Duration::seconds(1.0);
+// Latency this many times the base latency is treated as congestion...
+const float64 CongestionLatencyFactor = 2.0;
+// ...as long as it's also at least this much higher, so jitter doesn't count
+// for origins with tiny latencies, e.g. local files
+const Duration MinCongestionLatency = Duration::milliseconds((int64)10);
+}
+
+TransferMediator::OriginState::OriginState()
+ : limit(InitialOriginLimit),
+   outstanding(0),
+   baseLatency(Duration::zero()),
+   latency(Duration::zero()),
+   peakRate(0),
+   lastDecrease(Time::null()),
+   completed(0),
+   failed(0)
+{
+}
+
+TransferMediator::PoolStats::PoolStats()
+ : inFlight(0),
+   started(0),
+   completed(0),
+   totalQueueWait(Duration::zero()),
+   bytes(0),
+   periodBytes(0),
+   bytesPerSecond(0)
+{
+}
+
 TransferMediator::TransferMediator()
  : mContext(NULL)
 {
     mCleanup = false;
+    mWakeRequested = false;
     mNumOutstanding = 0;
     mAggregationAlgorithm = new MaxPriorityAggregation();
     mThread = new Thread("TransferMediator", std::tr1::bind(&TransferMediator::mediatorThread, this));
@@ -52,64 +87,163 @@ TransferMediator::~TransferMediator() {
 }
 
 void TransferMediator::mediatorThread() {
-    uint32 its = 0;
-    while(!mCleanup) {
+    Time last_stats = Timer::now();
+    while(true) {
+        {
+            boost::unique_lock<boost::mutex> lock(mWakeMutex);
+            while(!mWakeRequested && !mCleanup) {
+                Duration until_stats = StatsInterval - (Timer::now() - last_stats);
+                if (until_stats <= Duration::zero() ||
+                    !mWakeCV.timed_wait(lock, boost::posix_time::microseconds(until_stats.toMicroseconds())))
+                    break;
+            }
+            if (mCleanup) break;
+            mWakeRequested = false;
+        }
+
+        processPools();
         checkQueue();
-        // NOTE: This is tied specifically to the # of milliseconds below to
-        // give ~1sec granularity
-        if (its++ % 200 == 0)
-            updateStats();
-
-        /**
-           Ewen and I weren't able to identify why the below call caused a
-           deadlock on the shared space hosted on sns30 (could not reproduce on
-           other machines).  With the below line, in gdb, with bulletphysics on,
-           and servermap-options set to port 6880, we'd get 4 calls to
-           checkQueue, followed by no follow up calls.  Not sure what to say.
-         */
-        //boost::this_thread::sleep(boost::posix_time::milliseconds(5));
-        Timer::sleep(Duration::milliseconds(5));
-    }
-    for(PoolType::iterator pool = mPools.begin(); pool != mPools.end(); pool++) {
-        pool->second->cleanup();
-        pool->second->getTransferPool()->addRequest(std::tr1::shared_ptr<TransferRequest>());
-    }
-    for(PoolType::iterator pool = mPools.begin(); pool != mPools.end(); pool++) {
-        pool->second->getThread()->join();
+
+        Time now = Timer::now();
+        if (now - last_stats >= StatsInterval) {
+            updateStats(now - last_stats);
+            last_stats = now;
+        }
     }
 }
 
+void TransferMediator::wake() {
+    boost::unique_lock<boost::mutex> lock(mWakeMutex);
+    mWakeRequested = true;
+    mWakeCV.notify_one();
+}
+
 void TransferMediator::registerPool(TransferPoolPtr pool) {
-    //Lock exclusive to access map
-    boost::upgrade_lock<boost::shared_mutex> lock(mPoolMutex);
-    boost::upgrade_to_unique_lock<boost::shared_mutex> uniqueLock(lock);
+    {
+        //Lock exclusive to access map
+        boost::upgrade_lock<boost::shared_mutex> lock(mPoolMutex);
+        boost::upgrade_to_unique_lock<boost::shared_mutex> uniqueLock(lock);
 
-    //ensure client id doesnt already exist, they should be unique
-    PoolType::iterator findClientId = mPools.find(pool->getClientID());
-    assert(findClientId == mPools.end());
+        //ensure client id doesnt already exist, they should be unique
+        PoolType::iterator findClientId = mPools.find(pool->getClientID());
+        assert(findClientId == mPools.end());
 
-    std::tr1::shared_ptr<PoolWorker> worker(new PoolWorker(pool));
-    mPools.insert(PoolType::value_type(pool->getClientID(), worker));
+        pool->setRequestsAvailableCallback(std::tr1::bind(&TransferMediator::wake, this));
+        mPools.insert(PoolType::value_type(pool->getClientID(), pool));
+    }
+    {
+        boost::unique_lock<boost::mutex> lock(mAggMutex);
+        mPoolStats[pool->getClientID()] = PoolStats();
+    }
+    wake();
 }
 
 void TransferMediator::cleanup() {
-    if (mCleanup) return;
-
-    mCleanup = true;
+    {
+        boost::unique_lock<boost::mutex> lock(mWakeMutex);
+        if (mCleanup) return;
+        mCleanup = true;
+        mWakeCV.notify_one();
+    }
     mThread->join();
 }
 
+void TransferMediator::processPools() {
+    boost::shared_lock<boost::shared_mutex> pool_lock(mPoolMutex);
+    boost::unique_lock<boost::mutex> lock(mAggMutex);
+    for(PoolType::iterator pool_it = mPools.begin(); pool_it != mPools.end(); pool_it++) {
+        for(TransferRequestPtr req = pool_it->second->getRequest(); req; req = pool_it->second->getRequest())
+            addPoolRequest(req);
+    }
+}
+
+void TransferMediator::addPoolRequest(TransferRequestPtr req) {
+    AggregateListByID& idIndex = mAggregateList.get<tagID>();
+    AggregateListByID::iterator findID = idIndex.find(req->getIdentifier());
+
+    //Check if this request already exists
+    if(findID != idIndex.end()) {
+        //Check if this request is for deleting
+        if(req->isDeletionRequest()) {
+            const std::map<std::string, std::tr1::shared_ptr<TransferRequest> >&
+                allReqs = (*findID)->getTransferRequests();
+
+            std::map<std::string,
+                std::tr1::shared_ptr<TransferRequest> >::const_iterator findClient =
+                allReqs.find(req->getClientID());
+
+            /* If the client isn't in the aggregated request, it must have already
+             * been deleted, or the deletion request is invalid
+             */
+            if(findClient == allReqs.end()) {
+                return;
+            }
+
+            if(allReqs.size() > 1) {
+                /* If there are more than one, we need to just delete the single client
+                 * from the aggregate request
+                 */
+                (*findID)->removeClient(req->getClientID());
+            } else {
+                // If only one in the list, we can erase the entire request
+                mAggregateList.erase(findID);
+            }
+        } else {
+            //store original aggregated priority for later
+            Priority oldAggPriority = (*findID)->getPriority();
+
+            //Update the priority of this client
+            (*findID)->setClientPriority(req);
+
+            //And check if it's changed, we need to update the index
+            Priority newAggPriority = (*findID)->getPriority();
+            if(oldAggPriority != newAggPriority) {
+                //Convert the iterator to the priority one and update
+                AggregateListByPriority::iterator byPriority =
+                    mAggregateList.project<tagPriority>(findID);
+                AggregateListByPriority & priorityIndex =
+                    mAggregateList.get<tagPriority>();
+                priorityIndex.modify_key(byPriority, boost::lambda::_1=newAggPriority);
+            }
+        }
+    } else if (!req->isDeletionRequest()) {
+        //Make a new one and insert it
+        std::tr1::shared_ptr<AggregateRequest> newAggReq(new AggregateRequest(req));
+        newAggReq->mQueuedTime = Timer::now();
+        mAggregateList.insert(newAggReq);
+    }
+}
+
 void TransferMediator::execute_finished(std::tr1::shared_ptr<TransferRequest> req, std::string id) {
+    Time now = Timer::now();
     boost::unique_lock<boost::mutex> lock(mAggMutex, boost::defer_lock_t());
     lock.lock();
 
+    ExecutingMap::iterator exec_it = mExecuting.find(req.get());
+    if (exec_it != mExecuting.end()) {
+        const ExecutingRequest& exec = exec_it->second;
+        OriginState& origin = mOrigins[exec.origin];
+        origin.outstanding--;
+        updateOrigin(origin, exec, req, now);
+
+        uint64 bytes = req->bytesTransferred();
+        for(uint32 i = 0; i < exec.clients.size(); i++) {
+            PoolStats& stats = mPoolStats[exec.clients[i]];
+            if (stats.inFlight > 0) stats.inFlight--;
+            stats.completed++;
+            stats.bytes += bytes;
+            stats.periodBytes += bytes;
+        }
+        mExecuting.erase(exec_it);
+    }
+    mNumOutstanding--;
+
     AggregateListByID& idIndex = mAggregateList.get<tagID>();
     AggregateListByID::iterator findID = idIndex.find(id);
     if(findID == idIndex.end()) {
         //This can happen now if a request was canceled but it was already outstanding
-        mNumOutstanding--;
         lock.unlock();
-        checkQueue();
+        wake();
         return;
     }
 
@@ -124,47 +258,116 @@ void TransferMediator::execute_finished(std::tr1::shared_ptr<TransferRequest> re
 
     mAggregateList.erase(findID);
 
-    mNumOutstanding--;
     lock.unlock();
     SILOG(transfer, detailed, "done transfer mediator execute_finished");
-    checkQueue();
+    wake();
 }
 
-void TransferMediator::checkQueue() {
-    boost::unique_lock<boost::mutex> lock(mAggMutex, boost::defer_lock_t());
+void TransferMediator::updateOrigin(OriginState& origin, const ExecutingRequest& exec, TransferRequestPtr req, const Time& now) {
+    bool congested = true;
+    if (req->succeeded()) {
+        origin.completed++;
+
+        // Discount time spent transferring data so large transfers don't
+        // look like congestion.
+        Duration elapsed = now - exec.startTime;
+        uint64 bytes = req->bytesTransferred();
+        origin.peakRate *= 0.999;
+        if (bytes > 0)
+            origin.peakRate = std::max(origin.peakRate, bytes / std::max(elapsed.toSeconds(), 0.000001));
+        Duration latency = elapsed;
+        if (origin.peakRate > 0)
+            latency = latency - Duration::seconds(bytes / origin.peakRate);
+        if (latency < Duration::zero())
+            latency = Duration::zero();
+
+        if (origin.completed == 1 || latency < origin.baseLatency)
+            origin.baseLatency = latency;
+        else
+            origin.baseLatency = origin.baseLatency + (latency - origin.baseLatency) * 0.01;
+        origin.latency = (origin.completed == 1) ? latency : (origin.latency * 0.875 + latency * 0.125);
+
+        congested = (latency > origin.baseLatency * CongestionLatencyFactor + MinCongestionLatency);
+    }
+    else {
+        origin.failed++;
+    }
 
-    lock.lock();
+    if (congested) {
+        // Requests started before the last decrease were already subject to
+        // the same conditions, so only back off once per round trip.
+        if (exec.startTime > origin.lastDecrease) {
+            origin.limit = std::max(1.0, origin.limit / 2);
+            origin.lastDecrease = now;
+        }
+    }
+    else {
+        origin.limit = std::min((float64)MaxOriginOutstanding, origin.limit + 1.0 / origin.limit);
+    }
+}
 
-    AggregateListByPriority & priorityIndex = mAggregateList.get<tagPriority>();
-    AggregateListByPriority::iterator findTop = priorityIndex.begin();
+void TransferMediator::checkQueue() {
+    typedef std::vector< std::pair<TransferRequestPtr, std::string> > ToExecuteList;
+    ToExecuteList to_execute;
+    {
+        boost::unique_lock<boost::mutex> lock(mAggMutex);
 
-    if(findTop != priorityIndex.end()) {
-        std::string topId = (*findTop)->getIdentifier();
-        SILOG(transfer, detailed, priorityIndex.size() << " length agg list, top priority "
+        AggregateListByPriority & priorityIndex = mAggregateList.get<tagPriority>();
+        AggregateListByPriority::iterator findTop = priorityIndex.begin();
+
+        if(findTop != priorityIndex.end()) {
+            std::string topId = (*findTop)->getIdentifier();
+            SILOG(transfer, detailed, priorityIndex.size() << " length agg list, top priority "
                 << (*findTop)->getPriority() << " id " << topId);
-    }
+        }
+
+        // While we have free slots and there are items left, scan for items
+        // that haven't been started yet and whose origin isn't already at its
+        // limit.
+        Time now = Timer::now();
+        for(; findTop != priorityIndex.end() && mNumOutstanding < MaxOutstanding; findTop++) {
+            if ((*findTop)->mExecuting) continue;
+
+            std::tr1::shared_ptr<TransferRequest> req = (*findTop)->getSingleRequest();
+            String origin_id = req->getOrigin();
+            OriginState& origin = mOrigins[origin_id];
+            if (origin.outstanding >= (uint32)origin.limit) continue;
 
-    // While we have free slots and there are items left, scan for items that
-    // haven't been started yet that we can process.
-    while(findTop != priorityIndex.end() && mNumOutstanding < 10) {
-        if (!(*findTop)->mExecuting) {
             mNumOutstanding++;
+            origin.outstanding++;
             (*findTop)->mExecuting = true;
-            std::tr1::shared_ptr<TransferRequest> req = (*findTop)->getSingleRequest();
-            req->execute(
-                req,
-                std::tr1::bind(&TransferMediator::execute_finished, this,
-                    req, (*findTop)->getIdentifier())
-            );
+
+            ExecutingMap::iterator exec_it = mExecuting.insert(ExecutingMap::value_type(req.get(), ExecutingRequest()));
+            ExecutingRequest& exec = exec_it->second;
+            exec.origin = origin_id;
+            exec.startTime = now;
+            const std::map<std::string, std::tr1::shared_ptr<TransferRequest> >&
+                allReqs = (*findTop)->getTransferRequests();
+            for(std::map<std::string, std::tr1::shared_ptr<TransferRequest> >::const_iterator
+                    it = allReqs.begin(); it != allReqs.end(); it++) {
+                exec.clients.push_back(it->first);
+                PoolStats& stats = mPoolStats[it->first];
+                stats.inFlight++;
+                stats.started++;
+                stats.totalQueueWait += now - (*findTop)->mQueuedTime;
+            }
+
+            to_execute.push_back(std::make_pair(req, (*findTop)->getIdentifier()));
         }
-        findTop++;
     }
 
-    lock.unlock();
+    // Execute without holding the lock since requests may finish immediately
+    for(ToExecuteList::iterator it = to_execute.begin(); it != to_execute.end(); it++) {
+        it->first->execute(
+            it->first,
+            std::tr1::bind(&TransferMediator::execute_finished, this,
+                it->first, it->second)
+        );
+    }
 }
 
 
-void TransferMediator::updateStats() {
+void TransferMediator::updateStats(const Duration& elapsed) {
     uint32 names_resolved =
         MeerkatNameHandler::getSingleton().statsNamesResolved() +
         FileNameHandler::getSingleton().statsNamesResolved() +
@@ -210,6 +413,12 @@ void TransferMediator::updateStats() {
             uploads << " uploads, " << uploads_bytes_transferred << " uploads_bytes, " <<
             (mContext->simTime()-Time::null()).microseconds() << " time");
     }
+
+    boost::unique_lock<boost::mutex> lock(mAggMutex);
+    for(PoolStatsMap::iterator pool_it = mPoolStats.begin(); pool_it != mPoolStats.end(); pool_it++) {
+        pool_it->second.bytesPerSecond = pool_it->second.periodBytes / std::max(elapsed.toSeconds(), 0.001);
+        pool_it->second.periodBytes = 0;
+    }
 }
 
 
@@ -267,94 +476,6 @@ TransferMediator::AggregateRequest::AggregateRequest(std::tr1::shared_ptr<Transf
     setClientPriority(req);
 }
 
-/*
- * TransferMediator::PoolWorker definitions
- */
-
-TransferMediator::PoolWorker::PoolWorker(std::tr1::shared_ptr<TransferPool> transferPool)
-    : mTransferPool(transferPool), mCleanup(false) {
-    mWorkerThread = new Thread("TransferMediator Worker", std::tr1::bind(&PoolWorker::run, this));
-}
-
-std::tr1::shared_ptr<TransferPool> TransferMediator::PoolWorker::getTransferPool() const {
-    return mTransferPool;
-}
-
-Thread * TransferMediator::PoolWorker::getThread() const {
-    return mWorkerThread;
-}
-
-void TransferMediator::PoolWorker::cleanup() {
-    mCleanup = true;
-}
-
-void TransferMediator::PoolWorker::run() {
-    while(!mCleanup) {
-        std::tr1::shared_ptr<TransferRequest> req = TransferMediator::getRequest(mTransferPool);
-        if(req == NULL) {
-            continue;
-        }
-        //SILOG(transfer, debug, "worker got one!");
-
-        boost::unique_lock<boost::mutex> lock(TransferMediator::getSingleton().mAggMutex);
-        AggregateListByID& idIndex = TransferMediator::getSingleton().mAggregateList.get<tagID>();
-        AggregateListByID::iterator findID = idIndex.find(req->getIdentifier());
-
-        //Check if this request already exists
-        if(findID != idIndex.end()) {
-            //Check if this request is for deleting
-            if(req->isDeletionRequest()) {
-                const std::map<std::string, std::tr1::shared_ptr<TransferRequest> >&
-                    allReqs = (*findID)->getTransferRequests();
-
-                std::map<std::string,
-                    std::tr1::shared_ptr<TransferRequest> >::const_iterator findClient =
-                    allReqs.find(req->getClientID());
-
-                /* If the client isn't in the aggregated request, it must have already
-                 * been deleted, or the deletion request is invalid
-                 */
-                if(findClient == allReqs.end()) {
-                    continue;
-                }
-
-                if(allReqs.size() > 1) {
-                    /* If there are more than one, we need to just delete the single client
-                     * from the aggregate request
-                     */
-                    (*findID)->removeClient(req->getClientID());
-                } else {
-                    // If only one in the list, we can erase the entire request
-                    TransferMediator::getSingleton().mAggregateList.erase(findID);
-                }
-            } else {
-                //store original aggregated priority for later
-                Priority oldAggPriority = (*findID)->getPriority();
-
-                //Update the priority of this client
-                (*findID)->setClientPriority(req);
-
-                //And check if it's changed, we need to update the index
-                Priority newAggPriority = (*findID)->getPriority();
-                if(oldAggPriority != newAggPriority) {
-                    //Convert the iterator to the priority one and update
-                    AggregateListByPriority::iterator byPriority =
-                            TransferMediator::getSingleton().mAggregateList.project<tagPriority>(findID);
-                    AggregateListByPriority & priorityIndex =
-                            TransferMediator::getSingleton().mAggregateList.get<tagPriority>();
-                    priorityIndex.modify_key(byPriority, boost::lambda::_1=newAggPriority);
-                }
-            }
-        } else {
-            //Make a new one and insert it
-            //SILOG(transfer, debug, "worker id " << mTransferPool->getClientID() << " adding url " << req->getIdentifier());
-            std::tr1::shared_ptr<AggregateRequest> newAggReq(new AggregateRequest(req));
-            TransferMediator::getSingleton().mAggregateList.insert(newAggReq);
-        }
-
-    }
-}
-
 void TransferMediator::registerContext(Context* ctx) {
     mContext = ctx;
     if (ctx->commander()) {
@@ -376,6 +497,36 @@ void TransferMediator::commandListRequests(const Command::Command& cmd, Command:
         requests_ary.push_back(Command::Object());
         requests_ary.back().put("id", (*req_it)->getIdentifier());
         requests_ary.back().put("priority", (*req_it)->getPriority());
+        requests_ary.back().put("executing", (*req_it)->mExecuting);
+    }
+
+    result.put( String("pools"), Command::Array());
+    Command::Array& pools_ary = result.getArray("pools");
+    for(PoolStatsMap::iterator pool_it = mPoolStats.begin(); pool_it != mPoolStats.end(); pool_it++) {
+        const PoolStats& stats = pool_it->second;
+        pools_ary.push_back(Command::Object());
+        pools_ary.back().put("id", pool_it->first);
+        pools_ary.back().put("in_flight", stats.inFlight);
+        pools_ary.back().put("started", stats.started);
+        pools_ary.back().put("completed", stats.completed);
+        pools_ary.back().put("queue_wait_ms",
+            stats.started > 0 ? (stats.totalQueueWait.toSeconds() * 1000.0 / stats.started) : 0.0);
+        pools_ary.back().put("bytes", stats.bytes);
+        pools_ary.back().put("bytes_per_second", stats.bytesPerSecond);
+    }
+
+    result.put( String("origins"), Command::Array());
+    Command::Array& origins_ary = result.getArray("origins");
+    for(OriginMap::iterator origin_it = mOrigins.begin(); origin_it != mOrigins.end(); origin_it++) {
+        const OriginState& origin = origin_it->second;
+        origins_ary.push_back(Command::Object());
+        origins_ary.back().put("origin", origin_it->first);
+        origins_ary.back().put("limit", origin.limit);
+        origins_ary.back().put("outstanding", origin.outstanding);
+        origins_ary.back().put("latency_ms", origin.latency.toSeconds() * 1000.0);
+        origins_ary.back().put("base_latency_ms", origin.baseLatency.toSeconds() * 1000.0);
+        origins_ary.back().put("completed", origin.completed);
+        origins_ary.back().put("failed", origin.failed);
     }
 
     cmdr->result(cmdid, result);
@@ -7,10 +7,26 @@
 #include <sirikata/core/transfer/FileTransferHandler.hpp>
 #include <sirikata/core/transfer/HttpTransferHandler.hpp>
 #include <sirikata/core/transfer/DataTransferHandler.hpp>
+#include <sirikata/core/transfer/URL.hpp>
 
 namespace Sirikata {
 namespace Transfer {
 
+namespace {
+// Scheme and host, or just the scheme for URIs without a host, e.g. data: and
+// meerkat: URIs using the default CDN
+String uriOrigin(const URI& uri) {
+    URL url(uri);
+    if (url.empty() || url.host().empty())
+        return uri.scheme();
+    return uri.scheme() + "://" + url.host();
+}
+} // namespace
+
+String MetadataRequest::getOrigin() const {
+    return uriOrigin(mURI);
+}
+
 void MetadataRequest::execute(std::tr1::shared_ptr<TransferRequest> req, ExecuteFinished cb) {
     std::tr1::shared_ptr<MetadataRequest> casted =
       std::tr1::static_pointer_cast<MetadataRequest, TransferRequest>(req);
@@ -34,6 +50,11 @@ void MetadataRequest::execute(std::tr1::shared_ptr<TransferRequest> req, Execute
 }
 
 
+String ChunkRequest::getOrigin() const {
+    // The data comes from wherever the name resolved to
+    return uriOrigin(mMetadata->getURI());
+}
+
 void ChunkRequest::execute(std::tr1::shared_ptr<TransferRequest> req, ExecuteFinished cb) {
     std::tr1::shared_ptr<ChunkRequest> casted =
             std::tr1::static_pointer_cast<ChunkRequest, TransferRequest>(req);
@@ -101,6 +122,11 @@ void ChunkRequest::notifyCaller(TransferRequestPtr me, TransferRequestPtr from,
     SILOG(transfer, detailed, "done ChunkRequest notifyCaller");
 }
 
+String DirectChunkRequest::getOrigin() const {
+    // Always retrieved from the default CDN
+    return "meerkat";
+}
+
 void DirectChunkRequest::execute(std::tr1::shared_ptr<TransferRequest> req, ExecuteFinished cb) {
     std::tr1::shared_ptr<DirectChunkRequest> casted =
             std::tr1::static_pointer_cast<DirectChunkRequest, TransferRequest>(req);
@@ -139,6 +165,22 @@ const std::string& UploadRequest::getIdentifier() const {
     return mPath;
 }
 
+String UploadRequest::getOrigin() const {
+    // Only meerkat uploads are supported, see execute
+    return "meerkat";
+}
+
+bool UploadRequest::succeeded() const {
+    return !mUploadedPath.empty();
+}
+
+uint64 UploadRequest::bytesTransferred() const {
+    uint64 total = 0;
+    for(StringMap::const_iterator it = mFiles.begin(); it != mFiles.end(); it++)
+        total += it->second.size();
+    return total;
+}
+
 void UploadRequest::execute(TransferRequestPtr req, ExecuteFinished cb) {
     UploadRequestPtr casted =
         std::tr1::static_pointer_cast<UploadRequest>(req);
@@ -0,0 +1,501 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <sirikata/core/util/Standard.hh>
+#include <sirikata/core/util/CompactLocEncoding.hpp>
+
+// Message format. Integers are varints, signed integers are zigzag encoded
+// first:
+//
+//   [version : 1 byte] [precision : float32] [record count]
+//   [base time : microseconds] [origin x, y, z : signed, in units of precision]
+//   records...
+//
+// Each record is
+//
+//   [object : 16 bytes] [seqno, signed offset from the previous record's]
+//   [fields : 1 byte] followed by each field present, in the order of the
+//   CompactLocRecord::Field bits:
+//     epoch:        [epoch]
+//     location:     [t : signed offset from base time]
+//                   [position x, y, z : signed offset from origin]
+//                   [velocity x, y, z : signed]
+//     orientation:  [t : signed offset from base time]
+//                   [position : smallest three, 6 bytes]
+//                   [velocity : smallest three, 6 bytes, only if flagged in
+//                    position]
+//     bounds:       [center offset x, y, z, center radius, max size : float32]
+//     strings:      [(id << 1) | 1] for a reference to a string sent earlier,
+//                   or [id << 1] [length] [bytes] for the full string, where
+//                   id 0 means the string shouldn't be remembered
+//     index ids:    [count] [index id]...
+
+namespace Sirikata {
+
+namespace {
+
+const uint8 CompactLocVersion = CompactLocEncoder::Version;
+
+void writeVarint(String* out, uint64 v) {
+    do {
+        uint8 b = v & 0x7F;
+        v >>= 7;
+        if (v > 0) b |= 0x80;
+        out->push_back((char)b);
+    } while(v > 0);
+}
+
+void writeSignedVarint(String* out, int64 v) {
+    writeVarint(out, (uint64)((v << 1) ^ (v >> 63)));
+}
+
+void writeFloat(String* out, float32 v) {
+    uint32 bits;
+    memcpy(&bits, &v, sizeof(bits));
+    for(int i = 0; i < 4; i++)
+        out->push_back((char)((bits >> (8*i)) & 0xFF));
+}
+
+bool readVarint(const uint8*& pos, const uint8* end, uint64* v) {
+    *v = 0;
+    for(uint32 shift = 0; shift < 64; shift += 7) {
+        if (pos >= end) return false;
+        uint8 b = *pos++;
+        *v |= (uint64)(b & 0x7F) << shift;
+        if ((b & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+bool readSignedVarint(const uint8*& pos, const uint8* end, int64* v) {
+    uint64 zz;
+    if (!readVarint(pos, end, &zz)) return false;
+    *v = (int64)(zz >> 1) ^ -(int64)(zz & 1);
+    return true;
+}
+
+bool readFloat(const uint8*& pos, const uint8* end, float32* v) {
+    if (end - pos < 4) return false;
+    uint32 bits = 0;
+    for(int i = 0; i < 4; i++)
+        bits |= (uint32)pos[i] << (8*i);
+    memcpy(v, &bits, sizeof(bits));
+    pos += 4;
+    return true;
+}
+
+int64 timeMicroseconds(const Time& t) {
+    return (t - Time::null()).toMicroseconds();
+}
+
+// Smallest three quaternion encoding: the largest component is dropped (and
+// made positive by negating the quaternion, which represents the same
+// rotation) and the remaining three, which must be within +/- 1/sqrt(2), are
+// stored with 15 bits each. Together with 2 bits for the index of the dropped
+// component, this leaves one bit free for a flag.
+const float32 SmallestThreeRange = 0.70710678f;
+const uint32 SmallestThreeMax = (1 << 15) - 1;
+
+void writeSmallestThree(String* out, const Quaternion& q_in, bool flag) {
+    Quaternion q = q_in;
+    float32 len = sqrt(q.x*q.x + q.y*q.y + q.z*q.z + q.w*q.w);
+    if (len > 1e-08f)
+        q = Quaternion(q.x/len, q.y/len, q.z/len, q.w/len, Quaternion::XYZW());
+    else
+        q = Quaternion::identity();
+
+    float32 comps[4] = { q.x, q.y, q.z, q.w };
+    uint32 largest = 0;
+    for(uint32 i = 1; i < 4; i++)
+        if (fabs(comps[i]) > fabs(comps[largest])) largest = i;
+    float32 sign = (comps[largest] < 0.f) ? -1.f : 1.f;
+
+    uint64 packed = largest;
+    uint32 shift = 2;
+    for(uint32 i = 0; i < 4; i++) {
+        if (i == largest) continue;
+        float32 normalized = (comps[i] * sign / SmallestThreeRange + 1.f) * 0.5f;
+        int32 quantized = (int32)floor(normalized * SmallestThreeMax + 0.5f);
+        if (quantized < 0) quantized = 0;
+        if (quantized > (int32)SmallestThreeMax) quantized = SmallestThreeMax;
+        packed |= (uint64)quantized << shift;
+        shift += 15;
+    }
+    if (flag)
+        packed |= (uint64)1 << 47;
+
+    for(int i = 0; i < 6; i++)
+        out->push_back((char)((packed >> (8*i)) & 0xFF));
+}
+
+bool readSmallestThree(const uint8*& pos, const uint8* end, Quaternion* q, bool* flag) {
+    if (end - pos < 6) return false;
+    uint64 packed = 0;
+    for(int i = 0; i < 6; i++)
+        packed |= (uint64)pos[i] << (8*i);
+    pos += 6;
+
+    uint32 largest = packed & 0x3;
+    float32 comps[4];
+    float32 sum_sq = 0.f;
+    uint32 shift = 2;
+    for(uint32 i = 0; i < 4; i++) {
+        if (i == largest) continue;
+        uint32 quantized = (packed >> shift) & SmallestThreeMax;
+        comps[i] = ((float32)quantized / SmallestThreeMax * 2.f - 1.f) * SmallestThreeRange;
+        sum_sq += comps[i] * comps[i];
+        shift += 15;
+    }
+    comps[largest] = sqrt(std::max(0.f, 1.f - sum_sq));
+
+    *q = Quaternion(comps[0], comps[1], comps[2], comps[3], Quaternion::XYZW());
+    *flag = ((packed >> 47) & 0x1) != 0;
+    return true;
+}
+
+bool isIdentity(const Quaternion& q) {
+    return (q.x == 0.f && q.y == 0.f && q.z == 0.f && (q.w == 1.f || q.w == -1.f));
+}
+
+} // namespace
+
+
+const float32 CompactLocEncoder::DefaultPrecision = 0.001f;
+
+CompactLocEncoder::CompactLocEncoder(float32 precision)
+ : mPrecision(precision),
+   mCount(0),
+   mHaveOrigin(false),
+   mBaseTime(0),
+   mLastSeqno(0),
+   mNextStringID(1),
+   mNextMessageID(0)
+{
+    mOrigin[0] = mOrigin[1] = mOrigin[2] = 0;
+    // IDs start at 1 since 0 indicates a string without an ID
+    mStringsByID.push_back(NULL);
+}
+
+int64 CompactLocEncoder::quantize(float32 v) const {
+    return (int64)floor((float64)v / mPrecision + 0.5);
+}
+
+void CompactLocEncoder::add(const CompactLocRecord& rec) {
+    // Pick the origin and base time from the first record that has them so
+    // other nearby objects end up with small offsets.
+    if (!mHaveOrigin && (rec.has(CompactLocRecord::LocationField) || rec.has(CompactLocRecord::OrientationField))) {
+        mHaveOrigin = true;
+        if (rec.has(CompactLocRecord::LocationField)) {
+            Vector3f pos = rec.location.position();
+            mOrigin[0] = quantize(pos.x);
+            mOrigin[1] = quantize(pos.y);
+            mOrigin[2] = quantize(pos.z);
+            mBaseTime = timeMicroseconds(rec.location.updateTime());
+        }
+        else {
+            mBaseTime = timeMicroseconds(rec.orientation.updateTime());
+        }
+    }
+
+    mBody.append((const char*)rec.object.getArray().data(), UUID::static_size);
+    writeSignedVarint(&mBody, (int64)(rec.seqno - mLastSeqno));
+    mLastSeqno = rec.seqno;
+    mBody.push_back((char)rec.fields);
+
+    if (rec.has(CompactLocRecord::EpochField))
+        writeVarint(&mBody, rec.epoch);
+
+    if (rec.has(CompactLocRecord::LocationField)) {
+        writeSignedVarint(&mBody, timeMicroseconds(rec.location.updateTime()) - mBaseTime);
+        Vector3f pos = rec.location.position();
+        writeSignedVarint(&mBody, quantize(pos.x) - mOrigin[0]);
+        writeSignedVarint(&mBody, quantize(pos.y) - mOrigin[1]);
+        writeSignedVarint(&mBody, quantize(pos.z) - mOrigin[2]);
+        Vector3f vel = rec.location.velocity();
+        writeSignedVarint(&mBody, quantize(vel.x));
+        writeSignedVarint(&mBody, quantize(vel.y));
+        writeSignedVarint(&mBody, quantize(vel.z));
+    }
+
+    if (rec.has(CompactLocRecord::OrientationField)) {
+        writeSignedVarint(&mBody, timeMicroseconds(rec.orientation.updateTime()) - mBaseTime);
+        bool has_velocity = !isIdentity(rec.orientation.velocity());
+        writeSmallestThree(&mBody, rec.orientation.position(), has_velocity);
+        if (has_velocity)
+            writeSmallestThree(&mBody, rec.orientation.velocity(), false);
+    }
+
+    if (rec.has(CompactLocRecord::BoundsField)) {
+        writeFloat(&mBody, rec.bounds.centerOffset.x);
+        writeFloat(&mBody, rec.bounds.centerOffset.y);
+        writeFloat(&mBody, rec.bounds.centerOffset.z);
+        writeFloat(&mBody, rec.bounds.centerBoundsRadius);
+        writeFloat(&mBody, rec.bounds.maxObjectRadius);
+    }
+
+    if (rec.has(CompactLocRecord::MeshField))
+        encodeString(rec.mesh);
+    if (rec.has(CompactLocRecord::PhysicsField))
+        encodeString(rec.physics);
+    if (rec.has(CompactLocRecord::QueryDataField))
+        encodeString(rec.query_data);
+
+    if (rec.has(CompactLocRecord::IndexIDsField)) {
+        writeVarint(&mBody, rec.index_ids.size());
+        for(uint32 i = 0; i < rec.index_ids.size(); i++)
+            writeVarint(&mBody, rec.index_ids[i]);
+    }
+
+    mCount++;
+}
+
+void CompactLocEncoder::encodeString(const String& str) {
+    StringIDMap::iterator it = mStringIDs.find(str);
+    if (it == mStringIDs.end()) {
+        if (mStringIDs.size() >= MaxStringIDs) {
+            // Out of space, send it without an ID
+            writeVarint(&mBody, 0);
+            writeVarint(&mBody, str.size());
+            mBody.append(str);
+            return;
+        }
+        StringInfo info;
+        info.id = mNextStringID++;
+        info.delivered = false;
+        // Make sure it doesn't look like it's already in this message
+        info.definedIn = mNextMessageID - 1;
+        it = mStringIDs.insert(StringIDMap::value_type(str, info)).first;
+        mStringsByID.push_back(&it->second);
+    }
+
+    StringInfo& info = it->second;
+    // References are safe if the subscriber is known to have the string or
+    // it's already earlier in this message.
+    if (info.delivered || info.definedIn == mNextMessageID) {
+        writeVarint(&mBody, ((uint64)info.id << 1) | 1);
+        return;
+    }
+
+    writeVarint(&mBody, (uint64)info.id << 1);
+    writeVarint(&mBody, str.size());
+    mBody.append(str);
+    info.definedIn = mNextMessageID;
+    mDefinedStrings.push_back(info.id);
+}
+
+uint32 CompactLocEncoder::finish(String* out) {
+    out->clear();
+    out->reserve(mBody.size() + 32);
+    out->push_back((char)CompactLocVersion);
+    writeFloat(out, mPrecision);
+    writeVarint(out, mCount);
+    writeVarint(out, (uint64)mBaseTime);
+    for(int i = 0; i < 3; i++)
+        writeSignedVarint(out, mOrigin[i]);
+    out->append(mBody);
+
+    uint32 msg_id = mNextMessageID++;
+    if (!mDefinedStrings.empty()) {
+        // If we never hear back about some messages, forget about the oldest
+        // ones. Their strings will just be sent in full again.
+        if (mUndelivered.size() >= MaxUndeliveredMessages)
+            mUndelivered.erase(mUndelivered.begin());
+        mUndelivered[msg_id].swap(mDefinedStrings);
+    }
+
+    clearMessage();
+
+    return msg_id;
+}
+
+void CompactLocEncoder::clear() {
+    // Strings defined in the discarded message refer to its ID, so it has to
+    // be used up to avoid them looking like they're in the next message.
+    mNextMessageID++;
+    clearMessage();
+}
+
+void CompactLocEncoder::clearMessage() {
+    mBody.clear();
+    mCount = 0;
+    mHaveOrigin = false;
+    mOrigin[0] = mOrigin[1] = mOrigin[2] = 0;
+    mBaseTime = 0;
+    mLastSeqno = 0;
+    mDefinedStrings.clear();
+}
+
+void CompactLocEncoder::delivered(uint32 msg_id) {
+    UndeliveredMessageMap::iterator msg_it = mUndelivered.find(msg_id);
+    if (msg_it == mUndelivered.end()) return;
+
+    const std::vector<uint32>& ids = msg_it->second;
+    for(uint32 i = 0; i < ids.size(); i++)
+        mStringsByID[ids[i]]->delivered = true;
+    mUndelivered.erase(msg_it);
+}
+
+void CompactLocEncoder::dropped(uint32 msg_id) {
+    mUndelivered.erase(msg_id);
+}
+
+void CompactLocEncoder::reset() {
+    // The IDs are kept so they still match any the subscriber has, we just
+    // stop assuming it has them.
+    for(StringIDMap::iterator it = mStringIDs.begin(); it != mStringIDs.end(); it++)
+        it->second.delivered = false;
+    mUndelivered.clear();
+}
+
+
+
+CompactLocDecoder::CompactLocDecoder()
+{
+}
+
+bool CompactLocDecoder::decodeString(const uint8*& pos, const uint8* end, String* out, bool* known) {
+    uint64 tag;
+    if (!readVarint(pos, end, &tag)) return false;
+    uint64 id = tag >> 1;
+
+    if (tag & 1) {
+        *known = (id < mHaveString.size() && mHaveString[id]);
+        if (*known)
+            *out = mStrings[id];
+        return true;
+    }
+
+    uint64 len;
+    if (!readVarint(pos, end, &len)) return false;
+    if (len > (uint64)(end - pos)) return false;
+    out->assign((const char*)pos, len);
+    pos += len;
+    *known = true;
+
+    if (id != 0) {
+        // Don't let a bad ID make us allocate huge tables
+        if (id > CompactLocEncoder::MaxStringIDs) return false;
+        if (id >= mStrings.size()) {
+            mStrings.resize(id+1);
+            mHaveString.resize(id+1, false);
+        }
+        mStrings[id] = *out;
+        mHaveString[id] = true;
+    }
+    return true;
+}
+
+bool CompactLocDecoder::decode(const void* data, uint32 len, std::vector<CompactLocRecord>* out) {
+    const uint8* pos = (const uint8*)data;
+    const uint8* end = pos + len;
+
+    if (pos >= end || *pos != CompactLocVersion) return false;
+    pos++;
+
+    float32 precision;
+    uint64 count, base_time_raw;
+    int64 origin[3];
+    if (!readFloat(pos, end, &precision) ||
+        !readVarint(pos, end, &count) ||
+        !readVarint(pos, end, &base_time_raw) ||
+        !readSignedVarint(pos, end, &origin[0]) ||
+        !readSignedVarint(pos, end, &origin[1]) ||
+        !readSignedVarint(pos, end, &origin[2]))
+        return false;
+    int64 base_time = (int64)base_time_raw;
+
+    uint64 last_seqno = 0;
+    for(uint64 i = 0; i < count; i++) {
+        CompactLocRecord rec;
+
+        if (end - pos < UUID::static_size) return false;
+        rec.object = UUID(pos, UUID::static_size);
+        pos += UUID::static_size;
+
+        int64 seqno_offset;
+        if (!readSignedVarint(pos, end, &seqno_offset)) return false;
+        rec.seqno = last_seqno + seqno_offset;
+        last_seqno = rec.seqno;
+
+        if (pos >= end) return false;
+        rec.fields = *pos++;
+
+        if (rec.has(CompactLocRecord::EpochField)) {
+            if (!readVarint(pos, end, &rec.epoch)) return false;
+        }
+
+        if (rec.has(CompactLocRecord::LocationField)) {
+            int64 t, p[3], v[3];
+            if (!readSignedVarint(pos, end, &t)) return false;
+            for(int j = 0; j < 3; j++)
+                if (!readSignedVarint(pos, end, &p[j])) return false;
+            for(int j = 0; j < 3; j++)
+                if (!readSignedVarint(pos, end, &v[j])) return false;
+            rec.location = TimedMotionVector3f(
+                Time::null() + Duration::microseconds(base_time + t),
+                MotionVector3f(
+                    Vector3f((origin[0] + p[0]) * precision, (origin[1] + p[1]) * precision, (origin[2] + p[2]) * precision),
+                    Vector3f(v[0] * precision, v[1] * precision, v[2] * precision)
+                )
+            );
+        }
+
+        if (rec.has(CompactLocRecord::OrientationField)) {
+            int64 t;
+            if (!readSignedVarint(pos, end, &t)) return false;
+            Quaternion orient_pos, orient_vel = Quaternion::identity();
+            bool has_velocity, unused;
+            if (!readSmallestThree(pos, end, &orient_pos, &has_velocity)) return false;
+            if (has_velocity && !readSmallestThree(pos, end, &orient_vel, &unused)) return false;
+            rec.orientation = TimedMotionQuaternion(
+                Time::null() + Duration::microseconds(base_time + t),
+                MotionQuaternion(orient_pos, orient_vel)
+            );
+        }
+
+        if (rec.has(CompactLocRecord::BoundsField)) {
+            if (!readFloat(pos, end, &rec.bounds.centerOffset.x) ||
+                !readFloat(pos, end, &rec.bounds.centerOffset.y) ||
+                !readFloat(pos, end, &rec.bounds.centerOffset.z) ||
+                !readFloat(pos, end, &rec.bounds.centerBoundsRadius) ||
+                !readFloat(pos, end, &rec.bounds.maxObjectRadius))
+                return false;
+        }
+
+        // References to strings we don't have can only happen if the encoder
+        // was told a message was delivered when it wasn't. The best we can do
+        // is drop the field, which leaves the old value in place.
+        bool known;
+        if (rec.has(CompactLocRecord::MeshField)) {
+            if (!decodeString(pos, end, &rec.mesh, &known)) return false;
+            if (!known) rec.fields &= ~CompactLocRecord::MeshField;
+        }
+        if (rec.has(CompactLocRecord::PhysicsField)) {
+            if (!decodeString(pos, end, &rec.physics, &known)) return false;
+            if (!known) rec.fields &= ~CompactLocRecord::PhysicsField;
+        }
+        if (rec.has(CompactLocRecord::QueryDataField)) {
+            if (!decodeString(pos, end, &rec.query_data, &known)) return false;
+            if (!known) rec.fields &= ~CompactLocRecord::QueryDataField;
+        }
+
+        if (rec.has(CompactLocRecord::IndexIDsField)) {
+            uint64 nids;
+            if (!readVarint(pos, end, &nids)) return false;
+            if (nids > (uint64)(end - pos)) return false;
+            rec.index_ids.resize(nids);
+            for(uint64 j = 0; j < nids; j++) {
+                uint64 index_id;
+                if (!readVarint(pos, end, &index_id)) return false;
+                rec.index_ids[j] = (uint32)index_id;
+            }
+        }
+
+        out->push_back(rec);
+    }
+
+    return (pos == end);
+}
+
+} // namespace Sirikata
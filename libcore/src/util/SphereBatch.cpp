@@ -0,0 +1,226 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <sirikata/core/util/Standard.hh>
+#include <sirikata/core/util/SphereBatch.hpp>
+#include <float.h>
+
+// Only use SSE when scalar float math is also done in SSE registers, otherwise
+// x87 excess precision could make the scalar version disagree with it.
+#if (defined(__SSE__) && defined(__SSE_MATH__)) || defined(_M_X64)
+#define SIRIKATA_SPHERE_BATCH_SSE 1
+#include <xmmintrin.h>
+#endif
+
+namespace Sirikata {
+
+const float32 SphereBatchQuery::NoMaxDistance = FLT_MAX;
+
+SphereBatchQuery::SphereBatchQuery(const Vector3f& center, float32 region_radius, float32 max_distance, const SolidAngle& min_angle)
+ : mCenter(center),
+   mRegionRadius(region_radius),
+   mMaxDistance(max_distance),
+   mMinAngle(min_angle)
+{
+    float32 angle_frac = mMinAngle.asFloat() / (2.0f * SolidAngle::Pi);
+    float32 angle_invert_frac = (1.0f - angle_frac);
+    mInvertSquaredFrac = 1.0f - angle_invert_frac*angle_invert_frac;
+}
+
+
+SphereBatch::SphereBatch(const Time& epoch)
+ : mEpoch(epoch)
+{
+}
+
+float32 SphereBatch::timeOffset(const Time& t) const {
+    return (float32)(t - mEpoch).toSeconds();
+}
+
+void SphereBatch::rebase(const Time& epoch) {
+    float32 dt_epoch = timeOffset(epoch);
+    for(uint32 i = 0; i < size(); i++) {
+        float32 dt = dt_epoch - mTime[i];
+        mPosX[i] = mPosX[i] + mVelX[i] * dt;
+        mPosY[i] = mPosY[i] + mVelY[i] * dt;
+        mPosZ[i] = mPosZ[i] + mVelZ[i] * dt;
+        mTime[i] = 0.f;
+    }
+    mEpoch = epoch;
+}
+
+void SphereBatch::clear() {
+    mPosX.clear(); mPosY.clear(); mPosZ.clear();
+    mVelX.clear(); mVelY.clear(); mVelZ.clear();
+    mTime.clear();
+    mRadius.clear();
+    mMaxSize.clear();
+}
+
+void SphereBatch::reserve(uint32 n) {
+    mPosX.reserve(n); mPosY.reserve(n); mPosZ.reserve(n);
+    mVelX.reserve(n); mVelY.reserve(n); mVelZ.reserve(n);
+    mTime.reserve(n);
+    mRadius.reserve(n);
+    mMaxSize.reserve(n);
+}
+
+uint32 SphereBatch::add(const TimedMotionVector3f& loc, float32 radius, float32 max_size) {
+    uint32 idx = size();
+    mPosX.push_back(0.f); mPosY.push_back(0.f); mPosZ.push_back(0.f);
+    mVelX.push_back(0.f); mVelY.push_back(0.f); mVelZ.push_back(0.f);
+    mTime.push_back(0.f);
+    mRadius.push_back(radius);
+    mMaxSize.push_back(max_size);
+    set(idx, loc);
+    return idx;
+}
+
+void SphereBatch::update(uint32 idx, const TimedMotionVector3f& loc, float32 radius, float32 max_size) {
+    set(idx, loc);
+    mRadius[idx] = radius;
+    mMaxSize[idx] = max_size;
+}
+
+void SphereBatch::updateLocation(uint32 idx, const TimedMotionVector3f& loc) {
+    set(idx, loc);
+}
+
+void SphereBatch::set(uint32 idx, const TimedMotionVector3f& loc) {
+    const Vector3f& pos = loc.position();
+    const Vector3f& vel = loc.velocity();
+    mPosX[idx] = pos.x; mPosY[idx] = pos.y; mPosZ[idx] = pos.z;
+    mVelX[idx] = vel.x; mVelY[idx] = vel.y; mVelZ[idx] = vel.z;
+    mTime[idx] = timeOffset(loc.updateTime());
+}
+
+void SphereBatch::remove(uint32 idx) {
+    uint32 last = size() - 1;
+    if (idx != last) {
+        mPosX[idx] = mPosX[last]; mPosY[idx] = mPosY[last]; mPosZ[idx] = mPosZ[last];
+        mVelX[idx] = mVelX[last]; mVelY[idx] = mVelY[last]; mVelZ[idx] = mVelZ[last];
+        mTime[idx] = mTime[last];
+        mRadius[idx] = mRadius[last];
+        mMaxSize[idx] = mMaxSize[last];
+    }
+    mPosX.pop_back(); mPosY.pop_back(); mPosZ.pop_back();
+    mVelX.pop_back(); mVelY.pop_back(); mVelZ.pop_back();
+    mTime.pop_back();
+    mRadius.pop_back();
+    mMaxSize.pop_back();
+}
+
+Vector3f SphereBatch::position(uint32 idx, const Time& t) const {
+    float32 dt = timeOffset(t) - mTime[idx];
+    return Vector3f(
+        mPosX[idx] + mVelX[idx] * dt,
+        mPosY[idx] + mVelY[idx] * dt,
+        mPosZ[idx] + mVelZ[idx] * dt
+    );
+}
+
+bool SphereBatch::simd() {
+#if SIRIKATA_SPHERE_BATCH_SSE
+    return true;
+#else
+    return false;
+#endif
+}
+
+// The scalar and SSE versions below must perform the same operations in the
+// same order so they make identical decisions -- keep them in sync.
+uint32 SphereBatch::cullScalarRange(float32 qt, const SphereBatchQuery& query, uint32 start, uint32 end, std::vector<uint32>* results) const {
+    const bool check_dist = query.hasMaxDistance();
+    const bool check_angle = query.hasMinAngle();
+    const float32 cx = query.mCenter.x, cy = query.mCenter.y, cz = query.mCenter.z;
+    const float32 region_radius = query.mRegionRadius;
+    const float32 max_dist = query.mMaxDistance;
+    const float32 isf = query.mInvertSquaredFrac;
+
+    uint32 count = 0;
+    for(uint32 i = start; i < end; i++) {
+        float32 dt = qt - mTime[i];
+        float32 dx = (mPosX[i] + mVelX[i] * dt) - cx;
+        float32 dy = (mPosY[i] + mVelY[i] * dt) - cy;
+        float32 dz = (mPosZ[i] + mVelZ[i] * dt) - cz;
+        float32 center_dist = sqrtf((dx*dx + dy*dy) + dz*dz) - region_radius;
+        float32 dist = (center_dist > 0.f) ? center_dist : 0.f;
+
+        bool pass = true;
+        if (check_dist)
+            pass = pass && ((dist - mRadius[i]) <= max_dist);
+        if (check_angle) {
+            float32 dist2 = dist*dist;
+            float32 rad2 = mMaxSize[i]*mMaxSize[i];
+            pass = pass && ((dist2 <= rad2) || (isf * dist2 <= rad2));
+        }
+        if (pass) {
+            results->push_back(i);
+            count++;
+        }
+    }
+    return count;
+}
+
+uint32 SphereBatch::cullScalar(const Time& t, const SphereBatchQuery& query, std::vector<uint32>* results) const {
+    return cullScalarRange(timeOffset(t), query, 0, size(), results);
+}
+
+uint32 SphereBatch::cull(const Time& t, const SphereBatchQuery& query, std::vector<uint32>* results) const {
+#if SIRIKATA_SPHERE_BATCH_SSE
+    const float32 qt = timeOffset(t);
+    const uint32 n = size();
+    const uint32 simd_end = n - (n % 4);
+
+    const bool check_dist = query.hasMaxDistance();
+    const bool check_angle = query.hasMinAngle();
+    const __m128 qt4 = _mm_set1_ps(qt);
+    const __m128 cx4 = _mm_set1_ps(query.mCenter.x);
+    const __m128 cy4 = _mm_set1_ps(query.mCenter.y);
+    const __m128 cz4 = _mm_set1_ps(query.mCenter.z);
+    const __m128 region_radius4 = _mm_set1_ps(query.mRegionRadius);
+    const __m128 max_dist4 = _mm_set1_ps(query.mMaxDistance);
+    const __m128 isf4 = _mm_set1_ps(query.mInvertSquaredFrac);
+    const __m128 zero4 = _mm_setzero_ps();
+
+    uint32 count = 0;
+    for(uint32 i = 0; i < simd_end; i += 4) {
+        __m128 dt = _mm_sub_ps(qt4, _mm_loadu_ps(&mTime[i]));
+        __m128 dx = _mm_sub_ps(_mm_add_ps(_mm_loadu_ps(&mPosX[i]), _mm_mul_ps(_mm_loadu_ps(&mVelX[i]), dt)), cx4);
+        __m128 dy = _mm_sub_ps(_mm_add_ps(_mm_loadu_ps(&mPosY[i]), _mm_mul_ps(_mm_loadu_ps(&mVelY[i]), dt)), cy4);
+        __m128 dz = _mm_sub_ps(_mm_add_ps(_mm_loadu_ps(&mPosZ[i]), _mm_mul_ps(_mm_loadu_ps(&mVelZ[i]), dt)), cz4);
+        __m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+        // _mm_max_ps(a, b) is (a > b ? a : b), like the scalar version
+        __m128 dist = _mm_max_ps(_mm_sub_ps(_mm_sqrt_ps(len2), region_radius4), zero4);
+
+        int mask = 0xF;
+        if (check_dist) {
+            __m128 edge_dist = _mm_sub_ps(dist, _mm_loadu_ps(&mRadius[i]));
+            mask &= _mm_movemask_ps(_mm_cmple_ps(edge_dist, max_dist4));
+        }
+        if (check_angle) {
+            __m128 dist2 = _mm_mul_ps(dist, dist);
+            __m128 max_size = _mm_loadu_ps(&mMaxSize[i]);
+            __m128 rad2 = _mm_mul_ps(max_size, max_size);
+            __m128 inside = _mm_cmple_ps(dist2, rad2);
+            __m128 large = _mm_cmple_ps(_mm_mul_ps(isf4, dist2), rad2);
+            mask &= _mm_movemask_ps(_mm_or_ps(inside, large));
+        }
+
+        if (mask == 0) continue;
+        for(uint32 j = 0; j < 4; j++) {
+            if (mask & (1 << j)) {
+                results->push_back(i + j);
+                count++;
+            }
+        }
+    }
+
+    return count + cullScalarRange(qt, query, simd_end, n, results);
+#else
+    return cullScalar(t, query, results);
+#endif
+}
+
+} // namespace Sirikata
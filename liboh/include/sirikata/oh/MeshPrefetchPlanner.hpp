@@ -0,0 +1,189 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_OH_MESH_PREFETCH_PLANNER_HPP_
+#define _SIRIKATA_OH_MESH_PREFETCH_PLANNER_HPP_
+
+#include <sirikata/oh/Platform.hpp>
+#include <sirikata/core/util/MotionVector.hpp>
+#include <sirikata/core/util/AggregateBoundingInfo.hpp>
+#include <sirikata/core/util/SpaceObjectReference.hpp>
+
+namespace Sirikata {
+namespace OH {
+
+/** MeshPrefetchPlanner does the bookkeeping for MeshPrefetcher: which objects
+ *  each presence can see, which objects it has seen before, what state their
+ *  meshes are in, and which meshes should be requested next. It doesn't
+ *  download anything or keep time itself, and it isn't thread safe, so it
+ *  can be driven directly by tests.
+ *
+ *  An object is predicted to enter a presence's results when it would satisfy
+ *  a solid angle query, or when its parent aggregate would, since that's when
+ *  a cut query refines the aggregate into its children. Aggregates satisfy
+ *  the query when the largest object they contain would, measured from the
+ *  closest point of the bounds of the objects' centers.
+ */
+class SIRIKATA_OH_EXPORT MeshPrefetchPlanner {
+public:
+    struct Options {
+        Duration horizon; // Only prefetch objects expected sooner than this
+        float32 solidAngle; // Query angle objects are assumed to need
+        uint32 maxOutstanding;
+        uint32 maxCandidates;
+        float64 maxPriority;
+    };
+
+    struct Stats {
+        Stats()
+         : requested(0), completed(0), failed(0),
+           hits(0), late(0), misses(0), unpredicted(0), loaded(0),
+           used(0), wasted(0)
+        {}
+
+        uint64 requested;
+        uint64 completed;
+        uint64 failed;
+        // When an object enters a presence's results, its mesh was...
+        uint64 hits; // prefetched
+        uint64 late; // still being prefetched
+        uint64 misses; // a candidate but not prefetched
+        uint64 unpredicted; // never seen before, so couldn't be a candidate
+        uint64 loaded; // already loaded for another visible object
+        // Prefetched meshes which were later used, or dropped unused
+        uint64 used;
+        uint64 wasted;
+    };
+
+    struct Request {
+        String mesh;
+        float64 expected; // Seconds until it's expected to be visible
+        float64 priority;
+    };
+    typedef std::vector<Request> RequestList;
+
+    typedef std::tr1::function<Time(const SpaceID&)> SpaceTimeFunction;
+
+    MeshPrefetchPlanner(const Options& opts);
+
+    /// An object was added to, or revalidated in, a presence's results.
+    /// parent is the aggregate it was refined from, or null.
+    void objectAdded(const SpaceObjectReference& presence, const SpaceObjectReference& obj,
+        const TimedMotionVector3f& loc, const AggregateBoundingInfo& bounds,
+        const String& mesh, const ObjectReference& parent, const Time& now);
+    /// An object was removed from a presence's results
+    void objectRemoved(const SpaceObjectReference& presence, const SpaceObjectReference& obj,
+        const TimedMotionVector3f& loc, const AggregateBoundingInfo& bounds,
+        const String& mesh, const Time& now);
+    /// A presence's own location changed
+    void presenceMoved(const SpaceObjectReference& presence, const TimedMotionVector3f& loc);
+    void presenceRemoved(const SpaceObjectReference& presence, const Time& now);
+
+    /** Chooses meshes to request now, soonest first, without exceeding
+     *  maxOutstanding, and marks them as being fetched.
+     *  \param spaceTime gives the current time in a space
+     *  \param requests filled in with the meshes to request
+     */
+    void plan(const SpaceTimeFunction& spaceTime, RequestList& requests);
+    /// A mesh returned by plan() finished downloading
+    void fetchFinished(const String& mesh, bool success);
+    /// A mesh returned by plan() won't be downloaded after all
+    void fetchCancelled(const String& mesh);
+    /// Takes the meshes being fetched which no candidate uses any more, so
+    /// their downloads can be cancelled.
+    void takeDropped(std::vector<String>& dropped);
+
+    const Stats& stats() const { return mStats; }
+    uint32 outstanding() const { return mOutstanding; }
+    uint32 numCandidates() const { return (uint32)mCandidates.size(); }
+    uint32 numMeshes() const { return (uint32)mMeshes.size(); }
+    uint32 numPresences() const { return (uint32)mPresences.size(); }
+
+    /** Estimates how long until an object becomes visible to a query.
+     *  \param offset position of the object relative to the querier
+     *  \param velocity velocity of the object relative to the querier
+     *  \param radius radius of the object's bounds
+     *  \param solidAngle minimum solid angle the query accepts
+     *  \returns time in seconds, 0 if already visible, or a negative value if
+     *           the object won't become visible on their current paths
+     */
+    static float64 timeToVisible(const Vector3f& offset, const Vector3f& velocity, float32 radius, float32 solidAngle);
+    /// Distance, in units of an object's radius, at which it satisfies a
+    /// solid angle query
+    static float32 visibleDistanceScale(float32 solidAngle);
+    /// Time until offset + velocity * t is within distance, 0 if it already
+    /// is, or negative if never
+    static float64 timeToReach(const Vector3f& offset, const Vector3f& velocity, float32 distance);
+
+private:
+    enum MeshState {
+        Cold, // Not known to be in the cache
+        Prefetched,
+        Loaded, // Visible, so downloaded regardless of prefetching
+        Failed
+    };
+
+    struct Mesh {
+        Mesh()
+         : state(Cold), refs(0), visibleRefs(0), fetching(false)
+        {}
+
+        MeshState state;
+        uint32 refs; // Candidates using this mesh
+        uint32 visibleRefs; // Visible candidates using this mesh
+        bool fetching;
+    };
+    typedef std::tr1::unordered_map<String, Mesh> MeshMap;
+
+    struct Candidate {
+        Candidate()
+         : visibleCount(0)
+        {}
+
+        String mesh;
+        TimedMotionVector3f loc;
+        AggregateBoundingInfo bounds;
+        ObjectReference parent; // Aggregate containing this object, if known
+        uint32 visibleCount; // Presences currently seeing this object
+        Time lastSeen; // Local time
+    };
+    typedef std::tr1::unordered_map<SpaceObjectReference, Candidate, SpaceObjectReference::Hasher> CandidateMap;
+
+    struct Presence {
+        Presence()
+         : located(false)
+        {}
+
+        TimedMotionVector3f loc;
+        bool located; // Whether we've heard loc yet
+        typedef std::tr1::unordered_set<SpaceObjectReference, SpaceObjectReference::Hasher> VisibleSet;
+        VisibleSet visible;
+    };
+    typedef std::tr1::unordered_map<SpaceObjectReference, Presence, SpaceObjectReference::Hasher> PresenceMap;
+
+    void setCandidateMesh(Candidate& cand, const String& mesh);
+    void showCandidate(Candidate& cand);
+    void hideCandidate(Candidate& cand);
+    void releaseMesh(const String& mesh);
+    void recordEntry(const SpaceObjectReference& obj, bool known, const Candidate& cand);
+    void trimCandidates();
+    // Time until cand satisfies the query of a presence at ppos moving at
+    // pvel, or negative if it won't
+    float64 timeToSatisfy(const Candidate& cand, const Time& t, const Vector3f& ppos, const Vector3f& pvel) const;
+
+    Options mOptions;
+    float32 mVisibleScale; // Visible distance per unit of radius
+
+    CandidateMap mCandidates;
+    MeshMap mMeshes;
+    PresenceMap mPresences;
+    uint32 mOutstanding;
+    std::vector<String> mDropped;
+    Stats mStats;
+}; // class MeshPrefetchPlanner
+
+} // namespace OH
+} // namespace Sirikata
+
+#endif //_SIRIKATA_OH_MESH_PREFETCH_PLANNER_HPP_
@@ -0,0 +1,92 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_OH_MESH_PREFETCHER_HPP_
+#define _SIRIKATA_OH_MESH_PREFETCHER_HPP_
+
+#include <sirikata/oh/Platform.hpp>
+#include <sirikata/oh/ObjectHostContext.hpp>
+#include <sirikata/oh/MeshPrefetchPlanner.hpp>
+#include <sirikata/proxyobject/ProxyObject.hpp>
+#include <sirikata/core/service/Poller.hpp>
+#include <sirikata/core/transfer/TransferPool.hpp>
+#include <sirikata/core/transfer/ResourceDownloadTask.hpp>
+#include <sirikata/core/command/Command.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace Sirikata {
+
+class ObjectHost;
+
+namespace OH {
+
+/** MeshPrefetcher warms the transfer caches with meshes of objects which are
+ *  expected to enter a presence's query results soon, so they don't only
+ *  start downloading once they're already visible.
+ *
+ *  Every object reported in any local presence's proximity results, including
+ *  aggregates and the children they're refined into, becomes a candidate and
+ *  stays one after it leaves the results. Periodically, candidates which
+ *  aren't in any presence's results are ranked by how long, given the
+ *  presences' and objects' current motion, until they would enter the results
+ *  of a solid angle query (see MeshPrefetchPlanner). Meshes of those expected
+ *  within the horizon are requested, nearest first, at low priority through a
+ *  dedicated TransferPool. This only sees objects the object host already
+ *  knows about, so it mostly helps with objects re-entering a query, objects
+ *  seen by other presences, and children of aggregates.
+ *
+ *  Hit, miss and waste counts are reported by the oh.prefetch.stats command.
+ *
+ *  The notification methods are thread safe.
+ */
+class SIRIKATA_OH_EXPORT MeshPrefetcher {
+public:
+    typedef MeshPrefetchPlanner::Options Options;
+    typedef MeshPrefetchPlanner::Stats Stats;
+
+    MeshPrefetcher(ObjectHostContext* ctx, ObjectHost* parent, const Options& opts);
+    ~MeshPrefetcher();
+
+    void start();
+    void stop();
+
+    /// A proxy was added to, or revalidated in, its presence's results
+    void proxyAdded(const ProxyObjectPtr& proxy);
+    /// A proxy was removed from its presence's results
+    void proxyRemoved(const ProxyObjectPtr& proxy);
+    /// A presence's own location changed
+    void presenceMoved(const ProxyObjectPtr& self);
+    void presenceRemoved(const SpaceObjectReference& presence);
+
+    Stats stats();
+
+private:
+    typedef std::vector<Transfer::ResourceDownloadTaskPtr> TaskList;
+    // Removes the tasks for meshes the planner dropped from mTasks, adding
+    // them to tasks. Must be called with mMutex held.
+    void takeDroppedTasks(TaskList& tasks);
+    // Cancels tasks. Called without mMutex held so we never block on the
+    // transfer pool while its callbacks wait for us.
+    void cancelTasks(TaskList& tasks);
+
+    void poll();
+    void handleDownloadFinished(const String& mesh, Transfer::ResourceDownloadTaskPtr task, Transfer::TransferRequestPtr request, Transfer::DenseDataPtr response);
+
+    void commandStats(const Command::Command& cmd, Command::Commander* cmdr, Command::CommandID cmdid);
+
+    ObjectHostContext* mContext;
+    ObjectHost* mParent;
+    Transfer::TransferPoolPtr mTransferPool;
+    Poller mPoller;
+
+    boost::mutex mMutex;
+    MeshPrefetchPlanner mPlanner;
+    typedef std::tr1::unordered_map<String, Transfer::ResourceDownloadTaskPtr> TaskMap;
+    TaskMap mTasks;
+}; // class MeshPrefetcher
+
+} // namespace OH
+} // namespace Sirikata
+
+#endif //_SIRIKATA_OH_MESH_PREFETCHER_HPP_
@@ -70,6 +70,7 @@ namespace OH {
 class Storage;
 class PersistedObjectSet;
 class ObjectQueryProcessor;
+class MeshPrefetcher;
 }
 
 class SIRIKATA_OH_EXPORT ObjectHost
@@ -95,6 +96,7 @@ class SIRIKATA_OH_EXPORT ObjectHost
     OH::Storage* mStorage;
     OH::PersistedObjectSet* mPersistentSet;
     OH::ObjectQueryProcessor* mQueryProcessor;
+    OH::MeshPrefetcher* mMeshPrefetcher;
     QueryDataLookupConstructor mQueryDataLookupConstructor;
     String mQueryDataLookupConstructorOpts;
 
@@ -188,6 +190,9 @@ public:
     void setQueryProcessor(OH::ObjectQueryProcessor* proc) { mQueryProcessor = proc; }
     OH::ObjectQueryProcessor* getQueryProcessor() { return mQueryProcessor; }
 
+    // Get the mesh prefetcher, or NULL if prefetching is disabled.
+    OH::MeshPrefetcher* getMeshPrefetcher() { return mMeshPrefetcher; }
+
     // Get and set the storage backend to use for persistent object storage.
     void setQueryDataLookupConstructor(QueryDataLookupConstructor qdl, const String& opts) { mQueryDataLookupConstructor = qdl; mQueryDataLookupConstructorOpts = opts; }
     QueryDataLookupConstructor getQueryDataLookupConstructor() { return mQueryDataLookupConstructor; }
@@ -68,7 +68,7 @@ ObjectQueryHandler::ObjectQueryHandler(ObjectHostContext* ctx, ManualObjectQuery
    mObjectResults( std::tr1::bind(&ObjectQueryHandler::handleDeliverEvents, this) )
 {
     String object_handler_type = GetOptionValue<String>(OPT_MANUAL_QUERY_HANDLER_TYPE);
-    if (object_handler_type == "dist" || object_handler_type == "rtreedist") mObjectDistance = true;
+    if (object_handler_type == "dist" || object_handler_type == "rtreedist" || object_handler_type == "griddist") mObjectDistance = true;
 }
 
 ObjectQueryHandler::~ObjectQueryHandler() {
@@ -4,9 +4,20 @@
 
 #include <sirikata/oh/Platform.hpp>
 #include "SimpleObjectQueryProcessor.hpp"
+#include <sirikata/core/options/Options.hpp>
 
 static int oh_simple_query_plugin_refcount = 0;
 
+namespace Sirikata {
+
+static void InitPluginOptions() {
+    InitializeClassOptions::module(SIRIKATA_OPTIONS_MODULE)
+        .addOption(new OptionValue(OPT_SIMPLE_QUERY_COMPACT_LOC, "false", Sirikata::OptionValueType<bool>(), "If true, ask the space for compact loc updates containing only changed fields."))
+        ;
+}
+
+} // namespace Sirikata
+
 
 SIRIKATA_PLUGIN_EXPORT_C const char* name() {
     return "oh-simple-query";
@@ -31,6 +42,7 @@ SIRIKATA_PLUGIN_EXPORT_C void init() {
     using std::tr1::placeholders::_1;
     using std::tr1::placeholders::_2;
     if (oh_simple_query_plugin_refcount == 0) {
+        InitPluginOptions();
         Sirikata::OH::ObjectQueryProcessorFactory::getSingleton().registerConstructor(
             "simple",
             std::tr1::bind(
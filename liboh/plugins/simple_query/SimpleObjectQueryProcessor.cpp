@@ -8,9 +8,11 @@
 #include "Protocol_Loc.pbj.hpp"
 #include "Protocol_Frame.pbj.hpp"
 #include <sirikata/pintoloc/ProtocolLocUpdate.hpp>
+#include <sirikata/pintoloc/CompactLocUpdate.hpp>
 #include <sirikata/proxyobject/ProxyManager.hpp>
 #include <sirikata/oh/OHSpaceTimeSynced.hpp>
 #include <sirikata/core/odp/SST.hpp>
+#include <sirikata/core/options/Options.hpp>
 
 #define SOQP_LOG(lvl, msg) SILOG(simple-object-query-processor, lvl, msg)
 
@@ -19,13 +21,14 @@ namespace OH {
 namespace Simple {
 
 SimpleObjectQueryProcessor* SimpleObjectQueryProcessor::create(ObjectHostContext* ctx, const String& args) {
-    return new SimpleObjectQueryProcessor(ctx);
+    return new SimpleObjectQueryProcessor(ctx, GetOptionValue<bool>(OPT_SIMPLE_QUERY_COMPACT_LOC));
 }
 
 
-SimpleObjectQueryProcessor::SimpleObjectQueryProcessor(ObjectHostContext* ctx)
+SimpleObjectQueryProcessor::SimpleObjectQueryProcessor(ObjectHostContext* ctx, bool compact_loc)
  : ObjectQueryProcessor(ctx),
-   mContext(ctx)
+   mContext(ctx),
+   mCompactLocUpdates(compact_loc)
 {
 }
 
@@ -62,6 +65,23 @@ void SimpleObjectQueryProcessor::presenceConnectedStream(HostedObjectPtr ho, con
             HostedObjectWPtr(ho), sporef, _1, _2
         )
     );
+
+    if (mCompactLocUpdates) {
+        strm->listenSubstream(OBJECT_PORT_LOCATION_COMPACT,
+            std::tr1::bind(&SimpleObjectQueryProcessor::handleCompactLocationSubstream, this,
+                HostedObjectWPtr(ho), sporef, _1, _2
+            )
+        );
+        // Ask for compact updates by telling the space which version we can
+        // decode. Spaces that don't support them just ignore the request and
+        // keep sending regular updates.
+        static uint8 compact_version = CompactLocEncoder::Version;
+        strm->createChildStream(
+            std::tr1::bind(&SimpleObjectQueryProcessor::handleCompactRequestStream, this, _1, _2),
+            (void*)&compact_version, 1,
+            OBJECT_PORT_LOCATION_COMPACT, OBJECT_PORT_LOCATION_COMPACT
+        );
+    }
 }
 
 void SimpleObjectQueryProcessor::presenceDisconnected(HostedObjectPtr ho, const SpaceObjectReference& sporef) {
@@ -232,21 +252,82 @@ bool SimpleObjectQueryProcessor::handleLocationMessage(const HostedObjectPtr& se
         return true;
     }
     // As well as looking up object state (orhpan manager) only once
-    ObjectStatePtr obj_state = mObjectStateMap[spaceobj];
-
+    OHSpaceTimeSynced sync(mContext->objectHost, spaceobj.space());
     for(int32 idx = 0; idx < contents.update_size(); idx++) {
         Sirikata::Protocol::Loc::LocationUpdate update = contents.update(idx);
-        SpaceObjectReference observed(spaceobj.space(), ObjectReference(update.object()));
-        ProxyObjectPtr proxy_obj = proxy_manager->getProxyObject(observed);
-
-        OHSpaceTimeSynced sync(mContext->objectHost, spaceobj.space());
         LocProtocolLocUpdate llu(update, sync);
-        if (!proxy_obj) {
-            obj_state->orphans.addOrphanUpdate(observed, llu);
-        }
-        else {
-            deliverLocationUpdate(self, spaceobj, llu);
-        }
+        handleLocUpdate(self, proxy_manager, spaceobj, llu);
+    }
+
+    return true;
+}
+
+void SimpleObjectQueryProcessor::handleLocUpdate(const HostedObjectPtr& self, ProxyManagerPtr proxy_manager, const SpaceObjectReference& spaceobj, const LocUpdate& lu) {
+    SpaceObjectReference observed(spaceobj.space(), lu.object());
+    ProxyObjectPtr proxy_obj = proxy_manager->getProxyObject(observed);
+    if (!proxy_obj) {
+        ObjectStatePtr obj_state = mObjectStateMap[spaceobj];
+        obj_state->orphans.addOrphanUpdate(observed, lu);
+    }
+    else {
+        deliverLocationUpdate(self, spaceobj, lu);
+    }
+}
+
+void SimpleObjectQueryProcessor::handleCompactRequestStream(int err, SSTStreamPtr s) {
+    // The request is complete once it's sent, we don't expect a response
+    if (s) s->close(false);
+}
+
+void SimpleObjectQueryProcessor::handleCompactLocationSubstream(const HostedObjectWPtr& weakSelf, const SpaceObjectReference& spaceobj, int err, SSTStreamPtr s) {
+    s->registerReadCallback(
+        std::tr1::bind(
+            &SimpleObjectQueryProcessor::handleCompactLocationSubstreamRead, this,
+            weakSelf, spaceobj, s, new std::stringstream(), _1, _2
+        )
+    );
+}
+
+void SimpleObjectQueryProcessor::handleCompactLocationSubstreamRead(const HostedObjectWPtr& weakSelf, const SpaceObjectReference& spaceobj, SSTStreamPtr s, std::stringstream* prevdata, uint8* buffer, int length) {
+    HostedObjectPtr self(weakSelf.lock());
+    if (!self)
+        return;
+    if (self->stopped()) {
+        SOQP_LOG(detailed,"Ignoring location update after system stop requested.");
+        return;
+    }
+
+    prevdata->write((const char*)buffer, length);
+    if (handleCompactLocationMessage(self, spaceobj, prevdata->str())) {
+        delete prevdata;
+        s->registerReadCallback(0);
+        s->close(false);
+    }
+}
+
+bool SimpleObjectQueryProcessor::handleCompactLocationMessage(const HostedObjectPtr& self, const SpaceObjectReference& spaceobj, const std::string& payload) {
+    Sirikata::Protocol::Frame frame;
+    bool parse_success = frame.ParseFromString(payload);
+    if (!parse_success) return false;
+
+    ProxyManagerPtr proxy_manager = self->getProxyManager(spaceobj.space(), spaceobj.object());
+    if (!proxy_manager) {
+        SOQP_LOG(warn,"Hosted Object received a message for a presence without a proxy manager.");
+        return true;
+    }
+    ObjectStateMap::iterator state_it = mObjectStateMap.find(spaceobj);
+    if (state_it == mObjectStateMap.end())
+        return true;
+
+    std::vector<CompactLocRecord> records;
+    const std::string& contents = frame.payload();
+    if (!state_it->second->compactDecoder.decode(contents.data(), contents.size(), &records))
+        SOQP_LOG(warn,"Received malformed compact location update.");
+
+    OHSpaceTimeSynced sync(mContext->objectHost, spaceobj.space());
+    for(uint32 idx = 0; idx < records.size(); idx++) {
+        CompactLocUpdate clu(records[idx], sync);
+        handleLocUpdate(self, proxy_manager, spaceobj, clu);
     }
 
     return true;
@@ -8,6 +8,9 @@
 #include <sirikata/oh/ObjectQueryProcessor.hpp>
 
 #include <sirikata/pintoloc/OrphanLocUpdateManager.hpp>
+#include <sirikata/core/util/CompactLocEncoding.hpp>
+
+#define OPT_SIMPLE_QUERY_COMPACT_LOC "simple-query.compact-loc-updates"
 
 namespace Sirikata {
 namespace OH {
@@ -25,7 +28,7 @@ class SimpleObjectQueryProcessor :
 public:
     static SimpleObjectQueryProcessor* create(ObjectHostContext* ctx, const String& args);
 
-    SimpleObjectQueryProcessor(ObjectHostContext* ctx);
+    SimpleObjectQueryProcessor(ObjectHostContext* ctx, bool compact_loc);
     virtual ~SimpleObjectQueryProcessor();
 
     virtual void start();
@@ -54,6 +57,14 @@ private:
     // Handlers for substream read events for space-managed updates
     void handleLocationSubstreamRead(const HostedObjectWPtr &weakSelf, const SpaceObjectReference& spaceobj, SSTStreamPtr s, std::stringstream* prevdata, uint8* buffer, int length);
     bool handleLocationMessage(const HostedObjectPtr& self, const SpaceObjectReference& spaceobj, const std::string& paylod);
+    // Handlers for compact updates, which are only sent if we request them
+    void handleCompactRequestStream(int err, SSTStreamPtr s);
+    void handleCompactLocationSubstream(const HostedObjectWPtr &weakSelf, const SpaceObjectReference& spaceobj, int err, SSTStreamPtr s);
+    void handleCompactLocationSubstreamRead(const HostedObjectWPtr &weakSelf, const SpaceObjectReference& spaceobj, SSTStreamPtr s, std::stringstream* prevdata, uint8* buffer, int length);
+    bool handleCompactLocationMessage(const HostedObjectPtr& self, const SpaceObjectReference& spaceobj, const std::string& payload);
+    // Either delivers the update or holds onto it until the object it's for
+    // shows up in the results
+    void handleLocUpdate(const HostedObjectPtr& self, ProxyManagerPtr proxy_manager, const SpaceObjectReference& spaceobj, const LocUpdate& lu);
 
 
     // BaseProxCommandable
@@ -66,6 +77,8 @@ private:
 
 
     ObjectHostContext* mContext;
+    // Whether to ask the space for compact loc updates
+    bool mCompactLocUpdates;
 
     // We resolve ordering issues here instead of leaving it up to the
     // object. To do so, we track a bit of state for each query -- the
@@ -93,6 +106,8 @@ private:
 
         HostedObjectWPtr ho;
         OrphanLocUpdateManager orphans;
+        // Tracks strings the space has sent in compact updates
+        CompactLocDecoder compactDecoder;
         bool stopped;
     };
     typedef std::tr1::shared_ptr<ObjectState> ObjectStatePtr;
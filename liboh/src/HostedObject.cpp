@@ -36,6 +36,7 @@
 #include <sirikata/oh/HostedObject.hpp>
 #include <sirikata/oh/ObjectHostContext.hpp>
 #include <sirikata/oh/ObjectHost.hpp>
+#include <sirikata/oh/MeshPrefetcher.hpp>
 #include <sirikata/core/util/Platform.hpp>
 #include <sirikata/oh/ObjectScriptManager.hpp>
 #include <sirikata/core/options/Options.hpp>
@@ -813,6 +814,10 @@ void HostedObject::handleLocationUpdate(const SpaceObjectReference& observer, co
     assert(proxy_obj);
 
     this->processLocationUpdate( observer, proxy_obj, lu);
+
+    // Prefetching predicts from the presence's own motion as well
+    if (observed == observer && mObjectHost->getMeshPrefetcher() != NULL)
+        mObjectHost->getMeshPrefetcher()->presenceMoved(proxy_obj);
 }
 
 void HostedObject::handleProximityUpdate(const SpaceObjectReference& spaceobj, const Sirikata::Protocol::Prox::ProximityUpdate& update) {
@@ -881,7 +886,15 @@ void HostedObject::handleProximityUpdate(const SpaceObjectReference& spaceobj, c
 
         // Always mark the object as valid (either revalidated, or just
         // valid for the first time)
-        if (proxy_obj) proxy_obj->validate();
+        if (proxy_obj) {
+            proxy_obj->validate();
+            // Remember which aggregate this object was refined from
+            if (add.has_parent())
+                proxy_obj->setParent(add.parent(), add.parent_seqno());
+        }
+
+        if (mObjectHost->getMeshPrefetcher() != NULL)
+            mObjectHost->getMeshPrefetcher()->proxyAdded(proxy_obj);
 
         //tells the object script that something that was close has come
         //into view
@@ -928,6 +941,9 @@ void HostedObject::handleProximityUpdate(const SpaceObjectReference& spaceobj, c
                     self->mObjectScript->notifyProximateGone(proxy_obj,spaceobj);
 
                 proxy_obj->invalidate(permanent);
+
+                if (mObjectHost->getMeshPrefetcher() != NULL)
+                    mObjectHost->getMeshPrefetcher()->proxyRemoved(proxy_obj);
             }
         }
 
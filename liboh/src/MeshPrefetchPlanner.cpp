@@ -0,0 +1,358 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <sirikata/oh/MeshPrefetchPlanner.hpp>
+
+#define PREFETCH_LOG(lvl, msg) SILOG(prefetch, lvl, msg)
+
+namespace Sirikata {
+namespace OH {
+
+namespace {
+struct PresencePosition {
+    SpaceID space;
+    Time time;
+    Vector3f pos;
+    Vector3f vel;
+};
+}
+
+MeshPrefetchPlanner::MeshPrefetchPlanner(const Options& opts)
+ : mOptions(opts),
+   mVisibleScale(visibleDistanceScale(opts.solidAngle)),
+   mOutstanding(0)
+{
+}
+
+float32 MeshPrefetchPlanner::visibleDistanceScale(float32 solidAngle) {
+    // A sphere of radius r at distance d subtends 2*pi*(1 - cos(theta)),
+    // where sin(theta) = r/d. Beyond a hemisphere the object has to contain
+    // the querier, and a zero angle would make everything visible.
+    float64 sa = std::max(std::min((float64)solidAngle, 2 * M_PI), 1e-9);
+    float64 theta = acos(1.0 - sa / (2 * M_PI));
+    return (float32)(1.0 / sin(theta));
+}
+
+float64 MeshPrefetchPlanner::timeToReach(const Vector3f& offset, const Vector3f& velocity, float32 distance) {
+    // Smallest t >= 0 with |offset + velocity*t| <= distance
+    float64 c = (float64)offset.lengthSquared() - (float64)distance * distance;
+    if (c <= 0)
+        return 0;
+    float64 b = offset.dot(velocity);
+    float64 a = velocity.lengthSquared();
+    // Not approaching, so the distance only grows from here
+    if (b >= 0 || a <= 0)
+        return -1;
+    float64 disc = b * b - a * c;
+    if (disc < 0)
+        return -1;
+    return (-b - sqrt(disc)) / a;
+}
+
+float64 MeshPrefetchPlanner::timeToVisible(const Vector3f& offset, const Vector3f& velocity, float32 radius, float32 solidAngle) {
+    return timeToReach(offset, velocity, radius * visibleDistanceScale(solidAngle));
+}
+
+void MeshPrefetchPlanner::objectAdded(const SpaceObjectReference& presence, const SpaceObjectReference& obj,
+    const TimedMotionVector3f& loc, const AggregateBoundingInfo& bounds,
+    const String& mesh, const ObjectReference& parent, const Time& now)
+{
+    Presence& pres = mPresences[presence];
+    if (obj == presence) {
+        pres.loc = loc;
+        pres.located = true;
+        return;
+    }
+
+    CandidateMap::iterator it = mCandidates.find(obj);
+    bool known = (it != mCandidates.end());
+    if (!known)
+        it = mCandidates.insert(CandidateMap::value_type(obj, Candidate())).first;
+    Candidate& cand = it->second;
+    cand.loc = loc;
+    cand.bounds = bounds;
+    cand.lastSeen = now;
+    // Remember the parent even after the object moves to the top level, so
+    // we can predict when it's refined out of the aggregate again
+    if (parent != ObjectReference::null())
+        cand.parent = parent;
+    setCandidateMesh(cand, mesh);
+
+    // Additions also revalidate objects which are already visible, which
+    // shouldn't count as entering the result set again.
+    if (pres.visible.insert(obj).second) {
+        recordEntry(obj, known, cand);
+        showCandidate(cand);
+    }
+
+    if (!known)
+        trimCandidates();
+}
+
+void MeshPrefetchPlanner::objectRemoved(const SpaceObjectReference& presence, const SpaceObjectReference& obj,
+    const TimedMotionVector3f& loc, const AggregateBoundingInfo& bounds,
+    const String& mesh, const Time& now)
+{
+    PresenceMap::iterator pit = mPresences.find(presence);
+    if (pit == mPresences.end() || pit->second.visible.erase(obj) == 0)
+        return;
+
+    CandidateMap::iterator it = mCandidates.find(obj);
+    if (it == mCandidates.end())
+        return;
+    Candidate& cand = it->second;
+    hideCandidate(cand);
+    // Keep its last known motion so we can predict when it comes back
+    cand.loc = loc;
+    cand.bounds = bounds;
+    cand.lastSeen = now;
+    setCandidateMesh(cand, mesh);
+}
+
+void MeshPrefetchPlanner::presenceMoved(const SpaceObjectReference& presence, const TimedMotionVector3f& loc) {
+    Presence& pres = mPresences[presence];
+    pres.loc = loc;
+    pres.located = true;
+}
+
+void MeshPrefetchPlanner::presenceRemoved(const SpaceObjectReference& presence, const Time& now) {
+    PresenceMap::iterator pit = mPresences.find(presence);
+    if (pit == mPresences.end())
+        return;
+
+    const Presence::VisibleSet& visible = pit->second.visible;
+    for(Presence::VisibleSet::const_iterator vit = visible.begin(); vit != visible.end(); vit++) {
+        CandidateMap::iterator it = mCandidates.find(*vit);
+        if (it == mCandidates.end()) continue;
+        hideCandidate(it->second);
+        it->second.lastSeen = now;
+    }
+    mPresences.erase(pit);
+}
+
+void MeshPrefetchPlanner::setCandidateMesh(Candidate& cand, const String& mesh) {
+    if (mesh == cand.mesh)
+        return;
+
+    // Move the candidate's visibility over to the new mesh with it
+    uint32 visible = cand.visibleCount;
+    while(cand.visibleCount > 0)
+        hideCandidate(cand);
+    releaseMesh(cand.mesh);
+    cand.mesh = mesh;
+    if (!mesh.empty())
+        mMeshes[mesh].refs++;
+    while(cand.visibleCount < visible)
+        showCandidate(cand);
+}
+
+void MeshPrefetchPlanner::showCandidate(Candidate& cand) {
+    if (cand.visibleCount++ > 0 || cand.mesh.empty())
+        return;
+    // Whoever displays it will load the mesh now. Any prefetch still in
+    // flight is left to finish and populate the cache.
+    Mesh& mesh = mMeshes[cand.mesh];
+    mesh.visibleRefs++;
+    mesh.state = Loaded;
+}
+
+void MeshPrefetchPlanner::hideCandidate(Candidate& cand) {
+    assert(cand.visibleCount > 0);
+    if (--cand.visibleCount > 0 || cand.mesh.empty())
+        return;
+    // Once nothing displays the mesh it may be unloaded and evicted, so it
+    // becomes worth prefetching again if the object heads back into view.
+    Mesh& mesh = mMeshes[cand.mesh];
+    assert(mesh.visibleRefs > 0);
+    if (--mesh.visibleRefs == 0)
+        mesh.state = Cold;
+}
+
+void MeshPrefetchPlanner::releaseMesh(const String& mesh) {
+    if (mesh.empty())
+        return;
+
+    MeshMap::iterator it = mMeshes.find(mesh);
+    assert(it != mMeshes.end() && it->second.refs > 0);
+    if (--it->second.refs > 0)
+        return;
+
+    if (it->second.state == Prefetched)
+        mStats.wasted++;
+    if (it->second.fetching) {
+        mDropped.push_back(mesh);
+        mOutstanding--;
+    }
+    mMeshes.erase(it);
+}
+
+void MeshPrefetchPlanner::recordEntry(const SpaceObjectReference& obj, bool known, const Candidate& cand) {
+    if (cand.mesh.empty())
+        return;
+
+    const Mesh& mesh = mMeshes[cand.mesh];
+    if (mesh.state == Prefetched) {
+        mStats.hits++;
+        mStats.used++;
+    }
+    else if (mesh.state == Loaded) {
+        mStats.loaded++;
+    }
+    else if (mesh.fetching) {
+        mStats.late++;
+    }
+    else if (known) {
+        mStats.misses++;
+    }
+    else {
+        mStats.unpredicted++;
+    }
+    PREFETCH_LOG(insane, obj << " entered results, mesh " << cand.mesh << " in state " << (int)mesh.state);
+}
+
+void MeshPrefetchPlanner::trimCandidates() {
+    if (mCandidates.size() <= mOptions.maxCandidates)
+        return;
+
+    // Drop the candidates which have been out of view longest. Trim an extra
+    // 10% so we don't have to do this on every new candidate.
+    typedef std::vector< std::pair<Time, SpaceObjectReference> > AgeList;
+    AgeList ages;
+    for(CandidateMap::iterator it = mCandidates.begin(); it != mCandidates.end(); it++) {
+        if (it->second.visibleCount == 0)
+            ages.push_back(std::make_pair(it->second.lastSeen, it->first));
+    }
+    size_t ntrim = std::min(ages.size(), mCandidates.size() - mOptions.maxCandidates + mOptions.maxCandidates / 10);
+    std::partial_sort(ages.begin(), ages.begin() + ntrim, ages.end());
+    for(size_t i = 0; i < ntrim; i++) {
+        CandidateMap::iterator it = mCandidates.find(ages[i].second);
+        releaseMesh(it->second.mesh);
+        mCandidates.erase(it);
+    }
+}
+
+float64 MeshPrefetchPlanner::timeToSatisfy(const Candidate& cand, const Time& t, const Vector3f& ppos, const Vector3f& pvel) const {
+    // Queries measure aggregates from the closest point of their center
+    // bounds, using the size of the largest object inside. For single objects
+    // the center bounds are just a point.
+    const AggregateBoundingInfo& bounds = cand.bounds;
+    if (bounds.maxObjectRadius <= 0)
+        return -1;
+    float32 distance = std::max(bounds.centerBoundsRadius, 0.f) + bounds.maxObjectRadius * mVisibleScale;
+    Vector3f pos = cand.loc.position(t) + bounds.centerOffset;
+    return timeToReach(pos - ppos, cand.loc.velocity() - pvel, distance);
+}
+
+void MeshPrefetchPlanner::plan(const SpaceTimeFunction& spaceTime, RequestList& requests) {
+    if (mOutstanding >= mOptions.maxOutstanding)
+        return;
+
+    // Where each presence is right now, in its space's time
+    std::vector<PresencePosition> positions;
+    for(PresenceMap::iterator it = mPresences.begin(); it != mPresences.end(); it++) {
+        if (!it->second.located) continue;
+        PresencePosition pp;
+        pp.space = it->first.space();
+        size_t same = 0;
+        while(same < positions.size() && positions[same].space != pp.space)
+            same++;
+        pp.time = (same < positions.size()) ? positions[same].time : spaceTime(pp.space);
+        pp.pos = it->second.loc.position(pp.time);
+        pp.vel = it->second.loc.velocity();
+        positions.push_back(pp);
+    }
+    if (positions.empty())
+        return;
+
+    // Soonest any presence is expected to see each cold mesh
+    typedef std::tr1::unordered_map<String, float64> MeshTimeMap;
+    MeshTimeMap mesh_times;
+    float64 horizon = mOptions.horizon.toSeconds();
+    for(CandidateMap::iterator it = mCandidates.begin(); it != mCandidates.end(); it++) {
+        const Candidate& cand = it->second;
+        if (cand.visibleCount > 0 || cand.mesh.empty()) continue;
+        MeshMap::iterator mit = mMeshes.find(cand.mesh);
+        if (mit == mMeshes.end() || mit->second.state != Cold || mit->second.fetching) continue;
+
+        const SpaceID& space = it->first.space();
+        const Candidate* parent = NULL;
+        if (cand.parent != ObjectReference::null()) {
+            CandidateMap::iterator parent_it = mCandidates.find(SpaceObjectReference(space, cand.parent));
+            if (parent_it != mCandidates.end())
+                parent = &parent_it->second;
+        }
+
+        for(std::vector<PresencePosition>::iterator pit = positions.begin(); pit != positions.end(); pit++) {
+            if (pit->space != space) continue;
+            float64 t = timeToSatisfy(cand, pit->time, pit->pos, pit->vel);
+            // Children show up when their aggregate is refined
+            if (parent != NULL) {
+                float64 parent_t = timeToSatisfy(*parent, pit->time, pit->pos, pit->vel);
+                if (parent_t >= 0 && (t < 0 || parent_t < t))
+                    t = parent_t;
+            }
+            if (t < 0 || t > horizon) continue;
+            MeshTimeMap::iterator tmit = mesh_times.find(cand.mesh);
+            if (tmit == mesh_times.end())
+                mesh_times[cand.mesh] = t;
+            else if (t < tmit->second)
+                tmit->second = t;
+        }
+    }
+
+    typedef std::vector< std::pair<float64, String> > MeshTimeList;
+    MeshTimeList soonest;
+    for(MeshTimeMap::iterator it = mesh_times.begin(); it != mesh_times.end(); it++)
+        soonest.push_back(std::make_pair(it->second, it->first));
+    size_t nreq = std::min(soonest.size(), (size_t)(mOptions.maxOutstanding - mOutstanding));
+    std::partial_sort(soonest.begin(), soonest.begin() + nreq, soonest.end());
+
+    for(size_t i = 0; i < nreq; i++) {
+        Request req;
+        req.mesh = soonest[i].second;
+        req.expected = soonest[i].first;
+        // Sooner is more urgent, but always stay below the priority of
+        // anything that's actually visible
+        req.priority = std::max(mOptions.maxPriority * (1.0 - req.expected / horizon), mOptions.maxPriority * 0.01);
+        requests.push_back(req);
+
+        mMeshes[req.mesh].fetching = true;
+        mStats.requested++;
+        mOutstanding++;
+        PREFETCH_LOG(detailed, "Prefetching " << req.mesh << ", expected in " << req.expected << "s");
+    }
+}
+
+void MeshPrefetchPlanner::fetchFinished(const String& mesh_name, bool success) {
+    MeshMap::iterator it = mMeshes.find(mesh_name);
+    if (it == mMeshes.end() || !it->second.fetching)
+        return;
+
+    Mesh& mesh = it->second;
+    mesh.fetching = false;
+    mOutstanding--;
+    if (success)
+        mStats.completed++;
+    else
+        mStats.failed++;
+    // If it became visible in the meantime, it's been loaded anyway
+    if (mesh.state == Cold)
+        mesh.state = (success ? Prefetched : Failed);
+}
+
+void MeshPrefetchPlanner::fetchCancelled(const String& mesh_name) {
+    MeshMap::iterator it = mMeshes.find(mesh_name);
+    if (it == mMeshes.end() || !it->second.fetching)
+        return;
+    it->second.fetching = false;
+    mOutstanding--;
+}
+
+void MeshPrefetchPlanner::takeDropped(std::vector<String>& dropped) {
+    dropped.insert(dropped.end(), mDropped.begin(), mDropped.end());
+    mDropped.clear();
+}
+
+} // namespace OH
+} // namespace Sirikata
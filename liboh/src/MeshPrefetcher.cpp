@@ -0,0 +1,190 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <sirikata/oh/MeshPrefetcher.hpp>
+#include <sirikata/oh/ObjectHost.hpp>
+#include <sirikata/core/transfer/TransferMediator.hpp>
+#include <sirikata/core/transfer/AggregatedTransferPool.hpp>
+
+namespace Sirikata {
+namespace OH {
+
+MeshPrefetcher::MeshPrefetcher(ObjectHostContext* ctx, ObjectHost* parent, const Options& opts)
+ : mContext(ctx),
+   mParent(parent),
+   mPoller(
+       ctx->mainStrand,
+       std::tr1::bind(&MeshPrefetcher::poll, this),
+       "MeshPrefetcher::poll",
+       Duration::milliseconds((int64)500)
+   ),
+   mPlanner(opts)
+{
+    mTransferPool = Transfer::TransferMediator::getSingleton().registerClient<Transfer::AggregatedTransferPool>("MeshPrefetcher");
+
+    if (mContext->commander()) {
+        mContext->commander()->registerCommand(
+            "oh.prefetch.stats",
+            std::tr1::bind(&MeshPrefetcher::commandStats, this, _1, _2, _3)
+        );
+    }
+}
+
+MeshPrefetcher::~MeshPrefetcher() {
+    if (mContext->commander())
+        mContext->commander()->unregisterCommand("oh.prefetch.stats");
+}
+
+void MeshPrefetcher::start() {
+    mPoller.start();
+}
+
+void MeshPrefetcher::stop() {
+    mPoller.stop();
+
+    TaskList tasks;
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        for(TaskMap::iterator it = mTasks.begin(); it != mTasks.end(); it++) {
+            tasks.push_back(it->second);
+            mPlanner.fetchCancelled(it->first);
+        }
+        mTasks.clear();
+        takeDroppedTasks(tasks);
+    }
+    cancelTasks(tasks);
+}
+
+void MeshPrefetcher::takeDroppedTasks(TaskList& tasks) {
+    std::vector<String> dropped;
+    mPlanner.takeDropped(dropped);
+    for(std::vector<String>::iterator it = dropped.begin(); it != dropped.end(); it++) {
+        TaskMap::iterator task_it = mTasks.find(*it);
+        if (task_it == mTasks.end()) continue;
+        tasks.push_back(task_it->second);
+        mTasks.erase(task_it);
+    }
+}
+
+void MeshPrefetcher::cancelTasks(TaskList& tasks) {
+    for(TaskList::iterator it = tasks.begin(); it != tasks.end(); it++)
+        (*it)->cancel();
+    tasks.clear();
+}
+
+void MeshPrefetcher::proxyAdded(const ProxyObjectPtr& proxy) {
+    if (!proxy) return;
+
+    TaskList dropped;
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        mPlanner.objectAdded(
+            proxy->getOwnerPresenceID(), proxy->getObjectReference(),
+            proxy->location(), proxy->bounds(), proxy->mesh().toString(),
+            proxy->parentAggregate(), mContext->simTime()
+        );
+        takeDroppedTasks(dropped);
+    }
+    cancelTasks(dropped);
+}
+
+void MeshPrefetcher::proxyRemoved(const ProxyObjectPtr& proxy) {
+    if (!proxy) return;
+
+    TaskList dropped;
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        mPlanner.objectRemoved(
+            proxy->getOwnerPresenceID(), proxy->getObjectReference(),
+            proxy->location(), proxy->bounds(), proxy->mesh().toString(),
+            mContext->simTime()
+        );
+        takeDroppedTasks(dropped);
+    }
+    cancelTasks(dropped);
+}
+
+void MeshPrefetcher::presenceMoved(const ProxyObjectPtr& self) {
+    if (!self || !self->isPresence()) return;
+
+    boost::mutex::scoped_lock lock(mMutex);
+    mPlanner.presenceMoved(self->getObjectReference(), self->location());
+}
+
+void MeshPrefetcher::presenceRemoved(const SpaceObjectReference& presence) {
+    boost::mutex::scoped_lock lock(mMutex);
+    mPlanner.presenceRemoved(presence, mContext->simTime());
+}
+
+MeshPrefetcher::Stats MeshPrefetcher::stats() {
+    boost::mutex::scoped_lock lock(mMutex);
+    return mPlanner.stats();
+}
+
+void MeshPrefetcher::poll() {
+    TaskList started;
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+
+        MeshPrefetchPlanner::RequestList requests;
+        mPlanner.plan(
+            std::tr1::bind(&ObjectHost::currentSpaceTime, mParent, _1),
+            requests
+        );
+        for(MeshPrefetchPlanner::RequestList::iterator it = requests.begin(); it != requests.end(); it++) {
+            Transfer::ResourceDownloadTaskPtr task = Transfer::ResourceDownloadTask::construct(
+                Transfer::URI(it->mesh), mTransferPool, it->priority,
+                std::tr1::bind(&MeshPrefetcher::handleDownloadFinished, this, it->mesh, _1, _2, _3)
+            );
+            mTasks[it->mesh] = task;
+            started.push_back(task);
+        }
+    }
+
+    for(TaskList::iterator it = started.begin(); it != started.end(); it++)
+        (*it)->start();
+}
+
+void MeshPrefetcher::handleDownloadFinished(const String& mesh, Transfer::ResourceDownloadTaskPtr task, Transfer::TransferRequestPtr request, Transfer::DenseDataPtr response) {
+    boost::mutex::scoped_lock lock(mMutex);
+
+    // The mesh may have been dropped, and maybe requested again, since
+    TaskMap::iterator it = mTasks.find(mesh);
+    if (it == mTasks.end() || it->second != task)
+        return;
+    mTasks.erase(it);
+    // We don't need the data, only for it to have passed through the caches
+    mPlanner.fetchFinished(mesh, (bool)response);
+}
+
+void MeshPrefetcher::commandStats(const Command::Command& cmd, Command::Commander* cmdr, Command::CommandID cmdid) {
+    Command::Result result = Command::EmptyResult();
+
+    boost::mutex::scoped_lock lock(mMutex);
+    const Stats& stats = mPlanner.stats();
+    result.put("requested", stats.requested);
+    result.put("completed", stats.completed);
+    result.put("failed", stats.failed);
+    result.put("hits", stats.hits);
+    result.put("late", stats.late);
+    result.put("misses", stats.misses);
+    result.put("unpredicted", stats.unpredicted);
+    result.put("loaded", stats.loaded);
+    result.put("used", stats.used);
+    result.put("wasted", stats.wasted);
+    uint64 entries = stats.hits + stats.late + stats.misses + stats.unpredicted;
+    if (entries > 0)
+        result.put("hit_rate", (float64)stats.hits / entries);
+
+    result.put("candidates", mPlanner.numCandidates());
+    result.put("meshes", mPlanner.numMeshes());
+    result.put("presences", mPlanner.numPresences());
+    result.put("outstanding", mPlanner.outstanding());
+    lock.unlock();
+
+    cmdr->result(cmdid, result);
+}
+
+} // namespace OH
+} // namespace Sirikata
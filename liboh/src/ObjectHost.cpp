@@ -46,6 +46,7 @@
 #include <sirikata/core/util/SpaceObjectReference.hpp>
 #include <sirikata/core/service/Context.hpp>
 #include <sirikata/oh/ObjectQueryProcessor.hpp>
+#include <sirikata/oh/MeshPrefetcher.hpp>
 
 #include <sirikata/core/network/IOStrandImpl.hpp>
 
@@ -61,16 +62,24 @@ ObjectHost::ObjectHost(ObjectHostContext* ctx, Network::IOService *ioServ, const
    mStorage(NULL),
    mPersistentSet(NULL),
    mQueryProcessor(NULL),
+   mMeshPrefetcher(NULL),
    mActiveHostedObjects(0)
 {
     mContext->objectHost = this;
     OptionValue *protocolOptions;
     OptionValue *scriptManagers;
     OptionValue *simOptions;
+    OptionValue *prefetch, *prefetchHorizon, *prefetchAngle, *prefetchMaxOutstanding, *prefetchMaxCandidates, *prefetchPriority;
     InitializeClassOptions ico("objecthost",this,
                            protocolOptions=new OptionValue("protocols","",OptionValueType<std::map<std::string,std::string> >(),"passes options into protocol specific libraries like \"tcpsst:{--send-buffer-size=1440 --parallel-sockets=1},udp:{--send-buffer-size=1500}\""),
                            scriptManagers=new OptionValue("scriptManagers","simplecamera:{},js:{}",OptionValueType<std::map<std::string,std::string> >(),"Instantiates script managers with specified options like \"simplecamera:{},js:{--import-paths=/path/to/scripts}\""),
                            simOptions=new OptionValue("simOptions","ogregraphics:{}",OptionValueType<std::map<std::string,std::string> >(),"Passes initialization strings to simulations, by name"),
+                           prefetch=new OptionValue("prefetch","false",OptionValueType<bool>(),"If true, prefetch meshes of objects expected to come into presences' query results soon"),
+                           prefetchHorizon=new OptionValue("prefetch-horizon","10s",OptionValueType<Duration>(),"Only prefetch objects expected to become visible within this time"),
+                           prefetchAngle=new OptionValue("prefetch-angle","0.01",OptionValueType<float32>(),"Solid angle objects must reach before prefetching expects them to be visible"),
+                           prefetchMaxOutstanding=new OptionValue("prefetch-max-outstanding","4",OptionValueType<uint32>(),"Maximum number of prefetch downloads in progress at once"),
+                           prefetchMaxCandidates=new OptionValue("prefetch-max-candidates","10000",OptionValueType<uint32>(),"Maximum number of objects tracked as prefetch candidates"),
+                           prefetchPriority=new OptionValue("prefetch-priority","0.001",OptionValueType<float64>(),"Transfer priority of the most urgent prefetches, which should be below that of visible objects"),
 
                            NULL);
 
@@ -123,6 +132,16 @@ ObjectHost::ObjectHost(ObjectHostContext* ctx, Network::IOService *ioServ, const
 
     mTransferMediator = &(Transfer::TransferMediator::getSingleton());
     mTransferPool = mTransferMediator->registerClient<Transfer::AggregatedTransferPool>("ObjectHost");
+
+    if (prefetch->as<bool>()) {
+        OH::MeshPrefetcher::Options prefetch_opts;
+        prefetch_opts.horizon = prefetchHorizon->as<Duration>();
+        prefetch_opts.solidAngle = prefetchAngle->as<float32>();
+        prefetch_opts.maxOutstanding = prefetchMaxOutstanding->as<uint32>();
+        prefetch_opts.maxCandidates = prefetchMaxCandidates->as<uint32>();
+        prefetch_opts.maxPriority = prefetchPriority->as<float64>();
+        mMeshPrefetcher = new OH::MeshPrefetcher(mContext, this, prefetch_opts);
+    }
 }
 
 ObjectHost::~ObjectHost()
@@ -137,6 +156,8 @@ ObjectHost::~ObjectHost()
         }
         objs.clear(); // The HostedObject destructor will attempt to delete from mHostedObjects
     }
+
+    delete mMeshPrefetcher;
 }
 
 HostedObjectPtr ObjectHost::createObject(const String& script_type, const String& script_opts, const String& script_contents) {
@@ -368,8 +389,11 @@ void ObjectHost::unregisterHostedObject(const SpaceObjectReference& sporef_uuid,
         // The NULL case covers the possibility that the connection finishes
         // after the HostedObject requests destruction and stops paying
         // attention to connection events
-        if (key_obj == NULL || obj.get()==key_obj)
+        if (key_obj == NULL || obj.get()==key_obj) {
             mHostedObjects.erase(iter);
+            if (mMeshPrefetcher != NULL)
+                mMeshPrefetcher->presenceRemoved(sporef_uuid);
+        }
         else
             SILOG(oh,error,"Two objects having the same internal name in the mHostedObjects map on disconnect "<<sporef_uuid.toString());
     }
@@ -416,9 +440,14 @@ ObjectHost::SSTStreamPtr ObjectHost::getSpaceStream(const SpaceID& space, const
 
 void ObjectHost::start()
 {
+    if (mMeshPrefetcher != NULL)
+        mMeshPrefetcher->start();
 }
 
 void ObjectHost::stop() {
+    if (mMeshPrefetcher != NULL)
+        mMeshPrefetcher->stop();
+
     for(SpaceSessionManagerMap::iterator it = mSessionManagers.begin(); it != mSessionManagers.end(); it++) {
         SessionManager* sm = it->second;
         sm->stop();
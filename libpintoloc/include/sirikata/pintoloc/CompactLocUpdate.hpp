@@ -0,0 +1,87 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_LIBPINTOLOC_COMPACT_LOC_UPDATE_HPP_
+#define _SIRIKATA_LIBPINTOLOC_COMPACT_LOC_UPDATE_HPP_
+
+#include <sirikata/pintoloc/LocUpdate.hpp>
+#include <sirikata/pintoloc/TimeSynced.hpp>
+#include <sirikata/core/util/CompactLocEncoding.hpp>
+
+namespace Sirikata {
+
+/** Implementation of LocUpdate which collects its information from a
+ *  CompactLocRecord decoded from a compact location update message.
+ *
+ *  \note the references passed in must remain valid for the lifetime of this
+ *  object.
+ */
+class SIRIKATA_LIBPINTOLOC_EXPORT CompactLocUpdate : public LocUpdate {
+public:
+    CompactLocUpdate(const CompactLocRecord& rec, const TimeSynced& sync)
+     : mRecord(rec),
+       mSync(sync)
+    {}
+    virtual ~CompactLocUpdate() {}
+
+    virtual ObjectReference object() const { return ObjectReference(mRecord.object); }
+
+    // Request epoch
+    virtual bool has_epoch() const { return mRecord.has(CompactLocRecord::EpochField); }
+    virtual uint64 epoch() const { return mRecord.epoch; }
+
+    // Parent aggregate, never included in compact updates
+    virtual bool has_parent() const { return false; }
+    virtual ObjectReference parent() const { return ObjectReference::null(); }
+    virtual uint64 parent_seqno() const { return mRecord.seqno; }
+
+    // Location
+    virtual bool has_location() const { return mRecord.has(CompactLocRecord::LocationField); }
+    virtual TimedMotionVector3f location() const {
+        return TimedMotionVector3f(mSync.localTime(mRecord.location.updateTime()), mRecord.location.value());
+    }
+    virtual uint64 location_seqno() const { return mRecord.seqno; }
+
+    // Orientation
+    virtual bool has_orientation() const { return mRecord.has(CompactLocRecord::OrientationField); }
+    virtual TimedMotionQuaternion orientation() const {
+        return TimedMotionQuaternion(mSync.localTime(mRecord.orientation.updateTime()), mRecord.orientation.value());
+    }
+    virtual uint64 orientation_seqno() const { return mRecord.seqno; }
+
+    // Bounds
+    virtual bool has_bounds() const { return mRecord.has(CompactLocRecord::BoundsField); }
+    virtual AggregateBoundingInfo bounds() const { return mRecord.bounds; }
+    virtual uint64 bounds_seqno() const { return mRecord.seqno; }
+
+    // Mesh
+    virtual bool has_mesh() const { return mRecord.has(CompactLocRecord::MeshField); }
+    virtual String mesh() const { return mRecord.mesh; }
+    virtual uint64 mesh_seqno() const { return mRecord.seqno; }
+
+    // Physics
+    virtual bool has_physics() const { return mRecord.has(CompactLocRecord::PhysicsField); }
+    virtual String physics() const { return mRecord.physics; }
+    virtual uint64 physics_seqno() const { return mRecord.seqno; }
+
+    // Query data
+    virtual bool has_query_data() const { return mRecord.has(CompactLocRecord::QueryDataField); }
+    virtual String query_data() const { return mRecord.query_data; }
+    virtual uint64 query_data_seqno() const { return mRecord.seqno; }
+
+    virtual uint32 index_id_size() const { return mRecord.index_ids.size(); }
+    virtual ProxIndexID index_id(int32 idx) const { return mRecord.index_ids[idx]; }
+    virtual uint64 index_id_seqno() const { return mRecord.seqno; }
+
+private:
+    CompactLocUpdate();
+    CompactLocUpdate(const CompactLocUpdate&);
+
+    const CompactLocRecord& mRecord;
+    const TimeSynced& mSync;
+}; // class CompactLocUpdate
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_LIBPINTOLOC_COMPACT_LOC_UPDATE_HPP_
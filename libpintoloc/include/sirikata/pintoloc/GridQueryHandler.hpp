@@ -0,0 +1,658 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_PINTOLOC_GRID_QUERY_HANDLER_HPP_
+#define _SIRIKATA_PINTOLOC_GRID_QUERY_HANDLER_HPP_
+
+#include <prox/geom/QueryHandler.hpp>
+#include <prox/base/LocationUpdateListener.hpp>
+#include <prox/geom/QueryChangeListener.hpp>
+#include <sirikata/core/util/SphereBatch.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace Sirikata {
+
+/** Implementation of QueryHandler which stores objects in a hashed uniform
+ *  grid, keyed by the cell containing the center of their bounds. Unlike the
+ *  tree based handlers, moving an object never restructures anything: it's
+ *  just swapped out of one cell's list and appended to another's, so the cost
+ *  of an update is constant. This makes it a good fit for dynamic objects,
+ *  where rtrees spend most of their time refitting and restructuring.
+ *
+ *  Queries are evaluated against all the cells within their reach -- the
+ *  query radius for distance queries, or the distance at which the largest
+ *  object would drop below the minimum solid angle for solid angle queries --
+ *  padded by the largest object bounds seen. If that covers more cells than
+ *  are occupied, only the occupied cells are scanned. Each cell keeps its
+ *  objects' bounds in a SphereBatch so the constraints are checked against
+ *  the whole cell at once, with SSE where available. Results are flat, no
+ *  aggregates are generated.
+ *
+ *  Because of SphereBatch, SimulationTraits must use Sirikata's single
+ *  precision geometry types, as ProxSimulationTraits does.
+ */
+template<typename SimulationTraits>
+class GridQueryHandler : public Prox::QueryHandler<SimulationTraits> {
+public:
+    typedef SimulationTraits SimulationTraitsType;
+
+    typedef Prox::QueryHandler<SimulationTraits> QueryHandlerType;
+    typedef Prox::LocationUpdateListener<SimulationTraits> LocationUpdateListenerType;
+    typedef Prox::LocationUpdateProvider<SimulationTraits> LocationUpdateProviderType;
+    typedef Prox::QueryChangeListener<SimulationTraits> QueryChangeListenerType;
+
+    typedef Prox::Query<SimulationTraits> QueryType;
+    typedef Prox::QueryEvent<SimulationTraits> QueryEventType;
+    typedef Prox::LocationServiceCache<SimulationTraits> LocationServiceCacheType;
+    typedef typename LocationServiceCacheType::Iterator LocCacheIterator;
+
+    typedef typename SimulationTraits::ObjectIDType ObjectID;
+    typedef typename SimulationTraits::ObjectIDHasherType ObjectIDHasher;
+    typedef typename SimulationTraits::TimeType Time;
+    typedef typename SimulationTraits::realType Real;
+    typedef typename SimulationTraits::Vector3Type Vector3;
+    typedef typename SimulationTraits::MotionVector3Type MotionVector3;
+    typedef typename SimulationTraits::BoundingSphereType BoundingSphere;
+    typedef typename SimulationTraits::SolidAngleType SolidAngle;
+
+    typedef typename QueryHandlerType::ShouldTrackCallback ShouldTrackCallback;
+    typedef typename QueryHandlerType::ObjectList ObjectList;
+    typedef typename QueryHandlerType::NodeIteratorImpl NodeIteratorImpl;
+
+    typedef typename std::tr1::function<GridQueryHandler*()> QueryHandlerCreator;
+
+    static GridQueryHandler* construct(Real cell_size) {
+        return new GridQueryHandler(cell_size);
+    }
+    static QueryHandlerCreator Constructor(Real cell_size) {
+        return std::tr1::bind(&GridQueryHandler::construct, cell_size);
+    }
+
+    GridQueryHandler(Real cell_size)
+     : QueryHandlerType(),
+       mLocCache(NULL),
+       mLocUpdateProvider(NULL),
+       mStaticObjects(false),
+       mLastTime(Time::null()),
+       mCellSize(cell_size > 0 ? cell_size : 1),
+       mMaxCenterRadius(0),
+       mMaxObjectSize(0),
+       mLastChecks(0)
+    {
+    }
+
+    virtual ~GridQueryHandler() {
+        for(QueryMapIterator it = mQueries.begin(); it != mQueries.end(); it++) {
+            QueryState* state = it->second;
+            delete state;
+        }
+        mQueries.clear();
+
+        for(ObjectMapIterator it = mObjects.begin(); it != mObjects.end(); it++) {
+            mLocCache->stopTracking(it->second->loc);
+            delete it->second;
+        }
+        mObjects.clear();
+        mCells.clear();
+
+        mLocUpdateProvider->removeUpdateListener(this);
+    }
+
+    void initialize(LocationServiceCacheType* loc_cache, LocationUpdateProviderType* loc_up_provider, bool static_objects, bool replicated, ShouldTrackCallback should_track_cb = 0) {
+        mLocCache = loc_cache;
+        mLocUpdateProvider = loc_up_provider;
+        mLocUpdateProvider->addUpdateListener(this);
+        mStaticObjects = static_objects;
+        mShouldTrackCB = should_track_cb;
+    }
+
+    virtual bool staticOnly() const {
+        return mStaticObjects;
+    }
+
+    void tick(const Time& t, bool report) {
+        // Bring the grid up to date: updated objects get placed at their new
+        // positions and moving objects at where they've drifted to.
+        for(ObjectStateSetIterator it = mDirtyObjects.begin(); it != mDirtyObjects.end(); it++)
+            placeObject(*it, t);
+        mDirtyObjects.clear();
+        for(ObjectStateSetIterator it = mMovingObjects.begin(); it != mMovingObjects.end(); it++)
+            placeObject(*it, t, false);
+        mLastTime = t;
+
+        if (QueryHandlerType::mReportQueryStats && report)
+            printf("tick\n");
+
+        mLastChecks = 0;
+        for(QueryMapIterator query_it = mQueries.begin(); query_it != mQueries.end(); query_it++) {
+            QueryType* query = query_it->first;
+            QueryState* state = query_it->second;
+
+            uint32 checks = evaluateQuery(query, state, t);
+            mLastChecks += checks;
+
+            if (QueryHandlerType::mReportQueryStats && report) {
+                printf("{ \"id\" : %d, \"checks\" : %d, \"cells\" : %d, \"results\" : %d }\n", query->id(), checks, state->cellsVisited, (uint32)state->results.size());
+            }
+        }
+
+        if (QueryHandlerType::mReportCost && report)
+            printf("{ \"cost\" : %f }\n", cost());
+    }
+
+    virtual void rebuild() {
+        // Nothing to restructure, but the padding for object bounds only ever
+        // grows as objects are updated, so recompute it.
+        mMaxCenterRadius = 0;
+        mMaxObjectSize = 0;
+        for(ObjectMapIterator it = mObjects.begin(); it != mObjects.end(); it++) {
+            mMaxCenterRadius = std::max(mMaxCenterRadius, it->second->radius);
+            mMaxObjectSize = std::max(mMaxObjectSize, it->second->maxSize);
+        }
+    }
+
+    virtual float cost() {
+        // Average number of objects checked per query in the last tick
+        if (mQueries.empty()) return 0.f;
+        return mLastChecks / (float)mQueries.size();
+    }
+
+    virtual uint32 numObjects() const {
+        return (uint32)mObjects.size();
+    }
+    virtual uint32 numQueries() const {
+        return (uint32)mQueries.size();
+    }
+    virtual uint32 numNodes() const {
+        // No aggregates, see nodesBeginImpl
+        return 0;
+    }
+
+    virtual ObjectID rootAggregateID()  {
+        return typename SimulationTraits::ObjectIDNullType()();
+    }
+
+    virtual uint32 numResultsForQuery(const QueryType* q) const {
+        QueryMapConstIterator it = mQueries.find(const_cast<QueryType*>(q));
+        if (it == mQueries.end()) return 0; // For rebuilding query handler
+        return (uint32)it->second->results.size();
+    }
+    virtual uint32 sizeForQuery(const QueryType* q) const {
+        QueryMapConstIterator it = mQueries.find(const_cast<QueryType*>(q));
+        if (it == mQueries.end()) return 0; // For rebuilding query handler
+        return it->second->cellsVisited;
+    }
+
+    virtual LocationServiceCacheType* locationCache() const {
+        return mLocCache;
+    }
+
+    virtual void draw() {}
+
+    void addObject(const ObjectID& obj_id) {
+        addObject(mLocCache->startTracking(obj_id));
+    }
+    void addObject(const LocCacheIterator& obj_loc_it) {
+        ObjectID obj_id = mLocCache->iteratorID(obj_loc_it);
+        assert(mObjects.find(obj_id) == mObjects.end());
+
+        ObjectState* obj = new ObjectState(obj_id, obj_loc_it);
+        mObjects[obj_id] = obj;
+        placeObject(obj, mLastTime);
+    }
+    // The grid is flat, parents are ignored
+    void addObject(const ObjectID& obj_id, const ObjectID& parent) {
+        addObject(obj_id);
+    }
+    void addObject(const LocCacheIterator& obj_loc_it, const ObjectID& parent) {
+        addObject(obj_loc_it);
+    }
+
+    void removeObject(const ObjectID& obj_id, bool temporary = false) {
+        ObjectMapIterator it = mObjects.find(obj_id);
+        if (it == mObjects.end()) return;
+        ObjectState* obj = it->second;
+
+        // Results need to be removed immediately since the object won't be
+        // around for the next tick to notice it's gone.
+        for(QueryMapIterator query_it = mQueries.begin(); query_it != mQueries.end(); query_it++) {
+            QueryState* state = query_it->second;
+            typename ResultSet::iterator result_it = state->results.find(obj_id);
+            if (result_it == state->results.end()) continue;
+            state->results.erase(result_it);
+
+            QueryEventType evt(mLocCache, QueryHandlerType::handlerID());
+            evt.addRemoval( typename QueryEventType::Removal(obj_id, temporary ? QueryEventType::Transient : QueryEventType::Permanent) );
+            query_it->first->pushEvent(evt);
+        }
+
+        unplaceObject(obj);
+        mDirtyObjects.erase(obj);
+        mMovingObjects.erase(obj);
+        mLocCache->stopTracking(obj->loc);
+        mObjects.erase(it);
+        delete obj;
+    }
+
+    bool containsObject(const ObjectID& obj_id) {
+        return (mObjects.find(obj_id) != mObjects.end());
+    }
+
+    ObjectList allObjects() {
+        ObjectList retval;
+        retval.reserve(mObjects.size());
+        for(ObjectMapIterator it = mObjects.begin(); it != mObjects.end(); it++)
+            retval.push_back(mLocCache->startTracking(it->first));
+        return retval;
+    }
+
+
+    // Nodes (aggregates) are just treated like objects, the same as other
+    // handlers do when they aren't reconstructing a replicated tree.
+    void addNode(const ObjectID& nodeid) {
+        addObject(nodeid);
+    }
+    void addNode(const ObjectID& nodeid, const ObjectID& parent) {
+        addObject(nodeid);
+    }
+    void addNode(const LocCacheIterator& node_loc_it, const ObjectID& parent) {
+        addObject(node_loc_it);
+    }
+    void removeNode(const ObjectID& nodeid, bool temporary = false) {
+        removeObject(nodeid, temporary);
+    }
+
+    void reparent(const ObjectID& nodeobjid, const ObjectID& parentid) {
+        // No hierarchy to update
+    }
+
+
+    void locationConnected(const ObjectID& obj_id, bool aggregate, bool local, const MotionVector3& pos, const BoundingSphere& region, Real ms) {
+        assert(mObjects.find(obj_id) == mObjects.end());
+
+        bool do_track = true;
+        if (mShouldTrackCB) do_track = mShouldTrackCB(obj_id, local, aggregate, pos, region, ms);
+
+        if (do_track)
+            addObject(obj_id);
+    }
+
+    void locationConnectedWithParent(const ObjectID& obj_id, const ObjectID& parent, bool aggregate, bool local, const MotionVector3& pos, const BoundingSphere& region, Real ms) {
+        locationConnected(obj_id, aggregate, local, pos, region, ms);
+    }
+
+    // LocationUpdateListener Implementation
+    void locationParentUpdated(const ObjectID& obj_id, const ObjectID& old_par, const ObjectID& new_par) {
+    }
+
+    void locationPositionUpdated(const ObjectID& obj_id, const MotionVector3& old_pos, const MotionVector3& new_pos) {
+        markDirty(obj_id);
+    }
+
+    void locationRegionUpdated(const ObjectID& obj_id, const BoundingSphere& old_region, const BoundingSphere& new_region) {
+        markDirty(obj_id);
+    }
+
+    void locationMaxSizeUpdated(const ObjectID& obj_id, Real old_maxSize, Real new_maxSize) {
+        markDirty(obj_id);
+    }
+
+    void locationQueryDataUpdated(const ObjectID& obj_id, const String& old_query_data, const String& new_query_data) {
+    }
+
+    void locationDisconnected(const ObjectID& obj_id, bool temporary = false) {
+        removeObject(obj_id, temporary);
+    }
+
+    // QueryChangeListener Implementation
+    // Nothing to be done for any of these, we use values directly from the
+    // query when evaluating it.
+    void queryPositionChanged(QueryType* query, const MotionVector3& old_pos, const MotionVector3& new_pos) {
+    }
+
+    void queryRegionChanged(QueryType* query, const BoundingSphere& old_region, const BoundingSphere& new_region) {
+    }
+
+    void queryMaxSizeChanged(QueryType* query, Real old_ms, Real new_ms) {
+    }
+
+    void queryAngleChanged(QueryType* query, const SolidAngle& old_val, const SolidAngle& new_val) {
+    }
+
+    void queryMaxResultsChanged(QueryType* query, const uint32 old_val, const uint32 new_val) {
+    }
+
+    void queryCustomQueryChanged(QueryType* query, const String& old_val, const String& new_val) {
+    }
+
+    void queryDestroyed(QueryType* query, bool implicit) {
+        QueryMapIterator it = mQueries.find(query);
+        assert( it != mQueries.end() );
+        QueryState* state = it->second;
+
+        // Fill in removal events if they aren't implicit
+        if (!implicit && !state->results.empty()) {
+            QueryEventType rem_evt(mLocCache, QueryHandlerType::handlerID());
+            for(typename ResultSet::iterator result_it = state->results.begin(); result_it != state->results.end(); result_it++)
+                rem_evt.addRemoval( typename QueryEventType::Removal(*result_it, QueryEventType::Transient) );
+            query->pushEvent(rem_evt);
+        }
+
+        delete state;
+        mQueries.erase(it);
+    }
+
+    void queryDeleted(const QueryType* query) {
+    }
+
+protected:
+
+    void registerQuery(QueryType* query) {
+        // Results are generated on the next tick
+        QueryState* state = new QueryState();
+        mQueries[query] = state;
+        query->addChangeListener(this);
+    }
+
+    // There are no aggregate nodes to iterate over.
+    virtual NodeIteratorImpl* nodesBeginImpl() const {
+        return NULL;
+    }
+    virtual NodeIteratorImpl* nodesEndImpl() const {
+        return NULL;
+    }
+
+private:
+    struct CellKey {
+        CellKey()
+         : x(0), y(0), z(0)
+        {}
+        CellKey(int32 _x, int32 _y, int32 _z)
+         : x(_x), y(_y), z(_z)
+        {}
+
+        bool operator==(const CellKey& rhs) const {
+            return (x == rhs.x && y == rhs.y && z == rhs.z);
+        }
+        bool operator!=(const CellKey& rhs) const {
+            return !(*this == rhs);
+        }
+
+        int32 x, y, z;
+    };
+    struct CellKeyHasher {
+        size_t operator()(const CellKey& key) const {
+            // Large primes, as in Teschner et al., Optimized Spatial Hashing
+            return (size_t)((key.x * 73856093u) ^ (key.y * 19349663u) ^ (key.z * 83492791u));
+        }
+    };
+
+    struct ObjectState;
+    // Unordered, objects are swapped into the holes left by removals. batch
+    // holds each object's bounds at the same index as objects. Positions are
+    // stored as of Time::null() with zero velocity since objects are re-placed
+    // as they move.
+    struct Cell {
+        std::vector<ObjectState*> objects;
+        SphereBatch batch;
+    };
+    typedef std::tr1::unordered_map<CellKey, Cell, CellKeyHasher> CellMap;
+    typedef typename CellMap::iterator CellMapIterator;
+
+    struct ObjectState {
+        ObjectState(const ObjectID& _id, const LocCacheIterator& _loc)
+         : id(_id),
+           loc(_loc),
+           radius(0),
+           maxSize(0),
+           cell(NULL),
+           cellIndex(0)
+        {}
+
+        ObjectID id;
+        LocCacheIterator loc;
+        // Cached from the location cache when placed so queries don't need
+        // to hit it for every candidate
+        Vector3 center;
+        Real radius;
+        Real maxSize;
+        // Cell entries are never moved by other cells changing, so we can
+        // hold onto them directly
+        CellKey cellKey;
+        Cell* cell;
+        uint32 cellIndex;
+    };
+    typedef std::tr1::unordered_map<ObjectID, ObjectState*, ObjectIDHasher> ObjectMap;
+    typedef typename ObjectMap::iterator ObjectMapIterator;
+    typedef std::tr1::unordered_set<ObjectState*> ObjectStateSet;
+    typedef typename ObjectStateSet::iterator ObjectStateSetIterator;
+
+    typedef std::tr1::unordered_set<ObjectID, ObjectIDHasher> ResultSet;
+    struct QueryState {
+        QueryState()
+         : cellsVisited(0)
+        {}
+
+        ResultSet results;
+        uint32 cellsVisited;
+    };
+    typedef std::tr1::unordered_map<QueryType*, QueryState*> QueryMap;
+    typedef typename QueryMap::iterator QueryMapIterator;
+    typedef typename QueryMap::const_iterator QueryMapConstIterator;
+
+    // Objects matching a query, with the score used to select the best ones
+    // when there are more than the query's maximum number of results
+    typedef std::pair<Real, ObjectState*> Candidate;
+    typedef std::vector<Candidate> CandidateList;
+    struct CandidateGreater {
+        bool operator()(const Candidate& lhs, const Candidate& rhs) const {
+            return lhs.first > rhs.first;
+        }
+    };
+
+    // Casting a float that's out of range for int32 is undefined, so huge
+    // coordinates are clamped and share the cells at the edge of the grid.
+    // Non-finite coordinates (which can't satisfy any query anyway) go in the
+    // cell at the origin.
+    int32 cellCoord(Real val) const {
+        static const int32 kMaxCoord = (1 << 30);
+        Real coord = std::floor(val / mCellSize);
+        if (coord != coord) return 0;
+        if (coord < -(Real)kMaxCoord) return -kMaxCoord;
+        if (coord > (Real)kMaxCoord) return kMaxCoord;
+        return (int32)coord;
+    }
+    CellKey cellKey(const Vector3& pos) const {
+        return CellKey(cellCoord(pos.x), cellCoord(pos.y), cellCoord(pos.z));
+    }
+
+    void markDirty(const ObjectID& obj_id) {
+        ObjectMapIterator it = mObjects.find(obj_id);
+        if (it == mObjects.end()) return;
+        mDirtyObjects.insert(it->second);
+    }
+
+    // Places the object into the cell for its position at time t, refreshing
+    // cached location data. If full is false, only the position is updated,
+    // as for objects moving along their previous trajectory.
+    void placeObject(ObjectState* obj, const Time& t, bool full = true) {
+        MotionVector3 loc = mLocCache->location(obj->loc);
+        if (full) {
+            obj->radius = mLocCache->centerBoundsRadius(obj->loc);
+            obj->maxSize = mLocCache->maxSize(obj->loc);
+            mMaxCenterRadius = std::max(mMaxCenterRadius, obj->radius);
+            mMaxObjectSize = std::max(mMaxObjectSize, obj->maxSize);
+
+            if (!mStaticObjects && loc.velocity().lengthSquared() > 0)
+                mMovingObjects.insert(obj);
+            else
+                mMovingObjects.erase(obj);
+        }
+        obj->center = loc.position(t) + mLocCache->centerOffset(obj->loc);
+
+        TimedMotionVector3f batch_loc(Time::null(), MotionVector3f(obj->center, Vector3::zero()));
+
+        CellKey key = cellKey(obj->center);
+        if (obj->cell != NULL && obj->cellKey == key) {
+            obj->cell->batch.update(obj->cellIndex, batch_loc, obj->radius, obj->maxSize);
+            return;
+        }
+
+        unplaceObject(obj);
+        Cell& cell = mCells[key];
+        obj->cellKey = key;
+        obj->cell = &cell;
+        obj->cellIndex = (uint32)cell.objects.size();
+        cell.objects.push_back(obj);
+        cell.batch.add(batch_loc, obj->radius, obj->maxSize);
+    }
+
+    void unplaceObject(ObjectState* obj) {
+        if (obj->cell == NULL) return;
+
+        Cell& cell = *(obj->cell);
+        ObjectState* last = cell.objects.back();
+        cell.objects[obj->cellIndex] = last;
+        last->cellIndex = obj->cellIndex;
+        cell.objects.pop_back();
+        // Does the same swap with the last entry
+        cell.batch.remove(obj->cellIndex);
+        if (cell.objects.empty())
+            mCells.erase(obj->cellKey);
+
+        obj->cell = NULL;
+    }
+
+    // Score for ranking an object which satisfies the query, larger is better
+    Real score(const ObjectState* obj, const SphereBatchQuery& query) const {
+        Real dist = std::max((obj->center - query.center()).length() - query.regionRadius(), (Real)0);
+        // Rank by apparent size, so the largest solid angles win out
+        if (dist <= obj->maxSize) return SimulationTraits::InfiniteRadius;
+        return (obj->maxSize * obj->maxSize) / (dist * dist);
+    }
+
+    void checkCell(const Cell& cell, const SphereBatchQuery& query) {
+        mCulled.clear();
+        cell.batch.cull(Time::null(), query, &mCulled);
+        for(std::vector<uint32>::const_iterator it = mCulled.begin(); it != mCulled.end(); it++) {
+            ObjectState* obj = cell.objects[*it];
+            mCandidates.push_back(Candidate(score(obj, query), obj));
+        }
+    }
+
+    // Evaluates the query against the grid and pushes events for any changes
+    // to its results. Returns the number of objects checked.
+    uint32 evaluateQuery(QueryType* query, QueryState* state, const Time& t) {
+        Vector3 qpos = query->position(t);
+        BoundingSphere qregion = query->region();
+        Vector3 qcenter = qpos + qregion.center();
+        Real qregion_radius = qregion.radius();
+        Real qradius = query->radius();
+        const SolidAngle& qangle = query->angle();
+        uint32 qmax_results = query->maxResults();
+
+        // Farthest an object's center could be and still satisfy the query
+        Real reach = SimulationTraits::InfiniteRadius;
+        if (qradius != SimulationTraits::InfiniteRadius)
+            reach = qregion_radius + qradius + mMaxCenterRadius;
+        if (qangle != SolidAngle::Min)
+            reach = std::min(reach, qregion_radius + qangle.maxDistance(mMaxObjectSize));
+        SphereBatchQuery batch_query(
+            qcenter, qregion_radius,
+            (qradius == SimulationTraits::InfiniteRadius ? SphereBatchQuery::NoMaxDistance : qradius),
+            qangle
+        );
+
+        mCandidates.clear();
+        uint32 checks = 0;
+        state->cellsVisited = 0;
+
+        // Either scan every cell within reach, or if that's more than are
+        // occupied (including very large or infinite reach), just scan the
+        // occupied cells.
+        bool scan_range = (reach / mCellSize < 1024);
+        CellKey lo, hi;
+        if (scan_range) {
+            lo = cellKey(qcenter - Vector3(reach, reach, reach));
+            hi = cellKey(qcenter + Vector3(reach, reach, reach));
+            float64 range_cells = (hi.x - lo.x + 1.0) * (hi.y - lo.y + 1.0) * (hi.z - lo.z + 1.0);
+            scan_range = (range_cells < mCells.size());
+        }
+        if (scan_range) {
+            for(int32 x = lo.x; x <= hi.x; x++) {
+                for(int32 y = lo.y; y <= hi.y; y++) {
+                    for(int32 z = lo.z; z <= hi.z; z++) {
+                        CellMapIterator cell_it = mCells.find(CellKey(x, y, z));
+                        if (cell_it == mCells.end()) continue;
+                        state->cellsVisited++;
+                        checks += cell_it->second.objects.size();
+                        checkCell(cell_it->second, batch_query);
+                    }
+                }
+            }
+        }
+        else {
+            for(CellMapIterator cell_it = mCells.begin(); cell_it != mCells.end(); cell_it++) {
+                state->cellsVisited++;
+                checks += cell_it->second.objects.size();
+                checkCell(cell_it->second, batch_query);
+            }
+        }
+
+        if (qmax_results != SimulationTraits::InfiniteResults && mCandidates.size() > qmax_results) {
+            std::nth_element(mCandidates.begin(), mCandidates.begin() + qmax_results, mCandidates.end(), CandidateGreater());
+            mCandidates.resize(qmax_results);
+        }
+
+        // Diff against the previous results
+        ResultSet new_results;
+        QueryEventType evt(mLocCache, QueryHandlerType::handlerID());
+        for(typename CandidateList::iterator it = mCandidates.begin(); it != mCandidates.end(); it++) {
+            const ObjectID& objid = it->second->id;
+            new_results.insert(objid);
+            if (state->results.find(objid) == state->results.end())
+                evt.addAddition( typename QueryEventType::Addition(objid, QueryEventType::Normal) );
+        }
+        for(typename ResultSet::iterator it = state->results.begin(); it != state->results.end(); it++) {
+            if (new_results.find(*it) == new_results.end())
+                evt.addRemoval( typename QueryEventType::Removal(*it, QueryEventType::Transient) );
+        }
+        state->results.swap(new_results);
+
+        if (evt.size() > 0)
+            query->pushEvent(evt);
+
+        return checks;
+    }
+
+    LocationServiceCacheType* mLocCache;
+    LocationUpdateProviderType* mLocUpdateProvider;
+    ShouldTrackCallback mShouldTrackCB;
+    bool mStaticObjects;
+
+    ObjectMap mObjects;
+    CellMap mCells;
+    // Objects updated since the last tick
+    ObjectStateSet mDirtyObjects;
+    // Objects with non-zero velocity, which need to be re-placed every tick
+    ObjectStateSet mMovingObjects;
+    QueryMap mQueries;
+    Time mLastTime;
+
+    const Real mCellSize;
+    // Largest object bounds seen, used to pad the region searched for queries
+    Real mMaxCenterRadius;
+    Real mMaxObjectSize;
+
+    CandidateList mCandidates;
+    // Indices of the objects in a cell which satisfied the query
+    std::vector<uint32> mCulled;
+    uint32 mLastChecks;
+}; // class GridQueryHandler
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_PINTOLOC_GRID_QUERY_HANDLER_HPP_
@@ -20,6 +20,8 @@
 
 #include <prox/manual/RTreeManualQueryHandler.hpp>
 
+#include <sirikata/pintoloc/GridQueryHandler.hpp>
+
 namespace Sirikata {
 
 // Implementation note: it would be nice to just use a templated singleton
@@ -110,6 +112,8 @@ public:
         handler_types.push_back("rtreecut");
         handler_types.push_back("rtreecutagg");
         handler_types.push_back("level");
+        handler_types.push_back("grid");
+        handler_types.push_back("griddist");
 
         for(uint32 handler_type = 0; handler_type < handler_types.size(); handler_type++) {
             for(uint32 per_node_data = 0; per_node_data < per_node_datas.size(); per_node_data++) {
@@ -131,12 +135,15 @@ private:
     static QueryHandler* ConstructWithNodeData(const String& type, const String& args, bool rebuilding = true) {
         static OptionValue* branching = NULL;
         static OptionValue* rebuild_batch_size = NULL;
+        static OptionValue* cell_size = NULL;
         if (branching == NULL) {
             branching = new OptionValue("branching", "10", Sirikata::OptionValueType<uint32>(), "Number of children each node should have.");
             rebuild_batch_size = new OptionValue("rebuild-batch-size", "10", Sirikata::OptionValueType<uint32>(), "Number of queries to transition on each iteration when rebuilding. Keep this small to avoid long latencies between updates.");
+            cell_size = new OptionValue("cell-size", "50", Sirikata::OptionValueType<float32>(), "Size of grid cells for grid query handlers. Should be on the order of query distances; too small and queries visit many cells, too large and they check many objects.");
             Sirikata::InitializeClassOptions ico("query_handler", NULL,
                 branching,
                 rebuild_batch_size,
+                cell_size,
                 NULL);
         }
 
@@ -145,6 +152,7 @@ private:
         // Since these options end up being shared if you instantiate multiple
         // QueryHandlers, reset them each time.
         branching->unsafeAs<uint32>() = 10;
+        cell_size->unsafeAs<float32>() = 50.f;
 
         OptionSet* optionsSet = OptionSet::getOptions("query_handler", NULL);
         optionsSet->parse(args);
@@ -197,6 +205,15 @@ private:
             else
                 return new Prox::LevelQueryHandler<SimulationTraits, NodeDataType>(branching->unsafeAs<uint32>());
         }
+        else if (type == "grid" || type == "griddist") {
+            // Node data doesn't apply, the grid doesn't generate aggregates
+            if (rebuilding)
+                return new Prox::RebuildingQueryHandler<SimulationTraits>(
+                    GridQueryHandler<SimulationTraits>::Constructor(cell_size->unsafeAs<float32>()), rebuild_batch_size->unsafeAs<uint32>()
+                );
+            else
+                return new GridQueryHandler<SimulationTraits>(cell_size->unsafeAs<float32>());
+        }
         else {
             return NULL;
         }
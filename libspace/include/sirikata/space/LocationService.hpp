@@ -180,6 +180,11 @@ public:
     virtual void unsubscribe(const UUID& remote, const UUID& uuid, ProxIndexID index_id) = 0;
     /** Unsubscribe remote for updates about all objects across all indices. */
     virtual void unsubscribe(const UUID& remote, const std::tr1::function<void()>&callback) = 0;
+    /** Indicate that remote can decode compact location updates (see
+     *  CompactLocEncoder), which it requests when it connects. Policies may
+     *  ignore this and keep sending regular updates, the default.
+     */
+    virtual void enableCompactUpdates(const UUID& remote) {}
 
     virtual void service() = 0;
 
@@ -326,6 +331,8 @@ protected:
     typedef ODPSST::StreamPtr SSTStreamPtr;
     void handleLocationUpdateSubstream(const UUID& source, int err, SSTStreamPtr s);
     void handleLocationUpdateSubstreamRead(const UUID& source, SSTStreamPtr s, std::stringstream* prevdata, uint8* buffer, int length);
+    void handleCompactUpdatesSubstream(const UUID& source, int err, SSTStreamPtr s);
+    void handleCompactUpdatesSubstreamRead(const UUID& source, SSTStreamPtr s, uint8* buffer, int length);
     void tryHandleLocationUpdate(const UUID& source, SSTStreamPtr s, const String& payload, std::stringstream* prevdata);
 
     SpaceContext* mContext;
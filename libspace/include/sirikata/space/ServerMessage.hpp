@@ -37,6 +37,7 @@
 
 #include <sirikata/core/network/Message.hpp>
 #include <sirikata/core/network/ObjectMessage.hpp>
+#include <sirikata/core/network/MessageBatch.hpp>
 
 #include "Protocol_ServerMessage.pbj.hpp"
 
@@ -104,6 +105,11 @@ public:
     // Deprecated. Remains for backwards compatibility.
     bool serialize(Network::Chunk* result) const;
     static Message* deserialize(const Network::Chunk& wire);
+    /** Serialize the message directly onto the end of a batch. Also updates
+     *  the size returned by serializedSize().
+     *  \returns true if successful, otherwise the batch is left unchanged
+     */
+    bool serialize(Network::MessageBatchWriter* batch) const;
 
     // Deprecated. Remains for backwards compatibility.
     uint32 serializedSize() const;
@@ -42,6 +42,7 @@
 namespace Sirikata {
 
 class ServerIDMap;
+class Message;
 
 /** The SpaceNetworkConnectionListener interface receives events about
  *  connections to other space servers. */
@@ -66,6 +67,20 @@ public:
 
         virtual ServerID id() const = 0;
         virtual bool send(const Chunk&) = 0;
+        /** Send a message. The stream may serialize it directly into its own
+         *  buffers and hold onto it so it can be written along with other
+         *  messages, so callers must call flush() once they've sent everything
+         *  they have available.
+         *  \returns the serialized size of the message if it was accepted,
+         *           otherwise 0
+         */
+        virtual uint32 send(const Message* msg) = 0;
+        /** Write out any messages being held by the stream. If they can't all
+         *  be written, the SendListener will be notified when the stream can
+         *  accept more data.
+         *  \returns true if no messages are still being held
+         */
+        virtual bool flush() = 0;
     };
 
     /** The Network::SendListener interface should be implemented by the object
@@ -0,0 +1,71 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_SPACE_WORKER_POOL_HPP_
+#define _SIRIKATA_SPACE_WORKER_POOL_HPP_
+
+#include <sirikata/space/Platform.hpp>
+#include <sirikata/core/util/Thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace Sirikata {
+
+/** WorkerPool is a fork-join set of threads used to split up one step of
+ *  a service's work, e.g. ticking all of prox's query handlers or building loc
+ *  updates for all subscribers. run() hands the same task
+ *  to every worker, each with its own index, and blocks until all of them
+ *  have finished. The calling thread acts as worker 0, so it keeps its strand
+ *  for the duration just as if the work had been done serially, and a pool
+ *  with 1 worker doesn't start any threads.
+ *
+ *  Time spent running tasks is tracked per worker for reporting.
+ */
+class SIRIKATA_SPACE_EXPORT WorkerPool {
+public:
+    typedef std::tr1::function<void(uint32)> Task;
+
+    WorkerPool(const String& name, uint32 nworkers);
+    ~WorkerPool();
+
+    uint32 size() const { return mNumWorkers; }
+
+    // Run task(i) for each worker i, returning when they have all completed.
+    void run(const Task& task);
+
+    struct WorkerStats {
+        WorkerStats()
+         : runs(0),
+           busy(Duration::zero())
+        {}
+
+        uint64 runs;
+        Duration busy;
+    };
+    // Copy of the per-worker stats, safe to call from any thread
+    std::vector<WorkerStats> stats();
+
+private:
+    void workerMain(uint32 idx);
+    void runTask(uint32 idx, const Task& task);
+
+    const uint32 mNumWorkers;
+    std::vector<Thread*> mThreads;
+
+    boost::mutex mMutex;
+    boost::condition_variable mWorkReady;
+    boost::condition_variable mWorkDone;
+    // Current task, only valid during run()
+    const Task* mTask;
+    // Incremented for each run() so workers start the task exactly once
+    uint64 mGeneration;
+    // Number of threads, not including the caller, still running the task
+    uint32 mRemaining;
+    bool mShutdown;
+    std::vector<WorkerStats> mStats;
+}; // class WorkerPool
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_SPACE_WORKER_POOL_HPP_
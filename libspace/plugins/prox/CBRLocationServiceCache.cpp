@@ -74,6 +74,10 @@ void CBRLocationServiceCache::addPlaceholderImposter(
 }
 
 
+void CBRLocationServiceCache::setObjectChangedCallback(const ObjectChangedCallback& cb) {
+    mObjectChangedCallback = cb;
+}
+
 LocationServiceCache::Iterator CBRLocationServiceCache::startTracking(const ObjectReference& id) {
     Lock lck(mDataMutex);
 
@@ -261,6 +265,21 @@ const bool CBRLocationServiceCache::isAggregate(const ObjectID& id) {
     return it->second.isAggregate;
 }
 
+ObjectAdditionFragmentPtr CBRLocationServiceCache::additionFragment(const ObjectID& id) {
+    Lock lck(mDataMutex);
+    ObjectDataMap::iterator it = mObjects.find(id);
+    assert(it != mObjects.end());
+
+    ObjectData& data = it->second;
+    if (!data.additionFragment) {
+        data.additionFragment = ProxResultEncoder::encodeAdditionFragment(
+            id.getAsUUID(), data.isAggregate,
+            data.location, data.orientation, data.bounds, data.mesh, data.physics
+        );
+    }
+    return data.additionFragment;
+}
+
 
 void CBRLocationServiceCache::localObjectAdded(const UUID& uuid, bool agg, const TimedMotionVector3f& loc, const TimedMotionQuaternion& orient, const AggregateBoundingInfo& bounds, const String& mesh, const String& phy, const String& query_data) {
   objectAdded(uuid, true, agg, loc, orient, bounds, mesh, phy, query_data);
@@ -398,6 +417,8 @@ void CBRLocationServiceCache::processObjectAdded(const ObjectReference& uuid, Ob
             (*it)->locationConnected(uuid, false, data.isLocal, data.location, data.bounds.centerBounds(), data.bounds.maxObjectRadius);
         }
     }
+    if (trigger_addition_event && !data.isAggregate && mObjectChangedCallback)
+        mObjectChangedCallback(uuid, data.location.velocity() != Vector3f::zero());
 
     {
         Lock lck(mDataMutex);
@@ -444,6 +465,8 @@ void CBRLocationServiceCache::processObjectRemoved(const ObjectReference& uuid,
         for(ListenerSet::iterator it = mListeners.begin(); it != mListeners.end(); it++)
             (*it)->locationDisconnected(uuid);
     }
+    if (trigger_removal_event && !agg && mObjectChangedCallback)
+        mObjectChangedCallback(uuid, false);
     bool successfullyRemoved = false;
     {
         Lock lck(mDataMutex);
@@ -479,6 +502,7 @@ void CBRLocationServiceCache::processLocationUpdated(const ObjectReference& uuid
 
         oldval = it->second.location;
         it->second.location = newval;
+        it->second.additionFragment.reset();
     }
 
     if (!agg) {
@@ -486,6 +510,8 @@ void CBRLocationServiceCache::processLocationUpdated(const ObjectReference& uuid
         for(ListenerSet::iterator it = mListeners.begin(); it != mListeners.end(); it++)
             (*it)->locationPositionUpdated(uuid, oldval, newval);
     }
+    if (!agg && mObjectChangedCallback)
+        mObjectChangedCallback(uuid, newval.velocity() != Vector3f::zero());
 }
 
 void CBRLocationServiceCache::orientationUpdated(const UUID& uuid, bool agg, const TimedMotionQuaternion& newval) {
@@ -505,6 +531,7 @@ void CBRLocationServiceCache::processOrientationUpdated(const ObjectReference& u
     if (it == mObjects.end()) return;
 
     it->second.orientation = newval;
+    it->second.additionFragment.reset();
 }
 
 void CBRLocationServiceCache::boundsUpdated(const UUID& uuid, bool agg, const AggregateBoundingInfo& newval) {
@@ -519,6 +546,7 @@ void CBRLocationServiceCache::boundsUpdated(const UUID& uuid, bool agg, const Ag
 
 void CBRLocationServiceCache::processBoundsUpdated(const ObjectReference& uuid, bool agg, const AggregateBoundingInfo& newval) {
     AggregateBoundingInfo oldval;
+    bool moving;
     {
         Lock lck(mDataMutex);
 
@@ -527,6 +555,8 @@ void CBRLocationServiceCache::processBoundsUpdated(const ObjectReference& uuid,
 
         oldval = it->second.bounds;
         it->second.bounds = newval;
+        it->second.additionFragment.reset();
+        moving = (it->second.location.velocity() != Vector3f::zero());
     }
 
     if (!agg) {
@@ -536,6 +566,8 @@ void CBRLocationServiceCache::processBoundsUpdated(const ObjectReference& uuid,
             (*listen_it)->locationMaxSizeUpdated(uuid, oldval.maxObjectRadius, newval.maxObjectRadius);
         }
     }
+    if (!agg && mObjectChangedCallback)
+        mObjectChangedCallback(uuid, moving);
 }
 
 void CBRLocationServiceCache::meshUpdated(const UUID& uuid, bool agg, const String& newval) {
@@ -555,6 +587,7 @@ void CBRLocationServiceCache::processMeshUpdated(const ObjectReference& uuid, bo
     if (it == mObjects.end()) return;
     String oldval = it->second.mesh;
     it->second.mesh = newval;
+    it->second.additionFragment.reset();
 }
 
 void CBRLocationServiceCache::physicsUpdated(const UUID& uuid, bool agg, const String& newval) {
@@ -574,6 +607,7 @@ void CBRLocationServiceCache::processPhysicsUpdated(const ObjectReference& uuid,
     if (it == mObjects.end()) return;
     String oldval = it->second.physics;
     it->second.physics = newval;
+    it->second.additionFragment.reset();
 }
 
 
@@ -37,6 +37,7 @@
 #include <prox/base/LocationServiceCache.hpp>
 #include <sirikata/space/LocationService.hpp>
 #include <boost/thread.hpp>
+#include "../../src/ProxResultEncoder.hpp"
 
 namespace Sirikata {
 
@@ -106,6 +107,18 @@ public:
 
     const bool isAggregate(const ObjectID& id);
 
+    // Invoked in the strand whenever listeners are notified of a change which
+    // can affect query results: an object being added or removed, or its
+    // position or size changing. moving indicates whether the object has a
+    // non-zero velocity, i.e. whether its position keeps changing without
+    // further updates.
+    typedef std::tr1::function<void(const ObjectReference&, bool)> ObjectChangedCallback;
+    void setObjectChangedCallback(const ObjectChangedCallback& cb);
+
+    // Encoded ObjectAddition for the object's current state, generated on
+    // demand and reused until the object's state changes.
+    ObjectAdditionFragmentPtr additionFragment(const ObjectID& id);
+
 
     /* LocationServiceListener members. */
     virtual void localObjectAdded(const UUID& uuid, bool agg, const TimedMotionVector3f& loc, const TimedMotionQuaternion& orient, const AggregateBoundingInfo& bounds, const String& mesh, const String& physics, const String& query_data);
@@ -145,6 +158,9 @@ private:
                      // ensures we can handle these cases correctly
         int16 tracking; // Ref count to support multiple users
         bool isAggregate;
+        // Cached encoding for results, cleared whenever any of the data it
+        // includes changes
+        ObjectAdditionFragmentPtr additionFragment;
     };
     typedef std::multimap<ObjectReference,std::tr1::function<void()> > DeferredCallbackMap;
     DeferredCallbackMap mDeferredCallbacks;
@@ -194,6 +210,8 @@ private:
     ObjectDataMap mObjects;
     bool mWithReplicas;
 
+    ObjectChangedCallback mObjectChangedCallback;
+
     bool tryRemoveObject(const ObjectReference & obj_id, ObjectDataMap::iterator& obj_it);
     void addCallbackToObject(const ObjectReference & obj_id, const std::tr1::function<void()>&callback);
     void callDeferredCallbacksForObject(const ObjectReference & obj_id);
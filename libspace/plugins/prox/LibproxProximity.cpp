@@ -46,6 +46,8 @@
 #include <sirikata/space/AggregateManager.hpp>
 
 #include <sirikata/core/command/Commander.hpp>
+#include <sirikata/core/trace/TimeSeries.hpp>
+#include <sirikata/core/util/Timer.hpp>
 #include <json_spirit/json_spirit.h>
 
 #include <boost/lexical_cast.hpp>
@@ -86,11 +88,19 @@ LibproxProximity::LibproxProximity(SpaceContext* ctx, LocationService* locservic
    mMaxMaxCount(1),
    mServerQueries(),
    mServerDistance(false),
-   mServerHandlerPoller(mProxStrand, std::tr1::bind(&LibproxProximity::tickQueryHandler, this, mServerQueryHandler), "LibproxProximity ServerHandler Poll", Duration::milliseconds((int64)100)),
+   mServerHandlerPoller(mProxStrand, std::tr1::bind(&LibproxProximity::runTickQueryHandler, this, mServerQueryHandler), "LibproxProximity ServerHandler Poll", Duration::milliseconds((int64)100)),
    mServerQueryBoundsPoller(mProxStrand, std::tr1::bind(&LibproxProximity::recomputeAggregateQueryBounds, this), "LibproxProximity Aggregate Query Bounds Poll", Duration::seconds((int64)1)),
    mObjectQueries(),
    mObjectDistance(false),
-   mObjectHandlerPoller(mProxStrand, std::tr1::bind(&LibproxProximity::tickQueryHandler, this, mObjectQueryHandler), "LibproxProximity ObjectHandler Poll", Duration::milliseconds((int64)100)),
+   mObjectHandlerPoller(mProxStrand, std::tr1::bind(&LibproxProximity::runTickQueryHandler, this, mObjectQueryHandler), "LibproxProximity ObjectHandler Poll", Duration::milliseconds((int64)100)),
+   mWorkerPool(NULL),
+   mAllHandlersPoller(mProxStrand, std::tr1::bind(&LibproxProximity::tickAllQueryHandlers, this), "LibproxProximity AllHandlers Poll", Duration::milliseconds((int64)100)),
+   mParallelTick(false),
+   mTickScheduler(NULL),
+   mAdaptiveTickPoller(mProxStrand, std::tr1::bind(&LibproxProximity::adaptiveTick, this), "LibproxProximity Adaptive Tick Poll", GetOptionValue<Duration>(OPT_PROX_TICK_MIN_INTERVAL)),
+   mTimeSeriesTickRateName(String("space.server") + boost::lexical_cast<String>(ctx->id()) + ".prox.tick_rate"),
+   mTimeSeriesDirtyObjectsName(String("space.server") + boost::lexical_cast<String>(ctx->id()) + ".prox.dirty_objects"),
+   mLastTickReport(Time::null()),
    mStaticRebuilderPoller(mProxStrand, std::tr1::bind(&LibproxProximity::rebuildHandler, this, OBJECT_CLASS_STATIC), "LibproxProximity Static Rebuilder Poll", Duration::seconds(172800.f)),
    mDynamicRebuilderPoller(mProxStrand, std::tr1::bind(&LibproxProximity::rebuildHandler, this, OBJECT_CLASS_DYNAMIC), "LibproxProximity Dynamic Rebuilder Poll", Duration::seconds(172800.f))
 {
@@ -121,7 +131,7 @@ LibproxProximity::LibproxProximity(SpaceContext* ctx, LocationService* locservic
             std::tr1::bind(&LibproxProximity::handlerShouldHandleObject, this, server_static_objects, false, _1, _2, _3, _4, _5, _6)
         );
     }
-    if (server_handler_type == "dist" || server_handler_type == "rtreedist") mServerDistance = true;
+    if (server_handler_type == "dist" || server_handler_type == "rtreedist" || server_handler_type == "griddist") mServerDistance = true;
 
     // Object Queries
     String object_handler_type = GetOptionValue<String>(OPT_PROX_OBJECT_QUERY_HANDLER_TYPE);
@@ -141,10 +151,39 @@ LibproxProximity::LibproxProximity(SpaceContext* ctx, LocationService* locservic
             std::tr1::bind(&LibproxProximity::handlerShouldHandleObject, this, object_static_objects, true, _1, _2, _3, _4, _5, _6)
         );
     }
-    if (object_handler_type == "dist" || object_handler_type == "rtreedist") mObjectDistance = true;
+    if (object_handler_type == "dist" || object_handler_type == "rtreedist" || object_handler_type == "griddist") mObjectDistance = true;
+
+    mWorkerPool = new WorkerPool("LibproxProximity", GetOptionValue<uint32>(OPT_PROX_THREADS));
+
+    mCoalesceFirst = GetOptionValue<bool>(OPT_PROX_COALESCE_FIRST);
+    mMaxPerResult = GetOptionValue<uint32>(PROX_MAX_PER_RESULT);
+    for(uint32 i = 0; i < mWorkerPool->size(); i++)
+        mResultEncoders.push_back(new ProxResultEncoder());
+
+    String tick_mode = GetOptionValue<String>(OPT_PROX_TICK_MODE);
+    if (tick_mode == "adaptive") {
+        mTickScheduler = new ProxTickScheduler(
+            GetOptionValue<Duration>(OPT_PROX_TICK_MIN_INTERVAL),
+            GetOptionValue<Duration>(OPT_PROX_TICK_MAX_INTERVAL),
+            GetOptionValue<float32>(OPT_PROX_TICK_MAX_LOAD)
+        );
+        mLocCache->setObjectChangedCallback(
+            std::tr1::bind(&LibproxProximity::objectChangedForTick, this, _1, _2)
+        );
+    }
+    else if (tick_mode != "fixed") {
+        PROXLOG(error, "Unknown prox.tick-mode " << tick_mode << ", using fixed");
+    }
 }
 
 LibproxProximity::~LibproxProximity() {
+    if (mTickScheduler != NULL) {
+        mLocCache->setObjectChangedCallback(CBRLocationServiceCache::ObjectChangedCallback());
+        delete mTickScheduler;
+    }
+    delete mWorkerPool;
+    for(uint32 i = 0; i < mResultEncoders.size(); i++)
+        delete mResultEncoders[i];
     for(int i = 0; i < NUM_OBJECT_CLASSES; i++) {
         delete mObjectQueryHandler[i].handler;
         delete mServerQueryHandler[i].handler;
@@ -202,8 +241,16 @@ uint32 LibproxProximity::numServersQueried() {
 void LibproxProximity::start() {
     LibproxProximityBase::start();
 
-    mContext->add(&mServerHandlerPoller);
-    mContext->add(&mObjectHandlerPoller);
+    if (mTickScheduler != NULL) {
+        mContext->add(&mAdaptiveTickPoller);
+    }
+    else if (mWorkerPool->size() > 1) {
+        mContext->add(&mAllHandlersPoller);
+    }
+    else {
+        mContext->add(&mServerHandlerPoller);
+        mContext->add(&mObjectHandlerPoller);
+    }
     mContext->add(&mStaticRebuilderPoller);
     mContext->add(&mDynamicRebuilderPoller);
     mContext->add(&mServerQueryBoundsPoller);
@@ -492,11 +539,13 @@ void LibproxProximity::receiveMigrationData(const UUID& obj, ServerID source_ser
 
 void LibproxProximity::aggregateObjectCreated(ProxAggregator* handler, const ObjectReference& objid) {
     if (!static_cast<ProxQueryHandler*>(handler)->staticOnly()) return;
+    boost::lock_guard<boost::mutex> lck(mAggregateListenerMutex);
     LibproxProximityBase::aggregateObjectCreated(objid);
 }
 
 void LibproxProximity::aggregateObjectDestroyed(ProxAggregator* handler, const ObjectReference& objid) {
     if (!static_cast<ProxQueryHandler*>(handler)->staticOnly()) return;
+    boost::lock_guard<boost::mutex> lck(mAggregateListenerMutex);
     LibproxProximityBase::aggregateObjectDestroyed(objid);
 }
 
@@ -504,36 +553,43 @@ void LibproxProximity::aggregateCreated(ProxAggregator* handler, const ObjectRef
     // We ignore aggregates built of dynamic objects, they aren't useful for
     // creating aggregate meshes
     if (!static_cast<ProxQueryHandler*>(handler)->staticOnly()) return;
+    boost::lock_guard<boost::mutex> lck(mAggregateListenerMutex);
     LibproxProximityBase::aggregateCreated(objid);
 }
 
 void LibproxProximity::aggregateChildAdded(ProxAggregator* handler, const ObjectReference& objid, const ObjectReference& child, const Vector3f& bnds_center, const float32 bnds_center_radius, const float32 max_obj_size) {
     if (!static_cast<ProxQueryHandler*>(handler)->staticOnly()) return;
+    boost::lock_guard<boost::mutex> lck(mAggregateListenerMutex);
     LibproxProximityBase::aggregateChildAdded(objid, child, bnds_center, AggregateBoundingInfo(Vector3f::zero(), bnds_center_radius, max_obj_size));
 }
 
 void LibproxProximity::aggregateChildRemoved(ProxAggregator* handler, const ObjectReference& objid, const ObjectReference& child, const Vector3f& bnds_center, const float32 bnds_center_radius, const float32 max_obj_size) {
     if (!static_cast<ProxQueryHandler*>(handler)->staticOnly()) return;
+    boost::lock_guard<boost::mutex> lck(mAggregateListenerMutex);
     LibproxProximityBase::aggregateChildRemoved(objid, child, bnds_center, AggregateBoundingInfo(Vector3f::zero(), bnds_center_radius, max_obj_size));
 }
 
 void LibproxProximity::aggregateBoundsUpdated(ProxAggregator* handler, const ObjectReference& objid, const Vector3f& bnds_center, const float32 bnds_center_radius, const float32 max_obj_size) {
     if (!static_cast<ProxQueryHandler*>(handler)->staticOnly()) return;
+    boost::lock_guard<boost::mutex> lck(mAggregateListenerMutex);
     LibproxProximityBase::aggregateBoundsUpdated(objid, bnds_center, AggregateBoundingInfo(Vector3f::zero(), bnds_center_radius, max_obj_size));
 }
 
 void LibproxProximity::aggregateQueryDataUpdated(ProxAggregator* handler, const ObjectReference& objid, const String& qd) {
     if (!static_cast<ProxQueryHandler*>(handler)->staticOnly()) return;
+    boost::lock_guard<boost::mutex> lck(mAggregateListenerMutex);
     LibproxProximityBase::aggregateQueryDataUpdated(objid, qd, (handler->rootAggregateID() == objid));
 }
 
 void LibproxProximity::aggregateDestroyed(ProxAggregator* handler, const ObjectReference& objid) {
     if (!static_cast<ProxQueryHandler*>(handler)->staticOnly()) return;
+    boost::lock_guard<boost::mutex> lck(mAggregateListenerMutex);
     LibproxProximityBase::aggregateDestroyed(objid);
 }
 
 void LibproxProximity::aggregateObserved(ProxAggregator* handler, const ObjectReference& objid, uint32 nobservers, uint32 nchildren) {
     if (!static_cast<ProxQueryHandler*>(handler)->staticOnly()) return;
+    boost::lock_guard<boost::mutex> lck(mAggregateListenerMutex);
     LibproxProximityBase::aggregateObserved(objid, nobservers, nchildren);
 }
 
@@ -680,6 +736,15 @@ void LibproxProximity::poll() {
 
 
 void LibproxProximity::queryHasEvents(Query* query) {
+    if (mParallelTick) {
+        // We're in a worker ticking this query's handler. Events are generated
+        // once all the workers are done, see tickAllQueryHandlers.
+        int32 idx = queryHandlerIndex(query->handler());
+        assert(idx >= 0);
+        mDeferredQueries[idx].insert(query);
+        return;
+    }
+
     InstanceMethodNotReentrant nr(mQueryHasEventsNotRentrant);
 
     if (
@@ -730,6 +795,14 @@ void LibproxProximity::replicaLocationUpdated(const UUID& uuid, const TimedMotio
 
 // PROX Thread: Everything after this should only be called from within the prox thread.
 
+void LibproxProximity::runTickQueryHandler(ProxQueryHandlerData qh[NUM_OBJECT_CLASSES]) {
+    // With only one worker this just calls tickQueryHandler directly, but lets
+    // the pool track tick time.
+    mWorkerPool->run(
+        std::tr1::bind(&LibproxProximity::tickQueryHandler, this, qh)
+    );
+}
+
 void LibproxProximity::tickQueryHandler(ProxQueryHandlerData qh[NUM_OBJECT_CLASSES]) {
     // Not really any better place to do this. We'll call this more frequently
     // than necessary by putting it here, but hopefully it doesn't matter since
@@ -751,30 +824,8 @@ void LibproxProximity::tickQueryHandler(ProxQueryHandlerData qh[NUM_OBJECT_CLASS
     // additions.
 
     Time simT = mContext->simTime();
-    for(int i = 0; i < NUM_OBJECT_CLASSES; i++) {
-        if (qh[i].handler != NULL) {
-            for(ObjectIDSet::iterator it = qh[i].removals.begin(); it != qh[i].removals.end(); it++) {
-                // Have to be careful because we may have recorded a swap, but
-                // then migrated the object. It would be nice to have just
-                // cleaned these out, but just violating the abstraction and
-                // checking directly is easier for now.
-                if (mLocCache->alive(*it))
-                    qh[i].handler->removeObject(*it, true);
-                mLocCache->stopRefcountTracking(*it);
-            }
-            qh[i].removals.clear();
-
-            qh[i].handler->tick(simT);
-
-            for(ObjectIDSet::iterator it = qh[i].additions.begin(); it != qh[i].additions.end(); it++) {
-                // See note above about migrations
-                if (mLocCache->alive(*it))
-                    qh[i].handler->addObject(*it);
-                mLocCache->stopRefcountTracking(*it);
-            }
-            qh[i].additions.clear();
-        }
-    }
+    for(int i = 0; i < NUM_OBJECT_CLASSES; i++)
+        tickQueryHandlerClass(&qh[i], simT);
 
     // We wait until the first full iteration is done for queries so we can
     // coalesce their initial results, skipping intermediate refinement. Now's
@@ -788,9 +839,157 @@ void LibproxProximity::tickQueryHandler(ProxQueryHandlerData qh[NUM_OBJECT_CLASS
     mObjectQueriesFirstIteration.clear();
 }
 
+void LibproxProximity::tickQueryHandlerClass(ProxQueryHandlerData* qh, const Time& simT) {
+    if (qh->handler == NULL) return;
+
+    for(ObjectIDSet::iterator it = qh->removals.begin(); it != qh->removals.end(); it++) {
+        // Have to be careful because we may have recorded a swap, but
+        // then migrated the object. It would be nice to have just
+        // cleaned these out, but just violating the abstraction and
+        // checking directly is easier for now.
+        if (mLocCache->alive(*it))
+            qh->handler->removeObject(*it, true);
+        mLocCache->stopRefcountTracking(*it);
+    }
+    qh->removals.clear();
+
+    qh->handler->tick(simT);
+
+    for(ObjectIDSet::iterator it = qh->additions.begin(); it != qh->additions.end(); it++) {
+        // See note above about migrations
+        if (mLocCache->alive(*it))
+            qh->handler->addObject(*it);
+        mLocCache->stopRefcountTracking(*it);
+    }
+    qh->additions.clear();
+}
+
+void LibproxProximity::tickAllQueryHandlers() {
+    using std::tr1::placeholders::_1;
+
+    processExpiredStaticObjectTimeouts();
+
+    // Each handler has its own tree and is ticked by exactly one worker. The
+    // handlers only share the loc cache, which is locked, and the aggregate
+    // listener, which is serialized by mAggregateListenerMutex. Since we hold
+    // the prox strand until all the workers finish, nothing else can modify
+    // the handlers or the loc cache during the tick. Removals are still
+    // processed before additions within each handler, so swaps between
+    // handlers generate events in the right order, as in tickQueryHandler.
+    Time simT = mContext->simTime();
+    mParallelTick = true;
+    mWorkerPool->run(
+        std::tr1::bind(&LibproxProximity::tickQueryHandlersForWorker, this, _1, simT)
+    );
+    mParallelTick = false;
+
+    // Server queries are few and their results are small, just handle them
+    // here.
+    for(int i = 0; i < NUM_OBJECT_CLASSES; i++) {
+        QuerySet& deferred = mDeferredQueries[i];
+        for(QuerySet::iterator it = deferred.begin(); it != deferred.end(); it++)
+            generateServerQueryEvents(*it);
+        deferred.clear();
+    }
+
+    // Object query results are encoded in parallel. Events are collected in
+    // the same order they would be handled by tickQueryHandler: during the
+    // tick and then for queries finishing their first iteration.
+    ObjectQueryEventsList qevts;
+    for(int i = NUM_OBJECT_CLASSES; i < 2*NUM_OBJECT_CLASSES; i++) {
+        QuerySet& deferred = mDeferredQueries[i];
+        for(QuerySet::iterator it = deferred.begin(); it != deferred.end(); it++)
+            collectObjectQueryEvents(*it, false, &qevts);
+        deferred.clear();
+    }
+    FirstIterationObjectSet copied_first_its = mObjectQueriesFirstIteration;
+    for(FirstIterationObjectSet::const_iterator it = copied_first_its.begin(); it != copied_first_its.end(); it++)
+        collectObjectQueryEvents(*it, true, &qevts);
+    mObjectQueriesFirstIteration.clear();
+
+    if (qevts.empty()) return;
+
+    mWorkerPool->run(
+        std::tr1::bind(&LibproxProximity::encodeObjectQueryEventsForWorker, this, _1, &qevts)
+    );
+    sendObjectQueryEvents(qevts);
+}
+
+void LibproxProximity::tickQueryHandlersForWorker(uint32 worker, const Time& simT) {
+    for(uint32 idx = worker; idx < 2*NUM_OBJECT_CLASSES; idx += mWorkerPool->size())
+        tickQueryHandlerClass(queryHandlerByIndex(idx), simT);
+}
+
+void LibproxProximity::encodeObjectQueryEventsForWorker(uint32 worker, ObjectQueryEventsList* qevts) {
+    // Split by querier so each querier's seqnos are assigned in order by a
+    // single worker, even if it has events from multiple handlers.
+    uint32 nworkers = mWorkerPool->size();
+    for(ObjectQueryEventsList::iterator it = qevts->begin(); it != qevts->end(); it++) {
+        if (it->query_id.hash() % nworkers != worker) continue;
+        encodeObjectQueryEvents(&(*it), mResultEncoders[worker]);
+    }
+}
+
+void LibproxProximity::adaptiveTick() {
+    Time start = Timer::now();
+    if (mTickScheduler->shouldTick(start)) {
+        if (mWorkerPool->size() > 1) {
+            tickAllQueryHandlers();
+        }
+        else {
+            runTickQueryHandler(mServerQueryHandler);
+            runTickQueryHandler(mObjectQueryHandler);
+        }
+        mTickScheduler->ticked(start, Timer::now() - start);
+    }
+    reportTickStats(start);
+}
+
+void LibproxProximity::reportTickStats(const Time& now) {
+    if (mLastTickReport == Time::null()) {
+        mLastTickReport = now;
+        return;
+    }
+    Duration since = now - mLastTickReport;
+    if (since < Duration::seconds(1.f)) return;
+
+    const ProxTickScheduler::Stats& stats = mTickScheduler->stats();
+    uint64 ticks = stats.ticks - mLastTickReportStats.ticks;
+    uint64 dirty = stats.dirtyObjects - mLastTickReportStats.dirtyObjects;
+    mContext->timeSeries->report(mTimeSeriesTickRateName, ticks / since.toSeconds());
+    mContext->timeSeries->report(mTimeSeriesDirtyObjectsName, (ticks > 0) ? ((float64)dirty / ticks) : 0.0);
+
+    mLastTickReport = now;
+    mLastTickReportStats = stats;
+}
+
+void LibproxProximity::objectChangedForTick(const ObjectReference& objid, bool moving) {
+    mTickScheduler->objectChanged(objid, moving);
+}
+
+void LibproxProximity::queriesChangedForTick() {
+    if (mTickScheduler != NULL)
+        mTickScheduler->queriesChanged();
+}
+
+LibproxProximity::ProxQueryHandlerData* LibproxProximity::queryHandlerByIndex(uint32 idx) {
+    if (idx < NUM_OBJECT_CLASSES)
+        return &mServerQueryHandler[idx];
+    return &mObjectQueryHandler[idx - NUM_OBJECT_CLASSES];
+}
+
+int32 LibproxProximity::queryHandlerIndex(ProxQueryHandler* handler) {
+    for(uint32 idx = 0; idx < 2*NUM_OBJECT_CLASSES; idx++) {
+        if (queryHandlerByIndex(idx)->handler == handler)
+            return idx;
+    }
+    return -1;
+}
+
 void LibproxProximity::rebuildHandlerType(ProxQueryHandlerData* handler, ObjectClass objtype) {
     if (handler[objtype].handler != NULL)
         handler[objtype].handler->rebuild();
+    queriesChangedForTick();
 }
 
 void LibproxProximity::rebuildHandler(ObjectClass objtype) {
@@ -830,6 +1029,30 @@ void LibproxProximity::recomputeAggregateQueryBounds() {
 }
 
 // Command handlers
+void LibproxProximity::getStats(Command::Result* result_out) {
+    LibproxProximityBase::getStats(result_out);
+    Command::Result& result = *result_out;
+
+    // Time each prox thread has spent ticking handlers and encoding results
+    std::vector<WorkerPool::WorkerStats> worker_stats = mWorkerPool->stats();
+    result.put("stats.threads.count", (uint32)worker_stats.size());
+    for(uint32 i = 0; i < worker_stats.size(); i++) {
+        String key = String("stats.threads.") + boost::lexical_cast<String>(i) + ".";
+        result.put(key + "runs", worker_stats[i].runs);
+        result.put(key + "tick_time_us", worker_stats[i].busy.toMicroseconds());
+    }
+
+    if (mTickScheduler != NULL) {
+        const ProxTickScheduler::Stats& tick_stats = mTickScheduler->stats();
+        result.put("stats.tick.ticks", tick_stats.ticks);
+        result.put("stats.tick.deadline_ticks", tick_stats.deadlineTicks);
+        result.put("stats.tick.skipped_polls", tick_stats.skippedPolls);
+        result.put("stats.tick.interval_us", mTickScheduler->interval().toMicroseconds());
+        result.put("stats.tick.dirty_objects", mTickScheduler->dirtyObjects());
+        result.put("stats.tick.moving_objects", mTickScheduler->movingObjects());
+    }
+}
+
 void LibproxProximity::commandProperties(const Command::Command& cmd, Command::Commander* cmdr, Command::CommandID cmdid) {
     Command::Result result = Command::EmptyResult();
 
@@ -837,6 +1060,8 @@ void LibproxProximity::commandProperties(const Command::Command& cmd, Command::C
     result.put("name", "libprox");
     result.put("settings.handlers", mNumQueryHandlers * 2);
     result.put("settings.dynamic_separate", mSeparateDynamicObjects);
+    result.put("settings.threads", mWorkerPool->size());
+    result.put("settings.tick_mode", (mTickScheduler != NULL) ? "adaptive" : "fixed");
     if (mSeparateDynamicObjects)
         result.put("settings.static_heuristic", mMoveToStaticDelay.toString());
 
@@ -1019,7 +1244,6 @@ void LibproxProximity::commandListNodes(const Command::Command& cmd, Command::Co
 
 void LibproxProximity::generateServerQueryEvents(Query* query) {
     Time t = mContext->simTime();
-    uint32 max_count = GetOptionValue<uint32>(PROX_MAX_PER_RESULT);
 
     assert(mInvertedServerQueries.find(query) != mInvertedServerQueries.end());
     ServerID sid = mInvertedServerQueries[query];
@@ -1033,7 +1257,7 @@ void LibproxProximity::generateServerQueryEvents(Query* query) {
         Sirikata::Protocol::Prox::IProximityResults contents = container.mutable_result();
         contents.set_t(t);
         uint32 count = 0;
-        while(count < max_count && !evts.empty()) {
+        while(count < mMaxPerResult && !evts.empty()) {
             const QueryEvent& evt = evts.front();
             Sirikata::Protocol::Prox::IProximityUpdate event_results = contents.add_update();
             // Each QueryEvent is made up of additions and
@@ -1128,17 +1352,25 @@ void LibproxProximity::generateServerQueryEvents(Query* query) {
 }
 
 void LibproxProximity::generateObjectQueryEvents(Query* query, bool do_first) {
+    ObjectQueryEventsList qevts;
+    collectObjectQueryEvents(query, do_first, &qevts);
+    if (qevts.empty()) return;
+
+    for(ObjectQueryEventsList::iterator it = qevts.begin(); it != qevts.end(); it++)
+        encodeObjectQueryEvents(&(*it), mResultEncoders[0]);
+    sendObjectQueryEvents(qevts);
+}
+
+void LibproxProximity::collectObjectQueryEvents(Query* query, bool do_first, ObjectQueryEventsList* qevts_out) {
     // If we're waiting for the first iteration to finish, we ignore the
     // notification, waiting until we get out of the first tick to manually
     // trigger updates.
     bool is_first = (mObjectQueriesFirstIteration.find(query) != mObjectQueriesFirstIteration.end());
-    bool coalesce_first = GetOptionValue<bool>(OPT_PROX_COALESCE_FIRST);
-    if (coalesce_first && !do_first && is_first) return;
+    if (mCoalesceFirst && !do_first && is_first) return;
 
-    uint32 max_count = GetOptionValue<uint32>(PROX_MAX_PER_RESULT);
-
-    assert(mInvertedObjectQueries.find(query) != mInvertedObjectQueries.end());
-    UUID query_id = mInvertedObjectQueries[query];
+    InvertedObjectQueryMap::const_iterator query_it = mInvertedObjectQueries.find(query);
+    assert(query_it != mInvertedObjectQueries.end());
+    const UUID& query_id = query_it->second;
     SeqNoPtr seqNoPtr = getSeqNoInfo(query_id);
 
     QueryEventList evts;
@@ -1149,17 +1381,92 @@ void LibproxProximity::generateObjectQueryEvents(Query* query, bool do_first) {
         return;
     }
 
-    if (coalesce_first && is_first) {
+    if (mCoalesceFirst && is_first) {
         coalesceEvents(evts, 10);
         mObjectQueriesFirstIteration.erase(query);
     }
 
+    if (evts.empty()) return;
+
+    qevts_out->push_back(ObjectQueryEvents());
+    ObjectQueryEvents& qevt = qevts_out->back();
+    qevt.query_id = query_id;
+    qevt.seqno = seqNoPtr;
+    qevt.evts.swap(evts);
+}
+
+void LibproxProximity::encodeObjectQueryEvents(ObjectQueryEvents* qevts, ProxResultEncoder* encoder) {
+    if (!encoder->valid()) {
+        encodeObjectQueryEventsPBJ(qevts);
+        return;
+    }
+
+    const UUID& query_id = qevts->query_id;
+    SeqNoPtr& seqNoPtr = qevts->seqno;
+    QueryEventList& evts = qevts->evts;
+    Time t = mContext->simTime();
+
+    while(!evts.empty()) {
+        encoder->start(t);
+
+        uint32 count = 0;
+        while(count < mMaxPerResult && !evts.empty()) {
+            const QueryEvent& evt = evts.front();
+            encoder->startUpdate();
+
+            for(uint32 aidx = 0; aidx < evt.additions().size(); aidx++) {
+                const ObjectReference& oobjid = evt.additions()[aidx].id();
+                assert(mLocCache->tracking(oobjid));
+                count++;
+
+                mLocService->subscribe(query_id, oobjid.getAsUUID());
+
+                //query_id contains the uuid of the object that is receiving
+                //the proximity message that obj_id has been added.
+                ObjectAdditionFragmentPtr frag = mLocCache->additionFragment(oobjid);
+                encoder->addAddition(*frag, (*seqNoPtr)++);
+            }
+            for(uint32 pidx = 0; pidx < evt.reparents().size(); pidx++) {
+                encoder->addReparent(
+                    evt.reparents()[pidx].id().getAsUUID(),
+                    (*seqNoPtr)++,
+                    evt.reparents()[pidx].oldParent().getAsUUID(),
+                    evt.reparents()[pidx].newParent().getAsUUID(),
+                    (evt.reparents()[pidx].type() != QueryEvent::Normal)
+                );
+            }
+            for(uint32 ridx = 0; ridx < evt.removals().size(); ridx++) {
+                UUID objid = evt.removals()[ridx].id().getAsUUID();
+                count++;
+                // Clear out seqno and let main strand remove loc
+                // subcription
+                mLocService->unsubscribe(query_id, objid);
+
+                encoder->addRemoval(
+                    objid, (*seqNoPtr)++,
+                    (evt.removals()[ridx].permanent() == QueryEvent::Permanent)
+                );
+            }
+
+            encoder->finishUpdate();
+            evts.pop_front();
+        }
+
+        qevts->results.push_back(encoder->finish());
+    }
+}
+
+void LibproxProximity::encodeObjectQueryEventsPBJ(ObjectQueryEvents* qevts) {
+    const UUID& query_id = qevts->query_id;
+    SeqNoPtr& seqNoPtr = qevts->seqno;
+    QueryEventList& evts = qevts->evts;
+
     while(!evts.empty()) {
         Sirikata::Protocol::Prox::ProximityResults prox_results;
         prox_results.set_t(mContext->simTime());
 
         uint32 count = 0;
-        while(count < max_count && !evts.empty()) {
+        while(count < mMaxPerResult && !evts.empty()) {
             const QueryEvent& evt = evts.front();
             Sirikata::Protocol::Prox::IProximityUpdate event_results = prox_results.add_update();
 
@@ -1246,13 +1553,23 @@ void LibproxProximity::generateObjectQueryEvents(Query* query, bool do_first) {
             evts.pop_front();
         }
 
-        Sirikata::Protocol::Object::ObjectMessage* obj_msg = createObjectMessage(
-            mContext->id(),
-            UUID::null(), OBJECT_PORT_PROXIMITY,
-            query_id, OBJECT_PORT_PROXIMITY,
-            serializePBJMessage(prox_results)
-        );
-        mObjectResults.push(obj_msg);
+        qevts->results.push_back(serializePBJMessage(prox_results));
+    }
+}
+
+void LibproxProximity::sendObjectQueryEvents(ObjectQueryEventsList& qevts) {
+    // Message IDs aren't allocated in a thread-safe way, so this always
+    // happens in the prox thread.
+    for(ObjectQueryEventsList::iterator it = qevts.begin(); it != qevts.end(); it++) {
+        for(uint32 i = 0; i < it->results.size(); i++) {
+            Sirikata::Protocol::Object::ObjectMessage* obj_msg = createObjectMessage(
+                mContext->id(),
+                UUID::null(), OBJECT_PORT_PROXIMITY,
+                it->query_id, OBJECT_PORT_PROXIMITY,
+                it->results[i]
+            );
+            mObjectResults.push(obj_msg);
+        }
     }
 }
 
@@ -1298,6 +1615,8 @@ void LibproxProximity::eraseSeqNoInfo(const UUID& obj_id)
 
 
 void LibproxProximity::handleUpdateServerQuery(const ServerID& server, const TimedMotionVector3f& loc, const BoundingSphere3f& bounds, const SolidAngle& angle, const uint32 max_results) {
+    queriesChangedForTick();
+
     TimedMotionVector3f adjusted_loc(loc.updateTime(), MotionVector3f(loc.position() + bounds.center(), loc.velocity()));
     BoundingSphere3f region(Vector3f(0,0,0), 0);
     float ms = bounds.radius();
@@ -1334,6 +1653,8 @@ void LibproxProximity::handleUpdateServerQuery(const ServerID& server, const Tim
 }
 
 void LibproxProximity::handleRemoveServerQuery(const ServerID& server) {
+    queriesChangedForTick();
+
     PROXLOG(debug,"Remove server query from " << server);
 
     for(int i = 0; i < NUM_OBJECT_CLASSES; i++) {
@@ -1388,6 +1709,8 @@ void LibproxProximity::handleDisconnectedServer(ServerID sid) {
 }
 
 void LibproxProximity::handleUpdateObjectQuery(const UUID& object, const TimedMotionVector3f& loc, const BoundingSphere3f& bounds, const SolidAngle& angle, uint32 max_results, SeqNoPtr seqno) {
+    queriesChangedForTick();
+
     BoundingSphere3f region(bounds.center(), 0);
     float ms = bounds.radius();
 
@@ -1455,6 +1778,8 @@ void LibproxProximity::handleDisconnectedObject(const UUID& object) {
     handleRemoveObjectQuery(object, false, std::tr1::function<void()>());
 }
 void LibproxProximity::handleRemoveObjectQuery(const UUID& object, bool notify_main_thread, const std::tr1::function<void()> &callback) {
+    queriesChangedForTick();
+
     // Clear out queries
     for(int i = 0; i < NUM_OBJECT_CLASSES; i++) {
         if (mObjectQueryHandler[i].handler == NULL) continue;
@@ -1529,6 +1854,7 @@ void LibproxProximity::handleCheckObjectClassForHandlers(const ObjectReference&
     handlers[swap_out].removals.insert(objid);
     mLocCache->startRefcountTracking(objid);
     handlers[swap_in].additions.insert(objid);
+    queriesChangedForTick();
 }
 
 void LibproxProximity::trySwapHandlers(bool is_local, const ObjectReference& objid, bool is_static) {
@@ -34,6 +34,9 @@
 #define _SIRIKATA_LIBPROX_PROXIMITY_HPP_
 
 #include "LibproxProximityBase.hpp"
+#include <sirikata/space/WorkerPool.hpp>
+#include "../../src/ProxResultEncoder.hpp"
+#include "ProxTickScheduler.hpp"
 #include <prox/geom/QueryHandler.hpp>
 #include <prox/base/LocationUpdateListener.hpp>
 #include <prox/base/AggregateListener.hpp>
@@ -170,6 +173,26 @@ private:
     void generateServerQueryEvents(Query* query);
     void generateObjectQueryEvents(Query* query, bool do_first=false);
 
+    // Object query events are generated in three steps so the expensive
+    // part, encoding results, can be split across threads. Collecting
+    // events and creating messages must happen in the prox thread, but
+    // encoding only touches the querier's own state and thread-safe data,
+    // so any number of queriers can be encoded in parallel as long as each
+    // querier's events are encoded in order by a single thread.
+    struct ObjectQueryEvents {
+        UUID query_id;
+        SeqNoPtr seqno;
+        QueryEventList evts;
+        // Serialized ProximityResults, each becomes one message
+        std::vector<String> results;
+    };
+    typedef std::vector<ObjectQueryEvents> ObjectQueryEventsList;
+    void collectObjectQueryEvents(Query* query, bool do_first, ObjectQueryEventsList* qevts_out);
+    void encodeObjectQueryEvents(ObjectQueryEvents* qevts, ProxResultEncoder* encoder);
+    // Reference implementation, used if the encoder can't be
+    void encodeObjectQueryEventsPBJ(ObjectQueryEvents* qevts);
+    void sendObjectQueryEvents(ObjectQueryEventsList& qevts);
+
     // Decides whether a query handler should handle a particular object.
     bool handlerShouldHandleObject(bool is_static_handler, bool is_global_handler, const ObjectReference& obj_id, bool local, bool aggregate, const TimedMotionVector3f& pos, const BoundingSphere3f& region, float maxSize);
     // The real handler for moving objects between static/dynamic
@@ -246,13 +269,29 @@ private:
 
     // PROX Thread - Should only be accessed in methods used by the prox thread
 
+    void runTickQueryHandler(ProxQueryHandlerData qh[NUM_OBJECT_CLASSES]);
     void tickQueryHandler(ProxQueryHandlerData qh[NUM_OBJECT_CLASSES]);
+    void tickQueryHandlerClass(ProxQueryHandlerData* qh, const Time& simT);
+    // With multiple prox threads, all handlers are ticked at once, each by a
+    // single worker, and then results are encoded on all the workers.
+    void tickAllQueryHandlers();
+    void tickQueryHandlersForWorker(uint32 worker, const Time& simT);
+    void encodeObjectQueryEventsForWorker(uint32 worker, ObjectQueryEventsList* qevts);
+    // With adaptive ticking, handlers are only ticked when mTickScheduler
+    // decides they need to be, instead of by the fixed rate pollers.
+    void adaptiveTick();
+    void reportTickStats(const Time& now);
+    void objectChangedForTick(const ObjectReference& objid, bool moving);
+    void queriesChangedForTick();
+    ProxQueryHandlerData* queryHandlerByIndex(uint32 idx);
+    int32 queryHandlerIndex(ProxQueryHandler* handler);
     void rebuildHandlerType(ProxQueryHandlerData* handler, ObjectClass objtype);
     void rebuildHandler(ObjectClass objtype);
 
     void recomputeAggregateQueryBounds();
 
     // Command handlers
+    virtual void getStats(Command::Result* result);
     virtual void commandProperties(const Command::Command& cmd, Command::Commander* cmdr, Command::CommandID cmdid);
     virtual void commandListHandlers(const Command::Command& cmd, Command::Commander* cmdr, Command::CommandID cmdid);
     bool parseHandlerName(const String& name, ProxQueryHandlerData** handlers_out, ObjectClass* class_out);
@@ -293,6 +332,34 @@ private:
     bool mObjectDistance; // Using distance queries
     PollerService mObjectHandlerPoller;
 
+    // Replaces the server and object handler pollers when using multiple
+    // prox threads.
+    WorkerPool* mWorkerPool;
+    PollerService mAllHandlersPoller;
+    // Set while workers tick handlers, during which query events are deferred
+    // into mDeferredQueries, one set per handler, since each handler is only
+    // ticked by one worker.
+    bool mParallelTick;
+    typedef std::tr1::unordered_set<Query*> QuerySet;
+    QuerySet mDeferredQueries[2*NUM_OBJECT_CLASSES];
+    // Handlers ticked in parallel can both report aggregate events
+    boost::mutex mAggregateListenerMutex;
+
+    // Settings for generating results, fixed at startup
+    bool mCoalesceFirst;
+    uint32 mMaxPerResult;
+    // One encoder per worker, so workers can encode in parallel
+    std::vector<ProxResultEncoder*> mResultEncoders;
+
+    // Only non-NULL with adaptive ticking, in which case
+    // mAdaptiveTickPoller replaces the other handler pollers.
+    ProxTickScheduler* mTickScheduler;
+    PollerService mAdaptiveTickPoller;
+    const String mTimeSeriesTickRateName;
+    const String mTimeSeriesDirtyObjectsName;
+    Time mLastTickReport;
+    ProxTickScheduler::Stats mLastTickReportStats;
+
     // Pollers that trigger rebuilding of query data structures
     PollerService mStaticRebuilderPoller;
     PollerService mDynamicRebuilderPoller;
@@ -730,6 +730,12 @@ void LibproxProximityBase::updateAggregateQueryData(const ObjectReference& objid
 
 void LibproxProximityBase::commandStats(const Command::Command& cmd, Command::Commander* cmdr, Command::CommandID cmdid) {
     Command::Result result = Command::EmptyResult();
+    getStats(&result);
+    cmdr->result(cmdid, result);
+}
+
+void LibproxProximityBase::getStats(Command::Result* result_out) {
+    Command::Result& result = *result_out;
 
     result.put("stats.object.sent.bytes", mStats.objectSentBytes.read());
     result.put("stats.object.sent.messages", mStats.objectSentMessages.read());
@@ -745,8 +751,6 @@ void LibproxProximityBase::commandStats(const Command::Command& cmd, Command::Co
     result.put("stats.space.sent.messages", mStats.spaceSentMessages.read());
     result.put("stats.space.received.bytes", mStats.spaceReceivedBytes.read());
     result.put("stats.space.received.messages", mStats.spaceReceivedMessages.read());
-
-    cmdr->result(cmdid, result);
 }
 
 } // namespace Sirikata
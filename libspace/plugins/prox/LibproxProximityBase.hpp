@@ -357,6 +357,8 @@ protected:
     virtual void commandForceRebuild(const Command::Command& cmd, Command::Commander* cmdr, Command::CommandID cmdid) = 0;
     virtual void commandListNodes(const Command::Command& cmd, Command::Commander* cmdr, Command::CommandID cmdid) = 0;
     virtual void commandStats(const Command::Command& cmd, Command::Commander* cmdr, Command::CommandID cmdid);
+    // Fills in the results for commandStats, override to add more
+    virtual void getStats(Command::Result* result);
 
 }; // class LibproxProximityBase
 
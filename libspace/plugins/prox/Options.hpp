@@ -11,6 +11,11 @@
 #define PROX_MAX_PER_RESULT        "prox.max-per-result"
 #define OPT_PROX_SPLIT_DYNAMIC     "prox.split-dynamic"
 #define OPT_PROX_COALESCE_FIRST    "prox.coalesce-first"
+#define OPT_PROX_THREADS           "prox.threads"
+#define OPT_PROX_TICK_MODE         "prox.tick-mode"
+#define OPT_PROX_TICK_MIN_INTERVAL "prox.tick.min-interval"
+#define OPT_PROX_TICK_MAX_INTERVAL "prox.tick.max-interval"
+#define OPT_PROX_TICK_MAX_LOAD     "prox.tick.max-load"
 
 #define OPT_PROX_SERVER_QUERY_HANDLER_TYPE         "prox.server.handler"
 #define OPT_PROX_SERVER_QUERY_HANDLER_OPTIONS      "prox.server.handler-options"
@@ -55,6 +55,11 @@ static void InitPluginOptions() {
         .addOption(new OptionValue(OPT_PROX_SPLIT_DYNAMIC, "true", Sirikata::OptionValueType<bool>(), "If true, separate query handlers will be used for static and dynamic objects."))
 
         .addOption(new OptionValue(OPT_PROX_COALESCE_FIRST, "false", Sirikata::OptionValueType<bool>(), "If true, wait for all results from first query evaluation and coalesce them into a minimal set of results. Only applies to declarative queries (non-manual)."))
+        .addOption(new OptionValue(OPT_PROX_THREADS, "1", Sirikata::OptionValueType<uint32>(), "Number of threads used to tick query handlers and generate object query results. With more than 1, query handlers are ticked in parallel and results are generated in parallel across queriers."))
+        .addOption(new OptionValue(OPT_PROX_TICK_MODE, "fixed", Sirikata::OptionValueType<String>(), "How query handlers are scheduled. fixed ticks them every 100ms. adaptive only ticks them when objects or queries have changed, or prox.tick.max-interval has passed, adapting the rate to the cost of ticking."))
+        .addOption(new OptionValue(OPT_PROX_TICK_MIN_INTERVAL, "10ms", Sirikata::OptionValueType<Duration>(), "Minimum time between adaptive ticks."))
+        .addOption(new OptionValue(OPT_PROX_TICK_MAX_INTERVAL, "1s", Sirikata::OptionValueType<Duration>(), "Maximum time between adaptive ticks, even if nothing has changed."))
+        .addOption(new OptionValue(OPT_PROX_TICK_MAX_LOAD, "0.5", Sirikata::OptionValueType<float32>(), "Maximum fraction of the prox thread's time adaptive ticks should use. The time between ticks is increased as ticks get more expensive."))
 
         .addOption(new OptionValue(OPT_PROX_QUERY_RANGE, "100", Sirikata::OptionValueType<float32>(), "The range of queries when using range queries instead of solid angle queries."))
 
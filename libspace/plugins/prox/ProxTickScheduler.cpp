@@ -0,0 +1,64 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "ProxTickScheduler.hpp"
+
+namespace Sirikata {
+
+ProxTickScheduler::ProxTickScheduler(const Duration& min_interval, const Duration& max_interval, float32 max_load)
+ : mMinInterval(min_interval),
+   mMaxInterval(std::max(min_interval, max_interval)),
+   mMaxLoad(std::max(std::min(max_load, 1.f), 0.01f)),
+   mDirtyQueries(0),
+   mLastTick(Time::null()),
+   mAvgTickCost(0),
+   mInterval(min_interval)
+{
+}
+
+void ProxTickScheduler::objectChanged(const ObjectReference& objid, bool moving) {
+    mDirtyObjects.insert(objid);
+    if (moving)
+        mMovingObjects.insert(objid);
+    else
+        mMovingObjects.erase(objid);
+}
+
+void ProxTickScheduler::queriesChanged() {
+    mDirtyQueries++;
+}
+
+bool ProxTickScheduler::dirty() const {
+    return (!mDirtyObjects.empty() || !mMovingObjects.empty() || mDirtyQueries > 0);
+}
+
+bool ProxTickScheduler::shouldTick(const Time& now) {
+    Duration since = now - mLastTick;
+    if (since >= mMaxInterval) {
+        if (!dirty()) mStats.deadlineTicks++;
+        return true;
+    }
+    if (dirty() && since >= mInterval)
+        return true;
+
+    mStats.skippedPolls++;
+    return false;
+}
+
+void ProxTickScheduler::ticked(const Time& start, const Duration& elapsed) {
+    mStats.ticks++;
+    mStats.dirtyObjects += mDirtyObjects.size();
+
+    mDirtyObjects.clear();
+    mDirtyQueries = 0;
+    mLastTick = start;
+
+    // Exponentially weighted so a single slow tick doesn't stall updates
+    float64 cost = elapsed.toMicroseconds();
+    mAvgTickCost = (mStats.ticks == 1) ? cost : (0.75 * mAvgTickCost + 0.25 * cost);
+    Duration target = Duration::microseconds((int64)(mAvgTickCost / mMaxLoad));
+    mInterval = std::max(mMinInterval, std::min(mMaxInterval, target));
+}
+
+} // namespace Sirikata
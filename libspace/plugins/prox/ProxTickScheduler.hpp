@@ -0,0 +1,86 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_LIBPROX_PROX_TICK_SCHEDULER_HPP_
+#define _SIRIKATA_LIBPROX_PROX_TICK_SCHEDULER_HPP_
+
+#include <sirikata/space/Platform.hpp>
+#include <sirikata/core/util/ObjectReference.hpp>
+
+namespace Sirikata {
+
+/** ProxTickScheduler decides when query handlers need to be ticked. Instead
+ *  of ticking at a fixed rate, it tracks which objects and queries have
+ *  changed since the last tick and only ticks when something has, or when
+ *  a deadline passes so any work the handlers spread over multiple ticks
+ *  still completes. Objects with non-zero velocity keep changing without
+ *  updates, so they keep the scheduler dirty until they stop.
+ *
+ *  The minimum time between ticks adapts to the cost of ticking: it's kept
+ *  large enough that ticks use at most a target fraction of the prox thread,
+ *  but never shorter than the minimum interval or longer than the deadline.
+ *
+ *  Only used from the prox strand, so no locking is performed.
+ */
+class ProxTickScheduler {
+public:
+    ProxTickScheduler(const Duration& min_interval, const Duration& max_interval, float32 max_load);
+
+    // Object added, removed, or moved or resized. moving indicates whether its
+    // position is still changing.
+    void objectChanged(const ObjectReference& objid, bool moving);
+    // A query was added, removed or updated, or objects were moved between
+    // handlers.
+    void queriesChanged();
+
+    bool dirty() const;
+    // Returns true if a tick should be performed now. Counts as a skipped
+    // poll if it returns false.
+    bool shouldTick(const Time& now);
+    // Record a completed tick, clearing the dirty state and adapting the tick
+    // interval to its cost.
+    void ticked(const Time& start, const Duration& elapsed);
+
+    const Duration& interval() const { return mInterval; }
+    uint32 dirtyObjects() const { return mDirtyObjects.size(); }
+    uint32 movingObjects() const { return mMovingObjects.size(); }
+
+    struct Stats {
+        Stats()
+         : ticks(0),
+           deadlineTicks(0),
+           skippedPolls(0),
+           dirtyObjects(0)
+        {}
+
+        uint64 ticks;
+        // Ticks triggered only by the deadline
+        uint64 deadlineTicks;
+        uint64 skippedPolls;
+        // Sum of dirty set sizes over all ticks
+        uint64 dirtyObjects;
+    };
+    const Stats& stats() const { return mStats; }
+
+private:
+    const Duration mMinInterval;
+    const Duration mMaxInterval;
+    const float32 mMaxLoad;
+
+    typedef std::tr1::unordered_set<ObjectReference, ObjectReference::Hasher> ObjectSet;
+    ObjectSet mDirtyObjects;
+    ObjectSet mMovingObjects;
+    uint32 mDirtyQueries;
+
+    Time mLastTick;
+    // Smoothed cost of each tick, in microseconds
+    float64 mAvgTickCost;
+    Duration mInterval;
+
+    Stats mStats;
+}; // class ProxTickScheduler
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_LIBPROX_PROX_TICK_SCHEDULER_HPP_
@@ -46,6 +46,8 @@ static void InitPluginOptions() {
         new OptionValue("prefix","",Sirikata::OptionValueType<String>(),"Prefix for redis keys, allowing you to provide 'namespaces' so multiple spaces can share the same redis database."),
         new OptionValue("ttl","60s",Sirikata::OptionValueType<Duration>(),"Duration for keys to remain valid in Redis before they are automatically removed in case of dead nodes. This is a tradeoff between having to refresh entries and how long it takes before an object identifier can be reclaimed after a server crashes."),
         new OptionValue("transactions","true",Sirikata::OptionValueType<bool>(),"If false, disables transactions. This isn't really safe as you can fail between commands and get keys stuck, but it allows running against older versions of Redis. Since this isn't safe, transactions are turned on by default."),
+        new OptionValue("batch-delay","300us",Sirikata::OptionValueType<Duration>(),"Maximum time to hold lookups and writes so they can be sent to Redis together, as a single MGET for lookups and a single transaction for writes. 0 sends each one immediately."),
+        new OptionValue("batch-size","256",Sirikata::OptionValueType<uint32>(),"Maximum number of lookups or writes in a batch. A batch is sent as soon as it fills up."),
         NULL
     );
 }
@@ -59,8 +61,10 @@ static ObjectSegmentation* createRedisOSeg(SpaceContext* ctx, Network::IOStrand*
     String redis_prefix = optionsSet->referenceOption("prefix")->as<String>();
     Duration redis_ttl = optionsSet->referenceOption("ttl")->as<Duration>();
     bool redis_has_transactions = optionsSet->referenceOption("transactions")->as<bool>();
+    Duration batch_delay = optionsSet->referenceOption("batch-delay")->as<Duration>();
+    uint32 batch_size = optionsSet->referenceOption("batch-size")->as<uint32>();
 
-    return new RedisObjectSegmentation(ctx, oseg_strand, cseg, cache, redis_host, redis_port, redis_prefix, redis_ttl, redis_has_transactions);
+    return new RedisObjectSegmentation(ctx, oseg_strand, cseg, cache, redis_host, redis_port, redis_prefix, redis_ttl, redis_has_transactions, batch_delay, batch_size);
 }
 
 } // namespace Sirikata
@@ -114,32 +114,6 @@ struct RedisObjectMigratedOperationInfo {
     uint8 refcount;
 };
 
-void globalRedisLookupObjectReadFinished(redisAsyncContext* c, void* _reply, void* privdata) {
-    redisReply *reply = (redisReply*)_reply;
-    RedisObjectOperationInfo* wi = (RedisObjectOperationInfo*)privdata;
-
-    if (reply == NULL) {
-        REDISOSEG_LOG(error, "Unknown redis error when reading object " << wi->obj.toString());
-    }
-    else if (reply->type == REDIS_REPLY_ERROR) {
-        REDISOSEG_LOG(error, "Redis error when reading object " << wi->obj.toString() << ": " << String(reply->str, reply->len));
-        wi->oseg->failReadObject(wi->obj);
-    }
-    else if (reply->type == REDIS_REPLY_NIL) {
-        REDISOSEG_LOG(error, "Redis got nil when reading object.");
-        wi->oseg->failReadObject(wi->obj);
-    }
-    else if (reply->type == REDIS_REPLY_STRING) {
-        wi->oseg->finishReadObject(wi->obj, String(reply->str, reply->len));
-    }
-    else {
-        REDISOSEG_LOG(error, "Unexpected redis reply type when reading object " << wi->obj.toString() << ": " << reply->type);
-    }
-
-    delete wi;
-}
-
-
 void globalRedisAddNewObjectWriteFinished(redisAsyncContext* c, void* _reply, void* privdata) {
     redisReply *reply = (redisReply*)_reply;
     RedisObjectOperationInfo* wi = (RedisObjectOperationInfo*)privdata;
@@ -398,9 +372,155 @@ void globalRedisRefreshObjectTimeoutWriteFinished(redisAsyncContext* c, void* _r
     wi->checkDestroy();
 }
 
+// State tracking for a batch of lookups sent as a single MGET
+struct RedisLookupBatchInfo {
+    RedisLookupBatchInfo(RedisObjectSegmentation* _oseg)
+     : oseg(_oseg)
+    {}
+
+    RedisObjectSegmentation* oseg;
+    std::vector<UUID> objs; // In the same order as the MGET keys
+};
+
+void globalRedisLookupBatchFinished(redisAsyncContext* c, void* _reply, void* privdata) {
+    redisReply *reply = (redisReply*)_reply;
+    RedisLookupBatchInfo* bi = (RedisLookupBatchInfo*)privdata;
+
+    if (reply == NULL || reply->type != REDIS_REPLY_ARRAY || reply->elements != bi->objs.size()) {
+        if (reply == NULL)
+            REDISOSEG_LOG(error, "Unknown redis error when reading " << bi->objs.size() << " objects");
+        else if (reply->type == REDIS_REPLY_ERROR)
+            REDISOSEG_LOG(error, "Redis error when reading " << bi->objs.size() << " objects: " << String(reply->str, reply->len));
+        else
+            REDISOSEG_LOG(error, "Unexpected redis reply when reading " << bi->objs.size() << " objects: " << reply->type);
+        // Fail all of them so messages waiting on the lookups aren't stuck
+        for(uint32 i = 0; i < bi->objs.size(); i++)
+            bi->oseg->failReadObject(bi->objs[i]);
+    }
+    else {
+        for(uint32 i = 0; i < bi->objs.size(); i++) {
+            redisReply* elem = reply->element[i];
+            if (elem->type == REDIS_REPLY_STRING)
+                bi->oseg->finishReadObject(bi->objs[i], String(elem->str, elem->len));
+            else // nil if the key doesn't exist
+                bi->oseg->failReadObject(bi->objs[i]);
+        }
+    }
+
+    bi->oseg->finishLookupBatch(bi->objs.size());
+    delete bi;
+}
+
+// State tracking for a batch of new and migrated object writes sent as a single
+// transaction
+struct RedisWriteBatchInfo {
+    RedisWriteBatchInfo(RedisObjectSegmentation* _oseg)
+     : oseg(_oseg), completed(false), refcount(0)
+    {}
+
+    void checkDestroy() {
+        if (refcount == 0) delete this;
+    }
+
+    // Reports failure for the entire batch
+    void fail() {
+        for(uint32 i = 0; i < writes.size(); i++) {
+            if (writes[i].isNew)
+                oseg->finishWriteNewObject(writes[i].obj, OSegWriteListener::UNKNOWN_ERROR);
+        }
+        completed = true;
+    }
+
+    RedisObjectSegmentation* oseg;
+    std::vector<RedisObjectSegmentation::PendingWrite> writes; // In transaction order
+    bool completed; // Callbacks invoked, successful or not
+    uint32 refcount;
+};
+
+void globalRedisWriteBatchFinished(redisAsyncContext* c, void* _reply, void* privdata) {
+    redisReply *reply = (redisReply*)_reply;
+    RedisWriteBatchInfo* wi = (RedisWriteBatchInfo*)privdata;
+
+    wi->refcount--;
+    // If we've already indicated a result, we can't go back
+    if (wi->completed) {
+        wi->checkDestroy();
+        return;
+    }
+
+    if (reply == NULL) {
+        REDISOSEG_LOG(error, "Unknown redis error when writing " << wi->writes.size() << " objects");
+        wi->fail();
+    }
+    else if (reply->type == REDIS_REPLY_ERROR) {
+        REDISOSEG_LOG(error, "Redis error when writing " << wi->writes.size() << " objects: " << String(reply->str, reply->len));
+        wi->fail();
+    }
+    else if (reply->type == REDIS_REPLY_STATUS) {
+        // OK for MULTI and QUEUED for each command, nothing to do until EXEC
+        String reply_str(reply->str, reply->len);
+        if (reply_str != String("OK") && reply_str != String("QUEUED")) {
+            REDISOSEG_LOG(error, "Unexpected status reply while writing " << wi->writes.size() << " objects: " << reply_str);
+            wi->fail();
+        }
+    }
+    else if (reply->type == REDIS_REPLY_ARRAY) {
+        // Bulk reply to EXEC, SET(NX) + EXPIRE for each object
+        if (reply->elements != 2 * wi->writes.size()) {
+            REDISOSEG_LOG(error, "Invalid bulk reply to batched write transaction: " << reply->elements << " elements for " << wi->writes.size() << " objects");
+            wi->fail();
+        }
+        else {
+            for(uint32 i = 0; i < wi->writes.size(); i++) {
+                const RedisObjectSegmentation::PendingWrite& write = wi->writes[i];
+                redisReply* set_reply = reply->element[2*i];
+                redisReply* expire_reply = reply->element[2*i+1];
+                bool expire_succeeded = (expire_reply->type == REDIS_REPLY_INTEGER && expire_reply->integer == 1);
+
+                if (write.isNew) {
+                    if (set_reply->type != REDIS_REPLY_INTEGER) {
+                        REDISOSEG_LOG(error, "Invalid reply type for SETNX for new object " << write.obj.toString());
+                        wi->oseg->finishWriteNewObject(write.obj, OSegWriteListener::UNKNOWN_ERROR);
+                    }
+                    else if (set_reply->integer != 1) {
+                        REDISOSEG_LOG(error, "Redis error when writing new object " << write.obj.toString() << ": " << set_reply->integer << " likely already registered.");
+                        wi->oseg->finishWriteNewObject(write.obj, OSegWriteListener::OBJ_ALREADY_REGISTERED);
+                    }
+                    else if (!expire_succeeded) {
+                        REDISOSEG_LOG(error, "Redis error when writing new object expiry " << write.obj.toString());
+                        wi->oseg->finishWriteNewObject(write.obj, OSegWriteListener::UNKNOWN_ERROR);
+                    }
+                    else {
+                        wi->oseg->finishWriteNewObject(write.obj, OSegWriteListener::SUCCESS);
+                    }
+                }
+                else {
+                    if (set_reply->type != REDIS_REPLY_STATUS || String(set_reply->str, set_reply->len) != "OK") {
+                        REDISOSEG_LOG(error, "Unexpected reply for SET for migrated object " << write.obj.toString());
+                    }
+                    else if (!expire_succeeded) {
+                        REDISOSEG_LOG(error, "Unexpected reply for EXPIRE for migrated object " << write.obj.toString());
+                    }
+                    else {
+                        wi->oseg->finishWriteMigratedObject(write.obj, write.ackTo);
+                    }
+                }
+            }
+        }
+        // No matter what we've completed if we got here since it's the EXEC response
+        wi->completed = true;
+    }
+    else {
+        REDISOSEG_LOG(error, "Unexpected redis reply type when writing " << wi->writes.size() << " objects: " << reply->type);
+        wi->fail();
+    }
+
+    wi->checkDestroy();
+}
+
 } // namespace
 
-RedisObjectSegmentation::RedisObjectSegmentation(SpaceContext* con, Network::IOStrand* o_strand, CoordinateSegmentation* cseg, OSegCache* cache, const String& redis_host, uint32 redis_port, const String& redis_prefix, Duration key_ttl, bool redis_has_transactions)
+RedisObjectSegmentation::RedisObjectSegmentation(SpaceContext* con, Network::IOStrand* o_strand, CoordinateSegmentation* cseg, OSegCache* cache, const String& redis_host, uint32 redis_port, const String& redis_prefix, Duration key_ttl, bool redis_has_transactions, Duration batch_delay, uint32 batch_size)
  : ObjectSegmentation(con, o_strand),
    mCSeg(cseg),
    mCache(cache),
@@ -409,10 +529,20 @@ RedisObjectSegmentation::RedisObjectSegmentation(SpaceContext* con, Network::IOS
    mRedisPrefix(redis_prefix),
    mRedisKeyTTL(key_ttl),
    mRedisHasTransactions(redis_has_transactions),
+   mBatchDelay(batch_delay),
+   mBatchSize(std::max(batch_size, (uint32)1)),
    mRedisContext(NULL),
    mRedisFD(NULL),
    mReading(false),
    mWriting(false),
+   mFlushScheduled(false),
+   mLookupsInFlight(0),
+   mBatchTimer(
+       Network::IOTimer::create(
+           o_strand,
+           std::tr1::bind(&RedisObjectSegmentation::flushBatches, this)
+       )
+   ),
    mExpiryTimer(
        Network::IOTimer::create(
            con->mainStrand,
@@ -432,6 +562,7 @@ void RedisObjectSegmentation::start() {
 }
 
 void RedisObjectSegmentation::stop() {
+    mBatchTimer->cancel();
     mExpiryTimer->cancel();
     ObjectSegmentation::stop();
 }
@@ -586,15 +717,136 @@ OSegEntry RedisObjectSegmentation::lookup(const UUID& obj_id) {
 
     // Otherwise, kick off the lookup process and return null
     if (mStopping) return OSegEntry::null();
-    RedisObjectOperationInfo* ri = new RedisObjectOperationInfo(this, obj_id);
-    ensureConnected();
     {
         Lock lck(mMutex);
-        redisAsyncCommand(mRedisContext, globalRedisLookupObjectReadFinished, ri, "GET %s%s", mRedisPrefix.c_str(), obj_id.toString().c_str());
+        queueLookup(obj_id);
     }
     return OSegEntry::null();
 }
 
+int RedisObjectSegmentation::getPushback() {
+    Lock lck(mMutex);
+    return (int)mPendingLookups.size() + mLookupsInFlight;
+}
+
+void RedisObjectSegmentation::queueLookup(const UUID& obj_id) {
+    mPendingLookups.push_back(obj_id);
+    if (mPendingLookups.size() >= mBatchSize)
+        flushLookups();
+    else
+        scheduleFlush();
+}
+
+void RedisObjectSegmentation::queueWrite(const PendingWrite& write) {
+    mPendingWrites.push_back(write);
+    if (mPendingWrites.size() >= mBatchSize)
+        flushWrites();
+    else
+        scheduleFlush();
+}
+
+void RedisObjectSegmentation::scheduleFlush() {
+    if (mBatchDelay <= Duration::zero()) {
+        flushLookups();
+        flushWrites();
+        return;
+    }
+
+    if (mFlushScheduled) return;
+    mFlushScheduled = true;
+    mBatchTimer->wait(mBatchDelay);
+}
+
+void RedisObjectSegmentation::flushBatches() {
+    Lock lck(mMutex);
+    mFlushScheduled = false;
+    if (mStopping) return;
+    flushLookups();
+    flushWrites();
+}
+
+void RedisObjectSegmentation::flushLookups() {
+    if (mPendingLookups.empty()) return;
+
+    RedisLookupBatchInfo* bi = new RedisLookupBatchInfo(this);
+    bi->objs.swap(mPendingLookups);
+
+    // MGET key1 key2 ..., built as an argv since the number of keys varies
+    std::vector<String> keys;
+    keys.reserve(bi->objs.size());
+    std::vector<const char*> argv;
+    std::vector<size_t> argvlen;
+    argv.reserve(bi->objs.size() + 1);
+    argvlen.reserve(bi->objs.size() + 1);
+    argv.push_back("MGET");
+    argvlen.push_back(4);
+    for(uint32 i = 0; i < bi->objs.size(); i++) {
+        keys.push_back(mRedisPrefix + bi->objs[i].toString());
+        argv.push_back(keys.back().c_str());
+        argvlen.push_back(keys.back().size());
+    }
+
+    REDISOSEG_LOG(insane, "MGET " << bi->objs.size() << " objects");
+    mLookupsInFlight += bi->objs.size();
+    ensureConnected();
+    redisAsyncCommandArgv(mRedisContext, globalRedisLookupBatchFinished, bi, argv.size(), &argv[0], &argvlen[0]);
+}
+
+void RedisObjectSegmentation::finishLookupBatch(uint32 count) {
+    // Invoked from redis callbacks, so we already hold mMutex
+    mLookupsInFlight -= count;
+}
+
+void RedisObjectSegmentation::flushWrites() {
+    if (mPendingWrites.empty()) return;
+
+    ensureConnected();
+
+    // Without transactions, each write goes out as separate commands. They're
+    // still buffered together by hiredis and sent in one write.
+    if (!mRedisHasTransactions) {
+        for(uint32 i = 0; i < mPendingWrites.size(); i++)
+            issueWrite(mPendingWrites[i]);
+        mPendingWrites.clear();
+        return;
+    }
+
+    RedisWriteBatchInfo* wi = new RedisWriteBatchInfo(this);
+    wi->writes.swap(mPendingWrites);
+
+    REDISOSEG_LOG(insane, "Writing " << wi->writes.size() << " objects");
+    wi->refcount++;
+    redisAsyncCommand(mRedisContext, globalRedisWriteBatchFinished, wi, "MULTI");
+    for(uint32 i = 0; i < wi->writes.size(); i++) {
+        const PendingWrite& write = wi->writes[i];
+        String obj_id_str = write.obj.toString();
+        wi->refcount++;
+        redisAsyncCommand(mRedisContext, globalRedisWriteBatchFinished, wi, (write.isNew ? "SETNX %s%s %b" : "SET %s%s %b"), mRedisPrefix.c_str(), obj_id_str.c_str(), write.value.c_str(), write.value.size());
+        wi->refcount++;
+        redisAsyncCommand(mRedisContext, globalRedisWriteBatchFinished, wi, "EXPIRE %s%s %d", mRedisPrefix.c_str(), obj_id_str.c_str(), (int32)mRedisKeyTTL.seconds());
+    }
+    wi->refcount++;
+    redisAsyncCommand(mRedisContext, globalRedisWriteBatchFinished, wi, "EXEC");
+}
+
+void RedisObjectSegmentation::issueWrite(const PendingWrite& write) {
+    String obj_id_str = write.obj.toString();
+    if (write.isNew) {
+        RedisObjectOperationInfo* wi = new RedisObjectOperationInfo(this, write.obj);
+        wi->refcount++;
+        redisAsyncCommand(mRedisContext, globalRedisAddNewObjectWriteFinished, wi, "SETNX %s%s %b", mRedisPrefix.c_str(), obj_id_str.c_str(), write.value.c_str(), write.value.size());
+        wi->refcount++;
+        redisAsyncCommand(mRedisContext, globalRedisAddNewObjectWriteFinished, wi, "EXPIRE %s%s %d", mRedisPrefix.c_str(), obj_id_str.c_str(), (int32)mRedisKeyTTL.seconds());
+    }
+    else {
+        RedisObjectMigratedOperationInfo* wi = new RedisObjectMigratedOperationInfo(this, write.obj, write.ackTo);
+        wi->refcount++;
+        redisAsyncCommand(mRedisContext, globalRedisAddMigratedObjectWriteFinished, wi, "SET %s%s %b", mRedisPrefix.c_str(), obj_id_str.c_str(), write.value.c_str(), write.value.size());
+        wi->refcount++;
+        redisAsyncCommand(mRedisContext, globalRedisAddMigratedObjectWriteFinished, wi, "EXPIRE %s%s %d", mRedisPrefix.c_str(), obj_id_str.c_str(), (int32)mRedisKeyTTL.seconds());
+    }
+}
+
 void RedisObjectSegmentation::finishReadObject(const UUID& obj_id, const String& data_str) {
     REDISOSEG_LOG(detailed, "Finished reading OSEG entry for object " << obj_id.toString());
     if (mStopping) return;
@@ -629,7 +881,6 @@ void RedisObjectSegmentation::addNewObject(const UUID& obj_id, float radius) {
 
     mOSeg[obj_id] = OSegEntry(mContext->id(), radius);
 
-    RedisObjectOperationInfo* wi = new RedisObjectOperationInfo(this, obj_id);
     // Note: currently we're keeping compatibility with Redis 1.2. This means
     // that there aren't hashes on the server. Instead, we create and parse them
     // ourselves. This isn't so bad since they are all fixed format anyway.
@@ -637,22 +888,9 @@ void RedisObjectSegmentation::addNewObject(const UUID& obj_id, float radius) {
     os << mContext->id() << ":" << radius;
     String valstr = os.str();
     REDISOSEG_LOG(insane, "SETNX " << obj_id.toString() << " " << valstr);
-    ensureConnected();
     {
-        String obj_id_str = obj_id.toString();
         Lock lck(mMutex);
-        if (mRedisHasTransactions) {
-            wi->refcount++;
-            redisAsyncCommand(mRedisContext, globalRedisAddNewObjectWriteFinished, wi, "MULTI");
-        }
-        wi->refcount++;
-        redisAsyncCommand(mRedisContext, globalRedisAddNewObjectWriteFinished, wi, "SETNX %s%s %b", mRedisPrefix.c_str(), obj_id_str.c_str(), valstr.c_str(), valstr.size());
-        wi->refcount++;
-        redisAsyncCommand(mRedisContext, globalRedisAddNewObjectWriteFinished, wi, "EXPIRE %s%s %d", mRedisPrefix.c_str(), obj_id_str.c_str(), (int32)mRedisKeyTTL.seconds());
-        if (mRedisHasTransactions) {
-            wi->refcount++;
-            redisAsyncCommand(mRedisContext, globalRedisAddNewObjectWriteFinished, wi, "EXEC");
-        }
+        queueWrite(PendingWrite(obj_id, valstr, true, NullServerID));
     }
 }
 
@@ -688,7 +926,6 @@ void RedisObjectSegmentation::addMigratedObject(const UUID& obj_id, float radius
 
     mOSeg[obj_id] = OSegEntry(mContext->id(), radius);
 
-    RedisObjectMigratedOperationInfo* wi = new RedisObjectMigratedOperationInfo(this, obj_id, (generateAck ? idServerAckTo : NullServerID));
     // Note: currently we're keeping compatibility with Redis 1.2. This means
     // that there aren't hashes on the server. Instead, we create and parse them
     // ourselves. This isn't so bad since they are all fixed format anyway.
@@ -696,22 +933,9 @@ void RedisObjectSegmentation::addMigratedObject(const UUID& obj_id, float radius
     os << mContext->id() << ":" << radius;
     String valstr = os.str();
     REDISOSEG_LOG(insane, "SET " << obj_id.toString() << " " << valstr);
-    ensureConnected();
     {
-        String obj_id_str = obj_id.toString();
         Lock lck(mMutex);
-        if (mRedisHasTransactions) {
-            wi->refcount++;
-            redisAsyncCommand(mRedisContext, globalRedisAddNewObjectWriteFinished, wi, "MULTI");
-        }
-        wi->refcount++;
-        redisAsyncCommand(mRedisContext, globalRedisAddMigratedObjectWriteFinished, wi, "SET %s%s %b", mRedisPrefix.c_str(), obj_id_str.c_str(), valstr.c_str(), valstr.size());
-        wi->refcount++;
-        redisAsyncCommand(mRedisContext, globalRedisAddNewObjectWriteFinished, wi, "EXPIRE %s%s %d", mRedisPrefix.c_str(), obj_id_str.c_str(), (int32)mRedisKeyTTL.seconds());
-        if (mRedisHasTransactions) {
-            wi->refcount++;
-            redisAsyncCommand(mRedisContext, globalRedisAddNewObjectWriteFinished, wi, "EXEC");
-        }
+        queueWrite(PendingWrite(obj_id, valstr, false, (generateAck ? idServerAckTo : NullServerID)));
     }
 }
 
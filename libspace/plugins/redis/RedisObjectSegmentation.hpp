@@ -47,7 +47,7 @@ namespace Sirikata {
 
 class RedisObjectSegmentation : public ObjectSegmentation {
 public:
-    RedisObjectSegmentation(SpaceContext* con, Network::IOStrand* o_strand, CoordinateSegmentation* cseg, OSegCache* cache, const String& redis_host, uint32 redis_port, const String& redis_prefix, Duration redis_ttl, bool redis_has_transactions);
+    RedisObjectSegmentation(SpaceContext* con, Network::IOStrand* o_strand, CoordinateSegmentation* cseg, OSegCache* cache, const String& redis_host, uint32 redis_port, const String& redis_prefix, Duration redis_ttl, bool redis_has_transactions, Duration batch_delay, uint32 batch_size);
     ~RedisObjectSegmentation();
 
     virtual void start();
@@ -66,6 +66,8 @@ public:
     virtual void handleMigrateMessageAck(const Sirikata::Protocol::OSeg::MigrateMessageAcknowledge& msg);
     virtual void handleUpdateOSegMessage(const Sirikata::Protocol::OSeg::UpdateOSegMessage& update_oseg_msg);
 
+    // Lookups queued or waiting on a reply from redis
+    virtual int getPushback();
 
     // Redis event handlers
     void disconnected();
@@ -81,6 +83,21 @@ public:
     void failReadObject(const UUID& obj_id);
     void finishWriteNewObject(const UUID& obj_id, OSegWriteListener::OSegAddNewStatus);
     void finishWriteMigratedObject(const UUID& obj_id, ServerID ackTo);
+    // Invoked when redis has replied to (or failed) a batch of lookups
+    void finishLookupBatch(uint32 count);
+
+    // A write of an object's entry, queued to be sent with others in one
+    // transaction
+    struct PendingWrite {
+        PendingWrite(const UUID& _obj, const String& _value, bool _isNew, ServerID _ackTo)
+         : obj(_obj), value(_value), isNew(_isNew), ackTo(_ackTo)
+        {}
+
+        UUID obj;
+        String value;
+        bool isNew; // SETNX for new objects, SET for migrated objects
+        ServerID ackTo; // Migrated objects only
+    };
 
 private:
     void connect();
@@ -93,6 +110,19 @@ private:
     void readHandler(const boost::system::error_code& ec);
     void writeHandler(const boost::system::error_code& ec);
 
+    // Lookups and writes are collected for up to mBatchDelay and sent as a
+    // single MGET and a single transaction. Other than flushBatches, these must
+    // be called with mMutex held.
+    void queueLookup(const UUID& obj_id);
+    void queueWrite(const PendingWrite& write);
+    void scheduleFlush();
+    void flushLookups();
+    void flushWrites();
+    // Used instead of a transaction when transactions are disabled
+    void issueWrite(const PendingWrite& write);
+    // Timer handler which sends whatever has been batched so far
+    void flushBatches();
+
     void cacheAndNotifyNewObject(const UUID& obj_id, OSegWriteListener::OSegAddNewStatus);
     void cacheAndAckMigration(const UUID& obj_id, ServerID ackTo);
 
@@ -113,6 +143,8 @@ private:
     String mRedisPrefix;
     Duration mRedisKeyTTL;
     bool mRedisHasTransactions;
+    Duration mBatchDelay;
+    uint32 mBatchSize;
 
     redisAsyncContext* mRedisContext;
     boost::asio::posix::stream_descriptor* mRedisFD; // Wrapped hiredis file descriptor
@@ -129,6 +161,12 @@ private:
     typedef boost::lock_guard<Mutex> Lock;
     Mutex mMutex;
 
+    // Batching state, protected by mMutex
+    std::vector<UUID> mPendingLookups;
+    std::vector<PendingWrite> mPendingWrites;
+    bool mFlushScheduled;
+    int32 mLookupsInFlight; // Sent in an MGET, waiting on the reply
+    Network::IOTimerPtr mBatchTimer;
 
     // Track objects that need timeouts refreshed in redis
     struct ObjectTimeout {
@@ -44,6 +44,9 @@ namespace Sirikata {
 void InitAlwaysLocationUpdatePolicyOptions() {
     Sirikata::InitializeClassOptions ico(ALWAYS_POLICY_OPTIONS, NULL,
         new OptionValue(LOC_MAX_PER_RESULT, "5", Sirikata::OptionValueType<uint32>(), "Maximum number of loc updates to report in each result message."),
+        new OptionValue(LOC_COMPACT_UPDATES, "true", Sirikata::OptionValueType<bool>(), "If true, objects which request it get compact loc updates containing only changed fields."),
+        new OptionValue(LOC_COMPACT_PRECISION, "0.001", Sirikata::OptionValueType<float32>(), "Precision, in meters, of positions and velocities in compact loc updates."),
+        new OptionValue(LOC_THREADS, "1", Sirikata::OptionValueType<uint32>(), "Number of threads used to build loc update messages. With more than 1, messages for different subscribers are built in parallel."),
         NULL);
 }
 
@@ -62,15 +65,29 @@ AlwaysLocationUpdatePolicy::AlwaysLocationUpdatePolicy(SpaceContext* ctx, const
    mOHUpdatesPerSecond(0),
    mTimeSeriesObjectUpdatesName(String("space.server") + boost::lexical_cast<String>(ctx->id()) + ".loc.object_updates_per_second"),
    mObjectUpdatesPerSecond(0),
+   mServicePasses(0),
+   mServiceBuildTime(Duration::zero()),
+   mServiceSendTime(Duration::zero()),
+   mServiceUpdates(0),
+   mTimeSeriesServiceBuildName(String("space.server") + boost::lexical_cast<String>(ctx->id()) + ".loc.service_build_us"),
+   mTimeSeriesServiceUpdatesName(String("space.server") + boost::lexical_cast<String>(ctx->id()) + ".loc.updates_per_second"),
+   mCompactUpdates(false),
+   mCompactPrecision(CompactLocEncoder::DefaultPrecision),
+   mWorkerPool(NULL),
    mServerSubscriptions(this, /*include_all_data=*/true, mServerUpdatesPerSecond),
    mOHSubscriptions(this, /*include_all_data=*/true, mOHUpdatesPerSecond),
    mObjectSubscriptions(this, /*include_all_data=*/false, mObjectUpdatesPerSecond)
 {
     OptionSet* optionsSet = OptionSet::getOptions(ALWAYS_POLICY_OPTIONS,NULL);
     optionsSet->parse(args);
+
+    mCompactUpdates = GetOptionValue<bool>(ALWAYS_POLICY_OPTIONS, LOC_COMPACT_UPDATES);
+    mCompactPrecision = GetOptionValue<float32>(ALWAYS_POLICY_OPTIONS, LOC_COMPACT_PRECISION);
+    mWorkerPool = new WorkerPool("AlwaysLocationUpdatePolicy", GetOptionValue<uint32>(ALWAYS_POLICY_OPTIONS, LOC_THREADS));
 }
 
 AlwaysLocationUpdatePolicy::~AlwaysLocationUpdatePolicy() {
+    delete mWorkerPool;
 }
 
 void AlwaysLocationUpdatePolicy::start() {
@@ -103,6 +120,28 @@ void AlwaysLocationUpdatePolicy::reportStats() {
         mObjectUpdatesPerSecond.read() / since_last_seconds
     );
     mObjectUpdatesPerSecond = 0;
+
+    // Average time to build messages in each service() pass, and how many
+    // updates those passes managed to send
+    if (mServicePasses > 0) {
+        mLocService->context()->timeSeries->report(
+            mTimeSeriesServiceBuildName,
+            mServiceBuildTime.toMicroseconds() / (float32)mServicePasses
+        );
+        SILOG(always_loc,detailed,
+            mServicePasses << " service passes using " << mWorkerPool->size() << " threads, "
+            << mServiceBuildTime.toMicroseconds() / (float32)mServicePasses << "us building, "
+            << mServiceSendTime.toMicroseconds() / (float32)mServicePasses << "us sending per pass"
+        );
+    }
+    mLocService->context()->timeSeries->report(
+        mTimeSeriesServiceUpdatesName,
+        mServiceUpdates / since_last_seconds
+    );
+    mServicePasses = 0;
+    mServiceBuildTime = Duration::zero();
+    mServiceSendTime = Duration::zero();
+    mServiceUpdates = 0;
 }
 
 
@@ -268,7 +307,15 @@ void AlwaysLocationUpdatePolicy::replicaQueryDataUpdated(const UUID& uuid, const
     mOHSubscriptions.queryDataUpdated(uuid, newval, mLocService);
 }
 
+void AlwaysLocationUpdatePolicy::enableCompactUpdates(const UUID& remote) {
+    if (!mCompactUpdates) return;
+    mLocService->context()->mainStrand->post(
+        std::tr1::bind(&ObjectSubscriberIndex::enableCompact, &mObjectSubscriptions, remote)
+    );
+}
+
 void AlwaysLocationUpdatePolicy::service() {
+    mServicePasses++;
     mServerSubscriptions.service();
     mOHSubscriptions.service();
     mObjectSubscriptions.service();
@@ -344,6 +391,47 @@ void AlwaysLocationUpdatePolicy::ohLocSubstreamCallback(int x, OHDPSST::StreamPt
     }
 }
 
+void AlwaysLocationUpdatePolicy::tryCreateCompactChildStream(const UUID& dest, ODPSST::StreamPtr parent_stream, std::string* msg, uint32 msg_id, int count, const SubscriberInfoPtr& sub_info) {
+    if (!validSubscriber(dest)) {
+        delete msg;
+        return;
+    }
+
+    parent_stream->createChildStream(
+        std::tr1::bind(&AlwaysLocationUpdatePolicy::objectCompactLocSubstreamCallback, this, _1, _2, dest, parent_stream, msg, msg_id, count+1, sub_info),
+        (void*)msg->data(), msg->size(),
+        OBJECT_PORT_LOCATION_COMPACT, OBJECT_PORT_LOCATION_COMPACT
+    );
+}
+
+void AlwaysLocationUpdatePolicy::objectCompactLocSubstreamCallback(int x, ODPSST::StreamPtr substream, const UUID& dest, ODPSST::StreamPtr parent_stream, std::string* msg, uint32 msg_id, int count, const SubscriberInfoPtr& sub_info) {
+    // If we got it, the data got sent and strings it defined can be referenced
+    // from now on
+    if (substream) {
+        delete msg;
+        substream->close(false);
+        mLocService->context()->mainStrand->post(
+            std::tr1::bind(&AlwaysLocationUpdatePolicy::compactMessageDelivered, sub_info, msg_id)
+        );
+        return;
+    }
+
+    if (count < 5) {
+        tryCreateCompactChildStream(dest, parent_stream, msg, msg_id, count, sub_info);
+    }
+    else {
+        SILOG(always_loc,error,"Failed multiple times to open compact loc update substream.");
+        delete msg;
+        // The next service() will resend everything to this subscriber
+        sub_info->droppedMessages++;
+    }
+}
+
+void AlwaysLocationUpdatePolicy::compactMessageDelivered(const SubscriberInfoPtr& sub_info, uint32 msg_id) {
+    if (sub_info->compactEncoder != NULL)
+        sub_info->compactEncoder->delivered(msg_id);
+}
+
 bool AlwaysLocationUpdatePolicy::validSubscriber(const UUID& dest) {
     return (mLocService->context()->objectSessionManager()->getSession(ObjectReference(dest)) != NULL);
 }
@@ -376,10 +464,8 @@ bool AlwaysLocationUpdatePolicy::isSelfSubscriber(const ServerID& sid, const UUI
     return false;
 }
 
-bool AlwaysLocationUpdatePolicy::trySend(const UUID& dest, const Sirikata::Protocol::Loc::BulkLocationUpdate& blu, const SubscriberInfoPtr& numOutstandingMessageCount)
+bool AlwaysLocationUpdatePolicy::trySend(const UUID& dest, const String& bluMsg, const SubscriberInfoPtr& numOutstandingMessageCount)
 {
-    std::string bluMsg = serializePBJMessage(blu);
-
     ObjectSession* session = mLocService->context()->objectSessionManager()->getSession(ObjectReference(dest));
     if (session == NULL) {
         //mObjectSubscriptions.decrementOutstandingMessageCount(dest);
@@ -398,10 +484,8 @@ bool AlwaysLocationUpdatePolicy::trySend(const UUID& dest, const Sirikata::Proto
     return true;
 }
 
-bool AlwaysLocationUpdatePolicy::trySend(const OHDP::NodeID& dest, const Sirikata::Protocol::Loc::BulkLocationUpdate& blu, const SubscriberInfoPtr& numOutstandingMessageCount)
+bool AlwaysLocationUpdatePolicy::trySend(const OHDP::NodeID& dest, const String& bluMsg, const SubscriberInfoPtr& numOutstandingMessageCount)
 {
-    std::string bluMsg = serializePBJMessage(blu);
-
     ObjectHostSessionPtr session = mLocService->context()->ohSessionManager()->getSession(dest);
     if (!session) {
         //mOHSubscriptions.decrementOutstandingMessageCount(dest);
@@ -420,13 +504,29 @@ bool AlwaysLocationUpdatePolicy::trySend(const OHDP::NodeID& dest, const Sirikat
     return true;
 }
 
-bool AlwaysLocationUpdatePolicy::trySend(const ServerID& dest, const Sirikata::Protocol::Loc::BulkLocationUpdate& blu, const SubscriberInfoPtr& numOutstandingMessageCount) {
+bool AlwaysLocationUpdatePolicy::trySendCompact(const UUID& dest, const String& compactMsg, uint32 msg_id, const SubscriberInfoPtr& sub_info)
+{
+    ObjectSession* session = mLocService->context()->objectSessionManager()->getSession(ObjectReference(dest));
+    if (session == NULL)
+        return false;
+    ODPSST::StreamPtr locServiceStream = session->getStream();
+    if (!locServiceStream)
+        return false;
+
+    Sirikata::Protocol::Frame msg_frame;
+    msg_frame.set_payload(compactMsg);
+    std::string* framed_loc_msg = new std::string(serializePBJMessage(msg_frame));
+    tryCreateCompactChildStream(dest, locServiceStream, framed_loc_msg, msg_id, 0, sub_info);
+    return true;
+}
+
+bool AlwaysLocationUpdatePolicy::trySend(const ServerID& dest, const String& bluMsg, const SubscriberInfoPtr& numOutstandingMessageCount) {
     Message* msg = new Message(
         mLocService->context()->id(),
         SERVER_PORT_LOCATION,
         dest,
         SERVER_PORT_LOCATION,
-        serializePBJMessage(blu)
+        bluMsg
     );
 
     // There's no retries/async step for servers since they either get on the
@@ -35,16 +35,33 @@
 
 #include <sirikata/space/LocationService.hpp>
 #include <sirikata/core/options/CommonOptions.hpp>
+#include <sirikata/core/util/CompactLocEncoding.hpp>
+#include <sirikata/core/util/Timer.hpp>
+#include <sirikata/space/WorkerPool.hpp>
+#include "DirtyUpdateList.hpp"
 
 #include "Protocol_Loc.pbj.hpp"
 
 #define ALWAYS_POLICY_OPTIONS      "always_location_update_policy"
 #define LOC_MAX_PER_RESULT         "loc.max-per-result"
+#define LOC_COMPACT_UPDATES        "loc.compact-updates"
+#define LOC_COMPACT_PRECISION      "loc.compact-precision"
+#define LOC_THREADS                "loc.threads"
 
 namespace Sirikata {
 
 void InitAlwaysLocationUpdatePolicyOptions();
 
+/** Hash function for each type of location update subscriber. */
+template<typename SubscriberType>
+struct LocSubscriberHasher {
+    typedef typename SubscriberType::Hasher Hasher;
+};
+template<>
+struct LocSubscriberHasher<ServerID> {
+    typedef std::tr1::hash<ServerID> Hasher;
+};
+
 /** A LocationUpdatePolicy which always sends a location
  *  update message to all subscribers on any position update.
  */
@@ -92,6 +109,8 @@ public:
     virtual void replicaPhysicsUpdated(const UUID& uuid, const String& newval);
     virtual void replicaQueryDataUpdated(const UUID& uuid, const String& newval);
 
+    virtual void enableCompactUpdates(const UUID& remote);
+
     virtual void service();
 
 private:
@@ -99,6 +118,11 @@ private:
 
 
     struct UpdateInfo {
+        // Fields which changed since the last update was sent, using the bits
+        // from CompactLocRecord::Field. Only compact updates take advantage of
+        // this, regular updates always include everything.
+        uint8 fields;
+
         uint64 epoch;
         TimedMotionVector3f location;
         TimedMotionQuaternion orientation;
@@ -108,22 +132,33 @@ private:
         String query_data;
     };
 
-    typedef std::set<UUID> UUIDSet;
     typedef std::set<ProxIndexID> ProxIndexSet;
-    typedef std::map<UUID, ProxIndexSet> ObjectIndexesMap;
+    typedef std::tr1::unordered_map<UUID, ProxIndexSet, UUID::Hasher> ObjectIndexesMap;
 
     struct SubscriberInfo {
         SubscriberInfo(SeqNoPtr seq_number_ptr )
-            : seqnoPtr(seq_number_ptr)
+            : seqnoPtr(seq_number_ptr),
+              compactEncoder(NULL),
+              droppedMessages(0)
         {}
+        ~SubscriberInfo() {
+            delete compactEncoder;
+        }
         SeqNoPtr seqnoPtr;
+        // Non-NULL if the subscriber asked for compact updates, which
+        // only include changed fields
+        CompactLocEncoder* compactEncoder;
+        // Number of compact update messages that we gave up on sending. Since
+        // they only contained changes, we need to resend everything to get the
+        // subscriber back in sync.
+        AtomicValue<uint32> droppedMessages;
         // Indexes this subscriber is observing each object in. This acts both
         // as a set of objects that this subscriber is observing (the keys) and
         // the list of indexes each object is being observed in.
         //
         // This needs to persist permanently between subscribe/unsubscribe calls
         // so we can specify them with each update we create. We keep them
-        // separately from outstandingUpdates so we can clear out that data as
+        // separately from dirtyUpdates so we can clear out that data as
         // we use it up but keep this around.
         //
         // TODO(ewencp) we might be able to figure out some way to keep this
@@ -134,8 +169,8 @@ private:
         // aren't real orphans because we used aggregate data.
         ObjectIndexesMap objectIndexes;
         // Information about each object that we need to create and send an
-        // update about
-        std::map<UUID, UpdateInfo> outstandingUpdates;
+        // update about, in the order they changed
+        DirtyUpdateList<UpdateInfo> dirtyUpdates;
 
         // Indicates that there are no subscriptions for this object left,
         // allowing us to clear out its entry
@@ -151,7 +186,7 @@ private:
     // and eat up a bunch of our processor just looping for
     // retries. With objects moving, we could get arbitarily many
     // outstanding updates since once the substream request is started
-    // it frees up the spot in the outstandingUpdates map above,
+    // it frees up the spot in the dirtyUpdates list above,
     // allowing more for the same object to be sent. To protect against
     // this, we track how many loc update messages are outstanding and
     // stall updates while we're waiting for them to return (or fail!).
@@ -169,14 +204,21 @@ private:
         // objects which they need to perform queries over.
         const bool send_all_data;
         AtomicValue<uint32>& sent_count;
-        typedef std::set<SubscriberType> SubscriberSet;
+        typedef typename LocSubscriberHasher<SubscriberType>::Hasher SubscriberHasher;
+        typedef std::tr1::unordered_set<SubscriberType, SubscriberHasher> SubscriberSet;
+        // Most objects only have a few subscribers, so a vector is cheaper to
+        // walk on every update than a set.
+        typedef std::vector<SubscriberType> SubscriberList;
         typedef std::tr1::shared_ptr<SubscriberInfo> SubscriberInfoPtr;
         // Forward index: Subscriber -> Objects + Updates
-        typedef std::map<SubscriberType, SubscriberInfoPtr> SubscriberMap;
+        typedef std::tr1::unordered_map<SubscriberType, SubscriberInfoPtr, SubscriberHasher> SubscriberMap;
         SubscriberMap mSubscriptions;
         // Reverse index: Objects -> Subscribers
-        typedef std::map<UUID, SubscriberSet*> ObjectSubscribersMap;
+        typedef std::tr1::unordered_map<UUID, SubscriberList, UUID::Hasher> ObjectSubscribersMap;
         ObjectSubscribersMap mObjectSubscribers;
+        // Subscribers which can decode compact updates. This is kept separately
+        // since they may ask before they have any subscriptions.
+        SubscriberSet mCompactSubscribers;
 
 
         // This is the small amount of cross-strand data that needs mutex
@@ -437,12 +479,25 @@ private:
             for(typename SubscriberMap::iterator sub_it = mSubscriptions.begin(); sub_it != mSubscriptions.end(); sub_it++)
                 sub_it->second.reset();
             mSubscriptions.clear();
-
-            for(typename ObjectSubscribersMap::iterator sub_it = mObjectSubscribers.begin(); sub_it != mObjectSubscribers.end(); sub_it++)
-                delete sub_it->second;
             mObjectSubscribers.clear();
         }
 
+        // Remove remote from the list of subscribers to uuid
+        void removeObjectSubscriber(const UUID& uuid, const SubscriberType& remote) {
+            typename ObjectSubscribersMap::iterator obj_it = mObjectSubscribers.find(uuid);
+            if (obj_it == mObjectSubscribers.end()) return;
+            SubscriberList& subs = obj_it->second;
+            for(uint32 i = 0; i < subs.size(); i++) {
+                if (subs[i] == remote) {
+                    subs[i] = subs.back();
+                    subs.pop_back();
+                    break;
+                }
+            }
+            if (subs.empty())
+                mObjectSubscribers.erase(obj_it);
+        }
+
         void subscribe(const SubscriberType& remote, const UUID& uuid, SeqNoPtr seqnoPtr) {
             subscribe(remote, uuid, (ProxIndexID*)NULL, seqnoPtr);
         }
@@ -462,6 +517,8 @@ private:
             typename SubscriberMap::iterator sub_it = mSubscriptions.find(remote);
             if (sub_it == mSubscriptions.end()) {
                 SubscriberInfoPtr sub_info(new SubscriberInfo(seqnoPtr));
+                if (mCompactSubscribers.find(remote) != mCompactSubscribers.end())
+                    sub_info->compactEncoder = new CompactLocEncoder(parent->mCompactPrecision);
                 mSubscriptions.insert(typename SubscriberMap::value_type(remote,sub_info));
 
                 sub_it = mSubscriptions.find(remote);
@@ -486,13 +543,9 @@ private:
                 sub_it->second->objectIndexes[uuid].insert(*index_id);
 
             // Add server to object's subscribers list
-            typename ObjectSubscribersMap::iterator obj_sub_it = mObjectSubscribers.find(uuid);
-            if (obj_sub_it == mObjectSubscribers.end()) {
-                mObjectSubscribers[uuid] = new SubscriberSet();
-                obj_sub_it = mObjectSubscribers.find(uuid);
-            }
-            SubscriberSet* obj_subs = obj_sub_it->second;
-            obj_subs->insert(remote);
+            SubscriberList& obj_subs = mObjectSubscribers[uuid];
+            if (std::find(obj_subs.begin(), obj_subs.end(), remote) == obj_subs.end())
+                obj_subs.push_back(remote);
 
             // Force an update. This is necessary because the subscription comes
             // in asynchronously from Proximity, so its possible the data sent
@@ -531,17 +584,15 @@ private:
             }
 
             // Remove server from object's list
-            typename ObjectSubscribersMap::iterator obj_it = mObjectSubscribers.find(uuid);
-            if (obj_it != mObjectSubscribers.end()) {
-                SubscriberSet* subs = obj_it->second;
-                subs->erase(remote);
-            }
+            removeObjectSubscriber(uuid, remote);
         }
 
         void unsubscribe(const SubscriberType& remote) {
             typename SubscriberMap::iterator sub_it = mSubscriptions.find(remote);
-            if (sub_it == mSubscriptions.end())
+            if (sub_it == mSubscriptions.end()) {
+                mCompactSubscribers.erase(remote);
                 return;
+            }
 
             SubscriberInfoPtr subs = sub_it->second;
             // We just need to clear out this subscriber's objectIndexes
@@ -550,18 +601,12 @@ private:
             // because they require the correct type of call -- with or without
             // indices. Instead just do the second half of what they would do
             // manually -- remove references to the objects subscribed to from
-            // mObjectSubscribers' SubscriberSets
-            for(typename ObjectIndexesMap::iterator obj_ind_it = subs->objectIndexes.begin(); obj_ind_it != subs->objectIndexes.end(); obj_ind_it++) {
-                UUID uuid = obj_ind_it->first;
-                // Remove server from object's list
-                typename ObjectSubscribersMap::iterator obj_it = mObjectSubscribers.find(uuid);
-                if (obj_it != mObjectSubscribers.end()) {
-                    SubscriberSet* subs = obj_it->second;
-                    subs->erase(remote);
-                }
-            }
+            // mObjectSubscribers' SubscriberLists
+            for(typename ObjectIndexesMap::iterator obj_ind_it = subs->objectIndexes.begin(); obj_ind_it != subs->objectIndexes.end(); obj_ind_it++)
+                removeObjectSubscriber(obj_ind_it->first, remote);
             // And then actually clear out the list of subscriptions
             subs->objectIndexes.clear();
+            mCompactSubscribers.erase(remote);
 
             // Just drop any outstanding updates we have left. They
             // are useless if we're using tree replication since we
@@ -572,34 +617,66 @@ private:
             mSubscriptions.erase(sub_it);
         }
 
+        // Switch a subscriber to compact updates. Must be called from the main
+        // strand.
+        void enableCompact(const SubscriberType& remote) {
+            if (!parent->validSubscriber(remote)) return;
+            mCompactSubscribers.insert(remote);
+
+            typename SubscriberMap::iterator sub_it = mSubscriptions.find(remote);
+            if (sub_it == mSubscriptions.end() || sub_it->second->compactEncoder != NULL)
+                return;
+            sub_it->second->compactEncoder = new CompactLocEncoder(parent->mCompactPrecision);
+            // Updates may already be queued with only some fields marked, so
+            // make sure the first compact update is complete
+            forceFullUpdates(remote, sub_it->second);
+        }
+
+        // Queue updates with every field for all objects remote is subscribed
+        // to
+        void forceFullUpdates(const SubscriberType& remote, const SubscriberInfoPtr& sub_info) {
+            for(typename ObjectIndexesMap::iterator obj_ind_it = sub_info->objectIndexes.begin(); obj_ind_it != sub_info->objectIndexes.end(); obj_ind_it++) {
+                if (!parent->mLocService->contains(obj_ind_it->first)) continue;
+                propertyUpdatedForSubscriber(obj_ind_it->first, parent->mLocService, remote, NULL);
+            }
+        }
+
+        uint8 allFields() const {
+            uint8 all =
+                CompactLocRecord::LocationField | CompactLocRecord::OrientationField |
+                CompactLocRecord::BoundsField | CompactLocRecord::MeshField |
+                CompactLocRecord::PhysicsField;
+            if (send_all_data)
+                all |= CompactLocRecord::QueryDataField;
+            return all;
+        }
+
         typedef std::tr1::function<void(UpdateInfo&)> UpdateFunctor;
         // Generic version of an update - adds updates per-subscriber as
         // necessary and calls the UpdateFunctor to trigger the particular
         // update to values.
-        void propertyUpdated(const UUID& uuid, LocationService* locservice, UpdateFunctor fup) {
+        void propertyUpdated(const UUID& uuid, LocationService* locservice, const UpdateFunctor& fup) {
             // Add the update to each subscribed object
             typename ObjectSubscribersMap::iterator obj_sub_it = mObjectSubscribers.find(uuid);
             if (obj_sub_it == mObjectSubscribers.end()) return;
 
-            SubscriberSet* object_subscribers = obj_sub_it->second;
-
-            for(typename SubscriberSet::iterator subscriber_it = object_subscribers->begin(); subscriber_it != object_subscribers->end(); subscriber_it++) {
-                propertyUpdatedForSubscriber(uuid, locservice, *subscriber_it, fup);
-            }
+            const SubscriberList& object_subscribers = obj_sub_it->second;
+            for(uint32 i = 0; i < object_subscribers.size(); i++)
+                propertyUpdatedForSubscriber(uuid, locservice, object_subscribers[i], fup);
         }
 
         // Update of location information for individual subscriber. Note that
         // this should only be used in special cases -- mainly to handle when a
         // new subscriber is added.  Otherwise its just a utility for the normal
         // update method above.
-        void propertyUpdatedForSubscriber(const UUID& uuid, LocationService* locservice, SubscriberType sub, UpdateFunctor fup) {
-            if (mSubscriptions.find(sub) == mSubscriptions.end()) return; // XXX FIXME
-            assert(mSubscriptions.find(sub) != mSubscriptions.end());
-            std::tr1::shared_ptr<SubscriberInfo> sub_info = mSubscriptions[sub];
+        void propertyUpdatedForSubscriber(const UUID& uuid, LocationService* locservice, const SubscriberType& sub, const UpdateFunctor& fup) {
+            typename SubscriberMap::iterator sub_it = mSubscriptions.find(sub);
+            if (sub_it == mSubscriptions.end()) return; // XXX FIXME
+            SubscriberInfo* sub_info = sub_it->second.get();
             if (sub_info->objectIndexes.find(uuid) == sub_info->objectIndexes.end()) return; // XXX FIXME
-            assert(sub_info->objectIndexes.find(uuid) != sub_info->objectIndexes.end());
 
-            if (sub_info->outstandingUpdates.find(uuid) == sub_info->outstandingUpdates.end()) {
+            UpdateInfo* ui = sub_info->dirtyUpdates.find(uuid);
+            if (ui == NULL) {
                 UpdateInfo new_ui;
                 new_ui.epoch = locservice->epoch(uuid);
                 new_ui.location = locservice->location(uuid);
@@ -610,23 +687,24 @@ private:
                 // Don't bother copying possibly big data if not necessary
                 if (send_all_data)
                     new_ui.query_data = locservice->queryData(uuid);
-                sub_info->outstandingUpdates[uuid] = new_ui;
+                // The functor marks the field it changes
+                new_ui.fields = fup ? 0 : allFields();
+                ui = &(sub_info->dirtyUpdates.add(uuid, new_ui));
+            }
+            else if (!fup) {
+                ui->fields = allFields();
             }
-            else
-                UpdateInfo& ui = sub_info->outstandingUpdates[uuid];
-
 
-            UpdateInfo& ui = sub_info->outstandingUpdates[uuid];
             if (fup)
-                fup(ui);
+                fup(*ui);
         }
 
-        static void setUILocation(UpdateInfo& ui, const TimedMotionVector3f& newval) {ui.location = newval; }
-        static void setUIOrientation(UpdateInfo& ui, const TimedMotionQuaternion& newval) { ui.orientation = newval; }
-        static void setUIBounds(UpdateInfo& ui, const AggregateBoundingInfo& newval) { ui.bounds = newval; }
-        static void setUIMesh(UpdateInfo& ui, const String& newval) {ui.mesh = newval;}
-        static void setUIPhysics(UpdateInfo& ui, const String& newval) {ui.physics = newval;}
-        static void setUIQueryData(UpdateInfo& ui, const String& newval) {ui.query_data = newval;}
+        static void setUILocation(UpdateInfo& ui, const TimedMotionVector3f& newval) {ui.location = newval; ui.fields |= CompactLocRecord::LocationField; }
+        static void setUIOrientation(UpdateInfo& ui, const TimedMotionQuaternion& newval) { ui.orientation = newval; ui.fields |= CompactLocRecord::OrientationField; }
+        static void setUIBounds(UpdateInfo& ui, const AggregateBoundingInfo& newval) { ui.bounds = newval; ui.fields |= CompactLocRecord::BoundsField; }
+        static void setUIMesh(UpdateInfo& ui, const String& newval) {ui.mesh = newval; ui.fields |= CompactLocRecord::MeshField; }
+        static void setUIPhysics(UpdateInfo& ui, const String& newval) {ui.physics = newval; ui.fields |= CompactLocRecord::PhysicsField; }
+        static void setUIQueryData(UpdateInfo& ui, const String& newval) {ui.query_data = newval; ui.fields |= CompactLocRecord::QueryDataField; }
 
         void locationUpdated(const UUID& uuid, const TimedMotionVector3f& newval, LocationService* locservice) {
             propertyUpdated(
@@ -674,113 +752,296 @@ private:
         }
 
 
+        // A message built for a subscriber during service(), waiting to be
+        // sent
+        struct BuiltMessage {
+            String data;
+            // ID from the compactEncoder, only used for compact messages
+            uint32 compactID;
+            // Number of updates from the front of dirtyUpdates which have
+            // been shipped once this message is sent
+            uint32 shipped;
+        };
+        // A subscriber with updates to send in the current service() pass.
+        // Messages are built for each of these in parallel, then sent from
+        // the main strand.
+        struct ServiceEntry {
+            // Iterators are stable since subscriptions only change on the main
+            // strand. We avoid holding another reference to the SubscriberInfo
+            // since that would count as an outstanding message.
+            typename SubscriberMap::iterator sub_it;
+            // Outstanding messages when the pass started. This can only drop
+            // while messages are being built, so the limits are conservative.
+            long outstanding;
+            std::vector<BuiltMessage> messages;
+        };
+        std::vector<ServiceEntry> mServiceEntries;
+
+        // Limits on the number of outstanding messages per subscriber, see
+        // numOutstandingMessages. Full messages are only built up to the soft
+        // limit, but a final partial one can go up to the hard limit.
+        enum {
+            OutstandingMessageHardLimit = 64,
+            OutstandingMessageSoftLimit = 25
+        };
+
         void service() {
             uint32 max_updates = GetOptionValue<uint32>(ALWAYS_POLICY_OPTIONS, LOC_MAX_PER_RESULT);
-            const uint32 outstanding_message_hard_limit = 64;
-            const uint32 outstanding_message_soft_limit = 25;
 
             std::list<SubscriberType> to_delete;
 
+            // Collect subscribers that have updates to send. Anything that
+            // needs to touch sessions happens here, on the main strand.
+            mServiceEntries.clear();
             for(typename SubscriberMap::iterator server_it = mSubscriptions.begin(); server_it != mSubscriptions.end(); server_it++) {
-                SubscriberType sid = server_it->first;
-                std::tr1::shared_ptr<SubscriberInfo> sub_info = server_it->second;
+                const SubscriberType& sid = server_it->first;
+                SubscriberInfo* sub_info = server_it->second.get();
 
                 // We can end up with leftover updates after a subscriber has
                 // already disconnected. We need to ignore them if we're not
                 // even going to be able to send the messages.
                 if (!parent->validSubscriber(sid)) {
-                    sub_info->outstandingUpdates.clear();
-                    if (sub_info->noSubscriptionsLeft()) {
-                        sub_info.reset();
+                    sub_info->dirtyUpdates.clear();
+                    mCompactSubscribers.erase(sid);
+                    if (sub_info->noSubscriptionsLeft())
                         to_delete.push_back(sid);
-                    }
                     continue;
                 }
 
-                Sirikata::Protocol::Loc::BulkLocationUpdate bulk_update;
-
-                bool send_failed = false;
-                std::map<UUID, UpdateInfo>::iterator last_shipped = sub_info->outstandingUpdates.begin();
-                for(std::map<UUID, UpdateInfo>::iterator up_it = sub_info->outstandingUpdates.begin();
-                    numOutstandingMessages(sub_info) < outstanding_message_soft_limit && up_it != sub_info->outstandingUpdates.end();
-                    up_it++)
-                {
-                    Sirikata::Protocol::Loc::ILocationUpdate update = bulk_update.add_update();
-                    update.set_object(up_it->first);
-
-                    //write and update sequence number
-                    update.set_seqno( (*(sub_info->seqnoPtr)) ++ );
+                // If compact updates were lost, the subscriber missed some
+                // changes. Resend everything and stop assuming it knows any
+                // strings.
+                uint32 dropped = sub_info->droppedMessages.read();
+                if (sub_info->compactEncoder != NULL && dropped > 0) {
+                    sub_info->droppedMessages -= dropped;
+                    sub_info->compactEncoder->reset();
+                    forceFullUpdates(sid, server_it->second);
+                }
 
-                    if (parent->isSelfSubscriber(sid, up_it->first))
-                        update.set_epoch(up_it->second.epoch);
+                if (sub_info->dirtyUpdates.empty()) {
+                    if (sub_info->noSubscriptionsLeft())
+                        to_delete.push_back(sid);
+                    continue;
+                }
 
-                    // If we're tracking indexes (tree replication), add the
-                    // list in
-                    typename ObjectIndexesMap::iterator obj_ind_it = sub_info->objectIndexes.find(up_it->first);
-                    if (obj_ind_it != sub_info->objectIndexes.end()) {
-                        for (typename ProxIndexSet::iterator prox_idx_it = obj_ind_it->second.begin(); prox_idx_it != obj_ind_it->second.end(); prox_idx_it++)
-                            update.add_index_id((uint32)*prox_idx_it);
-                    }
+                mServiceEntries.push_back(ServiceEntry());
+                mServiceEntries.back().sub_it = server_it;
+                mServiceEntries.back().outstanding = numOutstandingMessages(server_it->second);
+            }
 
-                    Sirikata::Protocol::ITimedMotionVector location = update.mutable_location();
-                    location.set_t(up_it->second.location.updateTime());
-                    location.set_position(up_it->second.location.position());
-
-                    location.set_velocity(up_it->second.location.velocity());
-
-                    Sirikata::Protocol::ITimedMotionQuaternion orientation = update.mutable_orientation();
-                    orientation.set_t(up_it->second.orientation.updateTime());
-                    orientation.set_position(up_it->second.orientation.position());
-                    orientation.set_velocity(up_it->second.orientation.velocity());
-
-                    Sirikata::Protocol::IAggregateBoundingInfo msg_bounds = update.mutable_aggregate_bounds();
-                    msg_bounds.set_center_offset(up_it->second.bounds.centerOffset);
-                    msg_bounds.set_center_bounds_radius(up_it->second.bounds.centerBoundsRadius);
-                    msg_bounds.set_max_object_size(up_it->second.bounds.maxObjectRadius);
-
-                    update.set_mesh(up_it->second.mesh);
-                    update.set_physics(up_it->second.physics);
-                    // Don't bother copying possibly big data if not necessary
-                    if (send_all_data)
-                        update.set_query_data(up_it->second.query_data);
-
-                    // If we hit the limit for this update, try to send it out
-                    if (bulk_update.update_size() > (int32)max_updates) {
-                        bool sent = parent->trySend(sid, bulk_update, sub_info);
-                        if (!sent) {
-                            send_failed = true;
-                            break;
-                        }
-                        else {
-                            bulk_update = Sirikata::Protocol::Loc::BulkLocationUpdate(); // clear it out
-                            last_shipped = up_it;
-                            sent_count++;
-                        }
-                    }
+            // Build messages. Each entry is only touched by one worker, so
+            // workers fill in their own entries' buffers without locking.
+            Time build_start = Timer::now();
+            WorkerPool* pool = parent->mWorkerPool;
+            if (pool->size() > 1 && mServiceEntries.size() > 1)
+                pool->run(std::tr1::bind(&SubscriberIndex::buildMessages, this, _1, pool->size(), max_updates));
+            else
+                buildMessages(0, 1, max_updates);
+            Time send_start = Timer::now();
+            parent->mServiceBuildTime += send_start - build_start;
+
+            // Send the messages in order, stopping at the first one we can't
+            // send, and clear out the updates that were shipped.
+            for(uint32 entry_idx = 0; entry_idx < mServiceEntries.size(); entry_idx++) {
+                ServiceEntry& entry = mServiceEntries[entry_idx];
+                const SubscriberType& sid = entry.sub_it->first;
+                const SubscriberInfoPtr& sub_info = entry.sub_it->second;
+                CompactLocEncoder* compact = sub_info->compactEncoder;
+
+                uint32 shipped = 0;
+                uint32 msg_idx = 0;
+                for(; msg_idx < entry.messages.size(); msg_idx++) {
+                    const BuiltMessage& msg = entry.messages[msg_idx];
+                    if (numOutstandingMessages(sub_info) >= OutstandingMessageHardLimit)
+                        break;
+                    bool sent = (compact != NULL) ?
+                        parent->trySendCompact(sid, msg.data, msg.compactID, sub_info) :
+                        parent->trySend(sid, msg.data, sub_info);
+                    if (!sent) break;
+                    shipped = msg.shipped;
+                    sent_count++;
                 }
-
-                // Try to send the last few if necessary/possible
-                if (numOutstandingMessages(sub_info) < outstanding_message_hard_limit && !send_failed && bulk_update.update_size() > 0) {
-                    bool sent = parent->trySend(sid, bulk_update, sub_info);
-                    if (sent) {
-                        last_shipped = sub_info->outstandingUpdates.end();
-                        sent_count++;
-                    }
+                // The updates in unsent messages remain outstanding and get
+                // added again next time
+                if (compact != NULL) {
+                    for(; msg_idx < entry.messages.size(); msg_idx++)
+                        compact->dropped(entry.messages[msg_idx].compactID);
                 }
 
                 // Finally clear out any entries successfully sent out
-                sub_info->outstandingUpdates.erase( sub_info->outstandingUpdates.begin(), last_shipped);
+                sub_info->dirtyUpdates.eraseFront(shipped);
+                parent->mServiceUpdates += shipped;
 
-                if (sub_info->noSubscriptionsLeft() && sub_info->outstandingUpdates.empty()) {
-                    sub_info.reset();
+                if (sub_info->noSubscriptionsLeft() && sub_info->dirtyUpdates.empty())
                     to_delete.push_back(sid);
-                }
             }
+            mServiceEntries.clear();
+            parent->mServiceSendTime += Timer::now() - send_start;
 
             for(typename std::list<SubscriberType>::iterator it = to_delete.begin(); it != to_delete.end(); it++)
                 mSubscriptions.erase(*it);
         }
 
+        // Build messages for every nworkers'th entry in mServiceEntries,
+        // starting with worker. This may run on any thread, so it only touches
+        // the subscriber's own state.
+        void buildMessages(uint32 worker, uint32 nworkers, uint32 max_updates) {
+            for(uint32 entry_idx = worker; entry_idx < mServiceEntries.size(); entry_idx += nworkers) {
+                ServiceEntry& entry = mServiceEntries[entry_idx];
+                if (entry.sub_it->second->compactEncoder != NULL)
+                    buildCompactMessages(entry, max_updates);
+                else
+                    buildBulkMessages(entry, max_updates);
+            }
+        }
+
+        // Whether another message can be built, counting the ones already
+        // built for the entry as outstanding
+        bool canBuildMessage(const ServiceEntry& entry, bool partial) {
+            long outstanding = entry.outstanding;
+            if (parent->sendHoldsSubscriber(entry.sub_it->first))
+                outstanding += entry.messages.size();
+            return outstanding < (partial ? OutstandingMessageHardLimit : OutstandingMessageSoftLimit);
+        }
+
+        void buildBulkMessages(ServiceEntry& entry, uint32 max_updates) {
+            const SubscriberType& sid = entry.sub_it->first;
+            SubscriberInfo* sub_info = entry.sub_it->second.get();
+            const DirtyUpdateList<UpdateInfo>& dirty = sub_info->dirtyUpdates;
+
+            Sirikata::Protocol::Loc::BulkLocationUpdate bulk_update;
+            uint32 up_idx = 0;
+            for(; canBuildMessage(entry, false) && up_idx < dirty.size(); up_idx++) {
+                const UUID& uuid = dirty.id(up_idx);
+                const UpdateInfo& ui = dirty.update(up_idx);
+
+                Sirikata::Protocol::Loc::ILocationUpdate update = bulk_update.add_update();
+                update.set_object(uuid);
+
+                //write and update sequence number
+                update.set_seqno( (*(sub_info->seqnoPtr)) ++ );
+
+                if (parent->isSelfSubscriber(sid, uuid))
+                    update.set_epoch(ui.epoch);
+
+                // If we're tracking indexes (tree replication), add the
+                // list in
+                typename ObjectIndexesMap::iterator obj_ind_it = sub_info->objectIndexes.find(uuid);
+                if (obj_ind_it != sub_info->objectIndexes.end()) {
+                    for (typename ProxIndexSet::iterator prox_idx_it = obj_ind_it->second.begin(); prox_idx_it != obj_ind_it->second.end(); prox_idx_it++)
+                        update.add_index_id((uint32)*prox_idx_it);
+                }
+
+                Sirikata::Protocol::ITimedMotionVector location = update.mutable_location();
+                location.set_t(ui.location.updateTime());
+                location.set_position(ui.location.position());
+
+                location.set_velocity(ui.location.velocity());
+
+                Sirikata::Protocol::ITimedMotionQuaternion orientation = update.mutable_orientation();
+                orientation.set_t(ui.orientation.updateTime());
+                orientation.set_position(ui.orientation.position());
+                orientation.set_velocity(ui.orientation.velocity());
+
+                Sirikata::Protocol::IAggregateBoundingInfo msg_bounds = update.mutable_aggregate_bounds();
+                msg_bounds.set_center_offset(ui.bounds.centerOffset);
+                msg_bounds.set_center_bounds_radius(ui.bounds.centerBoundsRadius);
+                msg_bounds.set_max_object_size(ui.bounds.maxObjectRadius);
+
+                update.set_mesh(ui.mesh);
+                update.set_physics(ui.physics);
+                // Don't bother copying possibly big data if not necessary
+                if (send_all_data)
+                    update.set_query_data(ui.query_data);
+
+                // If we hit the limit for this update, finish the message
+                if (bulk_update.update_size() > (int32)max_updates) {
+                    String data = serializePBJMessage(bulk_update);
+                    addBuiltMessage(entry, &data, 0, up_idx+1);
+                    bulk_update = Sirikata::Protocol::Loc::BulkLocationUpdate(); // clear it out
+                }
+            }
+
+            // And the last few if necessary/possible
+            if (bulk_update.update_size() > 0 && canBuildMessage(entry, true)) {
+                String data = serializePBJMessage(bulk_update);
+                addBuiltMessage(entry, &data, 0, up_idx);
+            }
+        }
+
+        void buildCompactMessages(ServiceEntry& entry, uint32 max_updates) {
+            const SubscriberType& sid = entry.sub_it->first;
+            const SubscriberInfoPtr& sub_info = entry.sub_it->second;
+            CompactLocEncoder* compact = sub_info->compactEncoder;
+            const DirtyUpdateList<UpdateInfo>& dirty = sub_info->dirtyUpdates;
+
+            String data;
+            uint32 up_idx = 0;
+            for(; canBuildMessage(entry, false) && up_idx < dirty.size(); up_idx++) {
+                compact->add(compactRecord(sid, sub_info, dirty.id(up_idx), dirty.update(up_idx)));
+                if (compact->size() > max_updates) {
+                    uint32 msg_id = compact->finish(&data);
+                    addBuiltMessage(entry, &data, msg_id, up_idx+1);
+                }
+            }
+
+            if (!compact->empty()) {
+                if (canBuildMessage(entry, true)) {
+                    uint32 msg_id = compact->finish(&data);
+                    addBuiltMessage(entry, &data, msg_id, up_idx);
+                }
+                else {
+                    // The updates remain outstanding and get added again
+                    // next time
+                    compact->clear();
+                }
+            }
+        }
+
+        // Takes the contents of data
+        void addBuiltMessage(ServiceEntry& entry, String* data, uint32 compact_id, uint32 shipped) {
+            entry.messages.push_back(BuiltMessage());
+            BuiltMessage& msg = entry.messages.back();
+            msg.data.swap(*data);
+            msg.compactID = compact_id;
+            msg.shipped = shipped;
+        }
+
+        // Build a compact record with only the changed fields of an outstanding
+        // update
+        CompactLocRecord compactRecord(const SubscriberType& sid, const SubscriberInfoPtr& sub_info, const UUID& uuid, const UpdateInfo& ui) {
+            CompactLocRecord rec;
+            rec.object = uuid;
+            rec.seqno = (*(sub_info->seqnoPtr)) ++;
+            rec.fields = ui.fields;
+
+            if (parent->isSelfSubscriber(sid, uuid)) {
+                rec.fields |= CompactLocRecord::EpochField;
+                rec.epoch = ui.epoch;
+            }
+
+            typename ObjectIndexesMap::iterator obj_ind_it = sub_info->objectIndexes.find(uuid);
+            if (obj_ind_it != sub_info->objectIndexes.end() && !obj_ind_it->second.empty()) {
+                rec.fields |= CompactLocRecord::IndexIDsField;
+                for (typename ProxIndexSet::iterator prox_idx_it = obj_ind_it->second.begin(); prox_idx_it != obj_ind_it->second.end(); prox_idx_it++)
+                    rec.index_ids.push_back((uint32)*prox_idx_it);
+            }
+
+            if (rec.has(CompactLocRecord::LocationField))
+                rec.location = ui.location;
+            if (rec.has(CompactLocRecord::OrientationField))
+                rec.orientation = ui.orientation;
+            if (rec.has(CompactLocRecord::BoundsField))
+                rec.bounds = ui.bounds;
+            if (rec.has(CompactLocRecord::MeshField))
+                rec.mesh = ui.mesh;
+            if (rec.has(CompactLocRecord::PhysicsField))
+                rec.physics = ui.physics;
+            if (rec.has(CompactLocRecord::QueryDataField))
+                rec.query_data = ui.query_data;
+            return rec;
+        }
+
     };
 
     void tryCreateChildStream(const UUID& dest, ODPSST::StreamPtr parent_stream, std::string* msg, int count, const SubscriberInfoPtr&numOutstandingMessageCount);
@@ -796,9 +1057,25 @@ private:
     bool isSelfSubscriber(const OHDP::NodeID& sid, const UUID& observed);
     bool isSelfSubscriber(const ServerID& sid, const UUID& observed);
 
-    bool trySend(const UUID& dest, const Sirikata::Protocol::Loc::BulkLocationUpdate& blu, const SubscriberInfoPtr& numOutstandingMessageCount);
-    bool trySend(const OHDP::NodeID& dest, const Sirikata::Protocol::Loc::BulkLocationUpdate& blu, const SubscriberInfoPtr& numOutstandingMessageCount);
-    bool trySend(const ServerID& dest, const Sirikata::Protocol::Loc::BulkLocationUpdate& blu, const SubscriberInfoPtr& numOutstandingMessageCount);
+    // Send a serialized BulkLocationUpdate
+    bool trySend(const UUID& dest, const String& blu_msg, const SubscriberInfoPtr& numOutstandingMessageCount);
+    bool trySend(const OHDP::NodeID& dest, const String& blu_msg, const SubscriberInfoPtr& numOutstandingMessageCount);
+    bool trySend(const ServerID& dest, const String& blu_msg, const SubscriberInfoPtr& numOutstandingMessageCount);
+
+    // Send a message built by the subscriber's compactEncoder. Only objects
+    // can request compact updates.
+    bool trySendCompact(const UUID& dest, const String& compact_msg, uint32 msg_id, const SubscriberInfoPtr& sub_info);
+    bool trySendCompact(const OHDP::NodeID& dest, const String& compact_msg, uint32 msg_id, const SubscriberInfoPtr& sub_info) { return false; }
+    bool trySendCompact(const ServerID& dest, const String& compact_msg, uint32 msg_id, const SubscriberInfoPtr& sub_info) { return false; }
+
+    // Whether sent messages hold on to the SubscriberInfoPtr until they're
+    // delivered, i.e. whether they count towards numOutstandingMessages
+    bool sendHoldsSubscriber(const UUID& dest) { return true; }
+    bool sendHoldsSubscriber(const OHDP::NodeID& dest) { return true; }
+    bool sendHoldsSubscriber(const ServerID& dest) { return false; }
+    void tryCreateCompactChildStream(const UUID& dest, ODPSST::StreamPtr parent_stream, std::string* msg, uint32 msg_id, int count, const SubscriberInfoPtr& sub_info);
+    void objectCompactLocSubstreamCallback(int x, ODPSST::StreamPtr substream, const UUID& dest, ODPSST::StreamPtr parent_stream, std::string* msg, uint32 msg_id, int count, const SubscriberInfoPtr& sub_info);
+    static void compactMessageDelivered(const SubscriberInfoPtr& sub_info, uint32 msg_id);
 
 
 
@@ -816,6 +1093,21 @@ private:
     const String mTimeSeriesObjectUpdatesName;
     AtomicValue<uint32> mObjectUpdatesPerSecond;
 
+    // Time spent building and sending messages in service(), and the number
+    // of updates sent, since the last stats report
+    uint32 mServicePasses;
+    Duration mServiceBuildTime;
+    Duration mServiceSendTime;
+    uint64 mServiceUpdates;
+    const String mTimeSeriesServiceBuildName;
+    const String mTimeSeriesServiceUpdatesName;
+
+    bool mCompactUpdates;
+    float32 mCompactPrecision;
+
+    // Builds update messages for subscribers in parallel
+    WorkerPool* mWorkerPool;
+
     typedef SubscriberIndex<ServerID> ServerSubscriberIndex;
     ServerSubscriberIndex mServerSubscriptions;
 
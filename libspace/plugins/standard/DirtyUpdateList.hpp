@@ -0,0 +1,90 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_SPACE_DIRTY_UPDATE_LIST_HPP_
+#define _SIRIKATA_SPACE_DIRTY_UPDATE_LIST_HPP_
+
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/util/UUID.hpp>
+
+namespace Sirikata {
+
+/** A list of objects with pending updates, in the order they were first
+ *  changed, along with the data for each update. Each object appears at most
+ *  once, so repeated changes before the update is sent are merged into the
+ *  same entry. Updates are sent from the front of the list.
+ */
+template<typename UpdateType>
+class DirtyUpdateList {
+public:
+    DirtyUpdateList()
+     : mHead(0),
+       mBase(0)
+    {}
+
+    bool empty() const { return size() == 0; }
+    uint32 size() const { return mEntries.size() - mHead; }
+
+    const UUID& id(uint32 idx) const { return mEntries[mHead + idx].first; }
+    UpdateType& update(uint32 idx) { return mEntries[mHead + idx].second; }
+    const UpdateType& update(uint32 idx) const { return mEntries[mHead + idx].second; }
+
+    /** Get the pending update for an object, or NULL if it has none. */
+    UpdateType* find(const UUID& id) {
+        typename IndexMap::iterator it = mIndex.find(id);
+        if (it == mIndex.end()) return NULL;
+        return &(mEntries[it->second - mBase].second);
+    }
+
+    /** Add an update for an object which doesn't have one yet. */
+    UpdateType& add(const UUID& id, const UpdateType& up) {
+        assert(mIndex.find(id) == mIndex.end());
+        mIndex[id] = mBase + mEntries.size();
+        mEntries.push_back(Entry(id, up));
+        return mEntries.back().second;
+    }
+
+    /** Remove the first count updates, e.g. after they've been sent. */
+    void eraseFront(uint32 count) {
+        if (count == 0) return;
+        if (count >= size()) {
+            clear();
+            return;
+        }
+        for(uint32 i = 0; i < count; i++)
+            mIndex.erase(mEntries[mHead + i].first);
+        mHead += count;
+        // Erased entries are only reclaimed once they make up half the list,
+        // so the cost of moving the remaining ones is amortized over the
+        // erases. The index holds positions relative to mBase, so it doesn't
+        // need to change.
+        if (mHead > mEntries.size() / 2) {
+            mEntries.erase(mEntries.begin(), mEntries.begin() + mHead);
+            mBase += mHead;
+            mHead = 0;
+        }
+    }
+
+    void clear() {
+        mEntries.clear();
+        mIndex.clear();
+        mHead = 0;
+        mBase = 0;
+    }
+
+private:
+    typedef std::pair<UUID, UpdateType> Entry;
+    std::vector<Entry> mEntries;
+    // Entries before mHead have been erased but not reclaimed yet
+    uint32 mHead;
+    // Position of mEntries[0] counting every entry ever added, which is what
+    // the index stores
+    uint64 mBase;
+    typedef std::tr1::unordered_map<UUID, uint64, UUID::Hasher> IndexMap;
+    IndexMap mIndex;
+}; // class DirtyUpdateList
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_SPACE_DIRTY_UPDATE_LIST_HPP_
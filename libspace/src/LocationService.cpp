@@ -6,6 +6,7 @@
 #include <sirikata/core/command/Commander.hpp>
 #include <sirikata/core/network/IOStrandImpl.hpp>
 #include <sirikata/core/odp/SST.hpp>
+#include <sirikata/core/util/CompactLocEncoding.hpp>
 
 AUTO_SINGLETON_INSTANCE(Sirikata::LocationUpdatePolicyFactory);
 AUTO_SINGLETON_INSTANCE(Sirikata::LocationServiceFactory);
@@ -113,6 +114,34 @@ void LocationService::newSession(ObjectSession* session) {
         )
     );
 
+    // Objects that can decode compact location updates open a substream to
+    // ask for them
+    strm->listenSubstream(OBJECT_PORT_LOCATION_COMPACT,
+        std::tr1::bind(
+            &LocationService::handleCompactUpdatesSubstream, this,
+            sourceObject.object().getAsUUID(),
+            std::tr1::placeholders::_1,std::tr1::placeholders::_2
+        )
+    );
+}
+
+void LocationService::handleCompactUpdatesSubstream(const UUID& source, int err, SSTStreamPtr s) {
+    s->registerReadCallback(
+        std::tr1::bind(
+            &LocationService::handleCompactUpdatesSubstreamRead, this,
+            source, s,
+            std::tr1::placeholders::_1,std::tr1::placeholders::_2
+        )
+    );
+}
+
+void LocationService::handleCompactUpdatesSubstreamRead(const UUID& source, SSTStreamPtr s, uint8* buffer, int length) {
+    // The request is just the version of the encoding the object supports
+    if (length >= 1 && buffer[0] == CompactLocEncoder::Version)
+        mUpdatePolicy->enableCompactUpdates(source);
+
+    s->registerReadCallback(0);
+    s->close(false);
 }
 
 void LocationService::handleLocationUpdateSubstream(const UUID& source, int err, SSTStreamPtr s) {
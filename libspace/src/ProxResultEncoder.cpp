@@ -0,0 +1,273 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "ProxResultEncoder.hpp"
+#include <sirikata/core/network/Message.hpp>
+
+#define PROXLOG(level,msg) SILOG(prox,level,msg)
+
+namespace Sirikata {
+
+ProxResultEncoder::ProxResultEncoder()
+{
+    mValid = calibrate();
+    if (!mValid)
+        PROXLOG(warn, "Couldn't determine proximity result encoding, falling back to encoding results with PBJ");
+}
+
+ObjectAdditionFragmentPtr ProxResultEncoder::encodeAdditionFragment(
+    const UUID& objid, bool aggregate,
+    const TimedMotionVector3f& loc, const TimedMotionQuaternion& orient,
+    const AggregateBoundingInfo& bnds, const String& mesh, const String& physics)
+{
+    Sirikata::Protocol::Prox::ObjectAddition addition;
+    fillAddition(addition, objid, 0, aggregate, loc, orient, bnds, mesh, physics);
+
+    ObjectAdditionFragment* frag = new ObjectAdditionFragment();
+    frag->data = serializePBJMessage(addition);
+    frag->seqnoOffset = additionSeqnoOffset();
+    assert(frag->seqnoOffset < frag->data.size());
+
+    return ObjectAdditionFragmentPtr(frag);
+}
+
+uint32 ProxResultEncoder::additionSeqnoOffset() {
+    // The only field encoded ahead of the seqno is the object's UUID, which
+    // is always the same size, so the seqno is at the same offset in every
+    // fragment. Find it once from a sample: seqnos 0 and 1 both encode to a
+    // single byte, so the encodings differ only at the seqno. calibrate()
+    // checks that the offset holds for fragments with different contents.
+    static uint32 offset = 0;
+    static bool found = false;
+    if (!found) {
+        Sirikata::Protocol::Prox::ObjectAddition addition;
+        fillAddition(addition, UUID::null(), 0, false,
+            TimedMotionVector3f(), TimedMotionQuaternion(), AggregateBoundingInfo(), "", "");
+        String without_seqno = serializePBJMessage(addition);
+        addition.set_seqno(1);
+        String with_seqno = serializePBJMessage(addition);
+        uint32 diff = 0;
+        while(diff < without_seqno.size() && diff < with_seqno.size() && without_seqno[diff] == with_seqno[diff])
+            diff++;
+        offset = diff;
+        found = true;
+    }
+    return offset;
+}
+
+bool ProxResultEncoder::calibrate() {
+    // Sample events, encoded both with PBJ and by this encoder
+    UUID objid(UUID::random()), old_parent(UUID::random()), new_parent(UUID::random());
+    TimedMotionVector3f loc(Time::null(), MotionVector3f(Vector3f(1.f, 2.f, 3.f), Vector3f(0.f, 1.f, 0.f)));
+    TimedMotionQuaternion orient(Time::null(), MotionQuaternion(Quaternion::identity(), Quaternion::identity()));
+    AggregateBoundingInfo bnds(Vector3f::zero(), 0.f, 1.f);
+    String mesh("meerkat:///test/sample.dae");
+
+    // Seqnos must be varints to be spliced into fragments, at the same offset
+    // no matter what else the fragment contains
+    ObjectAdditionFragmentPtr frag = encodeAdditionFragment(objid, false, loc, orient, bnds, mesh, "");
+    Sirikata::Protocol::Prox::ObjectAddition addition;
+    fillAddition(addition, objid, 128, false, loc, orient, bnds, mesh, "");
+    String spliced =
+        frag->data.substr(0, frag->seqnoOffset) + String("\x80\x01", 2) + frag->data.substr(frag->seqnoOffset + 1);
+    if (serializePBJMessage(addition) != spliced) return false;
+
+    String other_mesh("meerkat:///test/a/longer/path/to/another/sample.dae");
+    AggregateBoundingInfo other_bnds(Vector3f(1.f, 1.f, 1.f), 2.f, 3.f);
+    ObjectAdditionFragmentPtr other_frag = encodeAdditionFragment(new_parent, true, loc, orient, other_bnds, other_mesh, "physics");
+    Sirikata::Protocol::Prox::ObjectAddition other_addition;
+    fillAddition(other_addition, new_parent, 128, true, loc, orient, other_bnds, other_mesh, "physics");
+    String other_spliced =
+        other_frag->data.substr(0, other_frag->seqnoOffset) + String("\x80\x01", 2) + other_frag->data.substr(other_frag->seqnoOffset + 1);
+    if (serializePBJMessage(other_addition) != other_spliced) return false;
+
+    // Keys for each type of event within an update
+    Sirikata::Protocol::Prox::ProximityUpdate addition_update;
+    Sirikata::Protocol::Prox::IObjectAddition nested_addition = addition_update.add_addition();
+    fillAddition(nested_addition, objid, 128, false, loc, orient, bnds, mesh, "");
+    mSectionKeys[AdditionSection] = extractFieldKey(serializePBJMessage(addition_update), serializePBJMessage(addition));
+
+    Sirikata::Protocol::Prox::NodeReparent reparent;
+    reparent.set_object(objid);
+    reparent.set_seqno(129);
+    reparent.set_old_parent(old_parent);
+    reparent.set_new_parent(new_parent);
+    reparent.set_type(Sirikata::Protocol::Prox::NodeReparent::Aggregate);
+    Sirikata::Protocol::Prox::ProximityUpdate reparent_update;
+    Sirikata::Protocol::Prox::INodeReparent nested_reparent = reparent_update.add_reparent();
+    nested_reparent.set_object(objid);
+    nested_reparent.set_seqno(129);
+    nested_reparent.set_old_parent(old_parent);
+    nested_reparent.set_new_parent(new_parent);
+    nested_reparent.set_type(Sirikata::Protocol::Prox::NodeReparent::Aggregate);
+    mSectionKeys[ReparentSection] = extractFieldKey(serializePBJMessage(reparent_update), serializePBJMessage(reparent));
+
+    Sirikata::Protocol::Prox::ObjectRemoval removal;
+    removal.set_object(objid);
+    removal.set_seqno(130);
+    removal.set_type(Sirikata::Protocol::Prox::ObjectRemoval::Transient);
+    Sirikata::Protocol::Prox::ProximityUpdate removal_update;
+    Sirikata::Protocol::Prox::IObjectRemoval nested_removal = removal_update.add_removal();
+    nested_removal.set_object(objid);
+    nested_removal.set_seqno(130);
+    nested_removal.set_type(Sirikata::Protocol::Prox::ObjectRemoval::Transient);
+    mSectionKeys[RemovalSection] = extractFieldKey(serializePBJMessage(removal_update), serializePBJMessage(removal));
+
+    // Sections are encoded in order of field number. Keys are varints, but
+    // single byte keys (field numbers < 16) keep the comparison simple.
+    for(uint32 i = 0; i < NumUpdateSections; i++) {
+        if (mSectionKeys[i].size() != 1) return false;
+        mSectionOrder[i] = (UpdateSection)i;
+    }
+    for(uint32 i = 1; i < NumUpdateSections; i++) {
+        for(uint32 j = i; j > 0 && (uint8)mSectionKeys[mSectionOrder[j]][0] < (uint8)mSectionKeys[mSectionOrder[j-1]][0]; j--)
+            std::swap(mSectionOrder[j], mSectionOrder[j-1]);
+    }
+
+    // Key for updates within the results. Updates must follow the header
+    // fields for us to be able to append them.
+    Time t = Time::null() + Duration::seconds(1);
+    Sirikata::Protocol::Prox::ProximityResults results;
+    results.set_t(t);
+    String header = serializePBJMessage(results);
+    Sirikata::Protocol::Prox::IProximityUpdate nested_update = results.add_update();
+    Sirikata::Protocol::Prox::IObjectRemoval update_removal = nested_update.add_removal();
+    update_removal.set_object(objid);
+    update_removal.set_seqno(130);
+    update_removal.set_type(Sirikata::Protocol::Prox::ObjectRemoval::Transient);
+    String with_update = serializePBJMessage(results);
+    if (with_update.compare(0, header.size(), header) != 0) return false;
+    mUpdateKey = extractFieldKey(with_update.substr(header.size()), serializePBJMessage(removal_update));
+    if (mUpdateKey.empty()) return false;
+
+    // Finally, make sure we generate exactly the same thing as PBJ for a
+    // message with multiple updates and every type of event.
+    Sirikata::Protocol::Prox::IProximityUpdate full_update = results.add_update();
+    Sirikata::Protocol::Prox::IObjectRemoval full_removal = full_update.add_removal();
+    full_removal.set_object(objid);
+    full_removal.set_seqno(131);
+    full_removal.set_type(Sirikata::Protocol::Prox::ObjectRemoval::Permanent);
+    Sirikata::Protocol::Prox::IObjectAddition full_addition = full_update.add_addition();
+    fillAddition(full_addition, objid, 300, false, loc, orient, bnds, mesh, "");
+    Sirikata::Protocol::Prox::INodeReparent full_reparent = full_update.add_reparent();
+    full_reparent.set_object(objid);
+    full_reparent.set_seqno(2);
+    full_reparent.set_old_parent(old_parent);
+    full_reparent.set_new_parent(new_parent);
+    full_reparent.set_type(Sirikata::Protocol::Prox::NodeReparent::Object);
+    String expected = serializePBJMessage(results);
+
+    start(t);
+    startUpdate();
+    addRemoval(objid, 130, false);
+    finishUpdate();
+    startUpdate();
+    addRemoval(objid, 131, true);
+    addAddition(*frag, 300);
+    addReparent(objid, 2, old_parent, new_parent, false);
+    finishUpdate();
+    return (finish() == expected);
+}
+
+String ProxResultEncoder::extractFieldKey(const String& parent, const String& elem) {
+    uint32 len_size = varintSize(elem.size());
+    if (parent.size() <= elem.size() + len_size ||
+        parent.compare(parent.size() - elem.size(), elem.size(), elem) != 0)
+        return String();
+
+    String key = parent.substr(0, parent.size() - elem.size() - len_size);
+    String len;
+    appendVarint(&len, elem.size());
+    if (parent.compare(key.size(), len_size, len) != 0)
+        return String();
+    return key;
+}
+
+void ProxResultEncoder::appendVarint(String* out, uint64 val) {
+    while(val >= 0x80) {
+        out->push_back((char)((val & 0x7F) | 0x80));
+        val >>= 7;
+    }
+    out->push_back((char)val);
+}
+
+uint32 ProxResultEncoder::varintSize(uint64 val) {
+    uint32 result = 1;
+    while(val >= 0x80) {
+        val >>= 7;
+        result++;
+    }
+    return result;
+}
+
+void ProxResultEncoder::appendField(String* out, const String& key, const char* data, uint32 len) {
+    out->append(key);
+    appendVarint(out, len);
+    out->append(data, len);
+}
+
+void ProxResultEncoder::start(const Time& t) {
+    mResults.set_t(t);
+    bool serialized_success = serializePBJMessage(&mOutput, mResults);
+    assert(serialized_success);
+}
+
+void ProxResultEncoder::startUpdate() {
+    for(uint32 i = 0; i < NumUpdateSections; i++)
+        mSections[i].clear();
+}
+
+void ProxResultEncoder::addAddition(const ObjectAdditionFragment& frag, uint64 seqno) {
+    String& out = mSections[AdditionSection];
+    out.append(mSectionKeys[AdditionSection]);
+    appendVarint(&out, frag.data.size() - 1 + varintSize(seqno));
+    out.append(frag.data, 0, frag.seqnoOffset);
+    appendVarint(&out, seqno);
+    out.append(frag.data, frag.seqnoOffset + 1, String::npos);
+}
+
+void ProxResultEncoder::addReparent(const UUID& objid, uint64 seqno, const UUID& old_parent, const UUID& new_parent, bool aggregate) {
+    mReparent.set_object(objid);
+    mReparent.set_seqno(seqno);
+    mReparent.set_old_parent(old_parent);
+    mReparent.set_new_parent(new_parent);
+    mReparent.set_type(
+        aggregate ?
+        Sirikata::Protocol::Prox::NodeReparent::Aggregate :
+        Sirikata::Protocol::Prox::NodeReparent::Object
+    );
+    bool serialized_success = serializePBJMessage(&mScratch, mReparent);
+    assert(serialized_success);
+    appendField(&mSections[ReparentSection], mSectionKeys[ReparentSection], mScratch.data(), mScratch.size());
+}
+
+void ProxResultEncoder::addRemoval(const UUID& objid, uint64 seqno, bool permanent) {
+    mRemoval.set_object(objid);
+    mRemoval.set_seqno(seqno);
+    mRemoval.set_type(
+        permanent ?
+        Sirikata::Protocol::Prox::ObjectRemoval::Permanent :
+        Sirikata::Protocol::Prox::ObjectRemoval::Transient
+    );
+    bool serialized_success = serializePBJMessage(&mScratch, mRemoval);
+    assert(serialized_success);
+    appendField(&mSections[RemovalSection], mSectionKeys[RemovalSection], mScratch.data(), mScratch.size());
+}
+
+void ProxResultEncoder::finishUpdate() {
+    uint32 update_size = 0;
+    for(uint32 i = 0; i < NumUpdateSections; i++)
+        update_size += mSections[i].size();
+
+    mOutput.append(mUpdateKey);
+    appendVarint(&mOutput, update_size);
+    for(uint32 i = 0; i < NumUpdateSections; i++)
+        mOutput.append(mSections[mSectionOrder[i]]);
+}
+
+const String& ProxResultEncoder::finish() {
+    return mOutput;
+}
+
+} // namespace Sirikata
@@ -0,0 +1,151 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_SPACE_PROX_RESULT_ENCODER_HPP_
+#define _SIRIKATA_SPACE_PROX_RESULT_ENCODER_HPP_
+
+#include <sirikata/space/Platform.hpp>
+#include <sirikata/core/util/MotionVector.hpp>
+#include <sirikata/core/util/MotionQuaternion.hpp>
+#include <sirikata/core/util/AggregateBoundingInfo.hpp>
+#include <sirikata/core/transfer/URI.hpp>
+#include "Protocol_Prox.pbj.hpp"
+
+namespace Sirikata {
+
+/** A serialized ObjectAddition for one object, with its seqno set to 0. Since
+ *  the same data is sent to every querier that sees the object, it's encoded
+ *  once and reused for each result, only patching in the seqno.
+ */
+struct ObjectAdditionFragment {
+    String data;
+    // Offset of the (single byte) encoded seqno within data
+    uint32 seqnoOffset;
+};
+typedef std::tr1::shared_ptr<const ObjectAdditionFragment> ObjectAdditionFragmentPtr;
+
+/** Encodes ProximityResults for objects by appending pre-encoded pieces into a
+ *  reusable buffer instead of building up a PBJ message and serializing it.
+ *  The output is byte-for-byte what serializing the equivalent PBJ message
+ *  would produce. Usage:
+ *
+ *    encoder.start(t);
+ *    encoder.startUpdate();
+ *    encoder.addAddition(...); encoder.addRemoval(...); ...
+ *    encoder.finishUpdate();
+ *    ... more updates ...
+ *    const String& msg = encoder.finish();
+ *
+ *  The field keys of the nested messages come from the protocol definition,
+ *  so they're discovered when the encoder is created by encoding sample
+ *  messages with PBJ. If that fails, valid() returns false and the encoder
+ *  must not be used. An encoder isn't thread safe, but any number of them can
+ *  be used in parallel.
+ */
+class SIRIKATA_SPACE_EXPORT ProxResultEncoder {
+public:
+    ProxResultEncoder();
+
+    bool valid() const { return mValid; }
+
+    // Encode a fragment for an object from its current state
+    static ObjectAdditionFragmentPtr encodeAdditionFragment(
+        const UUID& objid, bool aggregate,
+        const TimedMotionVector3f& loc, const TimedMotionQuaternion& orient,
+        const AggregateBoundingInfo& bnds, const String& mesh, const String& physics);
+
+    // Fill in an ObjectAddition (or reference to one) the same way the
+    // fragments are encoded. mesh is the raw mesh URI, as stored in the
+    // location cache.
+    template<typename AdditionType>
+    static void fillAddition(
+        AdditionType& addition, const UUID& objid, uint64 seqno, bool aggregate,
+        const TimedMotionVector3f& loc, const TimedMotionQuaternion& orient,
+        const AggregateBoundingInfo& bnds, const String& mesh, const String& physics);
+
+    void start(const Time& t);
+    void startUpdate();
+    void addAddition(const ObjectAdditionFragment& frag, uint64 seqno);
+    void addReparent(const UUID& objid, uint64 seqno, const UUID& old_parent, const UUID& new_parent, bool aggregate);
+    void addRemoval(const UUID& objid, uint64 seqno, bool permanent);
+    void finishUpdate();
+    // Returns the encoded message, valid until the next call to start()
+    const String& finish();
+
+private:
+    enum UpdateSection {
+        AdditionSection = 0,
+        ReparentSection = 1,
+        RemovalSection = 2,
+        NumUpdateSections = 3
+    };
+
+    bool calibrate();
+    // Offset of the seqno within every encoded addition fragment
+    static uint32 additionSeqnoOffset();
+    // Given the encoding of a parent message containing only elem as a
+    // submessage, return the key for that field, or an empty string if the
+    // encoding isn't as expected.
+    static String extractFieldKey(const String& parent, const String& elem);
+    static void appendVarint(String* out, uint64 val);
+    static uint32 varintSize(uint64 val);
+    void appendField(String* out, const String& key, const char* data, uint32 len);
+
+    bool mValid;
+
+    String mUpdateKey;
+    String mSectionKeys[NumUpdateSections];
+    // Sections in the order they're encoded, i.e. by field number
+    UpdateSection mSectionOrder[NumUpdateSections];
+
+    // Reused for encoding, keeping their allocated space between results
+    Sirikata::Protocol::Prox::ProximityResults mResults;
+    Sirikata::Protocol::Prox::NodeReparent mReparent;
+    Sirikata::Protocol::Prox::ObjectRemoval mRemoval;
+    String mScratch;
+    String mSections[NumUpdateSections];
+    String mOutput;
+}; // class ProxResultEncoder
+
+template<typename AdditionType>
+void ProxResultEncoder::fillAddition(
+    AdditionType& addition, const UUID& objid, uint64 seqno, bool aggregate,
+    const TimedMotionVector3f& loc, const TimedMotionQuaternion& orient,
+    const AggregateBoundingInfo& bnds, const String& mesh, const String& physics)
+{
+    addition.set_object(objid);
+    addition.set_seqno(seqno);
+
+    if (aggregate)
+        addition.set_type(Sirikata::Protocol::Prox::ObjectAddition::Aggregate);
+    else
+        addition.set_type(Sirikata::Protocol::Prox::ObjectAddition::Object);
+
+    Sirikata::Protocol::ITimedMotionVector motion = addition.mutable_location();
+    motion.set_t(loc.updateTime());
+    motion.set_position(loc.position());
+    motion.set_velocity(loc.velocity());
+
+    Sirikata::Protocol::ITimedMotionQuaternion msg_orient = addition.mutable_orientation();
+    msg_orient.set_t(orient.updateTime());
+    msg_orient.set_position(orient.position());
+    msg_orient.set_velocity(orient.velocity());
+
+    Sirikata::Protocol::IAggregateBoundingInfo msg_bounds = addition.mutable_aggregate_bounds();
+    msg_bounds.set_center_offset(bnds.centerOffset);
+    msg_bounds.set_center_bounds_radius(bnds.centerBoundsRadius);
+    msg_bounds.set_max_object_size(bnds.maxObjectRadius);
+
+    // Normalized the same way as CBRLocationServiceCache::mesh()
+    String mesh_url = Transfer::URI(mesh).toString();
+    if (mesh_url.size() > 0)
+        addition.set_mesh(mesh_url);
+    if (physics.size() > 0)
+        addition.set_physics(physics);
+    // Do not include query_data for results going to objects
+}
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_LIBPROX_PROX_RESULT_ENCODER_HPP_
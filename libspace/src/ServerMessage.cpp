@@ -85,14 +85,24 @@ void Message::set_source_server(const ServerID sid) {
 }
 
 bool Message::serialize(Network::Chunk* output) const {
-    // FIXME having to copy here sucks
-    std::string result;
-    bool success = serializePBJMessage(&result, mImpl);
-    if (!success) return false;
-    output->resize( result.size() );
-    memcpy(&((*output)[0]), &(result[0]), sizeof(uint8)*result.size());
+    uint32 len = mImpl.ByteSize();
+    output->resize(len);
+    if (len == 0) return true;
+    return mImpl.SerializeToArray(&((*output)[0]), len);
+}
+
+bool Message::serialize(Network::MessageBatchWriter* batch) const {
+    uint32 len = mImpl.ByteSize();
+    // Refresh the cached size so callers can get it without recomputing it
+    mCachedSize = len;
+    uint8* dest = batch->append(len);
+    if (!mImpl.SerializeToArray(dest, len)) {
+        batch->removeLast();
+        return false;
+    }
     return true;
 }
+
 static char toHex(unsigned char u) {
     if (u<=9) return '0'+u;
     return 'A'+(u-10);
@@ -40,6 +40,7 @@
 #include <sirikata/core/network/StreamListener.hpp>
 #include <sirikata/core/options/CommonOptions.hpp>
 #include <sirikata/space/ServerMessage.hpp>
+#include <sirikata/core/trace/Trace.hpp>
 #include <sirikata/core/network/ServerIDMap.hpp>
 
 using namespace Sirikata::Network;
@@ -138,9 +139,11 @@ TCPSpaceNetwork::RemoteSession::~RemoteSession() {
 
 
 
-TCPSpaceNetwork::TCPSendStream::TCPSendStream(ServerID sid, RemoteSessionPtr s)
- : logical_endpoint(sid),
-   session(s)
+TCPSpaceNetwork::TCPSendStream::TCPSendStream(SpaceContext* ctx, ServerID sid, RemoteSessionPtr s, uint32 max_batch)
+ : context(ctx),
+   logical_endpoint(sid),
+   session(s),
+   max_batch_bytes(max_batch)
 {
 }
 
@@ -152,14 +155,14 @@ ServerID TCPSpaceNetwork::TCPSendStream::id() const {
     return logical_endpoint;
 }
 
-bool TCPSpaceNetwork::TCPSendStream::send(const Chunk& data) {
+TCPSpaceNetwork::RemoteStreamPtr TCPSpaceNetwork::TCPSendStream::writableStream() {
     if (!session)
-        return false;
+        return RemoteStreamPtr();
 
-    RemoteStreamPtr remote_stream = session->remote_stream;
-    if (!remote_stream)
-        return false;
+    return session->remote_stream;
+}
 
+bool TCPSpaceNetwork::TCPSendStream::write(const RemoteStreamPtr& remote_stream, MemoryReference data) {
     bool success = (
         remote_stream->connected &&
         !remote_stream->shutting_down &&
@@ -171,12 +174,69 @@ bool TCPSpaceNetwork::TCPSendStream::send(const Chunk& data) {
     return success;
 }
 
+bool TCPSpaceNetwork::TCPSendStream::send(const Chunk& data) {
+    RemoteStreamPtr remote_stream = writableStream();
+    if (!remote_stream)
+        return false;
+
+    // Anything already batched has to go out first to preserve ordering
+    if (!flush())
+        return false;
+
+    return write(remote_stream, MemoryReference(data));
+}
+
+uint32 TCPSpaceNetwork::TCPSendStream::send(const Message* msg) {
+    RemoteStreamPtr remote_stream = writableStream();
+    if (!remote_stream)
+        return 0;
+
+    // If this would push the batch over the limit, the batch needs to be
+    // written before we can accept it. serializedSize() may be stale if the
+    // message was modified after it was computed, but that only affects when
+    // we split batches.
+    if (!batch.empty() &&
+        batch.size() + msg->serializedSize() + Network::MessageBatchWriter::MAX_FRAMING_BYTES > max_batch_bytes &&
+        !flush())
+        return 0;
+
+    // Serializing updates the cached size, so getting it afterwards is free
+    if (!msg->serialize(&batch))
+        return 0;
+    batch_payload_ids.push_back(msg->payload_id());
+
+    // A limit of 0 disables batching, each message is written immediately
+    if (max_batch_bytes == 0)
+        flush();
+    return msg->serializedSize();
+}
+
+bool TCPSpaceNetwork::TCPSendStream::flush() {
+    if (batch.empty())
+        return true;
+
+    RemoteStreamPtr remote_stream = writableStream();
+    if (!remote_stream)
+        return false;
+
+    if (!write(remote_stream, batch.data()))
+        return false;
+
+    for(uint32 i = 0; i < batch_payload_ids.size(); i++)
+        TIMESTAMP_FULL(context->trace(), context->simTime(), batch_payload_ids[i], Trace::SPACE_TO_SPACE_HIT_NETWORK);
+    batch_payload_ids.clear();
+    batch.clear();
+    return true;
+}
+
 
 TCPSpaceNetwork::TCPReceiveStream::TCPReceiveStream(ServerID sid, RemoteSessionPtr s, Network::IOStrand* _ios)
  : logical_endpoint(sid),
    session(s),
    front_stream(),
    front_elem(NULL),
+   batch(NULL),
+   batch_reader(NULL),
    ios(_ios)
 {
 }
@@ -185,6 +245,9 @@ TCPSpaceNetwork::TCPReceiveStream::~TCPReceiveStream()
 {
     session.reset();
     front_stream.reset();
+    delete front_elem;
+    delete batch_reader;
+    delete batch;
 }
 
 ServerID TCPSpaceNetwork::TCPReceiveStream::id() const {
@@ -195,51 +258,64 @@ Chunk* TCPSpaceNetwork::TCPReceiveStream::front() {
     if (!session)
         return NULL;
 
-    if (front_elem != NULL)
-        return front_elem;
-
-    // Need to get a new front_elem
-    getCurrentRemoteStream();
-    if (!front_stream)
-        return NULL;
-
-    Chunk* result = front_stream->pop(ios);
-    front_elem = result;
-    return result;
+    if (front_elem == NULL)
+        front_elem = nextMessage();
+    return front_elem;
 }
 
 Chunk* TCPSpaceNetwork::TCPReceiveStream::pop() {
-    // Use front() to get the next one.
+    // Use front() to get the next one, then just clear out the front element
     Chunk* result = front();
+    front_elem = NULL;
+    return result;
+}
 
-    // If front fails we can bail out now
-    if (result == NULL)
-        return NULL;
+Chunk* TCPSpaceNetwork::TCPReceiveStream::nextMessage() {
+    while(true) {
+        if (batch == NULL) {
+            getCurrentRemoteStream();
+            if (!front_stream)
+                return NULL;
+
+            batch = front_stream->pop(ios);
+            front_stream.reset();
+            if (batch == NULL)
+                return NULL;
+            // Unbatched messages are handed out as they are, only real
+            // batches need to be split up
+            if (batch->empty() || (*batch)[0] != Network::MessageBatchReader::BATCH_MARKER) {
+                Chunk* result = batch;
+                batch = NULL;
+                return result;
+            }
+            batch_reader = new Network::MessageBatchReader(batch->empty() ? NULL : &(*batch)[0], batch->size());
+        }
 
-    // Otherwise, just do cleanup before returning the front item
-    assert(front_stream);
-    assert(result == front_elem);
-    // We've already popped in front, we just clear out the front element and
-    // front queue
-    front_elem = NULL;
-    front_stream.reset();
+        MemoryReference msg_data = MemoryReference::null();
+        if (batch_reader->next(&msg_data))
+            return new Chunk((const uint8*)msg_data.data(), (const uint8*)msg_data.data() + msg_data.size());
 
-    return result;
+        if (batch_reader->remaining() > 0)
+            TCPNET_LOG(error,"Discarding malformed batch from " << logical_endpoint);
+        delete batch_reader;
+        batch_reader = NULL;
+        delete batch;
+        batch = NULL;
+    }
 }
 
 bool TCPSpaceNetwork::TCPReceiveStream::canReadFrom(RemoteStreamPtr& strm) {
     return (
         strm &&
         (strm->connected || strm->shutting_down) &&
-        ( (front_elem != NULL && strm == front_stream) || !strm->receive_queue.probablyEmpty())
+        !strm->receive_queue.probablyEmpty()
     );
 }
 
 void TCPSpaceNetwork::TCPReceiveStream::getCurrentRemoteStream() {
     // Consider
-    //  1) an already marked front stream
-    //  2) closing streams
-    //  3) active streams.
+    //  1) closing streams
+    //  2) active streams.
     // In order to return a stream it must
     //  a) exist
     //  b) have data in its receive queue
@@ -264,15 +340,15 @@ void TCPSpaceNetwork::TCPReceiveStream::getCurrentRemoteStream() {
 
 
 
-TCPSpaceNetwork::TCPSpaceNetwork(SpaceContext* ctx)
+TCPSpaceNetwork::TCPSpaceNetwork(SpaceContext* ctx, const String& stream_plugin, const String& stream_options, uint32 max_batch_bytes)
  : SpaceNetwork(ctx),
+   mStreamPlugin(stream_plugin),
+   mMaxBatchBytes(max_batch_bytes),
    mSendListener(NULL),
    mReceiveListener(NULL)
 {
-    mStreamPlugin = GetOptionValue<String>("spacestreamlib");
-
-    mListenOptions = StreamListenerFactory::getSingleton().getOptionParser(mStreamPlugin)(GetOptionValue<String>("spacestreamoptions"));
-    mSendOptions = StreamFactory::getSingleton().getOptionParser(mStreamPlugin)(GetOptionValue<String>("spacestreamoptions"));
+    mListenOptions = StreamListenerFactory::getSingleton().getOptionParser(mStreamPlugin)(stream_options);
+    mSendOptions = StreamFactory::getSingleton().getOptionParser(mStreamPlugin)(stream_options);
 
     mIOStrand = mContext->ioService->createStrand("TCPSpaceNetwork IO");
     mIOWork = new Network::IOWork(mContext->ioService, "TCPSpaceNetwork Work");
@@ -330,7 +406,7 @@ TCPSpaceNetwork::TCPSendStream* TCPSpaceNetwork::getNewSendStream(ServerID sid)
         TCPSpaceNetwork::RemoteData* data = getRemoteData(sid);
         if (data->send == NULL) {
             notify = true;
-            data->send = new TCPSendStream(sid, data->session);
+            data->send = new TCPSendStream(mContext, sid, data->session, mMaxBatchBytes);
         }
         result = data->send;
     }
@@ -37,13 +37,14 @@
 #include <sirikata/core/network/Address4.hpp>
 #include <sirikata/core/network/Stream.hpp>
 #include <sirikata/core/network/StreamListener.hpp>
+#include <sirikata/core/network/MessageBatch.hpp>
 #include <sirikata/core/util/PluginManager.hpp>
 #include <sirikata/core/queue/SizedThreadSafeQueue.hpp>
 #include <sirikata/core/queue/CountResourceMonitor.hpp>
 
 namespace Sirikata {
 
-class TCPSpaceNetwork : public SpaceNetwork {
+class SIRIKATA_SPACE_EXPORT TCPSpaceNetwork : public SpaceNetwork {
     // Data associated with a stream.  Note that this stream is
     // usually, but not always, unique to the endpoint pair.  Due to
     // the possibility of both sides initiating a connection at the
@@ -132,17 +133,36 @@ class TCPSpaceNetwork : public SpaceNetwork {
     typedef std::tr1::shared_ptr<RemoteSession> RemoteSessionPtr;
     typedef std::tr1::weak_ptr<RemoteSession> RemoteSessionWPtr;
 
+    // Messages sent with send(const Message*) are serialized directly into a
+    // batch which is reused across writes and written to the underlying stream
+    // as a single chunk when flushed or when it reaches max_batch_bytes. The
+    // send stream is only used from the ServerMessageQueue's strand, so the
+    // batch doesn't need any locking.
     class TCPSendStream : public SpaceNetwork::SendStream {
     public:
-        TCPSendStream(ServerID sid, RemoteSessionPtr s);
+        TCPSendStream(SpaceContext* ctx, ServerID sid, RemoteSessionPtr s, uint32 max_batch);
         ~TCPSendStream();
 
         virtual ServerID id() const;
         virtual bool send(const Chunk&);
+        virtual uint32 send(const Message* msg);
+        virtual bool flush();
 
     private:
+        // Get the stream to write to, or an empty pointer if there isn't a
+        // usable one right now.
+        RemoteStreamPtr writableStream();
+        // Write data to the stream, requesting a ready send callback if it
+        // can't be written.
+        bool write(const RemoteStreamPtr& remote_stream, MemoryReference data);
+
+        SpaceContext* context;
         ServerID logical_endpoint;
         RemoteSessionPtr session;
+        Network::MessageBatchWriter batch;
+        // Payload IDs of the messages in batch, timestamped once it's written
+        std::vector<UniqueMessageID> batch_payload_ids;
+        const uint32 max_batch_bytes;
     };
     typedef std::tr1::unordered_map<ServerID, TCPSendStream*> SendStreamMap;
 
@@ -155,6 +175,10 @@ class TCPSpaceNetwork : public SpaceNetwork {
         virtual Chunk* pop();
 
     private:
+        // Get the next message from the current batch, pulling in a new batch
+        // from the streams if necessary.
+        Chunk* nextMessage();
+
         // Get the current queue for receiving data from the address.
         // This considers any closing streams first, then the main stream
         // in order to handle any data arriving on closing streams as
@@ -170,11 +194,14 @@ class TCPSpaceNetwork : public SpaceNetwork {
 
         ServerID logical_endpoint;
         RemoteSessionPtr session;
-        RemoteStreamPtr front_stream; // Stream which we already got a front()
-                                      // item from
+        RemoteStreamPtr front_stream; // Stream we're about to pull a
+                                      // batch from
         Chunk* front_elem; // The front item, left out here to make it
                            // accessible since the RemoteStream doesn't give
                            // easy access
+        Chunk* batch; // Chunk received from the network which we're splitting
+                      // into messages
+        Network::MessageBatchReader* batch_reader;
         Network::IOStrand* ios;
     };
     typedef std::tr1::unordered_map<ServerID, TCPReceiveStream*> ReceiveStreamMap;
@@ -231,6 +258,9 @@ class TCPSpaceNetwork : public SpaceNetwork {
     Network::IOStrand *mIOStrand;
     Network::IOWork* mIOWork;
 
+    // Maximum size of the batches written by TCPSendStreams
+    uint32 mMaxBatchBytes;
+
     RemoteStreamMap mClosingStreams;
     TimerSet mClosingStreamTimers; // Timers for streams that are still closing.
 
@@ -293,7 +323,11 @@ class TCPSpaceNetwork : public SpaceNetwork {
     void readySendCallback(RemoteStreamWPtr wstream);
 
 public:
-    TCPSpaceNetwork(SpaceContext* ctx);
+    /** Create a network which connects servers with streams from
+     *  stream_plugin, configured with stream_options, and which batches up to
+     *  max_batch_bytes of messages into a single write (0 disables batching).
+     */
+    TCPSpaceNetwork(SpaceContext* ctx, const String& stream_plugin, const String& stream_options, uint32 max_batch_bytes);
     virtual ~TCPSpaceNetwork();
 
     virtual void setSendListener(SendListener* sl);
@@ -0,0 +1,100 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <sirikata/space/WorkerPool.hpp>
+#include <sirikata/core/util/Timer.hpp>
+#include <boost/lexical_cast.hpp>
+
+namespace Sirikata {
+
+WorkerPool::WorkerPool(const String& name, uint32 nworkers)
+ : mNumWorkers(std::max(nworkers, (uint32)1)),
+   mTask(NULL),
+   mGeneration(0),
+   mRemaining(0),
+   mShutdown(false),
+   mStats(mNumWorkers)
+{
+    // Worker 0 is whoever calls run()
+    for(uint32 i = 1; i < mNumWorkers; i++) {
+        mThreads.push_back(
+            new Thread(name + " Worker " + boost::lexical_cast<String>(i), std::tr1::bind(&WorkerPool::workerMain, this, i))
+        );
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        boost::lock_guard<boost::mutex> lck(mMutex);
+        mShutdown = true;
+    }
+    mWorkReady.notify_all();
+
+    for(uint32 i = 0; i < mThreads.size(); i++) {
+        mThreads[i]->join();
+        delete mThreads[i];
+    }
+    mThreads.clear();
+}
+
+void WorkerPool::run(const Task& task) {
+    if (mThreads.empty()) {
+        runTask(0, task);
+        return;
+    }
+
+    {
+        boost::lock_guard<boost::mutex> lck(mMutex);
+        mTask = &task;
+        mGeneration++;
+        mRemaining = mThreads.size();
+    }
+    mWorkReady.notify_all();
+
+    runTask(0, task);
+
+    boost::unique_lock<boost::mutex> lck(mMutex);
+    while(mRemaining > 0)
+        mWorkDone.wait(lck);
+    mTask = NULL;
+}
+
+std::vector<WorkerPool::WorkerStats> WorkerPool::stats() {
+    boost::lock_guard<boost::mutex> lck(mMutex);
+    return mStats;
+}
+
+void WorkerPool::workerMain(uint32 idx) {
+    uint64 last_generation = 0;
+    while(true) {
+        const Task* task = NULL;
+        {
+            boost::unique_lock<boost::mutex> lck(mMutex);
+            while(!mShutdown && mGeneration == last_generation)
+                mWorkReady.wait(lck);
+            if (mShutdown) return;
+            last_generation = mGeneration;
+            task = mTask;
+        }
+
+        runTask(idx, *task);
+
+        boost::lock_guard<boost::mutex> lck(mMutex);
+        mRemaining--;
+        if (mRemaining == 0)
+            mWorkDone.notify_one();
+    }
+}
+
+void WorkerPool::runTask(uint32 idx, const Task& task) {
+    Time start = Timer::now();
+    task(idx);
+    Duration elapsed = Timer::now() - start;
+
+    boost::lock_guard<boost::mutex> lck(mMutex);
+    mStats[idx].runs++;
+    mStats[idx].busy += elapsed;
+}
+
+} // namespace Sirikata
@@ -58,7 +58,7 @@ namespace Sirikata
   };
 
 
-  class CacheLRUOriginal : public OSegCache
+  class SIRIKATA_SPACE_EXPORT CacheLRUOriginal : public OSegCache
   {
   private:
     Context* mContext;
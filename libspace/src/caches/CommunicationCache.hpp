@@ -45,7 +45,7 @@ namespace Sirikata
   double commCacheScoreFunctionPrint(const FCacheRecord* a,bool toPrint);
 
 
-  class CommunicationCache : public OSegCache
+  class SIRIKATA_SPACE_EXPORT CommunicationCache : public OSegCache
   {
   private:
     Complete_Cache mCompleteCache;
@@ -0,0 +1,262 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "ShardedClockCache.hpp"
+#include <sirikata/core/command/Commander.hpp>
+
+namespace Sirikata {
+
+using std::tr1::placeholders::_1;
+using std::tr1::placeholders::_2;
+using std::tr1::placeholders::_3;
+
+namespace {
+uint32 nextPowerOfTwo(uint32 x) {
+    uint32 result = 1;
+    while(result < x)
+        result <<= 1;
+    return result;
+}
+}
+
+ShardedClockCache::Shard::Shard(uint32 _maxSize, uint32 tableSize)
+ : entries(tableSize),
+   mask(tableSize-1),
+   size(0),
+   maxSize(_maxSize),
+   hand(0),
+   nextPurge(0),
+   hits(0),
+   misses(0),
+   expired(0),
+   evictions(0)
+{
+}
+
+ShardedClockCache::ShardedClockCache(Context* ctx, uint32 maxSize, uint32 numShards, Duration entryLifetime)
+ : mContext(ctx),
+   mEntryLifetime(entryLifetime.toMilliseconds())
+{
+    numShards = std::max(numShards, (uint32)1);
+    uint32 shard_size = std::max((maxSize + numShards - 1) / numShards, (uint32)1);
+    // Keep the load factor at or below 1/2 so probe sequences stay short
+    uint32 table_size = std::max(nextPowerOfTwo(shard_size * 2), (uint32)8);
+    for(uint32 i = 0; i < numShards; i++)
+        mShards.push_back(new Shard(shard_size, table_size));
+
+    if (mContext->commander()) {
+        mContext->commander()->registerCommand(
+            "space.oseg.cache.properties",
+            std::tr1::bind(&ShardedClockCache::commandProperties, this, _1, _2, _3)
+        );
+    }
+}
+
+ShardedClockCache::~ShardedClockCache() {
+    if (mContext->commander())
+        mContext->commander()->unregisterCommand("space.oseg.cache.properties");
+
+    for(uint32 i = 0; i < mShards.size(); i++)
+        delete mShards[i];
+}
+
+ShardedClockCache::Shard* ShardedClockCache::shardFor(const UUID& uuid, uint32* home) {
+    // Mix the hash since UUID::hash is a simple combination of the bytes
+    uint64 h = (uint64)uuid.hash() * 0x9E3779B97F4A7C15ULL;
+    uint32 hi = (uint32)(h >> 32);
+    Shard* shard = mShards[hi % mShards.size()];
+    *home = (uint32)h & shard->mask;
+    return shard;
+}
+
+int64 ShardedClockCache::now() const {
+    return (mContext->recentSimTime() - Time::null()).toMilliseconds();
+}
+
+bool ShardedClockCache::isExpired(const Entry& entry, int64 curtime) const {
+    return (curtime - entry.inserted > mEntryLifetime);
+}
+
+int32 ShardedClockCache::find(Shard* shard, const UUID& uuid, uint32 home) const {
+    for(uint32 idx = home; shard->entries[idx].used; idx = (idx + 1) & shard->mask) {
+        if (shard->entries[idx].id == uuid)
+            return (int32)idx;
+    }
+    return -1;
+}
+
+void ShardedClockCache::erase(Shard* shard, uint32 idx) {
+    // Backward shift deletion: move later entries in the same probe sequence
+    // into the hole so lookups never need tombstones.
+    std::vector<Entry>& entries = shard->entries;
+    uint32 hole = idx;
+    for(uint32 next = (hole + 1) & shard->mask; entries[next].used; next = (next + 1) & shard->mask) {
+        uint32 home = entries[next].home;
+        // Entries whose home is cyclically in (hole, next] can't move
+        bool stays = (hole <= next) ?
+            (hole < home && home <= next) :
+            (hole < home || home <= next);
+        if (stays) continue;
+        entries[hole] = entries[next];
+        hole = next;
+    }
+    entries[hole].used = false;
+    shard->size--;
+}
+
+uint32 ShardedClockCache::purgeExpired(Shard* shard, int64 curtime) {
+    uint32 purged = 0;
+    uint32 idx = 0;
+    while(idx < shard->entries.size()) {
+        Entry& entry = shard->entries[idx];
+        // Erasing shifts later entries back, possibly into idx, so check it
+        // again. Entries only move backwards towards the hole, so nothing we
+        // haven't checked yet can end up behind idx.
+        if (entry.used && isExpired(entry, curtime)) {
+            erase(shard, idx);
+            purged++;
+            continue;
+        }
+        idx++;
+    }
+    shard->expired += purged;
+    return purged;
+}
+
+void ShardedClockCache::evictOne(Shard* shard, int64 curtime) {
+    assert(shard->size > 0);
+
+    if (curtime >= shard->nextPurge) {
+        shard->nextPurge = curtime + std::max(mEntryLifetime / 4, (int64)1);
+        if (purgeExpired(shard, curtime) > 0)
+            return;
+    }
+
+    // Terminates within two sweeps since the first clears every reference bit
+    while(true) {
+        Entry& entry = shard->entries[shard->hand];
+        if (entry.used) {
+            bool expired = isExpired(entry, curtime);
+            if (!entry.referenced || expired) {
+                erase(shard, shard->hand);
+                if (expired)
+                    shard->expired++;
+                else
+                    shard->evictions++;
+                return;
+            }
+            entry.referenced = false;
+        }
+        shard->hand = (shard->hand + 1) & shard->mask;
+    }
+}
+
+void ShardedClockCache::insert(const UUID& uuid, const OSegEntry& sID) {
+    uint32 home;
+    Shard* shard = shardFor(uuid, &home);
+    int64 curtime = now();
+
+    boost::lock_guard<boost::mutex> lck(shard->mutex);
+
+    int32 existing = find(shard, uuid, home);
+    if (existing >= 0) {
+        Entry& entry = shard->entries[existing];
+        entry.value = sID;
+        entry.inserted = curtime;
+        entry.referenced = true;
+        return;
+    }
+
+    if (shard->size >= shard->maxSize)
+        evictOne(shard, curtime);
+
+    uint32 idx = home;
+    while(shard->entries[idx].used)
+        idx = (idx + 1) & shard->mask;
+
+    Entry& entry = shard->entries[idx];
+    entry.id = uuid;
+    entry.value = sID;
+    entry.inserted = curtime;
+    entry.home = home;
+    entry.used = true;
+    entry.referenced = true;
+    shard->size++;
+}
+
+const OSegEntry& ShardedClockCache::get(const UUID& uuid) {
+    OSegEntry* result = mResult.get();
+    if (result == NULL) {
+        result = new OSegEntry();
+        mResult.reset(result);
+    }
+    *result = OSegEntry::null();
+
+    uint32 home;
+    Shard* shard = shardFor(uuid, &home);
+
+    boost::lock_guard<boost::mutex> lck(shard->mutex);
+
+    int32 idx = find(shard, uuid, home);
+    if (idx < 0) {
+        shard->misses++;
+        return *result;
+    }
+
+    Entry& entry = shard->entries[idx];
+    if (isExpired(entry, now())) {
+        erase(shard, idx);
+        shard->expired++;
+        shard->misses++;
+        return *result;
+    }
+
+    entry.referenced = true;
+    shard->hits++;
+    *result = entry.value;
+    return *result;
+}
+
+void ShardedClockCache::remove(const UUID& uuid) {
+    uint32 home;
+    Shard* shard = shardFor(uuid, &home);
+
+    boost::lock_guard<boost::mutex> lck(shard->mutex);
+
+    int32 idx = find(shard, uuid, home);
+    if (idx >= 0)
+        erase(shard, idx);
+}
+
+ShardedClockCache::Stats ShardedClockCache::stats() {
+    Stats result;
+    for(uint32 i = 0; i < mShards.size(); i++) {
+        Shard* shard = mShards[i];
+        boost::lock_guard<boost::mutex> lck(shard->mutex);
+        result.size += shard->size;
+        result.hits += shard->hits;
+        result.misses += shard->misses;
+        result.expired += shard->expired;
+        result.evictions += shard->evictions;
+    }
+    return result;
+}
+
+void ShardedClockCache::commandProperties(const Command::Command& cmd, Command::Commander* cmdr, Command::CommandID cmdid) {
+    Command::Result result = Command::EmptyResult();
+
+    Stats st = stats();
+    result.put("name", "shardedclock");
+    result.put("shards", (uint32)mShards.size());
+    result.put("size", st.size);
+    result.put("capacity", (uint32)(mShards.size() * mShards[0]->maxSize));
+    result.put("hits", st.hits);
+    result.put("misses", st.misses);
+    result.put("expired", st.expired);
+    result.put("evictions", st.evictions);
+
+    cmdr->result(cmdid, result);
+}
+
+} // namespace Sirikata
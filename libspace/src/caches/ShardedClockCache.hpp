@@ -0,0 +1,109 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_SPACE_SHARDED_CLOCK_CACHE_HPP_
+#define _SIRIKATA_SPACE_SHARDED_CLOCK_CACHE_HPP_
+
+#include <sirikata/space/OSegCache.hpp>
+#include <sirikata/core/command/Command.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+namespace Sirikata {
+
+/** OSegCache which is safe to use from many threads at once. Entries are split
+ *  into shards by UUID hash, each with its own lock, and stored inline in an
+ *  open addressed table so inserts don't allocate. When a shard is full,
+ *  expired entries are dropped first. Finding them takes a scan of the whole
+ *  table, so a shard does that at most once per quarter of the entry
+ *  lifetime. If that frees nothing, an entry is evicted with CLOCK (second
+ *  chance): a hand sweeps the table, clearing reference bits set by lookups
+ *  and evicting the first unreferenced or expired entry it finds. Entries
+ *  older than the entry lifetime are never returned.
+ *
+ *  Hit, miss and eviction counts are available through the
+ *  space.oseg.cache.properties command.
+ */
+class SIRIKATA_SPACE_EXPORT ShardedClockCache : public OSegCache {
+public:
+    ShardedClockCache(Context* ctx, uint32 maxSize, uint32 numShards, Duration entryLifetime);
+    virtual ~ShardedClockCache();
+
+    virtual void insert(const UUID& uuid, const OSegEntry& sID);
+    virtual const OSegEntry& get(const UUID& uuid);
+    virtual void remove(const UUID& uuid);
+
+    struct Stats {
+        Stats()
+         : size(0), hits(0), misses(0), expired(0), evictions(0)
+        {}
+
+        uint32 size;
+        uint64 hits;
+        uint64 misses; // Including expired entries
+        uint64 expired; // Expired entries dropped, by lookups or when full
+        uint64 evictions; // Unexpired entries evicted to make room
+    };
+    Stats stats();
+
+private:
+    struct Entry {
+        Entry()
+         : id(UUID::null()),
+           value(OSegEntry::null()),
+           inserted(0),
+           home(0),
+           used(false),
+           referenced(false)
+        {}
+
+        UUID id;
+        OSegEntry value;
+        int64 inserted; // Sim time in milliseconds
+        uint32 home; // Slot id hashes to, needed to shift entries on removal
+        bool used;
+        bool referenced;
+    };
+
+    struct Shard {
+        Shard(uint32 maxSize, uint32 tableSize);
+
+        boost::mutex mutex;
+        std::vector<Entry> entries;
+        uint32 mask;
+        uint32 size;
+        uint32 maxSize;
+        uint32 hand;
+        int64 nextPurge; // Sim time in milliseconds
+        uint64 hits;
+        uint64 misses;
+        uint64 expired;
+        uint64 evictions;
+    };
+
+    Shard* shardFor(const UUID& uuid, uint32* home);
+    int64 now() const;
+    bool isExpired(const Entry& entry, int64 curtime) const;
+
+    // These must be called with the shard's mutex held
+    int32 find(Shard* shard, const UUID& uuid, uint32 home) const;
+    void erase(Shard* shard, uint32 idx);
+    // Returns the number of entries dropped
+    uint32 purgeExpired(Shard* shard, int64 curtime);
+    void evictOne(Shard* shard, int64 curtime);
+
+    void commandProperties(const Command::Command& cmd, Command::Commander* cmdr, Command::CommandID cmdid);
+
+    Context* mContext;
+    std::vector<Shard*> mShards;
+    int64 mEntryLifetime; // In milliseconds
+
+    // get() returns a reference, so results are copied into per-thread
+    // storage which stays valid after the shard is unlocked.
+    boost::thread_specific_ptr<OSegEntry> mResult;
+}; // class ShardedClockCache
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_SPACE_SHARDED_CLOCK_CACHE_HPP_
@@ -31,6 +31,7 @@
  */
 
 #include "FairServerMessageQueue.hpp"
+#include "Options.hpp"
 #include <sirikata/space/SpaceNetwork.hpp>
 #include <sirikata/space/ServerMessage.hpp>
 #include <sirikata/core/options/CommonOptions.hpp>
@@ -46,6 +47,14 @@ FairServerMessageQueue::SenderAdapterQueue::SenderAdapterQueue(Sender* sender, S
 {
 }
 
+QueueEnum::PushResult FairServerMessageQueue::SenderAdapterQueue::push(Message* msg) {
+    if (mFront != NULL)
+        return QueueEnum::PushExceededMaximumSize;
+
+    mFront = msg;
+    return QueueEnum::PushSucceeded;
+}
+
 Message* FairServerMessageQueue::SenderAdapterQueue::front() {
     if (mFront != NULL)
         return mFront;
@@ -68,14 +77,26 @@ bool FairServerMessageQueue::SenderAdapterQueue::empty() {
 
 FairServerMessageQueue::FairServerMessageQueue(SpaceContext* ctx, SpaceNetwork* net, Sender* sender)
         : ServerMessageQueue(ctx, net, sender),
-          mServerQueues(),
+          mServerQueues(NULL),
           mServiceScheduled(false),
           mStoppedBlocked(0),
           mStoppedUnderflow(0)
 {
+    String fair_queue_type = GetOptionValue<String>(SERVER_FAIR_QUEUE);
+    if (fair_queue_type == "drr")
+        mServerQueues = new DRRFairQueue<Message, ServerID, SenderAdapterQueue>();
+    else if (fair_queue_type == "wfq")
+        mServerQueues = new FairQueue<Message, ServerID, SenderAdapterQueue>();
+    else {
+        SILOG(fsmq, fatal, "Unknown " << SERVER_FAIR_QUEUE << " type: " << fair_queue_type);
+        assert(false);
+        exit(-1);
+    }
 }
 
 FairServerMessageQueue::~FairServerMessageQueue() {
+    delete mServerQueues;
+
     SILOG(fsmq,info,
         "FSMQ: underflow: " << mStoppedUnderflow <<
         ", blocked: " << mStoppedBlocked
@@ -113,7 +134,7 @@ void FairServerMessageQueue::service() {
         {
             MutexLock lck(mMutex);
 
-            next_msg = mServerQueues.front(&sid);
+            next_msg = mServerQueues->front(&sid);
             if (next_msg == NULL )
                 break;
 
@@ -128,7 +149,7 @@ void FairServerMessageQueue::service() {
             }
 
             // Pop the message
-            Message* next_msg_popped = mServerQueues.pop();
+            Message* next_msg_popped = mServerQueues->pop();
             assert(next_msg == next_msg_popped);
 
             cum_sent_size += sent_size;
@@ -142,7 +163,7 @@ void FairServerMessageQueue::service() {
         {
             // Lock needed for getQueueWeight
             MutexLock lck(mMutex);
-        CONTEXT_TRACE_NO_TIME(serverDatagramSent, start_time, end_time, mServerQueues.getQueueWeight(next_msg->dest_server()),
+        CONTEXT_TRACE_NO_TIME(serverDatagramSent, start_time, end_time, mServerQueues->getQueueWeight(next_msg->dest_server()),
             next_msg->dest_server(), next_msg->id(), packet_size);
         }
         */
@@ -152,6 +173,10 @@ void FairServerMessageQueue::service() {
         delete next_msg;
     }
 
+    // Write out everything accepted this round. If a stream can't take it
+    // all, it holds onto the rest and we'll get networkReadyToSend, which
+    // reschedules servicing, when it can.
+    flushSendStreams();
 
     if (num_sent == MAX_MESSAGES_PER_ROUND) {
         mBlocked = true;
@@ -161,7 +186,7 @@ void FairServerMessageQueue::service() {
     }
     else {
         // There are 2 ways we could get here:
-        // 1. mServerQueues.empty() == true: We ran out of input messages to
+        // 1. mServerQueues->empty() == true: We ran out of input messages to
         // send.  We have to discard the bytes we didn't have input for. We
         // track this manually to avoid locking for mServerQueues
         // 2. Otherwise, we had enough bytes, there were items in the queue,
@@ -191,7 +216,7 @@ void FairServerMessageQueue::messageReady(ServerID sid) {
     // Make sure we are setup for this server. We don't have a weight for this
     // server yet, so we must use a default. We use the average of all known
     // weights, and hope to get an update soon.
-    if (!mServerQueues.hasQueue(sid)) {
+    if (!mServerQueues->hasQueue(sid)) {
         addInputQueue(
             sid,
             getAverageServerWeight()
@@ -199,13 +224,13 @@ void FairServerMessageQueue::messageReady(ServerID sid) {
     }
 
     // Notify and service
-    mServerQueues.notifyPushFront(sid);
+    mServerQueues->notifyPushFront(sid);
     scheduleServicing();
 }
 
 float FairServerMessageQueue::getAverageServerWeight() const {
     // NOTE: MUST have mMutex locked, currently only called from messageReady.
-    return mServerQueues.avg_weight();
+    return mServerQueues->avg_weight();
 }
 
 void FairServerMessageQueue::networkReadyToSend(const ServerID& from) {
@@ -222,32 +247,32 @@ void FairServerMessageQueue::networkReadyToSend(const ServerID& from) {
 void FairServerMessageQueue::addInputQueue(ServerID sid, float weight) {
     // NOTE: MUST have lock, acquired by messageReady or handleUpdateReceiverStats
 
-    assert( !mServerQueues.hasQueue(sid) );
+    assert( !mServerQueues->hasQueue(sid) );
     SILOG(fairsender,info,"Adding input queue for " << sid);
-    mServerQueues.addQueue(new SenderAdapterQueue(mSender,sid),sid,weight);
+    mServerQueues->addQueue(new SenderAdapterQueue(mSender,sid),sid,weight);
 }
 
 void FairServerMessageQueue::handleUpdateReceiverStats(ServerID sid, double total_weight, double used_weight) {
     MutexLock lck(mMutex);
 
-    if (!mServerQueues.hasQueue(sid))
+    if (!mServerQueues->hasQueue(sid))
         addInputQueue(sid, used_weight);
     else
-        mServerQueues.setQueueWeight(sid, used_weight);
+        mServerQueues->setQueueWeight(sid, used_weight);
 }
 
 void FairServerMessageQueue::removeInputQueue(ServerID sid) {
     MutexLock lck(mMutex);
 
-    assert( mServerQueues.hasQueue(sid) );
-    mServerQueues.removeQueue(sid);
+    assert( mServerQueues->hasQueue(sid) );
+    mServerQueues->removeQueue(sid);
 }
 
 void FairServerMessageQueue::enableDownstream(ServerID sid) {
     MutexLock lck(mMutex);
 
     // Will ignore queues it doesn't know about.
-    mServerQueues.enableQueue(sid);
+    mServerQueues->enableQueue(sid);
 
     scheduleServicing();
 }
@@ -255,7 +280,7 @@ void FairServerMessageQueue::enableDownstream(ServerID sid) {
 void FairServerMessageQueue::disableDownstream(ServerID sid) {
     SILOG(fsmq,info, "Network disabled: " << (mContext->simTime()-Time::null()).toSeconds());
     // NOTE: must ensure mMutex is locked
-    mServerQueues.disableQueue(sid);
+    mServerQueues->disableQueue(sid);
 }
 
 }
@@ -34,6 +34,7 @@
 #define _SIRIKATA_FAIRSENDQUEUE_HPP
 
 #include <sirikata/core/queue/FairQueue.hpp>
+#include <sirikata/core/queue/DRRFairQueue.hpp>
 #include "ServerMessageQueue.hpp"
 
 namespace Sirikata {
@@ -41,6 +42,10 @@ class FairServerMessageQueue:public ServerMessageQueue {
 protected:
     struct SenderAdapterQueue {
         SenderAdapterQueue(Sender* sender, ServerID sid);
+        // Messages are normally pulled from the Sender and signalled with
+        // notifyPushFront. A pushed message is buffered as the front, ahead
+        // of anything the Sender still has, so only one fits at a time.
+        QueueEnum::PushResult push(Message* msg);
         Message* front();
         Message* pop();
         bool empty();
@@ -50,8 +55,8 @@ protected:
         Message* mFront;
     };
 
-    typedef FairQueue<Message, ServerID, SenderAdapterQueue> FairSendQueue;
-    FairSendQueue mServerQueues;
+    typedef AbstractFairQueue<Message, ServerID, SenderAdapterQueue> FairSendQueue;
+    FairSendQueue* mServerQueues;
 
     Sirikata::AtomicValue<bool> mServiceScheduled;
 
@@ -110,6 +110,7 @@ Forwarder::Forwarder(SpaceContext* ctx)
              mOSegLookups(NULL),
              mUniqueConnIDs(0),
              mServiceIDSource(0),
+             mODPRouters(new ODPRouterMap()),
              mServerWeightPoller(
                  ctx->mainStrand,
                  std::tr1::bind(&Forwarder::updateServerWeights, this),
@@ -147,7 +148,10 @@ Forwarder::Forwarder(SpaceContext* ctx)
   {
       // We don't need to delete these because they are added to
       // mOutgoingMessages as a service queue, so they will be deleted there.
-      mODPRouters.clear();
+      delete mODPRouters;
+      for(uint32 i = 0; i < mRetiredODPRouters.size(); i++)
+          delete mRetiredODPRouters[i];
+      mRetiredODPRouters.clear();
 
       delete mOSegCacheUpdateRouter;
       delete mForwarderWeightRouter;
@@ -225,11 +229,10 @@ void Forwarder::reportStats() {
 
 void Forwarder::addObjectConnection(const UUID& dest_obj, ObjectConnection* conn) {
   UniqueObjConn uoc;
-  uoc.id = mUniqueConnIDs;
+  uoc.id = mUniqueConnIDs++;
   uoc.conn = conn;
-  ++mUniqueConnIDs;
 
-  mObjectConnections[dest_obj] = uoc;
+  mObjectConnections.set(dest_obj, uoc);
 }
 
 void Forwarder::enableObjectConnection(const UUID& dest_obj) {
@@ -243,28 +246,29 @@ void Forwarder::enableObjectConnection(const UUID& dest_obj) {
 }
 
 ObjectConnection* Forwarder::removeObjectConnection(const UUID& dest_obj) {
-    //    ObjectConnection* conn = mObjectConnections[dest_obj];
-    UniqueObjConn uoc = mObjectConnections[dest_obj];
-    ObjectConnection* conn = uoc.conn;
-    mObjectConnections.erase(dest_obj);
-    return conn;
+    UniqueObjConn uoc;
+    if (!mObjectConnections.erase(dest_obj, &uoc))
+        return NULL;
+    return uoc.conn;
 }
 
 ObjectConnection* Forwarder::getObjectConnection(const UUID& dest_obj) {
-    ObjectConnectionMap::iterator it = mObjectConnections.find(dest_obj);
-    return (it == mObjectConnections.end()) ? NULL : it->second.conn;
+    UniqueObjConn uoc;
+    if (!mObjectConnections.get(dest_obj, &uoc))
+        return NULL;
+    return uoc.conn;
 }
 
 ObjectConnection* Forwarder::getObjectConnection(const UUID& dest_obj, uint64& ider )
 {
-    ObjectConnectionMap::iterator it = mObjectConnections.find(dest_obj);
-    if (it == mObjectConnections.end())
+    UniqueObjConn uoc;
+    if (!mObjectConnections.get(dest_obj, &uoc))
     {
       ider = 0;
       return NULL;
     }
-    ider = it->second.id;
-    return it->second.conn;
+    ider = uoc.id;
+    return uoc.conn;
 }
 
 
@@ -304,15 +308,29 @@ ODPFlowScheduler* Forwarder::createODPFlowScheduler(LocationService* loc, Server
 
     {
         boost::lock_guard<boost::recursive_mutex> lck(mODPRouterMapMutex);
-        mODPRouters[remote_server] = new_flow_scheduler;
+        ODPRouterMap* updated = new ODPRouterMap(*mODPRouters);
+        (*updated)[remote_server] = new_flow_scheduler;
+        // Make sure the new map is fully written before readers can see it
+        memory_barrier();
+        const ODPRouterMap* previous = mODPRouters;
+        mODPRouters = updated;
+        mRetiredODPRouters.push_back(previous);
     }
     return new_flow_scheduler;
 }
 
+ODPFlowScheduler* Forwarder::getODPFlowScheduler(ServerID remote_server) const {
+    const ODPRouterMap* routers = mODPRouters;
+    memory_barrier();
+    ODPRouterMap::const_iterator it = routers->find(remote_server);
+    return (it == routers->end()) ? NULL : it->second;
+}
+
 void Forwarder::updateServerWeights() {
-    boost::lock_guard<boost::recursive_mutex> lck(mODPRouterMapMutex);
+    const ODPRouterMap* routers = mODPRouters;
+    memory_barrier();
 
-    for(ODPRouterMap::iterator it = mODPRouters.begin(); it != mODPRouters.end(); it++) {
+    for(ODPRouterMap::const_iterator it = routers->begin(); it != routers->end(); it++) {
         ServerID serv_id = it->first;
         ODPFlowScheduler* serv_flow_sched = it->second;
 
@@ -476,13 +494,7 @@ void Forwarder::receiveWeightUpdateMessage(Message* msg) {
         weight_update.server_pair_used_weight()
     );
 
-    ODPFlowScheduler* serv_flow_sched = NULL;
-    {
-        boost::lock_guard<boost::recursive_mutex> lck(mODPRouterMapMutex);
-        ODPRouterMap::iterator flow_sched_it = mODPRouters.find(source);
-        if (flow_sched_it != mODPRouters.end())
-            serv_flow_sched = flow_sched_it->second;
-    }
+    ODPFlowScheduler* serv_flow_sched = getODPFlowScheduler(source);
     if (serv_flow_sched != NULL) {
         // Update with receiver stats from this remote server.
         serv_flow_sched->updateReceiverStats(
@@ -575,20 +587,15 @@ bool Forwarder::routeObjectMessageToServer(Sirikata::Protocol::Object::ObjectMes
   // And then we can actually push
   // We try to look up the ODPFlowScheduler efficiently first, and only prePush
   // if we fail to find it.
-  ODPFlowScheduler* flow_sched = NULL;
-  {
-      boost::lock_guard<boost::recursive_mutex> lck(mODPRouterMapMutex);
-      ODPRouterMap::iterator odp_it = mODPRouters.find(dest_serv.server());
-      if (odp_it != mODPRouters.end())
-          flow_sched = odp_it->second;
-  }
+  ODPFlowScheduler* flow_sched = getODPFlowScheduler(dest_serv.server());
   if (flow_sched == NULL) {
       // Will force allocation of ODPFlowScheduler if its not there already
       {
           boost::lock_guard<boost::recursive_mutex> lck(mODPRouterMapMutex);
           mOutgoingMessages->prePush(dest_serv.server());
-          flow_sched = mODPRouters[dest_serv.server()];
+          flow_sched = getODPFlowScheduler(dest_serv.server());
       }
+      assert(flow_sched != NULL);
   }
 
   OSegEntry source_object_data(OSegEntry::null());//FIXME: do we want mandatory lookup for nonlocal guys?! = mOSegLookups->cacheLookup(obj_msg->source_object());
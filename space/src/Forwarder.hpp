@@ -49,6 +49,7 @@
 #include <sirikata/core/odp/SSTDecls.hpp>
 
 #include "ForwarderServiceQueue.hpp"
+#include "ShardedObjectMap.hpp"
 
 #include <sirikata/core/queue/SizedThreadSafeQueue.hpp>
 #include <sirikata/core/queue/ThreadSafeQueueWithNotification.hpp>
@@ -98,14 +99,16 @@ private:
     ODPSST::BaseDatagramLayerPtr mSSTDatagramLayer;
 
 
-    // Object connections, identified by a separate unique ID to handle fast migrations
-    uint64 mUniqueConnIDs; // Connection ID generator
+    // Object connections, identified by a separate unique ID to handle fast
+    // migrations. Sharded by object so lookups from different threads don't
+    // serialize on a single lock.
+    AtomicValue<uint64> mUniqueConnIDs; // Connection ID generator
     struct UniqueObjConn
     {
       uint64 id;
       ObjectConnection* conn;
     };
-    typedef std::tr1::unordered_map<UUID, UniqueObjConn, UUID::Hasher> ObjectConnectionMap;
+    typedef ShardedObjectMap<UniqueObjConn> ObjectConnectionMap;
     ObjectConnectionMap mObjectConnections;
     OSegLookupQueue::LookupCallback mNullServerIDOSegCallback;
     typedef std::vector<ServerID> ListServersUpdate;
@@ -121,9 +124,17 @@ private:
     // Per-Service ServerMessage Router's
     Router<Message*>* mOSegCacheUpdateRouter;
     Router<Message*>* mForwarderWeightRouter;
+    // The per-server ODPFlowSchedulers are looked up for every forwarded
+    // message but only added when a new server connection appears, so readers
+    // use an immutable snapshot of the map without any locking. Writers hold
+    // mODPRouterMapMutex, copy the current map, add to it, and publish the
+    // copy. Old snapshots may still be in use by readers, so they are only
+    // freed with the Forwarder -- there's one per remote server, so this is
+    // small.
     typedef std::tr1::unordered_map<ServerID, ODPFlowScheduler*> ODPRouterMap;
     boost::recursive_mutex mODPRouterMapMutex;
-    ODPRouterMap mODPRouters;
+    const ODPRouterMap* volatile mODPRouters;
+    std::vector<const ODPRouterMap*> mRetiredODPRouters;
     Poller mServerWeightPoller; // For updating ServerMessageQueue, remote
                                 // ServerMessageReceiver with per-server weights
 
@@ -164,6 +175,9 @@ private:
     // new server connection is made.  This creates it and gets it setup so the
     // Forwarder can get weight updates sent to the remote endpoint.
     ODPFlowScheduler* createODPFlowScheduler(LocationService* loc, ServerID remote_server, uint32 max_size);
+    // Lock-free lookup of the ODPFlowScheduler for a server, returns NULL if
+    // one hasn't been created yet.
+    ODPFlowScheduler* getODPFlowScheduler(ServerID remote_server) const;
 
     // Invoked periodically by an (internal) poller to update server fair queue
     // weights. Updates local ServerMessageQueue and sends messages to remote
@@ -186,7 +200,8 @@ private:
     // --- Inputs
   public:
     // Received from OH networking, needs forwarding decision.  Forwards or
-    // drops -- ownership is given to Forwarder either way
+    // drops -- ownership is given to Forwarder either way. Must be called from
+    // the main strand.
     void routeObjectHostMessage(Sirikata::Protocol::Object::ObjectMessage* obj_msg);
   private:
     // Received from other space server, needs forwarding decision
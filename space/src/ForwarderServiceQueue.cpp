@@ -32,15 +32,28 @@
 
 
 #include "ForwarderServiceQueue.hpp"
+#include "Options.hpp"
+#include <sirikata/core/options/CommonOptions.hpp>
+#include <sirikata/core/queue/FairQueue.hpp>
+#include <sirikata/core/queue/DRRFairQueue.hpp>
 #include <boost/thread/locks.hpp>
 
 namespace Sirikata {
 
 ForwarderServiceQueue::ForwarderServiceQueue(ServerID this_server, uint32 size, Listener* listener)
         : mThisServer(this_server),
+          mUseDRR(false),
           mQueueSize(size),
           mListener(listener)
 {
+    String fair_queue_type = GetOptionValue<String>(SERVER_FAIR_QUEUE);
+    if (fair_queue_type == "drr")
+        mUseDRR = true;
+    else if (fair_queue_type != "wfq") {
+        SILOG(forwarder, fatal, "Unknown " << SERVER_FAIR_QUEUE << " type: " << fair_queue_type);
+        assert(false);
+        exit(-1);
+    }
 }
 
 ForwarderServiceQueue::~ForwarderServiceQueue() {
@@ -107,16 +120,14 @@ void ForwarderServiceQueue::notifyPushFront(ServerID sid, ServiceID svc) {
     mListener->forwarderServiceMessageReady(sid);
 }
 
-uint32 ForwarderServiceQueue::size(ServerID sid, ServiceID svc) {
-    boost::lock_guard<boost::mutex> lock(mMutex);
-    return checkServiceQueue(getServerFairQueue(sid), svc)->size(svc);
-}
-
-
 ForwarderServiceQueue::OutgoingFairQueue* ForwarderServiceQueue::getServerFairQueue(ServerID sid) {
     ServerQueueMap::iterator it = mQueues.find(sid);
     if (it == mQueues.end()) {
-        OutgoingFairQueue* ofq = new OutgoingFairQueue();
+        OutgoingFairQueue* ofq = NULL;
+        if (mUseDRR)
+            ofq = new DRRFairQueue<Message, ServiceID, MessageQueue>();
+        else
+            ofq = new FairQueue<Message, ServiceID, MessageQueue>();
         // Create service queues for all the services
         for(MessageQueueCreatorMap::iterator creator_it = mQueueCreators.begin(); creator_it != mQueueCreators.end(); creator_it++) {
             ServiceID svc_id = creator_it->first;
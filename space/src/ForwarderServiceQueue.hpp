@@ -34,7 +34,7 @@
 #define _SIRIKATA_FORWARDER_SERVICE_QUEUE_HPP_
 
 #include <sirikata/core/util/Platform.hpp>
-#include <sirikata/core/queue/FairQueue.hpp>
+#include <sirikata/core/queue/AbstractFairQueue.hpp>
 #include <sirikata/space/ServerMessage.hpp>
 #include <boost/thread.hpp>
 
@@ -74,11 +74,12 @@ class ForwarderServiceQueue {
     friend class ForwarderServerMessageRouter;
     friend class ODPFlowScheduler;
 
-    typedef FairQueue<Message, ServiceID, MessageQueue> OutgoingFairQueue;
+    typedef AbstractFairQueue<Message, ServiceID, MessageQueue> OutgoingFairQueue;
     typedef std::tr1::unordered_map<ServerID, OutgoingFairQueue*> ServerQueueMap;
     typedef std::tr1::unordered_map<ServiceID, MessageQueueCreator> MessageQueueCreatorMap;
 
     ServerID mThisServer;
+    bool mUseDRR; // Use DRRFairQueue instead of FairQueue
     MessageQueueCreatorMap mQueueCreators;
     ServerQueueMap mQueues;
     uint32 mQueueSize;
@@ -96,8 +97,6 @@ class ForwarderServiceQueue {
     // given service on the given server.
     void notifyPushFront(ServerID sid, ServiceID svc);
 
-    uint32 size(ServerID sid, ServiceID svc);
-
     // Utilities
 
     // Gets the FairQueue over services for the specified server.
@@ -50,35 +50,23 @@ LocalForwarder::LocalForwarder(SpaceContext* ctx)
 }
 
 void LocalForwarder::addActiveConnection(ObjectConnection* conn) {
-    boost::lock_guard<boost::mutex> lock(mMutex);
-
-
-    assert(mActiveConnections.find(conn->id()) == mActiveConnections.end());
-    mActiveConnections[conn->id()] = conn;
+    ObjectConnection* existing = NULL;
+    assert(!mActiveConnections.get(conn->id(), &existing));
+    (void)existing; // Only used by the assert
+    mActiveConnections.set(conn->id(), conn);
 }
 
 void LocalForwarder::removeActiveConnection(const UUID& objid) {
-    boost::lock_guard<boost::mutex> lock(mMutex);
-
-    ObjectConnectionMap::iterator it = mActiveConnections.find(objid);
-    if (it == mActiveConnections.end())
-        return;
-
-    mActiveConnections.erase(it);
+    mActiveConnections.erase(objid);
 }
 
 bool LocalForwarder::tryForward(Sirikata::Protocol::Object::ObjectMessage* msg) {
     ObjectConnection* conn = NULL;
     {
-        boost::lock_guard<boost::mutex> lock(mMutex);
-
         // Destination connection must exist and be enabled
-        ObjectConnectionMap::iterator it = mActiveConnections.find(msg->dest_object());
-        if (it == mActiveConnections.end())
+        if (!mActiveConnections.get(msg->dest_object(), &conn))
             return false;
 
-        conn = it->second;
-
         // FIXME we can't sanity check here because we use this after
         // receiving from another space server (in which case we won't
         // have the source object...).
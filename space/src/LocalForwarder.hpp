@@ -37,6 +37,7 @@
 #include <sirikata/core/service/PollingService.hpp>
 #include <sirikata/core/util/AtomicTypes.hpp>
 #include "ObjectConnection.hpp"
+#include "ShardedObjectMap.hpp"
 
 namespace Sirikata {
 
@@ -75,11 +76,12 @@ class LocalForwarder : public PollingService {
 
     virtual void poll();
 
-    typedef std::tr1::unordered_map<UUID, ObjectConnection*, UUID::Hasher> ObjectConnectionMap;
+    // Sharded so networking threads forwarding between different objects
+    // don't contend for a single lock
+    typedef ShardedObjectMap<ObjectConnection*> ObjectConnectionMap;
 
     SpaceContext* mContext;
     ObjectConnectionMap mActiveConnections;
-    boost::mutex mMutex;
     // Stats, reported as x per second
     Time mLastStatsTime;
     const String mTimeSeriesForwardedName;
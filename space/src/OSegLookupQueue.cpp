@@ -34,11 +34,22 @@
 #include <sirikata/space/ObjectSegmentation.hpp>
 #include "Options.hpp"
 #include <sirikata/core/options/CommonOptions.hpp>
+#include <sirikata/core/util/Timer.hpp>
 
 namespace Sirikata {
 
 // OSegLookupList Implementation
 
+OSegLookupQueue::OSegLookupList::OSegLookupList(const Time& started)
+ : mTotalSize(0),
+   mStarted(started)
+{
+}
+
+const Time& OSegLookupQueue::OSegLookupList::started() const {
+    return mStarted;
+}
+
 size_t OSegLookupQueue::OSegLookupList::ByteSize() const{
     return mTotalSize;
 }
@@ -56,6 +67,12 @@ void OSegLookupQueue::OSegLookupList::push_back(const OSegLookup& lu) {
     OSegLookupVector::push_back(lu);
 }
 
+void OSegLookupQueue::OSegLookupList::swap(OSegLookupList& other) {
+    OSegLookupVector::swap(other);
+    std::swap(mTotalSize, other.mTotalSize);
+    std::swap(mStarted, other.mStarted);
+}
+
 OSegLookupQueue::OSegLookupList::iterator OSegLookupQueue::OSegLookupList::begin(){
     return OSegLookupVector::begin();
 }
@@ -71,9 +88,14 @@ OSegLookupQueue::OSegLookupList::iterator OSegLookupQueue::OSegLookupList::end()
 OSegLookupQueue::OSegLookupQueue(Network::IOStrand* net_strand, ObjectSegmentation* oseg)
  : mNetworkStrand(net_strand),
    mOSeg(oseg),
-   mTotalSize(0)
+   mTotalSize(0),
+   mLastWindowDecrease(Time::null())
 {
     mMaxLookups = GetOptionValue<uint32>(OSEG_LOOKUP_QUEUE_SIZE);
+    mMinPushbackWindow = (float)std::max(GetOptionValue<uint32>(OSEG_LOOKUP_WINDOW_MIN), (uint32)1);
+    mMaxPushbackWindow = (float)std::max(GetOptionValue<uint32>(OSEG_LOOKUP_WINDOW_MAX), (uint32)mMinPushbackWindow);
+    mTargetLatency = GetOptionValue<Duration>(OSEG_LOOKUP_TARGET_LATENCY);
+    mPushbackWindow = mMinPushbackWindow;
     mOSeg->setLookupListener(this);
 }
 
@@ -87,18 +109,19 @@ bool OSegLookupQueue::lookup(Sirikata::Protocol::Object::ObjectMessage* msg, con
   UUID dest_obj = msg->dest_object();
   size_t cursize = msg->ByteSize();
 
+  OSegLookup lu;
+  lu.msg = msg;
+  lu.cb = cb;
+  lu.size = cursize;
+
   //if already looking up, do not call lookup on mOSeg;
-  LookupMap::const_iterator it = mLookups.find(dest_obj);
+  LookupMap::iterator it = mLookups.find(dest_obj);
   if (it != mLookups.end())
   {
     //we are already looking up the object.  Just add it to mLookups
     // And if we do, stick it on a list and wait
     mTotalSize += cursize;
-    OSegLookup lu;
-    lu.msg = msg;
-    lu.cb = cb;
-    lu.size = cursize;
-    mLookups[dest_obj].push_back(lu);
+    it->second.push_back(lu);
     return true;
   }
 
@@ -111,15 +134,9 @@ bool OSegLookupQueue::lookup(Sirikata::Protocol::Object::ObjectMessage* msg, con
   }
 
   //if did not get a cache hit, check if have enough room to add it;
-  if (mLookups.size() > mMaxLookups)
+  if (mOSeg->getPushback() > (int)mPushbackWindow || mLookups.size() > mMaxLookups)
     return false;
 
-  //FIXME: hardcoded here
-  #define MAX_OSEG_PUSHBACK_PARAMETER 3
-
-  if (mOSeg->getPushback() > MAX_OSEG_PUSHBACK_PARAMETER)
-      return false;
-
   //  otherwise, do full oseg lookup;
   destServer = mOSeg->lookup(dest_obj);
   // If we already have a server, handle the callback right away
@@ -130,11 +147,8 @@ bool OSegLookupQueue::lookup(Sirikata::Protocol::Object::ObjectMessage* msg, con
 
   // And if we do, stick it on a list and wait
   mTotalSize += cursize;
-  OSegLookup lu;
-  lu.msg = msg;
-  lu.cb = cb;
-  lu.size = cursize;
-  mLookups[dest_obj].push_back(lu);
+  it = mLookups.insert( LookupMap::value_type(dest_obj, OSegLookupList(Timer::now())) ).first;
+  it->second.push_back(lu);
   return true;
 }
 
@@ -146,17 +160,46 @@ void OSegLookupQueue::osegLookupCompleted(const UUID& id, const OSegEntry& dest)
 }
 
 void OSegLookupQueue::handleLookupCompleted(const UUID& id, const OSegEntry& dest) {
-    //Now sending messages that we had saved up from oseg lookup calls.
+    finishLookup(id, dest, ResolvedFromServer);
+}
+
+void OSegLookupQueue::finishLookup(const UUID& id, const OSegEntry& dest, ResolvedFrom resolved_from) {
+    // Take the waiting messages out before invoking their callbacks, so a
+    // callback which submits another lookup for this object starts a new one
+    OSegLookupList waiting(Time::null());
     LookupMap::iterator iterQueueMap = mLookups.find(id);
     if (iterQueueMap == mLookups.end())
         return;
 
-    for (int s=0; s < (signed) ((iterQueueMap->second).size()); ++ s) {
-        const OSegLookup& lu = (iterQueueMap->second[s]);
-        mTotalSize -= lu.size;
-        lu.cb(lu.msg, dest, ResolvedFromServer);
-    }
+    if (resolved_from == ResolvedFromServer)
+        updatePushbackWindow(Timer::now() - iterQueueMap->second.started());
+
+    waiting.swap(iterQueueMap->second);
+    mTotalSize -= (int32)waiting.ByteSize();
     mLookups.erase(iterQueueMap);
+
+    //Now sending messages that we had saved up from oseg lookup calls.
+    for (int s=0; s < (signed) (waiting.size()); ++ s) {
+        const OSegLookup& lu = (waiting[s]);
+        lu.cb(lu.msg, dest, resolved_from);
+    }
+}
+
+void OSegLookupQueue::updatePushbackWindow(const Duration& latency) {
+    if (latency <= mTargetLatency) {
+        // Grow by one per fast lookup, roughly doubling each round trip, so
+        // bursts of new lookups, e.g. during mass connects, ramp up quickly.
+        mPushbackWindow = std::min(mPushbackWindow + 1.f, mMaxPushbackWindow);
+        return;
+    }
+
+    // Slow lookups mean the OSeg is overloaded. A burst of them is one
+    // congestion event, so only back off once per target latency.
+    Time tnow = Timer::now();
+    if (tnow - mLastWindowDecrease < mTargetLatency)
+        return;
+    mLastWindowDecrease = tnow;
+    mPushbackWindow = std::max(mPushbackWindow / 2.f, mMinPushbackWindow);
 }
 
 } // namespace Sirikata
@@ -44,6 +44,9 @@ namespace Sirikata {
  *  The user can specify a policy for how these rejections occur, e.g. based
  *  on a total number of outstanding lookups, a total number of bytes in messages
  *  for outstanding lookups, etc.
+ *
+ *  The ObjectSegmentation is only safe to use from the network strand, so
+ *  the queue is only used from there and needs no locking.
  */
 class OSegLookupQueue : public OSegLookupListener {
 public:
@@ -71,11 +74,16 @@ private:
     class OSegLookupList : protected std::vector<OSegLookup> {
         typedef std::vector<OSegLookup> OSegLookupVector;
         size_t mTotalSize;
+        Time mStarted;
     public:
+        explicit OSegLookupList(const Time& started);
+        // Time the OSeg lookup was started
+        const Time& started() const;
         size_t ByteSize() const;
         size_t size() const;
         OSegLookup& operator[] (size_t where);
         void push_back(const OSegLookup& lu);
+        void swap(OSegLookupList& other);
         OSegLookupVector::iterator begin();
         OSegLookupVector::iterator end();
     };
@@ -91,10 +99,23 @@ private:
     uint32 mMaxLookups; // Total number of unique OSeg lookups (i.e. number of
                         // UUIDs, not number of requests).
 
+    // New lookups are rejected while the OSeg's pushback exceeds this
+    // window. It grows while lookups finish within mTargetLatency and is
+    // halved, at most once per mTargetLatency, when they take longer.
+    float mPushbackWindow;
+    float mMinPushbackWindow;
+    float mMaxPushbackWindow;
+    Duration mTargetLatency;
+    Time mLastWindowDecrease;
+
     /* OSegLookupListener Interface */
     virtual void osegLookupCompleted(const UUID& id, const OSegEntry& dest);
     /* Main thread handler for lookups. */
     void handleLookupCompleted(const UUID& id, const OSegEntry& dest);
+    /* Invokes callbacks for all the messages waiting on a lookup. */
+    void finishLookup(const UUID& id, const OSegEntry& dest, ResolvedFrom resolved_from);
+    /* Adjusts the pushback window given the latency of a completed lookup. */
+    void updatePushbackWindow(const Duration& latency);
 public:
     /** Create an OSegLookupQueue which uses the specified ObjectSegmentation to resolve queries and
      *  the specified predicate to determine if new lookups are accepted.
@@ -111,8 +132,10 @@ public:
      */
     OSegEntry cacheLookup(const UUID& destid) const;
     /** Perform an OSeg lookup, calling the specified callback when the result is available.
-     *  If the result is available immediately, the callback may be triggered during this
-     *  call.  Otherwise, it will be triggered when a service() call produces a result.
+     *  Must be called from the network strand. If the result is available
+     *  immediately, the callback is triggered during this call.  Otherwise,
+     *  it will be triggered from the network strand when the OSeg produces a
+     *  result.
      *  Note that if the request is accepted, the message is owned by the OSegLookupQueue until
      *  the callback is invoked, at which time control is passed back to the caller.
      *  \param msg the ObjectMessage to perform the lookup for
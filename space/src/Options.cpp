@@ -52,6 +52,7 @@ void InitSpaceOptions() {
 
         .addOption(new OptionValue("spacestreamlib","tcpsst",Sirikata::OptionValueType<String>(),"Which library to use to communicate with the object host"))
         .addOption(new OptionValue("spacestreamoptions","--send-buffer-size=32768 --parallel-sockets=1 --no-delay=true",Sirikata::OptionValueType<String>(),"TCPSST stream options such as how many bytes to collect for sending during an ongoing asynchronous send call."))
+        .addOption(new OptionValue("spacestreambatchsize","0",Sirikata::OptionValueType<uint32>(),"Maximum number of bytes of messages to other space servers to combine into a single write. Should be smaller than the stream's send buffer size, e.g. 16384. 0, the default, disables batching. Only enable it when every space server is able to split batched writes, older servers can't parse them."))
 
         .addOption(new OptionValue("id", "1", Sirikata::OptionValueType<ServerID>(), "Server ID for this server"))
 
@@ -61,6 +62,7 @@ void InitSpaceOptions() {
         .addOption(new OptionValue(SERVER_QUEUE_LENGTH, "8192", Sirikata::OptionValueType<uint32>(), "Length of queue for each server."))
         .addOption(new OptionValue(SERVER_RECEIVER, "fair", Sirikata::OptionValueType<String>(), "The type of ServerMessageReceiver to use for routing."))
         .addOption(new OptionValue(SERVER_ODP_FLOW_SCHEDULER, "region", Sirikata::OptionValueType<String>(), "The type of ODPFlowScheduler to use for routing."))
+        .addOption(new OptionValue(SERVER_FAIR_QUEUE, "wfq", Sirikata::OptionValueType<String>(), "The fair queuing algorithm used to share bandwidth between servers and services: wfq (weighted fair queuing) or drr (deficit round robin, O(1) per message)."))
         .addOption(new OptionValue(FORWARDER_RECEIVE_QUEUE_SIZE, "16384", Sirikata::OptionValueType<uint32>(), "The type of ODPFlowScheduler to use for routing."))
         .addOption(new OptionValue(FORWARDER_SEND_QUEUE_SIZE, "65536", Sirikata::OptionValueType<uint32>(), "The type of ODPFlowScheduler to use for routing."))
 
@@ -70,6 +72,9 @@ void InitSpaceOptions() {
         .addOption(new OptionValue(OSEG_OPTIONS,"",Sirikata::OptionValueType<String>(),"Specifies arguments to OSeg."))
 
         .addOption(new OptionValue(OSEG_LOOKUP_QUEUE_SIZE, "2000", Sirikata::OptionValueType<uint32>(), "Number of new lookups you can have on oseg lookup queue."))
+        .addOption(new OptionValue(OSEG_LOOKUP_WINDOW_MIN, "3", Sirikata::OptionValueType<uint32>(), "Smallest OSeg pushback (outstanding lookups reported by the OSeg) that new lookups are still accepted at."))
+        .addOption(new OptionValue(OSEG_LOOKUP_WINDOW_MAX, "4096", Sirikata::OptionValueType<uint32>(), "Largest OSeg pushback that new lookups are accepted at. The window grows towards this while lookups finish within the target latency."))
+        .addOption(new OptionValue(OSEG_LOOKUP_TARGET_LATENCY, "100ms", Sirikata::OptionValueType<Duration>(), "OSeg lookups slower than this shrink the window of accepted pushback, faster ones grow it."))
 
         .addOption(new OptionValue(OSEG_CACHE_SIZE, "200", Sirikata::OptionValueType<uint32>(), "Maximum number of entries in the OSeg cache."))
 
@@ -80,6 +85,7 @@ void InitSpaceOptions() {
          .addOption(new OptionValue("receive-capacity-overestimate","1",Sirikata::OptionValueType<double>(),"How much to overestimate recv capacity when queue is not blocked."))
         .addOption(new OptionValue(OSEG_CACHE_CLEAN_GROUP_SIZE, "25", Sirikata::OptionValueType<uint32>(), "Number of items to remove from the OSeg cache when it reaches the maximum size."))
         .addOption(new OptionValue(OSEG_CACHE_ENTRY_LIFETIME, "8s", Sirikata::OptionValueType<Duration>(), "Maximum lifetime for an OSeg cache entry."))
+        .addOption(new OptionValue(OSEG_CACHE_SHARDS, "16", Sirikata::OptionValueType<uint32>(), "Number of independently locked shards the OSeg cache is split into, for cache_shardedclock."))
 
         .addOption(new OptionValue(CSEG, "uniform", Sirikata::OptionValueType<String>(), "Type of Coordinate Segmentation implementation to use."))
         .addOption(new OptionValue("cseg-service-host", "meru00", Sirikata::OptionValueType<String>(), "Hostname of machine running the CSEG service (running with --cseg=distributed)"))
@@ -97,7 +103,8 @@ void InitSpaceOptions() {
         .addOption(new OptionValue(OPT_PROX, "libprox", Sirikata::OptionValueType<String>(), "Type of Proximity query processor to instantiate."))
         .addOption(new OptionValue(OPT_PROX_OPTIONS, "", Sirikata::OptionValueType<String>(), "Arguments to pass to Proximity query processor. Note that many common options are already provided (type of top-level service, type of server-to-server and object-to-server handlers, etc) so they do not need to be passed through."))
 
-      .addOption(new OptionValue("route-object-message-buffer", "64", Sirikata::OptionValueType<size_t>(), "size of the buffer between network and main strand for space server message routing"))
+      .addOption(new OptionValue("route-object-message-buffer", "64", Sirikata::OptionValueType<size_t>(), "size of the buffer between network and each routing lane for space server message routing"))
+      .addOption(new OptionValue(ROUTE_OBJECT_MESSAGE_LANES, "4", Sirikata::OptionValueType<uint32>(), "Number of lanes object host messages needing routing decisions are split across. Lanes are processed in parallel; messages from a single object host connection always use the same lane so they stay in order."))
 
         .addOption(new OptionValue(OPT_MODULES, "environment", Sirikata::OptionValueType< std::vector<String> >(), "Additional SpaceModules to load"))
 
@@ -42,6 +42,7 @@
 #define SERVER_QUEUE_LENGTH  "server.queue.length"
 #define SERVER_RECEIVER      "server.receiver"
 #define SERVER_ODP_FLOW_SCHEDULER   "server.odp.flowsched"
+#define SERVER_FAIR_QUEUE    "server.fair-queue"
 
 #define NETWORK_TYPE         "net"
 
@@ -60,10 +61,12 @@
 #define OSEG_CACHE_SIZE              "oseg-cache-size"
 #define OSEG_CACHE_CLEAN_GROUP_SIZE  "oseg-cache-clean-group-size"
 #define OSEG_CACHE_ENTRY_LIFETIME    "oseg-cache-entry-lifetime"
+#define OSEG_CACHE_SHARDS            "oseg-cache-shards"
 
 #define CACHE_SELECTOR              "oseg-cache-selector"
 #define CACHE_TYPE_COMMUNICATION    "cache_communication"
 #define CACHE_TYPE_ORIGINAL_LRU     "cache_originallru"
+#define CACHE_TYPE_SHARDED_CLOCK    "cache_shardedclock"
 
 
 #define CACHE_COMM_SCALING          "oseg-cache-scaling"
@@ -72,6 +75,11 @@
 #define FORWARDER_RECEIVE_QUEUE_SIZE "forwarder.receive-queue-size"
 
 #define OSEG_LOOKUP_QUEUE_SIZE     "oseg_lookup_queue_size"
+#define OSEG_LOOKUP_WINDOW_MIN     "oseg-lookup-window-min"
+#define OSEG_LOOKUP_WINDOW_MAX     "oseg-lookup-window-max"
+#define OSEG_LOOKUP_TARGET_LATENCY "oseg-lookup-target-latency"
+
+#define ROUTE_OBJECT_MESSAGE_LANES "route-object-message-lanes"
 
 #define OPT_PROX                   "prox"
 #define OPT_PROX_OPTIONS           "prox-options"
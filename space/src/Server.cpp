@@ -37,6 +37,7 @@
 #include <sirikata/space/ServerMessage.hpp>
 #include <sirikata/core/trace/Trace.hpp>
 #include <sirikata/core/options/CommonOptions.hpp>
+#include "Options.hpp"
 #include <sirikata/space/Authenticator.hpp>
 #include "Forwarder.hpp"
 #include "LocalForwarder.hpp"
@@ -94,7 +95,12 @@ Server::Server(SpaceContext* ctx, Authenticator* auth, Forwarder* forwarder, Loc
    mMigrationSendRunning(false),
    mShutdownRequested(false),
    mObjectHostConnectionManager(NULL),
-   mRouteObjectMessage(Sirikata::SizedResourceMonitor(GetOptionValue<size_t>("route-object-message-buffer"))),
+   mRouteLaneStatsPoller(
+       ctx->mainStrand,
+       std::tr1::bind(&Server::reportRouteLaneStats, this),
+       "Server::reportRouteLaneStats",
+       Duration::seconds((int64)1)
+   ),
    mTimeSeriesObjects(String("space.server") + boost::lexical_cast<String>(ctx->id()) + ".objects")
 {
     using std::tr1::placeholders::_1;
@@ -103,6 +109,11 @@ Server::Server(SpaceContext* ctx, Authenticator* auth, Forwarder* forwarder, Loc
 
     mTimeSyncServer = new TimeSyncServer(mContext, this);
 
+    uint32 num_route_lanes = std::max(GetOptionValue<uint32>(ROUTE_OBJECT_MESSAGE_LANES), (uint32)1);
+    size_t route_lane_buffer = GetOptionValue<size_t>("route-object-message-buffer");
+    for(uint32 i = 0; i < num_route_lanes; i++)
+        mRouteLanes.push_back(new RouteLane(mContext, i, route_lane_buffer));
+
     mMigrateServerMessageService = mForwarder->createServerMessageService("migrate");
 
     mForwarder->registerMessageRecipient(SERVER_PORT_MIGRATION, this);
@@ -202,6 +213,10 @@ Server::~Server()
     delete mObjectHostConnectionManager;
     delete mLocalForwarder;
 
+    for(uint32 i = 0; i < mRouteLanes.size(); i++)
+        delete mRouteLanes[i];
+    mRouteLanes.clear();
+
     delete mMigrationMonitor;
 
     delete mTimeSyncServer;
@@ -292,11 +307,11 @@ bool Server::isObjectConnecting(const UUID& object_id) const {
     return (mStoredConnectionData.find(object_id) != mStoredConnectionData.end());
 }
 bool Server::isObjectDisconnecting(const UUID& object_id) const {
-    boost::lock_guard<boost::mutex> lock(const_cast<boost::mutex&>(mRouteObjectMessageMutex));
+    boost::lock_guard<boost::mutex> lock(const_cast<boost::mutex&>(mDisconnectingObjectsMutex));
     return mDisconnectingObjects.find(object_id)!=mDisconnectingObjects.end();
 }
 bool Server::markObjectDisconnecting(const UUID& object_id, int serviceCount) {
-    boost::lock_guard<boost::mutex> lock(mRouteObjectMessageMutex);
+    boost::lock_guard<boost::mutex> lock(mDisconnectingObjectsMutex);
     DisconnectingObjectMap::iterator where = mDisconnectingObjects.find(object_id);
     if (where==mDisconnectingObjects.end()) {
         mDisconnectingObjects[object_id]=serviceCount;
@@ -307,7 +322,7 @@ bool Server::markObjectDisconnecting(const UUID& object_id, int serviceCount) {
 }
 
 void Server::markObjectDisconnectedCallback(UUID object){
-    boost::lock_guard<boost::mutex> lock(mRouteObjectMessageMutex);
+    boost::lock_guard<boost::mutex> lock(mDisconnectingObjectsMutex);
     DisconnectingObjectMap::iterator where = mDisconnectingObjects.find(object);
     assert(where!=mDisconnectingObjects.end());
     where->second--;
@@ -386,23 +401,24 @@ bool Server::onObjectHostMessageReceived(const ObjectHostConnectionID& conn_id,
     if (mForwarder->tryCacheForward(obj_msg))
         return true;
 
-    // 5. Otherwise, we're going to have to ship this to the main thread, either
-    // for handling session messages, messages to the space, or to make a
-    // routing decision.
+    // 5. Otherwise, we're going to have to ship this to a routing lane, either
+    // for messages to the space or to make a routing decision.
+    RouteLane* lane = getRouteLane(conn_id);
     bool hit_empty;
     bool push_for_processing_success;
     {
-        boost::lock_guard<boost::mutex> lock(mRouteObjectMessageMutex);
-        hit_empty = (mRouteObjectMessage.probablyEmpty());
-        push_for_processing_success = mRouteObjectMessage.push(ConnectionIDObjectMessagePair(conn_id,obj_msg),false);
+        boost::lock_guard<boost::mutex> lock(lane->mutex);
+        hit_empty = (lane->queue.probablyEmpty());
+        push_for_processing_success = lane->queue.push(ConnectionIDObjectMessagePair(conn_id,obj_msg),false);
     }
     if (!push_for_processing_success) {
         TIMESTAMP(obj_msg, Trace::SPACE_DROPPED_AT_MAIN_STRAND_CROSSING);
         TRACE_DROP(SPACE_DROPPED_AT_MAIN_STRAND_CROSSING);
         delete obj_msg;
     } else {
+        lane->depth++;
         if (hit_empty)
-            scheduleObjectHostMessageRouting();
+            scheduleObjectHostMessageRouting(lane);
     }
 
     // NOTE: We always "accept" the data, even if we're just dropping
@@ -426,33 +442,67 @@ void Server::onObjectHostDisconnected(const ObjectHostConnectionID& oh_conn_id,
     mOHSessionManager->fireObjectHostSessionEnded( OHDP::NodeID(short_conn_id) );
 }
 
-void Server::scheduleObjectHostMessageRouting() {
-    mContext->mainStrand->post(
+Server::RouteLane::RouteLane(SpaceContext* ctx, uint32 idx, size_t buffer_size)
+ : strand(ctx->ioService->createStrand(String("Server Route Lane ") + boost::lexical_cast<String>(idx))),
+   queue(Sirikata::SizedResourceMonitor(buffer_size)),
+   depth(0),
+   timeSeriesDepthName(String("space.server") + boost::lexical_cast<String>(ctx->id()) + ".route_lane" + boost::lexical_cast<String>(idx) + ".queue_depth")
+{
+}
+
+Server::RouteLane::~RouteLane() {
+    ConnectionIDObjectMessagePair front(ObjectHostConnectionID(),NULL);
+    while(queue.pop(front))
+        delete front.obj_msg;
+    delete strand;
+}
+
+Server::RouteLane* Server::getRouteLane(const ObjectHostConnectionID& conn_id) {
+    return mRouteLanes[conn_id.shortID() % mRouteLanes.size()];
+}
+
+void Server::scheduleObjectHostMessageRouting(RouteLane* lane) {
+    lane->strand->post(
         std::tr1::bind(
             &Server::handleObjectHostMessageRouting,
-            this),
+            this, lane),
         "Server::handleObjectHostMessageRouting"
     );
 }
 
-void Server::handleObjectHostMessageRouting() {
+void Server::handleObjectHostMessageRouting(RouteLane* lane) {
 #define MAX_OH_MESSAGES_HANDLED 100
 
+    LaneRoutedBatch* batch = new LaneRoutedBatch();
+    batch->reserve(MAX_OH_MESSAGES_HANDLED);
     for(uint32 i = 0; i < MAX_OH_MESSAGES_HANDLED; i++)
-        if (!handleSingleObjectHostMessageRouting())
+        if (!handleSingleObjectHostMessageRouting(lane, batch))
             break;
 
+    // One post per drained batch. Batches from this lane are posted in order,
+    // so messages from each connection stay in order.
+    if (batch->empty()) {
+        delete batch;
+    }
+    else {
+        mContext->mainStrand->post(
+            std::tr1::bind(&Server::finishObjectHostMessageRouting, this, batch),
+            "Server::finishObjectHostMessageRouting"
+        );
+    }
+
     {
-        boost::lock_guard<boost::mutex> lock(mRouteObjectMessageMutex);
-        if (!mRouteObjectMessage.probablyEmpty())
-            scheduleObjectHostMessageRouting();
+        boost::lock_guard<boost::mutex> lock(lane->mutex);
+        if (!lane->queue.probablyEmpty())
+            scheduleObjectHostMessageRouting(lane);
     }
 }
 
-bool Server::handleSingleObjectHostMessageRouting() {
+bool Server::handleSingleObjectHostMessageRouting(RouteLane* lane, LaneRoutedBatch* batch) {
     ConnectionIDObjectMessagePair front(ObjectHostConnectionID(),NULL);
-    if (!mRouteObjectMessage.pop(front))
+    if (!lane->queue.pop(front))
         return false;
+    lane->depth--;
 
     UUID source_object = front.obj_msg->source_object();
 
@@ -470,20 +520,8 @@ bool Server::handleSingleObjectHostMessageRouting() {
             return true;
         }
 
-        // We need to translate identifiers. The space identifiers are ignored
-        // on the space server (only one space to deal with, unlike object
-        // hosts). The NodeID uses null() for the local (destination) endpoint
-        // and the short ID of the object host connection for the remote
-        // (source).
-        ShortObjectHostConnectionID ohdp_node_id = front.conn_id.shortID();
-
-        OHDP::DelegateService::deliver(
-            OHDP::Endpoint(SpaceID::null(), OHDP::NodeID(ohdp_node_id), front.obj_msg->source_port()),
-            OHDP::Endpoint(SpaceID::null(), OHDP::NodeID::null(), front.obj_msg->dest_port()),
-            MemoryReference(front.obj_msg->payload())
-        );
-        delete front.obj_msg;
-
+        // OHDP delivery needs the main strand
+        batch->push_back(LaneRoutedMessage(LaneRoutedMessage::OHDP, front));
         return true;
     }
 
@@ -494,30 +532,81 @@ bool Server::handleSingleObjectHostMessageRouting() {
     // connections and allow messages through.
     // NOTE that we check connecting objects as well since we need to get past this point to deliver
     // Session messages.
-    bool source_connected =
-        mObjects.find(source_object) != mObjects.end() ||
-        mMigratingConnections.find(source_object) != mMigratingConnections.end();
-    if (!source_connected)
+    bool source_connected = false;
+    if (!mRoutableObjects.get(source_object, &source_connected))
     {
-        if (mObjectsAwaitingMigration.find(source_object) == mObjectsAwaitingMigration.end() &&
-            mObjectMigrations.find(source_object) == mObjectMigrations.end())
-        {
-            SPACE_LOG(warn,"Got message for unknown object: " << source_object.toString());
-        }
-        else
-        {
-            SPACE_LOG(warn,"Server got message from object after migration started: " << source_object.toString());
+        batch->push_back(LaneRoutedMessage(LaneRoutedMessage::Unroutable, front));
+        return true;
+    }
+
+
+    // Finally, if we've passed all these tests, then everything looks good and
+    // we can route it.
+    batch->push_back(LaneRoutedMessage(LaneRoutedMessage::Route, front));
+    return true;
+}
+
+void Server::finishObjectHostMessageRouting(LaneRoutedBatch* batch) {
+    for(LaneRoutedBatch::iterator it = batch->begin(); it != batch->end(); it++) {
+        switch(it->action) {
+          case LaneRoutedMessage::Route:
+            mForwarder->routeObjectHostMessage(it->msg.obj_msg);
+            break;
+          case LaneRoutedMessage::OHDP:
+            handleObjectHostOHDPMessage(it->msg.conn_id, it->msg.obj_msg);
+            break;
+          case LaneRoutedMessage::Unroutable:
+            handleUnroutableObjectHostMessage(it->msg.obj_msg);
+            break;
         }
+    }
+    delete batch;
+}
 
-        delete front.obj_msg;
+void Server::handleObjectHostOHDPMessage(const ObjectHostConnectionID& conn_id, Sirikata::Protocol::Object::ObjectMessage* msg) {
+    // We need to translate identifiers. The space identifiers are ignored
+    // on the space server (only one space to deal with, unlike object
+    // hosts). The NodeID uses null() for the local (destination) endpoint
+    // and the short ID of the object host connection for the remote
+    // (source).
+    ShortObjectHostConnectionID ohdp_node_id = conn_id.shortID();
+
+    OHDP::DelegateService::deliver(
+        OHDP::Endpoint(SpaceID::null(), OHDP::NodeID(ohdp_node_id), msg->source_port()),
+        OHDP::Endpoint(SpaceID::null(), OHDP::NodeID::null(), msg->dest_port()),
+        MemoryReference(msg->payload())
+    );
+    delete msg;
+}
 
-        return true;
+void Server::handleUnroutableObjectHostMessage(Sirikata::Protocol::Object::ObjectMessage* msg) {
+    UUID source_object = msg->source_object();
+    if (mObjectsAwaitingMigration.find(source_object) == mObjectsAwaitingMigration.end() &&
+        mObjectMigrations.find(source_object) == mObjectMigrations.end())
+    {
+        SPACE_LOG(warn,"Got message for unknown object: " << source_object.toString());
+    }
+    else
+    {
+        SPACE_LOG(warn,"Server got message from object after migration started: " << source_object.toString());
     }
 
+    delete msg;
+}
 
-    // Finally, if we've passed all these tests, then everything looks good and we can route it
-    mForwarder->routeObjectHostMessage(front.obj_msg);
-    return true;
+void Server::updateRoutableObject(const UUID& obj_id) {
+    bool routable =
+        mObjects.find(obj_id) != mObjects.end() ||
+        mMigratingConnections.find(obj_id) != mMigratingConnections.end();
+    if (routable)
+        mRoutableObjects.set(obj_id, true);
+    else
+        mRoutableObjects.erase(obj_id);
+}
+
+void Server::reportRouteLaneStats() {
+    for(uint32 i = 0; i < mRouteLanes.size(); i++)
+        mContext->timeSeries->report(mRouteLanes[i]->timeSeriesDepthName, mRouteLanes[i]->depth.read());
 }
 
 // Handle Session messages from an object
@@ -756,6 +845,7 @@ void Server::finishAddObject(const UUID& obj_id, OSegAddNewStatus status)
           // Create and store the connection
           ObjectConnection* conn = new ObjectConnection(obj_id, mObjectHostConnectionManager, sc.conn_id, sc.session_seqno);
           mObjects[obj_id] = conn;
+          updateRoutableObject(obj_id);
           mContext->timeSeries->report(mTimeSeriesObjects, mObjects.size());
 
           //TODO: assumes each server process is assigned only one region... perhaps we should enforce this constraint
@@ -912,6 +1002,7 @@ void Server::handleUniqueDisconnectWithDeletedObjectConnection(UUID obj_id) {
         mForwarder->removeObjectConnection(obj_id);
         
         mObjects.erase(obj_id);
+        updateRoutableObject(obj_id);
         // Num objects is reported by the caller
         
         ObjectReference obj(obj_id);
@@ -1028,6 +1119,7 @@ void Server::handleMigration(const UUID& obj_id)
 
     // Move from list waiting for migration message to active objects
     mObjects[obj_id] = obj_conn;
+    updateRoutableObject(obj_id);
     mContext->timeSeries->report(mTimeSeriesObjects, mObjects.size());
     mLocalForwarder->addActiveConnection(obj_conn);
 
@@ -1082,10 +1174,12 @@ void Server::handleMigration(const UUID& obj_id)
 
 void Server::start() {
     mForwarder->start();
+    mRouteLaneStatsPoller.start();
 }
 
 void Server::stop() {
     mForwarder->stop();
+    mRouteLaneStatsPoller.stop();
     mObjectHostConnectionManager->shutdown();
     mShutdownRequested = true;
 }
@@ -1191,6 +1285,7 @@ void Server::handleMigrationEvent(const UUID& obj_id) {
             mocd.serviceConnection    =                                      true;
 
             mMigratingConnections[obj_id] = mocd;
+            updateRoutableObject(obj_id);
 
 
 
@@ -1198,6 +1293,7 @@ void Server::handleMigrationEvent(const UUID& obj_id) {
             mLocationService->removeLocalObject(obj_id, (markObjectDisconnectingCallCount--,disconnectedCb));
             mLocalForwarder->removeActiveConnection(obj_id);
             mObjects.erase(obj_id);
+            updateRoutableObject(obj_id);
             mContext->timeSeries->report(mTimeSeriesObjects, mObjects.size());
             ObjectReference obj(obj_id);
 
@@ -1290,6 +1386,7 @@ void Server::processAlreadyMigrating(const UUID& obj_id)
     mLocalForwarder->removeActiveConnection( obj_id );
     // Move from list waiting for migration message to active objects
     mObjects[obj_id] = obj_conn;
+    updateRoutableObject(obj_id);
     mContext->timeSeries->report(mTimeSeriesObjects, mObjects.size());
     mLocalForwarder->addActiveConnection(obj_conn);
 
@@ -1389,6 +1486,7 @@ void Server::killObjectConnection(const UUID& obj_id)
     CONTEXT_SPACETRACE(objectMigrationRoundTrip, obj_id, mContext->id(), migTo , timeTakenMs);
 
     mMigratingConnections.erase(objConMapIt);
+    updateRoutableObject(obj_id);
   }
 }
 
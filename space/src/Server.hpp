@@ -39,6 +39,7 @@
 
 #include <sirikata/space/ObjectHostConnectionManager.hpp>
 #include <sirikata/core/service/Service.hpp>
+#include <sirikata/core/service/Poller.hpp>
 #include <sirikata/core/queue/SizedThreadSafeQueue.hpp>
 
 #include <sirikata/core/util/MotionVector.hpp>
@@ -56,6 +57,8 @@
 
 #include <sirikata/core/command/Commander.hpp>
 
+#include "ShardedObjectMap.hpp"
+
 namespace Sirikata
 {
 class Authenticator;
@@ -117,7 +120,7 @@ private:
     // Callback which handles messages from object hosts -- mostly just does sanity checking
     // before using the forwarder to do routing.  Operates in the
     // network strand to allow for fast forwarding, see
-    // handleObjectHostMessageRouting for continuation in main strand
+    // handleObjectHostMessageRouting for continuation in a routing lane
     virtual bool onObjectHostMessageReceived(const ObjectHostConnectionID& conn_id, const ShortObjectHostConnectionID short_conn_id, Sirikata::Protocol::Object::ObjectMessage*);
     // Disconnection events, forwarded to
     // handleObjectHostConnectionClosed in main strand
@@ -147,13 +150,31 @@ private:
 
     // Handle an object host closing its connection
     void handleObjectHostConnectionClosed(const ObjectHostConnectionID& conn_id);
-    // Schedule main thread to handle oh message routing
-    void scheduleObjectHostMessageRouting();
-    void handleObjectHostMessageRouting();
-    // Perform forwarding for a message on the front of mRouteObjectMessage from the object host which
-    // couldn't be forwarded directly by the networking code
-    // (i.e. needs routing to another node)
-    bool handleSingleObjectHostMessageRouting();
+
+    struct RouteLane;
+    struct LaneRoutedMessage;
+    typedef std::vector<LaneRoutedMessage> LaneRoutedBatch;
+    // Get the routing lane for messages from an object host connection
+    RouteLane* getRouteLane(const ObjectHostConnectionID& conn_id);
+    // Schedule a routing lane's strand to handle oh message routing
+    void scheduleObjectHostMessageRouting(RouteLane* lane);
+    void handleObjectHostMessageRouting(RouteLane* lane);
+    // Check a message on the front of a routing lane's queue from the object
+    // host which couldn't be forwarded directly by the networking code
+    // (i.e. needs routing to another node), adding it to batch
+    bool handleSingleObjectHostMessageRouting(RouteLane* lane, LaneRoutedBatch* batch);
+    // Main strand continuation for a batch of messages checked by a routing
+    // lane. The forwarding decision needs the OSeg, which is only safe to use
+    // from the main strand.
+    void finishObjectHostMessageRouting(LaneRoutedBatch* batch);
+    // Main strand handlers for messages routing lanes can't route: OHDP
+    // messages and messages from objects we don't know about
+    void handleObjectHostOHDPMessage(const ObjectHostConnectionID& conn_id, Sirikata::Protocol::Object::ObjectMessage* msg);
+    void handleUnroutableObjectHostMessage(Sirikata::Protocol::Object::ObjectMessage* msg);
+    // Update mRoutableObjects after an object is added to or removed from
+    // mObjects or mMigratingConnections
+    void updateRoutableObject(const UUID& obj_id);
+    void reportRouteLaneStats();
 
     // Handle Session messages from an object
     void handleSessionMessage(const ObjectHostConnectionID& oh_conn_id, Sirikata::Protocol::Object::ObjectMessage* msg);
@@ -225,7 +246,8 @@ private:
                                   // only still a map to handle migrations
                                   // properly
     typedef std::tr1::unordered_map<UUID,int,UUID::Hasher> DisconnectingObjectMap;
-    ///Maps UUID to a count of the number of services we need callbacks from: guarded by mRouteObjectMessageMutex
+    ///Maps UUID to a count of the number of services we need callbacks from: guarded by mDisconnectingObjectsMutex
+    boost::mutex mDisconnectingObjectsMutex;
     DisconnectingObjectMap mDisconnectingObjects;
     bool isObjectDisconnecting(const UUID &object)const;
     ///Other services end up calling this callback to mark an object as being disconnected. Bound by the handleDisconnect function which passes this to the service for the final disconnection call
@@ -285,10 +307,45 @@ private:
         }
     };
 
-    // FIXME Another place where needing a size queue and notifications causes
-    // double locking...
-    boost::mutex mRouteObjectMessageMutex;
-    Sirikata::SizedThreadSafeQueue<ConnectionIDObjectMessagePair>mRouteObjectMessage;
+    // Messages from object hosts which need routing decisions are handled in
+    // lanes, each with its own queue and strand so they are processed in
+    // parallel. All messages from an object host connection go through the
+    // same lane, so they stay in order.
+    struct RouteLane {
+        RouteLane(SpaceContext* ctx, uint32 idx, size_t buffer_size);
+        ~RouteLane();
+
+        Network::IOStrand* strand;
+        // FIXME Another place where needing a size queue and notifications causes
+        // double locking...
+        boost::mutex mutex;
+        Sirikata::SizedThreadSafeQueue<ConnectionIDObjectMessagePair> queue;
+        AtomicValue<uint32> depth;
+        const String timeSeriesDepthName;
+    };
+    // What a routing lane decided to do with a message
+    struct LaneRoutedMessage {
+        enum Action {
+            Route,
+            OHDP,
+            Unroutable
+        };
+
+        LaneRoutedMessage(Action act, const ConnectionIDObjectMessagePair& m)
+         : action(act), msg(m)
+        {}
+
+        Action action;
+        ConnectionIDObjectMessagePair msg;
+    };
+    typedef std::vector<RouteLane*> RouteLaneList;
+    RouteLaneList mRouteLanes;
+    Poller mRouteLaneStatsPoller;
+
+    // Objects we'll accept messages from, i.e. those in mObjects or
+    // mMigratingConnections. Those are only safe to use from the main strand,
+    // so this copy is kept for the routing lanes.
+    ShardedObjectMap<bool> mRoutableObjects;
 
     // TimeSeries identifiers. Must include the ServerID for uniqueness, so we
     // cache them so TimeSeries reports are fast
@@ -80,17 +80,16 @@ uint32 ServerMessageQueue::trySend(const ServerID& dest, const Message* msg) {
     if (strm_out==NULL) {
         return 0;
     }
-    Network::Chunk serialized;
-    msg->serialize(&serialized);
-    uint32 packet_size = serialized.size();
-    bool sent_success = strm_out->send(serialized);
-
-    if (sent_success) {
-        TIMESTAMP_PAYLOAD(msg, Trace::SPACE_TO_SPACE_HIT_NETWORK);
-        return packet_size;
-    }
+    // The stream records SPACE_TO_SPACE_HIT_NETWORK when it actually writes
+    // the message, which may be after it's batched with others.
+    return strm_out->send(msg); // 0 if failed
+}
 
-    return 0; // Failed
+void ServerMessageQueue::flushSendStreams() {
+    for(SendStreamMap::iterator it = mSendStreams.begin(); it != mSendStreams.end(); it++) {
+        if (it->second != NULL)
+            it->second->flush();
+    }
 }
 
 double ServerMessageQueue::totalUsedWeight() {
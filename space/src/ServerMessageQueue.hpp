@@ -96,6 +96,10 @@ public:
     // successful. Helper method for implementations.
     // If sent, returns the size of the serialized packet.  Otherwise, returns 0.
     uint32 trySend(const ServerID& addr, const Message* msg);
+    // Streams may hold messages accepted by trySend so they can be written
+    // together. Implementations must call this after each round of trySend
+    // calls. Must be called from mSenderStrand.
+    void flushSendStreams();
     double mCapacityOverestimate;
     SpaceContext* mContext;
     Network::IOStrand* mSenderStrand;
@@ -0,0 +1,115 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_SPACE_SHARDED_OBJECT_MAP_HPP_
+#define _SIRIKATA_SPACE_SHARDED_OBJECT_MAP_HPP_
+
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/util/UUID.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+namespace Sirikata {
+
+/** Thread safe map from object UUID to per-object data. The map is split into
+ *  NUM_SHARDS independently locked shards, chosen by the UUID's hash, so
+ *  threads working on different objects rarely contend for the same lock.
+ *  Values are returned by copy since the entry may be removed as soon as the
+ *  shard's lock is released, so ValueType should be small, e.g. a pointer.
+ */
+template<typename ValueType>
+class ShardedObjectMap : Noncopyable {
+public:
+    enum {
+        NUM_SHARDS = 32
+    };
+
+    ShardedObjectMap() {}
+
+    /** Look up the value for an object.
+     *  \param id the object to look up
+     *  \param result storage for the value if one is found
+     *  \returns true if the object was found
+     */
+    bool get(const UUID& id, ValueType* result) const {
+        const Shard& shard = shardFor(id);
+        boost::lock_guard<boost::mutex> lck(shard.mutex);
+        typename Map::const_iterator it = shard.map.find(id);
+        if (it == shard.map.end())
+            return false;
+        *result = it->second;
+        return true;
+    }
+
+    /** Set the value for an object, replacing any existing value. */
+    void set(const UUID& id, const ValueType& value) {
+        Shard& shard = shardFor(id);
+        boost::lock_guard<boost::mutex> lck(shard.mutex);
+        shard.map[id] = value;
+    }
+
+    /** Add a value for an object if it doesn't already have one.
+     *  \returns true if the value was added, false if one already existed
+     */
+    bool insert(const UUID& id, const ValueType& value) {
+        Shard& shard = shardFor(id);
+        boost::lock_guard<boost::mutex> lck(shard.mutex);
+        return shard.map.insert( typename Map::value_type(id, value) ).second;
+    }
+
+    /** Remove an object's entry.
+     *  \param id the object to remove
+     *  \param removed if non-NULL, storage for the value that was removed
+     *  \returns true if the object was found and removed
+     */
+    bool erase(const UUID& id, ValueType* removed = NULL) {
+        Shard& shard = shardFor(id);
+        boost::lock_guard<boost::mutex> lck(shard.mutex);
+        typename Map::iterator it = shard.map.find(id);
+        if (it == shard.map.end())
+            return false;
+        if (removed != NULL)
+            *removed = it->second;
+        shard.map.erase(it);
+        return true;
+    }
+
+    /** Get the total number of entries. Shards are locked one at a time, so
+     *  this is only a snapshot if nothing is modifying the map.
+     */
+    size_t size() const {
+        size_t result = 0;
+        for(uint32 i = 0; i < NUM_SHARDS; i++) {
+            boost::lock_guard<boost::mutex> lck(mShards[i].mutex);
+            result += mShards[i].map.size();
+        }
+        return result;
+    }
+
+private:
+    typedef std::tr1::unordered_map<UUID, ValueType, UUID::Hasher> Map;
+    struct Shard {
+        mutable boost::mutex mutex;
+        Map map;
+    };
+
+    // The high bits of the hash pick the shard so the low bits, which the
+    // per-shard maps use for buckets, stay well distributed within a shard.
+    uint32 shardIndex(const UUID& id) const {
+        size_t h = id.hash();
+        return (uint32)((h ^ (h >> 16)) >> 8) % NUM_SHARDS;
+    }
+    Shard& shardFor(const UUID& id) {
+        return mShards[shardIndex(id)];
+    }
+    const Shard& shardFor(const UUID& id) const {
+        return mShards[shardIndex(id)];
+    }
+
+    Shard mShards[NUM_SHARDS];
+};
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_SPACE_SHARDED_OBJECT_MAP_HPP_
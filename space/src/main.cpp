@@ -56,7 +56,7 @@
 #include <sirikata/core/util/PluginManager.hpp>
 #include <sirikata/core/trace/Trace.hpp>
 #include <sirikata/core/command/Commander.hpp>
-#include "TCPSpaceNetwork.hpp"
+#include "../../libspace/src/TCPSpaceNetwork.hpp"
 #include "FairServerMessageReceiver.hpp"
 #include "FairServerMessageQueue.hpp"
 #include <sirikata/core/network/ServerIDMap.hpp>
@@ -64,8 +64,9 @@
 #include "CoordinateSegmentationClient.hpp"
 #include <sirikata/space/LoadMonitor.hpp>
 #include <sirikata/space/ObjectSegmentation.hpp>
-#include "caches/CommunicationCache.hpp"
-#include "caches/CacheLRUOriginal.hpp"
+#include "../../libspace/src/caches/CommunicationCache.hpp"
+#include "../../libspace/src/caches/CacheLRUOriginal.hpp"
+#include "../../libspace/src/caches/ShardedClockCache.hpp"
 
 #include <sirikata/space/SpaceContext.hpp>
 #include <sirikata/mesh/Filter.hpp>
@@ -196,7 +197,12 @@ int main(int argc, char** argv) {
     Sirikata::SpaceNetwork* gNetwork = NULL;
     String network_type = GetOptionValue<String>(NETWORK_TYPE);
     if (network_type == "tcp")
-      gNetwork = new TCPSpaceNetwork(space_context);
+      gNetwork = new TCPSpaceNetwork(
+          space_context,
+          GetOptionValue<String>("spacestreamlib"),
+          GetOptionValue<String>("spacestreamoptions"),
+          GetOptionValue<uint32>("spacestreambatchsize")
+      );
 
     BoundingBox3f region = GetOptionValue<BoundingBox3f>("region");
     Vector3ui32 layout = GetOptionValue<Vector3ui32>("layout");
@@ -280,6 +286,11 @@ int main(int argc, char** argv) {
         Duration entryLifetime = GetOptionValue<Duration>(OSEG_CACHE_ENTRY_LIFETIME);
         oseg_cache = new CacheLRUOriginal(space_context, cacheSize, cacheCleanGroupSize, entryLifetime);
     }
+    else if (cacheSelector == CACHE_TYPE_SHARDED_CLOCK) {
+        uint32 cacheShards = GetOptionValue<uint32>(OSEG_CACHE_SHARDS);
+        Duration entryLifetime = GetOptionValue<Duration>(OSEG_CACHE_ENTRY_LIFETIME);
+        oseg_cache = new ShardedClockCache(space_context, cacheSize, cacheShards, entryLifetime);
+    }
     else {
         std::cout<<"\n\nUNKNOWN CACHE TYPE SELECTED.  Please re-try.\n\n";
         std::cout.flush();
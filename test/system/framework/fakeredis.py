@@ -0,0 +1,214 @@
+#!/usr/bin/env python
+
+'''
+A tiny in-memory stand-in for a Redis server, enough to run a space
+server with the redis OSeg without a real Redis installation. It
+speaks the Redis protocol and supports the commands the OSeg uses:
+PING, GET, MGET, SET, SETNX, EXPIRE, DEL, MULTI and EXEC. Expiry times
+are tracked and expired keys are removed when they're accessed.
+
+INFO returns per-command call counts in the same format as Redis'
+commandstats section, e.g. cmdstat_mget:calls=3, so tests can check
+how the server was used.
+
+Run it as a separate process:
+
+  python fakeredis.py --port=6379
+'''
+
+from __future__ import print_function
+import sys, time, socket, threading
+
+try:
+    import SocketServer as socketserver
+except ImportError:
+    import socketserver
+
+
+class Status(object):
+    '''A status reply, kept distinct from bulk strings'''
+    def __init__(self, msg):
+        self.msg = msg
+
+
+class FakeRedisStore(object):
+    '''Key/value data and command statistics shared by all connections'''
+
+    def __init__(self):
+        self._lock = threading.Lock()
+        self._data = {}
+        self._expires = {}
+        self._calls = {}
+
+    def _expire_key(self, key):
+        if key in self._expires and self._expires[key] <= time.time():
+            del self._expires[key]
+            del self._data[key]
+
+    def record(self, cmd):
+        with self._lock:
+            self._calls[cmd] = self._calls.get(cmd, 0) + 1
+
+    def execute(self, args):
+        '''Execute a single command, returning a reply value: Status,
+        bytes for bulk, int, None for nil, list or Exception.'''
+        cmd = args[0].decode('ascii', 'replace').lower()
+        handler = getattr(self, 'cmd_' + cmd, None)
+        if handler is None:
+            return Exception("ERR unknown command '" + cmd + "'")
+        self.record(cmd)
+        with self._lock:
+            try:
+                return handler(*args[1:])
+            except TypeError:
+                return Exception("ERR wrong number of arguments for '" + cmd + "' command")
+
+    def cmd_ping(self):
+        return Status('PONG')
+
+    def cmd_get(self, key):
+        self._expire_key(key)
+        return self._data.get(key)
+
+    def cmd_mget(self, *keys):
+        return [self.cmd_get(key) for key in keys]
+
+    def cmd_set(self, key, val):
+        self._data[key] = val
+        self._expires.pop(key, None)
+        return Status('OK')
+
+    def cmd_setnx(self, key, val):
+        self._expire_key(key)
+        if key in self._data: return 0
+        self._data[key] = val
+        return 1
+
+    def cmd_expire(self, key, seconds):
+        self._expire_key(key)
+        if key not in self._data: return 0
+        self._expires[key] = time.time() + int(seconds)
+        return 1
+
+    def cmd_del(self, *keys):
+        count = 0
+        for key in keys:
+            self._expire_key(key)
+            if key in self._data:
+                del self._data[key]
+                self._expires.pop(key, None)
+                count += 1
+        return count
+
+    def cmd_info(self, *section):
+        lines = ['# Commandstats']
+        for cmd, calls in sorted(self._calls.items()):
+            lines.append('cmdstat_%s:calls=%d' % (cmd, calls))
+        return ('\r\n'.join(lines) + '\r\n').encode('ascii')
+
+
+class FakeRedisHandler(socketserver.StreamRequestHandler):
+    '''Handles one client connection, including MULTI/EXEC state'''
+
+    def _read_command(self):
+        line = self.rfile.readline()
+        if not line: return None
+        if not line.startswith(b'*'):
+            # Inline command, e.g. from telnet
+            return line.strip().split()
+        args = []
+        for i in range(int(line[1:])):
+            size = int(self.rfile.readline()[1:])
+            args.append(self.rfile.read(size + 2)[:-2])
+        return args
+
+    def _encode(self, reply):
+        if reply is None:
+            return b'$-1\r\n'
+        if isinstance(reply, Status):
+            return ('+' + reply.msg + '\r\n').encode('ascii')
+        if isinstance(reply, Exception):
+            return ('-' + str(reply) + '\r\n').encode('ascii')
+        if isinstance(reply, bool) or isinstance(reply, int):
+            return (':%d\r\n' % reply).encode('ascii')
+        if isinstance(reply, list):
+            return ('*%d\r\n' % len(reply)).encode('ascii') + b''.join([self._encode(x) for x in reply])
+        return ('$%d\r\n' % len(reply)).encode('ascii') + reply + b'\r\n'
+
+    def handle(self):
+        store = self.server.store
+        queued = None
+        while True:
+            args = self._read_command()
+            if args is None: break
+            if not args: continue
+
+            cmd = args[0].lower()
+            if cmd in (b'multi', b'exec'):
+                store.record(cmd.decode('ascii'))
+
+            if cmd == b'multi':
+                if queued is not None:
+                    reply = Exception('ERR MULTI calls can not be nested')
+                else:
+                    queued = []
+                    reply = Status('OK')
+            elif cmd == b'exec':
+                if queued is None:
+                    reply = Exception('ERR EXEC without MULTI')
+                else:
+                    reply = [store.execute(x) for x in queued]
+                    queued = None
+            elif queued is not None:
+                queued.append(args)
+                reply = Status('QUEUED')
+            else:
+                reply = store.execute(args)
+
+            self.wfile.write(self._encode(reply))
+            self.wfile.flush()
+
+
+class FakeRedisServer(socketserver.ThreadingMixIn, socketserver.TCPServer):
+    allow_reuse_address = True
+    daemon_threads = True
+
+    def __init__(self, port, host='127.0.0.1'):
+        socketserver.TCPServer.__init__(self, (host, port), FakeRedisHandler)
+        self.store = FakeRedisStore()
+
+
+def info(port, host='127.0.0.1'):
+    '''
+    Connect to a (fake) Redis server and return a dict of command name
+    -> number of calls, parsed from INFO commandstats.
+    '''
+    conn = socket.create_connection((host, port), timeout=5)
+    conn.sendall(b'*2\r\n$4\r\nINFO\r\n$12\r\ncommandstats\r\n')
+    fp = conn.makefile('rb')
+    size = int(fp.readline()[1:])
+    data = fp.read(size).decode('ascii')
+    fp.close()
+    conn.close()
+
+    result = {}
+    for line in data.split('\r\n'):
+        if not line.startswith('cmdstat_'): continue
+        name, stats = line[len('cmdstat_'):].split(':', 1)
+        for stat in stats.split(','):
+            key, val = stat.split('=', 1)
+            if key == 'calls': result[name] = int(val)
+    return result
+
+
+if __name__ == "__main__":
+    port = 6379
+    for arg in sys.argv[1:]:
+        if arg.startswith('--port='):
+            port = int(arg.split('=', 1)[1])
+
+    server = FakeRedisServer(port)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
@@ -52,6 +52,30 @@ class OneManualSS(OneSS):
     def ohArgs(self):
         return dict(OneSS.ohArgs(self).items() + ({'oh.query-processor' : 'manual', 'moduleloglevel' : 'manual-query-processor=detailed'}).items())
 
+class OneThreadedSS(OneSS):
+    '''
+    Mixin to specify 1 space server ticking query handlers on multiple prox threads, 1 OH
+    '''
+
+    def spaceArgs(self):
+        return dict(OneSS.spaceArgs(self).items() + ({'prox.threads' : '4'}).items())
+
+class OneAdaptiveTickSS(OneSS):
+    '''
+    Mixin to specify 1 space server only ticking query handlers when objects or queries change, 1 OH
+    '''
+
+    def spaceArgs(self):
+        return dict(OneSS.spaceArgs(self).items() + ({'prox.tick-mode' : 'adaptive'}).items())
+
+class OneGridSS(OneSS):
+    '''
+    Mixin to specify 1 space server using grid query handlers, 1 OH
+    '''
+
+    def spaceArgs(self):
+        return dict(OneSS.spaceArgs(self).items() + ({'prox.object.handler' : 'grid', 'prox.server.handler' : 'grid'}).items())
+
 
 
 class MultipleSS(object):
@@ -168,6 +192,15 @@ class OneSSConnectionTest(ConnectionTest, OneSS):
 class OneSSManualConnectionTest(ConnectionTest, OneManualSS):
     pass
 
+class OneSSThreadedConnectionTest(ConnectionTest, OneThreadedSS):
+    pass
+
+class OneSSAdaptiveTickConnectionTest(ConnectionTest, OneAdaptiveTickSS):
+    pass
+
+class OneSSGridConnectionTest(ConnectionTest, OneGridSS):
+    pass
+
 class MultipleSSConnectionTest(ConnectionTest, MultipleSS):
     pass
 
@@ -210,6 +243,15 @@ class OneSSBasicQueryTest(BasicQueryTest, OneSS):
 class OneSSManualBasicQueryTest(BasicQueryTest, OneManualSS):
     after = [OneSSManualConnectionTest]
 
+class OneSSThreadedBasicQueryTest(BasicQueryTest, OneThreadedSS):
+    after = [OneSSThreadedConnectionTest]
+
+class OneSSAdaptiveTickBasicQueryTest(BasicQueryTest, OneAdaptiveTickSS):
+    after = [OneSSAdaptiveTickConnectionTest]
+
+class OneSSGridBasicQueryTest(BasicQueryTest, OneGridSS):
+    after = [OneSSGridConnectionTest]
+
 class MultipleSSBasicQueryTest(BasicQueryTest, MultipleSS):
     after = [MultipleSSConnectionTest]
 
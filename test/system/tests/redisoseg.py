@@ -0,0 +1,51 @@
+#!/usr/bin/env python
+
+from __future__ import print_function
+from proximity import ProximityTest, OneSS
+from httpcommand import OHObjectTest
+import framework.fakeredis as fakeredis
+import os.path, random, subprocess, sys, time
+
+class OneSSFakeRedis(OneSS):
+    '''
+    Mixin to specify 1 space server using the redis OSeg, backed by a
+    fake redis server so no real Redis installation is needed, 1 OH
+    '''
+
+    redis_port = random.randint(16000, 17000)
+
+    def spaceArgs(self):
+        return dict(OneSS.spaceArgs(self).items() + ({
+                    'oseg' : 'redis',
+                    'oseg-options' : '--port=' + str(self.redis_port) + ' --batch-delay=1ms'
+                    }).items())
+
+    def testPre(self):
+        self._redis_output = open(os.path.join(self._folder, 'fakeredis.log'), 'w')
+        fakeredis_script = os.path.splitext(fakeredis.__file__)[0] + '.py'
+        self._redis = subprocess.Popen([sys.executable, fakeredis_script, '--port=' + str(self.redis_port)],
+                                       stdout=self._redis_output, stderr=subprocess.STDOUT)
+        # Give it a moment to start listening before the space server connects
+        time.sleep(1)
+
+    def testPost(self):
+        try:
+            stats = fakeredis.info(self.redis_port)
+            # Object registrations are batched into transactions
+            self.assertIsIn('setnx', stats, 'Objects were never registered in redis')
+            self.assertIsIn('multi', stats, 'Object registrations not sent as transactions')
+            self.assertEqual(stats.get('multi'), stats.get('exec'), 'Unfinished redis transaction')
+        finally:
+            self._redis.terminate()
+            self._redis.wait()
+            self._redis_output.close()
+
+
+class RedisOSegConnectionTest(ProximityTest):
+    after = [ OHObjectTest ]
+
+    def testBody(self):
+        response = self.createObject('oh', 'proximityTests/connectionTest.em');
+
+class OneSSFakeRedisConnectionTest(RedisOSegConnectionTest, OneSSFakeRedis):
+    pass
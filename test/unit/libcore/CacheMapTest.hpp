@@ -0,0 +1,179 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/transfer/MemoryCacheLayer.hpp>
+#include <sirikata/core/transfer/LRUPolicy.hpp>
+#include <sirikata/core/transfer/ClockPolicy.hpp>
+#include <boost/thread.hpp>
+#include <boost/lexical_cast.hpp>
+
+using namespace Sirikata;
+using namespace Sirikata::Transfer;
+
+/** Sits below a MemoryCacheLayer, generating file data and counting how often
+ *  the cache missed. Safe to call from many threads.
+ */
+class CacheMapTestSource : public CacheLayer {
+public:
+    CacheMapTestSource(uint32 fileSize)
+     : CacheLayer(NULL),
+       mFileSize(fileSize),
+       requests(0)
+    {}
+
+    virtual void getData(const Fingerprint &fileId, const Range &requestedRange,
+        const TransferCallback&callback) {
+        ++requests;
+        MutableDenseDataPtr data(new DenseData(Range(0, mFileSize, LENGTH, true)));
+        for(uint32 i = 0; i < data->length(); i++)
+            data->writableData()[i] = (unsigned char)(fileId.rawData()[0] + i);
+        populateParentCaches(fileId, data);
+        SparseData sparse;
+        sparse.addValidData(data);
+        callback(&sparse);
+    }
+
+    uint32 mFileSize;
+    AtomicValue<uint32> requests;
+};
+
+/** Exposes a policy's free space so tests can check the cache stayed within
+ *  its limit.
+ */
+template<typename PolicyType>
+class CacheMapTestPolicy : public PolicyType {
+public:
+    CacheMapTestPolicy(cache_usize_type allocatedSpace)
+     : PolicyType(allocatedSpace)
+    {}
+
+    cache_ssize_type freeSpace() const {
+        return this->mFreeSpace;
+    }
+};
+
+class CacheMapTest : public CxxTest::TestSuite
+{
+    std::vector<Fingerprint> mIds;
+    AtomicValue<uint32> mErrors;
+
+    void checkData(const Fingerprint& id, const SparseData* data) {
+        Range::length_type len;
+        const unsigned char* ptr = data ? data->dataAt(10, len) : NULL;
+        if (ptr == NULL || *ptr != (unsigned char)(id.rawData()[0] + 10))
+            ++mErrors;
+    }
+
+    void getData(CacheLayer* layer, const Fingerprint& id) {
+        layer->getData(id, Range(true), std::tr1::bind(&CacheMapTest::checkData, this, id, std::tr1::placeholders::_1));
+    }
+
+    void stressThread(CacheLayer* layer, uint32 seed, int numRequests) {
+        // Most requests go to a small hot set so there are hits as well as
+        // evictions.
+        for(int i = 0; i < numRequests; i++) {
+            seed = seed * 1103515245 + 12345;
+            uint32 r = seed >> 8;
+            size_t idx = (r % 4 == 0) ? (r % mIds.size()) : (r % (mIds.size() / 8));
+            if (r % 64 == 0)
+                layer->purgeFromCache(mIds[idx]);
+            else
+                getData(layer, mIds[idx]);
+        }
+    }
+
+    template<typename PolicyType>
+    void stress(PolicyType* policy, uint32 fileSize) {
+        CacheMapTestSource source(fileSize);
+        MemoryCacheLayer memory(policy, &source);
+
+        const int kThreads = 8, kRequests = 5000;
+        std::vector<boost::thread*> threads;
+        for(int i = 0; i < kThreads; i++)
+            threads.push_back(new boost::thread(std::tr1::bind(&CacheMapTest::stressThread, this, &memory, (uint32)(i+1), kRequests)));
+        for(int i = 0; i < kThreads; i++) {
+            threads[i]->join();
+            delete threads[i];
+        }
+
+        TS_ASSERT_EQUALS(mErrors.read(), (uint32)0);
+        // Some requests should have been served from memory
+        TS_ASSERT(source.requests.read() < (uint32)(kThreads * kRequests));
+
+        // And the cache must not have grown past its limit
+        TS_ASSERT(policy->freeSpace() >= 0);
+    }
+
+public:
+    void setUp() {
+        mIds.clear();
+        for(int i = 0; i < 256; i++)
+            mIds.push_back(Fingerprint::computeDigest(boost::lexical_cast<String>(i)));
+        mErrors = 0;
+    }
+
+    void testClockPolicySecondChance() {
+        ClockPolicy policy(1000, 0.5, 0);
+        CacheMapTestSource source(100);
+        MemoryCacheLayer memory(&policy, &source);
+
+        // Fill the cache
+        for(int i = 0; i < 10; i++)
+            getData(&memory, mIds[i]);
+        TS_ASSERT_EQUALS(source.requests.read(), (uint32)10);
+
+        // New entries start out referenced, so the first eviction sweeps the
+        // whole ring, clearing every bit, before it evicts 0.
+        getData(&memory, mIds[10]);
+        TS_ASSERT_EQUALS(source.requests.read(), (uint32)11);
+
+        // Now reference 1, which is next under the hand, and force another
+        // eviction. 1 gets a second chance and 2 is evicted instead.
+        getData(&memory, mIds[1]);
+        TS_ASSERT_EQUALS(source.requests.read(), (uint32)11);
+        getData(&memory, mIds[11]);
+        TS_ASSERT_EQUALS(source.requests.read(), (uint32)12);
+
+        getData(&memory, mIds[1]);
+        TS_ASSERT_EQUALS(source.requests.read(), (uint32)12);
+        getData(&memory, mIds[2]);
+        TS_ASSERT_EQUALS(source.requests.read(), (uint32)13);
+        TS_ASSERT_EQUALS(mErrors.read(), (uint32)0);
+    }
+
+    void testClockPolicyBatchEviction() {
+        // Evicting for one entry frees an extra 20% of the cache, so the
+        // next two insertions don't need to evict anything.
+        ClockPolicy policy(1000, 0.5, 0.2);
+        CacheMapTestSource source(100);
+        MemoryCacheLayer memory(&policy, &source);
+
+        for(int i = 0; i < 11; i++)
+            getData(&memory, mIds[i]);
+        // 0, 1 and 2 were evicted together
+        for(int i = 3; i < 11; i++)
+            getData(&memory, mIds[i]);
+        TS_ASSERT_EQUALS(source.requests.read(), (uint32)11);
+
+        getData(&memory, mIds[11]);
+        getData(&memory, mIds[12]);
+        // Nothing else was evicted to make room
+        for(int i = 3; i < 13; i++)
+            getData(&memory, mIds[i]);
+        TS_ASSERT_EQUALS(source.requests.read(), (uint32)13);
+        TS_ASSERT_EQUALS(mErrors.read(), (uint32)0);
+    }
+
+    void testClockPolicyStress() {
+        CacheMapTestPolicy<ClockPolicy> policy(100*1000);
+        stress(&policy, 1000);
+    }
+
+    void testLRUPolicyStress() {
+        CacheMapTestPolicy<LRUPolicy> policy(100*1000);
+        stress(&policy, 1000);
+    }
+};
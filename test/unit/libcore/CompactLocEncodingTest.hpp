@@ -0,0 +1,208 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/util/CompactLocEncoding.hpp>
+#include <sirikata/core/util/Random.hpp>
+
+using namespace Sirikata;
+
+class CompactLocEncodingTest : public CxxTest::TestSuite
+{
+    Time mBaseTime;
+
+    CompactLocRecord randomRecord(uint64 seqno) {
+        CompactLocRecord rec;
+        rec.object = UUID::random();
+        rec.seqno = seqno;
+        rec.fields = CompactLocRecord::LocationField | CompactLocRecord::OrientationField;
+        rec.location = TimedMotionVector3f(
+            mBaseTime + Duration::milliseconds((int64)randInt<int32>(-1000, 1000)),
+            MotionVector3f(
+                Vector3f(randFloat(-1000.f, 1000.f), randFloat(-1000.f, 1000.f), randFloat(-50.f, 50.f)),
+                Vector3f(randFloat(-5.f, 5.f), randFloat(-5.f, 5.f), 0.f)
+            )
+        );
+        Quaternion orient(Vector3f(randFloat(-1.f, 1.f), randFloat(-1.f, 1.f), randFloat(-1.f, 1.f)).normal(), randFloat(-3.f, 3.f));
+        Quaternion orient_vel = (randInt<int32>(0, 1) == 0) ? Quaternion::identity() : Quaternion(Vector3f(0.f, 0.f, 1.f), 0.5f);
+        rec.orientation = TimedMotionQuaternion(rec.location.updateTime(), MotionQuaternion(orient, orient_vel));
+        return rec;
+    }
+
+    void checkLocation(const CompactLocRecord& orig, const CompactLocRecord& decoded, float32 precision) {
+        TS_ASSERT_EQUALS(orig.location.updateTime(), decoded.location.updateTime());
+        TS_ASSERT_DELTA(orig.location.position().x, decoded.location.position().x, precision);
+        TS_ASSERT_DELTA(orig.location.position().y, decoded.location.position().y, precision);
+        TS_ASSERT_DELTA(orig.location.position().z, decoded.location.position().z, precision);
+        TS_ASSERT_DELTA(orig.location.velocity().x, decoded.location.velocity().x, precision);
+        TS_ASSERT_DELTA(orig.location.velocity().y, decoded.location.velocity().y, precision);
+        TS_ASSERT_DELTA(orig.location.velocity().z, decoded.location.velocity().z, precision);
+    }
+
+    void checkOrientation(const Quaternion& orig, const Quaternion& decoded) {
+        // q and -q are the same rotation
+        float32 dot = fabs(orig.x*decoded.x + orig.y*decoded.y + orig.z*decoded.z + orig.w*decoded.w);
+        TS_ASSERT_DELTA(dot, 1.f, 1e-4f);
+    }
+
+public:
+    void setUp() {
+        mBaseTime = Time::null() + Duration::seconds(1000000);
+    }
+
+    void testRoundTrip() {
+        CompactLocEncoder encoder;
+        CompactLocDecoder decoder;
+
+        std::vector<CompactLocRecord> records;
+        for(uint32 i = 0; i < 20; i++) {
+            records.push_back(randomRecord(100 + i));
+            encoder.add(records.back());
+        }
+        // A record with everything except location and orientation
+        CompactLocRecord all;
+        all.object = UUID::random();
+        all.seqno = 50;
+        all.fields = CompactLocRecord::EpochField | CompactLocRecord::BoundsField |
+            CompactLocRecord::MeshField | CompactLocRecord::PhysicsField |
+            CompactLocRecord::QueryDataField | CompactLocRecord::IndexIDsField;
+        all.epoch = 12345678901ULL;
+        all.bounds = AggregateBoundingInfo(Vector3f(1.f, 2.f, 3.f), 4.5f, 6.25f);
+        all.mesh = "meerkat:///test/duck.dae/optimized/0/duck.dae";
+        all.physics = "";
+        all.query_data = "{ \"angle\" : 0.1 }";
+        all.index_ids.push_back(3);
+        all.index_ids.push_back(70000);
+        records.push_back(all);
+        encoder.add(all);
+        TS_ASSERT_EQUALS(encoder.size(), records.size());
+
+        String msg;
+        encoder.finish(&msg);
+        TS_ASSERT(encoder.empty());
+
+        std::vector<CompactLocRecord> decoded;
+        TS_ASSERT(decoder.decode(msg.data(), msg.size(), &decoded));
+        TS_ASSERT_EQUALS(decoded.size(), records.size());
+        if (decoded.size() != records.size()) return;
+
+        for(uint32 i = 0; i < records.size(); i++) {
+            TS_ASSERT_EQUALS(decoded[i].object, records[i].object);
+            TS_ASSERT_EQUALS(decoded[i].seqno, records[i].seqno);
+            TS_ASSERT_EQUALS(decoded[i].fields, records[i].fields);
+            if (records[i].has(CompactLocRecord::LocationField))
+                checkLocation(records[i], decoded[i], encoder.precision());
+            if (records[i].has(CompactLocRecord::OrientationField)) {
+                TS_ASSERT_EQUALS(decoded[i].orientation.updateTime(), records[i].orientation.updateTime());
+                checkOrientation(records[i].orientation.position(), decoded[i].orientation.position());
+                checkOrientation(records[i].orientation.velocity(), decoded[i].orientation.velocity());
+            }
+        }
+
+        const CompactLocRecord& dall = decoded.back();
+        TS_ASSERT_EQUALS(dall.epoch, all.epoch);
+        TS_ASSERT_EQUALS(dall.bounds.centerOffset, all.bounds.centerOffset);
+        TS_ASSERT_EQUALS(dall.bounds.centerBoundsRadius, all.bounds.centerBoundsRadius);
+        TS_ASSERT_EQUALS(dall.bounds.maxObjectRadius, all.bounds.maxObjectRadius);
+        TS_ASSERT_EQUALS(dall.mesh, all.mesh);
+        TS_ASSERT_EQUALS(dall.physics, all.physics);
+        TS_ASSERT_EQUALS(dall.query_data, all.query_data);
+        TS_ASSERT(dall.index_ids == all.index_ids);
+    }
+
+    void testStringReferences() {
+        CompactLocEncoder encoder;
+        CompactLocDecoder decoder;
+        String mesh = "meerkat:///test/multimtl.dae/optimized/0/multimtl.dae";
+
+        CompactLocRecord rec;
+        rec.object = UUID::random();
+        rec.fields = CompactLocRecord::MeshField;
+        rec.mesh = mesh;
+
+        // Until a message defining the string is delivered, it must be sent in
+        // full every time.
+        String first, second;
+        encoder.add(rec);
+        uint32 first_id = encoder.finish(&first);
+        encoder.add(rec);
+        encoder.finish(&second);
+        TS_ASSERT(first.find(mesh) != String::npos);
+        TS_ASSERT(second.find(mesh) != String::npos);
+
+        // Within a single message, the second use is a reference
+        String both;
+        encoder.add(rec);
+        encoder.add(rec);
+        encoder.finish(&both);
+        TS_ASSERT_EQUALS(both.find(mesh), both.rfind(mesh));
+
+        // Once delivered, only the reference is sent
+        encoder.delivered(first_id);
+        String ref;
+        encoder.add(rec);
+        encoder.finish(&ref);
+        TS_ASSERT(ref.find(mesh) == String::npos);
+        TS_ASSERT(ref.size() < first.size());
+
+        std::vector<CompactLocRecord> decoded;
+        TS_ASSERT(decoder.decode(first.data(), first.size(), &decoded));
+        TS_ASSERT(decoder.decode(ref.data(), ref.size(), &decoded));
+        TS_ASSERT_EQUALS(decoded.size(), 2u);
+        if (decoded.size() == 2) {
+            TS_ASSERT(decoded[1].has(CompactLocRecord::MeshField));
+            TS_ASSERT_EQUALS(decoded[1].mesh, mesh);
+        }
+
+        // A decoder that never saw the definition drops the field instead of
+        // using a bogus value
+        CompactLocDecoder fresh_decoder;
+        decoded.clear();
+        TS_ASSERT(fresh_decoder.decode(ref.data(), ref.size(), &decoded));
+        TS_ASSERT_EQUALS(decoded.size(), 1u);
+        if (decoded.size() == 1)
+            TS_ASSERT(!decoded[0].has(CompactLocRecord::MeshField));
+
+        // After a reset, strings are sent in full again
+        encoder.reset();
+        String after_reset;
+        encoder.add(rec);
+        encoder.finish(&after_reset);
+        TS_ASSERT(after_reset.find(mesh) != String::npos);
+    }
+
+    void testSmallerThanFloats() {
+        // Nearby objects with a location and orientation should encode in well
+        // under the 16 + 28 + 32 bytes of raw ids, floats and times.
+        CompactLocEncoder encoder;
+        for(uint32 i = 0; i < 10; i++) {
+            CompactLocRecord rec = randomRecord(i);
+            rec.location = TimedMotionVector3f(
+                mBaseTime,
+                MotionVector3f(Vector3f(100.f + i, 200.f, 10.f), Vector3f(1.f, 0.f, 0.f))
+            );
+            encoder.add(rec);
+        }
+        String msg;
+        encoder.finish(&msg);
+        TS_ASSERT_LESS_THAN(msg.size(), 10u * 48u);
+    }
+
+    void testMalformed() {
+        CompactLocEncoder encoder;
+        CompactLocDecoder decoder;
+        encoder.add(randomRecord(1));
+        String msg;
+        encoder.finish(&msg);
+
+        std::vector<CompactLocRecord> decoded;
+        TS_ASSERT(!decoder.decode(msg.data(), 0, &decoded));
+        for(uint32 len = 1; len < msg.size(); len++)
+            TS_ASSERT(!decoder.decode(msg.data(), len, &decoded));
+        String bad_version = msg;
+        bad_version[0] = 0x7F;
+        TS_ASSERT(!decoder.decode(bad_version.data(), bad_version.size(), &decoded));
+    }
+};
@@ -0,0 +1,266 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/util/Paths.hpp>
+#include <sirikata/core/transfer/BlobStore.hpp>
+#include <sirikata/core/transfer/DiskCacheLayer.hpp>
+#include <sirikata/core/transfer/LRUPolicy.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+using namespace Sirikata;
+using namespace Sirikata::Transfer;
+
+/** Stands in for the network at the bottom of the cache layers, generating
+ *  file data and counting how often it has to.
+ */
+class DiskCacheTestSource : public CacheLayer {
+public:
+    DiskCacheTestSource()
+     : CacheLayer(NULL),
+       requests(0)
+    {}
+
+    virtual void getData(const Fingerprint &fileId, const Range &requestedRange,
+        const TransferCallback&callback) {
+        requests++;
+        MutableDenseDataPtr data(new DenseData(Range(0, 1000, LENGTH, true)));
+        for(uint32 i = 0; i < data->length(); i++)
+            data->writableData()[i] = (unsigned char)(fileId.rawData()[0] + i);
+        populateParentCaches(fileId, data);
+        SparseData sparse;
+        sparse.addValidData(data);
+        callback(&sparse);
+    }
+
+    int requests;
+};
+
+class DiskCacheLayerTest : public CxxTest::TestSuite
+{
+    String mDir;
+
+    boost::mutex mMutex;
+    boost::condition_variable mCV;
+    int mFinished;
+    bool mValid;
+
+    static MutableDenseDataPtr makeData(uint64 start, uint64 len, bool eof, unsigned char val) {
+        MutableDenseDataPtr data(new DenseData(Range(start, len, LENGTH, eof)));
+        memset(data->writableData(), val, (size_t)len);
+        return data;
+    }
+
+    static unsigned char byteAt(const SparseData& data, uint64 offset) {
+        Range::length_type len;
+        const unsigned char* ptr = data.dataAt(offset, len);
+        TS_ASSERT(ptr != NULL);
+        return ptr ? *ptr : 0;
+    }
+
+    void gotData(const Fingerprint& id, const SparseData* data) {
+        boost::unique_lock<boost::mutex> lck(mMutex);
+        mValid = mValid && (data != NULL) &&
+            byteAt(*data, 10) == (unsigned char)(id.rawData()[0] + 10);
+        mFinished++;
+        mCV.notify_one();
+    }
+
+    void getAndWait(CacheLayer* layer, const Fingerprint& id) {
+        boost::unique_lock<boost::mutex> lck(mMutex);
+        int target = mFinished + 1;
+        lck.unlock();
+        layer->getData(id, Range(true), std::tr1::bind(&DiskCacheLayerTest::gotData, this, id, std::tr1::placeholders::_1));
+        lck.lock();
+        while(mFinished < target)
+            mCV.wait(lck);
+    }
+
+public:
+    void setUp() {
+        mDir = Path::Get(Path::DIR_TEMP, "DiskCacheLayerTest");
+        boost::filesystem::remove_all(mDir);
+        mFinished = 0;
+        mValid = true;
+    }
+
+    void tearDown() {
+        boost::filesystem::remove_all(mDir);
+    }
+
+    void testBlobStoreRoundTrip() {
+        Fingerprint a = Fingerprint::computeDigest("a"), b = Fingerprint::computeDigest("b");
+        BlobStore store(mDir);
+        std::vector<BlobStore::Entry> entries;
+        TS_ASSERT(store.open(&entries));
+        TS_ASSERT(entries.empty());
+
+        TS_ASSERT(store.put(a, *makeData(0, 100, true, 1)));
+        TS_ASSERT(store.put(b, *makeData(0, 60, false, 2)));
+        TS_ASSERT(store.put(b, *makeData(50, 50, false, 3)));
+        TS_ASSERT_EQUALS(store.liveBytes(), (uint64)210);
+
+        SparseData whole;
+        TS_ASSERT(store.get(a, Range(true), &whole));
+        TS_ASSERT_EQUALS(byteAt(whole, 99), 1);
+
+        SparseData part;
+        TS_ASSERT(store.get(b, Range(20, 60, LENGTH), &part));
+        TS_ASSERT_EQUALS(byteAt(part, 20), 2);
+        TS_ASSERT_EQUALS(byteAt(part, 70), 3);
+
+        // Only part of b is stored
+        SparseData missing;
+        TS_ASSERT(!store.get(b, Range(true), &missing));
+    }
+
+    void testBlobStoreReopen() {
+        Fingerprint a = Fingerprint::computeDigest("a");
+        {
+            BlobStore store(mDir);
+            TS_ASSERT(store.open(NULL));
+            TS_ASSERT(store.put(a, *makeData(10, 100, false, 7)));
+        }
+
+        BlobStore store(mDir);
+        std::vector<BlobStore::Entry> entries;
+        TS_ASSERT(store.open(&entries));
+        TS_ASSERT_EQUALS(entries.size(), (size_t)1);
+        if (entries.empty()) return;
+        TS_ASSERT_EQUALS(entries[0].id, a);
+        TS_ASSERT_EQUALS(entries[0].size, (cache_usize_type)100);
+        TS_ASSERT(Range(10, 100, LENGTH).isContainedBy(entries[0].ranges));
+
+        SparseData data;
+        TS_ASSERT(store.get(a, Range(10, 100, LENGTH), &data));
+        TS_ASSERT_EQUALS(byteAt(data, 109), 7);
+    }
+
+    void testBlobStoreCompact() {
+        Fingerprint a = Fingerprint::computeDigest("a"), b = Fingerprint::computeDigest("b");
+        BlobStore store(mDir);
+        TS_ASSERT(store.open(NULL));
+        TS_ASSERT(store.put(a, *makeData(0, 100, true, 1)));
+        TS_ASSERT(store.put(b, *makeData(0, 100, true, 2)));
+
+        SparseData before;
+        TS_ASSERT(store.get(b, Range(true), &before));
+
+        store.remove(a);
+        TS_ASSERT_EQUALS(store.liveBytes(), (uint64)100);
+        TS_ASSERT(store.compact());
+        TS_ASSERT_EQUALS(store.generation(), (uint32)1);
+        TS_ASSERT(store.totalBytes() < 200);
+
+        // Views from before compaction are still valid
+        TS_ASSERT_EQUALS(byteAt(before, 50), 2);
+
+        SparseData after;
+        TS_ASSERT(store.get(b, Range(true), &after));
+        TS_ASSERT_EQUALS(byteAt(after, 50), 2);
+        SparseData removed;
+        TS_ASSERT(!store.get(a, Range(true), &removed));
+
+        // And the compacted generation is the one that gets reopened
+        BlobStore reopened(mDir);
+        std::vector<BlobStore::Entry> entries;
+        TS_ASSERT(reopened.open(&entries));
+        TS_ASSERT_EQUALS(entries.size(), (size_t)1);
+        TS_ASSERT_EQUALS(reopened.generation(), (uint32)1);
+    }
+
+    void testBlobStoreTornIndex() {
+        Fingerprint a = Fingerprint::computeDigest("a");
+        {
+            BlobStore store(mDir);
+            TS_ASSERT(store.open(NULL));
+            TS_ASSERT(store.put(a, *makeData(0, 100, true, 1)));
+        }
+
+        // Simulate a crash in the middle of appending a record
+        String index = (boost::filesystem::path(mDir) / "blobs.0.idx").string();
+        uint64 index_size = boost::filesystem::file_size(index);
+        FILE* fp = fopen(index.c_str(), "ab");
+        TS_ASSERT(fp != NULL);
+        if (fp == NULL) return;
+        fwrite("partial record", 1, 14, fp);
+        fclose(fp);
+
+        BlobStore store(mDir);
+        std::vector<BlobStore::Entry> entries;
+        TS_ASSERT(store.open(&entries));
+        TS_ASSERT_EQUALS(entries.size(), (size_t)1);
+        TS_ASSERT_EQUALS(boost::filesystem::file_size(index), index_size);
+        SparseData data;
+        TS_ASSERT(store.get(a, Range(true), &data));
+    }
+
+    void testBlobStoreBatchesIndex() {
+        String index = (boost::filesystem::path(mDir) / "blobs.0.idx").string();
+        BlobStore store(mDir);
+        TS_ASSERT(store.open(NULL));
+        uint64 empty_size = boost::filesystem::file_size(index);
+
+        // Records wait for sync() or a full batch
+        for(uint32 i = 0; i < 10; i++)
+            TS_ASSERT(store.put(Fingerprint::computeDigest(boost::lexical_cast<String>(i)), *makeData(0, 100, true, i)));
+        TS_ASSERT_EQUALS(boost::filesystem::file_size(index), empty_size);
+        store.sync();
+        uint64 synced_size = boost::filesystem::file_size(index);
+        TS_ASSERT(synced_size > empty_size);
+
+        for(uint32 i = 0; i < BlobStore::MaxPendingRecords; i++)
+            TS_ASSERT(store.put(Fingerprint::computeDigest("a"), *makeData(0, 10, true, 1)));
+        TS_ASSERT(boost::filesystem::file_size(index) > synced_size);
+
+        BlobStore reopened(mDir);
+        std::vector<BlobStore::Entry> entries;
+        TS_ASSERT(reopened.open(&entries));
+        TS_ASSERT_EQUALS(entries.size(), (size_t)11);
+    }
+
+    void testBlobStoreRemovesLegacyFiles() {
+        boost::filesystem::create_directories(mDir);
+        String hex = Fingerprint::computeDigest("a").convertToHexString();
+        const char* names[] = { "", ".part", ".ranges", ".ranges.temp" };
+        for(uint32 i = 0; i < 4; i++) {
+            FILE* fp = fopen((boost::filesystem::path(mDir) / (hex + names[i])).string().c_str(), "wb");
+            TS_ASSERT(fp != NULL);
+            if (fp) fclose(fp);
+        }
+        // Unrelated files are left alone
+        String other = (boost::filesystem::path(mDir) / "notes.txt").string();
+        FILE* fp = fopen(other.c_str(), "wb");
+        if (fp) fclose(fp);
+
+        BlobStore store(mDir);
+        TS_ASSERT(store.open(NULL));
+        for(uint32 i = 0; i < 4; i++)
+            TS_ASSERT(!boost::filesystem::exists(boost::filesystem::path(mDir) / (hex + names[i])));
+        TS_ASSERT(boost::filesystem::exists(other));
+    }
+
+    void testDiskCacheLayerPersists() {
+        LRUPolicy policy(1024*1024);
+        DiskCacheTestSource source;
+        Fingerprint a = Fingerprint::computeDigest("a");
+
+        {
+            DiskCacheLayer layer(&policy, mDir, &source);
+            getAndWait(&layer, a);
+            TS_ASSERT_EQUALS(source.requests, 1);
+            // Destroying the layer waits for the queued write to finish
+        }
+
+        // A new layer over the same store finds the data without asking the
+        // source
+        LRUPolicy reopened_policy(1024*1024);
+        DiskCacheLayer layer(&reopened_policy, mDir, &source);
+        getAndWait(&layer, a);
+        TS_ASSERT_EQUALS(source.requests, 1);
+        TS_ASSERT(mValid);
+    }
+};
@@ -35,6 +35,7 @@
 
 #include <sirikata/core/util/Platform.hpp>
 #include <sirikata/core/queue/FairQueue.hpp>
+#include <sirikata/core/queue/DRRFairQueue.hpp>
 #include <cxxtest/TestSuite.h>
 
 class FairQueueTest : public CxxTest::TestSuite
@@ -136,6 +137,153 @@ public:
         ASSERT_FAIR_QUEUE_POP(test_queue, 0, 2); // t = 8
         ASSERT_FAIR_QUEUE_POP(test_queue, 2, 8); // t = 9
     }
+
+    typedef Sirikata::AbstractFairQueue<SizedElem, Sirikata::uint32, SizedElemQueue> AbstractSizedElemFairQueue;
+    typedef Sirikata::FairQueue<SizedElem, Sirikata::uint32, SizedElemQueue> WFQSizedElemQueue;
+    typedef Sirikata::DRRFairQueue<SizedElem, Sirikata::uint32, SizedElemQueue> DRRSizedElemQueue;
+
+    // Keeps every queue backlogged with elements of the given sizes, refilling
+    // a queue each time an element is popped from it, and returns the number
+    // of bytes popped for each key. Queues start with two elements so they
+    // never run dry, which would reset their DRR deficit.
+    static std::vector<Sirikata::uint32> backloggedShares(
+        AbstractSizedElemFairQueue* test_queue,
+        const std::vector<float>& weights, const std::vector<Sirikata::uint32>& sizes,
+        Sirikata::uint32 num_pops)
+    {
+        for(Sirikata::uint32 i = 0; i < weights.size(); i++) {
+            test_queue->addQueue(new SizedElemQueue(1 << 28), i, weights[i]);
+            test_queue->push(i, new SizedElem(sizes[i]));
+            test_queue->push(i, new SizedElem(sizes[i]));
+        }
+
+        std::vector<Sirikata::uint32> bytes(weights.size(), 0);
+        for(Sirikata::uint32 n = 0; n < num_pops; n++) {
+            Sirikata::uint32 key;
+            SizedElem* result = test_queue->pop(&key);
+            TS_ASSERT(result != NULL);
+            if (result == NULL) break;
+            bytes[key] += result->val;
+            delete result;
+            test_queue->push(key, new SizedElem(sizes[key]));
+        }
+        return bytes;
+    }
+
+    // Equal weights and sizes should give the same plain round robin order
+    // from both implementations
+    void testDRRRoundRobinMatchesFairQueue(void) {
+        WFQSizedElemQueue wfq;
+        DRRSizedElemQueue drr;
+        AbstractSizedElemFairQueue* queues[2] = { &wfq, &drr };
+
+        for(int q = 0; q < 2; q++) {
+            for(Sirikata::uint32 key = 0; key < 3; key++)
+                queues[q]->addQueue(new SizedElemQueue(1 << 28), key, 1.f);
+            for(Sirikata::uint32 i = 0; i < 4; i++)
+                for(Sirikata::uint32 key = 0; key < 3; key++)
+                    queues[q]->push(key, new SizedElem(10));
+        }
+
+        for(Sirikata::uint32 i = 0; i < 12; i++) {
+            Sirikata::uint32 wfq_key, drr_key;
+            SizedElem* wfq_result = wfq.pop(&wfq_key);
+            SizedElem* drr_result = drr.pop(&drr_key);
+            TS_ASSERT(wfq_result != NULL);
+            TS_ASSERT(drr_result != NULL);
+            TS_ASSERT_EQUALS(wfq_key, drr_key);
+            delete wfq_result;
+            delete drr_result;
+        }
+        TS_ASSERT(wfq.empty());
+        TS_ASSERT(drr.empty());
+        TS_ASSERT(drr.pop() == NULL);
+    }
+
+    // Over a long backlogged run both implementations should divide bytes
+    // between queues in proportion to their weights
+    void testDRRWeightedSharesMatchFairQueue(void) {
+        std::vector<float> weights;
+        weights.push_back(1.f); weights.push_back(2.f); weights.push_back(4.f); weights.push_back(0.5f);
+        std::vector<Sirikata::uint32> sizes;
+        sizes.push_back(100); sizes.push_back(37); sizes.push_back(250); sizes.push_back(64);
+
+        WFQSizedElemQueue wfq;
+        DRRSizedElemQueue drr;
+        std::vector<Sirikata::uint32> wfq_bytes = backloggedShares(&wfq, weights, sizes, 20000);
+        std::vector<Sirikata::uint32> drr_bytes = backloggedShares(&drr, weights, sizes, 20000);
+
+        double wfq_total = 0, drr_total = 0, weight_total = 0;
+        for(Sirikata::uint32 i = 0; i < weights.size(); i++) {
+            wfq_total += wfq_bytes[i];
+            drr_total += drr_bytes[i];
+            weight_total += weights[i];
+        }
+        for(Sirikata::uint32 i = 0; i < weights.size(); i++) {
+            double expected = weights[i] / weight_total;
+            TS_ASSERT_DELTA(wfq_bytes[i] / wfq_total, expected, 0.02);
+            TS_ASSERT_DELTA(drr_bytes[i] / drr_total, expected, 0.02);
+        }
+    }
+
+    // Weight changes take effect for queues which are already backlogged
+    void testDRRSetQueueWeight(void) {
+        std::vector<float> weights(2, 1.f);
+        std::vector<Sirikata::uint32> sizes(2, 10);
+
+        DRRSizedElemQueue drr;
+        std::vector<Sirikata::uint32> bytes = backloggedShares(&drr, weights, sizes, 1000);
+        TS_ASSERT_DELTA(bytes[0] / (double)(bytes[0] + bytes[1]), 0.5, 0.01);
+
+        drr.setQueueWeight(1, 3.f);
+        TS_ASSERT_EQUALS(drr.getQueueWeight(1), 3.f);
+        TS_ASSERT_EQUALS(drr.avg_weight(), 2.f);
+
+        Sirikata::uint32 bytes_after[2] = { 0, 0 };
+        for(Sirikata::uint32 n = 0; n < 4000; n++) {
+            Sirikata::uint32 key = 0;
+            SizedElem* result = drr.pop(&key);
+            bytes_after[key] += result->val;
+            delete result;
+            drr.push(key, new SizedElem(10));
+        }
+        TS_ASSERT_DELTA(bytes_after[1] / (double)(bytes_after[0] + bytes_after[1]), 0.75, 0.01);
+    }
+
+    // Disabled queues are skipped but still count as non-empty, and front()
+    // doesn't change until pop()
+    void testDRREnableDisable(void) {
+        DRRSizedElemQueue test_queue;
+
+        test_queue.addQueue(new SizedElemQueue(1 << 28), 0, 1.f);
+        test_queue.addQueue(new SizedElemQueue(1 << 28), 1, 1.f);
+        TS_ASSERT(test_queue.empty());
+
+        test_queue.push(0, new SizedElem(5));
+        test_queue.push(1, new SizedElem(5));
+        test_queue.push(1, new SizedElem(5));
+
+        test_queue.disableQueue(0);
+        Sirikata::uint32 key;
+        SizedElem* front = test_queue.front(&key);
+        TS_ASSERT_EQUALS(key, 1u);
+        TS_ASSERT_EQUALS(test_queue.front(&key), front);
+        ASSERT_FAIR_QUEUE_POP(test_queue, 1, 5);
+        ASSERT_FAIR_QUEUE_POP(test_queue, 1, 5);
+
+        TS_ASSERT(test_queue.front(&key) == NULL);
+        TS_ASSERT(!test_queue.empty());
+
+        test_queue.enableQueue(0);
+        ASSERT_FAIR_QUEUE_POP(test_queue, 0, 5);
+        TS_ASSERT(test_queue.empty());
+
+        test_queue.push(1, new SizedElem(5));
+        TS_ASSERT(test_queue.removeQueue(1));
+        TS_ASSERT(!test_queue.hasQueue(1));
+        TS_ASSERT_EQUALS(test_queue.numQueues(), 1u);
+        TS_ASSERT(test_queue.empty());
+    }
 };
 
 #endif //_SIRIKATA_FAIR_QUEUE_TEST_HPP_
@@ -0,0 +1,96 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/network/MessageBatch.hpp>
+
+using namespace Sirikata;
+using namespace Sirikata::Network;
+
+class MessageBatchTest : public CxxTest::TestSuite
+{
+    static String toString(const MemoryReference& ref) {
+        return String((const char*)ref.data(), ref.size());
+    }
+
+    // Read all messages in data, returning false if any bytes were left over
+    static bool readAll(const MemoryReference& data, std::vector<String>* result) {
+        MessageBatchReader reader(data.data(), data.size());
+        MemoryReference msg = MemoryReference::null();
+        while(reader.next(&msg))
+            result->push_back(toString(msg));
+        return reader.remaining() == 0;
+    }
+
+public:
+    void testRoundTrip() {
+        std::vector<String> msgs;
+        msgs.push_back("first");
+        msgs.push_back(String(300, 'x')); // Needs a two byte length
+        msgs.push_back("");
+        msgs.push_back("last");
+
+        MessageBatchWriter writer;
+        for(uint32 i = 0; i < msgs.size(); i++)
+            writer.append(msgs[i].data(), msgs[i].size());
+        TS_ASSERT_EQUALS(writer.count(), msgs.size());
+
+        std::vector<String> read;
+        TS_ASSERT(readAll(writer.data(), &read));
+        TS_ASSERT_EQUALS(read.size(), msgs.size());
+        for(uint32 i = 0; i < read.size() && i < msgs.size(); i++)
+            TS_ASSERT_EQUALS(read[i], msgs[i]);
+    }
+
+    // A single message is written without framing, so it's readable by peers
+    // which don't understand batches
+    void testSingleMessageUnframed() {
+        MessageBatchWriter writer;
+        String msg("\x08\x01", 2);
+        memcpy(writer.append(msg.size()), msg.data(), msg.size());
+        TS_ASSERT_EQUALS(toString(writer.data()), msg);
+
+        std::vector<String> read;
+        TS_ASSERT(readAll(writer.data(), &read));
+        TS_ASSERT_EQUALS(read.size(), 1u);
+    }
+
+    void testRemoveLast() {
+        MessageBatchWriter writer;
+        writer.append("abc", 3);
+        writer.append("defg", 4);
+        writer.removeLast();
+        TS_ASSERT_EQUALS(writer.count(), 1u);
+        TS_ASSERT_EQUALS(toString(writer.data()), String("abc"));
+
+        writer.append("hi", 2);
+        std::vector<String> read;
+        TS_ASSERT(readAll(writer.data(), &read));
+        TS_ASSERT_EQUALS(read.size(), 2u);
+        if (read.size() == 2)
+            TS_ASSERT_EQUALS(read[1], String("hi"));
+
+        writer.clear();
+        writer.append("x", 1);
+        writer.removeLast();
+        TS_ASSERT(writer.empty());
+        TS_ASSERT_EQUALS(writer.size(), 0u);
+    }
+
+    void testTruncated() {
+        MessageBatchWriter writer;
+        writer.append("abc", 3);
+        writer.append("defg", 4);
+        MemoryReference data = writer.data();
+
+        // Chop off the end of the last message
+        MessageBatchReader reader(data.data(), data.size() - 2);
+        MemoryReference msg = MemoryReference::null();
+        TS_ASSERT(reader.next(&msg));
+        TS_ASSERT_EQUALS(toString(msg), String("abc"));
+        TS_ASSERT(!reader.next(&msg));
+    }
+};
@@ -240,11 +240,11 @@ class SIRIKATA_EXPORT BaseDatagramLayer<Mock::ID>
         mMock->unlisten(ep.endPoint, ep.port);
     }
 
-    void send(EndPoint<EndPointType>* src, EndPoint<EndPointType>* dest, void* data, int len) {
+    void send(EndPoint<EndPointType>* src, EndPoint<EndPointType>* dest, const SegmentBufferPtr& packet) {
         mMock->send(
             src->endPoint, src->port,
             dest->endPoint, dest->port,
-            data, len
+            packet->data(), packet->size()
         );
     }
 
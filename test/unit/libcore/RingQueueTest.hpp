@@ -0,0 +1,166 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+
+#include <sirikata/core/queue/RingQueue.hpp>
+#include <sirikata/core/queue/SizedThreadSafeQueue.hpp>
+#include <sirikata/core/queue/CountResourceMonitor.hpp>
+#include <sirikata/core/util/Thread.hpp>
+
+using namespace Sirikata;
+
+class RingQueueTest : public CxxTest::TestSuite
+{
+    // Number of elements each producer pushes in the threaded tests
+    static const uint32 PER_PRODUCER = 100000;
+
+    template<typename QueueType>
+    static void produce(QueueType* queue, uint32 producer) {
+        for(uint32 i = 0; i < PER_PRODUCER; i++)
+            queue->push(producer * PER_PRODUCER + i + 1);
+    }
+
+    // Pops until total elements have been consumed across all consumers,
+    // checking that each producer's elements arrive in order.
+    template<typename QueueType>
+    static void consume(QueueType* queue, AtomicValue<uint32>* consumed, uint32 total, uint32 nproducers, uint64* sum, bool* ordered) {
+        std::vector<uint32> last(nproducers, 0);
+        uint32 value = 0;
+        while(consumed->read() < total) {
+            if (!queue->pop(value)) {
+                Thread::yield();
+                continue;
+            }
+            ++(*consumed);
+            *sum += value;
+            uint32 producer = (value - 1) / PER_PRODUCER;
+            if (value <= last[producer]) *ordered = false;
+            last[producer] = value;
+        }
+    }
+
+    template<typename QueueType>
+    void runThreaded(QueueType* queue, uint32 nproducers, uint32 nconsumers) {
+        uint32 total = nproducers * PER_PRODUCER;
+        AtomicValue<uint32> consumed(0);
+        std::vector<uint64> sums(nconsumers, 0);
+        bool* ordered = new bool[nconsumers];
+
+        std::vector<Thread*> threads;
+        for(uint32 i = 0; i < nconsumers; i++) {
+            ordered[i] = true;
+            threads.push_back(new Thread("RingQueueTest Consumer", std::tr1::bind(&RingQueueTest::consume<QueueType>, queue, &consumed, total, nproducers, &sums[i], &ordered[i])));
+        }
+        for(uint32 i = 0; i < nproducers; i++)
+            threads.push_back(new Thread("RingQueueTest Producer", std::tr1::bind(&RingQueueTest::produce<QueueType>, queue, i)));
+        for(uint32 i = 0; i < threads.size(); i++) {
+            threads[i]->join();
+            delete threads[i];
+        }
+
+        uint64 sum = 0;
+        for(uint32 i = 0; i < nconsumers; i++) {
+            sum += sums[i];
+            TS_ASSERT(ordered[i]);
+        }
+        TS_ASSERT_EQUALS(sum, ((uint64)total * (total + 1)) / 2);
+        TS_ASSERT(queue->probablyEmpty());
+        delete[] ordered;
+    }
+
+public:
+    void testPushPopOrder() {
+        MPMCRingQueue<int> queue(8);
+        int value = 0;
+        TS_ASSERT(!queue.pop(value));
+        for(int i = 0; i < 5; i++)
+            queue.push(i);
+        for(int i = 0; i < 5; i++) {
+            TS_ASSERT(queue.pop(value));
+            TS_ASSERT_EQUALS(value, i);
+        }
+        TS_ASSERT(!queue.pop(value));
+        TS_ASSERT(queue.probablyEmpty());
+    }
+
+    // Fill the queue, check it refuses more, and keep cycling through it so
+    // positions wrap around the ring several times.
+    void testFullAndWrap() {
+        MPMCRingQueue<int> queue(5);
+        TS_ASSERT_EQUALS(queue.capacity(), 8u);
+        int next_push = 0, next_pop = 0, value = 0;
+        for(int lap = 0; lap < 10; lap++) {
+            while(queue.tryPush(next_push))
+                next_push++;
+            TS_ASSERT_EQUALS(queue.size(), 8);
+            for(int i = 0; i < 5; i++) {
+                TS_ASSERT(queue.pop(value));
+                TS_ASSERT_EQUALS(value, next_pop);
+                next_pop++;
+            }
+        }
+        while(queue.pop(value)) {
+            TS_ASSERT_EQUALS(value, next_pop);
+            next_pop++;
+        }
+        TS_ASSERT_EQUALS(next_pop, next_push);
+    }
+
+    void testSPSCFullAndWrap() {
+        SPSCRingQueue<int> queue(4);
+        int next_push = 0, next_pop = 0, value = 0;
+        for(int lap = 0; lap < 10; lap++) {
+            while(queue.tryPush(next_push))
+                next_push++;
+            TS_ASSERT_EQUALS(queue.size(), 4);
+            for(int i = 0; i < 3; i++) {
+                TS_ASSERT(queue.pop(value));
+                TS_ASSERT_EQUALS(value, next_pop);
+                next_pop++;
+            }
+        }
+        std::deque<int> rest;
+        queue.popAll(&rest);
+        TS_ASSERT_EQUALS((int)rest.size(), next_push - next_pop);
+        TS_ASSERT(queue.probablyEmpty());
+    }
+
+    // Popping should release the queue's reference to the element
+    void testPopReleases() {
+        MPMCRingQueue<std::tr1::shared_ptr<int> > queue;
+        std::tr1::shared_ptr<int> elem(new int(5));
+        queue.push(elem);
+        TS_ASSERT_EQUALS(elem.use_count(), 2);
+        std::tr1::shared_ptr<int> popped;
+        TS_ASSERT(queue.pop(popped));
+        popped.reset();
+        TS_ASSERT_EQUALS(elem.use_count(), 1);
+    }
+
+    void testSizedThreadSafeQueue() {
+        SizedThreadSafeQueue<int, CountResourceMonitor, MPMCRingQueue<int> > queue(CountResourceMonitor(4));
+        TS_ASSERT(queue.push(1, false));
+        TS_ASSERT(queue.push(2, false));
+        TS_ASSERT(queue.push(3, false));
+        TS_ASSERT(!queue.push(4, false));
+        int value = 0;
+        TS_ASSERT(queue.pop(value));
+        TS_ASSERT_EQUALS(value, 1);
+        std::deque<int> rest;
+        queue.popAll(&rest);
+        TS_ASSERT_EQUALS(rest.size(), 2u);
+        TS_ASSERT(queue.probablyEmpty());
+    }
+
+    void testMPMCThreaded() {
+        MPMCRingQueue<uint32> queue(64);
+        runThreaded(&queue, 4, 4);
+    }
+
+    void testSPSCThreaded() {
+        SPSCRingQueue<uint32> queue(64);
+        runThreaded(&queue, 1, 1);
+    }
+};
@@ -0,0 +1,195 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+
+#include <sirikata/core/network/SSTDatagramBatcher.hpp>
+#include <sirikata/core/network/IOService.hpp>
+#include <sirikata/core/network/IOStrand.hpp>
+#include <sirikata/core/service/Context.hpp>
+
+using namespace Sirikata;
+using namespace Sirikata::SST;
+
+class SSTDatagramBatcherTest : public CxxTest::TestSuite
+{
+    typedef EndPoint<SpaceObjectReference> Endpoint;
+    typedef DatagramBatcher<SpaceObjectReference> Batcher;
+
+    struct Datagram {
+        Endpoint dest;
+        String data;
+        const void* ptr; // Where the data was sent from
+    };
+    typedef std::vector<Datagram> DatagramList;
+
+    Network::IOService* _ios;
+    Network::IOStrand* _mainStrand;
+    Context* _ctx;
+
+    Endpoint _src;
+    Endpoint _dest;
+    Endpoint _other_dest;
+    DatagramList _datagrams;
+
+    void collect(const Endpoint& src, const Endpoint& dest, const MemoryReference& data) {
+        Datagram dg;
+        dg.dest = dest;
+        dg.data = String((const char*)data.data(), data.size());
+        dg.ptr = data.data();
+        _datagrams.push_back(dg);
+    }
+
+    Batcher::Ptr createBatcher(uint32 max_packets) {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        using std::tr1::placeholders::_3;
+        return Batcher::create(
+            _ctx,
+            std::tr1::bind(&SSTDatagramBatcherTest::collect, this, _1, _2, _3),
+            max_packets, Duration::zero()
+        );
+    }
+
+    static SegmentBufferPtr makePacket(const String& data) {
+        SegmentBufferPtr packet(SegmentBuffer::allocate());
+        packet->append(data.data(), data.size());
+        return packet;
+    }
+
+    static std::vector<String> readAll(const String& datagram) {
+        std::vector<String> result;
+        DatagramBatchReader reader(datagram.data(), datagram.size());
+        MemoryReference packet = MemoryReference::null();
+        while(reader.next(&packet))
+            result.push_back(String((const char*)packet.data(), packet.size()));
+        return result;
+    }
+
+public:
+    SSTDatagramBatcherTest()
+     : _ios(NULL),
+       _mainStrand(NULL),
+       _ctx(NULL),
+       _src(SpaceObjectReference(SpaceID(UUID::random()), ObjectReference(UUID::random())), 1),
+       _dest(SpaceObjectReference(SpaceID(UUID::random()), ObjectReference(UUID::random())), 2),
+       _other_dest(SpaceObjectReference(SpaceID(UUID::random()), ObjectReference(UUID::random())), 3)
+    {}
+
+    void setUp() {
+        // The context is never run. Flushes posted to the main strand are
+        // run by polling the IOService from the test thread.
+        _ios = new Network::IOService("SSTDatagramBatcherTest Service");
+        _mainStrand = _ios->createStrand("SSTDatagramBatcherTest Main Strand");
+        _ctx = new Context("sst batcher test", _ios, _mainStrand, NULL, Timer::now());
+        _datagrams.clear();
+    }
+
+    void tearDown() {
+        delete _ctx;
+        _ctx = NULL;
+        delete _mainStrand;
+        _mainStrand = NULL;
+        delete _ios;
+        _ios = NULL;
+    }
+
+    // With batching disabled, each packet is sent immediately, straight from
+    // its buffer
+    void testDisabled() {
+        Batcher::Ptr batcher = createBatcher(1);
+        SegmentBufferPtr a = makePacket("first"), b = makePacket("second");
+        batcher->send(_src, _dest, a);
+        batcher->send(_src, _dest, b);
+        TS_ASSERT_EQUALS(_datagrams.size(), (size_t)2);
+        if (_datagrams.size() != 2) return;
+        TS_ASSERT_EQUALS(_datagrams[0].data, String("first"));
+        TS_ASSERT_EQUALS(_datagrams[0].ptr, (const void*)a->data());
+        TS_ASSERT_EQUALS(_datagrams[1].data, String("second"));
+        TS_ASSERT_EQUALS(_datagrams[1].ptr, (const void*)b->data());
+    }
+
+    // Full batches are sent immediately and split back into the original
+    // packets
+    void testFullBatch() {
+        Batcher::Ptr batcher = createBatcher(4);
+        std::vector<String> packets;
+        for(uint32 i = 0; i < 4; i++) {
+            packets.push_back(String(200 + i, 'a' + i));
+            batcher->send(_src, _dest, makePacket(packets.back()));
+            TS_ASSERT_EQUALS(_datagrams.size(), (size_t)(i < 3 ? 0 : 1));
+        }
+        if (_datagrams.size() != 1) return;
+        TS_ASSERT(readAll(_datagrams[0].data) == packets);
+    }
+
+    // Partial batches wait for the flush posted to the main strand. A lone
+    // packet is sent straight from its buffer, without any framing.
+    void testLonePacketFlush() {
+        Batcher::Ptr batcher = createBatcher(4);
+        SegmentBufferPtr packet = makePacket("lone packet");
+        batcher->send(_src, _dest, packet);
+        TS_ASSERT(_datagrams.empty());
+
+        _ios->poll();
+        TS_ASSERT_EQUALS(_datagrams.size(), (size_t)1);
+        if (_datagrams.size() != 1) return;
+        TS_ASSERT_EQUALS(_datagrams[0].data, String("lone packet"));
+        TS_ASSERT_EQUALS(_datagrams[0].ptr, (const void*)packet->data());
+    }
+
+    // Packets for different endpoints end up in different batches
+    void testSeparateEndpoints() {
+        Batcher::Ptr batcher = createBatcher(4);
+        batcher->send(_src, _dest, makePacket("a1"));
+        batcher->send(_src, _other_dest, makePacket("b1"));
+        batcher->send(_src, _dest, makePacket("a2"));
+        batcher->flush();
+
+        TS_ASSERT_EQUALS(_datagrams.size(), (size_t)2);
+        for(uint32 i = 0; i < _datagrams.size(); i++) {
+            std::vector<String> packets = readAll(_datagrams[i].data);
+            if (_datagrams[i].dest == _dest) {
+                TS_ASSERT_EQUALS(packets.size(), (size_t)2);
+                if (packets.size() == 2) {
+                    TS_ASSERT_EQUALS(packets[0], String("a1"));
+                    TS_ASSERT_EQUALS(packets[1], String("a2"));
+                }
+            }
+            else {
+                TS_ASSERT(_datagrams[i].dest == _other_dest);
+                TS_ASSERT_EQUALS(packets.size(), (size_t)1);
+                TS_ASSERT_EQUALS(_datagrams[i].data, String("b1"));
+            }
+        }
+    }
+
+    // Batches never grow past MAX_BATCH_BYTES
+    void testBatchBytesLimit() {
+        Batcher::Ptr batcher = createBatcher(100);
+        uint32 npackets = 20;
+        for(uint32 i = 0; i < npackets; i++)
+            batcher->send(_src, _dest, makePacket(String(1000, 'a' + i)));
+        batcher->flush();
+
+        TS_ASSERT(_datagrams.size() > 1);
+        uint32 received = 0;
+        for(uint32 i = 0; i < _datagrams.size(); i++) {
+            TS_ASSERT(_datagrams[i].data.size() <= (size_t)Batcher::MAX_BATCH_BYTES);
+            std::vector<String> packets = readAll(_datagrams[i].data);
+            for(uint32 j = 0; j < packets.size(); j++, received++)
+                TS_ASSERT_EQUALS(packets[j], String(1000, 'a' + received));
+        }
+        TS_ASSERT_EQUALS(received, npackets);
+    }
+
+    // Flushes posted for a batcher which has since been destroyed are ignored
+    void testDestroyedBeforeFlush() {
+        Batcher::Ptr batcher = createBatcher(4);
+        batcher->send(_src, _dest, makePacket("dropped"));
+        batcher.reset();
+        _ios->poll();
+        TS_ASSERT(_datagrams.empty());
+    }
+};
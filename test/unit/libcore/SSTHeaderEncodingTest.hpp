@@ -0,0 +1,63 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+
+#include <sirikata/core/network/SSTImpl.hpp>
+
+using namespace Sirikata;
+using namespace Sirikata::SST;
+using namespace Sirikata::Protocol::SST;
+
+class SSTHeaderEncodingTest : public CxxTest::TestSuite
+{
+    static SegmentBufferPtr makePayload(const String& data) {
+        SegmentBufferPtr buf(SegmentBuffer::allocate());
+        buf->append(data.data(), data.size());
+        return buf;
+    }
+
+    static String contents(const SegmentBufferPtr& buf) {
+        return String((const char*)buf->data(), buf->size());
+    }
+
+public:
+    // The keys are (field << 3) | 2, for the field numbers in SSTHeader.pbj
+    void testPayloadFieldKey() {
+        TS_ASSERT_EQUALS(payloadFieldKey<SSTChannelHeader>(), String(1, (char)0x2A));
+        TS_ASSERT_EQUALS(payloadFieldKey<SSTStreamHeader>(), String(1, (char)0x52));
+    }
+
+    // Encoding in place has to produce exactly what PBJ would
+    void testEncodeMatchesPBJ() {
+        // Long enough that the payload length needs a multi-byte varint
+        String data(300, 'x');
+
+        SSTStreamHeader stream_msg;
+        stream_msg.set_lsid(1);
+        stream_msg.set_type(SSTStreamHeader::DATA);
+        stream_msg.set_flags(0);
+        stream_msg.set_window(15);
+        stream_msg.set_src_port(10);
+        stream_msg.set_dest_port(11);
+        stream_msg.set_bsn(12345);
+        SSTStreamHeader stream_copy(stream_msg);
+        SegmentBufferPtr buf = encodeHeaderWithPayload(stream_msg, makePayload(data));
+        TS_ASSERT(buf);
+        stream_copy.set_payload(data.data(), data.size());
+        String stream_expected = serializePBJMessage(stream_copy);
+        TS_ASSERT_EQUALS(contents(buf), stream_expected);
+
+        SSTChannelHeader channel_msg;
+        channel_msg.set_channel_id(7);
+        channel_msg.set_transmit_sequence_number(300);
+        channel_msg.set_ack_count(1);
+        channel_msg.set_ack_sequence_number(299);
+        SSTChannelHeader channel_copy(channel_msg);
+        buf = encodeHeaderWithPayload(channel_msg, buf);
+        TS_ASSERT(buf);
+        channel_copy.set_payload(stream_expected.data(), stream_expected.size());
+        TS_ASSERT_EQUALS(contents(buf), serializePBJMessage(channel_copy));
+    }
+};
@@ -0,0 +1,92 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+
+#include <sirikata/core/network/SSTImpl.hpp>
+
+using namespace Sirikata;
+
+class SSTOutstandingSegmentListTest : public CxxTest::TestSuite
+{
+    typedef Sirikata::SST::OutstandingSegmentList OutstandingSegmentList;
+    typedef Sirikata::SST::ChannelSegment ChannelSegment;
+    typedef OutstandingSegmentList::SegmentPtr ChannelSegmentPtr;
+    static ChannelSegmentPtr makeSegment(uint64 seqno) {
+        return ChannelSegmentPtr(new ChannelSegment("x", 1, seqno, 0));
+    }
+
+public:
+    // Acks in the order packets were sent
+    void testOutstandingSegmentListInOrder() {
+        OutstandingSegmentList osl;
+        for(uint64 seqno = 1; seqno <= 10; seqno++)
+            osl.push_back(makeSegment(seqno));
+        TS_ASSERT_EQUALS(osl.size(), (size_t)10);
+        for(uint64 seqno = 1; seqno <= 10; seqno++) {
+            ChannelSegmentPtr seg = osl.erase(seqno);
+            TS_ASSERT(seg);
+            if (seg) TS_ASSERT_EQUALS(seg->mChannelSequenceNumber, seqno);
+        }
+        TS_ASSERT(osl.empty());
+    }
+
+    // Acks out of order, for missing entries and for entries acked twice
+    void testOutstandingSegmentListOutOfOrder() {
+        OutstandingSegmentList osl;
+        // Gaps are sequence numbers used by acks, which are never outstanding
+        osl.push_back(makeSegment(2));
+        osl.push_back(makeSegment(3));
+        osl.push_back(makeSegment(5));
+        osl.push_back(makeSegment(8));
+        TS_ASSERT(!osl.erase(1));
+        TS_ASSERT(!osl.erase(4));
+        TS_ASSERT(!osl.erase(9));
+        TS_ASSERT(osl.erase(5));
+        TS_ASSERT(!osl.erase(5));
+        TS_ASSERT(osl.erase(2));
+        TS_ASSERT_EQUALS(osl.beginSequenceNumber(), (uint64)3);
+        TS_ASSERT(osl.erase(3));
+        TS_ASSERT_EQUALS(osl.beginSequenceNumber(), (uint64)8);
+        TS_ASSERT_EQUALS(osl.size(), (size_t)1);
+        osl.clear();
+        TS_ASSERT(osl.empty());
+        TS_ASSERT(!osl.erase(8));
+    }
+
+    // Full sized window (MAX_QUEUED_SEGMENTS) with sparse sequence numbers,
+    // forcing the ring to grow while segments are outstanding, then
+    // acknowledged in cumulative ranges.
+    void testOutstandingSegmentListLargeWindow() {
+        OutstandingSegmentList osl;
+        const uint64 window = 3000;
+        for(uint64 i = 0; i < window; i++)
+            osl.push_back(makeSegment(1000 + i*2));
+        TS_ASSERT_EQUALS(osl.size(), (size_t)window);
+        TS_ASSERT_EQUALS(osl.beginSequenceNumber(), (uint64)1000);
+        TS_ASSERT_EQUALS(osl.endSequenceNumber(), (uint64)(1000 + (window-1)*2 + 1));
+
+        // Ack every other segment individually, from the back
+        uint64 acked = 0;
+        for(uint64 i = window; i > 0; i -= 2) {
+            if (osl.erase(1000 + (i-1)*2)) acked++;
+        }
+        TS_ASSERT_EQUALS(acked, window/2);
+        TS_ASSERT_EQUALS(osl.size(), (size_t)(window - acked));
+
+        // Then clear out the rest as ranges of sequence numbers
+        for(uint64 seqno = 1000; seqno < 1000 + window*2; seqno += 100) {
+            for(uint64 r = seqno; r < seqno + 100; r++)
+                if (osl.erase(r)) acked++;
+        }
+        TS_ASSERT_EQUALS(acked, window);
+        TS_ASSERT(osl.empty());
+
+        // And make sure we can keep going after the list drains
+        osl.push_back(makeSegment(1000 + window*2 + 5));
+        TS_ASSERT_EQUALS(osl.beginSequenceNumber(), (uint64)(1000 + window*2 + 5));
+        TS_ASSERT(osl.erase(1000 + window*2 + 5));
+        TS_ASSERT(osl.empty());
+    }
+};
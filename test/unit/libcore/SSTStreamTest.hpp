@@ -0,0 +1,263 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include "MockSST.hpp"
+
+#include <sirikata/core/service/Context.hpp>
+#include <sirikata/core/network/IOService.hpp>
+#include <sirikata/core/network/IOWork.hpp>
+#include <sirikata/core/trace/Trace.hpp>
+#include <sirikata/core/queue/ThreadSafeQueue.hpp>
+#include <sirikata/core/options/CommonOptions.hpp>
+
+using namespace Sirikata;
+
+/** Tests of SST stream behavior over a lossless, zero delay mock channel.
+ *  Unlike SSTTest, these don't depend on timing, so they're run with the
+ *  rest of the unit tests.
+ */
+class SSTStreamTest : public CxxTest::TestSuite
+{
+    Trace::Trace* _trace;
+    Network::IOService* _ios;
+    Network::IOStrand* _mainStrand;
+    Network::IOWork* _work;
+    Context* _ctx;
+
+    Mock::Service* _mock_service;
+    Mock::ConnectionManager* _conn_mgr;
+
+    ThreadSafeQueue<String> _events;
+
+    Mock::ID _receiver;
+    Mock::ID _sender;
+
+    String _payload;
+    // Only accessed from the receiving stream's read callbacks and the main
+    // strand, which only runs on one thread
+    String _received;
+    uint32 _reads;
+    // Same, for the stream read with a ReadVectorCallback
+    String _received_vector;
+    uint32 _vector_reads;
+
+    bool waitForEvent(const String& evt, Duration timeout) {
+        String read_evt;
+        bool got_event = _events.blockingPop(read_evt, timeout);
+        TS_ASSERT(got_event);
+        if (!got_event) return false;
+        TS_ASSERT_EQUALS(evt, read_evt);
+        return (evt == read_evt);
+    }
+
+    void onConnectReadOnce(int err, Mock::Stream::Ptr s) {
+        if (err != SST_IMPL_SUCCESS) return;
+        registerReadOnce(s);
+    }
+    void registerReadOnce(Mock::Stream::Ptr s) {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        s->registerReadCallback(
+            std::tr1::bind(&SSTStreamTest::onReadOnce, this, s, _1, _2)
+        );
+    }
+    // Takes one chunk of data, then stops listening until the main strand
+    // gets around to registering again, so data piles up in the receive
+    // buffer and wraps around its end.
+    void onReadOnce(Mock::Stream::Ptr s, uint8* data, int size) {
+        _received.append((const char*)data, size);
+        _reads++;
+        s->registerReadCallback(0);
+
+        if (_received.size() >= _payload.size()) {
+            _events.push("received");
+            return;
+        }
+        _ctx->mainStrand->post(
+            Duration::milliseconds(1),
+            std::tr1::bind(&SSTStreamTest::registerReadOnce, this, s)
+        );
+    }
+
+    void onConnectReadVectorOnce(int err, Mock::Stream::Ptr s) {
+        if (err != SST_IMPL_SUCCESS) return;
+        registerReadVectorOnce(s);
+    }
+    void registerReadVectorOnce(Mock::Stream::Ptr s) {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        s->registerReadVectorCallback(
+            std::tr1::bind(&SSTStreamTest::onReadVectorOnce, this, s, _1, _2)
+        );
+    }
+    // Like onReadOnce, but the data that piles up is delivered in one call,
+    // split in two wherever it wraps around the end of the receive buffer.
+    void onReadVectorOnce(Mock::Stream::Ptr s, const MemoryReference& first, const MemoryReference& second) {
+        _received_vector.append((const char*)first.data(), first.size());
+        _received_vector.append((const char*)second.data(), second.size());
+        _vector_reads++;
+        s->registerReadVectorCallback(0);
+
+        if (_received_vector.size() >= _payload.size()) {
+            _events.push("received");
+            return;
+        }
+        _ctx->mainStrand->post(
+            Duration::milliseconds(1),
+            std::tr1::bind(&SSTStreamTest::registerReadVectorOnce, this, s)
+        );
+    }
+
+    void onConnectSend(int err, Mock::Stream::Ptr s) {
+        if (err != SST_IMPL_SUCCESS) return;
+        writePayload(s, 0);
+    }
+    void writePayload(Mock::Stream::Ptr s, uint32 from) {
+        from += s->write((const uint8*)_payload.data() + from, _payload.size() - from);
+        if (from == _payload.size()) return;
+        _ctx->mainStrand->post(
+            Duration::milliseconds(1),
+            std::tr1::bind(&SSTStreamTest::writePayload, this, s, from)
+        );
+    }
+
+public:
+    SSTStreamTest()
+     : _trace(NULL),
+       _ios(NULL),
+       _mainStrand(NULL),
+       _work(NULL),
+       _ctx(NULL),
+       _mock_service(NULL),
+       _conn_mgr(NULL),
+       _receiver("a"),
+       _sender("b"),
+       _reads(0),
+       _vector_reads(0)
+    {}
+
+    void setUp() {
+        std::deque<String> empty_evts;
+        _events.swap(empty_evts);
+        _received.clear();
+        _reads = 0;
+        _received_vector.clear();
+        _vector_reads = 0;
+
+        _trace = new Trace::Trace("dummy.trace");
+        _ios = new Network::IOService("SSTStreamTest Service");
+        _mainStrand = _ios->createStrand("SSTStreamTest Main Strand");
+        _work = new Network::IOWork(*_ios, "SSTStreamTest IOWork");
+        _ctx = new Context("sst stream test", _ios, _mainStrand, _trace, Timer::now());
+
+        _mock_service = new Mock::Service(_ctx);
+        _mock_service->setMaxOutstandingPackets(0);
+        _conn_mgr = new Mock::ConnectionManager();
+
+        _ctx->add(_ctx);
+        _ctx->add(_conn_mgr);
+
+        _conn_mgr->createDatagramLayer(_receiver, _ctx, _mock_service);
+        _conn_mgr->createDatagramLayer(_sender, _ctx, _mock_service);
+
+        // A single thread keeps all the callbacks serialized
+        _ctx->run(1, Context::AllNew);
+    }
+
+    void tearDown() {
+        delete _work;
+        _work = NULL;
+
+        _ctx->shutdown();
+        _trace->prepareShutdown();
+
+        delete _ctx;
+        _ctx = NULL;
+
+        _trace->shutdown();
+        delete _trace;
+        _trace = NULL;
+
+        delete _mainStrand;
+        _mainStrand = NULL;
+        delete _ios;
+        _ios = NULL;
+
+        // See SSTTest::tearDown for why these come last
+        delete _conn_mgr;
+        _conn_mgr = NULL;
+        delete _mock_service;
+        _mock_service = NULL;
+    }
+
+    // A read callback which unregisters itself must not lose the part of the
+    // data that wrapped around the end of the receive buffer
+    void testReadCallbackUnregisters() {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+
+        // Several times the receive buffer, and not a multiple of the segment
+        // size, so reads wrap around the end of the buffer
+        uint32 window = GetOptionValue<uint32>(OPT_SST_DEFAULT_WINDOW_SIZE);
+        _payload.resize(window * 4 + 7);
+        for(uint32 i = 0; i < _payload.size(); i++)
+            _payload[i] = (char)(i % 251);
+
+        _conn_mgr->listen(
+            std::tr1::bind(&SSTStreamTest::onConnectReadOnce, this, _1, _2),
+            Mock::Endpoint(_receiver, 1)
+        );
+        _conn_mgr->connectStream(
+            Mock::Endpoint(_sender, 1),
+            Mock::Endpoint(_receiver, 1),
+            std::tr1::bind(&SSTStreamTest::onConnectSend, this, _1, _2)
+        );
+
+        if (!waitForEvent("received", Duration::seconds(15))) return;
+        TS_ASSERT_EQUALS(_received.size(), _payload.size());
+        TS_ASSERT(_received == _payload);
+        TS_ASSERT(_reads > 1);
+    }
+
+    // Vectored reads must deliver the same bytes, in the same order, as the
+    // single buffer callback does for the same data
+    void testReadVectorCallback() {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+
+        uint32 window = GetOptionValue<uint32>(OPT_SST_DEFAULT_WINDOW_SIZE);
+        _payload.resize(window * 4 + 7);
+        for(uint32 i = 0; i < _payload.size(); i++)
+            _payload[i] = (char)(i % 251);
+
+        // The same payload to two receiving streams, one using each kind of
+        // callback
+        _conn_mgr->listen(
+            std::tr1::bind(&SSTStreamTest::onConnectReadOnce, this, _1, _2),
+            Mock::Endpoint(_receiver, 1)
+        );
+        _conn_mgr->listen(
+            std::tr1::bind(&SSTStreamTest::onConnectReadVectorOnce, this, _1, _2),
+            Mock::Endpoint(_receiver, 2)
+        );
+        _conn_mgr->connectStream(
+            Mock::Endpoint(_sender, 1),
+            Mock::Endpoint(_receiver, 1),
+            std::tr1::bind(&SSTStreamTest::onConnectSend, this, _1, _2)
+        );
+        _conn_mgr->connectStream(
+            Mock::Endpoint(_sender, 2),
+            Mock::Endpoint(_receiver, 2),
+            std::tr1::bind(&SSTStreamTest::onConnectSend, this, _1, _2)
+        );
+
+        if (!waitForEvent("received", Duration::seconds(15))) return;
+        if (!waitForEvent("received", Duration::seconds(15))) return;
+        TS_ASSERT_EQUALS(_received_vector.size(), _payload.size());
+        TS_ASSERT(_received_vector == _payload);
+        TS_ASSERT(_received_vector == _received);
+        TS_ASSERT(_vector_reads > 1);
+    }
+};
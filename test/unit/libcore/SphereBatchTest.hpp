@@ -0,0 +1,129 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/util/SphereBatch.hpp>
+#include <sirikata/core/util/Random.hpp>
+
+using namespace Sirikata;
+
+class SphereBatchTest : public CxxTest::TestSuite
+{
+    Time mEpoch;
+
+    TimedMotionVector3f randomMotion(float32 world_size, float32 speed) {
+        return TimedMotionVector3f(
+            mEpoch + Duration::milliseconds((int64)(randFloat() * 1000)),
+            MotionVector3f(
+                Vector3f(randFloat(-world_size, world_size), randFloat(-world_size, world_size), randFloat(-world_size, world_size)),
+                Vector3f(randFloat(-speed, speed), randFloat(-speed, speed), randFloat(-speed, speed))
+            )
+        );
+    }
+
+    void fillRandom(SphereBatch* batch, uint32 n) {
+        for(uint32 i = 0; i < n; i++) {
+            float32 radius = randFloat() * 5.f;
+            batch->add(randomMotion(100.f, 10.f), radius, radius * (1.f + randFloat()));
+        }
+    }
+
+    // Checks cull and cullScalar make the same decisions and that they match
+    // checking each object individually with SolidAngle.
+    void checkQuery(const SphereBatch& batch, const Time& t, const SphereBatchQuery& query) {
+        std::vector<uint32> simd_results, scalar_results;
+        uint32 simd_count = batch.cull(t, query, &simd_results);
+        uint32 scalar_count = batch.cullScalar(t, query, &scalar_results);
+        TS_ASSERT_EQUALS(simd_count, simd_results.size());
+        TS_ASSERT_EQUALS(scalar_count, scalar_results.size());
+        TS_ASSERT(simd_results == scalar_results);
+
+        std::vector<uint32> expected;
+        for(uint32 i = 0; i < batch.size(); i++) {
+            Vector3f pos = batch.position(i, t);
+            float32 center_dist = (pos - query.center()).length() - query.regionRadius();
+            float32 dist = (center_dist > 0.f) ? center_dist : 0.f;
+            bool pass = true;
+            if (query.hasMaxDistance())
+                pass = pass && (dist - batch.radius(i) <= query.maxDistance());
+            if (query.hasMinAngle())
+                pass = pass && (query.minAngle().lessThanEqualDistanceSqRadius(dist*dist, batch.maxSize(i)) >= 0);
+            if (pass) expected.push_back(i);
+        }
+        TS_ASSERT(scalar_results == expected);
+    }
+
+public:
+    void setUp() {
+        mEpoch = Time::null() + Duration::seconds(1000);
+    }
+
+    void testRandomBatches() {
+        SphereBatch batch(mEpoch);
+        // Odd sizes so the scalar tail of cull is exercised as well
+        fillRandom(&batch, 1003);
+        Time t = mEpoch + Duration::seconds(2.5f);
+
+        SolidAngle angles[] = { SolidAngle::Min, SolidAngle(0.0001f), SolidAngle(0.01f), SolidAngle(0.5f), SolidAngle::Max };
+        float32 distances[] = { SphereBatchQuery::NoMaxDistance, 0.f, 10.f, 50.f };
+        for(uint32 q = 0; q < 50; q++) {
+            Vector3f center(randFloat(-100.f, 100.f), randFloat(-100.f, 100.f), randFloat(-100.f, 100.f));
+            float32 region_radius = (q % 2 == 0) ? 0.f : randFloat() * 20.f;
+            for(uint32 ai = 0; ai < sizeof(angles)/sizeof(angles[0]); ai++)
+                for(uint32 di = 0; di < sizeof(distances)/sizeof(distances[0]); di++)
+                    checkQuery(batch, t, SphereBatchQuery(center, region_radius, distances[di], angles[ai]));
+        }
+    }
+
+    void testEdgeCases() {
+        SphereBatch batch(mEpoch);
+        Vector3f center(10.f, 0.f, 0.f);
+        // Inside the query region, exactly at its surface, zero sized, and
+        // moving onto the query position.
+        batch.add(TimedMotionVector3f(mEpoch, MotionVector3f(center, Vector3f(0,0,0))), 1.f, 1.f);
+        batch.add(TimedMotionVector3f(mEpoch, MotionVector3f(Vector3f(15.f, 0.f, 0.f), Vector3f(0,0,0))), 1.f, 1.f);
+        batch.add(TimedMotionVector3f(mEpoch, MotionVector3f(Vector3f(20.f, 0.f, 0.f), Vector3f(0,0,0))), 0.f, 0.f);
+        batch.add(TimedMotionVector3f(mEpoch, MotionVector3f(Vector3f(0.f, 0.f, 0.f), Vector3f(1.f,0,0))), 0.5f, 0.5f);
+        batch.add(TimedMotionVector3f(mEpoch, MotionVector3f(Vector3f(1000.f, 0.f, 0.f), Vector3f(0,0,0))), 1.f, 1.f);
+
+        Time t = mEpoch + Duration::seconds(10.f);
+        float32 distances[] = { SphereBatchQuery::NoMaxDistance, 0.f, 5.f };
+        SolidAngle angles[] = { SolidAngle::Min, SolidAngle(0.1f), SolidAngle::Max };
+        for(uint32 di = 0; di < sizeof(distances)/sizeof(distances[0]); di++)
+            for(uint32 ai = 0; ai < sizeof(angles)/sizeof(angles[0]); ai++)
+                checkQuery(batch, t, SphereBatchQuery(center, 5.f, distances[di], angles[ai]));
+
+        // With a zero max distance, the objects inside, touching, and moved
+        // onto the query region pass and the far away ones don't.
+        std::vector<uint32> results;
+        batch.cull(t, SphereBatchQuery(center, 5.f, 0.f, SolidAngle::Min), &results);
+        TS_ASSERT_EQUALS(results.size(), 3u);
+        if (results.size() == 3) {
+            TS_ASSERT_EQUALS(results[0], 0u);
+            TS_ASSERT_EQUALS(results[1], 1u);
+            TS_ASSERT_EQUALS(results[2], 3u);
+        }
+    }
+
+    void testRemoveAndRebase() {
+        SphereBatch batch(mEpoch);
+        fillRandom(&batch, 64);
+        while(batch.size() > 17)
+            batch.remove(randInt<uint32>(0, batch.size()-1));
+        TS_ASSERT_EQUALS(batch.size(), 17u);
+
+        Time t = mEpoch + Duration::seconds(30.f);
+        batch.rebase(t);
+        TS_ASSERT_EQUALS(batch.epoch(), t);
+        SphereBatchQuery query(Vector3f(0,0,0), 0.f, 40.f, SolidAngle(0.01f));
+        checkQuery(batch, t, query);
+        checkQuery(batch, t + Duration::seconds(1.f), query);
+
+        batch.clear();
+        TS_ASSERT(batch.empty());
+        std::vector<uint32> results;
+        TS_ASSERT_EQUALS(batch.cull(t, query, &results), 0u);
+    }
+};
@@ -51,6 +51,7 @@
 #include <sirikata/core/options/CommonOptions.hpp>
 
 #include <string>
+#include <boost/lexical_cast.hpp>
 
 using namespace Sirikata;
 using boost::asio::ip::tcp;
@@ -67,6 +68,9 @@ public:
     boost::mutex mNumCbsMutex;
     int mNumCbs;
 
+    Transfer::DenseDataPtr mFullData;
+    std::vector< std::tr1::shared_ptr<Transfer::HttpManager::HttpResponse> > mCoalescedResponses;
+
     std::string mCdnHost;
     std::string mCdnService;
     std::string mCdnDnsUriPrefix;
@@ -598,6 +602,124 @@ public:
 
     }
 
+    void testPipelinedAndCoalescedRequests() {
+
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        using std::tr1::placeholders::_3;
+
+        Network::Address addr(mCdnHost, mCdnService);
+        boost::unique_lock<boost::mutex> lock(mMutex);
+
+        /*
+         * Get the whole file first to compare pieces against
+         */
+        Transfer::HttpManager::Headers headers;
+        headers["Host"] = mCdnHost;
+
+        SILOG(transfer, debug, "Issuing get file request");
+        Transfer::HttpManager::getSingleton().get(
+            addr, mCdnDownloadUriPrefix + "/" + mHashTest1,
+            std::tr1::bind(&HttpTransferTest::request_finished, this, _1, _2, _3),
+            headers
+        );
+        mDone.wait(lock);
+
+        TS_ASSERT(mHttpResponse);
+        if (!mHttpResponse || !mHttpResponse->getData()) return;
+        mFullData = mHttpResponse->getData();
+        TS_ASSERT(mFullData->length() == (uint64)mHashTest1Size);
+
+        /*
+         * Issue a bunch of different range requests on persistent
+         * connections all at once, so some are pipelined if
+         * http.pipeline-depth allows it, and make sure each gets its own
+         * response. Half of them are compressed to check that
+         * decompression doesn't run into the next response.
+         */
+        mNumCbs = 30;
+        for(int i=0; i<30; i++) {
+            headers.clear();
+            headers["Host"] = mCdnHost;
+            headers["Range"] = "bytes=" + boost::lexical_cast<String>(i*1000) + "-" + boost::lexical_cast<String>(i*1000+999);
+            if (i % 2 == 0)
+                headers["Accept-Encoding"] = "deflate, gzip";
+
+            SILOG(transfer, debug, "Issuing range get file request #" << i+1);
+            Transfer::HttpManager::getSingleton().get(
+                addr, mCdnDownloadUriPrefix + "/" + mHashTest1,
+                std::tr1::bind(&HttpTransferTest::range_request_finished, this, i*1000, _1, _2, _3),
+                headers
+            );
+        }
+        mDone.wait(lock);
+
+        /*
+         * Identical requests issued together should share a single response
+         */
+        mCoalescedResponses.clear();
+        mNumCbs = 10;
+        for(int i=0; i<10; i++) {
+            headers.clear();
+            headers["Host"] = mCdnHost;
+
+            SILOG(transfer, debug, "Issuing identical head file request #" << i+1);
+            Transfer::HttpManager::getSingleton().head(
+                addr, mCdnDownloadUriPrefix + "/" + mHashTest1,
+                std::tr1::bind(&HttpTransferTest::coalesced_request_finished, this, _1, _2, _3),
+                headers
+            );
+        }
+        mDone.wait(lock);
+
+        TS_ASSERT(mCoalescedResponses.size() == 10);
+        for(uint32 i = 1; i < mCoalescedResponses.size(); i++)
+            TS_ASSERT(mCoalescedResponses[i] == mCoalescedResponses[0]);
+
+        mFullData.reset();
+    }
+
+    void range_request_finished(uint32 offset, std::tr1::shared_ptr<Transfer::HttpManager::HttpResponse> response,
+        Transfer::HttpManager::ERR_TYPE error, const boost::system::error_code& boost_error) {
+
+        {
+            boost::unique_lock<boost::mutex> lock(mMutex);
+            TS_ASSERT(error == Transfer::HttpManager::SUCCESS);
+            TS_ASSERT(response);
+            if (error == Transfer::HttpManager::SUCCESS && response) {
+                TS_ASSERT(response->getData());
+                if (response->getData()) {
+                    TS_ASSERT(response->getData()->length() == 1000);
+                    TS_ASSERT(response->getData()->length() == (uint64)response->getContentLength());
+                    if (response->getData()->length() == 1000)
+                        TS_ASSERT(memcmp(response->getData()->data(), mFullData->dataAt(offset), 1000) == 0);
+                }
+            }
+        }
+
+        boost::unique_lock<boost::mutex> lock(mNumCbsMutex);
+        mNumCbs--;
+        if(mNumCbs == 0) {
+            mDone.notify_all();
+        }
+    }
+
+    void coalesced_request_finished(std::tr1::shared_ptr<Transfer::HttpManager::HttpResponse> response,
+        Transfer::HttpManager::ERR_TYPE error, const boost::system::error_code& boost_error) {
+
+        {
+            boost::unique_lock<boost::mutex> lock(mMutex);
+            TS_ASSERT(error == Transfer::HttpManager::SUCCESS);
+            mCoalescedResponses.push_back(response);
+        }
+
+        boost::unique_lock<boost::mutex> lock(mNumCbsMutex);
+        mNumCbs--;
+        if(mNumCbs == 0) {
+            mDone.notify_all();
+        }
+    }
+
     void multi_request_finished(std::tr1::shared_ptr<Transfer::HttpManager::HttpResponse> response,
         Transfer::HttpManager::ERR_TYPE error, const boost::system::error_code& boost_error) {
 
@@ -0,0 +1,266 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/oh/MeshPrefetchPlanner.hpp>
+#include <boost/lexical_cast.hpp>
+
+using namespace Sirikata;
+using namespace Sirikata::OH;
+
+class MeshPrefetchPlannerTest : public CxxTest::TestSuite
+{
+    typedef MeshPrefetchPlanner::RequestList RequestList;
+
+    SpaceID mSpace;
+    SpaceObjectReference mPresence;
+    Time mNow;
+
+    SpaceObjectReference object(uint32 id) {
+        return SpaceObjectReference(mSpace, ObjectReference(UUID(id)));
+    }
+
+    TimedMotionVector3f motion(const Vector3f& pos, const Vector3f& vel) {
+        return TimedMotionVector3f(mNow, MotionVector3f(pos, vel));
+    }
+
+    Time spaceTime(const SpaceID& space) {
+        return mNow;
+    }
+
+    MeshPrefetchPlanner::Options options(float64 horizon) {
+        MeshPrefetchPlanner::Options opts;
+        opts.horizon = Duration::seconds(horizon);
+        // Objects satisfy this at ~17.7 times their radius
+        opts.solidAngle = 0.01f;
+        opts.maxOutstanding = 4;
+        opts.maxCandidates = 100;
+        opts.maxPriority = 1.0;
+        return opts;
+    }
+
+    void plan(MeshPrefetchPlanner* planner, RequestList* requests) {
+        planner->plan(std::tr1::bind(&MeshPrefetchPlannerTest::spaceTime, this, std::tr1::placeholders::_1), *requests);
+    }
+
+    // Adds an object and removes it again, leaving it as a candidate with the
+    // given motion.
+    void addHidden(MeshPrefetchPlanner* planner, uint32 id, const String& mesh, const Vector3f& pos, const Vector3f& vel,
+        const AggregateBoundingInfo& bounds, const ObjectReference& parent = ObjectReference::null()) {
+        planner->objectAdded(mPresence, object(id), motion(pos, vel), bounds, mesh, parent, mNow);
+        planner->objectRemoved(mPresence, object(id), motion(pos, vel), bounds, mesh, mNow);
+    }
+
+public:
+    void setUp() {
+        mSpace = SpaceID(UUID((uint32)1));
+        mPresence = object(100);
+        mNow = Time::null() + Duration::seconds(1000);
+    }
+
+    void testTimeToReachInside() {
+        TS_ASSERT_EQUALS(MeshPrefetchPlanner::timeToReach(Vector3f(5, 0, 0), Vector3f(10, 0, 0), 10.f), 0);
+        TS_ASSERT_EQUALS(MeshPrefetchPlanner::timeToReach(Vector3f(10, 0, 0), Vector3f(0, 0, 0), 10.f), 0);
+    }
+
+    void testTimeToReachApproaching() {
+        TS_ASSERT_DELTA(MeshPrefetchPlanner::timeToReach(Vector3f(100, 0, 0), Vector3f(-10, 0, 0), 10.f), 9.0, 1e-6);
+        // Off axis, but passing close enough to get within range
+        TS_ASSERT_DELTA(MeshPrefetchPlanner::timeToReach(Vector3f(100, 6, 0), Vector3f(-10, 0, 0), 10.f), 9.2, 1e-5);
+    }
+
+    void testTimeToReachReceding() {
+        TS_ASSERT(MeshPrefetchPlanner::timeToReach(Vector3f(100, 0, 0), Vector3f(10, 0, 0), 10.f) < 0);
+        // Moving sideways only takes it further away
+        TS_ASSERT(MeshPrefetchPlanner::timeToReach(Vector3f(100, 0, 0), Vector3f(0, 10, 0), 10.f) < 0);
+    }
+
+    void testTimeToReachStationary() {
+        TS_ASSERT(MeshPrefetchPlanner::timeToReach(Vector3f(100, 0, 0), Vector3f(0, 0, 0), 10.f) < 0);
+    }
+
+    void testTimeToReachNearMiss() {
+        // Closest approach is 10.5, just outside the range
+        TS_ASSERT(MeshPrefetchPlanner::timeToReach(Vector3f(100, 10.5f, 0), Vector3f(-10, 0, 0), 10.f) < 0);
+    }
+
+    void testVisibleDistanceScale() {
+        // A hemisphere is only satisfied by touching the object
+        TS_ASSERT_DELTA(MeshPrefetchPlanner::visibleDistanceScale(2 * M_PI), 1.f, 1e-4);
+        // Small angles: omega ~= pi * (r/d)^2
+        TS_ASSERT_DELTA(MeshPrefetchPlanner::visibleDistanceScale(0.01f), sqrt(M_PI / 0.01), 0.05);
+        // Larger angles mean objects must be closer
+        TS_ASSERT(MeshPrefetchPlanner::visibleDistanceScale(0.1f) < MeshPrefetchPlanner::visibleDistanceScale(0.01f));
+        TS_ASSERT_DELTA(MeshPrefetchPlanner::timeToVisible(Vector3f(100, 0, 0), Vector3f(-10, 0, 0), 1.f, 2 * M_PI), 9.9, 1e-4);
+    }
+
+    void testReentryIsPrefetched() {
+        MeshPrefetchPlanner planner(options(10));
+        planner.presenceMoved(mPresence, motion(Vector3f(0, 0, 0), Vector3f(0, 0, 0)));
+        AggregateBoundingInfo bounds(Vector3f(0, 0, 0), 1.f);
+
+        // First sighting couldn't have been predicted
+        planner.objectAdded(mPresence, object(1), motion(Vector3f(10, 0, 0), Vector3f(0, 0, 0)), bounds, "meshdata://a", ObjectReference::null(), mNow);
+        TS_ASSERT_EQUALS(planner.stats().unpredicted, (uint64)1);
+
+        // Nothing to do while it's visible
+        RequestList requests;
+        plan(&planner, &requests);
+        TS_ASSERT_EQUALS(requests.size(), (size_t)0);
+
+        // It leaves, but is heading back and should be visible again in
+        // about (30 - 17.7) / 5 seconds
+        planner.objectRemoved(mPresence, object(1), motion(Vector3f(30, 0, 0), Vector3f(-5, 0, 0)), bounds, "meshdata://a", mNow);
+        plan(&planner, &requests);
+        TS_ASSERT_EQUALS(requests.size(), (size_t)1);
+        if (requests.empty()) return;
+        TS_ASSERT_EQUALS(requests[0].mesh, "meshdata://a");
+        TS_ASSERT_DELTA(requests[0].expected, 2.46, 0.05);
+        TS_ASSERT(requests[0].priority > 0 && requests[0].priority <= 1.0);
+        TS_ASSERT_EQUALS(planner.outstanding(), (uint32)1);
+
+        // Already being fetched, so not requested again
+        requests.clear();
+        plan(&planner, &requests);
+        TS_ASSERT_EQUALS(requests.size(), (size_t)0);
+
+        planner.fetchFinished("meshdata://a", true);
+        TS_ASSERT_EQUALS(planner.outstanding(), (uint32)0);
+        TS_ASSERT_EQUALS(planner.stats().completed, (uint64)1);
+
+        planner.objectAdded(mPresence, object(1), motion(Vector3f(15, 0, 0), Vector3f(-5, 0, 0)), bounds, "meshdata://a", ObjectReference::null(), mNow);
+        TS_ASSERT_EQUALS(planner.stats().hits, (uint64)1);
+        TS_ASSERT_EQUALS(planner.stats().used, (uint64)1);
+        TS_ASSERT_EQUALS(planner.stats().misses, (uint64)0);
+    }
+
+    void testLateAndMiss() {
+        MeshPrefetchPlanner planner(options(10));
+        planner.presenceMoved(mPresence, motion(Vector3f(0, 0, 0), Vector3f(0, 0, 0)));
+        AggregateBoundingInfo bounds(Vector3f(0, 0, 0), 1.f);
+
+        addHidden(&planner, 1, "meshdata://a", Vector3f(30, 0, 0), Vector3f(-5, 0, 0), bounds);
+        // Receding, so it won't be prefetched
+        addHidden(&planner, 2, "meshdata://b", Vector3f(30, 0, 0), Vector3f(5, 0, 0), bounds);
+        RequestList requests;
+        plan(&planner, &requests);
+        TS_ASSERT_EQUALS(requests.size(), (size_t)1);
+
+        planner.objectAdded(mPresence, object(1), motion(Vector3f(15, 0, 0), Vector3f(-5, 0, 0)), bounds, "meshdata://a", ObjectReference::null(), mNow);
+        planner.objectAdded(mPresence, object(2), motion(Vector3f(15, 0, 0), Vector3f(0, 0, 0)), bounds, "meshdata://b", ObjectReference::null(), mNow);
+        TS_ASSERT_EQUALS(planner.stats().late, (uint64)1);
+        TS_ASSERT_EQUALS(planner.stats().misses, (uint64)1);
+
+        // The download finishing after it became visible isn't a prefetch
+        planner.fetchFinished("meshdata://a", true);
+        TS_ASSERT_EQUALS(planner.outstanding(), (uint32)0);
+        TS_ASSERT_EQUALS(planner.stats().hits, (uint64)0);
+    }
+
+    void testHorizonAndLimit() {
+        MeshPrefetchPlanner planner(options(10));
+        planner.presenceMoved(mPresence, motion(Vector3f(0, 0, 0), Vector3f(0, 0, 0)));
+        AggregateBoundingInfo bounds(Vector3f(0, 0, 0), 1.f);
+
+        // Expected in 1..6 seconds
+        for(uint32 i = 1; i <= 6; i++)
+            addHidden(&planner, i, "meshdata://" + boost::lexical_cast<String>(i), Vector3f(17.72f + i * 5, 0, 0), Vector3f(-5, 0, 0), bounds);
+        // Too far away to reach within the horizon
+        addHidden(&planner, 7, "meshdata://7", Vector3f(200, 0, 0), Vector3f(-5, 0, 0), bounds);
+
+        RequestList requests;
+        plan(&planner, &requests);
+        TS_ASSERT_EQUALS(requests.size(), (size_t)4);
+        for(size_t i = 0; i < requests.size(); i++) {
+            TS_ASSERT_EQUALS(requests[i].mesh, "meshdata://" + boost::lexical_cast<String>(i+1));
+            if (i > 0)
+                TS_ASSERT(requests[i].priority <= requests[i-1].priority);
+        }
+
+        // Finishing one makes room for the next soonest
+        planner.fetchFinished("meshdata://1", true);
+        requests.clear();
+        plan(&planner, &requests);
+        TS_ASSERT_EQUALS(requests.size(), (size_t)1);
+        if (!requests.empty())
+            TS_ASSERT_EQUALS(requests[0].mesh, "meshdata://5");
+    }
+
+    void testAggregateChildren() {
+        // With a 5 second horizon the child is too far away to be expected on
+        // its own, but its aggregate will be refined in time.
+        MeshPrefetchPlanner planner(options(5));
+        planner.presenceMoved(mPresence, motion(Vector3f(0, 0, 0), Vector3f(5, 0, 0)));
+
+        SpaceObjectReference agg = object(1);
+        // Centers within 20 of (50,0,0), so refined at 20 + 17.7 away
+        addHidden(&planner, 1, "meshdata://agg", Vector3f(50, 0, 0), Vector3f(0, 0, 0), AggregateBoundingInfo(Vector3f(0, 0, 0), 20.f, 1.f));
+        addHidden(&planner, 2, "meshdata://child", Vector3f(65, 0, 0), Vector3f(0, 0, 0), AggregateBoundingInfo(Vector3f(0, 0, 0), 1.f), agg.object());
+        addHidden(&planner, 3, "meshdata://loner", Vector3f(65, 1, 0), Vector3f(0, 0, 0), AggregateBoundingInfo(Vector3f(0, 0, 0), 1.f));
+
+        RequestList requests;
+        plan(&planner, &requests);
+        TS_ASSERT_EQUALS(requests.size(), (size_t)2);
+        for(size_t i = 0; i < requests.size(); i++) {
+            TS_ASSERT(requests[i].mesh != "meshdata://loner");
+            TS_ASSERT_DELTA(requests[i].expected, 2.46, 0.05);
+        }
+    }
+
+    void testDroppedWhileFetching() {
+        MeshPrefetchPlanner planner(options(10));
+        planner.presenceMoved(mPresence, motion(Vector3f(0, 0, 0), Vector3f(0, 0, 0)));
+        AggregateBoundingInfo bounds(Vector3f(0, 0, 0), 1.f);
+
+        addHidden(&planner, 1, "meshdata://a", Vector3f(30, 0, 0), Vector3f(-5, 0, 0), bounds);
+        RequestList requests;
+        plan(&planner, &requests);
+        TS_ASSERT_EQUALS(requests.size(), (size_t)1);
+
+        // The object switched meshes, so nobody needs the download any more
+        planner.objectAdded(mPresence, object(1), motion(Vector3f(15, 0, 0), Vector3f(-5, 0, 0)), bounds, "meshdata://b", ObjectReference::null(), mNow);
+        std::vector<String> dropped;
+        planner.takeDropped(dropped);
+        TS_ASSERT_EQUALS(dropped.size(), (size_t)1);
+        TS_ASSERT_EQUALS(planner.outstanding(), (uint32)0);
+        // A late completion is ignored
+        planner.fetchFinished("meshdata://a", true);
+        TS_ASSERT_EQUALS(planner.stats().completed, (uint64)0);
+        TS_ASSERT_EQUALS(planner.outstanding(), (uint32)0);
+    }
+
+    void testWasted() {
+        MeshPrefetchPlanner planner(options(10));
+        planner.presenceMoved(mPresence, motion(Vector3f(0, 0, 0), Vector3f(0, 0, 0)));
+        AggregateBoundingInfo bounds(Vector3f(0, 0, 0), 1.f);
+
+        addHidden(&planner, 1, "meshdata://a", Vector3f(30, 0, 0), Vector3f(-5, 0, 0), bounds);
+        RequestList requests;
+        plan(&planner, &requests);
+        planner.fetchFinished("meshdata://a", true);
+
+        // It shows up with a different mesh, so the prefetched one was wasted
+        planner.objectAdded(mPresence, object(1), motion(Vector3f(15, 0, 0), Vector3f(-5, 0, 0)), bounds, "meshdata://b", ObjectReference::null(), mNow);
+        TS_ASSERT_EQUALS(planner.stats().wasted, (uint64)1);
+        TS_ASSERT_EQUALS(planner.stats().hits, (uint64)0);
+        TS_ASSERT_EQUALS(planner.numMeshes(), (uint32)1);
+    }
+
+    void testPresenceRemoved() {
+        MeshPrefetchPlanner planner(options(10));
+        planner.presenceMoved(mPresence, motion(Vector3f(0, 0, 0), Vector3f(0, 0, 0)));
+        AggregateBoundingInfo bounds(Vector3f(0, 0, 0), 1.f);
+
+        planner.objectAdded(mPresence, object(1), motion(Vector3f(10, 0, 0), Vector3f(0, 0, 0)), bounds, "meshdata://a", ObjectReference::null(), mNow);
+        planner.presenceRemoved(mPresence, mNow);
+        TS_ASSERT_EQUALS(planner.numPresences(), (uint32)0);
+
+        // A new presence heading towards it gets it prefetched
+        SpaceObjectReference other = object(101);
+        planner.presenceMoved(other, motion(Vector3f(-40, 0, 0), Vector3f(10, 0, 0)));
+        RequestList requests;
+        plan(&planner, &requests);
+        TS_ASSERT_EQUALS(requests.size(), (size_t)1);
+    }
+};
@@ -0,0 +1,273 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+
+#include <sirikata/pintoloc/ProxSimulationTraits.hpp>
+#include <sirikata/pintoloc/GridQueryHandler.hpp>
+#include <sirikata/core/util/Random.hpp>
+#include <prox/geom/BruteForceQueryHandler.hpp>
+#include <prox/base/LocationServiceCache.hpp>
+
+using namespace Sirikata;
+
+/** Checks GridQueryHandler against BruteForceQueryHandler. Both handlers
+ *  watch the same location cache and get the same queries, and after every
+ *  tick each query's results must match exactly.
+ */
+class GridQueryHandlerTest : public CxxTest::TestSuite
+{
+    typedef Prox::QueryHandler<ObjectProxSimulationTraits> QueryHandler;
+    typedef Prox::Query<ObjectProxSimulationTraits> Query;
+    typedef Prox::QueryEvent<ObjectProxSimulationTraits> QueryEvent;
+    typedef Prox::LocationUpdateListener<ObjectProxSimulationTraits> LocationUpdateListener;
+    typedef std::tr1::unordered_set<ObjectReference, ObjectReference::Hasher> ResultSet;
+
+    // Just enough of a location cache for flat query handlers. Objects can
+    // only be added and moved.
+    class TestLocationServiceCache : public Prox::LocationServiceCache<ObjectProxSimulationTraits> {
+    public:
+        void addObject(const ObjectReference& id, const TimedMotionVector3f& loc, float32 radius) {
+            ObjectData& data = mObjects[id];
+            data.location = loc;
+            data.radius = radius;
+            for(ListenerSet::iterator it = mListeners.begin(); it != mListeners.end(); it++)
+                (*it)->locationConnected(id, false, true, loc, BoundingSphere3f(Vector3f::zero(), radius), radius);
+        }
+
+        void updateLocation(const ObjectReference& id, const TimedMotionVector3f& loc) {
+            ObjectData& data = mObjects[id];
+            TimedMotionVector3f old_loc = data.location;
+            data.location = loc;
+            for(ListenerSet::iterator it = mListeners.begin(); it != mListeners.end(); it++)
+                (*it)->locationPositionUpdated(id, old_loc, loc);
+        }
+
+        virtual void addPlaceholderImposter(
+            const ObjectID& id,
+            const Vector3f& center_offset,
+            const float32 center_bounds_radius,
+            const float32 max_size,
+            const String& query_data,
+            const String& mesh
+        ) {
+        }
+
+        virtual Iterator startTracking(const ObjectID& id) {
+            ObjectMap::iterator it = mObjects.find(id);
+            assert(it != mObjects.end());
+            return Iterator( &(*it) );
+        }
+        virtual void stopTracking(const Iterator& id) {
+        }
+        virtual bool startRefcountTracking(const ObjectID& id) {
+            return true;
+        }
+        virtual void stopRefcountTracking(const ObjectID& id) {
+        }
+
+        virtual TimedMotionVector3f location(const Iterator& id) {
+            return extract(id).second.location;
+        }
+        virtual Vector3f centerOffset(const Iterator& id) {
+            return Vector3f::zero();
+        }
+        virtual float32 centerBoundsRadius(const Iterator& id) {
+            return extract(id).second.radius;
+        }
+        virtual float32 maxSize(const Iterator& id) {
+            return extract(id).second.radius;
+        }
+        virtual bool isLocal(const Iterator& id) {
+            return true;
+        }
+        String mesh(const Iterator& id) {
+            return "";
+        }
+        String queryData(const Iterator& id) {
+            return "";
+        }
+
+        virtual const ObjectReference& iteratorID(const Iterator& id) {
+            return extract(id).first;
+        }
+
+        virtual void addUpdateListener(LocationUpdateListener* listener) {
+            mListeners.insert(listener);
+        }
+        virtual void removeUpdateListener(LocationUpdateListener* listener) {
+            mListeners.erase(listener);
+        }
+
+    private:
+        struct ObjectData {
+            TimedMotionVector3f location;
+            float32 radius;
+        };
+        typedef std::tr1::unordered_map<ObjectReference, ObjectData, ObjectReference::Hasher> ObjectMap;
+        typedef std::tr1::unordered_set<LocationUpdateListener*> ListenerSet;
+
+        ObjectMap::value_type& extract(const Iterator& id) {
+            return *((ObjectMap::value_type*)id.data);
+        }
+
+        ObjectMap mObjects;
+        ListenerSet mListeners;
+    };
+
+    struct SceneObject {
+        ObjectReference id;
+        TimedMotionVector3f location;
+    };
+
+    TestLocationServiceCache* _loc_cache;
+    QueryHandler* _brute;
+    QueryHandler* _grid;
+    std::vector<Query*> _brute_queries;
+    std::vector<Query*> _grid_queries;
+    std::vector<ResultSet> _brute_results;
+    std::vector<ResultSet> _grid_results;
+    std::vector<SceneObject> _scene;
+    Time _time;
+
+    static Vector3f randomPosition(float32 half_width) {
+        return Vector3f(randFloat(-half_width, half_width), randFloat(-half_width, half_width), randFloat(-half_width, half_width));
+    }
+
+    static void applyEvents(Query* query, ResultSet& results) {
+        std::deque<QueryEvent> evts;
+        query->popEvents(evts);
+        while(!evts.empty()) {
+            const QueryEvent& evt = evts.front();
+            for(uint32 i = 0; i < evt.additions().size(); i++)
+                results.insert(evt.additions()[i].id());
+            for(uint32 i = 0; i < evt.removals().size(); i++)
+                results.erase(evt.removals()[i].id());
+            evts.pop_front();
+        }
+    }
+
+    void addObject(const Vector3f& pos, const Vector3f& vel, float32 radius) {
+        SceneObject obj;
+        obj.id = ObjectReference(UUID::random());
+        obj.location = TimedMotionVector3f(_time, MotionVector3f(pos, vel));
+        _scene.push_back(obj);
+        _loc_cache->addObject(obj.id, obj.location, radius);
+    }
+
+    void addQuery(const Vector3f& pos, const SolidAngle& angle, float32 radius) {
+        TimedMotionVector3f qloc(_time, MotionVector3f(pos, Vector3f::zero()));
+        BoundingSphere3f qregion(Vector3f::zero(), 0.f);
+        _brute_queries.push_back(_brute->registerQuery(qloc, qregion, 1.f, angle, radius));
+        _grid_queries.push_back(_grid->registerQuery(qloc, qregion, 1.f, angle, radius));
+        _brute_results.push_back(ResultSet());
+        _grid_results.push_back(ResultSet());
+    }
+
+    // Ticks both handlers and checks that every query has the same results.
+    // Returns the total number of results, so tests can make sure they're
+    // checking something.
+    uint32 tickAndCompare() {
+        _brute->tick(_time);
+        _grid->tick(_time);
+
+        uint32 total = 0;
+        for(uint32 i = 0; i < _brute_queries.size(); i++) {
+            applyEvents(_brute_queries[i], _brute_results[i]);
+            applyEvents(_grid_queries[i], _grid_results[i]);
+            TS_ASSERT_EQUALS(_grid_results[i].size(), _brute_results[i].size());
+            for(ResultSet::iterator it = _brute_results[i].begin(); it != _brute_results[i].end(); it++)
+                TS_ASSERT(_grid_results[i].find(*it) != _grid_results[i].end());
+            total += _brute_results[i].size();
+        }
+        return total;
+    }
+
+public:
+    GridQueryHandlerTest()
+     : _loc_cache(NULL),
+       _brute(NULL),
+       _grid(NULL)
+    {}
+
+    void setUp() {
+        srand(1234);
+        _time = Time::null() + Duration::seconds(100.f);
+
+        _loc_cache = new TestLocationServiceCache();
+        _brute = new Prox::BruteForceQueryHandler<ObjectProxSimulationTraits>();
+        _brute->initialize(_loc_cache, _loc_cache, false, false);
+        // Small cells relative to the scene, so queries cover many of them
+        _grid = new GridQueryHandler<ObjectProxSimulationTraits>(10.f);
+        _grid->initialize(_loc_cache, _loc_cache, false, false);
+    }
+
+    void tearDown() {
+        for(uint32 i = 0; i < _brute_queries.size(); i++) {
+            delete _brute_queries[i];
+            delete _grid_queries[i];
+        }
+        _brute_queries.clear();
+        _grid_queries.clear();
+        _brute_results.clear();
+        _grid_results.clear();
+        _scene.clear();
+
+        delete _grid;
+        _grid = NULL;
+        delete _brute;
+        _brute = NULL;
+        delete _loc_cache;
+        _loc_cache = NULL;
+    }
+
+    // Moving objects, some of which change direction every tick, against both
+    // solid angle and distance queries
+    void testMovingObjects() {
+        for(uint32 i = 0; i < 500; i++) {
+            Vector3f vel = (i % 2 == 0) ? randomPosition(20.f) : Vector3f::zero();
+            addObject(randomPosition(200.f), vel, randFloat(0.5f, 5.f));
+        }
+        for(uint32 i = 0; i < 10; i++)
+            addQuery(randomPosition(200.f), SolidAngle(0.01f), ObjectProxSimulationTraits::InfiniteRadius);
+        for(uint32 i = 0; i < 10; i++)
+            addQuery(randomPosition(200.f), SolidAngle::Min, 40.f);
+
+        uint32 total = 0;
+        for(uint32 ti = 0; ti < 20; ti++) {
+            _time += Duration::milliseconds((int64)100);
+            for(uint32 i = 0; i < _scene.size(); i += 2) {
+                if (randFloat() >= 0.2f) continue;
+                SceneObject& obj = _scene[i];
+                obj.location = TimedMotionVector3f(_time, MotionVector3f(obj.location.position(_time), randomPosition(20.f)));
+                _loc_cache->updateLocation(obj.id, obj.location);
+            }
+            total += tickAndCompare();
+        }
+        TS_ASSERT(total > 0);
+    }
+
+    // Objects far outside the range of cell coordinates mustn't break the
+    // grid for the rest of the objects
+    void testHugeCoordinates() {
+        for(uint32 i = 0; i < 100; i++)
+            addObject(randomPosition(100.f), Vector3f::zero(), 2.f);
+        // Well past 2^31 cells, but small enough that squared distances
+        // still fit in a float
+        addObject(Vector3f(1e15f, -1e15f, 0.f), Vector3f::zero(), 2.f);
+        addObject(Vector3f(-1e15f, 1e15f, 1e15f), Vector3f::zero(), 2.f);
+        addObject(Vector3f(0.f, 0.f, 0.f), Vector3f(1e15f, 0.f, 0.f), 2.f);
+
+        addQuery(Vector3f::zero(), SolidAngle(0.01f), ObjectProxSimulationTraits::InfiniteRadius);
+        addQuery(Vector3f::zero(), SolidAngle::Min, 50.f);
+        addQuery(Vector3f(1e15f, -1e15f, 0.f), SolidAngle::Min, 50.f);
+
+        uint32 total = 0;
+        for(uint32 ti = 0; ti < 3; ti++) {
+            _time += Duration::milliseconds((int64)100);
+            total += tickAndCompare();
+        }
+        TS_ASSERT(total > 0);
+    }
+};
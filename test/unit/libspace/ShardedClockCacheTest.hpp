@@ -0,0 +1,129 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+
+#include "../../../libspace/src/caches/ShardedClockCache.hpp"
+#include <sirikata/core/network/IOService.hpp>
+#include <sirikata/core/network/IOStrand.hpp>
+#include <sirikata/core/service/Context.hpp>
+#include <sirikata/core/util/Random.hpp>
+#include <sirikata/core/util/Timer.hpp>
+
+using namespace Sirikata;
+
+class ShardedClockCacheTest : public CxxTest::TestSuite
+{
+    typedef std::map<UUID, uint32> ReferenceMap;
+
+    Network::IOService* _ios;
+    Network::IOStrand* _mainStrand;
+    Context* _ctx;
+
+public:
+    ShardedClockCacheTest()
+     : _ios(NULL),
+       _mainStrand(NULL),
+       _ctx(NULL)
+    {}
+
+    void setUp() {
+        // The cache only needs the context for its sim time, which advances
+        // when the test calls simTime(), so the context is never run.
+        _ios = new Network::IOService("ShardedClockCacheTest Service");
+        _mainStrand = _ios->createStrand("ShardedClockCacheTest Main Strand");
+        _ctx = new Context("sharded clock cache test", _ios, _mainStrand, NULL, Timer::now());
+        _ctx->simTime();
+    }
+
+    void tearDown() {
+        delete _ctx;
+        _ctx = NULL;
+        delete _mainStrand;
+        _mainStrand = NULL;
+        delete _ios;
+        _ios = NULL;
+    }
+
+    // Random inserts, lookups and removals on a single shard, never exceeding
+    // its capacity so nothing gets evicted. Removals use backward shift
+    // deletion, and any entry it moves to the wrong slot, or loses, shows up
+    // as a lookup disagreeing with the reference map.
+    void testBackwardShiftDeletion() {
+        srand(42);
+        uint32 sizes[] = { 4, 8, 64 };
+        for(uint32 si = 0; si < sizeof(sizes)/sizeof(sizes[0]); si++) {
+            uint32 max_size = sizes[si];
+            ShardedClockCache cache(_ctx, max_size, 1, Duration::seconds(1000.f));
+
+            std::vector<UUID> keys;
+            for(uint32 i = 0; i < max_size; i++)
+                keys.push_back(UUID::random());
+
+            ReferenceMap reference;
+            for(uint32 op = 0; op < 20000; op++) {
+                const UUID& key = keys[rand() % keys.size()];
+                uint32 action = rand() % 3;
+                if (action == 0) {
+                    uint32 server = 1 + (rand() % 100);
+                    cache.insert(key, OSegEntry(server, 1.f));
+                    reference[key] = server;
+                }
+                else if (action == 1) {
+                    cache.remove(key);
+                    reference.erase(key);
+                }
+                else {
+                    const OSegEntry& result = cache.get(key);
+                    ReferenceMap::iterator it = reference.find(key);
+                    if (it == reference.end()) {
+                        TS_ASSERT(result.isNull());
+                    }
+                    else {
+                        TS_ASSERT_EQUALS(result.server(), it->second);
+                    }
+                }
+            }
+
+            TS_ASSERT_EQUALS(cache.stats().size, (uint32)reference.size());
+            TS_ASSERT_EQUALS(cache.stats().evictions, (uint64)0);
+            for(uint32 i = 0; i < keys.size(); i++) {
+                ReferenceMap::iterator it = reference.find(keys[i]);
+                const OSegEntry& result = cache.get(keys[i]);
+                if (it == reference.end())
+                    TS_ASSERT(result.isNull());
+                else
+                    TS_ASSERT_EQUALS(result.server(), it->second);
+            }
+        }
+    }
+
+    // When a shard is full, expired entries are dropped before any live entry
+    // is evicted, even though the live entries were all recently referenced.
+    void testExpiredEvictedFirst() {
+        ShardedClockCache cache(_ctx, 4, 1, Duration::milliseconds((int64)50));
+
+        UUID old_a = UUID::random(), old_b = UUID::random();
+        cache.insert(old_a, OSegEntry(1, 1.f));
+        cache.insert(old_b, OSegEntry(2, 1.f));
+
+        Timer::sleep(Duration::milliseconds((int64)100));
+        _ctx->simTime();
+
+        std::vector<UUID> fresh;
+        for(uint32 i = 0; i < 3; i++) {
+            fresh.push_back(UUID::random());
+            cache.insert(fresh.back(), OSegEntry(10 + i, 1.f));
+        }
+
+        ShardedClockCache::Stats st = cache.stats();
+        TS_ASSERT_EQUALS(st.size, (uint32)3);
+        TS_ASSERT_EQUALS(st.expired, (uint64)2);
+        TS_ASSERT_EQUALS(st.evictions, (uint64)0);
+        for(uint32 i = 0; i < fresh.size(); i++)
+            TS_ASSERT_EQUALS(cache.get(fresh[i]).server(), 10 + i);
+        TS_ASSERT(cache.get(old_a).isNull());
+        TS_ASSERT(cache.get(old_b).isNull());
+    }
+};